@@ -0,0 +1,93 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for bthread creation, scheduling and synchronization
+// (mutex wraps butex wait/wake underneath).
+
+#include <benchmark/benchmark.h>
+#include <bthread/bthread.h>
+
+namespace {
+
+void* dummy_bthread(void*) {
+    return NULL;
+}
+
+static void BM_BthreadStartBackgroundJoin(benchmark::State& state) {
+    for (auto _ : state) {
+        bthread_t th;
+        bthread_start_background(&th, NULL, dummy_bthread, NULL);
+        bthread_join(th, NULL);
+    }
+}
+BENCHMARK(BM_BthreadStartBackgroundJoin);
+
+static void BM_BthreadStartUrgentJoin(benchmark::State& state) {
+    for (auto _ : state) {
+        bthread_t th;
+        bthread_start_urgent(&th, NULL, dummy_bthread, NULL);
+        bthread_join(th, NULL);
+    }
+}
+BENCHMARK(BM_BthreadStartUrgentJoin);
+
+void* yielding_bthread(void* arg) {
+    const int n = (int)(intptr_t)arg;
+    for (int i = 0; i < n; ++i) {
+        bthread_yield();
+    }
+    return NULL;
+}
+
+// Two bthreads yielding to each other, measuring context switches.
+static void BM_BthreadYield(benchmark::State& state) {
+    const int kYieldsPerRound = 1000;
+    for (auto _ : state) {
+        bthread_t th[2];
+        for (size_t i = 0; i < 2; ++i) {
+            bthread_start_background(&th[i], NULL, yielding_bthread,
+                                     (void*)(intptr_t)kYieldsPerRound);
+        }
+        for (size_t i = 0; i < 2; ++i) {
+            bthread_join(th[i], NULL);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * kYieldsPerRound);
+}
+BENCHMARK(BM_BthreadYield);
+
+bthread_mutex_t g_mutex;
+int g_counter = 0;
+
+static void BM_BthreadMutex(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        bthread_mutex_init(&g_mutex, NULL);
+    }
+    for (auto _ : state) {
+        bthread_mutex_lock(&g_mutex);
+        ++g_counter;
+        bthread_mutex_unlock(&g_mutex);
+    }
+    if (state.thread_index() == 0) {
+        bthread_mutex_destroy(&g_mutex);
+    }
+}
+BENCHMARK(BM_BthreadMutex)->Threads(1)->Threads(4)->Threads(8);
+
+} // namespace
+
+BENCHMARK_MAIN();
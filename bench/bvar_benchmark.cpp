@@ -0,0 +1,69 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for bvar write paths. Every RPC bumps several bvars, so
+// the per-op cost (and its scalability across threads) matters.
+
+#include <benchmark/benchmark.h>
+#include <bvar/bvar.h>
+
+namespace {
+
+bvar::Adder<int64_t> g_adder;
+
+static void BM_BvarAdder(benchmark::State& state) {
+    for (auto _ : state) {
+        g_adder << 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BvarAdder)->Threads(1)->Threads(4)->Threads(8);
+
+bvar::Maxer<int64_t> g_maxer;
+
+static void BM_BvarMaxer(benchmark::State& state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_maxer << (i++ & 1023);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BvarMaxer)->Threads(1)->Threads(4);
+
+bvar::LatencyRecorder g_latency_recorder;
+
+static void BM_BvarLatencyRecorder(benchmark::State& state) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_latency_recorder << (i++ & 1023);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BvarLatencyRecorder)->Threads(1)->Threads(4)->Threads(8);
+
+static void BM_BvarAdderGetValue(benchmark::State& state) {
+    bvar::Adder<int64_t> adder;
+    adder << 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(adder.get_value());
+    }
+}
+BENCHMARK(BM_BvarAdderGetValue);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for butil::FlatMap (used for headers, sockets and LB
+// maps) and butil::DoublyBufferedData (the read-mostly structure behind
+// naming/LB data).
+
+#include <benchmark/benchmark.h>
+#include <butil/containers/flat_map.h>
+#include <butil/containers/doubly_buffered_data.h>
+#include <butil/fast_rand.h>
+
+namespace {
+
+static void BM_FlatMapInsertErase(benchmark::State& state) {
+    butil::FlatMap<uint64_t, uint64_t> m;
+    m.init(32);
+    uint64_t i = 0;
+    for (auto _ : state) {
+        const uint64_t key = (i++) & 1023;
+        m[key] = i;
+        if (i & 1) {
+            m.erase(key);
+        }
+    }
+}
+BENCHMARK(BM_FlatMapInsertErase);
+
+static void BM_FlatMapSeek(benchmark::State& state) {
+    const uint64_t n = state.range(0);
+    butil::FlatMap<uint64_t, uint64_t> m;
+    m.init(n * 2);
+    for (uint64_t i = 0; i < n; ++i) {
+        m[i] = i;
+    }
+    uint64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.seek((i++) % n));
+    }
+}
+BENCHMARK(BM_FlatMapSeek)->Arg(64)->Arg(4096);
+
+template <typename Hasher>
+static void BM_FlatMapStringSeek(benchmark::State& state) {
+    const size_t n = 256;
+    butil::FlatMap<std::string, uint64_t, Hasher> m;
+    m.init(n * 2);
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys.push_back("header-name-" + std::to_string(i));
+        m[keys.back()] = i;
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.seek(keys[(i++) % n]));
+    }
+}
+BENCHMARK_TEMPLATE(BM_FlatMapStringSeek, butil::DefaultHasher<std::string>);
+BENCHMARK_TEMPLATE(BM_FlatMapStringSeek, butil::FastStringHasher);
+
+typedef std::vector<uint64_t> ServerList;
+
+static void BM_DoublyBufferedDataRead(benchmark::State& state) {
+    static butil::DoublyBufferedData<ServerList> dbd;
+    if (state.thread_index() == 0) {
+        dbd.Modify([](ServerList& l) -> size_t {
+            l.assign(100, 1);
+            return 1;
+        });
+    }
+    for (auto _ : state) {
+        butil::DoublyBufferedData<ServerList>::ScopedPtr ptr;
+        if (dbd.Read(&ptr) == 0) {
+            benchmark::DoNotOptimize(ptr->size());
+        }
+    }
+}
+BENCHMARK(BM_DoublyBufferedDataRead)->Threads(1)->Threads(4)->Threads(8);
+
+} // namespace
+
+BENCHMARK_MAIN();
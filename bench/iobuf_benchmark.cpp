@@ -0,0 +1,111 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for butil::IOBuf, the buffer type on every send/receive
+// path. Run with --benchmark_format=json for machine-readable output.
+
+#include <benchmark/benchmark.h>
+#include <stdint.h>
+#include <vector>
+#include <butil/iobuf.h>
+
+namespace {
+
+static void BM_IOBufAppend(benchmark::State& state) {
+    const std::string data(state.range(0), 'a');
+    butil::IOBuf buf;
+    for (auto _ : state) {
+        buf.append(data);
+        // Keep memory bounded so the benchmark measures appending rather
+        // than allocating an ever-growing chain.
+        if (buf.size() > 16 * 1024 * 1024) {
+            buf.clear();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_IOBufAppend)->Arg(32)->Arg(1024)->Arg(16384);
+
+static void BM_IOBufAppendIOBuf(benchmark::State& state) {
+    butil::IOBuf src;
+    src.append(std::string(state.range(0), 'a'));
+    butil::IOBuf buf;
+    for (auto _ : state) {
+        buf.append(src);  // only references blocks, no copying
+        if (buf.backing_block_num() > 4096) {
+            buf.clear();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_IOBufAppendIOBuf)->Arg(1024)->Arg(16384);
+
+static void BM_IOBufCutn(benchmark::State& state) {
+    const size_t n = state.range(0);
+    butil::IOBuf src;
+    src.append(std::string(1024 * 1024, 'a'));
+    butil::IOBuf dest;
+    for (auto _ : state) {
+        src.cutn(&dest, n);
+        src.append(dest);  // move the data back to keep src non-empty
+        dest.clear();
+    }
+    state.SetBytesProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_IOBufCutn)->Arg(32)->Arg(1024)->Arg(16384);
+
+static void BM_IOBufCopyTo(benchmark::State& state) {
+    const size_t n = state.range(0);
+    butil::IOBuf src;
+    src.append(std::string(n, 'a'));
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        src.copy_to(&out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_IOBufCopyTo)->Arg(1024)->Arg(65536);
+
+// Copying a multi-MB attachment with regular stores evicts the handler's
+// working set from L2/L3; the slowdown shows up in the code that runs
+// after the copy. This interleaves a large copy_to with a pass over a
+// 256KB working set, like an echo-with-attachment handler does. Compare
+// --iobuf_nontemporal_copy_threshold=0 (plain memcpy) against the default
+// to see the win from the streaming-store kernel.
+static void BM_IOBufCopyToLargeThenTouchWorkingSet(benchmark::State& state) {
+    const size_t attachment_size = state.range(0);
+    butil::IOBuf src;
+    src.append(std::string(attachment_size, 'a'));
+    std::vector<char> sink(attachment_size);
+    std::vector<uint64_t> working_set(256 * 1024 / sizeof(uint64_t), 1);
+    uint64_t checksum = 0;
+    for (auto _ : state) {
+        src.copy_to(sink.data(), attachment_size);
+        for (size_t i = 0; i < working_set.size(); ++i) {
+            checksum += working_set[i];
+        }
+    }
+    benchmark::DoNotOptimize(checksum);
+    state.SetBytesProcessed(state.iterations() * attachment_size);
+}
+BENCHMARK(BM_IOBufCopyToLargeThenTouchWorkingSet)->Arg(4 << 20)->Arg(16 << 20);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for LoadBalancer::SelectServer, called once per RPC
+// (twice or more with retries).
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <brpc/socket.h>
+#include <brpc/policy/round_robin_load_balancer.h>
+#include <brpc/policy/randomized_load_balancer.h>
+#include <brpc/policy/locality_aware_load_balancer.h>
+#include <brpc/policy/consistent_hashing_load_balancer.h>
+#include <brpc/policy/hasher.h>
+
+namespace {
+
+const size_t kServerNum = 100;
+
+// Creates fake connected sockets and adds them to `lb'. Sockets are only
+// created once and shared by all benchmarks.
+void AddFakeServers(brpc::LoadBalancer* lb) {
+    static std::vector<brpc::ServerId>* ids = NULL;
+    if (ids == NULL) {
+        ids = new std::vector<brpc::ServerId>;
+        for (size_t i = 0; i < kServerNum; ++i) {
+            butil::EndPoint dummy;
+            butil::str2endpoint("192.168.1.1", 8000 + i, &dummy);
+            brpc::ServerId id(8888);
+            brpc::SocketOptions options;
+            options.remote_side = dummy;
+            CHECK_EQ(0, brpc::Socket::Create(options, &id.id));
+            ids->push_back(id);
+        }
+    }
+    for (size_t i = 0; i < ids->size(); ++i) {
+        lb->AddServer((*ids)[i]);
+    }
+}
+
+void RunSelectLoop(benchmark::State& state, brpc::LoadBalancer* lb,
+                   bool with_request_code) {
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectIn in = { 0, false, false, 0u, NULL };
+    brpc::LoadBalancer::SelectOut out(&ptr);
+    uint64_t seed = 0;
+    for (auto _ : state) {
+        if (with_request_code) {
+            ++seed;
+            in.has_request_code = true;
+            in.request_code = brpc::policy::MurmurHash32(
+                (const char*)&seed, sizeof(seed));
+        }
+        const int rc = lb->SelectServer(in, &out);
+        benchmark::DoNotOptimize(rc);
+        ptr.reset();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_SelectServerRoundRobin(benchmark::State& state) {
+    std::unique_ptr<brpc::policy::RoundRobinLoadBalancer> lb(
+        new brpc::policy::RoundRobinLoadBalancer);
+    AddFakeServers(lb.get());
+    RunSelectLoop(state, lb.get(), false);
+}
+BENCHMARK(BM_SelectServerRoundRobin);
+
+static void BM_SelectServerRandomized(benchmark::State& state) {
+    std::unique_ptr<brpc::policy::RandomizedLoadBalancer> lb(
+        new brpc::policy::RandomizedLoadBalancer);
+    AddFakeServers(lb.get());
+    RunSelectLoop(state, lb.get(), false);
+}
+BENCHMARK(BM_SelectServerRandomized);
+
+static void BM_SelectServerLocalityAware(benchmark::State& state) {
+    std::unique_ptr<brpc::policy::LocalityAwareLoadBalancer> lb(
+        new brpc::policy::LocalityAwareLoadBalancer);
+    AddFakeServers(lb.get());
+    RunSelectLoop(state, lb.get(), false);
+}
+BENCHMARK(BM_SelectServerLocalityAware);
+
+static void BM_SelectServerConsistentHashing(benchmark::State& state) {
+    std::unique_ptr<brpc::policy::ConsistentHashingLoadBalancer> lb(
+        new brpc::policy::ConsistentHashingLoadBalancer(
+            brpc::policy::CONS_HASH_LB_MURMUR3));
+    AddFakeServers(lb.get());
+    RunSelectLoop(state, lb.get(), true);
+}
+BENCHMARK(BM_SelectServerConsistentHashing);
+
+} // namespace
+
+BENCHMARK_MAIN();
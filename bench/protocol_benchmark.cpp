@@ -0,0 +1,127 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Microbenchmarks for protocol-level pack/parse: the baidu_std 12-byte
+// head and RpcMeta round-trip, and HTTP request serialization/parsing.
+
+#include <benchmark/benchmark.h>
+#include <butil/iobuf.h>
+#include <butil/raw_pack.h>
+#include <brpc/details/http_message.h>
+#include "brpc/policy/baidu_rpc_meta.pb.h"
+
+namespace {
+
+// Pack/unpack the 12-byte "PRPC" head exactly like baidu_rpc_protocol.cpp.
+static void BM_BaiduStdPackHead(benchmark::State& state) {
+    char head[12];
+    uint32_t body_size = 1024;
+    uint32_t meta_size = 64;
+    for (auto _ : state) {
+        memcpy(head, "PRPC", 4);
+        butil::RawPacker(head + 4).pack32(body_size).pack32(meta_size);
+        uint32_t body_size2 = 0;
+        uint32_t meta_size2 = 0;
+        butil::RawUnpacker(head + 4).unpack32(body_size2).unpack32(meta_size2);
+        benchmark::DoNotOptimize(body_size2 + meta_size2);
+    }
+}
+BENCHMARK(BM_BaiduStdPackHead);
+
+static brpc::policy::RpcMeta MakeRequestMeta() {
+    brpc::policy::RpcMeta meta;
+    brpc::policy::RpcRequestMeta* req = meta.mutable_request();
+    req->set_service_name("example.EchoService");
+    req->set_method_name("Echo");
+    req->set_log_id(123456789);
+    meta.set_correlation_id(987654321);
+    meta.set_compress_type(0);
+    return meta;
+}
+
+static void BM_RpcMetaSerialize(benchmark::State& state) {
+    const brpc::policy::RpcMeta meta = MakeRequestMeta();
+    for (auto _ : state) {
+        butil::IOBuf buf;
+        butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+        meta.SerializeToZeroCopyStream(&wrapper);
+        benchmark::DoNotOptimize(buf.size());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RpcMetaSerialize);
+
+static void BM_RpcMetaParse(benchmark::State& state) {
+    const brpc::policy::RpcMeta meta = MakeRequestMeta();
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    meta.SerializeToZeroCopyStream(&wrapper);
+    for (auto _ : state) {
+        brpc::policy::RpcMeta meta2;
+        butil::IOBufAsZeroCopyInputStream rd(buf);
+        meta2.ParseFromZeroCopyStream(&rd);
+        benchmark::DoNotOptimize(meta2.has_request());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RpcMetaParse);
+
+static void BM_HttpRequestSerialize(benchmark::State& state) {
+    butil::EndPoint ep;
+    butil::str2endpoint("127.0.0.1:8010", &ep);
+    butil::IOBuf content;
+    content.append(std::string(state.range(0), 'a'));
+    for (auto _ : state) {
+        brpc::HttpHeader header;
+        header.uri().set_path("/EchoService/Echo");
+        header.set_method(brpc::HTTP_METHOD_POST);
+        header.SetHeader("Content-Type", "application/json");
+        header.SetHeader("Accept", "*/*");
+        butil::IOBuf request;
+        brpc::MakeRawHttpRequest(&request, &header, ep, &content);
+        benchmark::DoNotOptimize(request.size());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HttpRequestSerialize)->Arg(128)->Arg(4096);
+
+static void BM_HttpRequestParse(benchmark::State& state) {
+    butil::EndPoint ep;
+    butil::str2endpoint("127.0.0.1:8010", &ep);
+    butil::IOBuf content;
+    content.append(std::string(state.range(0), 'a'));
+    brpc::HttpHeader header;
+    header.uri().set_path("/EchoService/Echo");
+    header.set_method(brpc::HTTP_METHOD_POST);
+    header.SetHeader("Content-Type", "application/json");
+    butil::IOBuf request;
+    brpc::MakeRawHttpRequest(&request, &header, ep, &content);
+    const std::string request_str = request.to_string();
+    for (auto _ : state) {
+        brpc::HttpMessage msg;
+        const ssize_t rc = msg.ParseFromArray(request_str.data(),
+                                              request_str.size());
+        benchmark::DoNotOptimize(rc);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * request_str.size());
+}
+BENCHMARK(BM_HttpRequestParse)->Arg(128)->Arg(4096);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -41,6 +41,7 @@ Acceptor::Acceptor(bthread_keytable_pool_t* pool)
     , _force_ssl(false)
     , _ssl_ctx(NULL) 
     , _use_rdma(false)
+    , _run_to_completion(false)
     , _bthread_tag(BTHREAD_TAG_DEFAULT) {
 }
 
@@ -49,9 +50,11 @@ Acceptor::~Acceptor() {
     Join();
 }
 
-int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
-                          const std::shared_ptr<SocketSSLContext>& ssl_ctx,
-                          bool force_ssl) {
+int Acceptor::StartAccept(
+    int listened_fd, int idle_timeout_sec,
+    const std::shared_ptr<SocketSSLContext>& ssl_ctx,
+    bool force_ssl,
+    const std::shared_ptr<EgressRateLimiter>& egress_limiter) {
     if (listened_fd < 0) {
         LOG(FATAL) << "Invalid listened_fd=" << listened_fd;
         return -1;
@@ -86,6 +89,7 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
     _idle_timeout_sec = idle_timeout_sec;
     _force_ssl = force_ssl;
     _ssl_ctx = ssl_ctx;
+    _egress_limiter = egress_limiter;
     
     // Creation of _acception_id is inside lock so that OnNewConnections
     // (which may run immediately) should see sane fields set below.
@@ -247,58 +251,102 @@ void Acceptor::ListConnections(std::vector<SocketId>* conn_list) {
     return ListConnections(conn_list, std::numeric_limits<size_t>::max());
 }
 
+// Number of connections drained from the kernel backlog before their
+// sockets are created and inserted into _socket_map under a single lock.
+// Bounds stack usage of the batch and the setup latency of the first
+// connection in it.
+static const size_t ACCEPT_BATCH_SIZE = 64;
+
+struct AcceptedConn {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
 void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
-    while (1) {
-        struct sockaddr_storage in_addr;
-        bzero(&in_addr, sizeof(in_addr));
-        socklen_t in_len = sizeof(in_addr);
-        butil::fd_guard in_fd(accept(acception->fd(), (sockaddr*)&in_addr, &in_len));
-        if (in_fd < 0) {
-            // no EINTR because listened fd is non-blocking.
-            if (errno == EAGAIN) {
-                return;
-            }
-            // Do NOT return -1 when `accept' failed, otherwise `_listened_fd'
-            // will be closed. Continue to consume all the events until EAGAIN
-            // instead.
-            // If the accept was failed, the error may repeat constantly, 
-            // limit frequency of logging.
-            PLOG_EVERY_SECOND(ERROR)
-                << "Fail to accept from listened_fd=" << acception->fd();
-            continue;
-        }
+    Acceptor* am = dynamic_cast<Acceptor*>(acception->user());
+    if (NULL == am) {
+        LOG(FATAL) << "Impossible! acception->user() MUST be Acceptor";
+        acception->SetFailed(EINVAL, "Impossible! acception->user() MUST be Acceptor");
+        return;
+    }
 
-        Acceptor* am = dynamic_cast<Acceptor*>(acception->user());
-        if (NULL == am) {
-            LOG(FATAL) << "Impossible! acception->user() MUST be Acceptor";
-            acception->SetFailed(EINVAL, "Impossible! acception->user() MUST be Acceptor");
-            return;
-        }
-        
-        SocketId socket_id;
-        SocketOptions options;
-        options.keytable_pool = am->_keytable_pool;
-        options.fd = in_fd;
-        butil::sockaddr2endpoint(&in_addr, in_len, &options.remote_side);
-        options.user = acception->user();
-        options.force_ssl = am->_force_ssl;
-        options.initial_ssl_ctx = am->_ssl_ctx;
+    // Fields shared by all connections of this acceptor, filled once per
+    // event instead of per accepted fd. Only fd and remote_side vary below.
+    SocketOptions options;
+    options.keytable_pool = am->_keytable_pool;
+    options.user = acception->user();
+    options.force_ssl = am->_force_ssl;
+    options.initial_ssl_ctx = am->_ssl_ctx;
+    options.egress_limiter = am->_egress_limiter;
 #if BRPC_WITH_RDMA
-        if (am->_use_rdma) {
-            options.on_edge_triggered_events = rdma::RdmaEndpoint::OnNewDataFromTcp;
-        } else {
+    if (am->_use_rdma) {
+        options.on_edge_triggered_events = rdma::RdmaEndpoint::OnNewDataFromTcp;
+    } else {
 #else
-        {
+    {
 #endif
-            options.on_edge_triggered_events = InputMessenger::OnNewMessages;
+        options.on_edge_triggered_events = InputMessenger::OnNewMessages;
+    }
+    options.use_rdma = am->_use_rdma;
+    options.process_event_inline = am->_run_to_completion;
+    options.bthread_tag = am->_bthread_tag;
+
+    bool drained = false;
+    while (!drained) {
+        // Drain a batch of fds first so that queued connections leave the
+        // kernel backlog quickly even when per-socket setup lags behind,
+        // which matters during reconnect storms.
+        AcceptedConn conns[ACCEPT_BATCH_SIZE];
+        size_t nconn = 0;
+        while (nconn < ACCEPT_BATCH_SIZE) {
+            AcceptedConn& c = conns[nconn];
+            bzero(&c.addr, sizeof(c.addr));
+            c.addr_len = sizeof(c.addr);
+#if defined(OS_LINUX)
+            // Let the kernel set the flags, saving two fcntls per fd in
+            // Socket::ResetFileDescriptor(which keeps them as no-ops).
+            c.fd = accept4(acception->fd(), (sockaddr*)&c.addr, &c.addr_len,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+            c.fd = accept(acception->fd(), (sockaddr*)&c.addr, &c.addr_len);
+#endif
+            if (c.fd < 0) {
+                // no EINTR because listened fd is non-blocking.
+                if (errno == EAGAIN) {
+                    drained = true;
+                    break;
+                }
+                // Do NOT return -1 when `accept' failed, otherwise `_listened_fd'
+                // will be closed. Continue to consume all the events until EAGAIN
+                // instead.
+                // If the accept was failed, the error may repeat constantly,
+                // limit frequency of logging.
+                PLOG_EVERY_SECOND(ERROR)
+                    << "Fail to accept from listened_fd=" << acception->fd();
+                continue;
+            }
+            ++nconn;
+        }
+
+        SocketId created_ids[ACCEPT_BATCH_SIZE];
+        size_t ncreated = 0;
+        for (size_t i = 0; i < nconn; ++i) {
+            butil::fd_guard in_fd(conns[i].fd);
+            options.fd = in_fd;
+            butil::sockaddr2endpoint(&conns[i].addr, conns[i].addr_len,
+                                     &options.remote_side);
+            SocketId socket_id;
+            if (Socket::Create(options, &socket_id) != 0) {
+                LOG(ERROR) << "Fail to create Socket";
+                continue;
+            }
+            in_fd.release(); // transfer ownership to socket_id
+            created_ids[ncreated++] = socket_id;
         }
-        options.use_rdma = am->_use_rdma;
-        options.bthread_tag = am->_bthread_tag;
-        if (Socket::Create(options, &socket_id) != 0) {
-            LOG(ERROR) << "Fail to create Socket";
+        if (0 == ncreated) {
             continue;
         }
-        in_fd.release(); // transfer ownership to socket_id
 
         // There's a funny race condition here. After Socket::Create, messages
         // from the socket are already handled and a RPC is possibly done
@@ -307,29 +355,40 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
         // on machines with few cores) where the _messenger.ConnectionCount()
         // may surprisingly be 0 even if the RPC is already done.
 
-        SocketUniquePtr sock;
-        if (Socket::AddressFailedAsWell(socket_id, &sock) >= 0) {
-            bool is_running = true;
-            {
-                BAIDU_SCOPED_LOCK(am->_map_mutex);
-                is_running = (am->status() == RUNNING);
-                // Always add this socket into `_socket_map' whether it
-                // has been `SetFailed' or not, whether `Acceptor' is
-                // running or not. Otherwise, `Acceptor::BeforeRecycle'
-                // may be called (inside Socket::BeforeRecycled) after `Acceptor'
-                // has been destroyed
-                am->_socket_map.insert(socket_id, ConnectStatistics());
+        SocketUniquePtr socks[ACCEPT_BATCH_SIZE];
+        for (size_t i = 0; i < ncreated; ++i) {
+            // Sockets failing the addressing were already destroyed, leave
+            // their slots NULL and don't add their ids into _socket_map.
+            Socket::AddressFailedAsWell(created_ids[i], &socks[i]);
+        }
+        bool is_running = true;
+        {
+            BAIDU_SCOPED_LOCK(am->_map_mutex);
+            is_running = (am->status() == RUNNING);
+            for (size_t i = 0; i < ncreated; ++i) {
+                if (socks[i] != NULL) {
+                    // Always add this socket into `_socket_map' whether it
+                    // has been `SetFailed' or not, whether `Acceptor' is
+                    // running or not. Otherwise, `Acceptor::BeforeRecycle'
+                    // may be called (inside Socket::BeforeRecycled) after
+                    // `Acceptor' has been destroyed
+                    am->_socket_map.insert(created_ids[i], ConnectStatistics());
+                }
             }
-            if (!is_running) {
+        }
+        if (!is_running) {
+            for (size_t i = 0; i < ncreated; ++i) {
+                if (socks[i] == NULL) {
+                    continue;
+                }
                 LOG(WARNING) << "Acceptor on fd=" << acception->fd()
-                    << " has been stopped, discard newly created " << *sock;
-                sock->SetFailed(ELOGOFF, "Acceptor on fd=%d has been stopped, "
+                    << " has been stopped, discard newly created " << *socks[i];
+                socks[i]->SetFailed(ELOGOFF, "Acceptor on fd=%d has been stopped, "
                         "discard newly created %s", acception->fd(),
-                        sock->description().c_str());
-                return;
+                        socks[i]->description().c_str());
             }
-        } // else: The socket has already been destroyed, Don't add its id
-          // into _socket_map
+            return;
+        }
     }
 }
 
@@ -54,9 +54,13 @@ public:
     // transmission for `idle_timeout_sec' will be closed automatically iff
     // `idle_timeout_sec' > 0
     // Return 0 on success, -1 otherwise.
+    // `egress_limiter' (possibly NULL) shapes the bytes written into all
+    // accepted connections, see egress_rate_limiter.h.
     int StartAccept(int listened_fd, int idle_timeout_sec,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
-                    bool force_ssl);
+                    bool force_ssl,
+                    const std::shared_ptr<EgressRateLimiter>& egress_limiter =
+                        std::shared_ptr<EgressRateLimiter>());
 
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
@@ -109,10 +113,16 @@ private:
 
     bool _force_ssl;
     std::shared_ptr<SocketSSLContext> _ssl_ctx;
+    // Shared by all accepted sockets, NULL when not shaping.
+    std::shared_ptr<EgressRateLimiter> _egress_limiter;
 
     // Whether to use rdma or not
     bool _use_rdma;
 
+    // Process input events of accepted sockets inline in the event
+    // dispatcher, see ServerOptions.run_to_completion.
+    bool _run_to_completion;
+
     // Acceptor belongs to this tag
     bthread_tag_t _bthread_tag;
 };
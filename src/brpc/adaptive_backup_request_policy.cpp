@@ -0,0 +1,116 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/time.h"
+#include "brpc/adaptive_backup_request_policy.h"
+
+namespace brpc {
+
+// Recompute the delay and decay ratio counters at most this often. The
+// quantile is read from a windowed bvar thus more frequent refreshes would
+// not see fresher data anyway.
+static const int64_t REFRESH_INTERVAL_US = 1000000L;
+
+AdaptiveBackupRequestPolicy::AdaptiveBackupRequestPolicy(const Options& options)
+    : _options(options)
+    , _latency(options.window_size)
+    , _last_refresh_us(0)
+    , _cached_backup_ms(options.default_backup_request_ms)
+    , _finished_count(0)
+    , _backup_count(0) {
+    if (!(_options.quantile > 0 && _options.quantile < 1)) {
+        LOG(ERROR) << "Invalid quantile=" << _options.quantile
+                   << ", changed to 0.95";
+        _options.quantile = 0.95;
+    }
+    if (_options.max_backup_ratio < 0) {
+        LOG(ERROR) << "Invalid max_backup_ratio=" << _options.max_backup_ratio
+                   << ", changed to 0";
+        _options.max_backup_ratio = 0;
+    }
+    if (_options.min_backup_request_ms < 0) {
+        _options.min_backup_request_ms = 0;
+    }
+    if (_options.max_backup_request_ms < _options.min_backup_request_ms) {
+        _options.max_backup_request_ms = _options.min_backup_request_ms;
+    }
+}
+
+void AdaptiveBackupRequestPolicy::RefreshBackupMs() const {
+    // Halve the counters so that the backup ratio is measured against
+    // recent traffic rather than the whole life of this policy, otherwise
+    // a long quiet history would allow a burst of backups far beyond
+    // max_backup_ratio when latency shifts.
+    _finished_count.store(_finished_count.load(butil::memory_order_relaxed) / 2,
+                          butil::memory_order_relaxed);
+    _backup_count.store(_backup_count.load(butil::memory_order_relaxed) / 2,
+                        butil::memory_order_relaxed);
+
+    if (_latency.count() < _options.min_sample_count) {
+        // Not warmed up yet, keep default_backup_request_ms.
+        return;
+    }
+    const int64_t lat_us = _latency.latency_percentile(_options.quantile);
+    // Round up to avoid a 0ms delay on sub-millisecond quantiles.
+    int64_t ms = (lat_us + 999) / 1000;
+    if (ms < _options.min_backup_request_ms) {
+        ms = _options.min_backup_request_ms;
+    } else if (ms > _options.max_backup_request_ms) {
+        ms = _options.max_backup_request_ms;
+    }
+    _cached_backup_ms.store((int32_t)ms, butil::memory_order_relaxed);
+}
+
+int32_t AdaptiveBackupRequestPolicy::GetBackupRequestMs(
+    const Controller*) const {
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t last_us = _last_refresh_us.load(butil::memory_order_relaxed);
+    if (now_us - last_us >= REFRESH_INTERVAL_US &&
+        _last_refresh_us.compare_exchange_strong(
+            last_us, now_us, butil::memory_order_relaxed)) {
+        RefreshBackupMs();
+    }
+    return _cached_backup_ms.load(butil::memory_order_relaxed);
+}
+
+bool AdaptiveBackupRequestPolicy::DoBackup(const Controller*) const {
+    const int64_t finished = _finished_count.load(butil::memory_order_relaxed);
+    const int64_t backups = _backup_count.load(butil::memory_order_relaxed);
+    // +1 on both sides counts the backup about to be sent and keeps cold
+    // instances (finished=0) from dividing by zero.
+    if ((double)(backups + 1) > _options.max_backup_ratio * (double)(finished + 1)) {
+        return false;
+    }
+    _backup_count.fetch_add(1, butil::memory_order_relaxed);
+    return true;
+}
+
+void AdaptiveBackupRequestPolicy::OnRPCEnd(const Controller* controller) {
+    _finished_count.fetch_add(1, butil::memory_order_relaxed);
+    // Only successful RPC contribute to the distribution: latencies of
+    // failures(e.g. unreachable servers) are often near-zero and would
+    // drag the quantile below meaningful values.
+    if (controller->ErrorCode() == 0) {
+        const int64_t lat_us = controller->latency_us();
+        if (lat_us > 0) {
+            _latency << lat_us;
+        }
+    }
+}
+
+} // namespace brpc
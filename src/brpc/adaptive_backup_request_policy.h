@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_ADAPTIVE_BACKUP_REQUEST_POLICY_H
+#define BRPC_ADAPTIVE_BACKUP_REQUEST_POLICY_H
+
+#include "butil/atomicops.h"
+#include "bvar/latency_recorder.h"
+#include "brpc/backup_request_policy.h"
+
+namespace brpc {
+
+// A BackupRequestPolicy that derives the backup-request delay from the
+// recent latency distribution of the channel instead of a hand-tuned
+// constant. Latencies of successful RPCs are fed into a LatencyRecorder
+// and the delay tracks a configurable quantile(p95 by default) of the
+// recent window, so the trigger follows downstream latency shifts
+// automatically. The fraction of RPCs that actually send a backup is
+// capped by `max_backup_ratio' to bound the duplicate load.
+//
+// One instance can be shared by all RPC over a channel(set it in
+// ChannelOptions.backup_request_policy) and all methods are thread-safe.
+// The instance must outlive RPC using it, just like other fields of
+// ChannelOptions.
+class AdaptiveBackupRequestPolicy : public BackupRequestPolicy {
+public:
+    struct Options {
+        // The quantile of recent latencies at which the backup request is
+        // triggered. Must be in (0, 1).
+        // Default: 0.95
+        double quantile{0.95};
+
+        // Upper bound of (backup requests sent / RPC finished), measured
+        // over recent RPC with exponential decay. DoBackup() returns false
+        // when sending one more backup would exceed the bound.
+        // Default: 0.1
+        double max_backup_ratio{0.1};
+
+        // The delay computed from `quantile' is clamped into
+        // [min_backup_request_ms, max_backup_request_ms].
+        // Default: 1 / 0x7fffffff
+        int32_t min_backup_request_ms{1};
+        int32_t max_backup_request_ms{0x7fffffff};
+
+        // The delay returned before `min_sample_count' latencies were
+        // collected. Negative value disables backup requests during the
+        // warm-up, which is the safe choice for cold starts.
+        // Default: -1
+        int32_t default_backup_request_ms{-1};
+
+        // Time window of the latency quantile in seconds.
+        // Default: -1 (bvar_dump_interval, which is 10s by default)
+        time_t window_size{-1};
+
+        // Number of latencies to collect before switching from
+        // `default_backup_request_ms' to the adaptive delay.
+        // Default: 128
+        int64_t min_sample_count{128};
+    };
+
+    AdaptiveBackupRequestPolicy() : AdaptiveBackupRequestPolicy(Options()) {}
+    explicit AdaptiveBackupRequestPolicy(const Options& options);
+
+    // BackupRequestPolicy
+    int32_t GetBackupRequestMs(const Controller* controller) const override;
+    bool DoBackup(const Controller* controller) const override;
+    void OnRPCEnd(const Controller* controller) override;
+
+    const Options& options() const { return _options; }
+
+    // The delay(in ms) that GetBackupRequestMs() currently returns,
+    // mainly for monitoring.
+    int32_t current_backup_request_ms() const
+    { return _cached_backup_ms.load(butil::memory_order_relaxed); }
+
+private:
+    // Recompute _cached_backup_ms from the latency quantile and decay the
+    // counters bounding the backup ratio. Called at most once per second.
+    void RefreshBackupMs() const;
+
+    Options _options;
+    bvar::LatencyRecorder _latency;
+    mutable butil::atomic<int64_t> _last_refresh_us;
+    mutable butil::atomic<int32_t> _cached_backup_ms;
+    // Decayed counters for capping the backup ratio.
+    mutable butil::atomic<int64_t> _finished_count;
+    mutable butil::atomic<int64_t> _backup_count;
+};
+
+} // namespace brpc
+
+#endif // BRPC_ADAPTIVE_BACKUP_REQUEST_POLICY_H
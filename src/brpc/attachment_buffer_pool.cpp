@@ -0,0 +1,78 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <stdlib.h>                          // posix_memalign free
+#include "butil/logging.h"
+#include "butil/scoped_lock.h"               // BAIDU_SCOPED_LOCK
+#include "brpc/attachment_buffer_pool.h"
+
+namespace brpc {
+
+AttachmentBufferPool::AttachmentBufferPool(size_t buffer_size,
+                                           size_t alignment,
+                                           size_t max_idle_buffers)
+    : _buffer_size(buffer_size)
+    , _alignment(alignment)
+    , _max_idle_buffers(max_idle_buffers) {
+    CHECK(alignment >= sizeof(void*) && !(alignment & (alignment - 1)))
+        << "Invalid alignment=" << alignment;
+    CHECK_GT(buffer_size, 0ul) << "Invalid buffer_size=" << buffer_size;
+    _idle_buffers.reserve(max_idle_buffers);
+}
+
+AttachmentBufferPool::~AttachmentBufferPool() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (size_t i = 0; i < _idle_buffers.size(); ++i) {
+        free(_idle_buffers[i]);
+    }
+    _idle_buffers.clear();
+}
+
+void* AttachmentBufferPool::Acquire() {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (!_idle_buffers.empty()) {
+            void* buf = _idle_buffers.back();
+            _idle_buffers.pop_back();
+            return buf;
+        }
+    }
+    void* buf = NULL;
+    if (posix_memalign(&buf, _alignment, _buffer_size) != 0) {
+        LOG(ERROR) << "Fail to allocate buffer of " << _buffer_size
+                   << " bytes aligned to " << _alignment;
+        return NULL;
+    }
+    return buf;
+}
+
+void AttachmentBufferPool::Release(void* buf) {
+    if (NULL == buf) {
+        return;
+    }
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_idle_buffers.size() < _max_idle_buffers) {
+            _idle_buffers.push_back(buf);
+            return;
+        }
+    }
+    free(buf);
+}
+
+} // namespace brpc
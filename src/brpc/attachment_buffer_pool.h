@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_ATTACHMENT_BUFFER_POOL_H
+#define BRPC_ATTACHMENT_BUFFER_POOL_H
+
+#include <vector>
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+
+namespace brpc {
+
+// A pool of fixed-size buffers with aligned addresses for receiving request
+// attachments. Register a pool with Server::RegisterAttachmentPool() and
+// baidu_std attachments of the method arrive in cntl->request_attachment()
+// as ONE contiguous block acquired from the pool, suitable for O_DIRECT
+// I/O without another copy in user code. The buffer goes back to the pool
+// when the last reference to the attachment data is released.
+class AttachmentBufferPool {
+public:
+    // `buffer_size': capacity of each buffer. Attachments larger than this
+    //     fall back to ordinary IOBuf blocks.
+    // `alignment': alignment of buffer addresses, must be a power of 2 and
+    //     a multiple of sizeof(void*), typically 512 or 4096 for O_DIRECT.
+    // `max_idle_buffers': at most so many released buffers are cached for
+    //     reuse, extra ones are freed at Release().
+    AttachmentBufferPool(size_t buffer_size, size_t alignment,
+                         size_t max_idle_buffers);
+    ~AttachmentBufferPool();
+
+    // Get an aligned buffer of buffer_size() bytes.
+    // Returns NULL when the allocation fails.
+    void* Acquire();
+
+    // Return a buffer obtained from Acquire() to the pool.
+    void Release(void* buf);
+
+    size_t buffer_size() const { return _buffer_size; }
+    size_t alignment() const { return _alignment; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AttachmentBufferPool);
+
+    const size_t _buffer_size;
+    const size_t _alignment;
+    const size_t _max_idle_buffers;
+    butil::Mutex _mutex;
+    std::vector<void*> _idle_buffers;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_ATTACHMENT_BUFFER_POOL_H
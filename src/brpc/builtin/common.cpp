@@ -25,6 +25,15 @@
 #include "butil/file_util.h"                 // butil::FilePath
 #include "butil/third_party/murmurhash3/murmurhash3.h"
 #include "butil/process_util.h"              // ReadCommandLine
+#include "butil/containers/flat_map.h"       // FlatMap
+#include "butil/crc32c.h"                    // crc32c::Extend
+#include "butil/scoped_lock.h"               // BAIDU_SCOPED_LOCK
+#include "butil/string_printf.h"             // string_printf
+#include "butil/time.h"                      // gettimeofday_us
+#include "brpc/controller.h"                 // Controller
+#include "brpc/http_status_code.h"           // HTTP_STATUS_NOT_MODIFIED
+#include "brpc/policy/gzip_compress.h"       // GzipCompress
+#include "brpc/reloadable_flags.h"           // BRPC_VALIDATE_GFLAG
 #include "brpc/server.h"
 #include "brpc/builtin/common.h"
 
@@ -396,4 +405,150 @@ void Time2GMT(time_t t, char* buf, size_t size) {
     strftime(buf, size, "%a, %d %b %Y %H:%M:%S %Z", &tm);
 }
 
+DEFINE_int32(builtin_page_cache_ms, 0,
+             "If positive, rendered /vars, /status and /flags pages are "
+             "cached for this many milliseconds and shared by all requests "
+             "arriving within the interval, with ETag/If-None-Match and "
+             "pre-compressed gzip bodies. 0 re-renders on every hit.");
+BRPC_VALIDATE_GFLAG(builtin_page_cache_ms, NonNegativeInteger);
+
+namespace {
+struct CachedPage {
+    CachedPage() : render_real_us(0), rendering_since_us(0) {}
+    butil::IOBuf content;        // identity body
+    butil::IOBuf gzipped;        // empty if compression failed or grew
+    std::string etag;
+    std::string content_type;
+    int64_t render_real_us;      // when `content' was rendered
+    // When a request claimed re-rendering of this page, 0 if none. Kept as
+    // a timestamp so that a renderer which failed midway only blocks
+    // re-rendering for one cache interval instead of forever.
+    int64_t rendering_since_us;
+};
+} // namespace
+
+static pthread_once_t g_page_cache_once = PTHREAD_ONCE_INIT;
+static butil::Mutex* g_page_cache_mutex = NULL;
+typedef butil::FlatMap<std::string, CachedPage*> PageCacheMap;
+static PageCacheMap* g_page_cache = NULL;
+
+static void InitPageCache() {
+    g_page_cache_mutex = new butil::Mutex;
+    g_page_cache = new PageCacheMap;
+    CHECK_EQ(0, g_page_cache->init(32, 50));
+}
+
+static const char* ETAG_STR = "ETag";
+static const char* IF_NONE_MATCH_STR = "If-None-Match";
+static const char* CONTENT_ENCODING_STR = "Content-Encoding";
+
+// Fill the response of `cntl' with a copy of `page' (headers were copied
+// out under the lock, IOBuf copying only references blocks).
+static void ServeCachedPage(Controller* cntl, const CachedPage& page) {
+    cntl->http_response().SetHeader(ETAG_STR, page.etag);
+    const std::string* req_etag =
+        cntl->http_request().GetHeader(IF_NONE_MATCH_STR);
+    if (req_etag != NULL && *req_etag == page.etag) {
+        cntl->http_response().set_status_code(HTTP_STATUS_NOT_MODIFIED);
+        cntl->response_attachment().clear();
+        return;
+    }
+    cntl->http_response().set_content_type(page.content_type);
+    if (!page.gzipped.empty() && SupportGzip(cntl)) {
+        cntl->http_response().SetHeader(CONTENT_ENCODING_STR, "gzip");
+        cntl->response_attachment() = page.gzipped;
+    } else {
+        cntl->response_attachment() = page.content;
+    }
+}
+
+bool ServeBuiltinPageFromCache(Controller* cntl, const std::string& key) {
+    if (FLAGS_builtin_page_cache_ms <= 0) {
+        return false;
+    }
+    pthread_once(&g_page_cache_once, InitPageCache);
+    const int64_t now_us = butil::gettimeofday_us();
+    CachedPage copied;
+    {
+        BAIDU_SCOPED_LOCK(*g_page_cache_mutex);
+        CachedPage** ppage = g_page_cache->seek(key);
+        if (ppage == NULL) {
+            CachedPage* new_page = new (std::nothrow) CachedPage;
+            if (new_page != NULL) {
+                new_page->rendering_since_us = now_us;
+                (*g_page_cache)[key] = new_page;
+            }
+            return false;
+        }
+        CachedPage* page = *ppage;
+        if (page->etag.empty()) {
+            // First render still in flight, nothing to serve yet.
+            return false;
+        }
+        const bool fresh = now_us < page->render_real_us +
+            FLAGS_builtin_page_cache_ms * 1000L;
+        if (!fresh) {
+            if (page->rendering_since_us == 0 ||
+                now_us >= page->rendering_since_us +
+                FLAGS_builtin_page_cache_ms * 1000L) {
+                // This request re-renders (or reclaims an abandoned
+                // render); others keep getting the previous snapshot.
+                page->rendering_since_us = now_us;
+                return false;
+            }
+            // Stale but someone else is already rendering, serve the
+            // previous snapshot.
+        }
+        copied = *page;
+    }
+    ServeCachedPage(cntl, copied);
+    return true;
+}
+
+bool StoreBuiltinPage(Controller* cntl, const std::string& key) {
+    if (FLAGS_builtin_page_cache_ms <= 0) {
+        return false;
+    }
+    pthread_once(&g_page_cache_once, InitPageCache);
+    const butil::IOBuf& body = cntl->response_attachment();
+    uint32_t crc = 0;
+    for (size_t i = 0; i < body.backing_block_num(); ++i) {
+        const butil::StringPiece blk = body.backing_block(i);
+        crc = butil::crc32c::Extend(crc, blk.data(), blk.size());
+    }
+    CachedPage rendered;
+    rendered.content = body;
+    rendered.etag = butil::string_printf("\"%08x-%zx\"", crc, body.size());
+    rendered.content_type = cntl->http_response().content_type();
+    rendered.render_real_us = butil::gettimeofday_us();
+    butil::IOBuf gzipped;
+    if (policy::GzipCompress(body, &gzipped, NULL) &&
+        gzipped.size() < body.size()) {
+        rendered.gzipped = gzipped;
+    }
+    {
+        BAIDU_SCOPED_LOCK(*g_page_cache_mutex);
+        CachedPage** ppage = g_page_cache->seek(key);
+        CachedPage* page = (ppage != NULL ? *ppage : NULL);
+        if (page == NULL) {
+            page = new (std::nothrow) CachedPage;
+            if (page == NULL) {
+                return false;
+            }
+            (*g_page_cache)[key] = page;
+        }
+        page->content = rendered.content;
+        page->gzipped = rendered.gzipped;
+        page->etag = rendered.etag;
+        page->content_type = rendered.content_type;
+        page->render_real_us = rendered.render_real_us;
+        page->rendering_since_us = 0;
+    }
+    // Apply cache headers to the rendering request as well so that it
+    // benefits from 304/gzip like cached hits do.
+    cntl->response_attachment().clear();
+    ServeCachedPage(cntl, rendered);
+    return true;
+}
+
 } // namespace brpc
@@ -122,6 +122,28 @@ const char* GetProgramChecksum();
 // True if the http requester support gzip compression.
 bool SupportGzip(Controller* cntl);
 
+// [Caching of rendered builtin pages]
+// Fleet dashboards polling /vars, /status or /flags on every instance make
+// the pages re-render and re-compress on each hit. When
+// -builtin_page_cache_ms is positive, services keep a snapshot per `key'
+// (rendered body, a pre-compressed gzip copy and an ETag) and share it
+// among all requests arriving within the interval; at most one request per
+// expiry re-renders while latecomers are served the previous snapshot.
+//
+// Returns true if the response of `cntl' was filled from the cache --
+// either the snapshot body or an empty 304 when the request carries a
+// matching If-None-Match -- in which case the caller must not render.
+// Returns false if the caller should render the page and then call
+// StoreBuiltinPage().
+bool ServeBuiltinPageFromCache(Controller* cntl, const std::string& key);
+
+// Store response_attachment() of `cntl' as the snapshot of `key' and apply
+// the cache headers (ETag, possibly a 304 or the gzip copy) to this
+// response as well. Returns false when caching is disabled, in which case
+// nothing was done and the caller should fall back to its usual response
+// handling (e.g. set_response_compress_type).
+bool StoreBuiltinPage(Controller* cntl, const std::string& key);
+
 void Time2GMT(time_t t, char* buf, size_t size);
 
 template <typename T>
@@ -18,8 +18,11 @@
 
 #include <ostream>
 #include <iomanip>
+#include <algorithm>
 #include <netinet/tcp.h>
 #include <gflags/gflags.h>
+#include "butil/string_splitter.h"     // StringSplitter
+#include "butil/time.h"                // gettimeofday_us
 #include "brpc/closure_guard.h"        // ClosureGuard
 #include "brpc/controller.h"           // Controller
 #include "brpc/socket_map.h"           // SocketMapList
@@ -39,7 +42,15 @@ DEFINE_bool(show_hostname_instead_of_ip, false,
 BRPC_VALIDATE_GFLAG(show_hostname_instead_of_ip, PassValidate);
 
 DEFINE_int32(max_shown_connections, 1024,
-             "Print stats of at most so many connections (soft limit)");
+             "Print stats of at most so many connections per page");
+
+DEFINE_int32(connections_cache_second, 3,
+             "Serve /connections from a snapshot of existing connections "
+             "refreshed at most once per so many seconds, so that frequent "
+             "views of a server with many connections do not repeatedly "
+             "walk all sockets. Non-positive values collect afresh on "
+             "every view");
+BRPC_VALIDATE_GFLAG(connections_cache_second, PassValidate);
 
 // NOTE: The returned string must be 3-char wide in text mode.
 inline const char* SSLStateToYesNo(SSLState s, bool use_html) {
@@ -108,44 +119,152 @@ static std::string BriefName(const std::string& cname) {
     return tmp;
 }
 
+// Bits of ColumnMask, one per column group of /connections.
+enum {
+    COL_CREATED_TIME = 0x1,
+    COL_REMOTE_SIDE  = 0x2,
+    COL_LOCAL        = 0x4,
+    COL_RECENT_ERR   = 0x8,
+    COL_NBREAK       = 0x10,
+    COL_SSL          = 0x20,
+    COL_PROTOCOL     = 0x40,
+    COL_FD           = 0x80,
+    COL_IN           = 0x100,
+    COL_OUT          = 0x200,
+    COL_RTT          = 0x400,
+    COL_SOCKET_ID    = 0x800,
+    COL_ALL          = 0xFFF
+};
+
+static const struct {
+    const char* name;
+    unsigned bit;
+} s_col_defs[] = {
+    { "createdtime", COL_CREATED_TIME },
+    { "remoteside",  COL_REMOTE_SIDE },
+    { "local",       COL_LOCAL },
+    { "recenterr",   COL_RECENT_ERR },
+    { "nbreak",      COL_NBREAK },
+    { "ssl",         COL_SSL },
+    { "protocol",    COL_PROTOCOL },
+    { "fd",          COL_FD },
+    { "in",          COL_IN },
+    { "out",         COL_OUT },
+    { "rtt",         COL_RTT },
+    { "socketid",    COL_SOCKET_ID },
+};
+
+// Turn the comma-separated `cols' query(e.g. "remoteside,protocol,out")
+// into a mask, matched case-insensitively. NULL/empty/unmatched values
+// select all columns. SocketId is always shown since it links to the
+// detailed socket page.
+static unsigned ParseColumnFilter(const std::string* cols_str) {
+    if (cols_str == NULL || cols_str->empty()) {
+        return COL_ALL;
+    }
+    unsigned cols = 0;
+    for (butil::StringSplitter sp(cols_str->c_str(), ','); sp; ++sp) {
+        for (size_t i = 0; i < arraysize(s_col_defs); ++i) {
+            if (sp.length() == strlen(s_col_defs[i].name) &&
+                strncasecmp(sp.field(), s_col_defs[i].name,
+                            sp.length()) == 0) {
+                cols |= s_col_defs[i].bit;
+                break;
+            }
+        }
+    }
+    return cols ? (cols | COL_SOCKET_ID) : COL_ALL;
+}
+
 void ConnectionsService::PrintConnections(
     std::ostream& os, const std::vector<SocketId>& conns,
-    bool use_html, const Server* server, bool is_channel_conn) const {
+    bool use_html, const Server* server, bool is_channel_conn,
+    ColumnMask cols) const {
     if (conns.empty()) {
         return;
     }
     if (use_html) {
-        os << "<table class=\"gridtable sortable\" border=\"1\"><tr>"
-            "<th>CreatedTime</th>"
-            "<th>RemoteSide</th>";
+        os << "<table class=\"gridtable sortable\" border=\"1\"><tr>";
+        if (cols & COL_CREATED_TIME) {
+            os << "<th>CreatedTime</th>";
+        }
+        if (cols & COL_REMOTE_SIDE) {
+            os << "<th>RemoteSide</th>";
+        }
         if (is_channel_conn) {
-            os << "<th>Local</th>"
-                "<th>RecentErr</th>"
-                "<th>nbreak</th>";
+            if (cols & COL_LOCAL) {
+                os << "<th>Local</th>";
+            }
+            if (cols & COL_RECENT_ERR) {
+                os << "<th>RecentErr</th>";
+            }
+            if (cols & COL_NBREAK) {
+                os << "<th>nbreak</th>";
+            }
+        }
+        if (cols & COL_SSL) {
+            os << "<th>SSL</th>";
+        }
+        if (cols & COL_PROTOCOL) {
+            os << "<th>Protocol</th>";
+        }
+        if (cols & COL_FD) {
+            os << "<th>fd</th>";
         }
-        os << "<th>SSL</th>"
-            "<th>Protocol</th>"
-            "<th>fd</th>"
-            "<th>InBytes/s</th>"
-            "<th>In/s</th>"
-            "<th>InBytes/m</th>"
-            "<th>In/m</th>"
-            "<th>OutBytes/s</th>"
-            "<th>Out/s</th>"
-            "<th>OutBytes/m</th>"
-            "<th>Out/m</th>"
-            "<th>Rtt/Var(ms)</th>"
-            "<th>SocketId</th>"
+        if (cols & COL_IN) {
+            os << "<th>InBytes/s</th>"
+                "<th>In/s</th>"
+                "<th>InBytes/m</th>"
+                "<th>In/m</th>";
+        }
+        if (cols & COL_OUT) {
+            os << "<th>OutBytes/s</th>"
+                "<th>Out/s</th>"
+                "<th>OutBytes/m</th>"
+                "<th>Out/m</th>";
+        }
+        if (cols & COL_RTT) {
+            os << "<th>Rtt/Var(ms)</th>";
+        }
+        os << "<th>SocketId</th>"
             "</tr>\n";
     } else {
-        os << "CreatedTime               |RemoteSide         |";
+        if (cols & COL_CREATED_TIME) {
+            os << "CreatedTime               |";
+        }
+        if (cols & COL_REMOTE_SIDE) {
+            os << "RemoteSide         |";
+        }
         if (is_channel_conn) {
-            os << "Local|RecentErr|nbreak|";
+            if (cols & COL_LOCAL) {
+                os << "Local|";
+            }
+            if (cols & COL_RECENT_ERR) {
+                os << "RecentErr|";
+            }
+            if (cols & COL_NBREAK) {
+                os << "nbreak|";
+            }
+        }
+        if (cols & COL_SSL) {
+            os << "SSL|";
+        }
+        if (cols & COL_PROTOCOL) {
+            os << "Protocol    |";
+        }
+        if (cols & COL_FD) {
+            os << "fd   |";
+        }
+        if (cols & COL_IN) {
+            os << "InBytes/s|In/s  |InBytes/m |In/m    |";
         }
-        os << "SSL|Protocol    |fd   |"
-            "InBytes/s|In/s  |InBytes/m |In/m    |"
-            "OutBytes/s|Out/s |OutBytes/m|Out/m   |"
-            "Rtt/Var(ms)|SocketId\n";
+        if (cols & COL_OUT) {
+            os << "OutBytes/s|Out/s |OutBytes/m|Out/m   |";
+        }
+        if (cols & COL_RTT) {
+            os << "Rtt/Var(ms)|";
+        }
+        os << "SocketId\n";
     }
 
     const char* const bar = (use_html ? "</td><td>" : "|");
@@ -173,25 +292,47 @@ void ConnectionsService::PrintConnections(
             os << "<tr><td>";
         }
         if (failed) {
-            os << min_width("Broken", 26) << bar
-               << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
+            if (cols & COL_CREATED_TIME) {
+                os << min_width("Broken", 26) << bar;
+            }
+            if (cols & COL_REMOTE_SIDE) {
+                os << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
+            }
             if (is_channel_conn) {
-                os << min_width(ptr->local_side().port, 5) << bar
-                   << min_width(ptr->recent_error_count(), 10) << bar
-                   << min_width(ptr->isolated_times(), 7) << bar;
+                if (cols & COL_LOCAL) {
+                    os << min_width(ptr->local_side().port, 5) << bar;
+                }
+                if (cols & COL_RECENT_ERR) {
+                    os << min_width(ptr->recent_error_count(), 10) << bar;
+                }
+                if (cols & COL_NBREAK) {
+                    os << min_width(ptr->isolated_times(), 7) << bar;
+                }
+            }
+            if (cols & COL_SSL) {
+                os << min_width("-", 3) << bar;
+            }
+            if (cols & COL_PROTOCOL) {
+                os << min_width("-", 12) << bar;
+            }
+            if (cols & COL_FD) {
+                os << min_width("-", 5) << bar;
+            }
+            if (cols & COL_IN) {
+                os << min_width("-", 9) << bar
+                   << min_width("-", 6) << bar
+                   << min_width("-", 10) << bar
+                   << min_width("-", 8) << bar;
+            }
+            if (cols & COL_OUT) {
+                os << min_width("-", 10) << bar
+                   << min_width("-", 6) << bar
+                   << min_width("-", 10) << bar
+                   << min_width("-", 8) << bar;
+            }
+            if (cols & COL_RTT) {
+                os << min_width("-", 11) << bar;
             }
-            os << min_width("-", 3) << bar
-               << min_width("-", 12) << bar
-               << min_width("-", 5) << bar
-               << min_width("-", 9) << bar
-               << min_width("-", 6) << bar
-               << min_width("-", 10) << bar
-               << min_width("-", 8) << bar
-               << min_width("-", 10) << bar
-               << min_width("-", 6) << bar
-               << min_width("-", 10) << bar
-               << min_width("-", 8) << bar
-               << min_width("-", 11) << bar;
         } else {
             {
                 SocketUniquePtr agent_sock;
@@ -199,116 +340,150 @@ void ConnectionsService::PrintConnections(
                     ptr.swap(agent_sock);
                 }
             }
-            // Get name of the protocol. In principle we can dynamic_cast the
-            // socket user to InputMessenger but I'm not sure if that's a bit
-            // slow (because we have many connections here).
-            int pref_index = ptr->preferred_index();
             SocketUniquePtr first_sub;
             int pooled_count = -1;
-            if (ptr->HasSocketPool()) {
-                int numfree = 0;
-                int numinflight = 0;
-                if (ptr->GetPooledSocketStats(&numfree, &numinflight)) {
-                    pooled_count = numfree + numinflight;
+            const char* pref_prot = "-";
+            if (cols & (COL_PROTOCOL | COL_RTT)) {
+                // Get name of the protocol. In principle we can dynamic_cast
+                // the socket user to InputMessenger but I'm not sure if
+                // that's a bit slow (because we have many connections here).
+                int pref_index = ptr->preferred_index();
+                if (ptr->HasSocketPool()) {
+                    int numfree = 0;
+                    int numinflight = 0;
+                    if (ptr->GetPooledSocketStats(&numfree, &numinflight)) {
+                        pooled_count = numfree + numinflight;
+                    }
+                    // Check preferred_index of any pooled sockets.
+                    ptr->ListPooledSockets(&first_id, 1);
+                    if (!first_id.empty()) {
+                        Socket::Address(first_id[0], &first_sub);
+                    }
                 }
-                // Check preferred_index of any pooled sockets.
-                ptr->ListPooledSockets(&first_id, 1);
-                if (!first_id.empty()) {
-                    Socket::Address(first_id[0], &first_sub);
+                bool accepted_by_server = (ptr->user() == server->_am);
+                for (size_t j = 0; !accepted_by_server &&
+                         j < server->_extra_ams.size(); ++j) {
+                    accepted_by_server = (ptr->user() == server->_extra_ams[j]);
                 }
-            }
-            const char* pref_prot = "-";
-            if (ptr->user() == server->_am) {
-                pref_prot = server->_am->NameOfProtocol(pref_index);
-                // Special treatment for nshead services. Notice that
-                // pref_index is comparable to ProtocolType after r31951
-                if (pref_index == (int)PROTOCOL_NSHEAD &&
-                    server->options().nshead_service != NULL) {
-                    if (nshead_service_name.empty()) {
-                        nshead_service_name = BriefName(butil::class_name_str(
-                                *server->options().nshead_service));
+                if (accepted_by_server) {
+                    pref_prot = server->_am->NameOfProtocol(pref_index);
+                    // Special treatment for nshead services. Notice that
+                    // pref_index is comparable to ProtocolType after r31951
+                    if (pref_index == (int)PROTOCOL_NSHEAD &&
+                        server->options().nshead_service != NULL) {
+                        if (nshead_service_name.empty()) {
+                            nshead_service_name = BriefName(butil::class_name_str(
+                                    *server->options().nshead_service));
+                        }
+                        pref_prot = nshead_service_name.c_str();
                     }
-                    pref_prot = nshead_service_name.c_str();
+                } else if (ptr->CreatedByConnect()) {
+                    pref_prot = get_client_side_messenger()->NameOfProtocol(pref_index);
                 }
-            } else if (ptr->CreatedByConnect()) {
-                pref_prot = get_client_side_messenger()->NameOfProtocol(pref_index);
-            }
-            if (strcmp(pref_prot, "unknown") == 0) {
-                // Show unknown protocol as - to be consistent with other columns.
-                pref_prot = "-";
-            } else if (strcmp(pref_prot, "h2") == 0) {
-                if (!ptr->is_ssl()) {
-                    pref_prot = "h2c";
+                if (strcmp(pref_prot, "unknown") == 0) {
+                    // Show unknown protocol as - to be consistent with other
+                    // columns.
+                    pref_prot = "-";
+                } else if (strcmp(pref_prot, "h2") == 0) {
+                    if (!ptr->is_ssl()) {
+                        pref_prot = "h2c";
+                    }
                 }
             }
-            ptr->GetStat(&stat);
-            PrintRealDateTime(os, ptr->_reset_fd_real_us);
-            int rttfd = ptr->fd();
-            if (rttfd < 0 && first_sub != NULL) {
-                rttfd = first_sub->fd();
+            if (cols & (COL_IN | COL_OUT)) {
+                ptr->GetStat(&stat);
             }
-
-            bool got_rtt = false;
-            uint32_t srtt = 0;
-            uint32_t rtt_var = 0;
-            // get rtt
-#if defined(OS_LINUX)
-            struct tcp_info ti;
-            socklen_t len = sizeof(ti);
-            if (0 == getsockopt(rttfd, SOL_TCP, TCP_INFO, &ti, &len)) {
-                got_rtt = true;
-                srtt = ti.tcpi_rtt;
-                rtt_var = ti.tcpi_rttvar;
+            if (cols & COL_CREATED_TIME) {
+                PrintRealDateTime(os, ptr->_reset_fd_real_us);
+                os << bar;
             }
+            char rtt_display[32];
+            if (cols & COL_RTT) {
+                int rttfd = ptr->fd();
+                if (rttfd < 0 && first_sub != NULL) {
+                    rttfd = first_sub->fd();
+                }
+                bool got_rtt = false;
+                uint32_t srtt = 0;
+                uint32_t rtt_var = 0;
+                // get rtt
+#if defined(OS_LINUX)
+                struct tcp_info ti;
+                socklen_t len = sizeof(ti);
+                if (0 == getsockopt(rttfd, SOL_TCP, TCP_INFO, &ti, &len)) {
+                    got_rtt = true;
+                    srtt = ti.tcpi_rtt;
+                    rtt_var = ti.tcpi_rttvar;
+                }
 #elif defined(OS_MACOSX)
-            struct tcp_connection_info ti;
-            socklen_t len = sizeof(ti);
-            if (0 == getsockopt(rttfd, IPPROTO_TCP, TCP_CONNECTION_INFO, &ti, &len)) {
-                got_rtt = true;
-                srtt = ti.tcpi_srtt;
-                rtt_var = ti.tcpi_rttvar;
-            }
+                struct tcp_connection_info ti;
+                socklen_t len = sizeof(ti);
+                if (0 == getsockopt(rttfd, IPPROTO_TCP, TCP_CONNECTION_INFO, &ti, &len)) {
+                    got_rtt = true;
+                    srtt = ti.tcpi_srtt;
+                    rtt_var = ti.tcpi_rttvar;
+                }
 #endif
-            char rtt_display[32];
-            if (got_rtt) {
-                snprintf(rtt_display, sizeof(rtt_display), "%.1f/%.1f",
-                         srtt / 1000.0, rtt_var / 1000.0);
-            } else {
-                strcpy(rtt_display, "-");
+                if (got_rtt) {
+                    snprintf(rtt_display, sizeof(rtt_display), "%.1f/%.1f",
+                             srtt / 1000.0, rtt_var / 1000.0);
+                } else {
+                    strcpy(rtt_display, "-");
+                }
+            }
+            if (cols & COL_REMOTE_SIDE) {
+                os << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
             }
-            os << bar << min_width(NameOfPoint(ptr->remote_side()), 19) << bar;
             if (is_channel_conn) {
-                if (ptr->local_side().port > 0) {
-                    os << min_width(ptr->local_side().port, 5) << bar;
+                if (cols & COL_LOCAL) {
+                    if (ptr->local_side().port > 0) {
+                        os << min_width(ptr->local_side().port, 5) << bar;
+                    } else {
+                        os << min_width("-", 5) << bar;
+                    }
+                }
+                if (cols & COL_RECENT_ERR) {
+                    os << min_width(ptr->recent_error_count(), 10) << bar;
+                }
+                if (cols & COL_NBREAK) {
+                    os << min_width(ptr->isolated_times(), 7) << bar;
+                }
+            }
+            if (cols & COL_SSL) {
+                os << SSLStateToYesNo(ptr->ssl_state(), use_html) << bar;
+            }
+            if (cols & COL_PROTOCOL) {
+                char protname[32];
+                if (pooled_count < 0) {
+                    snprintf(protname, sizeof(protname), "%s", pref_prot);
+                } else {
+                    snprintf(protname, sizeof(protname), "%s*%d", pref_prot,
+                             pooled_count);
+                }
+                os << min_width(protname, 12) << bar;
+            }
+            if (cols & COL_FD) {
+                if (ptr->fd() >= 0) {
+                    os << min_width(ptr->fd(), 5) << bar;
                 } else {
                     os << min_width("-", 5) << bar;
                 }
-                os << min_width(ptr->recent_error_count(), 10) << bar
-                   << min_width(ptr->isolated_times(), 7) << bar;
             }
-            os << SSLStateToYesNo(ptr->ssl_state(), use_html) << bar;
-            char protname[32];
-            if (pooled_count < 0) {
-                snprintf(protname, sizeof(protname), "%s", pref_prot);
-            } else {
-                snprintf(protname, sizeof(protname), "%s*%d", pref_prot,
-                         pooled_count);
+            if (cols & COL_IN) {
+                os << min_width(stat.in_size_s, 9) << bar
+                   << min_width(stat.in_num_messages_s, 6) << bar
+                   << min_width(stat.in_size_m, 10) << bar
+                   << min_width(stat.in_num_messages_m, 8) << bar;
             }
-            os << min_width(protname, 12) << bar;
-            if (ptr->fd() >= 0) {
-                os << min_width(ptr->fd(), 5) << bar;
-            } else {
-                os << min_width("-", 5) << bar;
+            if (cols & COL_OUT) {
+                os << min_width(stat.out_size_s, 10) << bar
+                   << min_width(stat.out_num_messages_s, 6) << bar
+                   << min_width(stat.out_size_m, 10) << bar
+                   << min_width(stat.out_num_messages_m, 8) << bar;
+            }
+            if (cols & COL_RTT) {
+                os << min_width(rtt_display, 11) << bar;
             }
-            os << min_width(stat.in_size_s, 9) << bar
-               << min_width(stat.in_num_messages_s, 6) << bar
-               << min_width(stat.in_size_m, 10) << bar
-               << min_width(stat.in_num_messages_m, 8) << bar
-               << min_width(stat.out_size_s, 10) << bar
-               << min_width(stat.out_num_messages_s, 6) << bar
-               << min_width(stat.out_size_m, 10) << bar
-               << min_width(stat.out_num_messages_m, 8) << bar
-               << min_width(rtt_display, 11) << bar;
         }
 
         if (use_html) {
@@ -327,6 +502,68 @@ void ConnectionsService::PrintConnections(
     }
 }
 
+void ConnectionsService::GetConnectionsMaybeCached(
+    const Server* server, bool nocache, size_t offset, size_t max_count,
+    std::vector<SocketId>* server_conns, std::vector<SocketId>* channel_conns,
+    size_t* server_conn_count, int64_t* channel_conn_count,
+    size_t* total_count, int64_t* snapshot_real_us) {
+    BAIDU_SCOPED_LOCK(_cache_mutex);
+    const int64_t now_us = butil::gettimeofday_us();
+    if (nocache || _cache_real_us == 0 ||
+        FLAGS_connections_cache_second <= 0 ||
+        now_us - _cache_real_us >
+        FLAGS_connections_cache_second * 1000000L) {
+        // Walk all sockets once and keep the ids around; pages within
+        // -connections_cache_second slice this snapshot instead of
+        // repeating the walk.
+        Acceptor* am = server->_am;
+        // NOTE: not accurate count.
+        size_t num_conns = am->ConnectionCount();
+        am->ListConnections(&_cached_server_conns);
+        std::vector<SocketId> more_conns;
+        for (size_t i = 0; i < server->_extra_ams.size(); ++i) {
+            num_conns += server->_extra_ams[i]->ConnectionCount();
+            server->_extra_ams[i]->ListConnections(&more_conns);
+            _cached_server_conns.insert(_cached_server_conns.end(),
+                                        more_conns.begin(), more_conns.end());
+        }
+        if (server->_internal_am) {
+            // Connections to internal_port are generally few and not
+            // counted into server_connection_count, as before.
+            server->_internal_am->ListConnections(&more_conns);
+            _cached_server_conns.insert(_cached_server_conns.end(),
+                                        more_conns.begin(), more_conns.end());
+        }
+        SocketMapList(&_cached_channel_conns);
+        _cached_server_conn_count = num_conns;
+        _cached_channel_conn_count = GetChannelConnectionCount();
+        _cache_real_us = now_us;
+    }
+    *server_conn_count = _cached_server_conn_count;
+    *channel_conn_count = _cached_channel_conn_count;
+    *snapshot_real_us = _cache_real_us;
+    const size_t nserver = _cached_server_conns.size();
+    const size_t total = nserver + _cached_channel_conns.size();
+    *total_count = total;
+    // Slice [offset, offset + max_count) of the concatenated sequence.
+    size_t end = offset + max_count;
+    if (end < offset || end > total) {  // unsigned overflow or past the end
+        end = total;
+    }
+    server_conns->clear();
+    channel_conns->clear();
+    if (offset < nserver) {
+        server_conns->assign(
+            _cached_server_conns.begin() + offset,
+            _cached_server_conns.begin() + std::min(end, nserver));
+    }
+    if (end > nserver) {
+        const size_t ch_begin = offset > nserver ? offset - nserver : 0;
+        channel_conns->assign(_cached_channel_conns.begin() + ch_begin,
+                              _cached_channel_conns.begin() + (end - nserver));
+    }
+}
+
 void ConnectionsService::default_method(
     ::google::protobuf::RpcController* cntl_base,
     const ::brpc::ConnectionsRequest*,
@@ -335,9 +572,8 @@ void ConnectionsService::default_method(
     ClosureGuard done_guard(done);
     Controller *cntl = static_cast<Controller*>(cntl_base);
     const Server* server = cntl->server();
-    Acceptor* am = server->_am;
-    Acceptor* internal_am = server->_internal_am;
     butil::IOBufBuilder os;
+    const URI& uri = cntl->http_request().uri();
     const bool use_html = UseHTML(cntl->http_request());
     cntl->http_response().set_content_type(
         use_html ? "text/html" : "text/plain");
@@ -352,52 +588,80 @@ void ConnectionsService::default_method(
         server->PrintTabsBody(os, "connections");
     }
 
-    size_t max_shown = (size_t)FLAGS_max_shown_connections;
-    if (cntl->http_request().uri().GetQuery("givemeall")) {
-        max_shown = std::numeric_limits<size_t>::max();
-    }
-    bool has_uncopied = false;
-    std::vector<SocketId> conns;
-    // NOTE: not accurate count.
-    size_t num_conns = am->ConnectionCount();
-    am->ListConnections(&conns, max_shown);
-    if (conns.size() == max_shown && num_conns > conns.size()) {
-        // OK to have false positive
-        has_uncopied = true;
+    const ColumnMask cols = ParseColumnFilter(uri.GetQuery("cols"));
+    size_t psize = (size_t)FLAGS_max_shown_connections;
+    const std::string* psize_str = uri.GetQuery("psize");
+    if (psize_str) {
+        const size_t user_psize = strtoul(psize_str->c_str(), NULL, 10);
+        if (user_psize > 0) {
+            psize = user_psize;
+        }
     }
-    if (internal_am) {
-        size_t num_conns2 = internal_am->ConnectionCount();
-        std::vector<SocketId> internal_conns;
-        // Connections to internal_port are generally small, thus
-        // -max_shown_connections is treated as a soft limit
-        internal_am->ListConnections(&internal_conns, max_shown);
-        if (internal_conns.size() == max_shown &&
-            num_conns2 > internal_conns.size()) {
-            // OK to have false positive
-            has_uncopied = true;
+    size_t page = 1;
+    const std::string* page_str = uri.GetQuery("page");
+    if (page_str) {
+        const size_t user_page = strtoul(page_str->c_str(), NULL, 10);
+        if (user_page > 1) {
+            page = user_page;
         }
-        conns.insert(conns.end(), internal_conns.begin(), internal_conns.end());
     }
-    os << "server_connection_count: " << num_conns << '\n';
-    PrintConnections(os, conns, use_html, server, false/*is_channel_conn*/);
-    if (has_uncopied) {
-        // Notice that we don't put the link of givemeall directly because
-        // people seeing the link are very likely to click it which may be
-        // slow and should generally be avoided.
-        os << "(Stop printing more connections... check out all connections"
-            " by appending \"?givemeall\" to the url of current page)"
-           << (use_html ? "<br>\n" : "\n");
+    if (uri.GetQuery("givemeall")) {
+        psize = std::numeric_limits<size_t>::max();
+        page = 1;
     }
+    const size_t offset = psize < std::numeric_limits<size_t>::max() / page
+        ? (page - 1) * psize : std::numeric_limits<size_t>::max();
+
+    std::vector<SocketId> server_conns;
+    std::vector<SocketId> channel_conns;
+    size_t server_conn_count = 0;
+    int64_t channel_conn_count = 0;
+    size_t total_count = 0;
+    int64_t snapshot_real_us = 0;
+    GetConnectionsMaybeCached(server, uri.GetQuery("nocache") != NULL,
+                              offset, psize, &server_conns, &channel_conns,
+                              &server_conn_count, &channel_conn_count,
+                              &total_count, &snapshot_real_us);
+
+    os << "server_connection_count: " << server_conn_count << '\n';
+    PrintConnections(os, server_conns, use_html, server,
+                     false/*is_channel_conn*/, cols);
 
-    SocketMapList(&conns);
     os << (use_html ? "<br>\n" : "\n")
-       << "channel_connection_count: " << GetChannelConnectionCount() << '\n';
-    PrintConnections(os, conns, use_html, server, true/*is_channel_conn*/);
+       << "channel_connection_count: " << channel_conn_count << '\n';
+    PrintConnections(os, channel_conns, use_html, server,
+                     true/*is_channel_conn*/, cols);
+
+    const size_t shown = server_conns.size() + channel_conns.size();
+    if (offset <= total_count && offset + shown < total_count) {
+        if (use_html) {
+            os << "<br>showing " << (total_count == 0 ? 0 : offset + 1) << '-'
+               << offset + shown << " of " << total_count << " connections, "
+               << "<a href=\"/connections?page=" << page + 1
+               << "&psize=" << psize << "\">next page</a> "
+               "(add &cols=remoteside,protocol,... to select columns)\n";
+        } else {
+            os << "(showing " << (total_count == 0 ? 0 : offset + 1) << '-'
+               << offset + shown << " of " << total_count << " connections, "
+               "append ?page=" << page + 1 << "&psize=" << psize
+               << " for the next page, ?cols=remoteside,protocol,... to "
+               "select columns, or ?givemeall for everything)\n";
+        }
+    }
+    if (FLAGS_connections_cache_second > 0) {
+        const int64_t age_s =
+            (butil::gettimeofday_us() - snapshot_real_us) / 1000000L;
+        if (age_s > 0) {
+            os << (use_html ? "<br>" : "") << "(snapshot taken " << age_s
+               << "s ago, append ?nocache to refresh)"
+               << (use_html ? "<br>\n" : "\n");
+        }
+    }
 
     if (use_html) {
         os << "</body></html>\n";
     }
-    
+
     os.move_to(cntl->response_attachment());
     cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
 }
@@ -19,6 +19,8 @@
 #ifndef BRPC_CONNECTIONS_SERVICE_H
 #define BRPC_CONNECTIONS_SERVICE_H
 
+#include <vector>
+#include "butil/synchronization/lock.h"
 #include "brpc/socket_id.h"
 #include "brpc/builtin_service.pb.h"
 #include "brpc/builtin/tabbed.h"
@@ -29,16 +31,47 @@ namespace brpc {
 class Acceptor;
 class ConnectionsService : public connections, public Tabbed {
 public:
+    ConnectionsService()
+        : _cache_real_us(0)
+        , _cached_server_conn_count(0)
+        , _cached_channel_conn_count(0) {}
+
     void default_method(::google::protobuf::RpcController* cntl_base,
                         const ::brpc::ConnectionsRequest* request,
                         ::brpc::ConnectionsResponse* response,
                         ::google::protobuf::Closure* done);
 
     void GetTabInfo(TabInfoList* info_list) const;
-    
+
 private:
+    // Bitset over the columns of the page, see ParseColumnFilter() in
+    // connections_service.cpp for the recognized names.
+    typedef unsigned ColumnMask;
+
     void PrintConnections(std::ostream& os, const std::vector<SocketId>& conns,
-                          bool use_html, const Server*, bool need_local) const;
+                          bool use_html, const Server*, bool need_local,
+                          ColumnMask cols) const;
+
+    // Fill `server_conns'/`channel_conns' with the SocketIds in
+    // [offset, offset + max_count) of the concatenation of all server-side
+    // and channel-side connections, served from a snapshot refreshed at
+    // most once per -connections_cache_second. Also fills the counters and
+    // the collection time of the snapshot.
+    void GetConnectionsMaybeCached(const Server* server, bool nocache,
+                                   size_t offset, size_t max_count,
+                                   std::vector<SocketId>* server_conns,
+                                   std::vector<SocketId>* channel_conns,
+                                   size_t* server_conn_count,
+                                   int64_t* channel_conn_count,
+                                   size_t* total_count,
+                                   int64_t* snapshot_real_us);
+
+    butil::Mutex _cache_mutex;
+    int64_t _cache_real_us;
+    size_t _cached_server_conn_count;
+    int64_t _cached_channel_conn_count;
+    std::vector<SocketId> _cached_server_conns;
+    std::vector<SocketId> _cached_channel_conns;
 };
 
 } // namespace brpc
@@ -19,12 +19,14 @@
 #include <ostream>
 #include <dirent.h>                    // opendir
 #include <fcntl.h>                     // O_RDONLY
+#include <sys/stat.h>                  // fstat
 #include "butil/fd_guard.h"
 #include "butil/fd_utility.h"
 
 #include "brpc/closure_guard.h"        // ClosureGuard
 #include "brpc/controller.h"           // Controller
 #include "brpc/builtin/common.h"
+#include "brpc/progressive_writer.h"   // NewFileRegionWriter
 #include "brpc/builtin/dir_service.h"
 
 
@@ -54,9 +56,22 @@ void DirService::default_method(::google::protobuf::RpcController* cntl_base,
             cntl->SetFailed(errno, "Cannot open `%s'", open_path.c_str());
             return;
         }
-        butil::make_non_blocking(fd);
         butil::make_close_on_exec(fd);
 
+        // Stream regular files bigger than one read through a
+        // ProgressiveWriter: the whole file is transferred (instead of
+        // being truncated at MAX_READ) with flat memory regardless of
+        // its size.
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > (off_t)MAX_READ) {
+            cntl->http_response().set_content_type("application/octet-stream");
+            cntl->WriteProgressiveAttachmentBy(
+                NewFileRegionWriter(fd.release(), 0, st.st_size));
+            return;
+        }
+        butil::make_non_blocking(fd);
+
         butil::IOPortal read_portal;
         size_t total_read = 0;
         do {
@@ -185,6 +185,16 @@ void FlagsService::default_method(::google::protobuf::RpcController* cntl_base,
         return;
     }
 
+    // Cache the full listing only; filtered views vary per request.
+    std::string cache_key;
+    if (constraint.empty()) {
+        cache_key = butil::string_printf(
+            "%p/flags:%d", cntl->server(), (int)use_html);
+        if (ServeBuiltinPageFromCache(cntl, cache_key)) {
+            return;
+        }
+    }
+
     // Parse query-string which is comma-separated flagnames/wildcards.
     std::vector<std::string> wildcards;
     std::set<std::string> exact;
@@ -245,7 +255,9 @@ void FlagsService::default_method(::google::protobuf::RpcController* cntl_base,
         os << "</table></body></html>\n";
     }
     os.move_to(cntl->response_attachment());
-    cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    if (cache_key.empty() || !StoreBuiltinPage(cntl, cache_key)) {
+        cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    }
 }
 
 void FlagsService::GetTabInfo(TabInfoList* info_list) const {
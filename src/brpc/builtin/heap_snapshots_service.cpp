@@ -0,0 +1,82 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/controller.h"           // Controller
+#include "brpc/details/heap_snapshots.h"
+#include "brpc/builtin/heap_snapshots_service.h"
+
+namespace brpc {
+
+void HeapSnapshotsService::default_method(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HeapSnapshotsRequest*,
+    ::brpc::HeapSnapshotsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+
+    HeapSnapshotKeeper* keeper = GetHeapSnapshotKeeper();
+    if (keeper == NULL) {
+        cntl->SetFailed(ENOMETHOD, "Heap snapshots are not enabled, set "
+                        "-enable_heap_snapshots and run with a sampling "
+                        "heap profiler(tcmalloc with "
+                        "TCMALLOC_SAMPLE_PARAMETER or jemalloc with "
+                        "MALLOC_CONF=prof:true)");
+        return;
+    }
+    const URI& uri = cntl->http_request().uri();
+    butil::IOBufBuilder os;
+    std::string error;
+
+    if (uri.GetQuery("take") != NULL) {
+        const int id = keeper->TakeSnapshot(&error);
+        if (id < 0) {
+            cntl->SetFailed(-1, "Fail to take heap snapshot: %s",
+                            error.c_str());
+            return;
+        }
+        os << "Took snapshot=" << id << "\n\n";
+    }
+
+    const std::string* base_str = uri.GetQuery("base");
+    const std::string* cur_str = uri.GetQuery("cur");
+    if (base_str != NULL && cur_str != NULL) {
+        int max_sites = 50;
+        const std::string* max_str = uri.GetQuery("max_sites");
+        if (max_str != NULL && atoi(max_str->c_str()) > 0) {
+            max_sites = atoi(max_str->c_str());
+        }
+        if (!keeper->Diff(atoi(base_str->c_str()), atoi(cur_str->c_str()),
+                          max_sites, os, &error)) {
+            cntl->SetFailed(EINVAL, "%s", error.c_str());
+            return;
+        }
+        os.move_to(cntl->response_attachment());
+        return;
+    }
+
+    keeper->ListSnapshots(os);
+    os << "\nDiff two snapshots with "
+        "/heap_snapshots?base=OLD_ID&cur=NEW_ID(&max_sites=N), take one "
+        "immediately with /heap_snapshots?take=1\n";
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
@@ -30,6 +30,7 @@
 #include "brpc/reloadable_flags.h"
 #include "brpc/builtin/pprof_perl.h"
 #include "brpc/builtin/hotspots_service.h"
+#include "brpc/details/continuous_profiler.h"
 #include "brpc/details/tcmalloc_extension.h"
 
 extern "C" {
@@ -606,6 +607,74 @@ static void DisplayResult(Controller* cntl,
     }
 }
 
+DECLARE_int32(continuous_profiling_window_seconds);
+
+// Render the chunks buffered by the continuous profiler instantly, without
+// starting a new profiling run.
+static void DisplayContinuousProfile(Controller* cntl,
+                                     ::google::protobuf::Closure* done,
+                                     const butil::IOBuf& result_prefix) {
+    ClosureGuard done_guard(done);
+    butil::IOBuf& resp = cntl->response_attachment();
+    const bool use_html = UseHTML(cntl->http_request());
+    butil::IOBufBuilder os;
+    ContinuousProfiler* profiler = GetContinuousProfiler();
+    if (profiler == NULL) {
+        os << result_prefix
+           << "Continuous profiling is not enabled, restart the server with "
+              "-enable_continuous_profiling (the cpu profiler must be linked)"
+           << (use_html ? "</body></html>" : "\n");
+        os.move_to(resp);
+        cntl->http_response().set_status_code(HTTP_STATUS_FORBIDDEN);
+        return;
+    }
+    int seconds = FLAGS_continuous_profiling_window_seconds;
+    const std::string* param =
+        cntl->http_request().uri().GetQuery("seconds");
+    if (param != NULL) {
+        char* endptr = NULL;
+        const long sec = strtol(param->c_str(), &endptr, 10);
+        if (endptr != param->c_str() + param->length() || sec <= 0) {
+            os << result_prefix << "Invalid seconds"
+               << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(HTTP_STATUS_BAD_REQUEST);
+            return;
+        }
+        seconds = sec;
+    }
+    butil::IOBuf merged;
+    if (!profiler->DumpMergedProfile(seconds, &merged)) {
+        os << result_prefix
+           << "No continuous profile was collected in the last " << seconds
+           << " seconds yet, try again later"
+           << (use_html ? "</body></html>" : "\n");
+        os.move_to(resp);
+        cntl->http_response().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+        return;
+    }
+    char prof_name[128];
+    if (MakeProfName(PROFILING_CPU, prof_name, sizeof(prof_name)) != 0 ||
+        strlen(prof_name) + 6 >= sizeof(prof_name)) {
+        os << result_prefix << "Fail to create prof name: " << berror()
+           << (use_html ? "</body></html>" : "\n");
+        os.move_to(resp);
+        cntl->http_response().set_status_code(HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    // Distinguish from an ad-hoc profile taken in the same second.
+    strcat(prof_name, "_cont");
+    if (!WriteSmallFile(prof_name, merged)) {
+        os << result_prefix << "Fail to write " << prof_name
+           << (use_html ? "</body></html>" : "\n");
+        os.move_to(resp);
+        cntl->http_response().set_status_code(HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return;
+    }
+    DisplayResult(cntl, done_guard.release(), prof_name, result_prefix,
+                  PROFILING_CPU);
+}
+
 static void DoProfiling(ProfilingType type,
                         ::google::protobuf::RpcController* cntl_base,
                         ::google::protobuf::Closure* done) {
@@ -643,6 +712,12 @@ static void DoProfiling(ProfilingType type,
         return;
     }
 
+    if (type == PROFILING_CPU &&
+        cntl->http_request().uri().GetQuery("continuous") != NULL) {
+        DisplayContinuousProfile(cntl, done_guard.release(), os.buf());
+        return;
+    }
+
     const int seconds = ReadSeconds(cntl);
     if ((type == PROFILING_CPU || type == PROFILING_CONTENTION)) {
         if (seconds < 0) {
@@ -753,7 +828,11 @@ static void DoProfiling(ProfilingType type,
                 HTTP_STATUS_INTERNAL_SERVER_ERROR);
             return NotifyWaiters(type, cntl, view);
         }
+        // Stop the continuous profiler(if running) which would make
+        // ProfilerStart below fail.
+        SuspendContinuousProfiling();
         if (!ProfilerStart(prof_name)) {
+            ResumeContinuousProfiling();
             os << "Another profiler (not via /hotspots/cpu) is running, "
                 "try again later" << (use_html ? "</body></html>" : "\n");
             os.move_to(resp);
@@ -764,6 +843,7 @@ static void DoProfiling(ProfilingType type,
             PLOG(WARNING) << "Profiling has been interrupted";
         }
         ProfilerStop();
+        ResumeContinuousProfiling();
     } else if (type == PROFILING_CONTENTION) {
         if (!bthread::ContentionProfilerStart(prof_name)) {
             os << "Another profiler (not via /hotspots/contention) is running, "
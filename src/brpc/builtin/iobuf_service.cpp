@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/iobuf.h"
+#include "brpc/controller.h"           // Controller
+#include "brpc/closure_guard.h"        // ClosureGuard
+#include "brpc/builtin/common.h"
+#include "brpc/builtin/iobuf_service.h"
+
+namespace brpc {
+
+static const char* const LIFETIME_BUCKET_NAMES[] =
+    { "<1ms", "<10ms", "<100ms", "<1s", "<10s", ">=10s" };
+BAIDU_CASSERT(arraysize(LIFETIME_BUCKET_NAMES) ==
+              butil::IOBuf::BlockSiteStat::NLIFETIME_BUCKET,
+              inconsistent_lifetime_buckets);
+
+void IOBufService::default_method(::google::protobuf::RpcController* cntl_base,
+                                  const ::brpc::IOBufRequest*,
+                                  ::brpc::IOBufResponse*,
+                                  ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    const bool use_html = UseHTML(cntl->http_request());
+    cntl->http_response().set_content_type(
+        use_html ? "text/html" : "text/plain");
+    butil::IOBufBuilder os;
+    if (use_html) {
+        os << "<!DOCTYPE html><html><head>" << gridtable_style()
+           << "</head><body>";
+    }
+    os << "block_count: " << butil::IOBuf::block_count() << '\n'
+       << "block_memory: " << butil::IOBuf::block_memory() << '\n'
+       << "block_count_hit_tls_threshold: "
+       << butil::IOBuf::block_count_hit_tls_threshold() << '\n'
+       << "new_bigview_count: " << butil::IOBuf::new_bigview_count() << '\n';
+    if (use_html) {
+        os << "<table class=\"gridtable\" border=\"1\"><tr>"
+              "<th>alloc_site</th><th>blocks</th><th>memory</th>";
+        for (size_t i = 0; i < arraysize(LIFETIME_BUCKET_NAMES); ++i) {
+            os << "<th>" << LIFETIME_BUCKET_NAMES[i] << "</th>";
+        }
+        os << "</tr>";
+    } else {
+        os << "\nblocks by allocation site"
+              "(lifetime buckets count died blocks):\n";
+    }
+    for (int site = 0; site < butil::IOBuf::BLOCK_SITE_NUM; ++site) {
+        butil::IOBuf::BlockSiteStat stat;
+        butil::IOBuf::get_block_site_stat(site, &stat);
+        if (use_html) {
+            os << "<tr><td>" << butil::IOBuf::block_alloc_site_name(site)
+               << "</td><td>" << stat.nblock
+               << "</td><td>" << stat.memory << "</td>";
+            for (size_t i = 0; i < arraysize(LIFETIME_BUCKET_NAMES); ++i) {
+                os << "<td>" << stat.lifetime_buckets[i] << "</td>";
+            }
+            os << "</tr>";
+        } else {
+            os << butil::IOBuf::block_alloc_site_name(site)
+               << ": blocks=" << stat.nblock
+               << " memory=" << stat.memory
+               << " lifetime=[";
+            for (size_t i = 0; i < arraysize(LIFETIME_BUCKET_NAMES); ++i) {
+                os << (i > 0 ? " " : "") << LIFETIME_BUCKET_NAMES[i]
+                   << ':' << stat.lifetime_buckets[i];
+            }
+            os << "]\n";
+        }
+    }
+    if (use_html) {
+        os << "</table></body></html>";
+    }
+    os.move_to(cntl->response_attachment());
+}
+
+} // namespace brpc
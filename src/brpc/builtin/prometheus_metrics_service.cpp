@@ -19,9 +19,14 @@
 #include <vector>
 #include <iomanip>
 #include <map>
+#include <gflags/gflags.h>
+#include "butil/synchronization/lock.h"
+#include "butil/time.h"
 #include "brpc/controller.h"                // Controller
 #include "brpc/server.h"                    // Server
 #include "brpc/closure_guard.h"             // ClosureGuard
+#include "brpc/progressive_attachment.h"    // ProgressiveAttachment
+#include "brpc/reloadable_flags.h"
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/builtin/common.h"
 #include "bvar/bvar.h"
@@ -38,6 +43,20 @@ namespace brpc {
 // Defined in server.cpp
 extern const char* const g_server_info_prefix;
 
+DEFINE_int32(prometheus_metrics_cache_ms, 0,
+             "If positive, /brpc_metrics caches its formatted output for so "
+             "many milliseconds so that concurrent or frequent scrapers "
+             "share one formatting pass instead of each re-formatting all "
+             "variables");
+BRPC_VALIDATE_GFLAG(prometheus_metrics_cache_ms, NonNegativeInteger);
+
+DEFINE_bool(prometheus_metrics_streaming, false,
+            "Write /brpc_metrics output to the response progressively in "
+            "chunks as variables are formatted instead of buffering the "
+            "whole output, limiting peak memory with huge numbers of "
+            "variables");
+BRPC_VALIDATE_GFLAG(prometheus_metrics_streaming, PassValidate);
+
 // This is a class that convert bvar result to prometheus output.
 // Currently the output only includes gauge and summary for two
 // reasons:
@@ -48,18 +67,33 @@ extern const char* const g_server_info_prefix;
 class PrometheusMetricsDumper : public bvar::Dumper {
 public:
     explicit PrometheusMetricsDumper(butil::IOBufBuilder* os,
-                                     const std::string& server_prefix)
+                                     const std::string& server_prefix,
+                                     ProgressiveAttachment* pa = NULL)
         : _os(os)
-        , _server_prefix(server_prefix) {
+        , _server_prefix(server_prefix)
+        , _pa(pa) {
     }
 
     bool dump(const std::string& name, const butil::StringPiece& desc) override;
     bool dump_mvar(const std::string& name, const butil::StringPiece& desc) override;
     bool dump_comment(const std::string& name, const std::string& type) override;
 
+    // Move whatever was formatted so far to the progressive attachment.
+    // No-op without one. Returns false when the connection was broken.
+    bool Flush();
+
 private:
     DISALLOW_COPY_AND_ASSIGN(PrometheusMetricsDumper);
 
+    // Flush to the progressive attachment once enough output piled up, so
+    // the formatted text leaves the process in chunks instead of being
+    // buffered wholly.
+    static const size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    bool MaybeFlush() {
+        return _pa == NULL || _os->buf().size() < FLUSH_THRESHOLD || Flush();
+    }
+
     // Return true iff name ends with suffix output by LatencyRecorder.
     bool DumpLatencyRecorderSuffix(const butil::StringPiece& name,
                                    const butil::StringPiece& desc);
@@ -81,9 +115,55 @@ private:
 private:
     butil::IOBufBuilder* _os;
     const std::string _server_prefix;
+    ProgressiveAttachment* _pa;
     std::map<std::string, SummaryItems> _m;
 };
 
+bool PrometheusMetricsDumper::Flush() {
+    if (_pa == NULL) {
+        return true;
+    }
+    butil::IOBuf piece;
+    _os->move_to(piece);
+    if (piece.empty()) {
+        return true;
+    }
+    return _pa->Write(piece) == 0;
+}
+
+// The "# HELP <name>\n# TYPE <name> gauge\n" section of a variable never
+// changes, pre-render it once instead of re-assembling it from pieces on
+// every scrape. The cache is capped since names of per-connection bvars
+// come and go.
+static void AppendGaugeComment(butil::IOBufBuilder& os,
+                               const butil::StringPiece& metrics_name) {
+    static const size_t MAX_CACHED_COMMENTS = 16384;
+    static butil::Mutex s_comment_mutex;
+    static std::map<std::string, std::string> s_comments;
+    const std::string key = metrics_name.as_string();
+    {
+        BAIDU_SCOPED_LOCK(s_comment_mutex);
+        std::map<std::string, std::string>::const_iterator
+            it = s_comments.find(key);
+        if (it != s_comments.end()) {
+            os << it->second;
+            return;
+        }
+    }
+    std::string block;
+    block.reserve(key.size() * 2 + 32);
+    block.append("# HELP ");
+    block.append(key);
+    block.append("\n# TYPE ");
+    block.append(key);
+    block.append(" gauge\n");
+    os << block;
+    BAIDU_SCOPED_LOCK(s_comment_mutex);
+    if (s_comments.size() < MAX_CACHED_COMMENTS) {
+        s_comments[key].swap(block);
+    }
+}
+
 butil::StringPiece GetMetricsName(const std::string& name) {
     auto pos = name.find_first_of('{');
     int size = (pos == std::string::npos) ? name.size() : pos;
@@ -99,15 +179,14 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
     if (DumpLatencyRecorderSuffix(name, desc)) {
         // Has encountered name with suffix exposed by LatencyRecorder,
         // Leave it to DumpLatencyRecorderSuffix to output Summary.
-        return true;
+        return MaybeFlush();
     }
 
     auto metrics_name = GetMetricsName(name);
 
-    *_os << "# HELP " << metrics_name << '\n'
-         << "# TYPE " << metrics_name << " gauge" << '\n'
-         << name << " " << desc << '\n';
-    return true;
+    AppendGaugeComment(*_os, metrics_name);
+    *_os << name << " " << desc << '\n';
+    return MaybeFlush();
 }
 
 bool PrometheusMetricsDumper::dump_mvar(const std::string& name, const butil::StringPiece& desc) {
@@ -116,13 +195,13 @@ bool PrometheusMetricsDumper::dump_mvar(const std::string& name, const butil::St
         return true;
     }
     *_os << name << " " << desc << "\n";
-    return true;
+    return MaybeFlush();
 }
 
 bool PrometheusMetricsDumper::dump_comment(const std::string& name, const std::string& type) {
     *_os << "# HELP " << name << '\n'
          << "# TYPE " << name << " " << type << '\n';
-    return true;
+    return MaybeFlush();
 }
 
 const PrometheusMetricsDumper::SummaryItems*
@@ -215,29 +294,88 @@ void PrometheusMetricsService::default_method(::google::protobuf::RpcController*
     ClosureGuard done_guard(done);
     Controller *cntl = static_cast<Controller*>(cntl_base);
     cntl->http_response().set_content_type("text/plain");
+    if (FLAGS_prometheus_metrics_streaming) {
+        butil::intrusive_ptr<ProgressiveAttachment> pa =
+            cntl->CreateProgressiveAttachment();
+        if (pa != NULL) {
+            // Send the header now so that formatted chunks below leave the
+            // process as they are produced instead of piling up in memory.
+            done_guard.release()->Run();
+            if (FLAGS_prometheus_metrics_cache_ms > 0) {
+                // The cached pass is one shared IOBuf, writing it out is
+                // zero-copy albeit not incremental.
+                butil::IOBuf output;
+                if (DumpPrometheusMetricsToIOBuf(&output) == 0) {
+                    pa->Write(output);
+                }
+            } else {
+                DumpPrometheusMetrics(NULL, pa.get());
+            }
+            return;
+        }
+        // Can't write progressively(e.g. h2 connection), fall through.
+    }
     if (DumpPrometheusMetricsToIOBuf(&cntl->response_attachment()) != 0) {
         cntl->SetFailed("Fail to dump metrics");
         return;
     }
 }
 
-int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
+int DumpPrometheusMetrics(butil::IOBuf* output, ProgressiveAttachment* pa) {
     butil::IOBufBuilder os;
-    PrometheusMetricsDumper dumper(&os, g_server_info_prefix);
+    PrometheusMetricsDumper dumper(&os, g_server_info_prefix, pa);
     const int ndump = bvar::Variable::dump_exposed(&dumper, NULL);
     if (ndump < 0) {
         return -1;
     }
-    os.move_to(*output);
+    if (output != NULL) {
+        os.move_to(*output);
+    }
 
     if (bvar::FLAGS_bvar_max_dump_multi_dimension_metric_number > 0) {
-        PrometheusMetricsDumper dumper_md(&os, g_server_info_prefix);
+        PrometheusMetricsDumper dumper_md(&os, g_server_info_prefix, pa);
         const int ndump_md = bvar::MVariableBase::dump_exposed(&dumper_md, NULL);
         if (ndump_md < 0) {
             return -1;
         }
-        output->append(butil::IOBuf::Movable(os.buf()));
+        if (output != NULL) {
+            output->append(butil::IOBuf::Movable(os.buf()));
+        }
+        if (!dumper_md.Flush()) {
+            return -1;
+        }
+    }
+    return dumper.Flush() ? 0 : -1;
+}
+
+int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output) {
+    const int cache_ms = FLAGS_prometheus_metrics_cache_ms;
+    if (cache_ms <= 0) {
+        return DumpPrometheusMetrics(output, NULL);
+    }
+    // Scrapers within the TTL share the formatting pass of the first one.
+    // Concurrent scrapers wait on the mutex and then hit the fresh cache.
+    // Appending an IOBuf is zero-copy.
+    static butil::Mutex s_cache_mutex;
+    static butil::IOBuf* s_cached_metrics = NULL;
+    static int64_t s_cached_at_ms = 0;
+    BAIDU_SCOPED_LOCK(s_cache_mutex);
+    const int64_t now_ms = butil::cpuwide_time_ms();
+    if (s_cached_metrics != NULL &&
+        now_ms >= s_cached_at_ms && now_ms - s_cached_at_ms < cache_ms) {
+        output->append(*s_cached_metrics);
+        return 0;
+    }
+    butil::IOBuf fresh;
+    if (DumpPrometheusMetrics(&fresh, NULL) != 0) {
+        return -1;
+    }
+    if (s_cached_metrics == NULL) {
+        s_cached_metrics = new butil::IOBuf;
     }
+    *s_cached_metrics = fresh;
+    s_cached_at_ms = now_ms;
+    output->append(butil::IOBuf::Movable(fresh));
     return 0;
 }
 
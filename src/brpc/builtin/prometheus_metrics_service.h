@@ -23,6 +23,8 @@
 
 namespace brpc {
 
+class ProgressiveAttachment;
+
 class PrometheusMetricsService : public brpc_metrics {
 public:
     void default_method(::google::protobuf::RpcController* cntl_base,
@@ -32,6 +34,14 @@ public:
 };
 
 butil::StringPiece GetMetricsName(const std::string& name);
+
+// Format all variables. When `pa' is not NULL the text is written to it
+// in chunks as variables are formatted, otherwise it's appended to
+// `output'(which must not be NULL then).
+int DumpPrometheusMetrics(butil::IOBuf* output, ProgressiveAttachment* pa);
+
+// Above with pa=NULL, plus the short-TTL output cache controlled by
+// -prometheus_metrics_cache_ms.
 int DumpPrometheusMetricsToIOBuf(butil::IOBuf* output);
 
 } // namepace brpc
@@ -17,6 +17,7 @@
 
 
 #include <ostream>
+#include "butil/string_printf.h"
 #include <google/protobuf/descriptor.h>     // ServiceDescriptor
 #include "brpc/controller.h"           // Controller
 #include "brpc/server.h"               // Server
@@ -53,6 +54,15 @@ void StatusService::default_method(::google::protobuf::RpcController* cntl_base,
     // can load values more easily.
     cntl->http_response().set_content_type(
         use_html ? "text/html" : "text/plain");
+
+    std::string cache_key;
+    if (cntl->http_request().uri().GetQuery("expand") == NULL) {
+        cache_key = butil::string_printf(
+            "%p/status:%d", server, (int)use_html);
+        if (ServeBuiltinPageFromCache(cntl, cache_key)) {
+            return;
+        }
+    }
     butil::IOBufBuilder os;
     std::string str;
     if (use_html) {
@@ -260,7 +270,9 @@ void StatusService::default_method(::google::protobuf::RpcController* cntl_base,
         os << "</div></body></html>";
     }
     os.move_to(cntl->response_attachment());
-    cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    if (cache_key.empty() || !StoreBuiltinPage(cntl, cache_key)) {
+        cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    }
 }
 
 void StatusService::GetTabInfo(TabInfoList* info_list) const {
@@ -18,6 +18,7 @@
 
 #include <ostream>
 #include <vector>                           // std::vector
+#include "butil/string_printf.h"
 #include "butil/string_splitter.h"
 #include "bvar/bvar.h"
 
@@ -336,6 +337,18 @@ void VarsService::default_method(::google::protobuf::RpcController* cntl_base,
     cntl->http_response().set_content_type(
         use_html ? "text/html" : "text/plain");
 
+    // Only the unfiltered page is cached; searches and expanded views are
+    // rare interactive uses and stay rendered per request.
+    std::string cache_key;
+    if (cntl->http_request().unresolved_path().empty() &&
+        cntl->http_request().uri().GetQuery("expand") == NULL) {
+        cache_key = butil::string_printf(
+            "%p/vars:%d%d", cntl->server(), (int)use_html, (int)with_tabs);
+        if (ServeBuiltinPageFromCache(cntl, cache_key)) {
+            return;
+        }
+    }
+
     butil::IOBufBuilder os;
     if (with_tabs) {
         os << "<!DOCTYPE html><html><head>\n"
@@ -426,7 +439,9 @@ void VarsService::default_method(::google::protobuf::RpcController* cntl_base,
         os << "</div></body></html>";
     }
     os.move_to(cntl->response_attachment());
-    cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    if (cache_key.empty() || !StoreBuiltinPage(cntl, cache_key)) {
+        cntl->set_response_compress_type(COMPRESS_TYPE_GZIP);
+    }
 }
 
 void VarsService::GetTabInfo(TabInfoList* info_list) const {
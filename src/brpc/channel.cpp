@@ -25,7 +25,9 @@
 #include "butil/third_party/murmurhash3/murmurhash3.h"
 #include "butil/strings/string_util.h"
 #include "bthread/unstable.h"                        // bthread_timer_add
+#include "bthread/id.h"                              // bthread_id_join_spin
 #include "brpc/socket_map.h"                         // SocketMapInsert
+#include "brpc/egress_rate_limiter.h"                // EgressRateLimiter
 #include "brpc/compress.h"
 #include "brpc/global.h"
 #include "brpc/span.h"
@@ -35,8 +37,11 @@
 #include "brpc/serialized_request.h"
 #include "brpc/serialized_response.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
+#include "brpc/details/timeout_coalescer.h"          // CoalesceTimeout
+#include "brpc/rpc_deadline.h"                       // GetCurrentRpcDeadline
 #include "brpc/rdma/rdma_helper.h"
 #include "brpc/policy/esp_authenticator.h"
+#include "brpc/reloadable_flags.h"
 
 namespace brpc {
 
@@ -49,6 +54,19 @@ DEFINE_string(health_check_path, "", "Http path of health check call."
     "sure the server functions well).");
 DEFINE_int32(health_check_timeout_ms, 500, "The timeout for both establishing "
     "the connection and the http call to -health_check_path over the connection");
+DEFINE_bool(propagate_rpc_deadline, false, "Clamp timeout of RPCs issued "
+    "while serving a request carrying a deadline(e.g. grpc-timeout) to the "
+    "remaining budget, and fail RPCs whose budget is already exhausted");
+DEFINE_int32(rpc_deadline_hop_margin_ms, 5, "Milliseconds subtracted from "
+    "the remaining budget before each hop when -propagate_rpc_deadline is "
+    "on, reserving time for sending back the response");
+DEFINE_int32(rpc_sync_spin_us, 0, "When positive, a synchronous call whose "
+    "channel recently finished sync calls within so many microseconds(on "
+    "average) busy-spins up to that long for the response before parking "
+    "the calling thread, skipping a park/unpark pair and a context switch "
+    "for ultra-low-latency RPCs. Burns CPU while spinning, keep it small "
+    "(e.g. below 100). 0 disables spinning");
+BRPC_VALIDATE_GFLAG(rpc_sync_spin_us, NonNegativeInteger);
 
 ChannelOptions::ChannelOptions()
     : connect_timeout_ms(200)
@@ -56,6 +74,7 @@ ChannelOptions::ChannelOptions()
     , backup_request_ms(-1)
     , max_retry(3)
     , enable_circuit_breaker(false)
+    , parse_response_on_arena(false)
     , protocol(PROTOCOL_BAIDU_STD)
     , connection_type(CONNECTION_TYPE_UNKNOWN)
     , succeed_without_server(true)
@@ -64,7 +83,11 @@ ChannelOptions::ChannelOptions()
     , auth(NULL)
     , backup_request_policy(NULL)
     , retry_policy(NULL)
+    , retry_budget(NULL)
     , ns_filter(NULL)
+    , micro_batch_window_us(0)
+    , micro_batch_max_count(20)
+    , max_egress_bytes_per_second(0)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -78,7 +101,8 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
     if (opt.auth == NULL &&
         !opt.has_ssl_options() &&
         opt.connection_group.empty() &&
-        opt.hc_option.health_check_path.empty()) {
+        opt.hc_option.health_check_path.empty() &&
+        opt.egress_limiter == NULL) {
         // Returning zeroized result by default is more intuitive for users.
         return ChannelSignature();
     }
@@ -123,6 +147,12 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
         if (opt.use_rdma) {
             buf.append("|rdma");
         }
+        if (opt.egress_limiter != NULL) {
+            // Sockets shaped by different limiters must not be shared.
+            const EgressRateLimiter* lim = opt.egress_limiter.get();
+            buf.append("|egress=");
+            buf.append((char*)&lim, sizeof(lim));
+        }
         butil::MurmurHash3_x64_128_Update(&mm_ctx, buf.data(), buf.size());
         buf.clear();
     
@@ -153,7 +183,8 @@ Channel::Channel(ProfilerLinker)
     , _serialize_request(NULL)
     , _pack_request(NULL)
     , _get_method_name(NULL)
-    , _preferred_index(-1) {
+    , _preferred_index(-1)
+    , _avg_sync_latency_us(0) {
 }
 
 Channel::~Channel() {
@@ -191,6 +222,16 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
         _options.hc_option.health_check_path = FLAGS_health_check_path;
         _options.hc_option.health_check_timeout_ms = FLAGS_health_check_timeout_ms;
     }
+    if (_options.max_egress_bytes_per_second > 0) {
+        if (_options.egress_limiter == NULL) {
+            _options.egress_limiter = std::make_shared<EgressRateLimiter>(
+                _options.max_egress_bytes_per_second);
+        } else {
+            // An explicitly shared group limiter, just update its rate.
+            _options.egress_limiter->set_max_bytes_per_second(
+                _options.max_egress_bytes_per_second);
+        }
+    }
     if (_options.use_rdma) {
 #if BRPC_WITH_RDMA
         if (!OptionsAvailableForRdma(&_options)) {
@@ -369,7 +410,8 @@ int Channel::InitSingle(const butil::EndPoint& server_addr_and_port,
         return -1;
     }
     if (SocketMapInsert(SocketMapKey(server_addr_and_port, sig),
-                        &_server_id, ssl_ctx, _options.use_rdma, _options.hc_option) != 0) {
+                        &_server_id, ssl_ctx, _options.use_rdma,
+                        _options.hc_option, _options.egress_limiter) != 0) {
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
@@ -409,6 +451,7 @@ int Channel::Init(const char* ns_url,
     ns_opt.use_rdma = _options.use_rdma;
     ns_opt.channel_signature = ComputeChannelSignature(_options);
     ns_opt.hc_option =  _options.hc_option;
+    ns_opt.egress_limiter = _options.egress_limiter;
     if (CreateSocketSSLContext(_options, &ns_opt.ssl_ctx) != 0) {
         return -1;
     }
@@ -461,9 +504,16 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     }
     cntl->_preferred_index = _preferred_index;
     cntl->_retry_policy = _options.retry_policy;
+    if (NULL == cntl->_retry_budget) {
+        // NULL unless overridden by Controller.set_retry_budget().
+        cntl->_retry_budget = _options.retry_budget;
+    }
     if (_options.enable_circuit_breaker) {
         cntl->add_flag(Controller::FLAGS_ENABLED_CIRCUIT_BREAKER);
     }
+    if (_options.parse_response_on_arena) {
+        cntl->add_flag(Controller::FLAGS_RESPONSE_ON_ARENA);
+    }
     const CallId correlation_id = cntl->call_id();
     const int rc = bthread_id_lock_and_reset_range(
                     correlation_id, NULL, 2 + cntl->max_retry());
@@ -517,6 +567,10 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
     cntl->_connect_timeout_ms = _options.connect_timeout_ms;
+    if (_options.micro_batch_window_us > 0) {
+        cntl->_micro_batch_window_us = _options.micro_batch_window_us;
+        cntl->_micro_batch_max_count = _options.micro_batch_max_count;
+    }
     if (cntl->backup_request_ms() == UNSET_MAGIC_NUM &&
         NULL == cntl->_backup_request_policy) {
         cntl->set_backup_request_ms(_options.backup_request_ms);
@@ -539,15 +593,42 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     // Share the lb with controller.
     cntl->_lb = _lb;
 
+    // Inherit the remaining budget of the RPC being served(if any) so that
+    // deadlines propagate down call chains automatically. Fail before
+    // serialization when the budget is already used up to cut wasted
+    // downstream work during overload.
+    if (FLAGS_propagate_rpc_deadline) {
+        const int64_t deadline_us = GetCurrentRpcDeadline();
+        if (deadline_us >= 0) {
+            const int64_t budget_ms =
+                (deadline_us - start_send_real_us) / 1000L
+                - FLAGS_rpc_deadline_hop_margin_ms;
+            if (budget_ms <= 0) {
+                cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the RPC being "
+                                "served was exceeded before calling %s",
+                                (method ? method->full_name().c_str()
+                                        : "null-method"));
+                return cntl->HandleSendFailed();
+            }
+            if (cntl->timeout_ms() < 0 || budget_ms < cntl->timeout_ms()) {
+                cntl->set_timeout_ms(budget_ms);
+            }
+        }
+    }
+
     // Ensure that serialize_request is done before pack_request in all
     // possible executions, including:
     //   HandleSendFailed => OnVersionedRPCReturned => IssueRPC(pack_request)
-    _serialize_request(&cntl->_request_buf, cntl, request);
-    if (cntl->FailedInline()) {
-        // Handle failures caused by serialize_request, and these error_codes
-        // should be excluded from the retry_policy.
-        return cntl->HandleSendFailed();
-    }
+    if (!cntl->has_preserialized_request()) {
+        _serialize_request(&cntl->_request_buf, cntl, request);
+        if (cntl->FailedInline()) {
+            // Handle failures caused by serialize_request, and these
+            // error_codes should be excluded from the retry_policy.
+            return cntl->HandleSendFailed();
+        }
+    } // else _request_buf holds the serialized request already, shared by
+      // the caller(see ParallelChannel). The blocks are refcounted, pack
+      // and retries read them without copying.
     if (FLAGS_usercode_in_pthread &&
         done != NULL &&
         TooManyUserCode()) {
@@ -590,13 +671,18 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
 
         // _deadline_us is for truncating _connect_timeout_ms
         cntl->_deadline_us = cntl->timeout_ms() * 1000L + start_send_real_us;
-        const int rc = bthread_timer_add(
-            &cntl->_timeout_id,
-            butil::microseconds_to_timespec(cntl->_deadline_us),
-            HandleTimeout, (void*)correlation_id.value);
-        if (BAIDU_UNLIKELY(rc != 0)) {
-            cntl->SetFailed(rc, "Fail to add timer for timeout");
-            return cntl->HandleSendFailed();
+        // Calls whose deadlines quantize to the same bucket share one
+        // timer, see details/timeout_coalescer.h. _timeout_id stays 0 then
+        // and EndRPC has nothing to delete.
+        if (!CoalesceTimeout(cntl->_deadline_us, correlation_id)) {
+            const int rc = bthread_timer_add(
+                &cntl->_timeout_id,
+                butil::microseconds_to_timespec(cntl->_deadline_us),
+                HandleTimeout, (void*)correlation_id.value);
+            if (BAIDU_UNLIKELY(rc != 0)) {
+                cntl->SetFailed(rc, "Fail to add timer for timeout");
+                return cntl->HandleSendFailed();
+            }
         }
     } else {
         cntl->_deadline_us = -1;
@@ -607,11 +693,36 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         // MUST wait for response when sending synchronous RPC. It will
         // be woken up by callback when RPC finishes (succeeds or still
         // fails after retry)
-        Join(correlation_id);
+        const int32_t spin_us = FLAGS_rpc_sync_spin_us;
+        if (spin_us > 0) {
+            // Spin before parking only when recent sync calls on this
+            // channel finished within the spin budget, so that the spin
+            // likely succeeds. Longer calls park as usual.
+            const int64_t avg_us =
+                _avg_sync_latency_us.load(butil::memory_order_relaxed);
+            if (avg_us > 0 && avg_us <= spin_us) {
+                bthread_id_join_spin(correlation_id, spin_us);
+            } else {
+                Join(correlation_id);
+            }
+        } else {
+            Join(correlation_id);
+        }
         if (cntl->_span) {
             cntl->SubmitSpan();
         }
-        cntl->OnRPCEnd(butil::gettimeofday_us());
+        const int64_t end_us = butil::gettimeofday_us();
+        if (spin_us > 0) {
+            // EMA over the last ~8 sync calls. Racing updates may drop
+            // a sample, which is fine for a heuristic.
+            const int64_t lat_us = end_us - start_send_real_us;
+            const int64_t prev_us =
+                _avg_sync_latency_us.load(butil::memory_order_relaxed);
+            _avg_sync_latency_us.store(
+                prev_us > 0 ? prev_us + (lat_us - prev_us) / 8 : lat_us,
+                butil::memory_order_relaxed);
+        }
+        cntl->OnRPCEnd(end_us);
     }
 }
 
@@ -644,4 +755,60 @@ int Channel::CheckHealth() {
     }
 }
 
+int Channel::Warmup(int num_connections) {
+    if (num_connections <= 0) {
+        LOG(ERROR) << "Invalid num_connections=" << num_connections;
+        return -1;
+    }
+    if (!SingleServer()) {
+        LOG(ERROR) << "Channel::Warmup() only supports single-server "
+                      "channels currently";
+        return -1;
+    }
+    if (_options.connection_type == CONNECTION_TYPE_SHORT) {
+        LOG(ERROR) << "Short connections cannot be warmed up";
+        return -1;
+    }
+    SocketUniquePtr main_sock;
+    if (Socket::Address(_server_id, &main_sock) != 0) {
+        LOG(ERROR) << "Fail to address SocketId=" << _server_id;
+        return -1;
+    }
+    if (_options.connection_type != CONNECTION_TYPE_POOLED) {
+        const timespec duetime =
+            butil::milliseconds_from_now(_options.connect_timeout_ms);
+        return main_sock->Warmup(&duetime) == 0 ? 1 : -1;
+    }
+    // Pooled connections: RPCs run on sockets from the pool rather than
+    // the main socket. Take `num_connections' sockets out (popping idle
+    // ones first, creating the rest), connect the fresh ones, then give
+    // all of them back so the pool holds at least that many established
+    // connections.
+    std::vector<SocketUniquePtr> pooled_socks;
+    pooled_socks.reserve(num_connections);
+    int established = 0;
+    for (int i = 0; i < num_connections; ++i) {
+        SocketUniquePtr ptr;
+        if (main_sock->GetPooledSocket(&ptr) != 0) {
+            break;
+        }
+        const timespec duetime =
+            butil::milliseconds_from_now(_options.connect_timeout_ms);
+        if (ptr->Warmup(&duetime) == 0) {
+            ++established;
+            pooled_socks.push_back(std::move(ptr));
+        } else {
+            ptr->SetFailed(ENOTCONN, "Fail to warm up pooled connection to %s",
+                           butil::endpoint2str(_server_address).c_str());
+        }
+    }
+    for (size_t i = 0; i < pooled_socks.size(); ++i) {
+        pooled_socks[i]->ReturnToPool();
+    }
+    // Keep SocketMap's idle pruning from closing the pool below the
+    // warmed size (it also replenishes the pool in the background).
+    main_sock->SetMinPooledSocketCount(num_connections);
+    return established;
+}
+
 } // namespace brpc
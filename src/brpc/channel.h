@@ -24,6 +24,7 @@
 
 #include <ostream>                          // std::ostream
 #include "bthread/errno.h"                  // Redefine errno
+#include "butil/atomicops.h"                // butil::atomic
 #include "butil/intrusive_ptr.hpp"          // butil::intrusive_ptr
 #include "butil/ptr_container.h"
 #include "brpc/ssl_options.h"               // ChannelSSLOptions
@@ -34,12 +35,15 @@
 #include "brpc/controller.h"                // brpc::Controller
 #include "brpc/details/profiler_linker.h"
 #include "brpc/retry_policy.h"
+#include "brpc/retry_budget.h"
 #include "brpc/backup_request_policy.h"
 #include "brpc/naming_service_filter.h"
 #include "brpc/health_check_option.h"
 
 namespace brpc {
 
+class EgressRateLimiter;
+
 struct ChannelOptions {
     // Constructed with default options.
     ChannelOptions();
@@ -79,6 +83,17 @@ struct ChannelOptions {
     // Default: false
     bool enable_circuit_breaker;
 
+    // Parse responses into a message allocated from a pooled
+    // google::protobuf::Arena owned by the Controller instead of the
+    // response passed to CallMethod, which stays untouched. Read the result
+    // via Controller.arena_response(), which is valid until the controller
+    // is Reset-ed or destroyed; copy it out (e.g. with CopyFrom) on the rare
+    // paths that need it longer. Eliminates per-repeated-field heap
+    // allocations for responses that are read once and discarded.
+    // Currently effective for baidu_std responses.
+    // Default: false
+    bool parse_response_on_arena;
+
     // Serialization protocol, defined in src/brpc/options.proto
     // NOTE: You can assign name of the protocol to this field as well, for
     // Example: options.protocol = "baidu_std";
@@ -130,6 +145,16 @@ struct ChannelOptions {
     // Default: NULL
     const RetryPolicy* retry_policy;
 
+    // Budget that retries and backup requests of this channel draw from,
+    // replenished by successful calls, bounding load amplification during
+    // downstream brownouts. May be shared by several channels to throttle
+    // them together. The interface is defined in src/brpc/retry_budget.h
+    // Overridable by Controller.set_retry_budget().
+    // This object is NOT owned by channel and should remain valid when
+    // channel is used.
+    // Default: NULL (retries are only limited by max_retry)
+    RetryBudget* retry_budget;
+
     // Filter ServerNodes (i.e. based on `tag' field of `ServerNode')
     // which are generated by NamingService. The interface is defined
     // in src/brpc/naming_service_filter.h
@@ -144,10 +169,41 @@ struct ChannelOptions {
     // Default: ""
     std::string connection_group;
 
-    // Set the health check param according to the channel granularity. 
+    // Set the health check param according to the channel granularity.
     // Its priority is higher than FLAGS_health_check_path and FLAGS_health_check_timeout_ms.
     // When it is not set, FLAGS_health_check_path and FLAGS_health_check_timeout_ms will take effect.
     HealthCheckOption hc_option;
+
+    // Hold each write into connections of this channel for so many
+    // microseconds, so that requests issued meanwhile go out in one write.
+    // With multiplexed protocols(e.g. baidu_std) the batched messages sit
+    // back-to-back on the connection and responses are demultiplexed by
+    // correlation id as usual. Effective for clients issuing huge amounts
+    // of tiny RPCs to few servers where per-write cost dominates. Adds up
+    // to so much latency to every call of this channel.
+    // Default: 0 (disabled)
+    int32_t micro_batch_window_us;
+
+    // [Only effective when micro_batch_window_us is positive]
+    // Flush before the window expires once so many requests are queued.
+    // Non-positive values never flush early.
+    // Default: 20
+    int32_t micro_batch_max_count;
+
+    // Limit the total bytes per second written into all connections of
+    // this channel(one shared token bucket), so that e.g. a bulk
+    // replication channel cannot saturate the NIC and delay other
+    // traffic. When positive, Init() fills `egress_limiter' with a new
+    // EgressRateLimiter. See egress_rate_limiter.h.
+    // Default: 0 (unlimited)
+    int64_t max_egress_bytes_per_second;
+
+    // Shape several channels as one group by putting the same
+    // shared_ptr here. Set automatically when max_egress_bytes_per_second
+    // is positive. Channels with different limiters never share
+    // connections.
+    // Default: NULL (no shaping)
+    std::shared_ptr<EgressRateLimiter> egress_limiter;
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ChannelOptions from being bloated in most cases.
@@ -166,6 +222,7 @@ private:
 class Channel : public ChannelBase {
 friend class Controller;
 friend class SelectiveChannel;
+friend class ParallelChannel;
 public:
     Channel(ProfilerLinker = ProfilerLinker());
     virtual ~Channel();
@@ -194,6 +251,8 @@ public:
     //   wrr                          # weighted round robin
     //   la                           # locality aware
     //   c_murmurhash/c_md5           # consistent hashing with murmurhash3/md5
+    //   c_wyhash                     # consistent hashing with wyhash, faster
+    //                                # but places the ring differently
     //   "" or NULL                   # treat `naming_service_url' as `server_addr_and_port'
     //                                # Init(xxx, "", options) and Init(xxx, NULL, options)
     //                                # are exactly same with Init(xxx, options)
@@ -222,6 +281,18 @@ public:
 
     int CheckHealth();
 
+    // Pre-establish connections (including SSL handshake) so that the
+    // first RPCs after a (re)start don't pay connect latency serially.
+    // With CONNECTION_TYPE_SINGLE, connects the (single) main socket and
+    // `num_connections' is ignored. With CONNECTION_TYPE_POOLED, fills
+    // the connection pool up to `num_connections' connections and keeps
+    // idle pruning of SocketMap from closing the pool below that number.
+    // Blocks until the connections are established or
+    // options().connect_timeout_ms expires per connection. Only
+    // supported by single-server channels currently.
+    // Returns the number of connections established, -1 on error.
+    int Warmup(int num_connections = 1);
+
 protected:
     bool SingleServer() const { return _lb.get() == NULL; }
 
@@ -253,6 +324,10 @@ protected:
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
     ChannelOptions _options;
     int _preferred_index;
+    // EMA of latencies of recent synchronous calls on this channel, in
+    // microseconds. 0 until the first sync call finishes. Gates the
+    // spin-before-park optimization, see -rpc_sync_spin_us in channel.cpp.
+    butil::atomic<int64_t> _avg_sync_latency_us;
 };
 
 enum ChannelOwnership {
@@ -52,6 +52,12 @@ DEFINE_int32(circuit_breaker_half_open_window_size, 0,
     "go to the closed state. Otherwise, it goes back to the open state. "
     "Values == 0 disables this feature");
 BRPC_VALIDATE_GFLAG(circuit_breaker_half_open_window_size, NonNegativeInteger);
+DEFINE_int32(circuit_breaker_success_sample_rate, 1,
+    "Update the EMA windows for one out of so many successful calls, each "
+    "sampled call carrying the weight of the skipped ones. Failed calls "
+    "are always recorded so breaking behavior is equivalent. 1 records "
+    "every call.");
+BRPC_VALIDATE_GFLAG(circuit_breaker_success_sample_rate, PositiveInteger);
 
 namespace {
 // EPSILON is used to generate the smoothing coefficient when calculating EMA.
@@ -81,21 +87,26 @@ CircuitBreaker::EmaErrorRecorder::EmaErrorRecorder(int window_size,
 }
 
 bool CircuitBreaker::EmaErrorRecorder::OnCallEnd(int error_code,
-                                                 int64_t latency) {
+                                                 int64_t latency,
+                                                 int weight) {
+    // A sample standing for `weight' calls decays the EMAs as if the
+    // skipped calls were recorded one by one with the same latency.
+    const double smooth =
+        (weight == 1 ? _smooth : std::pow(_smooth, weight));
     int64_t ema_latency = 0;
     bool healthy = false;
     if (error_code == 0) {
-        ema_latency = UpdateLatency(latency);
-        healthy = UpdateErrorCost(0, ema_latency);
+        ema_latency = UpdateLatency(latency, smooth);
+        healthy = UpdateErrorCost(0, ema_latency, smooth);
     } else {
         ema_latency = _ema_latency.load(butil::memory_order_relaxed);
-        healthy = UpdateErrorCost(latency, ema_latency);
+        healthy = UpdateErrorCost(latency, ema_latency, smooth);
     }
 
     // When the window is initializing, use error_rate to determine
     // if it needs to be isolated.
     if (_sample_count_when_initializing.load(butil::memory_order_relaxed) < _window_size &&
-        _sample_count_when_initializing.fetch_add(1, butil::memory_order_relaxed) < _window_size) {
+        _sample_count_when_initializing.fetch_add(weight, butil::memory_order_relaxed) < _window_size) {
         if (error_code != 0) {
             const int32_t error_count =
                 _error_count_when_initializing.fetch_add(1, butil::memory_order_relaxed);
@@ -118,14 +129,15 @@ void CircuitBreaker::EmaErrorRecorder::Reset() {
     _ema_error_cost.store(0, butil::memory_order_relaxed);
 }
 
-int64_t CircuitBreaker::EmaErrorRecorder::UpdateLatency(int64_t latency) {
+int64_t CircuitBreaker::EmaErrorRecorder::UpdateLatency(int64_t latency,
+                                                        double smooth) {
     int64_t ema_latency = _ema_latency.load(butil::memory_order_relaxed);
     do {
         int64_t next_ema_latency = 0;
         if (0 == ema_latency) {
             next_ema_latency = latency;
         } else {
-            next_ema_latency = ema_latency * _smooth + latency * (1 - _smooth);
+            next_ema_latency = ema_latency * smooth + latency * (1 - smooth);
         }
         if (_ema_latency.compare_exchange_weak(ema_latency, next_ema_latency)) {
             return next_ema_latency;
@@ -134,7 +146,8 @@ int64_t CircuitBreaker::EmaErrorRecorder::UpdateLatency(int64_t latency) {
 }
 
 bool CircuitBreaker::EmaErrorRecorder::UpdateErrorCost(int64_t error_cost,
-                                                       int64_t ema_latency) {
+                                                       int64_t ema_latency,
+                                                       double smooth) {
     const int max_mutiple = FLAGS_circuit_breaker_max_failed_latency_mutiple;
     if (ema_latency != 0) {
         error_cost = std::min(ema_latency * max_mutiple, error_cost);
@@ -160,7 +173,7 @@ bool CircuitBreaker::EmaErrorRecorder::UpdateErrorCost(int64_t error_cost,
                 break;
             }
         } else {
-            int64_t next_ema_error_cost = ema_error_cost * _smooth;
+            int64_t next_ema_error_cost = ema_error_cost * smooth;
             if (_ema_error_cost.compare_exchange_weak(
                 ema_error_cost, next_ema_error_cost)) {
                 break;
@@ -210,8 +223,25 @@ bool CircuitBreaker::OnCallEnd(int error_code, int64_t latency) {
         }
     }
 
-    if (_long_window.OnCallEnd(error_code, latency) &&
-        _short_window.OnCallEnd(error_code, latency)) {
+    // Error-biased sampling: failed calls are always recorded, successful
+    // ones for 1 out of --circuit_breaker_success_sample_rate, each
+    // sampled one carrying the weight of the skipped ones. The tick is
+    // thread-local and shared by all breakers of the thread, which keeps
+    // the hot path free of shared writes and still samples each node at
+    // the configured rate on average.
+    int weight = 1;
+    const int rate = FLAGS_circuit_breaker_success_sample_rate;
+    if (rate > 1 && error_code == 0) {
+        static __thread int tls_success_tick = 0;
+        if (++tls_success_tick < rate) {
+            return true;
+        }
+        tls_success_tick = 0;
+        weight = rate;
+    }
+
+    if (_long_window.OnCallEnd(error_code, latency, weight) &&
+        _short_window.OnCallEnd(error_code, latency, weight)) {
         return true;
     }
     MarkAsBroken();
@@ -19,6 +19,7 @@
 #define BRPC_CIRCUIT_BREAKER_H
 
 #include "butil/atomicops.h"
+#include "butil/macros.h"
 
 namespace brpc {
 
@@ -64,12 +65,15 @@ private:
     class EmaErrorRecorder {
     public:
         EmaErrorRecorder(int windows_size,  int max_error_percent);
-        bool OnCallEnd(int error_code, int64_t latency);
+        // `weight' is the number of calls this sample stands for, > 1 when
+        // successful calls are sampled by --circuit_breaker_success_sample_rate.
+        bool OnCallEnd(int error_code, int64_t latency, int weight);
         void Reset();
 
     private:
-        int64_t UpdateLatency(int64_t latency);
-        bool UpdateErrorCost(int64_t latency, int64_t ema_latency);
+        int64_t UpdateLatency(int64_t latency, double smooth);
+        bool UpdateErrorCost(int64_t latency, int64_t ema_latency,
+                             double smooth);
 
         const int _window_size;
         const int _max_error_percent;
@@ -86,7 +90,11 @@ private:
     int64_t _last_reset_time_ms;
     butil::atomic<int> _isolation_duration_ms;
     butil::atomic<int> _isolated_times;
-    butil::atomic<bool> _broken;
+    // Read on every call(and by node selection) but written only when the
+    // node breaks or recovers; aligned onto its own cacheline so that the
+    // EMA counters above, updated per response, do not keep invalidating
+    // it. The members below it are written rarely as well.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<bool> _broken;
     butil::atomic<bool> _half_open;
     butil::atomic<int32_t> _half_open_success_count;
 };
@@ -16,7 +16,10 @@
 // under the License.
 
 
+#include <algorithm>
+#include <vector>
 #include "butil/logging.h"
+#include "bthread/bthread.h"
 #include "json2pb/json_to_pb.h"
 #include "brpc/compress.h"
 #include "brpc/protocol.h"
@@ -111,6 +114,66 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
     return handler->Compress(serializer, buf);
 }
 
+namespace {
+struct ChunkCompressArgs {
+    bool (*compress_chunk)(const butil::IOBuf&, butil::IOBuf*);
+    const butil::IOBuf* whole;
+    size_t offset;
+    size_t length;
+    butil::IOBuf out;
+    bool ok;
+};
+}
+
+static void* RunCompressChunk(void* void_args) {
+    ChunkCompressArgs* args = (ChunkCompressArgs*)void_args;
+    butil::IOBuf chunk;
+    // Referencing blocks of `whole', no copying.
+    args->whole->append_to(&chunk, args->length, args->offset);
+    args->ok = args->compress_chunk(chunk, &args->out);
+    return NULL;
+}
+
+bool ParallelCompress(const butil::IOBuf& data, butil::IOBuf* out,
+                      size_t chunk_bytes,
+                      bool (*compress_chunk)(const butil::IOBuf&, butil::IOBuf*)) {
+    if (0 == chunk_bytes || data.size() <= chunk_bytes) {
+        return compress_chunk(data, out);
+    }
+    const size_t nchunk = (data.size() + chunk_bytes - 1) / chunk_bytes;
+    std::vector<ChunkCompressArgs> args(nchunk);
+    std::vector<bthread_t> tids(nchunk, INVALID_BTHREAD);
+    for (size_t i = 0; i < nchunk; ++i) {
+        args[i].compress_chunk = compress_chunk;
+        args[i].whole = &data;
+        args[i].offset = i * chunk_bytes;
+        args[i].length = std::min(chunk_bytes, data.size() - args[i].offset);
+        args[i].ok = false;
+    }
+    for (size_t i = 1; i < nchunk; ++i) {
+        if (bthread_start_background(
+                &tids[i], NULL, RunCompressChunk, &args[i]) != 0) {
+            tids[i] = INVALID_BTHREAD;
+            RunCompressChunk(&args[i]);
+        }
+    }
+    RunCompressChunk(&args[0]);
+    bool ok = args[0].ok;
+    for (size_t i = 1; i < nchunk; ++i) {
+        if (tids[i] != INVALID_BTHREAD) {
+            bthread_join(tids[i], NULL);
+        }
+        ok = ok && args[i].ok;
+    }
+    if (!ok) {
+        return false;
+    }
+    for (size_t i = 0; i < nchunk; ++i) {
+        out->append(butil::IOBuf::Movable(args[i].out));
+    }
+    return true;
+}
+
 ::google::protobuf::Metadata Serializer::GetMetadata() const {
     ::google::protobuf::Metadata metadata{};
     metadata.descriptor = SerializerBase::descriptor();
@@ -196,6 +196,16 @@ bool SerializeAsCompressedData(const google::protobuf::Message& msg,
                                butil::IOBuf* buf,
                                CompressType compress_type);
 
+// Cut `data' into chunks of `chunk_bytes' bytes, compress the chunks
+// concurrently on bthreads with `compress_chunk' and append the per-chunk
+// outputs to `out' in order. The codec must produce self-delimiting output
+// whose concatenation decompresses to the concatenation of the inputs,
+// e.g. gzip members or zstd frames.
+// Returns true iff all chunks are compressed successfully.
+bool ParallelCompress(const butil::IOBuf& data, butil::IOBuf* out,
+                      size_t chunk_bytes,
+                      bool (*compress_chunk)(const butil::IOBuf&, butil::IOBuf*));
+
 } // namespace brpc
 
 
@@ -19,11 +19,14 @@
 #include <signal.h>
 #include <openssl/md5.h>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/arena.h>
 #include <gflags/gflags.h>
 #include "bthread/bthread.h"
 #include "butil/build_config.h"    // OS_MACOSX
 #include "butil/string_printf.h"
 #include "butil/logging.h"
+#include "butil/object_pool.h"
+#include "butil/arena.h"
 #include "butil/time.h"
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
@@ -39,11 +42,15 @@
 #include "brpc/server.h"   // Server::_session_local_data_pool
 #include "brpc/simple_data_pool.h"
 #include "brpc/retry_policy.h"
+#include "brpc/retry_budget.h"
 #include "brpc/stream_impl.h"
 #include "brpc/policy/streaming_rpc_protocol.h" // FIXME
 #include "brpc/rpc_dump.h"
+#include "brpc/progressive_writer.h"
 #include "brpc/details/usercode_backup_pool.h"  // RunUserCode
+#include "brpc/details/timeout_coalescer.h"  // CoalesceTimeout
 #include "brpc/mongo_service_adaptor.h"
+#include "brpc/details/method_status.h"  // HwPerfSnapshot
 
 // Force linking the .o in UT (which analysis deps by inclusions)
 #include "brpc/parallel_channel.h"
@@ -165,6 +172,27 @@ Controller::~Controller() {
     ResetNonPods();
 }
 
+Controller* Controller::TakeFromObjectPool() {
+    // get_object() runs the constructor on fresh memory only; a recycled
+    // Controller comes back exactly as ReturnToObjectPool() left it, i.e.
+    // fully Reset() with containers keeping their capacity.
+    return butil::get_object<Controller>();
+}
+
+void Controller::ReturnToObjectPool(Controller* cntl) {
+    if (cntl == NULL) {
+        return;
+    }
+    // The destructor of a pooled Controller never runs, do its session-KV
+    // flush here. Reset() handles everything else.
+    if (cntl->_session_kv != nullptr && cntl->_session_kv->Count() != 0) {
+        LOG(INFO) << SessionKVFlusher{ cntl };
+        cntl->_session_kv.reset();
+    }
+    cntl->Reset();
+    butil::return_object(cntl);
+}
+
 class IgnoreAllRead : public ProgressiveReader {
 public:
     // @ProgressiveReader
@@ -192,8 +220,24 @@ void Controller::ResetNonPods() {
     if (_session_local_data) {
         _server->_session_local_data_pool->Return(_session_local_data);
     }
+    // _accessed may live inside _arena, destroy it before the arena's
+    // blocks are recycled below.
+    ExcludedServers::Destroy(_accessed);
+    _accessed = NULL;
+    if (_arena) {
+        // Keep the largest block inside so that the next RPC borrowing this
+        // arena from the pool allocates without hitting heap.
+        _arena->reset();
+        butil::return_object(_arena);
+    }
+    if (_response_arena) {
+        // _arena_response lives inside this arena, no deletion needed.
+        _response_arena->Reset();
+        butil::return_object(_response_arena);
+    }
     _mongo_session_data.reset();
     delete _sampled_request;
+    delete _hw_perf_snapshot;
 
     if (!is_used_by_rpc() && _correlation_id != INVALID_BTHREAD_ID) {
         CHECK_NE(EPERM, bthread_id_cancel(_correlation_id));
@@ -204,10 +248,11 @@ void Controller::ResetNonPods() {
     if (_pchan_sub_count > 0) {
         DestroyParallelChannelDone(_done);
     }
-    delete _sender;
+    if (_sender) {
+        _sender->Destroy();
+    }
     _lb.reset(NULL);
     _current_call.Reset();
-    ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
     delete _http_request;
     delete _http_response;
@@ -247,19 +292,24 @@ void Controller::ResetPods() {
 #endif
     _error_code = 0;
     _session_local_data = NULL;
+    _arena = NULL;
     _server = NULL;
     _oncancel_id = INVALID_BTHREAD_ID;
     _auth_context = NULL;
     _sampled_request = NULL;
+    _hw_perf_snapshot = NULL;
     _request_protocol = PROTOCOL_UNKNOWN;
     _max_retry = UNSET_MAGIC_NUM;
     _retry_policy = NULL;
+    _retry_budget = NULL;
     _correlation_id = INVALID_BTHREAD_ID;
     _connection_type = CONNECTION_TYPE_UNKNOWN;
     _timeout_ms = UNSET_MAGIC_NUM;
     _backup_request_ms = UNSET_MAGIC_NUM;
     _backup_request_policy = NULL;
     _connect_timeout_ms = UNSET_MAGIC_NUM;
+    _micro_batch_window_us = 0;
+    _micro_batch_max_count = 0;
     _real_timeout_ms = UNSET_MAGIC_NUM;
     _deadline_us = -1;
     _timeout_id = 0;
@@ -276,6 +326,8 @@ void Controller::ResetPods() {
     _inheritable.Reset();
     _pchan_sub_count = 0;
     _response = NULL;
+    _response_arena = NULL;
+    _arena_response = NULL;
     _done = NULL;
     _sender = NULL;
     _request_code = 0;
@@ -627,10 +679,18 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
             CHECK_EQ(0, bthread_id_unlock(info.id));
             return;
         }
+        if (NULL != _retry_budget && !_retry_budget->TakeToken()) {
+            // Budget exhausted, give up the backup request and wait for
+            // the original call as if backup was not configured.
+            _error_code = saved_error;
+            CHECK_EQ(0, bthread_id_unlock(info.id));
+            return;
+        }
 
         // Reset timeout if needed
         int rc = 0;
-        if (timeout_ms() >= 0) {
+        if (timeout_ms() >= 0 &&
+            !CoalesceTimeout(_deadline_us, _correlation_id)) {
             rc = bthread_timer_add(
                     &_timeout_id,
                     butil::microseconds_to_timespec(_deadline_us),
@@ -643,7 +703,8 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
         if (!SingleServer()) {
             if (_accessed == NULL) {
                 _accessed = ExcludedServers::Create(
-                    std::min(_max_retry, RETRY_AVOIDANCE));
+                    std::min(_max_retry, RETRY_AVOIDANCE),
+                    has_flag(FLAGS_ACCESSED_OUTLIVES_RESET) ? NULL : arena());
                 if (NULL == _accessed) {
                     SetFailed(ENOMEM, "Fail to create ExcludedServers");
                     goto END_OF_RPC;
@@ -663,7 +724,11 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
         return IssueRPC(butil::gettimeofday_us());
     } else {
         auto retry_policy = _retry_policy ? _retry_policy : DefaultRetryPolicy();
-        if (retry_policy->DoRetry(this)) {
+        // Take from the budget after the policy agreed to retry so that
+        // non-retrying errors do not count as exhaustion. When the budget
+        // ran out, fail with the current error as if max_retry was reached.
+        if (retry_policy->DoRetry(this) &&
+            (NULL == _retry_budget || _retry_budget->TakeToken())) {
             // The error must come from _current_call because:
             //  * we intercepted error from _unfinished_call in OnVersionedRPCReturned
             //  * ERPCTIMEDOUT/ECANCELED are not retrying error by default.
@@ -671,7 +736,9 @@ void Controller::OnVersionedRPCReturned(const CompletionInfo& info,
             if (!SingleServer()) {
                 if (_accessed == NULL) {
                     _accessed = ExcludedServers::Create(
-                            std::min(_max_retry, RETRY_AVOIDANCE));
+                            std::min(_max_retry, RETRY_AVOIDANCE),
+                            has_flag(FLAGS_ACCESSED_OUTLIVES_RESET)
+                            ? NULL : arena());
                     if (NULL == _accessed) {
                         SetFailed(ENOMEM, "Fail to create ExcludedServers");
                         goto END_OF_RPC;
@@ -786,6 +853,8 @@ void Controller::Call::OnComplete(
     if (sending_sock != NULL) {
         if (error_code != 0) {
             sending_sock->AddRecentError();
+        } else {
+            sending_sock->RecordInbandSuccess();
         }
 
         if (enable_circuit_breaker) {
@@ -997,6 +1066,9 @@ void Controller::OnRPCEnd(int64_t end_time_us) {
     if (NULL != _backup_request_policy) {
         _backup_request_policy->OnRPCEnd(this);
     }
+    if (NULL != _retry_budget && 0 == _error_code) {
+        _retry_budget->OnCallSucceeded();
+    }
 }
 
 void Controller::RunDoneInBackupThread(void* arg) {
@@ -1231,6 +1303,8 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
     wopt.auth_flags = _auth_flags;
     wopt.ignore_eovercrowded = has_flag(FLAGS_IGNORE_EOVERCROWDED);
     wopt.write_in_background = write_to_socket_in_background();
+    wopt.micro_batch_window_us = _micro_batch_window_us;
+    wopt.micro_batch_max_count = _micro_batch_max_count;
     int rc;
     size_t packet_size = 0;
     if (user_packet_guard) {
@@ -1403,6 +1477,30 @@ void* Controller::session_local_data() {
     return NULL;
 }
 
+butil::Arena* Controller::arena() {
+    if (NULL == _arena) {
+        _arena = butil::get_object<butil::Arena>();
+    }
+    return _arena;
+}
+
+google::protobuf::Arena* Controller::response_arena() {
+    if (NULL == _response_arena) {
+        _response_arena = butil::get_object<google::protobuf::Arena>();
+    }
+    return _response_arena;
+}
+
+google::protobuf::Message* Controller::ResponseParseTarget() {
+    if (!has_flag(FLAGS_RESPONSE_ON_ARENA) || NULL == _response) {
+        return _response;
+    }
+    if (NULL == _arena_response) {
+        _arena_response = _response->New(response_arena());
+    }
+    return _arena_response;
+}
+
 void Controller::HandleStreamConnection(Socket *host_socket) {
     if (_request_streams.empty()) {
         CHECK(!has_remote_stream());
@@ -1515,11 +1613,33 @@ Controller::CreateProgressiveAttachment(StopStyle stop_style) {
     if (stop_style == FORCE_STOP) {
         httpsock->fail_me_at_server_stop();
     }
+    // A 101 Switching-Protocols response (e.g. websocket upgrade) hands the
+    // raw byte stream over to the attachment, write without chunk-encoding
+    // just like before-HTTP/1.1.
     _wpa.reset(new ProgressiveAttachment(
-                   httpsock, http_request().before_http_1_1()));
+                   httpsock,
+                   http_request().before_http_1_1() ||
+                   http_response().status_code() ==
+                       HTTP_STATUS_SWITCHING_PROTOCOLS));
     return _wpa;
 }
 
+int Controller::WriteProgressiveAttachmentBy(ProgressiveWriter* writer,
+                                             StopStyle stop_style) {
+    if (writer == NULL) {
+        LOG(ERROR) << "Param[writer] is NULL";
+        return -1;
+    }
+    butil::intrusive_ptr<ProgressiveAttachment> pa =
+        CreateProgressiveAttachment(stop_style);
+    if (pa == NULL) {
+        writer->OnEndOfWriting(
+            butil::Status(EINVAL, "Fail to create ProgressiveAttachment"));
+        return -1;
+    }
+    return StartProgressiveWriting(pa.get(), writer);
+}
+
 void Controller::ReadProgressiveAttachmentBy(ProgressiveReader* r) {
     if (r == NULL) {
         LOG(FATAL) << "Param[r] is NULL";
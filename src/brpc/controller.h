@@ -62,6 +62,16 @@ struct x509_st;
 #endif
 }
 
+namespace butil {
+class Arena;
+}
+
+namespace google {
+namespace protobuf {
+class Arena;
+}
+}
+
 namespace brpc {
 class Span;
 class Server;
@@ -71,9 +81,12 @@ class RPCSender;
 class StreamSettings;
 class MongoContext;
 class RetryPolicy;
+class RetryBudget;
 class BackupRequestPolicy;
 class InputMessageBase;
 class ThriftStub;
+struct HwPerfSnapshot;
+class ProgressiveWriter;
 namespace policy {
 class OnServerStreamCreated;
 void ProcessMongoRequest(InputMessageBase*);
@@ -151,6 +164,15 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
     static const uint32_t FLAGS_PB_SINGLE_REPEATED_TO_ARRAY = (1 << 20);
     static const uint32_t FLAGS_MANAGE_HTTP_BODY_ON_ERROR = (1 << 21);
     static const uint32_t FLAGS_WRITE_TO_SOCKET_IN_BACKGROUND = (1 << 22);
+    static const uint32_t FLAGS_PRESERIALIZED_REQUEST = (1 << 23);
+    // _accessed is kept across Reset() (schan reuses sub-controllers within
+    // one RPC), allocate it from heap instead of arena() which is recycled
+    // by Reset().
+    static const uint32_t FLAGS_ACCESSED_OUTLIVES_RESET = (1 << 24);
+    // Parse responses into a message on response_arena() instead of the
+    // response passed to CallMethod. Set from
+    // ChannelOptions.parse_response_on_arena.
+    static const uint32_t FLAGS_RESPONSE_ON_ARENA = (1 << 25);
 
 public:
     struct Inheritable {
@@ -201,6 +223,12 @@ public:
     void set_max_retry(int max_retry);
     int max_retry() const { return _max_retry; }
 
+    // Override ChannelOptions.retry_budget for this call, e.g. to give a
+    // critical method its own reserve. NULL restores the channel's budget.
+    // The budget object is NOT owned and must outlive the call.
+    void set_retry_budget(RetryBudget* budget) { _retry_budget = budget; }
+    RetryBudget* retry_budget() const { return _retry_budget; }
+
     // Get number of retries.
     int retried_count() const { return _current_call.nretry; }
 
@@ -220,6 +248,18 @@ public:
     // Response of the RPC call (passed to CallMethod)
     google::protobuf::Message* response() const { return _response; }
 
+    // [Effective when ChannelOptions.parse_response_on_arena is on]
+    // The message the response was actually parsed into, allocated from
+    // response_arena(); response() stays untouched in this mode. Valid
+    // until this controller is Reset-ed or destroyed, copy it out (e.g.
+    // with CopyFrom) to keep the content longer. NULL when the mode is
+    // off or no response was parsed.
+    google::protobuf::Message* arena_response() const { return _arena_response; }
+
+    // The protobuf arena backing arena_response(). Created lazily from an
+    // ObjectPool and recycled when this controller resets, like arena().
+    google::protobuf::Arena* response_arena();
+
     // An identifier to send to server along with request. This is widely used
     // throughout baidu's servers to tag a searching session (a series of
     // queries following the topology of servers) with a same log_id.
@@ -397,6 +437,11 @@ public:
     void set_write_to_socket_in_background(bool f) { set_flag(FLAGS_WRITE_TO_SOCKET_IN_BACKGROUND, f); }
     bool write_to_socket_in_background() const { return has_flag(FLAGS_WRITE_TO_SOCKET_IN_BACKGROUND); }
 
+    // True if _request_buf was already filled with the serialized request
+    // before Channel::CallMethod, which skips serialization then. Set by
+    // ParallelChannel to share one serialization between sub calls.
+    bool has_preserialized_request() const { return has_flag(FLAGS_PRESERIALIZED_REQUEST); }
+
     // ------------------------------------------------------------------------
     //                      Server-side methods.
     // These calls shall be made from the server side only. Their results are
@@ -465,6 +510,17 @@ public:
 
     bool has_progressive_writer() const { return _wpa != NULL; }
 
+    // Pull-based alternative to CreateProgressiveAttachment(): create a
+    // ProgressiveAttachment and pull chunks of the body from `writer' in
+    // a background bthread whenever the connection can accept more data,
+    // so the full body never needs to be buffered in memory. brpc calls
+    // writer->OnEndOfWriting() exactly once when the writing stops.
+    // See progressive_writer.h for the interface and a built-in writer
+    // emitting a file region.
+    // Returns 0 on success, -1 otherwise (OnEndOfWriting was called).
+    int WriteProgressiveAttachmentBy(ProgressiveWriter* writer,
+                                     StopStyle stop_style = WAIT_FOR_STOP);
+
     // Set compression method for response.
     void set_response_compress_type(CompressType t) { _response_compress_type = t; }
 
@@ -498,6 +554,13 @@ public:
     // RPC. If factory is NULL, this method returns NULL.
     void* session_local_data();
 
+    // A memory arena living until the end of this RPC, for user temporaries
+    // that would otherwise be heap-allocated once per request. The arena is
+    // created lazily from an ObjectPool and returned with its largest block
+    // kept, so steady-state requests using it don't hit heap at all.
+    // Pointers into the arena are invalidated when the RPC ends.
+    butil::Arena* arena();
+
     // Get the data attached to a mongo session(practically a socket).
     MongoContext* mongo_session_data() { return _mongo_session_data.get(); }
     
@@ -527,7 +590,22 @@ public:
         ResetNonPods();
         ResetPods();
     }
-    
+
+    // Take a Controller from a thread-local object pool instead of
+    // constructing one, saving the (rather large) allocation per call on
+    // hot paths. Give it back with ReturnToObjectPool() -- NOT delete --
+    // once the RPC has fully finished: after a synchronous call returned,
+    // or inside/after the done of an asynchronous call. A call still
+    // referencing the Controller disqualifies it from being returned,
+    // typically one with an outstanding ProgressiveReader or a CallId
+    // that other threads may still join or cancel. Controllers sitting
+    // in the pool remain counted by bvar rpc_controller_count.
+    static Controller* TakeFromObjectPool();
+
+    // Reset `cntl' and put it back into the object pool. No-op on NULL.
+    static void ReturnToObjectPool(Controller* cntl);
+
+
     // Causes Failed() to return true on the client side.  "reason" will be
     // incorporated into the message returned by ErrorText().
     // NOTE: Change http_response().status_code() according to `error_code'
@@ -666,6 +744,12 @@ private:
     static void* RunEndRPC(void* arg);
     void EndRPC(const CompletionInfo&);
 
+    // The message the response payload should be parsed into: _response
+    // normally, or a clone of it created on response_arena() when
+    // FLAGS_RESPONSE_ON_ARENA is set. Called by protocols via
+    // ControllerPrivateAccessor.response_parse_target().
+    google::protobuf::Message* ResponseParseTarget();
+
     static int HandleSocketFailed(bthread_id_t, void* data, int error_code,
                                   const std::string& error_text);
     void HandleSendFailed();
@@ -800,17 +884,22 @@ private:
     butil::EndPoint _local_side;
     
     void* _session_local_data;
+    butil::Arena* _arena;
     const Server* _server;
     bthread_id_t _oncancel_id;
     const AuthContext* _auth_context;        // Authentication result
     butil::intrusive_ptr<MongoContext> _mongo_session_data;
     SampledRequest* _sampled_request;
+    // Hardware counters read at request begin for 1/N sampled requests,
+    // see -method_hw_counter_sample_ratio. Owned.
+    HwPerfSnapshot* _hw_perf_snapshot;
 
     ProtocolType _request_protocol;
     // Some of them are copied from `Channel' which might be destroyed
     // after CallMethod.
     int _max_retry;
     const RetryPolicy* _retry_policy;
+    RetryBudget* _retry_budget;
     // Synchronization object for one RPC call. It remains unchanged even
     // when retry happens. Synchronous RPC will wait on this id.
     CallId _correlation_id;
@@ -825,6 +914,10 @@ private:
     // [Timeout related]
     int32_t _timeout_ms;
     int32_t _connect_timeout_ms;
+    // [Micro batching] Copied from ChannelOptions.micro_batch_window_us
+    // (and max_count) when positive, passed to Socket::WriteOptions.
+    int32_t _micro_batch_window_us;
+    int32_t _micro_batch_max_count;
     int32_t _backup_request_ms;
     // Priority: `_backup_request_policy' > `_backup_request_ms'.
     BackupRequestPolicy* _backup_request_policy;
@@ -849,6 +942,9 @@ private:
     Inheritable _inheritable;
     int _pchan_sub_count;
     google::protobuf::Message* _response;
+    // Backing storage of arena-parsed responses, see FLAGS_RESPONSE_ON_ARENA.
+    google::protobuf::Arena* _response_arena;
+    google::protobuf::Message* _arena_response;
     google::protobuf::Closure* _done;
     RPCSender* _sender;
     uint64_t _request_code;
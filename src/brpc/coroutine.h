@@ -25,6 +25,7 @@
 #include <coroutine>
 #include <functional>
 #include <atomic>
+#include <google/protobuf/service.h>  // RpcChannel
 #include "brpc/callback.h"
 
 namespace brpc {
@@ -60,7 +61,8 @@ public:
     // DO NOT call them manually
     bool await_ready();
     template <typename U>
-    void await_suspend(std::coroutine_handle<detail::AwaitablePromise<U> > awaiting);
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<detail::AwaitablePromise<U> > awaiting);
     T await_resume();
 
 private:
@@ -96,6 +98,56 @@ private:
     Awaitable<void> _awaitable;
 };
 
+// Awaiter of one RPC, created by AwaitCall() below. Lives in the awaiting
+// coroutine's (pooled) frame, so a co_await'ed RPC allocates nothing on
+// the heap besides what CallMethod itself does.
+class RpcAwaiter : public google::protobuf::Closure {
+public:
+    RpcAwaiter(google::protobuf::RpcChannel* channel,
+               const google::protobuf::MethodDescriptor* method,
+               google::protobuf::RpcController* cntl,
+               const google::protobuf::Message* request,
+               google::protobuf::Message* response)
+        : _channel(channel)
+        , _method(method)
+        , _cntl(cntl)
+        , _request(request)
+        , _response(response) {}
+
+    // NOTE: called by the compiler, see Awaitable<T>.
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting);
+    void await_resume() const noexcept {}
+
+    // Called by the RPC framework when the call finishes. Resumes the
+    // awaiting coroutine in the calling thread, which runs on the current
+    // TaskGroup like any other RPC done.
+    void Run() override;
+
+private:
+    google::protobuf::RpcChannel* _channel;
+    const google::protobuf::MethodDescriptor* _method;
+    google::protobuf::RpcController* _cntl;
+    const google::protobuf::Message* _request;
+    google::protobuf::Message* _response;
+    std::coroutine_handle<> _awaiting;
+};
+
+// Call `method' of `channel' and suspend the current coroutine until the
+// response arrives. Works with any RpcChannel(Channel, ParallelChannel,
+// SelectiveChannel...). Usage:
+//   brpc::Controller cntl;
+//   EchoResponse response;
+//   co_await AwaitCall(&channel, method, &cntl, &request, &response);
+//   if (cntl.Failed()) { ... }    // same as an asynchronous call
+inline RpcAwaiter AwaitCall(google::protobuf::RpcChannel* channel,
+                            const google::protobuf::MethodDescriptor* method,
+                            google::protobuf::RpcController* cntl,
+                            const google::protobuf::Message* request,
+                            google::protobuf::Message* response) {
+    return RpcAwaiter(channel, method, cntl, request, response);
+}
+
 // Class for management of coroutine
 // 1. To create a new coroutine and wait it finish:
 //  Awaitable<void> func(double val);
@@ -18,6 +18,9 @@
 #ifndef BRPC_COROUTINE_INL_H
 #define BRPC_COROUTINE_INL_H
 
+#include <cstdlib>              // malloc/free
+#include <cstring>              // memset
+#include <new>                  // std::bad_alloc
 #include "bthread/unstable.h"   // bthread_timer_add
 #include "bthread/butex.h"      // butex_wake/butex_wait
 
@@ -26,25 +29,111 @@ namespace experimental {
 
 namespace detail {
 
+// ---- Per-thread pool of coroutine frames ----
+// A coroutine frame is allocated through promise_type::operator new on
+// every call of a coroutine function. Frames of one function have a fixed
+// size, so a per-thread freelist bucketed by size turns the per-call heap
+// allocation into a list pop after warm-up.
+
+// Size of the header keeping the bucket index. Also keeps the returned
+// storage aligned to 16(the default new alignment) since malloc is.
+const size_t CORO_FRAME_HEADER_SIZE = 64;
+// Frames up to CORO_FRAME_HEADER_SIZE * CORO_FRAME_BUCKET_NUM(4KB) bytes
+// are pooled, larger ones fall back to malloc/free.
+const size_t CORO_FRAME_BUCKET_NUM = 64;
+// At most this many cached frames per bucket per thread.
+const size_t CORO_FRAME_PER_BUCKET = 128;
+
+struct CoroFrameCache {
+    void* buckets[CORO_FRAME_BUCKET_NUM];
+    size_t nfree[CORO_FRAME_BUCKET_NUM];
+
+    CoroFrameCache() {
+        memset(buckets, 0, sizeof(buckets));
+        memset(nfree, 0, sizeof(nfree));
+    }
+    ~CoroFrameCache() {
+        for (size_t i = 0; i < CORO_FRAME_BUCKET_NUM; ++i) {
+            void* mem = buckets[i];
+            while (mem != nullptr) {
+                void* next = *(void**)mem;
+                free(mem);
+                mem = next;
+            }
+        }
+    }
+};
+
+inline CoroFrameCache& tls_coro_frame_cache() {
+    static thread_local CoroFrameCache cache;
+    return cache;
+}
+
+inline void* AllocCoroutineFrame(size_t size) {
+    const size_t bucket =
+        (size + 2 * CORO_FRAME_HEADER_SIZE - 1) / CORO_FRAME_HEADER_SIZE;
+    void* mem = nullptr;
+    if (bucket < CORO_FRAME_BUCKET_NUM) {
+        CoroFrameCache& cache = tls_coro_frame_cache();
+        if (cache.buckets[bucket] != nullptr) {
+            mem = cache.buckets[bucket];
+            cache.buckets[bucket] = *(void**)mem;
+            --cache.nfree[bucket];
+        }
+    }
+    if (mem == nullptr) {
+        mem = malloc(bucket * CORO_FRAME_HEADER_SIZE);
+        if (mem == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+    *(size_t*)mem = bucket;
+    return (char*)mem + CORO_FRAME_HEADER_SIZE;
+}
+
+inline void FreeCoroutineFrame(void* ptr) {
+    void* mem = (char*)ptr - CORO_FRAME_HEADER_SIZE;
+    const size_t bucket = *(size_t*)mem;
+    if (bucket < CORO_FRAME_BUCKET_NUM) {
+        CoroFrameCache& cache = tls_coro_frame_cache();
+        if (cache.nfree[bucket] < CORO_FRAME_PER_BUCKET) {
+            *(void**)mem = cache.buckets[bucket];
+            cache.buckets[bucket] = mem;
+            ++cache.nfree[bucket];
+            return;
+        }
+    }
+    free(mem);
+}
+
 class AwaitablePromiseBase {
 public:
     AwaitablePromiseBase() {
     }
 
     virtual ~AwaitablePromiseBase() {
-        delete _suspended_or_done;
+    }
+
+    // Coroutine frames of all Awaitable functions (and standalone
+    // promises like the ones of AwaitableDone) go through the per-thread
+    // frame pool above.
+    static void* operator new(size_t size) {
+        return AllocCoroutineFrame(size);
+    }
+    static void operator delete(void* ptr) {
+        FreeCoroutineFrame(ptr);
     }
 
     virtual void resume() = 0;
     virtual void destroy() = 0;
 
     bool needs_suspend() {
-        return _suspended_or_done != nullptr;
+        return _needs_suspend;
     }
 
     void set_needs_suspend() {
-        _suspended_or_done = new std::atomic<bool>();
-        _suspended_or_done->store(false);
+        _needs_suspend = true;
+        _suspended_or_done.store(false);
     }
 
     // For a Coroutine's leaf function
@@ -55,7 +144,7 @@ public:
     // Then the second suspend_or_done(), exchange(true) will returns true.
     // Then we can safely delete this.
     void suspend_or_done() {
-        if (_suspended_or_done->exchange(true)) {
+        if (_suspended_or_done.exchange(true)) {
             // Already suspend AND done
             if (_caller) {
                 // The leaf function has finished, resume its caller.
@@ -110,8 +199,9 @@ private:
     std::function<void()> _callback;
     // For a Coroutine's leaf function, it is always resumed from another thread.
     // It needs an atomic variable to keep thread safety.
-    // Non-leaf function does't need this, so we defined it as an optional pointer.
-    std::atomic<bool>* _suspended_or_done{nullptr};
+    // Only meaningful after set_needs_suspend().
+    std::atomic<bool> _suspended_or_done{false};
+    bool _needs_suspend{false};
     // For a Coroutine's non-root function, it needs to resume its caller when it finished.
     AwaitablePromiseBase* _caller{nullptr};
 };
@@ -135,6 +225,12 @@ public:
         _coro.destroy();
     }
 
+    // Handle for symmetric transfer, null for standalone promises which
+    // are not backed by a coroutine frame.
+    std::coroutine_handle<> coro_handle() const {
+        return _coro;
+    }
+
     // When we call a coroutine function, an AwaitablePromise<T> will be created.
     // Then call its get_return_object() to return an Awaitable<T>.
     auto get_return_object() {
@@ -164,6 +260,11 @@ public:
         _coro.destroy();
     }
 
+    // See comments in AwaitablePromise<T>::coro_handle().
+    std::coroutine_handle<> coro_handle() const {
+        return _coro;
+    }
+
     // When we call a coroutine function, an AwaitablePromise<void> will be created.
     // Then call its get_return_object() to return an Awaitable<void>.
     auto get_return_object() {
@@ -171,10 +272,10 @@ public:
         return Awaitable<void>(this);
     }
 
-    // When we call return in a coroutine function, return_value() will be called.
-    auto return_value() {
-        return std::suspend_never{};
-    }
+    // Called for `co_return;' and falling off the end of an
+    // Awaitable<void> function. Was mistakenly named return_value()
+    // before, which the compiler never accepted for void coroutines.
+    void return_void() {}
 
 private:
     std::coroutine_handle<AwaitablePromise> _coro;
@@ -192,13 +293,17 @@ inline bool Awaitable<T>::await_ready() {
 // If await_ready returns false, await_suspend() will be called automatically.
 template <typename T>
 template <typename U>
-inline void Awaitable<T>::await_suspend(std::coroutine_handle<detail::AwaitablePromise<U> > awaiting) {
+inline std::coroutine_handle<> Awaitable<T>::await_suspend(
+    std::coroutine_handle<detail::AwaitablePromise<U> > awaiting) {
     _promise->set_caller(&awaiting.promise());
     if (_promise->needs_suspend()) {
         _promise->on_suspend();
-        return;
+        return std::noop_coroutine();
     }
-    _promise->resume();
+    // Symmetric transfer: run the callee directly from this suspend point
+    // instead of a nested resume() call, which would grow the native stack
+    // by one frame per co_await depth.
+    return _promise->coro_handle();
 }
 
 // When the caller resumes from co_await, await_resume() will be called to get return value
@@ -218,6 +323,17 @@ inline void AwaitableDone::Run() {
     _awaitable.promise()->on_done();
 }
 
+inline void RpcAwaiter::await_suspend(std::coroutine_handle<> awaiting) {
+    // The coroutine is already suspended here, thus Run() may legally
+    // resume it from any thread(including in-place inside CallMethod).
+    _awaiting = awaiting;
+    _channel->CallMethod(_method, _cntl, _request, _response, this);
+}
+
+inline void RpcAwaiter::Run() {
+    _awaiting.resume();
+}
+
 template <typename T>
 inline Coroutine::Coroutine(Awaitable<T>&& aw, bool detach) {
     detail::AwaitablePromise<T>* origin_promise = aw.promise();
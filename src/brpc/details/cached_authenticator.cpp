@@ -0,0 +1,82 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gflags/gflags.h>
+#include "butil/time.h"                          // cpuwide_time_ms
+#include "butil/scoped_lock.h"                   // BAIDU_SCOPED_LOCK
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/cached_authenticator.h"
+
+namespace brpc {
+
+DEFINE_int32(auth_result_cache_ttl_ms, 0,
+             "If positive, servers cache results of "
+             "Authenticator::VerifyCredential keyed by the credential for "
+             "so many milliseconds, both successes and failures. Only "
+             "enable this when the result does not depend on the client "
+             "address");
+BRPC_VALIDATE_GFLAG(auth_result_cache_ttl_ms, NonNegativeInteger);
+
+DEFINE_int32(auth_result_cache_max_size, 16384,
+             "Max number of distinct credentials cached by "
+             "-auth_result_cache_ttl_ms, the cache restarts from empty "
+             "when exceeded");
+BRPC_VALIDATE_GFLAG(auth_result_cache_max_size, PositiveInteger);
+
+CachedAuthenticator::CachedAuthenticator(const Authenticator* inner)
+    : _inner(inner) {
+    CHECK_EQ(0, _cache.init(1024));
+}
+
+int CachedAuthenticator::VerifyCredential(const std::string& auth_str,
+                                          const butil::EndPoint& client_addr,
+                                          AuthContext* out_ctx) const {
+    const int64_t now_ms = butil::cpuwide_time_ms();
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        CacheEntry* entry = _cache.seek(auth_str);
+        if (entry != NULL) {
+            if (now_ms < entry->expire_ms) {
+                if (entry->result == 0 && out_ctx != NULL) {
+                    *out_ctx = entry->ctx;
+                }
+                return entry->result;
+            }
+            _cache.erase(auth_str);
+        }
+    }
+    AuthContext ctx;
+    const int rc = _inner->VerifyCredential(auth_str, client_addr, &ctx);
+    if (rc == 0 && out_ctx != NULL) {
+        *out_ctx = ctx;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_cache.size() >= (size_t)FLAGS_auth_result_cache_max_size) {
+        // Entries all share one TTL, tracking LRU is not worth it. Losing
+        // the whole cache at worst re-runs one verify per credential.
+        _cache.clear();
+    }
+    CacheEntry& entry = _cache[auth_str];
+    entry.result = rc;
+    entry.expire_ms = now_ms + FLAGS_auth_result_cache_ttl_ms;
+    if (rc == 0) {
+        entry.ctx = ctx;
+    }
+    return rc;
+}
+
+} // namespace brpc
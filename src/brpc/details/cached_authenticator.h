@@ -0,0 +1,63 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_DETAILS_CACHED_AUTHENTICATOR_H
+#define BRPC_DETAILS_CACHED_AUTHENTICATOR_H
+
+#include "butil/containers/flat_map.h"
+#include "butil/synchronization/lock.h"
+#include "brpc/authenticator.h"
+
+namespace brpc {
+
+// Decorates ServerOptions.auth with a TTL-ed cache of verify results so
+// that identical credentials across connections skip the (potentially
+// cryptographic) VerifyCredential of the wrapped authenticator. Failed
+// verifies are cached as well to shield the authenticator from floods of
+// bad credentials. Installed automatically by Server::StartInternal when
+// -auth_result_cache_ttl_ms is positive, transparently to all protocols.
+//
+// CAUTION: the cache is keyed by the credential only. Do NOT enable it
+// for authenticators whose result also depends on the client address.
+class CachedAuthenticator : public Authenticator {
+public:
+    explicit CachedAuthenticator(const Authenticator* inner);
+
+    // @Authenticator
+    int GenerateCredential(std::string* auth_str) const override
+    { return _inner->GenerateCredential(auth_str); }
+    int VerifyCredential(const std::string& auth_str,
+                         const butil::EndPoint& client_addr,
+                         AuthContext* out_ctx) const override;
+    std::string GetUnauthorizedErrorText() const override
+    { return _inner->GetUnauthorizedErrorText(); }
+
+private:
+    struct CacheEntry {
+        int result;         // return value of the wrapped VerifyCredential
+        int64_t expire_ms;
+        AuthContext ctx;    // valid iff result is 0
+    };
+
+    const Authenticator* _inner;
+    mutable butil::Mutex _mutex;
+    mutable butil::FlatMap<std::string, CacheEntry> _cache;
+};
+
+} // namespace brpc
+
+#endif // BRPC_DETAILS_CACHED_AUTHENTICATOR_H
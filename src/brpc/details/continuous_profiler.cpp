@@ -0,0 +1,263 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <stdlib.h>                              // getenv/setenv
+#include <unistd.h>                              // usleep/unlink
+#include <gflags/gflags.h>
+#include "butil/compiler_specific.h"             // BAIDU_WEAK
+#include "butil/file_util.h"                     // butil::ReadFileToString
+#include "butil/logging.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/scoped_lock.h"                   // BAIDU_SCOPED_LOCK
+#include "butil/string_printf.h"
+#include "butil/threading/platform_thread.h"
+#include "butil/time.h"                          // gettimeofday_us
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/continuous_profiler.h"
+
+extern "C" {
+int BAIDU_WEAK ProfilerStart(const char* fname);
+void BAIDU_WEAK ProfilerStop();
+}
+
+namespace brpc {
+
+DECLARE_string(rpc_profiling_dir);               // defined in builtin/common.cpp
+
+DEFINE_bool(enable_continuous_profiling, false,
+            "Keep the cpu profiler running at low frequency and buffer "
+            "recent profile chunks in memory, rendered instantly by "
+            "/hotspots/cpu?continuous=1");
+DEFINE_int32(continuous_profiling_frequency, 99,
+             "Sampling frequency(Hz) of continuous profiling, exported as "
+             "CPUPROFILE_FREQUENCY when the env is unset. Read once at start");
+DEFINE_int32(continuous_profiling_chunk_seconds, 10,
+             "Length of one continuous profiling chunk");
+BRPC_VALIDATE_GFLAG(continuous_profiling_chunk_seconds, PositiveInteger);
+DEFINE_int32(continuous_profiling_window_seconds, 300,
+             "Chunks older than this are dropped from memory, which is also "
+             "the default range shown by /hotspots/cpu?continuous=1");
+BRPC_VALIDATE_GFLAG(continuous_profiling_window_seconds, PositiveInteger);
+
+// Layout of a profile in the legacy pprof format, in machine words:
+//   header  [0, 3, 0, sampling_period_us, 0]
+//   entries [count, depth, pc1 ... pc_depth] ...
+//   trailer [0, 1, 0]
+// followed by the text of /proc/self/maps. Chunks of the same process can
+// be merged by concatenating their entries under one header/trailer/maps.
+static const size_t WORD_SIZE = sizeof(uintptr_t);
+static const size_t HEADER_WORDS = 5;
+
+static uintptr_t ReadWord(const std::string& data, size_t index) {
+    uintptr_t w;
+    memcpy(&w, data.data() + index * WORD_SIZE, WORD_SIZE);
+    return w;
+}
+
+// Locate the entries [*entries_begin, *entries_end) and the maps text
+// [*maps_begin, data.size()) of a profile, offsets in bytes.
+static bool ParseLegacyProfile(const std::string& data,
+                               size_t* entries_begin,
+                               size_t* entries_end,
+                               size_t* maps_begin) {
+    const size_t nwords = data.size() / WORD_SIZE;
+    if (nwords < HEADER_WORDS + 3 ||
+        ReadWord(data, 0) != 0 || ReadWord(data, 1) != 3 ||
+        ReadWord(data, 2) != 0) {
+        return false;
+    }
+    size_t i = HEADER_WORDS;
+    while (i + 3 <= nwords) {
+        if (ReadWord(data, i) == 0 && ReadWord(data, i + 1) == 1 &&
+            ReadWord(data, i + 2) == 0) {
+            *entries_begin = HEADER_WORDS * WORD_SIZE;
+            *entries_end = i * WORD_SIZE;
+            *maps_begin = (i + 3) * WORD_SIZE;
+            return *maps_begin <= data.size();
+        }
+        const uintptr_t depth = ReadWord(data, i + 1);
+        if (depth == 0 || depth > 1024) {  // implausible, corrupted profile
+            return false;
+        }
+        i += 2 + depth;
+    }
+    return false;
+}
+
+ContinuousProfiler::ContinuousProfiler()
+    : _suspend(0)
+    , _chunk_active(false) {
+    butil::string_printf(&_chunk_path, "%s/continuous_chunk.%d",
+                         FLAGS_rpc_profiling_dir.c_str(), (int)getpid());
+    butil::File::Error error;
+    const butil::FilePath dir(FLAGS_rpc_profiling_dir);
+    if (!butil::CreateDirectoryAndGetError(dir, &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir.value()
+                   << "', " << error;
+    }
+    // The profiler reads the frequency from the env at the first start.
+    // NOTE: shared with ad-hoc runs from /hotspots/cpu.
+    if (getenv("CPUPROFILE_FREQUENCY") == NULL) {
+        char freq[16];
+        snprintf(freq, sizeof(freq), "%d",
+                 FLAGS_continuous_profiling_frequency);
+        setenv("CPUPROFILE_FREQUENCY", freq, 0);
+    }
+    const int rc = pthread_create(&_tid, NULL, collecting_thread, this);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to create collecting_thread, " << berror(rc);
+    }
+}
+
+void* ContinuousProfiler::collecting_thread(void* arg) {
+    butil::PlatformThread::SetName("cont_profiler");
+    static_cast<ContinuousProfiler*>(arg)->run();
+    return NULL;
+}
+
+void ContinuousProfiler::run() {
+    while (true) {
+        if (_suspend.load(butil::memory_order_acquire) > 0 ||
+            !CollectOneChunk()) {
+            // Suspended or ProfilerStart refused(e.g. an ad-hoc profiler
+            // is running), check again later.
+            ::usleep(100 * 1000L);
+        }
+    }
+}
+
+bool ContinuousProfiler::CollectOneChunk() {
+    {
+        BAIDU_SCOPED_LOCK(_start_mutex);
+        if (_suspend.load(butil::memory_order_acquire) > 0) {
+            return false;
+        }
+        if (!ProfilerStart(_chunk_path.c_str())) {
+            return false;
+        }
+        _chunk_active.store(true, butil::memory_order_release);
+    }
+    const int64_t chunk_us =
+        (int64_t)FLAGS_continuous_profiling_chunk_seconds * 1000000L;
+    for (int64_t slept = 0; slept < chunk_us; slept += 100 * 1000L) {
+        ::usleep(100 * 1000L);
+        if (_suspend.load(butil::memory_order_acquire) > 0) {
+            break;  // Stop the chunk early to unblock Suspend().
+        }
+    }
+    ProfilerStop();
+    _chunk_active.store(false, butil::memory_order_release);
+
+    Chunk chunk;
+    chunk.end_us = butil::gettimeofday_us();
+    if (!butil::ReadFileToString(butil::FilePath(_chunk_path), &chunk.data)) {
+        LOG(WARNING) << "Fail to read " << _chunk_path;
+        return true;
+    }
+    unlink(_chunk_path.c_str());
+    const int64_t evict_before_us = chunk.end_us -
+        (int64_t)FLAGS_continuous_profiling_window_seconds * 1000000L;
+    BAIDU_SCOPED_LOCK(_chunks_mutex);
+    _chunks.push_back(std::move(chunk));
+    while (!_chunks.empty() && _chunks.front().end_us < evict_before_us) {
+        _chunks.pop_front();
+    }
+    return true;
+}
+
+bool ContinuousProfiler::DumpMergedProfile(int seconds, butil::IOBuf* out) {
+    if (seconds <= 0) {
+        return false;
+    }
+    const int64_t since_us =
+        butil::gettimeofday_us() - (int64_t)seconds * 1000000L;
+    BAIDU_SCOPED_LOCK(_chunks_mutex);
+    const std::string* last_data = NULL;
+    size_t last_maps_begin = 0;
+    for (std::deque<Chunk>::const_iterator it = _chunks.begin();
+         it != _chunks.end(); ++it) {
+        if (it->end_us < since_us) {
+            continue;
+        }
+        size_t entries_begin = 0;
+        size_t entries_end = 0;
+        size_t maps_begin = 0;
+        if (!ParseLegacyProfile(it->data, &entries_begin, &entries_end,
+                                &maps_begin)) {
+            LOG_ONCE(WARNING) << "Fail to parse a continuous profile chunk";
+            continue;
+        }
+        if (last_data == NULL) {
+            out->append(it->data.data(), HEADER_WORDS * WORD_SIZE);
+        }
+        out->append(it->data.data() + entries_begin,
+                    entries_end - entries_begin);
+        last_data = &it->data;
+        last_maps_begin = maps_begin;
+    }
+    if (last_data == NULL) {
+        return false;
+    }
+    const uintptr_t trailer[3] = { 0, 1, 0 };
+    out->append(trailer, sizeof(trailer));
+    out->append(last_data->data() + last_maps_begin,
+                last_data->size() - last_maps_begin);
+    return true;
+}
+
+void ContinuousProfiler::Suspend() {
+    _suspend.fetch_add(1, butil::memory_order_acq_rel);
+    // A concurrent CollectOneChunk() either saw _suspend and did not start,
+    // or started and set _chunk_active inside _start_mutex.
+    { BAIDU_SCOPED_LOCK(_start_mutex); }
+    while (_chunk_active.load(butil::memory_order_acquire)) {
+        ::usleep(10 * 1000L);
+    }
+}
+
+void ContinuousProfiler::Resume() {
+    _suspend.fetch_sub(1, butil::memory_order_acq_rel);
+}
+
+ContinuousProfiler* GetContinuousProfiler() {
+    if (!FLAGS_enable_continuous_profiling) {
+        return NULL;
+    }
+    if ((void*)ProfilerStart == NULL || (void*)ProfilerStop == NULL) {
+        LOG_ONCE(WARNING) << "-enable_continuous_profiling is on but the "
+            "cpu profiler is not linked";
+        return NULL;
+    }
+    return butil::get_leaky_singleton<ContinuousProfiler>();
+}
+
+void SuspendContinuousProfiling() {
+    ContinuousProfiler* p = GetContinuousProfiler();
+    if (p != NULL) {
+        p->Suspend();
+    }
+}
+
+void ResumeContinuousProfiling() {
+    ContinuousProfiler* p = GetContinuousProfiler();
+    if (p != NULL) {
+        p->Resume();
+    }
+}
+
+} // namespace brpc
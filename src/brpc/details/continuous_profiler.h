@@ -0,0 +1,85 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_CONTINUOUS_PROFILER_H
+#define BRPC_CONTINUOUS_PROFILER_H
+
+#include <deque>
+#include <string>
+#include <pthread.h>
+#include "butil/atomicops.h"
+#include "butil/iobuf.h"
+#include "butil/synchronization/lock.h"
+
+namespace brpc {
+
+// Keeps the cpu profiler(gperftools) running at low frequency and buffers
+// the recent profile chunks in memory, so that /hotspots/cpu?continuous=1
+// can render flame graphs of the last minutes instantly instead of
+// profiling for seconds on demand. Enabled by -enable_continuous_profiling.
+class ContinuousProfiler {
+public:
+    // Starts the collection thread. Use GetContinuousProfiler() instead of
+    // constructing directly.
+    ContinuousProfiler();
+
+    // Merge chunks overlapping the last `seconds' into a single profile in
+    // the legacy pprof format recognized by pprof.pl. Returns false when
+    // no chunk was collected yet.
+    bool DumpMergedProfile(int seconds, butil::IOBuf* out);
+
+    // Stop collecting until Resume() so that another profiler(e.g. an
+    // ad-hoc run from /hotspots/cpu) can call ProfilerStart(). Blocks until
+    // the in-flight chunk(if any) is stopped. Nestable.
+    void Suspend();
+    void Resume();
+
+private:
+    struct Chunk {
+        int64_t end_us;    // when the chunk was stopped
+        std::string data;  // raw profile in legacy pprof format
+    };
+
+    static void* collecting_thread(void* arg);
+    void run();
+    // Run the profiler for one chunk and append it to _chunks. Returns
+    // false when ProfilerStart() was refused.
+    bool CollectOneChunk();
+
+    std::string _chunk_path;
+    pthread_t _tid;
+    butil::atomic<int> _suspend;
+    butil::atomic<bool> _chunk_active;
+    // Serializes the start of a chunk against Suspend().
+    butil::Mutex _start_mutex;
+    butil::Mutex _chunks_mutex;
+    std::deque<Chunk> _chunks;
+};
+
+// The global profiler, created and started at the first call. Returns NULL
+// when -enable_continuous_profiling is off or the cpu profiler is not
+// linked.
+ContinuousProfiler* GetContinuousProfiler();
+
+// Suspend()/Resume() on the global profiler, no-op when it's disabled.
+void SuspendContinuousProfiling();
+void ResumeContinuousProfiling();
+
+} // namespace brpc
+
+#endif // BRPC_CONTINUOUS_PROFILER_H
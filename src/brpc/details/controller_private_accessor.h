@@ -102,6 +102,15 @@ public:
     
     Span* span() const { return _cntl->_span; }
 
+    // Ownership of |snapshot| goes to _cntl which deletes it in Reset()
+    // unless MethodStatus::EndHwCounterSample() consumed it before.
+    void set_hw_perf_snapshot(HwPerfSnapshot* snapshot) {
+        _cntl->_hw_perf_snapshot = snapshot;
+    }
+    HwPerfSnapshot* hw_perf_snapshot() const {
+        return _cntl->_hw_perf_snapshot;
+    }
+
     uint32_t pipelined_count() const { return _cntl->_pipelined_count; }
     void set_pipelined_count(uint32_t count) {  _cntl->_pipelined_count = count; }
 
@@ -162,6 +171,13 @@ public:
 
     const std::string& checksum_value() const { return _cntl->_checksum_value; }
 
+    // The message the response payload should be parsed into, taking
+    // arena-backed responses(ChannelOptions.parse_response_on_arena) into
+    // account.
+    google::protobuf::Message* response_parse_target() {
+        return _cntl->ResponseParseTarget();
+    }
+
 private:
     Controller* _cntl;
 };
@@ -172,6 +188,9 @@ class RPCSender {
 public:
     virtual ~RPCSender() {}
     virtual int IssueRPC(int64_t start_realtime_us) = 0;
+    // Called by Controller to release the sender instead of deleting it
+    // directly, so that implementations may hand the object back to a pool.
+    virtual void Destroy() { delete this; }
 };
 
 } // namespace brpc
@@ -16,7 +16,9 @@
 // under the License.
 
 
+#include <gflags/gflags.h>
 #include "brpc/details/health_check.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/socket.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
@@ -28,6 +30,16 @@
 
 namespace brpc {
 
+DEFINE_bool(passive_health_check, false,
+            "Let health checking piggyback on live traffic: when a response "
+            "succeeded in-band after the socket was isolated(e.g. late "
+            "responses on pooled connections of the same server), skip the "
+            "dedicated probe connection and revive directly, confirmed by "
+            "the app-layer check(if -health_check_path is set) over the "
+            "revived socket's own connection. Servers without such evidence "
+            "keep being probed by dedicated connections.");
+BRPC_VALIDATE_GFLAG(passive_health_check, PassValidate);
+
 // Declared at socket.cpp
 extern SocketVarsCollector* g_vars;
 
@@ -146,11 +158,15 @@ public:
 private:
     SocketId _id;
     bool _first_time;
+    // Construction time, in-band successes after it are passive evidence
+    // that the server already recovered.
+    int64_t _start_time_us;
 };
 
 HealthCheckTask::HealthCheckTask(SocketId id)
     : _id(id)
-    , _first_time(true) {}
+    , _first_time(true)
+    , _start_time_us(butil::cpuwide_time_us()) {}
 
 bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
     SocketUniquePtr ptr;
@@ -194,7 +210,16 @@ bool HealthCheckTask::OnTriggeringTask(timespec* next_abstime) {
     // not be NULL.
     g_vars->nhealthcheck << 1;
     int hc = 0;
-    if (ptr->_user) {
+    if (FLAGS_passive_health_check &&
+        ptr->last_inband_success_time_us() > _start_time_us) {
+        // A response succeeded in-band after this socket was isolated,
+        // e.g. a late response on a pooled connection of the same server:
+        // the server is demonstrably reachable, no need to open a dedicated
+        // probe connection. The app-layer check below(if configured) still
+        // confirms over the revived socket's own connection.
+        RPC_VLOG << "Passively revive " << *ptr
+                 << " by in-band success, skip probing";
+    } else if (ptr->_user) {
         hc = ptr->_user->CheckHealth(ptr.get());
     } else {
         hc = ptr->CheckHealth();
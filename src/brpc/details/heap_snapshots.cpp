@@ -0,0 +1,324 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <stdlib.h>                              // strtoull
+#include <unistd.h>                              // usleep/unlink
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/debug/stack_trace.h"             // butil::debug::StackTrace
+#include "butil/file_util.h"                     // butil::ReadFileToString
+#include "butil/logging.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "butil/scoped_lock.h"                   // BAIDU_SCOPED_LOCK
+#include "butil/string_printf.h"
+#include "butil/threading/platform_thread.h"
+#include "butil/time.h"                          // gettimeofday_us
+#include "brpc/reloadable_flags.h"
+#include "brpc/builtin/common.h"                 // PrintedAsDateTime
+#include "brpc/details/jemalloc_profiler.h"      // HasJemalloc
+#include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/heap_snapshots.h"
+
+namespace brpc {
+
+DEFINE_bool(enable_heap_snapshots, false,
+            "Keep periodic snapshots of the sampled heap profile in memory "
+            "and let /heap_snapshots diff any two of them. Needs tcmalloc "
+            "with TCMALLOC_SAMPLE_PARAMETER or jemalloc with opt.prof");
+DEFINE_int32(heap_snapshot_interval_seconds, 60,
+             "Interval between two automatic heap snapshots");
+BRPC_VALIDATE_GFLAG(heap_snapshot_interval_seconds, PositiveInteger);
+DEFINE_int32(heap_snapshot_max_count, 60,
+             "Snapshots older than the latest this many are dropped");
+BRPC_VALIDATE_GFLAG(heap_snapshot_max_count, PositiveInteger);
+
+// Read the current sampled heap profile into `*out'. tcmalloc returns it
+// directly, jemalloc only dumps to a file which is read back and removed.
+static bool GetHeapSampleText(std::string* out, std::string* error) {
+    if (HasJemalloc()) {
+        const std::string prof_name = JeProfileDump();
+        if (prof_name.empty()) {
+            *error = "Fail to dump jemalloc profile";
+            return false;
+        }
+        const bool ok =
+            butil::ReadFileToString(butil::FilePath(prof_name), out);
+        unlink(prof_name.c_str());
+        if (!ok) {
+            *error = "Fail to read " + prof_name;
+        }
+        return ok;
+    }
+    MallocExtension* malloc_ext = MallocExtension::instance();
+    if (malloc_ext == NULL || !has_TCMALLOC_SAMPLE_PARAMETER()) {
+        *error = "No sampling heap profiler";
+        return false;
+    }
+    malloc_ext->GetHeapSample(out);
+    return true;
+}
+
+// Both supported sources print text profiles listing sampled in-use
+// "count: bytes" per allocation stack, differing in layout:
+//   tcmalloc: `  count: bytes [count: bytes] @ pc1 pc2 ...' per line
+//   jemalloc: `@ pc1 pc2 ...' followed by `  t*: count: bytes [...]'
+// followed by the memory map which is irrelevant for diffing.
+static bool ParseSiteCounters(const char* p, int64_t* count, int64_t* bytes) {
+    char* end = NULL;
+    const int64_t c = strtoll(p, &end, 10);
+    if (end == p || *end != ':') {
+        return false;
+    }
+    p = end + 1;
+    const int64_t b = strtoll(p, &end, 10);
+    if (end == p) {
+        return false;
+    }
+    *count = c;
+    *bytes = b;
+    return true;
+}
+
+static void ParsePcs(const char* p, std::string* key) {
+    key->clear();
+    while (true) {
+        char* end = NULL;
+        const uintptr_t pc = (uintptr_t)strtoull(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        key->append((const char*)&pc, sizeof(pc));
+        p = end;
+    }
+}
+
+HeapSnapshotKeeper::HeapSnapshotKeeper()
+    : _next_id(1) {
+    const int rc = pthread_create(&_tid, NULL, snapshot_thread, this);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to create snapshot_thread, " << berror(rc);
+    }
+}
+
+void* HeapSnapshotKeeper::snapshot_thread(void* arg) {
+    butil::PlatformThread::SetName("heap_snapshot");
+    static_cast<HeapSnapshotKeeper*>(arg)->run();
+    return NULL;
+}
+
+void HeapSnapshotKeeper::run() {
+    std::string error;
+    // The first snapshot right away is the natural diff base.
+    if (TakeSnapshot(&error) < 0) {
+        LOG(WARNING) << "Fail to take heap snapshot: " << error;
+    }
+    while (true) {
+        const int64_t interval_us =
+            (int64_t)FLAGS_heap_snapshot_interval_seconds * 1000000L;
+        for (int64_t slept = 0; slept < interval_us; slept += 100 * 1000L) {
+            ::usleep(100 * 1000L);
+        }
+        if (TakeSnapshot(&error) < 0) {
+            LOG_EVERY_N(WARNING, 10)
+                << "Fail to take heap snapshot: " << error;
+        }
+    }
+}
+
+int HeapSnapshotKeeper::TakeSnapshot(std::string* error) {
+    std::string text;
+    if (!GetHeapSampleText(&text, error)) {
+        return -1;
+    }
+    Snapshot snap;
+    snap.time_us = butil::gettimeofday_us();
+    snap.total_count = 0;
+    snap.total_bytes = 0;
+    std::istringstream in(text);
+    std::string line;
+    std::string pending_key;
+    bool has_pending_stack = false;
+    while (std::getline(in, line)) {
+        const size_t b = line.find_first_not_of(" \t");
+        if (b == std::string::npos) {
+            continue;
+        }
+        const char* p = line.c_str() + b;
+        if (strncmp(p, "MAPPED_LIBRARIES:", 17) == 0 ||
+            strncmp(p, "--- Memory map:", 15) == 0) {
+            break;
+        }
+        if (*p == '@') {  // jemalloc: stack of the next t*: line
+            ParsePcs(p + 1, &pending_key);
+            has_pending_stack = true;
+            continue;
+        }
+        if (strncmp(p, "t*:", 3) == 0) {  // jemalloc: summed counters
+            int64_t count = 0;
+            int64_t bytes = 0;
+            if (ParseSiteCounters(p + 3, &count, &bytes) &&
+                has_pending_stack) {
+                Site& site = snap.sites[pending_key];
+                site.count += count;
+                site.bytes += bytes;
+                snap.total_count += count;
+                snap.total_bytes += bytes;
+            }
+            // Per-thread t<N>: lines and the header's t*: are skipped.
+            has_pending_stack = false;
+            continue;
+        }
+        const size_t at = line.find(" @ ", b);
+        if (at == std::string::npos ||
+            strncmp(p, "heap profile:", 13) == 0) {  // tcmalloc header
+            continue;
+        }
+        int64_t count = 0;  // tcmalloc: counters and stack on one line
+        int64_t bytes = 0;
+        if (!ParseSiteCounters(p, &count, &bytes)) {
+            continue;
+        }
+        std::string key;
+        ParsePcs(line.c_str() + at + 3, &key);
+        if (key.empty()) {
+            continue;
+        }
+        Site& site = snap.sites[key];
+        site.count += count;
+        site.bytes += bytes;
+        snap.total_count += count;
+        snap.total_bytes += bytes;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    snap.id = _next_id++;
+    const int id = snap.id;
+    _snapshots.push_back(std::move(snap));
+    while ((int)_snapshots.size() > std::max(FLAGS_heap_snapshot_max_count, 2)) {
+        _snapshots.pop_front();
+    }
+    return id;
+}
+
+void HeapSnapshotKeeper::ListSnapshots(std::ostream& os) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (std::deque<Snapshot>::const_iterator it = _snapshots.begin();
+         it != _snapshots.end(); ++it) {
+        os << "snapshot=" << it->id << ' '
+           << PrintedAsDateTime(it->time_us)
+           << " sampled_objects=" << it->total_count
+           << " sampled_bytes=" << it->total_bytes
+           << " sites=" << it->sites.size() << '\n';
+    }
+}
+
+bool HeapSnapshotKeeper::Diff(int base_id, int cur_id, int max_sites,
+                              std::ostream& os, std::string* error) {
+    // Copy both snapshots out so that symbolization(slow) runs unlocked.
+    Snapshot base;
+    Snapshot cur;
+    bool base_found = false;
+    bool cur_found = false;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (std::deque<Snapshot>::const_iterator it = _snapshots.begin();
+             it != _snapshots.end(); ++it) {
+            if (it->id == base_id) {
+                base = *it;
+                base_found = true;
+            }
+            if (it->id == cur_id) {
+                cur = *it;
+                cur_found = true;
+            }
+        }
+    }
+    if (!base_found || !cur_found) {
+        butil::string_printf(
+            error, "snapshot=%d is not buffered anymore",
+            !base_found ? base_id : cur_id);
+        return false;
+    }
+    struct SiteDelta {
+        const std::string* key;
+        int64_t count;
+        int64_t bytes;
+    };
+    std::vector<SiteDelta> deltas;
+    deltas.reserve(cur.sites.size());
+    for (std::map<std::string, Site>::const_iterator it = cur.sites.begin();
+         it != cur.sites.end(); ++it) {
+        SiteDelta d = { &it->first, it->second.count, it->second.bytes };
+        std::map<std::string, Site>::const_iterator it2 =
+            base.sites.find(it->first);
+        if (it2 != base.sites.end()) {
+            d.count -= it2->second.count;
+            d.bytes -= it2->second.bytes;
+        }
+        if (d.bytes > 0) {
+            deltas.push_back(d);
+        }
+    }
+    std::sort(deltas.begin(), deltas.end(),
+              [](const SiteDelta& a, const SiteDelta& b) {
+                  return a.bytes > b.bytes;
+              });
+    os << "base_snapshot=" << base_id << ' '
+       << PrintedAsDateTime(base.time_us)
+       << "\ncur_snapshot=" << cur_id << ' '
+       << PrintedAsDateTime(cur.time_us)
+       << "\nsampled_bytes_delta=" << cur.total_bytes - base.total_bytes
+       << "\nsampled_objects_delta=" << cur.total_count - base.total_count
+       << "\ngrown_sites=" << deltas.size() << '\n';
+    if (deltas.empty()) {
+        os << "\nNo allocation site gained in-use bytes between the two "
+            "snapshots(sites that shrank are not shown)\n";
+        return true;
+    }
+    for (size_t i = 0; i < deltas.size() && (int)i < max_sites; ++i) {
+        const SiteDelta& d = deltas[i];
+        os << "\n[" << i + 1 << "] bytes_delta=" << d.bytes
+           << " objects_delta=" << d.count << '\n';
+        butil::debug::StackTrace st(
+            (void* const*)d.key->data(),
+            d.key->size() / sizeof(void*));
+        st.OutputToStream(&os);
+    }
+    return true;
+}
+
+HeapSnapshotKeeper* GetHeapSnapshotKeeper() {
+    if (!FLAGS_enable_heap_snapshots) {
+        return NULL;
+    }
+    const bool available = HasJemalloc()
+        ? HasJemallocProfileEnabled()
+        : (MallocExtension::instance() != NULL &&
+           has_TCMALLOC_SAMPLE_PARAMETER());
+    if (!available) {
+        LOG_ONCE(WARNING) << "-enable_heap_snapshots is on but no sampling "
+            "heap profiler is available(tcmalloc needs "
+            "TCMALLOC_SAMPLE_PARAMETER in env, jemalloc needs "
+            "MALLOC_CONF=prof:true)";
+        return NULL;
+    }
+    return butil::get_leaky_singleton<HeapSnapshotKeeper>();
+}
+
+} // namespace brpc
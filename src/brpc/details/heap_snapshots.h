@@ -0,0 +1,89 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_HEAP_SNAPSHOTS_H
+#define BRPC_HEAP_SNAPSHOTS_H
+
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+#include <pthread.h>
+#include "butil/synchronization/lock.h"
+
+namespace brpc {
+
+// Periodically reads the sampled heap profile (tcmalloc with
+// TCMALLOC_SAMPLE_PARAMETER, or jemalloc with opt.prof) and keeps the
+// recent snapshots parsed in a bounded ring, so that a slow leak can be
+// located by diffing two snapshots on /heap_snapshots instead of staking
+// out an incident with on-demand dumps. Sampling overhead is the
+// allocator's own (typically <1%), taking a snapshot is a walk over the
+// sampled sites. Enabled by -enable_heap_snapshots.
+class HeapSnapshotKeeper {
+public:
+    // Starts the collection thread. Use GetHeapSnapshotKeeper() instead
+    // of constructing directly.
+    HeapSnapshotKeeper();
+
+    // Take a snapshot immediately(besides the periodic ones), e.g. right
+    // before and after an experiment. Returns the snapshot id, or -1 with
+    // `*error' set.
+    int TakeSnapshot(std::string* error);
+
+    // Print one line per buffered snapshot: id, time and sampled totals.
+    void ListSnapshots(std::ostream& os);
+
+    // Print allocation sites ordered by the in-use bytes they gained
+    // between snapshot `base_id' and the later snapshot `cur_id',
+    // symbolized, at most `max_sites' sites. Returns false with `*error'
+    // set when either id is not buffered anymore.
+    bool Diff(int base_id, int cur_id, int max_sites,
+              std::ostream& os, std::string* error);
+
+private:
+    struct Site {
+        int64_t count;
+        int64_t bytes;
+    };
+    struct Snapshot {
+        int id;
+        int64_t time_us;
+        int64_t total_count;
+        int64_t total_bytes;
+        // Keyed by the raw pc array of the allocation stack.
+        std::map<std::string, Site> sites;
+    };
+
+    static void* snapshot_thread(void* arg);
+    void run();
+
+    pthread_t _tid;
+    int _next_id;
+    butil::Mutex _mutex;
+    std::deque<Snapshot> _snapshots;
+};
+
+// The global keeper, created and started at the first call. Returns NULL
+// when -enable_heap_snapshots is off or no sampling heap profiler is
+// available.
+HeapSnapshotKeeper* GetHeapSnapshotKeeper();
+
+} // namespace brpc
+
+#endif // BRPC_HEAP_SNAPSHOTS_H
@@ -111,6 +111,7 @@ public:
     }
 
     bool empty() const { return _size == 0; }
+    size_t max_size() const { return _max_size; }
     int start_index() const { return _start_index; }
     int end_index() const { return start_index() + _header_queue.size(); }
 
@@ -327,6 +328,8 @@ public:
         return &_node_memory[id - 1];
     }
 
+    size_t node_count() const { return _node_memory.size(); }
+
 private:
 
     HuffmanNode& node(NodeId id) {
@@ -400,78 +403,107 @@ private:
     uint32_t _out_bytes;
 };
 
-class HuffmanDecoder {
-DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
+// A DFA walking the huffman tree a nibble at a time instead of bit by bit.
+// Each state corresponds to a tree node reachable at a 4-bit boundary; a
+// transition consumes 4 bits and emits at most one symbol (the shortest
+// code is 5 bits, a 4-bit window cannot complete two codes). Built from
+// HuffmanTree at startup, the table makes decoding one indexed load plus
+// a branch per nibble rather than up to 8 pointer chases per byte.
+class BAIDU_CACHELINE_ALIGNMENT HuffmanDecodeTable {
+DISALLOW_COPY_AND_ASSIGN(HuffmanDecodeTable);
 public:
-    HuffmanDecoder(std::string* out, const HuffmanTree* tree)
-        // FIXME: resizing of out is costly
-        : _out(out)
-        , _tree(tree)
-        , _cur_node(tree->node(HuffmanTree::ROOT_NODE))
-        , _cur_depth(0)  // Depth of root node is 0
-        , _padding(true)
-    {}
-    int Decode(uint8_t byte) {
-        for (int i = 7; i >= 0; --i) {
-            if (byte & (1u << i)) {
-                _cur_node = _tree->node(_cur_node->right_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
-                }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
-                }
-                _padding &= 1;
-            } else {
-                _cur_node = _tree->node(_cur_node->left_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
+    enum DecodeFlags {
+        DECODE_EMIT = 1, // the transition completed a code, output `sym'
+        DECODE_FAIL = 2  // NULL node or EOS was reached, the stream is broken
+    };
+    struct Entry {
+        uint16_t next_state;
+        uint8_t flags;
+        uint8_t sym;
+    };
+
+    explicit HuffmanDecodeTable(const HuffmanTree& tree);
+
+    const Entry& entry(uint16_t state, uint8_t nibble) const {
+        return _entries[(size_t)state * 16 + nibble];
+    }
+    // True if ending the stream in `state' leaves a valid padding, i.e.
+    // less than 8 bits all matching the MSBs of EOS (all ones).
+    // https://tools.ietf.org/html/rfc7541#section-5.2
+    bool accept(uint16_t state) const { return _accept[state]; }
+
+private:
+    uint16_t AddState(HuffmanTree::NodeId id, uint16_t depth, bool all_ones,
+                      std::vector<uint16_t>* node_to_state);
+
+    std::vector<Entry> _entries;
+    std::vector<bool> _accept;
+    std::vector<HuffmanTree::NodeId> _state_to_node;
+    // Bits consumed since the last completed code and whether they were
+    // all ones, by state. The path from root to a tree node is unique,
+    // so both are fixed attributes of the node behind the state.
+    std::vector<uint16_t> _state_depth;
+    std::vector<bool> _state_all_ones;
+};
+
+uint16_t HuffmanDecodeTable::AddState(
+        HuffmanTree::NodeId id, uint16_t depth, bool all_ones,
+        std::vector<uint16_t>* node_to_state) {
+    uint16_t& s = (*node_to_state)[id];
+    if (s == UINT16_MAX) {
+        s = _state_to_node.size();
+        _state_to_node.push_back(id);
+        _state_depth.push_back(depth);
+        _state_all_ones.push_back(all_ones);
+        _accept.push_back(depth <= 7 && all_ones);
+    }
+    return s;
+}
+
+HuffmanDecodeTable::HuffmanDecodeTable(const HuffmanTree& tree) {
+    std::vector<uint16_t> node_to_state(tree.node_count() + 1, UINT16_MAX);
+    AddState(HuffmanTree::ROOT_NODE, 0, true, &node_to_state);
+    // _state_to_node grows as transitions discover new states.
+    for (size_t s = 0; s < _state_to_node.size(); ++s) {
+        _entries.resize((s + 1) * 16);
+        for (int nib = 0; nib < 16; ++nib) {
+            Entry e = { 0, 0, 0 };
+            HuffmanTree::NodeId cur = _state_to_node[s];
+            uint16_t depth = _state_depth[s];
+            bool all_ones = _state_all_ones[s];
+            for (int i = 3; i >= 0; --i) {
+                const int bit = (nib >> i) & 1;
+                const HuffmanTree::NodeId child_id = bit
+                    ? tree.node(cur)->right_child
+                    : tree.node(cur)->left_child;
+                const HuffmanNode* child = tree.node(child_id);
+                if (child == NULL || child->value == HPACK_HUFFMAN_EOS) {
+                    e.flags = DECODE_FAIL;
+                    break;
                 }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
+                if (child->value != HuffmanTree::INVALID_VALUE) {
+                    // Completed a code. A second completion within the
+                    // same nibble is impossible, the shortest code takes
+                    // 5 bits.
+                    DCHECK(!(e.flags & DECODE_EMIT));
+                    e.flags |= DECODE_EMIT;
+                    e.sym = static_cast<uint8_t>(child->value);
+                    cur = HuffmanTree::ROOT_NODE;
+                    depth = 0;
+                    all_ones = true;
+                } else {
+                    cur = child_id;
+                    ++depth;
+                    all_ones &= (bit != 0);
                 }
-                _padding &= 0;
             }
-            ++_cur_depth;
-        }
-        return 0;
-    }
-    int EndStream() {
-        if (_cur_depth == 0) {
-            return 0;
-        }
-        if (_cur_depth <= 7 && _padding) {
-            return 0;
+            if (!(e.flags & DECODE_FAIL)) {
+                e.next_state = AddState(cur, depth, all_ones, &node_to_state);
+            }
+            _entries[s * 16 + nib] = e;
         }
-        // Invalid stream, the padding is not corresponding to MSB of EOS
-        // https://tools.ietf.org/html/rfc7541#section-5.2
-        return -1;
     }
-private:
-    std::string* _out;
-    const HuffmanTree* _tree;
-    const HuffmanNode* _cur_node;
-    uint16_t _cur_depth;
-    bool _padding;
-};
+}
 
 // Primitive Type Representations
 
@@ -497,6 +529,7 @@ inline void EncodeInteger(butil::IOBufAppender* out, uint8_t msb,
 
 // Static variables
 static HuffmanTree* s_huffman_tree = NULL;
+static HuffmanDecodeTable* s_huffman_decode_table = NULL;
 static IndexTable* s_static_table = NULL;
 static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
@@ -505,6 +538,7 @@ static void CreateStaticTableOrDie() {
     for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
         s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
     }
+    s_huffman_decode_table = new HuffmanDecodeTable(*s_huffman_tree);
     IndexTableOptions options;
     options.max_size = UINT_MAX;
     options.static_table = s_static_headers;
@@ -619,16 +653,38 @@ inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
     in_bytes += length;
     out->clear();
     if (!huffman) {
+        // Fast path: the string is already literal, no bit fiddling at all.
         iter.copy_and_forward(out, length);
         return in_bytes;
     }
-    HuffmanDecoder d(out, s_huffman_tree);
+    // No code is shorter than 5 bits, decoded size is at most 8/5 of input.
+    out->reserve(length * 8 / 5 + 1);
+    const HuffmanDecodeTable* t = s_huffman_decode_table;
+    uint16_t state = 0;
     for (; iter != NULL && length; ++iter, --length) {
-        if (d.Decode(*iter) != 0) {
+        const uint8_t byte = *iter;
+        const HuffmanDecodeTable::Entry& hi = t->entry(state, byte >> 4);
+        if (BAIDU_UNLIKELY(hi.flags & HuffmanDecodeTable::DECODE_FAIL)) {
+            LOG(ERROR) << "Decoder stream reaches NULL_NODE or EOS";
             return -1;
         }
+        if (hi.flags & HuffmanDecodeTable::DECODE_EMIT) {
+            out->push_back(static_cast<char>(hi.sym));
+        }
+        const HuffmanDecodeTable::Entry& lo = t->entry(hi.next_state, byte & 0x0F);
+        if (BAIDU_UNLIKELY(lo.flags & HuffmanDecodeTable::DECODE_FAIL)) {
+            LOG(ERROR) << "Decoder stream reaches NULL_NODE or EOS";
+            return -1;
+        }
+        if (lo.flags & HuffmanDecodeTable::DECODE_EMIT) {
+            out->push_back(static_cast<char>(lo.sym));
+        }
+        state = lo.next_state;
     }
-    if (d.EndStream() != 0) {
+    if (BAIDU_UNLIKELY(!t->accept(state))) {
+        // Invalid stream, the padding is not corresponding to MSB of EOS
+        // https://tools.ietf.org/html/rfc7541#section-5.2
+        LOG(ERROR) << "Invalid huffman padding";
         return -1;
     }
     return in_bytes;
@@ -636,10 +692,16 @@ inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
 
 HPacker::HPacker()
     : _encode_table(NULL)
-    , _decode_table(NULL) {
+    , _decode_table(NULL)
+    , _remote_table_size_limit(-1) {
     CreateStaticTableOnceOrDie();
 }
 
+void HPacker::SetRemoteTableSizeLimit(size_t max_size) {
+    _remote_table_size_limit.store((int64_t)max_size,
+                                   butil::memory_order_relaxed);
+}
+
 HPacker::~HPacker() {
     if (_encode_table) {
         delete _encode_table;
@@ -695,6 +757,18 @@ inline int HPacker::FindNameFromIndexTable(const std::string& name) const {
 
 void HPacker::Encode(butil::IOBufAppender* out, const Header& header,
                      const HPackOptions& options) {
+    const int64_t limit =
+        _remote_table_size_limit.load(butil::memory_order_relaxed);
+    if (BAIDU_UNLIKELY(limit >= 0 &&
+                       (size_t)limit < _encode_table->max_size())) {
+        // The peer shrank SETTINGS_HEADER_TABLE_SIZE below our table.
+        // Evict accordingly and tell the decoder with a Dynamic Table Size
+        // Update, which must precede entries of a header block(rfc7541#4.2).
+        // Table mutation happens here rather than in SetRemoteTableSizeLimit
+        // because encoding and table must stay in one thread at a time.
+        _encode_table->ResetMaxSize(limit);
+        EncodeInteger(out, 0x20, 5, limit);
+    }
     if (options.index_policy != HPACK_NEVER_INDEX_HEADER) {
         const int index = FindHeaderFromIndexTable(header);
         if (index > 0) {
@@ -824,7 +898,10 @@ ssize_t HPacker::Decode(butil::IOBufBytesIterator& iter, Header* h) {
                 return -1;
             }
             _decode_table->ResetMaxSize(max_size);
-            return Decode(iter, h);
+            const ssize_t nc = Decode(iter, h);
+            // Count the bytes of the update in, otherwise callers popping
+            // the returned size from an IOBuf would leave trailing bytes.
+            return nc <= 0 ? nc : nc + read_bytes;
         }
     case 1:
         // (0001) Literal Header Field Never Indexed
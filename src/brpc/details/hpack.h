@@ -21,6 +21,7 @@
 
 #include "butil/iobuf.h"                             // butil::IOBuf
 #include "butil/strings/string_piece.h"              // butil::StringPiece
+#include "butil/atomicops.h"                         // butil::atomic
 #include "brpc/http2.h"
 #include "brpc/describable.h"
 
@@ -108,6 +109,15 @@ public:
     void Encode(butil::IOBufAppender* out, const Header& header)
     { return Encode(out, header, HPackOptions()); }
 
+    // Bound the encoding dynamic table by the peer's
+    // SETTINGS_HEADER_TABLE_SIZE. When the limit is below the current table
+    // size, the table is shrunk at the next Encode and a Dynamic Table Size
+    // Update is emitted at the beginning of that header block(rfc7541#4.2),
+    // keeping both sides in sync. Callable from a thread other than the
+    // encoding one. Limits larger than the current table size are ignored:
+    // an encoder may always use a smaller table than the peer permits.
+    void SetRemoteTableSizeLimit(size_t max_size);
+
     // Try to decode at most one Header from source and erase corresponding
     // buffer.
     // Returns:
@@ -132,6 +142,10 @@ private:
 
     IndexTable* _encode_table;
     IndexTable* _decode_table;
+    // Peer-advertised limit pending application, -1 when none. Applied
+    // lazily by Encode since the table must not be mutated concurrently
+    // with encoding.
+    butil::atomic<int64_t> _remote_table_size_limit;
 };
 
 // Lowercase the input string, a fast implementation.
@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifndef ULLONG_MAX
 # define ULLONG_MAX ((uint64_t) -1) /* 2^64-1 */
@@ -509,6 +512,76 @@ bool is_url_char(char c) { return IS_URL_CHAR(c); }
 #define IS_HEADER_CHAR(ch)                                                     \
   (ch == CR || ch == LF || ch == 9 || ((unsigned char)ch > 31 && ch != 127))
 
+/* Find the first byte in [p, end) that may end a header value or is
+ * illegal inside one: CR, LF, control characters other than HT, or DEL.
+ * Every byte before the returned position satisfies IS_HEADER_CHAR and
+ * keeps header_state at h_general, so callers may consume the stretch in
+ * one step. Examines 16 bytes per iteration with SSE2 when available. */
+static const char *
+scan_header_value(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  const __m128i htab = _mm_set1_epi8('\t');
+  const __m128i del = _mm_set1_epi8(127);
+  const __m128i max_ctl = _mm_set1_epi8(31);
+  while (end - p >= 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    /* unsigned (v <= 31): min(v, 31) == v */
+    const __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, max_ctl), v);
+    const __m128i is_tab = _mm_cmpeq_epi8(v, htab);
+    const __m128i is_del = _mm_cmpeq_epi8(v, del);
+    const int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_andnot_si128(is_tab, is_ctl), is_del));
+    if (mask != 0) {
+      return p + __builtin_ctz((unsigned)mask);
+    }
+    p += 16;
+  }
+#endif
+  for (; p != end; ++p) {
+    const unsigned char ch = (unsigned char)*p;
+    if ((ch < 0x20 && ch != '\t') || ch == 127) {
+      break;
+    }
+  }
+  return p;
+}
+
+/* Find the first byte in [p, end) that leaves s_req_path: controls,
+ * space, DEL, '#' and '?'. Any other byte (including %x80-FF, see
+ * IS_URL_CHAR) keeps the URL parser in s_req_path. Stopping early is
+ * harmless, the per-byte code resumes at the returned position. */
+static const char *
+scan_url_path(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  const __m128i del = _mm_set1_epi8(127);
+  const __m128i sharp = _mm_set1_epi8('#');
+  const __m128i quest = _mm_set1_epi8('?');
+  const __m128i max_sp = _mm_set1_epi8(0x20);
+  while (end - p >= 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    /* unsigned (v <= 0x20): controls and space */
+    __m128i stop = _mm_cmpeq_epi8(_mm_min_epu8(v, max_sp), v);
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, del));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, sharp));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, quest));
+    const int mask = _mm_movemask_epi8(stop);
+    if (mask != 0) {
+      return p + __builtin_ctz((unsigned)mask);
+    }
+    p += 16;
+  }
+#endif
+  for (; p != end; ++p) {
+    const unsigned char ch = (unsigned char)*p;
+    if (ch <= 0x20 || ch == 127 || ch == '#' || ch == '?') {
+      break;
+    }
+  }
+  return p;
+}
+
 #if BRPC_HTTP_PARSER_STRICT
 # define STRICT_CHECK(cond)                                          \
 do {                                                                 \
@@ -1229,6 +1302,11 @@ size_t http_parser_execute (http_parser *parser,
               goto error;
             }
             parser->state = new_state;
+            if (new_state == s_req_path) {
+              /* Bulk-skip ordinary path bytes, the byte at the returned
+               * position goes through parse_url_char as usual. */
+              p = scan_url_path(p + 1, data + len) - 1;
+            }
         }
         break;
       }
@@ -1625,6 +1703,11 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (parser->header_state) {
           case h_general:
+            /* The current byte was validated above and plain value bytes
+             * cannot change h_general, skip the rest of the stretch in
+             * bulk. The byte at the returned position is re-examined by
+             * the loop after `p' advances onto it. */
+            p = scan_header_value(p + 1, data + len) - 1;
             break;
 
           case h_connection:
@@ -67,7 +67,7 @@ bool HasJemalloc() {
 }
 
 // env need MALLOC_CONF="prof:true" before process start
-static bool HasEnableJemallocProfile() {
+bool HasJemallocProfileEnabled() {
     bool prof = false;
     size_t len = sizeof(prof);
     int ret = mallctl("opt.prof", &prof, &len, nullptr, 0);
@@ -99,7 +99,7 @@ static int JeProfileActive(bool active) {
         return -1;
     }
 
-    if (!HasEnableJemallocProfile()) {
+    if (!HasJemallocProfileEnabled()) {
         LOG(WARNING) << "jemalloc have not set opt.prof before start";
         return -1;
     }
@@ -113,13 +113,13 @@ static int JeProfileActive(bool active) {
     return 0;
 }
 
-static std::string JeProfileDump() {
+std::string JeProfileDump() {
     if (!HasJemalloc()) {
         LOG(WARNING) << "no jemalloc";
         return "";
     }
 
-    if (!HasEnableJemallocProfile()) {
+    if (!HasJemallocProfileEnabled()) {
         LOG(WARNING) << "jemalloc have not set opt.prof before start";
         return "";
     }
@@ -152,7 +152,7 @@ static int JeProfileReset(size_t lg_sample) {
         return -1;
     }
 
-    if (!HasEnableJemallocProfile()) {
+    if (!HasJemallocProfileEnabled()) {
         LOG(WARNING) << "jemalloc have not set opt.prof before start";
         return -1;
     }
@@ -182,7 +182,7 @@ void JeControlProfile(Controller* cntl) {
         return;
     }
 
-    if (!HasEnableJemallocProfile()) {
+    if (!HasJemallocProfileEnabled()) {
         cntl->SetFailed(ENOMETHOD, "Heap profiler is not enabled, (no MALLOC_CONF=prof:true in env)");
         return;
     }
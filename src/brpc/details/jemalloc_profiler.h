@@ -24,6 +24,13 @@ namespace brpc {
 
 bool HasJemalloc();
 
+// True iff jemalloc was started with opt.prof(MALLOC_CONF=prof:true).
+bool HasJemallocProfileEnabled();
+
+// Dump the current heap profile to a file under -rpc_profiling_dir.
+// Returns the file path, empty on failure.
+std::string JeProfileDump();
+
 // opts: Ja
 // more see ref: https://github.com/jemalloc/jemalloc/blob/dev/include/jemalloc/internal/stats.h#L9
 std::string StatsPrint(const std::string& opts);
@@ -0,0 +1,199 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "butil/logging.h"
+#include "butil/errno.h"                        // berror
+#include "butil/unix_socket.h"
+#include "butil/threading/platform_thread.h"
+#include "brpc/details/listen_fd_handover.h"
+
+namespace brpc {
+
+// Protocol: the former generation writes one byte holding the number of
+// listen fds, then sends that many fds, each in one SCM_RIGHTS message.
+
+ListenFdHandover::ListenFdHandover()
+    : _listen_uds(-1)
+    , _thread(0)
+    , _serving(false)
+    , _handed_over(false) {
+    _wakeup_fds[0] = -1;
+    _wakeup_fds[1] = -1;
+}
+
+ListenFdHandover::~ListenFdHandover() {
+    Stop();
+}
+
+int ListenFdHandover::TakeOver(const std::string& path,
+                               std::vector<int>* fds) {
+    if (access(path.c_str(), F_OK) != 0) {
+        // No former generation around, the normal first start.
+        return -1;
+    }
+    const int conn = butil::unix_socket_connect(path.c_str());
+    if (conn < 0) {
+        return -1;
+    }
+    // The former generation answers immediately or not at all (it may be
+    // a stale socket file of a crashed process), don't block the start.
+    timeval tm = { 1, 0 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tm, sizeof(tm));
+    unsigned char nfd = 0;
+    if (read(conn, &nfd, 1) != 1 || 0 == nfd) {
+        LOG(WARNING) << "Former generation at " << path
+                     << " did not offer listen fds";
+        close(conn);
+        return -1;
+    }
+    for (unsigned char i = 0; i < nfd; ++i) {
+        const int fd = butil::unix_socket_recv_fd(conn);
+        if (fd < 0) {
+            LOG(ERROR) << "Fail to receive listen fd #" << (int)i
+                       << " from " << path;
+            for (size_t j = 0; j < fds->size(); ++j) {
+                close((*fds)[j]);
+            }
+            fds->clear();
+            close(conn);
+            return -1;
+        }
+        fds->push_back(fd);
+    }
+    close(conn);
+    LOG(INFO) << "Took over " << fds->size()
+              << " listen fd(s) from the former generation at " << path;
+    return 0;
+}
+
+int ListenFdHandover::Serve(const std::string& path,
+                            const std::vector<int>& listen_fds) {
+    if (_serving) {
+        LOG(ERROR) << "Already serving at " << _path;
+        return -1;
+    }
+    if (listen_fds.empty()) {
+        LOG(ERROR) << "Param[listen_fds] is empty";
+        return -1;
+    }
+    // Replaces the socket file of the former generation (if any), future
+    // generations now reach this process.
+    _listen_uds = butil::unix_socket_listen(path.c_str());
+    if (_listen_uds < 0) {
+        return -1;
+    }
+    if (pipe(_wakeup_fds) != 0) {
+        PLOG(ERROR) << "Fail to create pipe";
+        close(_listen_uds);
+        _listen_uds = -1;
+        return -1;
+    }
+    _path = path;
+    _listen_fds = listen_fds;
+    _handed_over.store(false, butil::memory_order_relaxed);
+    const int rc = pthread_create(&_thread, NULL, RunThis, this);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to create handover thread: " << berror(rc);
+        close(_listen_uds);
+        _listen_uds = -1;
+        close(_wakeup_fds[0]);
+        close(_wakeup_fds[1]);
+        _wakeup_fds[0] = -1;
+        _wakeup_fds[1] = -1;
+        return -1;
+    }
+    _serving = true;
+    return 0;
+}
+
+void ListenFdHandover::Stop() {
+    if (!_serving) {
+        return;
+    }
+    const ssize_t nw = write(_wakeup_fds[1], "q", 1);
+    LOG_IF(ERROR, nw != 1) << "Fail to wake up handover thread";
+    pthread_join(_thread, NULL);
+    _thread = 0;
+    close(_listen_uds);
+    _listen_uds = -1;
+    close(_wakeup_fds[0]);
+    close(_wakeup_fds[1]);
+    _wakeup_fds[0] = -1;
+    _wakeup_fds[1] = -1;
+    if (!handed_over()) {
+        // No next generation showed up; a later one must not connect to a
+        // dead socket file.
+        remove(_path.c_str());
+    }
+    _serving = false;
+}
+
+void* ListenFdHandover::RunThis(void* arg) {
+    static_cast<ListenFdHandover*>(arg)->Run();
+    return NULL;
+}
+
+void ListenFdHandover::Run() {
+    butil::PlatformThread::SetName("brpc_handover");
+    pollfd pfds[2] = {
+        { _listen_uds, POLLIN, 0 },
+        { _wakeup_fds[0], POLLIN, 0 }
+    };
+    while (true) {
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+        if (poll(pfds, 2, -1) < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            PLOG(ERROR) << "Fail to poll handover socket at " << _path;
+            return;
+        }
+        if (pfds[1].revents != 0) {
+            // Stop() wrote into the pipe.
+            return;
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+        const int conn = accept(_listen_uds, NULL, NULL);
+        if (conn < 0) {
+            if (EINTR != errno && EAGAIN != errno) {
+                PLOG(WARNING) << "Fail to accept on handover socket at "
+                              << _path;
+            }
+            continue;
+        }
+        const unsigned char nfd = (unsigned char)_listen_fds.size();
+        bool ok = (write(conn, &nfd, 1) == 1);
+        for (size_t i = 0; i < _listen_fds.size() && ok; ++i) {
+            ok = (butil::unix_socket_send_fd(conn, _listen_fds[i]) == 0);
+        }
+        close(conn);
+        if (ok) {
+            _handed_over.store(true, butil::memory_order_relaxed);
+            LOG(INFO) << "Handed " << _listen_fds.size()
+                      << " listen fd(s) at " << _path
+                      << " to the next generation";
+        }
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,75 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_DETAILS_LISTEN_FD_HANDOVER_H
+#define BRPC_DETAILS_LISTEN_FD_HANDOVER_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+
+namespace brpc {
+
+// Passes the listen fds of a server generation to the next generation of
+// the same process over a unix domain socket with SCM_RIGHTS, engaged by
+// -graceful_restart_uds. The running generation serves its fds at the
+// path; a starting generation takes them over instead of binding the port
+// again, so rolling restarts keep the kernel listen queue (no dropped
+// SYNs) and never race on rebinding the port.
+class ListenFdHandover {
+public:
+    ListenFdHandover();
+    ~ListenFdHandover();
+
+    // Receive the listen fds of a former generation serving at `path'
+    // into `fds' (caller owns them). Returns 0 when at least one fd was
+    // received, -1 otherwise (e.g. no former generation is around, which
+    // is the normal first start).
+    static int TakeOver(const std::string& path, std::vector<int>* fds);
+
+    // Serve `listen_fds' (not owned, must stay valid until Stop()) at
+    // `path' from a dedicated thread, replacing the socket file of any
+    // former generation. Returns 0 on success.
+    int Serve(const std::string& path, const std::vector<int>& listen_fds);
+
+    // Stop the serving thread. The socket file is unlinked unless the fds
+    // were handed to a next generation, which re-bound the path to itself.
+    void Stop();
+
+    bool handed_over() const
+    { return _handed_over.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ListenFdHandover);
+
+    static void* RunThis(void* arg);
+    void Run();
+
+    std::string _path;
+    std::vector<int> _listen_fds;
+    int _listen_uds;
+    int _wakeup_fds[2];
+    pthread_t _thread;
+    bool _serving;
+    butil::atomic<bool> _handed_over;
+};
+
+} // namespace brpc
+
+#endif // BRPC_DETAILS_LISTEN_FD_HANDOVER_H
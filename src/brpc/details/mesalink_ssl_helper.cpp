@@ -344,6 +344,11 @@ void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
     // MesaLink uses buffered IO internally
 }
 
+bool IsSSLKTLSActive(SSL* ssl) {
+    // MesaLink has no kernel TLS offload
+    return false;
+}
+
 SSLState DetectSSLState(int fd, int* error_code) {
     // Peek the first few bytes inside socket to detect whether
     // it's an SSL connection. If it is, create an SSL session
@@ -17,15 +17,213 @@
 
 
 #include <limits>
+#include <gflags/gflags.h>
 #include "butil/macros.h"
+#include "butil/build_config.h"                 // OS_LINUX
+#include "butil/thread_local.h"                 // thread_atexit
 #include "brpc/controller.h"
+#include "brpc/server.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/details/method_status.h"
 
+#if defined(OS_LINUX)
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 namespace brpc {
 
-static int cast_int(void* arg) {
-    return *(int*)arg;
+DEFINE_int32(method_hw_counter_sample_ratio, 0,
+             "Read hardware counters (cycles, cache-misses, branch-misses) "
+             "around one out of this many requests of each method and "
+             "aggregate the deltas into per-method bvars shown in /status. "
+             "0 disables the sampling. Needs kernel.perf_event_paranoid to "
+             "permit self-profiling; set before server start to expose the "
+             "bvars, the ratio itself is reloadable");
+BRPC_VALIDATE_GFLAG(method_hw_counter_sample_ratio, NonNegativeInteger);
+
+DEFINE_int32(low_priority_concurrency_percent, 50,
+             "Percentage of the non-reserved server-level concurrency that "
+             "REQUEST_PRIORITY_LOW methods may use before being shed. Only "
+             "effective when ServerOptions.reserved_concurrency_for_high_"
+             "priority is positive");
+BRPC_VALIDATE_GFLAG(low_priority_concurrency_percent, PositiveInteger);
+
+#if defined(OS_LINUX)
+namespace {
+
+// A per-thread group of self-profiling perf counters. The leader (cycles)
+// is read with PERF_FORMAT_GROUP so one read() snapshots all 3 counters.
+class ThreadHwCounters {
+public:
+    ThreadHwCounters() : _leader(-1), _nfollower(0) {
+        _leader = OpenCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (_leader < 0) {
+            return;
+        }
+        _followers[_nfollower] = OpenCounter(PERF_COUNT_HW_CACHE_MISSES, _leader);
+        if (_followers[_nfollower] >= 0) {
+            ++_nfollower;
+        }
+        _followers[_nfollower] = OpenCounter(PERF_COUNT_HW_BRANCH_MISSES, _leader);
+        if (_followers[_nfollower] >= 0) {
+            ++_nfollower;
+        }
+        if (_nfollower != 2) {
+            Close();
+        }
+    }
+
+    ~ThreadHwCounters() { Close(); }
+
+    bool valid() const { return _leader >= 0; }
+
+    bool Read(uint64_t* cycles, uint64_t* cache_misses,
+              uint64_t* branch_misses) {
+        struct {
+            uint64_t nr;
+            uint64_t values[3];
+        } buf;
+        if (read(_leader, &buf, sizeof(buf)) != sizeof(buf) || buf.nr != 3) {
+            return false;
+        }
+        *cycles = buf.values[0];
+        *cache_misses = buf.values[1];
+        *branch_misses = buf.values[2];
+        return true;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ThreadHwCounters);
+
+    static int OpenCounter(uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // Self-profiling of user space works under perf_event_paranoid=2.
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(__NR_perf_event_open, &attr, 0/*this thread*/,
+                       -1/*any cpu*/, group_fd, 0);
+    }
+
+    void Close() {
+        for (int i = 0; i < _nfollower; ++i) {
+            close(_followers[i]);
+        }
+        _nfollower = 0;
+        if (_leader >= 0) {
+            close(_leader);
+            _leader = -1;
+        }
+    }
+
+    int _leader;
+    int _followers[2];
+    int _nfollower;
+};
+
+void delete_thread_hw_counters(void* arg) {
+    delete static_cast<ThreadHwCounters*>(arg);
+}
+
+// Returns NULL when perf events are unavailable (e.g. containers without
+// CAP_PERFMON or a restrictive perf_event_paranoid), logged once per thread.
+ThreadHwCounters* tls_hw_counters() {
+    static __thread ThreadHwCounters* tls_counters = NULL;
+    static __thread bool tls_counters_failed = false;
+    if (tls_counters != NULL) {
+        return tls_counters;
+    }
+    if (tls_counters_failed) {
+        return NULL;
+    }
+    ThreadHwCounters* c = new ThreadHwCounters;
+    if (!c->valid()) {
+        PLOG(WARNING) << "Fail to open perf counters, hardware-counter "
+            "sampling is disabled on this thread";
+        delete c;
+        tls_counters_failed = true;
+        return NULL;
+    }
+    butil::thread_atexit(delete_thread_hw_counters, c);
+    tls_counters = c;
+    return c;
+}
+
+}  // namespace
+#endif  // OS_LINUX
+
+void MethodStatus::BeginHwCounterSample(Controller* cntl) {
+#if defined(OS_LINUX)
+    const uint32_t ratio = (uint32_t)FLAGS_method_hw_counter_sample_ratio;
+    if (0 == ratio) {  // the flag is reloadable, re-check after OnRequested
+        return;
+    }
+    if (_hw_sample_ticker.fetch_add(1, butil::memory_order_relaxed)
+        % ratio != 0) {
+        return;
+    }
+    ThreadHwCounters* counters = tls_hw_counters();
+    if (NULL == counters) {
+        return;
+    }
+    HwPerfSnapshot* snapshot = new (std::nothrow) HwPerfSnapshot;
+    if (NULL == snapshot) {
+        return;
+    }
+    if (!counters->Read(&snapshot->cycles, &snapshot->cache_misses,
+                        &snapshot->branch_misses)) {
+        delete snapshot;
+        return;
+    }
+    snapshot->thread = pthread_self();
+    ControllerPrivateAccessor(cntl).set_hw_perf_snapshot(snapshot);
+#else
+    (void)cntl;
+#endif
+}
+
+void MethodStatus::EndHwCounterSample(Controller* cntl) {
+#if defined(OS_LINUX)
+    ControllerPrivateAccessor accessor(cntl);
+    HwPerfSnapshot* snapshot = accessor.hw_perf_snapshot();
+    if (NULL == snapshot) {
+        return;
+    }
+    accessor.set_hw_perf_snapshot(NULL);
+    uint64_t cycles = 0;
+    uint64_t cache_misses = 0;
+    uint64_t branch_misses = 0;
+    // Per-thread counters only compare on the thread that took the begin
+    // snapshot; requests migrating between threads are dropped. Work of
+    // other bthreads interleaved on the thread inflates the deltas, which
+    // is acceptable for a sampled diagnostic.
+    if (pthread_equal(snapshot->thread, pthread_self())) {
+        ThreadHwCounters* counters = tls_hw_counters();
+        if (counters != NULL &&
+            counters->Read(&cycles, &cache_misses, &branch_misses)) {
+            _hw_samples << 1;
+            _hw_cycles << (int64_t)(cycles - snapshot->cycles);
+            _hw_cache_misses << (int64_t)(cache_misses - snapshot->cache_misses);
+            _hw_branch_misses << (int64_t)(branch_misses - snapshot->branch_misses);
+        }
+    }
+    delete snapshot;
+#else
+    (void)cntl;
+#endif
+}
+
+static int cast_nconcurrency(void* arg) {
+    return static_cast<ShardedConcurrency*>(arg)->Sum();
 }
 
 static int cast_cl(void* arg) {
@@ -37,10 +235,13 @@ static int cast_cl(void* arg) {
 }
 
 MethodStatus::MethodStatus()
-    : _nconcurrency(0)
-    , _nconcurrency_bvar(cast_int, &_nconcurrency)
+    : _request_priority(REQUEST_PRIORITY_NORMAL)
+    , _approx_concurrency(0)
+    , _nconcurrency_bvar(cast_nconcurrency, &_nconcurrency)
     , _eps_bvar(&_nerror_bvar)
     , _max_concurrency_bvar(cast_cl, &_cl)
+    , _hw_sample_ticker(0)
+    , _usercode_pool(NULL)
 {
 }
 
@@ -65,6 +266,14 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
             return -1;
         }
     }
+    if (FLAGS_method_hw_counter_sample_ratio > 0) {
+        if (_hw_samples.expose_as(prefix, "hw_samples") != 0 ||
+            _hw_cycles.expose_as(prefix, "hw_cycles") != 0 ||
+            _hw_cache_misses.expose_as(prefix, "hw_cache_misses") != 0 ||
+            _hw_branch_misses.expose_as(prefix, "hw_branch_misses") != 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -138,17 +347,59 @@ void MethodStatus::Describe(
 
     // Concurrency
     OutputValue(os, "concurrency: ", _nconcurrency_bvar.name(),
-                _nconcurrency, options, false);
+                _nconcurrency.Sum(), options, false);
     if (_cl) {
         OutputValue(os, "max_concurrency: ", _max_concurrency_bvar.name(),
                     MaxConcurrency(), options, false);
     }
+
+    // Hardware counters of sampled requests,
+    // see -method_hw_counter_sample_ratio.
+    const int64_t nsample = _hw_samples.get_value();
+    if (nsample > 0) {
+        OutputValue(os, "hw_samples: ", _hw_samples.name(),
+                    nsample, options, false);
+        OutputValue(os, "hw_cycles_per_sample: ", _hw_cycles.name(),
+                    _hw_cycles.get_value() / nsample, options, false);
+        OutputValue(os, "hw_cache_misses_per_sample: ",
+                    _hw_cache_misses.name(),
+                    _hw_cache_misses.get_value() / nsample, options, false);
+        OutputValue(os, "hw_branch_misses_per_sample: ",
+                    _hw_branch_misses.name(),
+                    _hw_branch_misses.get_value() / nsample, options, false);
+    }
 }
 
 void MethodStatus::SetConcurrencyLimiter(ConcurrencyLimiter* cl) {
     _cl.reset(cl);
 }
 
+bool MethodStatus::PassPriorityLanes(Controller* cntl) const {
+    if (NULL == cntl || NULL == cntl->server()) {
+        return true;
+    }
+    const ServerOptions& opt = cntl->server()->options();
+    if (opt.max_concurrency <= 0 ||
+        opt.reserved_concurrency_for_high_priority <= 0) {
+        // Priority lanes are off.
+        return true;
+    }
+    int limit = opt.max_concurrency - opt.reserved_concurrency_for_high_priority;
+    if (limit < 0) {
+        limit = 0;
+    }
+    if (_request_priority == REQUEST_PRIORITY_LOW) {
+        int percent = FLAGS_low_priority_concurrency_percent;
+        if (percent > 100) {
+            percent = 100;
+        }
+        limit = (int)((int64_t)limit * percent / 100);
+    }
+    // Server-level concurrency may or may not include this request yet
+    // depending on the protocol, the off-by-one does not matter for shedding.
+    return cntl->server()->Concurrency() <= limit;
+}
+
 int HandleResponseWritten(bthread_id_t id, void* data, int /*error_code*/) {
     auto args = static_cast<ResponseWriteInfo*>(data);
     args->sent_us = butil::cpuwide_time_us();
@@ -159,6 +410,7 @@ int HandleResponseWritten(bthread_id_t id, void* data, int /*error_code*/) {
 ConcurrencyRemover::~ConcurrencyRemover() {
     if (_status) {
         _status->OnResponded(_c->ErrorCode(), butil::cpuwide_time_us() - _received_us);
+        _status->EndHwCounterSample(_c);
         _status = NULL;
     }
     ServerPrivateAccessor(_c->server()).RemoveConcurrency(_c);
@@ -19,16 +19,80 @@
 #ifndef  BRPC_METHOD_STATUS_H
 #define  BRPC_METHOD_STATUS_H
 
+#include <pthread.h>                       // pthread_t
 #include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
 #include "bvar/bvar.h"                    // vars
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
+#include "brpc/options.pb.h"               // RequestPriority
 
 
 namespace brpc {
 
+DECLARE_int32(method_hw_counter_sample_ratio);
+
 class Controller;
 class Server;
+class UserCodeBackupPool;
+
+// Begin-of-request readings of the calling thread's hardware counters for
+// a request sampled by -method_hw_counter_sample_ratio. Attached to the
+// Controller and matched against end-of-request readings in
+// MethodStatus::EndHwCounterSample(). A sample is dropped when the request
+// ends on another thread since per-thread counters don't compare across
+// threads.
+struct HwPerfSnapshot {
+    pthread_t thread{0};
+    uint64_t cycles{0};
+    uint64_t cache_misses{0};
+    uint64_t branch_misses{0};
+};
+
+// Concurrency counter sharded over cachelines: each worker increments its
+// own shard so that concurrent requests don't bounce a single cacheline,
+// Sum() folds the shards on demand. The sum of the shards is always exact
+// (apart from not being an atomic snapshot), the sharding only moves the
+// cost from every request to the reader.
+class ShardedConcurrency {
+public:
+    static const size_t NSHARD = 16;
+    // When the approximate concurrency gets this close to max_concurrency,
+    // limiter decisions switch to folded exact values.
+    static const int SATURATION_SLACK = (int)NSHARD * 2;
+
+    ShardedConcurrency() {}
+
+    void Add(int delta) {
+        _shards[tls_shard_index() % NSHARD]
+            .count.fetch_add(delta, butil::memory_order_relaxed);
+    }
+
+    int Sum() const {
+        int sum = 0;
+        for (size_t i = 0; i < NSHARD; ++i) {
+            sum += _shards[i].count.load(butil::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ShardedConcurrency);
+
+    static size_t tls_shard_index() {
+        static butil::atomic<size_t> s_next_index(0);
+        static __thread size_t tls_index = (size_t)-1;
+        if (tls_index == (size_t)-1) {
+            tls_index = s_next_index.fetch_add(1, butil::memory_order_relaxed);
+        }
+        return tls_index;
+    }
+
+    struct BAIDU_CACHELINE_ALIGNMENT Shard {
+        Shard() : count(0) {}
+        butil::atomic<int> count;
+    };
+    Shard _shards[NSHARD];
+};
 // Record accessing stats of a method.
 class MethodStatus : public Describable {
 public:
@@ -58,6 +122,24 @@ public:
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
+    // Priority lane of the method, set by Server in AddService.
+    RequestPriority request_priority() const { return _request_priority; }
+
+    // Dedicated pool for running user code of the method when
+    // -usercode_in_pthread is on, NULL means sharing the global pool.
+    // See ServiceOptions.dedicated_usercode_backup_threads.
+    UserCodeBackupPool* usercode_pool() const { return _usercode_pool; }
+
+    // Read the thread's hardware counters (cycles, cache-misses,
+    // branch-misses) into a snapshot attached to `cntl' when this request
+    // is picked by -method_hw_counter_sample_ratio. Called by OnRequested.
+    void BeginHwCounterSample(Controller* cntl);
+
+    // Match the snapshot attached by BeginHwCounterSample() (if any)
+    // against current counter values and aggregate the deltas into
+    // per-method bvars. Called when the response is done.
+    void EndHwCounterSample(Controller* cntl);
+
 private:
 friend class Server;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
@@ -66,13 +148,35 @@ friend class Server;
     // before the server is started. 
     void SetConcurrencyLimiter(ConcurrencyLimiter* cl);
 
+    // Returns false when the request should be shed because non-HIGH lanes
+    // ran into the concurrency slice reserved for HIGH methods, see
+    // ServerOptions.reserved_concurrency_for_high_priority.
+    bool PassPriorityLanes(Controller* cntl) const;
+
+    // Returns the current concurrency(including the request just counted
+    // by the caller), exact near saturation of max_concurrency and
+    // approximate otherwise, see comments in the impl.
+    int EstimateConcurrency();
+
     std::unique_ptr<ConcurrencyLimiter> _cl;
-    butil::atomic<int> _nconcurrency;
+    RequestPriority _request_priority;
+    ShardedConcurrency _nconcurrency;
+    // Lazily folded snapshot of _nconcurrency for limiter decisions far
+    // away from saturation.
+    butil::atomic<int> _approx_concurrency;
     bvar::Adder<int64_t>  _nerror_bvar;
     bvar::LatencyRecorder _latency_rec;
     bvar::PassiveStatus<int>  _nconcurrency_bvar;
     bvar::PerSecond<bvar::Adder<int64_t>> _eps_bvar;
     bvar::PassiveStatus<int32_t> _max_concurrency_bvar;
+    // Hardware counters of sampled requests, see BeginHwCounterSample().
+    butil::atomic<uint32_t> _hw_sample_ticker;
+    bvar::Adder<int64_t> _hw_samples;
+    bvar::Adder<int64_t> _hw_cycles;
+    bvar::Adder<int64_t> _hw_cache_misses;
+    bvar::Adder<int64_t> _hw_branch_misses;
+    // Set by Server in AddService, owned by ServiceProperty.
+    UserCodeBackupPool* _usercode_pool;
 };
 
 struct ResponseWriteInfo {
@@ -94,11 +198,39 @@ private:
     int64_t _received_us;
 };
 
+inline int MethodStatus::EstimateConcurrency() {
+    const int max_cc = (NULL != _cl ? _cl->MaxConcurrency() : 0);
+    const int approx =
+        _approx_concurrency.load(butil::memory_order_relaxed) + 1;
+    if (max_cc > 0 && approx + ShardedConcurrency::SATURATION_SLACK >= max_cc) {
+        // Near saturation limiter decisions need the exact concurrency.
+        const int exact = _nconcurrency.Sum();
+        _approx_concurrency.store(exact, butil::memory_order_relaxed);
+        return exact;
+    }
+    // Fold periodically to bound the drift of the approximation. The
+    // counter is shared by all methods which only makes folds of hot
+    // methods more frequent.
+    static __thread uint32_t tls_fold_counter = 0;
+    if ((++tls_fold_counter & 31) == 0) {
+        const int exact = _nconcurrency.Sum();
+        _approx_concurrency.store(exact, butil::memory_order_relaxed);
+        return exact;
+    }
+    return approx;
+}
+
 inline bool MethodStatus::OnRequested(int* rejected_cc, Controller* cntl) {
-    const int cc = _nconcurrency.fetch_add(1, butil::memory_order_relaxed) + 1;
-    if (NULL == _cl || _cl->OnRequested(cc, cntl)) {
+    _nconcurrency.Add(1);
+    const int cc = EstimateConcurrency();
+    if ((NULL == _cl || _cl->OnRequested(cc, cntl)) &&
+        (_request_priority == REQUEST_PRIORITY_HIGH ||
+         PassPriorityLanes(cntl))) {
+        if (cntl != NULL && FLAGS_method_hw_counter_sample_ratio > 0) {
+            BeginHwCounterSample(cntl);
+        }
         return true;
-    } 
+    }
     if (rejected_cc) {
         *rejected_cc = cc;
     }
@@ -106,7 +238,7 @@ inline bool MethodStatus::OnRequested(int* rejected_cc, Controller* cntl) {
 }
 
 inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
-    _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    _nconcurrency.Add(-1);
     if (0 == error_code) {
         _latency_rec << latency;
     } else {
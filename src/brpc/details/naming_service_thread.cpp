@@ -16,6 +16,7 @@
 // under the License.
 
 
+#include <algorithm>
 #include <set>
 #include <pthread.h>
 #include <gflags/gflags.h>
@@ -78,15 +79,63 @@ NamingServiceThread::Actions::~Actions() {
 }
 
 void NamingServiceThread::Actions::AddServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    // Incremental path: cost is proportional to the number of added
+    // servers(plus a linear merge of small structs), unlike ResetServers
+    // which re-sorts and re-diffs the full list. Event-driven naming
+    // services watching deltas should call this instead of assembling
+    // a complete snapshot.
+    _added.assign(servers.begin(), servers.end());
+    std::sort(_added.begin(), _added.end());
+    _added.resize(std::unique(_added.begin(), _added.end()) - _added.begin());
+    // Drop servers that are already present.
+    size_t n = 0;
+    for (size_t i = 0; i < _added.size(); ++i) {
+        if (!std::binary_search(_last_servers.begin(), _last_servers.end(),
+                                _added[i])) {
+            _added[n++] = _added[i];
+        }
+    }
+    _added.resize(n);
+    _removed.clear();
+    if (_added.empty()) {
+        EndWait(_last_servers.empty() ? ENODATA : 0);
+        return;
+    }
+    // New full list = sorted merge of _last_servers and _added.
+    _servers.resize(_last_servers.size() + _added.size());
+    std::merge(_last_servers.begin(), _last_servers.end(),
+               _added.begin(), _added.end(), _servers.begin());
+    CommitChanges();
 }
 
 void NamingServiceThread::Actions::RemoveServers(
-    const std::vector<ServerNode>&) {
-    // FIXME(gejun)
-    RELEASE_ASSERT_VERBOSE(false, "Not implemented");
+    const std::vector<ServerNode>& servers) {
+    // Incremental path, see comments in AddServers().
+    _removed.assign(servers.begin(), servers.end());
+    std::sort(_removed.begin(), _removed.end());
+    _removed.resize(std::unique(_removed.begin(), _removed.end())
+                    - _removed.begin());
+    // Ignore servers that are not present.
+    size_t n = 0;
+    for (size_t i = 0; i < _removed.size(); ++i) {
+        if (std::binary_search(_last_servers.begin(), _last_servers.end(),
+                               _removed[i])) {
+            _removed[n++] = _removed[i];
+        }
+    }
+    _removed.resize(n);
+    _added.clear();
+    if (_removed.empty()) {
+        EndWait(_last_servers.empty() ? ENODATA : 0);
+        return;
+    }
+    _servers.resize(_last_servers.size());
+    _servers.resize(std::set_difference(
+                        _last_servers.begin(), _last_servers.end(),
+                        _removed.begin(), _removed.end(), _servers.begin())
+                    - _servers.begin());
+    CommitChanges();
 }
 
 void NamingServiceThread::Actions::ResetServers(
@@ -117,6 +166,13 @@ void NamingServiceThread::Actions::ResetServers(
                             _removed.begin());
     _removed.resize(_removed_end - _removed.begin());
 
+    CommitChanges();
+}
+
+// Precondition: _servers is the new sorted full list, _added/_removed are
+// sorted diffs against _last_servers. Creates/removes Sockets accordingly,
+// refreshes _last_sockets and notifies watchers.
+void NamingServiceThread::Actions::CommitChanges() {
     _added_sockets.clear();
     for (size_t i = 0; i < _added.size(); ++i) {
         ServerNodeWithId tagged_id;
@@ -126,7 +182,9 @@ void NamingServiceThread::Actions::ResetServers(
         //       to pick those Sockets with the right settings during OnAddedServers
         const SocketMapKey key(_added[i], _owner->_options.channel_signature);
         CHECK_EQ(0, SocketMapInsert(key, &tagged_id.id, _owner->_options.ssl_ctx,
-                                    _owner->_options.use_rdma, _owner->_options.hc_option));
+                                    _owner->_options.use_rdma,
+                                    _owner->_options.hc_option,
+                                    _owner->_options.egress_limiter));
         _added_sockets.push_back(tagged_id);
     }
 
@@ -160,27 +218,58 @@ void NamingServiceThread::Actions::ResetServers(
         std::inplace_merge(_sockets.begin(), _sockets.begin() + before_added,
                            _sockets.end());
     }
-    std::vector<ServerId> removed_ids;
-    ServerNodeWithId2ServerId(_removed_sockets, &removed_ids, NULL);
+    // Build the (refcounted, immutable) snapshot before taking _mutex so
+    // that lock-hold time is independent of both update size and watcher
+    // count: the critical section below merely swaps lists and copies the
+    // watcher map, callbacks run outside of it in parallel bthreads.
+    butil::intrusive_ptr<UpdateSnapshot> snapshot;
+    std::vector<std::pair<NamingServiceWatcher*,
+                          const NamingServiceFilter*> > targets;
+    if (!_removed_sockets.empty() || !_added_sockets.empty()) {
+        snapshot.reset(new UpdateSnapshot);
+        ServerNodeWithId2ServerId(
+            _removed_sockets, &snapshot->removed_ids, NULL);
+        ServerNodeWithId2ServerId(_added_sockets, &snapshot->added_ids, NULL);
+        snapshot->added_sockets = _added_sockets;
+    }
 
     {
         BAIDU_SCOPED_LOCK(_owner->_mutex);
         _last_servers.swap(_servers);
         _owner->_last_sockets.swap(_sockets);
-        for (std::map<NamingServiceWatcher*,
-                      const NamingServiceFilter*>::iterator
-                 it = _owner->_watchers.begin();
-             it != _owner->_watchers.end(); ++it) {
-            if (!_removed_sockets.empty()) {
-                it->first->OnRemovedServers(removed_ids);
+        if (snapshot.get() != NULL && !_owner->_watchers.empty()) {
+            targets.assign(_owner->_watchers.begin(),
+                           _owner->_watchers.end());
+            std::unique_lock<bthread::Mutex> mu(_owner->_notify_mutex);
+            for (size_t i = 0; i < targets.size(); ++i) {
+                _owner->_notifying_watchers.insert(targets[i].first);
             }
+        }
+    }
 
-            std::vector<ServerId> added_ids;
-            ServerNodeWithId2ServerId(_added_sockets, &added_ids, it->second);
-            if (!_added_sockets.empty()) {
-                it->first->OnAddedServers(added_ids);
+    if (!targets.empty()) {
+        std::vector<bthread_t> tids;
+        tids.reserve(targets.size());
+        for (size_t i = 0; i < targets.size(); ++i) {
+            WatcherNotifyArg* arg = new WatcherNotifyArg;
+            arg->snapshot = snapshot;
+            arg->owner = _owner;
+            arg->watcher = targets[i].first;
+            arg->filter = targets[i].second;
+            bthread_t th;
+            if (targets.size() == 1 ||
+                bthread_start_background(
+                    &th, NULL, NotifyWatcherThread, arg) != 0) {
+                NotifyWatcherThread(arg);
+            } else {
+                tids.push_back(th);
             }
         }
+        // Join this round before returning so that the next update can't
+        // overlap with it, keeping notifications in-order per watcher.
+        for (size_t i = 0; i < tids.size(); ++i) {
+            bthread_join(tids[i], NULL);
+        }
     }
 
     for (size_t i = 0; i < _removed.size(); ++i) {
@@ -203,7 +292,7 @@ void NamingServiceThread::Actions::ResetServers(
         LOG(INFO) << info.str();
     }
 
-    EndWait(servers.empty() ? ENODATA : 0);
+    EndWait(_last_servers.empty() ? ENODATA : 0);
 }
 
 void NamingServiceThread::Actions::EndWait(int error_code) {
@@ -335,6 +424,37 @@ void NamingServiceThread::ServerNodeWithId2ServerId(
     }
 }
 
+void NamingServiceThread::NotifyOneWatcher(const UpdateSnapshot& snapshot,
+                                           NamingServiceWatcher* watcher,
+                                           const NamingServiceFilter* filter) {
+    if (!snapshot.removed_ids.empty()) {
+        watcher->OnRemovedServers(snapshot.removed_ids);
+    }
+    if (!snapshot.added_sockets.empty()) {
+        if (filter == NULL) {
+            watcher->OnAddedServers(snapshot.added_ids);
+        } else {
+            std::vector<ServerId> added_ids;
+            ServerNodeWithId2ServerId(snapshot.added_sockets,
+                                      &added_ids, filter);
+            watcher->OnAddedServers(added_ids);
+        }
+    }
+    {
+        std::unique_lock<bthread::Mutex> mu(_notify_mutex);
+        _notifying_watchers.erase(watcher);
+    }
+    _notify_cond.notify_all();
+}
+
+void* NamingServiceThread::NotifyWatcherThread(void* arg) {
+    WatcherNotifyArg* wn_arg = static_cast<WatcherNotifyArg*>(arg);
+    wn_arg->owner->NotifyOneWatcher(
+        *wn_arg->snapshot, wn_arg->watcher, wn_arg->filter);
+    delete wn_arg;
+    return NULL;
+}
+
 int NamingServiceThread::AddWatcher(NamingServiceWatcher* watcher,
                                     const NamingServiceFilter* filter) {
     if (watcher == NULL) {
@@ -358,14 +478,23 @@ int NamingServiceThread::RemoveWatcher(NamingServiceWatcher* watcher) {
         LOG(ERROR) << "Param[watcher] is NULL";
         return -1;
     }
-    BAIDU_SCOPED_LOCK(_mutex);
-    if (_watchers.erase(watcher)) {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (!_watchers.erase(watcher)) {
+            return -1;
+        }
         // Not call OnRemovedServers of the watcher because watcher can
         // remove the sockets by itself and in most cases, removing
         // sockets is useless.
-        return 0;
     }
-    return -1;
+    // A fan-out bthread of an in-flight update may still be calling into
+    // this watcher; wait it out so that the caller is free to delete the
+    // watcher once we return.
+    std::unique_lock<bthread::Mutex> mu(_notify_mutex);
+    while (_notifying_watchers.count(watcher)) {
+        _notify_cond.wait(mu);
+    }
+    return 0;
 }
 
 void NamingServiceThread::Run() {
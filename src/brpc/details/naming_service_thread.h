@@ -19,9 +19,12 @@
 #ifndef BRPC_NAMING_SERVICE_THREAD_H
 #define BRPC_NAMING_SERVICE_THREAD_H
 
+#include <set>
 #include <string>
 #include "butil/intrusive_ptr.hpp"               // butil::intrusive_ptr
 #include "bthread/bthread.h"                    // bthread_t
+#include "bthread/mutex.h"                      // bthread::Mutex
+#include "bthread/condition_variable.h"         // bthread::ConditionVariable
 #include "brpc/server_id.h"                     // ServerId
 #include "brpc/shared_object.h"                 // SharedObject
 #include "brpc/naming_service.h"                // NamingService
@@ -53,6 +56,7 @@ struct GetNamingServiceThreadOptions {
     HealthCheckOption hc_option;
     ChannelSignature channel_signature;
     std::shared_ptr<SocketSSLContext> ssl_ctx;
+    std::shared_ptr<EgressRateLimiter> egress_limiter;
 };
 
 // A dedicated thread to map a name to ServerIds
@@ -65,6 +69,19 @@ class NamingServiceThread : public SharedObject, public Describable {
             return id != rhs.id ? (id < rhs.id) : (node < rhs.node);
         }
     };
+    // An immutable snapshot of one server-list update, shared(refcounted)
+    // by the bthreads fanning the update out to watchers in parallel.
+    struct UpdateSnapshot : public SharedObject {
+        std::vector<ServerId> removed_ids;            // unfiltered
+        std::vector<ServerId> added_ids;              // unfiltered
+        std::vector<ServerNodeWithId> added_sockets;  // for filtered watchers
+    };
+    struct WatcherNotifyArg {
+        butil::intrusive_ptr<UpdateSnapshot> snapshot;
+        NamingServiceThread* owner;
+        NamingServiceWatcher* watcher;
+        const NamingServiceFilter* filter;
+    };
     class Actions : public NamingServiceActions {
     public:
         explicit Actions(NamingServiceThread* owner);
@@ -76,6 +93,10 @@ class NamingServiceThread : public SharedObject, public Describable {
         void EndWait(int error_code);
 
     private:
+        // Apply sorted `_added'/`_removed' (diffs of `_servers' against
+        // `_last_servers') to SocketMap, `_last_sockets' and watchers.
+        void CommitChanges();
+
         NamingServiceThread* _owner;
         bthread_id_t _wait_id;
         butil::atomic<bool> _has_wait_error;
@@ -114,6 +135,14 @@ private:
         const std::vector<ServerNodeWithId>& src,
         std::vector<ServerId>* dst, const NamingServiceFilter* filter);
 
+    // Deliver one update to one watcher, then take the watcher out of
+    // _notifying_watchers. Entry point of the fan-out bthreads started
+    // by Actions::CommitChanges().
+    void NotifyOneWatcher(const UpdateSnapshot& snapshot,
+                          NamingServiceWatcher* watcher,
+                          const NamingServiceFilter* filter);
+    static void* NotifyWatcherThread(void* arg);
+
     butil::Mutex _mutex;
     bthread_t _tid;
     NamingService* _ns;
@@ -123,6 +152,12 @@ private:
     std::vector<ServerNodeWithId> _last_sockets;
     Actions _actions;
     std::map<NamingServiceWatcher*, const NamingServiceFilter*> _watchers;
+    // Watchers currently being notified by fan-out bthreads (outside
+    // _mutex). RemoveWatcher() waits until the removed watcher leaves
+    // this set so that the caller can free the watcher right after.
+    bthread::Mutex _notify_mutex;
+    bthread::ConditionVariable _notify_cond;
+    std::set<NamingServiceWatcher*> _notifying_watchers;
 };
 
 std::ostream& operator<<(std::ostream& os, const NamingServiceThread&);
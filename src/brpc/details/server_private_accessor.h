@@ -97,6 +97,9 @@ public:
 
     Acceptor* acceptor() const { return _server->_am; }
 
+    bthread_keytable_pool_t* keytable_pool() const
+    { return _server->_keytable_pool; }
+
     RestfulMap* global_restful_map() const
     { return _server->_global_restful_map; }
 
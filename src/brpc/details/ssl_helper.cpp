@@ -21,6 +21,7 @@
 #ifndef USE_MESALINK
 
 #include <sys/socket.h>                // recv
+#include <gflags/gflags.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/x509.h>
@@ -34,6 +35,12 @@
 
 namespace brpc {
 
+DEFINE_bool(ssl_enable_ktls, false,
+            "Negotiate kernel TLS after the SSL handshake so that symmetric "
+            "crypto of the connection runs in the kernel. Requires OpenSSL "
+            ">= 3.0 and a kernel with the tls module; silently falls back "
+            "to userspace SSL_read/SSL_write when either is missing");
+
 #ifndef OPENSSL_NO_DH
 static DH* g_dh_1024 = NULL;
 static DH* g_dh_2048 = NULL;
@@ -397,6 +404,18 @@ static int SetSSLOptions(SSL_CTX* ctx, const std::string& ciphers,
         ssloptions |= SSL_OP_NO_TLSv1_2;
     }
 #endif  // SSL_OP_NO_TLSv1_2
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (FLAGS_ssl_enable_ktls) {
+        // Whether the offload actually took effect is only known per
+        // connection after the handshake, see IsSSLKTLSActive().
+        ssloptions |= SSL_OP_ENABLE_KTLS;
+    }
+#else
+    LOG_IF(WARNING, FLAGS_ssl_enable_ktls)
+        << "-ssl_enable_ktls is ignored since OpenSSL lacks kTLS support"
+           " (requires 3.0 or newer)";
+#endif  // SSL_OP_ENABLE_KTLS
     SSL_CTX_set_options(ctx, ssloptions);
 
     long sslmode = SSL_MODE_ENABLE_PARTIAL_WRITE
@@ -476,6 +495,20 @@ static int SetServerALPNCallback(SSL_CTX* ssl_ctx, const std::string* alpns) {
     return 0;
 }
 
+static int NewClientSessionCallback(SSL* ssl, SSL_SESSION* sess) {
+    const SocketId sid = (SocketId)SSL_get_app_data(ssl);
+    SocketUniquePtr s;
+    if (Socket::Address(sid, &s) != 0) {
+        return 0;  // the reference is released by the caller
+    }
+    // Sessions are cached per remote endpoint inside SocketSSLContext and
+    // offered to later handshakes in Socket::SSLHandshake. TLS1.3 tickets
+    // arrive after the handshake, which is why caching goes through this
+    // callback instead of reading SSL_get_session at handshake end.
+    s->CacheSSLSession(sess);
+    return 1;  // we own the reference now
+}
+
 SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
     std::unique_ptr<SSL_CTX, FreeSSLCTX> ssl_ctx(
         SSL_CTX_new(SSLv23_client_method()));
@@ -506,7 +539,12 @@ SSL_CTX* CreateClientSSLContext(const ChannelSSLOptions& options) {
         SSL_CTX_set_alpn_protos(ssl_ctx.get(), alpn_list.data(), alpn_list.size());
     }
 
-    SSL_CTX_set_session_cache_mode(ssl_ctx.get(), SSL_SESS_CACHE_CLIENT);
+    // Sessions are stored in SocketSSLContext keyed by remote endpoint
+    // (via the callback below) rather than in the internal cache, which
+    // is never consulted for outgoing connections anyway.
+    SSL_CTX_set_session_cache_mode(
+        ssl_ctx.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ssl_ctx.get(), NewClientSessionCallback);
     return ssl_ctx.release();
 }
 
@@ -618,6 +656,16 @@ void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
     SSL_set_bio(ssl, rbio, wbio);
 }
 
+bool IsSSLKTLSActive(SSL* ssl) {
+#if defined(BIO_get_ktls_send) && defined(BIO_get_ktls_recv)
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0 ||
+        BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
 SSLState DetectSSLState(int fd, int* error_code) {
     // Peek the first few bytes inside socket to detect whether
     // it's an SSL connection. If it is, create an SSL session
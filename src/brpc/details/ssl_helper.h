@@ -103,6 +103,11 @@ SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
 // which can reduce the total number of calls to system read/write
 void AddBIOBuffer(SSL* ssl, int fd, int bufsize);
 
+// True if kernel TLS offload was negotiated on either direction of `ssl'
+// (-ssl_enable_ktls), in which case SSL_read/SSL_write pass plaintext to
+// the kernel and records are en/decrypted there.
+bool IsSSLKTLSActive(SSL* ssl);
+
 // Judge whether the underlying channel of `fd' is using SSL
 // If the return value is SSL_UNKNOWN, `error_code' will be
 // set to indicate the reason (0 for EOF)
@@ -0,0 +1,115 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/time.h"                     // microseconds_to_timespec
+#include "butil/scoped_lock.h"
+#include "butil/containers/flat_map.h"
+#include "bthread/bthread.h"                // bthread_id_error
+#include "bthread/unstable.h"               // bthread_timer_add
+#include "brpc/errno.pb.h"                  // ERPCTIMEDOUT
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/timeout_coalescer.h"
+
+
+namespace brpc {
+
+DEFINE_int32(rpc_timeout_coalesce_ms, 0,
+             "Quantize RPC deadlines into buckets of so many milliseconds "
+             "and cover each bucket with a single timer, 0 disables the "
+             "feature. Coalesced calls may time out up to one bucket width "
+             "later than their configured timeout_ms");
+BRPC_VALIDATE_GFLAG(rpc_timeout_coalesce_ms, NonNegativeInteger);
+
+namespace {
+struct TimeoutBucket {
+    int64_t quantized_deadline_us;
+    std::vector<uint64_t> call_ids;
+};
+}
+
+static butil::Mutex g_bucket_mutex;
+// Keyed by quantized deadline. Buckets leave the map when their timer runs.
+static butil::FlatMap<int64_t, TimeoutBucket*>* g_buckets = NULL;
+static pthread_once_t g_bucket_init_once = PTHREAD_ONCE_INIT;
+
+static void InitTimeoutBuckets() {
+    butil::FlatMap<int64_t, TimeoutBucket*>* m =
+        new butil::FlatMap<int64_t, TimeoutBucket*>;
+    if (m->init(64) != 0) {
+        LOG(WARNING) << "Fail to initialize g_buckets";
+    }
+    g_buckets = m;
+}
+
+static void RunTimeoutBucket(void* arg) {
+    TimeoutBucket* bucket = (TimeoutBucket*)arg;
+    {
+        BAIDU_SCOPED_LOCK(g_bucket_mutex);
+        g_buckets->erase(bucket->quantized_deadline_us);
+    }
+    // Unpublished now, call_ids can't grow anymore. Error the ids outside
+    // the lock since handlers may run user code.
+    for (size_t i = 0; i < bucket->call_ids.size(); ++i) {
+        const bthread_id_t cid = { bucket->call_ids[i] };
+        // A no-op for RPCs that already finished and destroyed their id.
+        bthread_id_error(cid, ERPCTIMEDOUT);
+    }
+    delete bucket;
+}
+
+bool CoalesceTimeout(int64_t deadline_us, bthread_id_t correlation_id) {
+    const int32_t coalesce_ms = FLAGS_rpc_timeout_coalesce_ms;
+    if (coalesce_ms <= 0) {
+        return false;
+    }
+    pthread_once(&g_bucket_init_once, InitTimeoutBuckets);
+    const int64_t quantum_us = coalesce_ms * 1000L;
+    // Round up so that a bucket never fires before any deadline in it.
+    const int64_t quantized_us =
+        (deadline_us + quantum_us - 1) / quantum_us * quantum_us;
+
+    BAIDU_SCOPED_LOCK(g_bucket_mutex);
+    TimeoutBucket** pbucket = g_buckets->seek(quantized_us);
+    if (pbucket != NULL) {
+        (*pbucket)->call_ids.push_back(correlation_id.value);
+        return true;
+    }
+    TimeoutBucket* bucket = new (std::nothrow) TimeoutBucket;
+    if (NULL == bucket) {
+        return false;
+    }
+    bucket->quantized_deadline_us = quantized_us;
+    bucket->call_ids.push_back(correlation_id.value);
+    // Added inside the lock so that a failure can't strand ids appended by
+    // other threads meanwhile. The id is thrown away: buckets are never
+    // deleted before firing.
+    bthread_timer_t timer_id;
+    if (bthread_timer_add(&timer_id,
+                          butil::microseconds_to_timespec(quantized_us),
+                          RunTimeoutBucket, bucket) != 0) {
+        delete bucket;
+        return false;
+    }
+    g_buckets->insert(quantized_us, bucket);
+    return true;
+}
+
+} // namespace brpc
@@ -0,0 +1,43 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  BRPC_TIMEOUT_COALESCER_H
+#define  BRPC_TIMEOUT_COALESCER_H
+
+#include <stdint.h>
+#include "bthread/types.h"                  // bthread_id_t
+
+
+namespace brpc {
+
+// Queue the RPC identified by `correlation_id' into a timeout bucket shared
+// by all calls whose deadline rounds up to the same boundary of
+// -rpc_timeout_coalesce_ms milliseconds. One timer covers the whole bucket
+// and its expiry errors every queued id with ERPCTIMEDOUT, reducing timer
+// registrations from per-call to per-bucket. Finished RPCs are not removed
+// from their bucket: erroring a destroyed correlation id is a no-op thanks
+// to the versioning inside bthread_id, which also obsoletes the
+// bthread_timer_del at the end of coalesced RPCs.
+// Returns true when the deadline was queued, false when coalescing is
+// disabled(or out of memory) and the caller should add its own timer.
+bool CoalesceTimeout(int64_t deadline_us, bthread_id_t correlation_id);
+
+} // namespace brpc
+
+
+#endif  // BRPC_TIMEOUT_COALESCER_H
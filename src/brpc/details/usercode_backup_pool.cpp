@@ -45,67 +45,123 @@ struct UserCode {
     void (*fn)(void*);
     void* arg;
 };
-struct UserCodeBackupPool {
-    // Run user code when parallelism of user code reaches the threshold
-    std::deque<UserCode> queue;
-    bvar::PassiveStatus<int> inplace_var;
-    bvar::PassiveStatus<size_t> queue_size_var;
-    bvar::Adder<size_t> inpool_count;
-    bvar::PerSecond<bvar::Adder<size_t> > inpool_per_second;
-    // NOTE: we don't use Adder<double> directly which does not compile in gcc 3.4
-    bvar::Adder<int64_t> inpool_elapse_us;
-    bvar::PassiveStatus<double> inpool_elapse_s;
-    bvar::PerSecond<bvar::PassiveStatus<double> > pool_usage;
 
-    UserCodeBackupPool();
-    int Init();
-    void UserCodeRunningLoop();
-};
-
-static pthread_mutex_t s_usercode_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t s_usercode_cond = PTHREAD_COND_INITIALIZER;
 static pthread_once_t s_usercode_init = PTHREAD_ONCE_INIT;
 butil::static_atomic<int> g_usercode_inplace = BUTIL_STATIC_ATOMIC_INIT(0);
 bool g_too_many_usercode = false;
 static UserCodeBackupPool* s_usercode_pool = NULL;
+static bvar::PassiveStatus<int>* s_inplace_var = NULL;
 
 static int GetUserCodeInPlace(void*) {
     return g_usercode_inplace.load(butil::memory_order_relaxed);
 }
 
-static size_t GetUserCodeQueueSize(void*) {
-    BAIDU_SCOPED_LOCK(s_usercode_mutex);
-    return (s_usercode_pool != NULL ? s_usercode_pool->queue.size() : 0);
-}
-
 static double GetInPoolElapseInSecond(void* arg) {
     return static_cast<bvar::Adder<int64_t>*>(arg)->get_value() / 1000000.0;
 }
 
-UserCodeBackupPool::UserCodeBackupPool()
-    : inplace_var("rpc_usercode_inplace", GetUserCodeInPlace, NULL)
-    , queue_size_var("rpc_usercode_queue_size", GetUserCodeQueueSize, NULL)
-    , inpool_count("rpc_usercode_backup_count")
-    , inpool_per_second("rpc_usercode_backup_second", &inpool_count)
-    , inpool_elapse_s(GetInPoolElapseInSecond, &inpool_elapse_us)
-    , pool_usage("rpc_usercode_backup_usage", &inpool_elapse_s, 1) {
+// "rpc_usercode_<suffix>" for the global pool whose `pool_name' is empty,
+// "rpc_usercode_<pool_name>_<suffix>" for dedicated pools.
+static std::string UserCodeVarName(const std::string& pool_name,
+                                   const char* suffix) {
+    std::string name = "rpc_usercode";
+    if (!pool_name.empty()) {
+        name.push_back('_');
+        name.append(pool_name);
+    }
+    name.push_back('_');
+    name.append(suffix);
+    return name;
+}
+
+class UserCodeBackupPool {
+public:
+    // `too_many_mark' is where the too-many-user-code mark of this pool is
+    // stored. The global pool passes &g_too_many_usercode to keep the inline
+    // TooManyUserCode() working on it, NULL makes the pool use its own
+    // storage.
+    UserCodeBackupPool(const std::string& name, bool* too_many_mark);
+    ~UserCodeBackupPool() { StopAndJoin(); }
+
+    int Init(int num_threads);
+
+    // Queue `fn(arg)' to be run by one of the backup threads.
+    void Submit(void (*fn)(void*), void* arg);
+
+    bool TooMany() const { return *_too_many_mark; }
+
+    // Run all pending user code and quit the threads. Nothing shall be
+    // submitted during or after this call.
+    void StopAndJoin();
+
+private:
+    static void* RunThis(void* arg);
+    static size_t GetQueueSize(void* arg);
+    void UserCodeRunningLoop();
+
+    std::string _name;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    bool _stop;
+    bool _own_mark;
+    bool* _too_many_mark;
+    int _num_threads;
+    // Run user code when parallelism of user code reaches the threshold
+    std::deque<UserCode> _queue;
+    std::vector<pthread_t> _threads;
+    bvar::PassiveStatus<size_t> _queue_size_var;
+    bvar::Adder<size_t> _inpool_count;
+    bvar::PerSecond<bvar::Adder<size_t> > _inpool_per_second;
+    // NOTE: we don't use Adder<double> directly which does not compile in gcc 3.4
+    bvar::Adder<int64_t> _inpool_elapse_us;
+    bvar::PassiveStatus<double> _inpool_elapse_s;
+    bvar::PerSecond<bvar::PassiveStatus<double> > _pool_usage;
+};
+
+UserCodeBackupPool::UserCodeBackupPool(const std::string& name,
+                                       bool* too_many_mark)
+    : _name(name)
+    , _stop(false)
+    , _own_mark(false)
+    , _too_many_mark(too_many_mark != NULL ? too_many_mark : &_own_mark)
+    , _num_threads(0)
+    , _queue_size_var(UserCodeVarName(name, "queue_size"), GetQueueSize, this)
+    , _inpool_count(UserCodeVarName(name, "backup_count"))
+    , _inpool_per_second(UserCodeVarName(name, "backup_second"), &_inpool_count)
+    , _inpool_elapse_s(GetInPoolElapseInSecond, &_inpool_elapse_us)
+    , _pool_usage(UserCodeVarName(name, "backup_usage"), &_inpool_elapse_s, 1) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
 }
 
-static void* UserCodeRunner(void* args) {
+void* UserCodeBackupPool::RunThis(void* arg) {
     butil::PlatformThread::SetName("brpc_user_code_runner");
-    static_cast<UserCodeBackupPool*>(args)->UserCodeRunningLoop();
+    static_cast<UserCodeBackupPool*>(arg)->UserCodeRunningLoop();
     return NULL;
 }
 
-int UserCodeBackupPool::Init() {
+size_t UserCodeBackupPool::GetQueueSize(void* arg) {
+    UserCodeBackupPool* p = static_cast<UserCodeBackupPool*>(arg);
+    BAIDU_SCOPED_LOCK(p->_mutex);
+    return p->_queue.size();
+}
+
+int UserCodeBackupPool::Init(int num_threads) {
+    if (num_threads <= 0) {
+        LOG(ERROR) << "Invalid num_threads=" << num_threads;
+        return -1;
+    }
+    _num_threads = num_threads;
     // Like bthread workers, these threads never quit (to avoid potential hang
-    // during termination of program).
-    for (int i = 0; i < FLAGS_usercode_backup_threads; ++i) {
+    // during termination of program) unless the pool is destroyed explicitly.
+    _threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
         pthread_t th;
-        if (pthread_create(&th, NULL, UserCodeRunner, this) != 0) {
+        if (pthread_create(&th, NULL, RunThis, this) != 0) {
             LOG(ERROR) << "Fail to create UserCodeRunner";
             return -1;
         }
+        _threads.push_back(th);
     }
     return 0;
 }
@@ -116,36 +172,71 @@ void UserCodeBackupPool::UserCodeRunningLoop() {
 #ifdef BAIDU_INTERNAL
     logging::ComlogInitializer comlog_initializer;
 #endif
-    
+
     int64_t last_time = butil::cpuwide_time_us();
     while (true) {
         bool blocked = false;
         UserCode usercode = { NULL, NULL };
         {
-            BAIDU_SCOPED_LOCK(s_usercode_mutex);
-            while (queue.empty()) {
-                pthread_cond_wait(&s_usercode_cond, &s_usercode_mutex);
+            BAIDU_SCOPED_LOCK(_mutex);
+            while (_queue.empty()) {
+                if (_stop) {
+                    return;
+                }
+                pthread_cond_wait(&_cond, &_mutex);
                 blocked = true;
             }
-            usercode = queue.front();
-            queue.pop_front();
-            if (g_too_many_usercode &&
-                (int)queue.size() <= FLAGS_usercode_backup_threads) {
-                g_too_many_usercode = false;
+            usercode = _queue.front();
+            _queue.pop_front();
+            if (*_too_many_mark && (int)_queue.size() <= _num_threads) {
+                *_too_many_mark = false;
             }
         }
         const int64_t begin_time = (blocked ? butil::cpuwide_time_us() : last_time);
         usercode.fn(usercode.arg);
         const int64_t end_time = butil::cpuwide_time_us();
-        inpool_count << 1;
-        inpool_elapse_us << (end_time - begin_time);
+        _inpool_count << 1;
+        _inpool_elapse_us << (end_time - begin_time);
         last_time = end_time;
     }
 }
 
+void UserCodeBackupPool::Submit(void (*fn)(void*), void* arg) {
+    const UserCode usercode = { fn, arg };
+    pthread_mutex_lock(&_mutex);
+    _queue.push_back(usercode);
+    // If the queue has too many items, we can't drop the user code
+    // directly which often must be run, for example: client-side done.
+    // The solution is that we set a mark which is not cleared before
+    // queue becomes short again. RPC code checks the mark before
+    // submitting tasks that may generate more user code.
+    if ((int)_queue.size() >=
+        (_num_threads * FLAGS_max_pending_in_each_backup_thread)) {
+        *_too_many_mark = true;
+    }
+    pthread_mutex_unlock(&_mutex);
+    pthread_cond_signal(&_cond);
+}
+
+void UserCodeBackupPool::StopAndJoin() {
+    if (_threads.empty()) {
+        return;
+    }
+    pthread_mutex_lock(&_mutex);
+    _stop = true;
+    pthread_mutex_unlock(&_mutex);
+    pthread_cond_broadcast(&_cond);
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+}
+
 static void InitUserCodeBackupPool() {
-    s_usercode_pool = new UserCodeBackupPool;
-    if (s_usercode_pool->Init() != 0) {
+    s_usercode_pool = new UserCodeBackupPool("", &g_too_many_usercode);
+    s_inplace_var = new bvar::PassiveStatus<int>(
+        "rpc_usercode_inplace", GetUserCodeInPlace, NULL);
+    if (s_usercode_pool->Init(FLAGS_usercode_backup_threads) != 0) {
         LOG(ERROR) << "Fail to init UserCodeBackupPool";
         // rare and critical, often happen when the program just started since
         // this function is called from GlobalInitializeOrDieImpl() as well,
@@ -160,27 +251,43 @@ void InitUserCodeBackupPoolOnceOrDie() {
 
 void EndRunningUserCodeInPool(void (*fn)(void*), void* arg) {
     InitUserCodeBackupPoolOnceOrDie();
-    
+
     g_usercode_inplace.fetch_sub(1, butil::memory_order_relaxed);
 
     // Not enough idle workers, run the code in backup threads to prevent
     // all workers from being blocked and no responses will be processed
     // anymore (deadlocked).
-    const UserCode usercode = { fn, arg };
-    pthread_mutex_lock(&s_usercode_mutex);
-    s_usercode_pool->queue.push_back(usercode);
-    // If the queue has too many items, we can't drop the user code
-    // directly which often must be run, for example: client-side done.
-    // The solution is that we set a mark which is not cleared before
-    // queue becomes short again. RPC code checks the mark before
-    // submitting tasks that may generate more user code.
-    if ((int)s_usercode_pool->queue.size() >=
-        (FLAGS_usercode_backup_threads *
-         FLAGS_max_pending_in_each_backup_thread)) {
-        g_too_many_usercode = true;
+    s_usercode_pool->Submit(fn, arg);
+}
+
+void EndRunningUserCodeInPool(UserCodeBackupPool* pool,
+                              void (*fn)(void*), void* arg) {
+    if (pool == NULL) {
+        return EndRunningUserCodeInPool(fn, arg);
+    }
+    g_usercode_inplace.fetch_sub(1, butil::memory_order_relaxed);
+    pool->Submit(fn, arg);
+}
+
+bool TooManyUserCode(const UserCodeBackupPool* pool) {
+    return pool != NULL ? pool->TooMany() : TooManyUserCode();
+}
+
+UserCodeBackupPool* NewUserCodeBackupPool(const std::string& name,
+                                          int num_threads) {
+    UserCodeBackupPool* pool = new UserCodeBackupPool(name, NULL);
+    if (pool->Init(num_threads) != 0) {
+        delete pool;
+        return NULL;
+    }
+    return pool;
+}
+
+void DestroyUserCodeBackupPool(UserCodeBackupPool* pool) {
+    if (pool != NULL) {
+        pool->StopAndJoin();
+        delete pool;
     }
-    pthread_mutex_unlock(&s_usercode_mutex);
-    pthread_cond_signal(&s_usercode_cond);
 }
 
 } // namespace brpc
@@ -19,6 +19,7 @@
 #ifndef  BRPC_USERCODE_BACKUP_POOL_H
 #define  BRPC_USERCODE_BACKUP_POOL_H
 
+#include <string>
 #include "butil/atomicops.h"
 #include "bthread/bthread.h"
 #include <gflags/gflags_declare.h>
@@ -82,6 +83,28 @@ inline void RunUserCode(void (*fn)(void*), void* arg) {
 // called, it will be called in EndRunningUserCodeInPool
 void InitUserCodeBackupPoolOnceOrDie();
 
+class UserCodeBackupPool;
+
+// Create a pool of `num_threads' backup pthreads dedicated to some services
+// or methods so that queueing delays caused by slow user code elsewhere do
+// not leak into them through the global pool. `name' is embedded into bvars
+// of the pool: rpc_usercode_<name>_queue_size etc. Returns NULL on failure.
+UserCodeBackupPool* NewUserCodeBackupPool(const std::string& name,
+                                          int num_threads);
+
+// Run remaining user code inside `pool', quit its threads and delete it.
+// Nothing shall be submitted to the pool during or after this call.
+void DestroyUserCodeBackupPool(UserCodeBackupPool* pool);
+
+// Counterpart of TooManyUserCode() against a dedicated pool. A NULL `pool'
+// checks the global pool.
+bool TooManyUserCode(const UserCodeBackupPool* pool);
+
+// Counterpart of EndRunningUserCodeInPool() submitting to a dedicated pool.
+// A NULL `pool' submits to the global pool.
+void EndRunningUserCodeInPool(UserCodeBackupPool* pool,
+                              void (*fn)(void*), void* arg);
+
 } // namespace brpc
 
 
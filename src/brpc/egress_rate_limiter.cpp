@@ -0,0 +1,67 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include "butil/scoped_lock.h"          // BAIDU_SCOPED_LOCK
+#include "butil/time.h"                 // butil::gettimeofday_us
+#include "brpc/egress_rate_limiter.h"
+
+
+namespace brpc {
+
+EgressRateLimiter::EgressRateLimiter(int64_t max_bytes_per_second)
+    : _max_bps(max_bytes_per_second)
+    , _tokens(0)
+    , _last_refill_us(0) {}
+
+void EgressRateLimiter::Refill(int64_t max_bps) {
+    const int64_t now_us = butil::gettimeofday_us();
+    if (_last_refill_us == 0) {
+        // First use: start with a full second of burst.
+        _tokens = max_bps;
+    } else {
+        _tokens += (now_us - _last_refill_us) * max_bps / 1000000;
+        _tokens = std::min(_tokens, max_bps);
+    }
+    _last_refill_us = now_us;
+}
+
+void EgressRateLimiter::Consume(int64_t bytes) {
+    const int64_t max_bps = max_bytes_per_second();
+    if (max_bps <= 0 || bytes <= 0) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    Refill(max_bps);
+    _tokens -= bytes;
+}
+
+int64_t EgressRateLimiter::SuggestedWaitUs() {
+    const int64_t max_bps = max_bytes_per_second();
+    if (max_bps <= 0) {
+        return 0;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    Refill(max_bps);
+    if (_tokens >= 0) {
+        return 0;
+    }
+    return -_tokens * 1000000 / max_bps;
+}
+
+} // namespace brpc
@@ -0,0 +1,74 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_EGRESS_RATE_LIMITER_H
+#define BRPC_EGRESS_RATE_LIMITER_H
+
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+#include "butil/synchronization/lock.h"
+
+
+namespace brpc {
+
+// A token bucket limiting the bytes written into the network, enforced in
+// the write path of Socket(in-process traffic shaping, no tc/qdisc
+// needed). One limiter can be shared by many sockets: set
+// ServerOptions.max_egress_bytes_per_second to shape all connections of a
+// server, ChannelOptions.max_egress_bytes_per_second to shape one channel,
+// or put the same shared_ptr into ChannelOptions.egress_limiter of several
+// channels to shape them as a group.
+// Writes are not chopped: a large write may overdraw the bucket and the
+// writing bthread then sleeps off the debt(via the timer thread) before
+// writing again, so the rate converges to the limit with bursts bounded
+// by one write. Throttle events are counted by rpc_egress_throttle_second.
+class EgressRateLimiter {
+public:
+    // rate <= 0 means unlimited.
+    explicit EgressRateLimiter(int64_t max_bytes_per_second);
+
+    // Changeable at any time, applied at next Consume()/SuggestedWaitUs().
+    void set_max_bytes_per_second(int64_t rate)
+    { _max_bps.store(rate, butil::memory_order_relaxed); }
+    int64_t max_bytes_per_second() const
+    { return _max_bps.load(butil::memory_order_relaxed); }
+
+    // Subtract `bytes' just written from the bucket.
+    void Consume(int64_t bytes);
+
+    // Microseconds the caller should wait before writing again, 0 when
+    // the bucket is not in debt.
+    int64_t SuggestedWaitUs();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(EgressRateLimiter);
+
+    // Add tokens for the time passed since the last refill, capped at one
+    // second worth of burst. Called with _mutex held.
+    void Refill(int64_t max_bps);
+
+    butil::atomic<int64_t> _max_bps;
+    butil::Mutex _mutex;
+    int64_t _tokens;          // negative = debt from an overdrawing write
+    int64_t _last_refill_us;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_EGRESS_RATE_LIMITER_H
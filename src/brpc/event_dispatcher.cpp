@@ -17,7 +17,9 @@
 
 
 #include <gflags/gflags.h>                            // DEFINE_int32
+#include <sys/socket.h>                               // getsockopt
 #include "butil/compat.h"
+#include "butil/time.h"                               // gettimeofday_us
 #include "butil/fd_utility.h"                         // make_close_on_exec
 #include "butil/logging.h"                            // LOG
 #include "butil/third_party/murmurhash3/murmurhash3.h"// fmix32
@@ -36,11 +38,83 @@ DEFINE_bool(usercode_in_pthread, false,
 DEFINE_bool(usercode_in_coroutine, false,
             "User's callback are run in coroutine, no bthread or pthread blocking call");
 
+DEFINE_bool(event_dispatcher_rx_affinity, false,
+            "Assign fds to the event dispatcher matching the cpu handling "
+            "their RX softirq(SO_INCOMING_CPU) instead of hashing the fd, "
+            "keeping received data LLC-local. Linux only, effective with "
+            "multiple dispatchers");
+DEFINE_int32(event_dispatcher_rx_rehome_interval_ms, 1000,
+             "Minimum interval between re-checks of the RX cpu of one fd "
+             "when -event_dispatcher_rx_affinity is on");
+
 static EventDispatcher* g_edisp = NULL;
 static bvar::LatencyRecorder* g_edisp_read_lantency = NULL;
 static bvar::LatencyRecorder* g_edisp_write_lantency = NULL;
+// Distribution of the number of events returned per epoll_wait/kevent,
+// telling how much the batched worker handoff amortizes per batch.
+static bvar::LatencyRecorder* g_edisp_batch_size = NULL;
 static pthread_once_t g_edisp_once = PTHREAD_ONCE_INIT;
 
+// [RX-affine dispatching] fd -> cached dispatcher index and next re-check
+// time. Fixed-size, fds beyond the table fall back to hashing. A stale
+// entry left by a fd closed outside IOEvent::RemoveConsumer() only costs
+// a suboptimal(still consistent) assignment until the fd is re-homed.
+struct RxAffinitySlot {
+    butil::atomic<int32_t> index;
+    butil::atomic<int64_t> next_check_us;
+};
+static const int RX_AFFINITY_SLOT_NUM = 65536;
+static RxAffinitySlot* g_rx_affinity_slots = NULL;
+
+static int IncomingCpuOf(int fd) {
+#if defined(OS_LINUX) && defined(SO_INCOMING_CPU)
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+        cpu >= 0) {
+        return cpu;
+    }
+#endif
+    return -1;
+}
+
+static RxAffinitySlot* RxAffinitySlotOf(int fd) {
+    if (g_rx_affinity_slots == NULL || fd < 0 || fd >= RX_AFFINITY_SLOT_NUM) {
+        return NULL;
+    }
+    return &g_rx_affinity_slots[fd];
+}
+
+bool NeedRehomeRxAffineFd(int fd) {
+    RxAffinitySlot* slot = RxAffinitySlotOf(fd);
+    if (slot == NULL) {
+        return false;
+    }
+    const int32_t cached = slot->index.load(butil::memory_order_relaxed);
+    if (cached < 0) {
+        return false;
+    }
+    const int64_t now_us = butil::gettimeofday_us();
+    int64_t next_us = slot->next_check_us.load(butil::memory_order_relaxed);
+    if (now_us < next_us ||
+        !slot->next_check_us.compare_exchange_strong(
+            next_us,
+            now_us + FLAGS_event_dispatcher_rx_rehome_interval_ms * 1000L,
+            butil::memory_order_relaxed)) {
+        // Not due yet, or a concurrent caller took this round.
+        return false;
+    }
+    const int cpu = IncomingCpuOf(fd);
+    return cpu >= 0 && cpu % FLAGS_event_dispatcher_num != cached;
+}
+
+void ClearRxAffineFd(int fd) {
+    RxAffinitySlot* slot = RxAffinitySlotOf(fd);
+    if (slot != NULL) {
+        slot->index.store(-1, butil::memory_order_relaxed);
+    }
+}
+
 static void StopAndJoinGlobalDispatchers() {
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         for (int j = 0; j < FLAGS_event_dispatcher_num; ++j) {
@@ -50,12 +124,23 @@ static void StopAndJoinGlobalDispatchers() {
     }
     delete g_edisp_read_lantency;
     delete g_edisp_write_lantency;
+    delete g_edisp_batch_size;
 }
 
 void InitializeGlobalDispatchers() {
     g_edisp_read_lantency = new bvar::LatencyRecorder("event_dispatcher_read_latency");
     g_edisp_write_lantency = new bvar::LatencyRecorder("event_dispatcher_write_latency");
-
+    g_edisp_batch_size = new bvar::LatencyRecorder("event_dispatcher_batch_size");
+
+    if (FLAGS_event_dispatcher_rx_affinity && FLAGS_event_dispatcher_num > 1) {
+        g_rx_affinity_slots = new RxAffinitySlot[RX_AFFINITY_SLOT_NUM];
+        for (int i = 0; i < RX_AFFINITY_SLOT_NUM; ++i) {
+            g_rx_affinity_slots[i].index.store(
+                -1, butil::memory_order_relaxed);
+            g_rx_affinity_slots[i].next_check_us.store(
+                0, butil::memory_order_relaxed);
+        }
+    }
     g_edisp = new EventDispatcher[FLAGS_task_group_ntags * FLAGS_event_dispatcher_num];
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         for (int j = 0; j < FLAGS_event_dispatcher_num; ++j) {
@@ -75,7 +160,21 @@ EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag) {
     if (FLAGS_task_group_ntags == 1 && FLAGS_event_dispatcher_num == 1) {
         return g_edisp[0];
     }
-    int index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
+    int index = -1;
+    RxAffinitySlot* slot = RxAffinitySlotOf(fd);
+    if (slot != NULL) {
+        index = slot->index.load(butil::memory_order_relaxed);
+        if (index < 0) {
+            // Cache even the hashed fallback so that later calls for this
+            // fd (e.g. RemoveConsumer) resolve to the same dispatcher.
+            const int cpu = IncomingCpuOf(fd);
+            index = (cpu >= 0 ? cpu : (int)butil::fmix32(fd))
+                % FLAGS_event_dispatcher_num;
+            slot->index.store(index, butil::memory_order_relaxed);
+        }
+    } else {
+        index = butil::fmix32(fd) % FLAGS_event_dispatcher_num;
+    }
     return g_edisp[tag * FLAGS_event_dispatcher_num + index];
 }
 
@@ -100,7 +199,11 @@ void IOEventData::BeforeRecycled() {
 } // namespace brpc
 
 #if defined(OS_LINUX)
-    #include "brpc/event_dispatcher_epoll.cpp"
+    #if BRPC_WITH_IO_URING
+        #include "brpc/event_dispatcher_uring.cpp"
+    #else
+        #include "brpc/event_dispatcher_epoll.cpp"
+    #endif
 #elif defined(OS_MACOSX)
     #include "brpc/event_dispatcher_kqueue.cpp"
 #else
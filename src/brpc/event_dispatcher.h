@@ -87,6 +87,11 @@ namespace rdma {
 class RdmaEndpoint;
 }
 
+#if BRPC_WITH_IO_URING
+// Defined in event_dispatcher_uring.cpp.
+struct IOUringContext;
+#endif
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate bthreads.
 class EventDispatcher {
@@ -179,15 +184,41 @@ private:
     // identifier of hosting bthread
     bthread_t _tid;
 
+    // True when the dispatcher runs in a dedicated busy-polling pthread
+    // instead of a bthread. Only used by the epoll backend when
+    // -event_dispatcher_busy_poll_us is positive.
+    bool _busy_poll;
+    pthread_t _busy_poll_thread;
+
     // The attribute of bthreads calling user callbacks.
     bthread_attr_t _thread_attr;
 
     // Pipe fds to wakeup EventDispatcher from `epoll_wait' in order to quit
     int _wakeup_fds[2];
+
+#if BRPC_WITH_IO_URING
+    // Ring and registration states, only used by the io_uring backend.
+    IOUringContext* _uring_ctx;
+#endif
 };
 
 EventDispatcher& GetGlobalEventDispatcher(int fd, bthread_tag_t tag);
 
+// [RX-affine dispatching] With -event_dispatcher_rx_affinity on,
+// GetGlobalEventDispatcher() assigns a fd to the dispatcher matching the
+// cpu handling its RX softirq(SO_INCOMING_CPU) instead of hashing the fd,
+// so received data stays LLC-local between softirq and our read. The
+// assignment is cached to keep all calls for one fd consistent.
+
+// True if `fd' should be moved to another dispatcher: rate-limits itself,
+// re-queries SO_INCOMING_CPU and compares with the cached assignment.
+// Always false when -event_dispatcher_rx_affinity is off.
+bool NeedRehomeRxAffineFd(int fd);
+
+// Forget the cached dispatcher assignment of `fd'. Called after the fd
+// left its dispatcher(closed or about to be re-homed).
+void ClearRxAffineFd(int fd);
+
 // IOEvent class manages the IO events of a file descriptor conveniently.
 template <typename T>
 class IOEvent {
@@ -238,7 +269,27 @@ public:
             LOG(ERROR) << "IOEvent has not been initialized";
             return -1;
         }
-        return GetGlobalEventDispatcher(fd, _bthread_tag).RemoveConsumer(fd);
+        const int rc = GetGlobalEventDispatcher(fd, _bthread_tag)
+            .RemoveConsumer(fd);
+        if (rc == 0) {
+            ClearRxAffineFd(fd);
+        }
+        return rc;
+    }
+
+    // Move `fd' to the dispatcher matching its current RX cpu if RSS
+    // steered the flow elsewhere since AddConsumer(), see comments above
+    // NeedRehomeRxAffineFd(). No-op when -event_dispatcher_rx_affinity
+    // is off. Returns -1 when the fd could not be re-added, in which case
+    // it is no longer polled by any dispatcher.
+    int RehomeConsumer(int fd) {
+        if (!_init || !NeedRehomeRxAffineFd(fd)) {
+            return 0;
+        }
+        if (RemoveConsumer(fd) != 0) {
+            return 0;  // still registered at the old dispatcher
+        }
+        return AddConsumer(fd);
     }
 
     // See comments of `EventDispatcher::RegisterEvent'.
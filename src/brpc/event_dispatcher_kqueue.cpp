@@ -203,6 +203,9 @@ void EventDispatcher::Run() {
             PLOG(FATAL) << "Fail to kqueue epfd=" << _event_dispatcher_fd;
             break;
         }
+        if (n > 0) {
+            (*g_edisp_batch_size) << n;
+        }
         for (int i = 0; i < n; ++i) {
             if ((e[i].flags & EV_ERROR) || e[i].filter == EVFILT_READ) {
                 int64_t start_ns = butil::cpuwide_time_ns();
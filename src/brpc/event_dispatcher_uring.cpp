@@ -0,0 +1,391 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <liburing.h>
+#include <poll.h>
+#include <new>
+#include "butil/containers/flat_map.h"
+#include "butil/synchronization/lock.h"
+#ifdef BRPC_SOCKET_HAS_EOF
+#include "brpc/details/has_epollrdhup.h"
+#endif
+
+namespace brpc {
+
+DEFINE_int32(io_uring_queue_depth, 4096,
+             "Submission queue depth of io_uring-based EventDispatcher");
+
+// Registration state of one file descriptor inside the ring. A multishot
+// POLL_ADD keeps firing completions until it is canceled, so one poller
+// covers the whole lifetime of a consumer unless its interest set changes.
+struct UringPoller {
+    int fd;
+    IOEventDataId data_id;
+    short poll_mask;
+    // Set (under IOUringContext.mutex) when the poller is being canceled.
+    // Completions already sitting in the CQ ring are dropped by checking it.
+    bool removed;
+};
+
+// CQE user_data is a UringPoller* in normal completions. Bit 0 tags the
+// terminal CQE of a POLL_REMOVE, upon which the poller is finally freed.
+// user_data 0 marks the NOP used to wake up Run() from Stop().
+const uint64_t URING_UD_FREE_BIT = 1;
+
+struct IOUringContext {
+    struct io_uring ring;
+    // io_uring's submission queue is single-producer while AddConsumer/
+    // RegisterEvent may be called from any thread, so SQE acquisition and
+    // submission are serialized here. The CQ side is only touched by Run().
+    butil::Mutex mutex;
+    butil::FlatMap<int, UringPoller*> pollers;
+};
+
+// Arm (or re-arm) a multishot poll for `p'. Called with ctx->mutex held.
+static int ArmPollerLocked(IOUringContext* ctx, UringPoller* p) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ctx->ring);
+    if (NULL == sqe) {
+        // SQ ring is full of unsubmitted entries, flush and retry once.
+        io_uring_submit(&ctx->ring);
+        sqe = io_uring_get_sqe(&ctx->ring);
+        if (NULL == sqe) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    io_uring_prep_poll_multishot(sqe, p->fd, p->poll_mask);
+    io_uring_sqe_set_data(sqe, p);
+    return io_uring_submit(&ctx->ring) >= 0 ? 0 : -1;
+}
+
+// Cancel the in-flight poll of `p'. If `free_poller' is true, `p' is
+// released when the cancelation completes in Run(). Called with
+// ctx->mutex held.
+static int CancelPollerLocked(IOUringContext* ctx, UringPoller* p,
+                              bool free_poller) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ctx->ring);
+    if (NULL == sqe) {
+        io_uring_submit(&ctx->ring);
+        sqe = io_uring_get_sqe(&ctx->ring);
+        if (NULL == sqe) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    io_uring_prep_poll_remove(sqe, (__u64)(uintptr_t)p);
+    io_uring_sqe_set_data64(
+        sqe, free_poller ? ((uint64_t)(uintptr_t)p | URING_UD_FREE_BIT) : 0);
+    return io_uring_submit(&ctx->ring) >= 0 ? 0 : -1;
+}
+
+EventDispatcher::EventDispatcher()
+    : _event_dispatcher_fd(-1)
+    , _stop(false)
+    , _tid(0)
+    , _thread_attr(BTHREAD_ATTR_EPOLL)
+    , _uring_ctx(NULL) {
+    _wakeup_fds[0] = -1;
+    _wakeup_fds[1] = -1;
+    _uring_ctx = new (std::nothrow) IOUringContext;
+    if (NULL == _uring_ctx) {
+        LOG(FATAL) << "Fail to new IOUringContext";
+        return;
+    }
+    const int rc = io_uring_queue_init(
+        FLAGS_io_uring_queue_depth, &_uring_ctx->ring, 0);
+    if (rc < 0) {
+        LOG(FATAL) << "Fail to create io_uring: " << berror(-rc);
+        delete _uring_ctx;
+        _uring_ctx = NULL;
+        return;
+    }
+    if (_uring_ctx->pollers.init(1024) != 0) {
+        LOG(FATAL) << "Fail to init poller map";
+        io_uring_queue_exit(&_uring_ctx->ring);
+        delete _uring_ctx;
+        _uring_ctx = NULL;
+        return;
+    }
+    // The ring fd is owned by io_uring_queue_exit(), this copy only makes
+    // Running() and sanity checks work as they do for epoll/kqueue.
+    _event_dispatcher_fd = _uring_ctx->ring.ring_fd;
+}
+
+EventDispatcher::~EventDispatcher() {
+    Stop();
+    Join();
+    if (_uring_ctx != NULL) {
+        io_uring_queue_exit(&_uring_ctx->ring);
+        _event_dispatcher_fd = -1;
+        for (butil::FlatMap<int, UringPoller*>::iterator
+                 it = _uring_ctx->pollers.begin();
+             it != _uring_ctx->pollers.end(); ++it) {
+            delete it->second;
+        }
+        delete _uring_ctx;
+        _uring_ctx = NULL;
+    }
+}
+
+int EventDispatcher::Start(const bthread_attr_t* consumer_thread_attr) {
+    if (NULL == _uring_ctx) {
+        LOG(FATAL) << "io_uring was not created";
+        return -1;
+    }
+    if (_tid != 0) {
+        LOG(FATAL) << "Already started this dispatcher(" << this
+                   << ") in bthread=" << _tid;
+        return -1;
+    }
+    if (consumer_thread_attr) {
+        _thread_attr = *consumer_thread_attr | BTHREAD_GLOBAL_PRIORITY;
+    }
+    bthread_attr_t uring_thread_attr = _thread_attr | BTHREAD_NEVER_QUIT;
+    int rc = bthread_start_background(
+        &_tid, &uring_thread_attr, RunThis, this);
+    if (rc) {
+        LOG(FATAL) << "Fail to create io_uring thread: " << berror(rc);
+        return -1;
+    }
+    return 0;
+}
+
+bool EventDispatcher::Running() const {
+    return !_stop && _uring_ctx != NULL && _tid != 0;
+}
+
+void EventDispatcher::Stop() {
+    _stop = true;
+    if (_uring_ctx != NULL) {
+        // Wake up Run() blocked in io_uring_wait_cqe with a NOP.
+        BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&_uring_ctx->ring);
+        if (sqe != NULL) {
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data64(sqe, 0);
+            io_uring_submit(&_uring_ctx->ring);
+        }
+    }
+}
+
+void EventDispatcher::Join() {
+    if (_tid) {
+        bthread_join(_tid, NULL);
+        _tid = 0;
+    }
+}
+
+int EventDispatcher::AddConsumer(IOEventDataId event_data_id, int fd) {
+    if (NULL == _uring_ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    UringPoller* p = new (std::nothrow) UringPoller;
+    if (NULL == p) {
+        errno = ENOMEM;
+        return -1;
+    }
+    p->fd = fd;
+    p->data_id = event_data_id;
+    p->poll_mask = POLLIN;
+#ifdef BRPC_SOCKET_HAS_EOF
+    p->poll_mask |= POLLRDHUP;
+#endif
+    p->removed = false;
+    BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+    if (_uring_ctx->pollers.seek(fd) != NULL) {
+        delete p;
+        errno = EEXIST;
+        return -1;
+    }
+    _uring_ctx->pollers[fd] = p;
+    if (ArmPollerLocked(_uring_ctx, p) != 0) {
+        _uring_ctx->pollers.erase(fd);
+        delete p;
+        return -1;
+    }
+    return 0;
+}
+
+int EventDispatcher::RegisterEvent(IOEventDataId event_data_id,
+                                   int fd, bool pollin) {
+    if (NULL == _uring_ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+    UringPoller** pp = _uring_ctx->pollers.seek(fd);
+    if (pollin) {
+        // Equivalent of EPOLL_CTL_MOD: the fd must already be registered,
+        // otherwise it has been removed via RemoveConsumer.
+        if (NULL == pp) {
+            errno = ENOENT;
+            return -1;
+        }
+        UringPoller* p = *pp;
+        CancelPollerLocked(_uring_ctx, p, false);
+        p->poll_mask |= POLLOUT;
+        return ArmPollerLocked(_uring_ctx, p);
+    }
+    if (pp != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    UringPoller* p = new (std::nothrow) UringPoller;
+    if (NULL == p) {
+        errno = ENOMEM;
+        return -1;
+    }
+    p->fd = fd;
+    p->data_id = event_data_id;
+    p->poll_mask = POLLOUT;
+    p->removed = false;
+    _uring_ctx->pollers[fd] = p;
+    if (ArmPollerLocked(_uring_ctx, p) != 0) {
+        _uring_ctx->pollers.erase(fd);
+        delete p;
+        return -1;
+    }
+    return 0;
+}
+
+int EventDispatcher::UnregisterEvent(IOEventDataId event_data_id,
+                                     int fd, bool pollin) {
+    if (NULL == _uring_ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+    UringPoller** pp = _uring_ctx->pollers.seek(fd);
+    if (NULL == pp) {
+        errno = ENOENT;
+        return -1;
+    }
+    UringPoller* p = *pp;
+    if (pollin) {
+        CancelPollerLocked(_uring_ctx, p, false);
+        p->poll_mask = POLLIN;
+#ifdef BRPC_SOCKET_HAS_EOF
+        p->poll_mask |= POLLRDHUP;
+#endif
+        return ArmPollerLocked(_uring_ctx, p);
+    }
+    p->removed = true;
+    _uring_ctx->pollers.erase(fd);
+    return CancelPollerLocked(_uring_ctx, p, true);
+}
+
+int EventDispatcher::RemoveConsumer(int fd) {
+    if (fd < 0 || NULL == _uring_ctx) {
+        return -1;
+    }
+    // Same reasoning as the epoll implementation: cancel the in-kernel
+    // registration before the fd is closed, otherwise a forked child
+    // holding the fd keeps the poll alive inside the ring.
+    BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+    UringPoller** pp = _uring_ctx->pollers.seek(fd);
+    if (NULL == pp) {
+        return -1;
+    }
+    UringPoller* p = *pp;
+    p->removed = true;
+    _uring_ctx->pollers.erase(fd);
+    return CancelPollerLocked(_uring_ctx, p, true);
+}
+
+void* EventDispatcher::RunThis(void* arg) {
+    ((EventDispatcher*)arg)->Run();
+    return NULL;
+}
+
+void EventDispatcher::Run() {
+    struct io_uring* ring = &_uring_ctx->ring;
+    while (!_stop) {
+        struct io_uring_cqe* first_cqe = NULL;
+        const int rc = io_uring_wait_cqe(ring, &first_cqe);
+        if (_stop) {
+            break;
+        }
+        if (rc < 0) {
+            if (-EINTR == rc) {
+                continue;
+            }
+            LOG(FATAL) << "Fail to wait cqe of ring_fd="
+                       << _event_dispatcher_fd << ": " << berror(-rc);
+            break;
+        }
+        // Harvest completions in batches, one io_uring_enter woke us up
+        // for all of them.
+        struct io_uring_cqe* cqes[32];
+        unsigned n;
+        while ((n = io_uring_peek_batch_cqe(ring, cqes, ARRAY_SIZE(cqes))) > 0) {
+            for (unsigned i = 0; i < n; ++i) {
+                struct io_uring_cqe* cqe = cqes[i];
+                const uint64_t ud = (uint64_t)io_uring_cqe_get_data64(cqe);
+                if (0 == ud) {
+                    // Wakeup NOP or untagged cancelation.
+                    continue;
+                }
+                if (ud & URING_UD_FREE_BIT) {
+                    // Terminal CQE of a canceling POLL_REMOVE: no further
+                    // completions reference the poller, release it.
+                    delete (UringPoller*)(uintptr_t)(ud & ~URING_UD_FREE_BIT);
+                    continue;
+                }
+                UringPoller* p = (UringPoller*)(uintptr_t)ud;
+                if (p->removed || cqe->res == -ECANCELED) {
+                    continue;
+                }
+                if (cqe->res < 0) {
+                    LOG_IF(FATAL, cqe->res == -EINVAL)
+                        << "Multishot poll is rejected by the kernel, "
+                           "io_uring EventDispatcher requires Linux >= 5.13";
+                    continue;
+                }
+                // poll(2) revents share values with epoll events on Linux,
+                // pass them through unchanged.
+                const uint32_t events = (uint32_t)cqe->res;
+                if (events & (POLLIN | POLLERR | POLLHUP)
+#ifdef BRPC_SOCKET_HAS_EOF
+                    || (events & POLLRDHUP)
+#endif
+                    ) {
+                    int64_t start_ns = butil::cpuwide_time_ns();
+                    CallInputEventCallback(p->data_id, events, _thread_attr);
+                    (*g_edisp_read_lantency) << (butil::cpuwide_time_ns() - start_ns);
+                }
+                if (events & (POLLOUT | POLLERR | POLLHUP)) {
+                    int64_t start_ns = butil::cpuwide_time_ns();
+                    CallOutputEventCallback(p->data_id, events, _thread_attr);
+                    (*g_edisp_write_lantency) << (butil::cpuwide_time_ns() - start_ns);
+                }
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    // Multishot registration was dropped by the kernel
+                    // (e.g. CQ overflow), re-arm it.
+                    BAIDU_SCOPED_LOCK(_uring_ctx->mutex);
+                    if (!p->removed) {
+                        ArmPollerLocked(_uring_ctx, p);
+                    }
+                }
+            }
+            io_uring_cq_advance(ring, n);
+        }
+    }
+}
+
+} // namespace brpc
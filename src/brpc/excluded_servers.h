@@ -19,8 +19,11 @@
 #ifndef BRPC_EXCLUDED_SERVERS_H
 #define BRPC_EXCLUDED_SERVERS_H
 
+#include "butil/arena.h"
+#include "butil/atomicops.h"
 #include "butil/scoped_lock.h"
 #include "butil/containers/bounded_queue.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix64
 #include "brpc/socket_id.h"                       // SocketId
 
 
@@ -33,6 +36,12 @@ public:
     // Create a instance with at most `cap' servers.
     static ExcludedServers* Create(int cap);
 
+    // Same, but drawn from `arena' (typically Controller::arena()) instead
+    // of heap so that retries/backup requests don't pay a malloc per call.
+    // Destroy() on the result only runs the destructor; the memory goes
+    // away with the arena, which must outlive this object.
+    static ExcludedServers* Create(int cap, butil::Arena* arena);
+
     // Destroy the instance
     static void Destroy(ExcludedServers* ptr);
 
@@ -49,13 +58,32 @@ public:
     size_t size() const { return _l.size(); }
 
 private:
-    ExcludedServers(int cap)
-        : _l(_space, sizeof(SocketId)* cap, butil::NOT_OWN_STORAGE) {}
+    ExcludedServers(int cap, bool arena_backed)
+        : _arena_backed(arena_backed)
+        , _l(_space, sizeof(SocketId)* cap, butil::NOT_OWN_STORAGE) {
+        _bloom[0].store(0, butil::memory_order_relaxed);
+        _bloom[1].store(0, butil::memory_order_relaxed);
+    }
     ~ExcludedServers() {}
+
+    // Two probe positions in the 128-bit bloom filter below.
+    static void BloomBits(SocketId id, uint32_t* bit1, uint32_t* bit2) {
+        const uint64_t h = butil::fmix64(id);
+        *bit1 = (uint32_t)(h & 127);
+        *bit2 = (uint32_t)((h >> 32) & 127);
+    }
+
     // Controller::_accessed may be shared by sub channels in schan, protect
     // all mutable methods with this mutex. In ordinary channels, this mutex
     // is never contended.
     mutable butil::Mutex _mutex;
+    // Set for every Add()ed id and never cleared(even when elim_push pops an
+    // old entry), so that a zero bit proves absence without taking _mutex
+    // while set bits fall through to the exact scan. Relaxed ordering is
+    // fine: exclusion is an avoidance heuristic, a racing Add that is
+    // missed only costs an extra try on a recently-visited server.
+    butil::atomic<uint64_t> _bloom[2];
+    const bool _arena_backed;
     butil::BoundedQueue<SocketId> _l;
     SocketId _space[0];
 };
@@ -68,17 +96,39 @@ inline ExcludedServers* ExcludedServers::Create(int cap) {
     if (NULL == space) {
         return NULL;
     }
-    return new (space) ExcludedServers(cap);
+    return new (space) ExcludedServers(cap, false);
+}
+
+inline ExcludedServers* ExcludedServers::Create(int cap, butil::Arena* arena) {
+    if (NULL == arena) {
+        return Create(cap);
+    }
+    void* space = arena->allocate(
+        offsetof(ExcludedServers, _space) + sizeof(SocketId) * cap);
+    if (NULL == space) {
+        return NULL;
+    }
+    return new (space) ExcludedServers(cap, true);
 }
 
 inline void ExcludedServers::Destroy(ExcludedServers* ptr) {
     if (ptr) {
+        const bool arena_backed = ptr->_arena_backed;
         ptr->~ExcludedServers();
-        free(ptr);
+        if (!arena_backed) {
+            free(ptr);
+        }
     }
 }
 
 inline void ExcludedServers::Add(SocketId id) {
+    uint32_t bit1 = 0;
+    uint32_t bit2 = 0;
+    BloomBits(id, &bit1, &bit2);
+    _bloom[bit1 >> 6].fetch_or(1ULL << (bit1 & 63),
+                               butil::memory_order_relaxed);
+    _bloom[bit2 >> 6].fetch_or(1ULL << (bit2 & 63),
+                               butil::memory_order_relaxed);
     BAIDU_SCOPED_LOCK(_mutex);
     const SocketId* last_id = _l.bottom();
     if (last_id == NULL || *last_id != id) {
@@ -87,6 +137,18 @@ inline void ExcludedServers::Add(SocketId id) {
 }
 
 inline bool ExcludedServers::IsExcluded(SocketId id) const {
+    uint32_t bit1 = 0;
+    uint32_t bit2 = 0;
+    BloomBits(id, &bit1, &bit2);
+    if (!(_bloom[bit1 >> 6].load(butil::memory_order_relaxed)
+          & (1ULL << (bit1 & 63))) ||
+        !(_bloom[bit2 >> 6].load(butil::memory_order_relaxed)
+          & (1ULL << (bit2 & 63)))) {
+        // Definitely never Add()ed. This is the common result in the
+        // SelectServer loop of every load balancer, answered in O(1)
+        // without the lock or the scan.
+        return false;
+    }
     BAIDU_SCOPED_LOCK(_mutex);
     for (size_t i = 0; i < _l.size(); ++i) {
         if (*_l.bottom(i) == id) {
@@ -43,6 +43,7 @@
 // Load Balancers
 #include "brpc/policy/round_robin_load_balancer.h"
 #include "brpc/policy/weighted_round_robin_load_balancer.h"
+#include "brpc/policy/smooth_weighted_round_robin_load_balancer.h"
 #include "brpc/policy/randomized_load_balancer.h"
 #include "brpc/policy/weighted_randomized_load_balancer.h"
 #include "brpc/policy/locality_aware_load_balancer.h"
@@ -59,6 +60,12 @@
 #include "brpc/compress.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/snappy_compress.h"
+#if BRPC_WITH_ZSTD
+#include "brpc/policy/zstd_compress.h"
+#endif
+#if BRPC_WITH_LZ4
+#include "brpc/policy/lz4_compress.h"
+#endif
 
 // Checksum handlers
 #include "brpc/checksum.h"
@@ -89,6 +96,7 @@
 #include "brpc/concurrency_limiter.h"
 #include "brpc/policy/auto_concurrency_limiter.h"
 #include "brpc/policy/constant_concurrency_limiter.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
 #include "brpc/policy/timeout_concurrency_limiter.h"
 
 #include "brpc/input_messenger.h"     // get_or_new_client_side_messenger
@@ -132,6 +140,7 @@ struct GlobalExtensions {
         , ch_mh_lb(CONS_HASH_LB_MURMUR3)
         , ch_md5_lb(CONS_HASH_LB_MD5)
         , ch_ketama_lb(CONS_HASH_LB_KETAMA)
+        , ch_wyhash_lb(CONS_HASH_LB_WYHASH)
         , constant_cl(0) {
     }
     
@@ -150,16 +159,19 @@ struct GlobalExtensions {
 
     RoundRobinLoadBalancer rr_lb;
     WeightedRoundRobinLoadBalancer wrr_lb;
+    SmoothWeightedRoundRobinLoadBalancer swrr_lb;
     RandomizedLoadBalancer randomized_lb;
     WeightedRandomizedLoadBalancer wr_lb;
     LocalityAwareLoadBalancer la_lb;
     ConsistentHashingLoadBalancer ch_mh_lb;
     ConsistentHashingLoadBalancer ch_md5_lb;
     ConsistentHashingLoadBalancer ch_ketama_lb;
+    ConsistentHashingLoadBalancer ch_wyhash_lb;
     DynPartLoadBalancer dynpart_lb;
 
     AutoConcurrencyLimiter auto_cl;
     ConstantConcurrencyLimiter constant_cl;
+    GradientConcurrencyLimiter gradient_cl;
     TimeoutConcurrencyLimiter timeout_cl;
 };
 
@@ -205,6 +217,17 @@ static int64_t GetIOBufNewBigViewCount(void*) {
 static int64_t GetIOBufBlockMemory(void*) {
     return butil::IOBuf::block_memory();
 }
+// `arg' is the allocation site, see IOBuf::BlockAllocSite.
+static int64_t GetIOBufSiteBlockCount(void* arg) {
+    butil::IOBuf::BlockSiteStat stat;
+    butil::IOBuf::get_block_site_stat((int)(intptr_t)arg, &stat);
+    return stat.nblock;
+}
+static int64_t GetIOBufSiteBlockMemory(void* arg) {
+    butil::IOBuf::BlockSiteStat stat;
+    butil::IOBuf::get_block_site_stat((int)(intptr_t)arg, &stat);
+    return stat.memory;
+}
 
 // Defined in server.cpp
 extern butil::static_atomic<int> g_running_server_count;
@@ -226,6 +249,20 @@ static void* GlobalUpdate(void*) {
         "iobuf_newbigview_second", &var_iobuf_new_bigview_count);
     bvar::PassiveStatus<int64_t> var_iobuf_block_memory(
         "iobuf_block_memory", GetIOBufBlockMemory, NULL);
+    // Break down blocks by allocation site, see /iobuf for the histograms.
+    bvar::PassiveStatus<int64_t>* var_iobuf_site_block_count[
+        butil::IOBuf::BLOCK_SITE_NUM];
+    bvar::PassiveStatus<int64_t>* var_iobuf_site_block_memory[
+        butil::IOBuf::BLOCK_SITE_NUM];
+    for (int i = 0; i < butil::IOBuf::BLOCK_SITE_NUM; ++i) {
+        const char* site_name = butil::IOBuf::block_alloc_site_name(i);
+        var_iobuf_site_block_count[i] = new bvar::PassiveStatus<int64_t>(
+            std::string("iobuf_block_count_") + site_name,
+            GetIOBufSiteBlockCount, (void*)(intptr_t)i);
+        var_iobuf_site_block_memory[i] = new bvar::PassiveStatus<int64_t>(
+            std::string("iobuf_block_memory_") + site_name,
+            GetIOBufSiteBlockMemory, (void*)(intptr_t)i);
+    }
     bvar::PassiveStatus<int> var_running_server_count(
         "rpc_server_count", GetRunningServerCount, NULL);
 
@@ -383,12 +420,14 @@ static void GlobalInitializeOrDieImpl() {
     // Load Balancers
     LoadBalancerExtension()->RegisterOrDie("rr", &g_ext->rr_lb);
     LoadBalancerExtension()->RegisterOrDie("wrr", &g_ext->wrr_lb);
+    LoadBalancerExtension()->RegisterOrDie("swrr", &g_ext->swrr_lb);
     LoadBalancerExtension()->RegisterOrDie("random", &g_ext->randomized_lb);
     LoadBalancerExtension()->RegisterOrDie("wr", &g_ext->wr_lb);
     LoadBalancerExtension()->RegisterOrDie("la", &g_ext->la_lb);
     LoadBalancerExtension()->RegisterOrDie("c_murmurhash", &g_ext->ch_mh_lb);
     LoadBalancerExtension()->RegisterOrDie("c_md5", &g_ext->ch_md5_lb);
     LoadBalancerExtension()->RegisterOrDie("c_ketama", &g_ext->ch_ketama_lb);
+    LoadBalancerExtension()->RegisterOrDie("c_wyhash", &g_ext->ch_wyhash_lb);
     LoadBalancerExtension()->RegisterOrDie("_dynpart", &g_ext->dynpart_lb);
 
     // Compress Handlers
@@ -404,6 +443,24 @@ static void GlobalInitializeOrDieImpl() {
     if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY, snappy_compress) != 0) {
         exit(1);
     }
+    CompressHandler snappy_framed_compress =
+        { SnappyFramedCompress, SnappyFramedDecompress, "snappy-framed" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_SNAPPY_FRAMED,
+                                snappy_framed_compress) != 0) {
+        exit(1);
+    }
+#if BRPC_WITH_ZSTD
+    CompressHandler zstd_compress = { ZstdCompress, ZstdDecompress, "zstd" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_ZSTD, zstd_compress) != 0) {
+        exit(1);
+    }
+#endif
+#if BRPC_WITH_LZ4
+    CompressHandler lz4_compress = { Lz4Compress, Lz4Decompress, "lz4" };
+    if (RegisterCompressHandler(COMPRESS_TYPE_LZ4, lz4_compress) != 0) {
+        exit(1);
+    }
+#endif
 
     // Checksum Handlers
     const ChecksumHandler crc32c_checksum = {Crc32cCompute, Crc32cVerify,
@@ -623,6 +680,7 @@ static void GlobalInitializeOrDieImpl() {
     // Concurrency Limiters
     ConcurrencyLimiterExtension()->RegisterOrDie("auto", &g_ext->auto_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
+    ConcurrencyLimiterExtension()->RegisterOrDie("gradient", &g_ext->gradient_cl);
     ConcurrencyLimiterExtension()->RegisterOrDie("timeout", &g_ext->timeout_cl);
 
     if (FLAGS_usercode_in_pthread) {
@@ -16,6 +16,7 @@
 // under the License.
 
 
+#include <strings.h>                   // strcasecmp
 #include "brpc/http_status_code.h"     // HTTP_STATUS_*
 #include "brpc/http_header.h"
 
@@ -55,7 +56,12 @@ void HttpHeader::Clear() {
 }
 
 const std::string* HttpHeader::GetHeader(const char* key) const {
-    return GetHeader(std::string(key));
+    // Seek with the C string directly(supported by CaseIgnoredHasher/Equal)
+    // instead of constructing a temporary std::string.
+    if (strcasecmp(key, SET_COOKIE) == 0) {
+        return _first_set_cookie;
+    }
+    return _headers.seek(key);
 }
 
 const std::string* HttpHeader::GetHeader(const std::string& key) const {
@@ -136,7 +142,9 @@ std::string& HttpHeader::GetOrAddHeader(const std::string& key) {
 
     std::string* val = _headers.seek(key);
     if (NULL == val) {
-        val = _headers.insert({ key, "" });
+        // The two-argument insert saves the temporary pair and the extra
+        // key copy of insert({key, ""}).
+        val = _headers.insert(key, std::string());
         if (is_set_cookie) {
             _first_set_cookie = val;
         }
@@ -145,7 +153,7 @@ std::string& HttpHeader::GetOrAddHeader(const std::string& key) {
 }
 
 std::string& HttpHeader::AddHeader(const std::string& key) {
-    std::string* val = _headers.insert({ key, "" });
+    std::string* val = _headers.insert(key, std::string());
     if (IsSetCookie(key) && NULL == _first_set_cookie) {
         _first_set_cookie = val;
     }
@@ -65,6 +65,22 @@ DEFINE_int32(socket_keepalive_interval_s, -1,
 DEFINE_int32(socket_keepalive_count, -1,
              "Set number of keepalives before death if this value is positive");
 
+DEFINE_int32(socket_read_linger_rounds, 0,
+             "When reading a socket hits EAGAIN and no new epoll event is "
+             "pending, yield and retry reading up to so many times before "
+             "the input bthread quits. On streaming-heavy sockets where the "
+             "next chunk arrives within a scheduling quantum this saves the "
+             "epoll notification and the bthread creation of the next event. "
+             "0 quits on first EAGAIN as before.");
+BRPC_VALIDATE_GFLAG(socket_read_linger_rounds, NonNegativeInteger);
+
+DEFINE_int32(socket_read_yield_every_n, 0,
+             "If positive, the input bthread of a socket yields to other "
+             "bthreads queued on the worker after every so many successful "
+             "reads, bounding how long one bursty connection may occupy a "
+             "worker. 0 never yields(the behavior before this flag).");
+BRPC_VALIDATE_GFLAG(socket_read_yield_every_n, NonNegativeInteger);
+
 DEFINE_int32(socket_tcp_user_timeout_ms, -1,
              "If this value is positive, set number of milliseconds that transmitted "
              "data may remain unacknowledged, or bufferred data may remain untransmitted "
@@ -77,10 +93,65 @@ DECLARE_bool(usercode_in_coroutine);
 DECLARE_uint64(max_body_size);
 
 const size_t MSG_SIZE_WINDOW = 10;  // Take last so many message into stat.
+const size_t BURST_SIZE_WINDOW = 10;  // Take last so many read bursts into stat.
 const size_t MIN_ONCE_READ = 4096;
-const size_t MAX_ONCE_READ = 524288;
+const size_t MAX_ONCE_READ = 1048576;
 const size_t PROTO_DUMMY_LEN = 4;
 
+// Map well-known leading bytes to the protocol that certainly emits them,
+// so that new connections of common protocols are recognized with one
+// comparison instead of running Parse of every preceding protocol.
+// Returns -1 on unrecognized bytes.
+static int GuessProtocolIndex(const butil::IOBuf& buf) {
+    if (buf.size() < PROTO_DUMMY_LEN) {
+        return -1;
+    }
+    char magic[PROTO_DUMMY_LEN + 1];
+    buf.copy_to_cstr(magic, PROTO_DUMMY_LEN);
+    if (memcmp(magic, "PRPC", PROTO_DUMMY_LEN) == 0) {
+        return PROTOCOL_BAIDU_STD;
+    }
+    if (memcmp(magic, "PRI ", PROTO_DUMMY_LEN) == 0) {
+        // Connection preface of HTTP/2: "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+        return PROTOCOL_H2;
+    }
+    if (memcmp(magic, "GET ", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "POST", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "PUT ", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "HEAD", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "DELE", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "OPTI", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "PATC", PROTO_DUMMY_LEN) == 0 ||
+        memcmp(magic, "HTTP", PROTO_DUMMY_LEN) == 0) {
+        return PROTOCOL_HTTP;
+    }
+    return -1;
+}
+
+void InputMessenger::RecordProbeHit(int index) {
+    if (NULL == _hit_counts) {
+        return;
+    }
+    const uint32_t n = _hit_counts[index].fetch_add(
+        1, butil::memory_order_relaxed) + 1;
+    if (n >= 0x10000) {
+        // Halve all counters so that the ordering follows recent traffic
+        // rather than the whole history. Concurrent hits may be lost
+        // occasionally which is acceptable for a heuristic.
+        const int max_index = _max_index.load(butil::memory_order_acquire);
+        for (int i = 0; i <= max_index; ++i) {
+            const uint32_t c =
+                _hit_counts[i].load(butil::memory_order_relaxed);
+            _hit_counts[i].store(c / 2, butil::memory_order_relaxed);
+        }
+    }
+    const int top = _top_index.load(butil::memory_order_relaxed);
+    if (top != index &&
+        (top < 0 || n > _hit_counts[top].load(butil::memory_order_relaxed))) {
+        _top_index.store(index, butil::memory_order_relaxed);
+    }
+}
+
 ParseResult InputMessenger::CutInputMessage(
         Socket* m, size_t* index, bool read_eof) {
     const int preferred = m->preferred_index();
@@ -148,8 +219,26 @@ ParseResult InputMessenger::CutInputMessage(
         }
         m->set_preferred_index(-1);
     }
-    for (int i = 0; i <= max_index; ++i) {
-        if (i == preferred || _handlers[i].parse == NULL) {
+    // Probe other protocols: first the one whose well-known magic matches
+    // the leading bytes, then the one hit most recently on this messenger,
+    // then the rest in index order.
+    const int guess = GuessProtocolIndex(m->_read_buf);
+    const int top = _top_index.load(butil::memory_order_relaxed);
+    for (int k = -2; k <= max_index; ++k) {
+        int i = k;
+        if (k == -2) {
+            i = guess;
+        } else if (k == -1) {
+            i = top;
+            if (i == guess) {
+                continue;
+            }
+        } else if (i == guess || i == top) {
+            // Already tried in the first two rounds.
+            continue;
+        }
+        if (i < 0 || i > max_index ||
+            i == preferred || _handlers[i].parse == NULL) {
             // Don't try preferred handler(already tried) or invalid handler
             continue;
         }
@@ -158,6 +247,7 @@ ParseResult InputMessenger::CutInputMessage(
             result.error() == PARSE_ERROR_NOT_ENOUGH_DATA) {
             m->set_preferred_index(i);
             *index = i;
+            RecordProbeHit(i);
             return result;
         } else if (result.error() != PARSE_ERROR_TRY_OTHERS) {
             // Critical error, return directly.
@@ -366,21 +456,69 @@ void InputMessenger::OnNewMessages(Socket* m) {
     // OK in most cases.
     InputMessageClosure last_msg;
     bool read_eof = false;
+    int nlinger = 0;        // EAGAIN retries of the current dry streak
+    int nread_rounds = 0;   // successful reads since the last yield
+    size_t burst_bytes = 0; // bytes read since the last EAGAIN
+    size_t once_read = 0;   // bytes asked from the next read
     while (!read_eof) {
+#if defined(OS_LINUX)
+        // In splice mode (see Socket::StartSpliceTo), body bytes are
+        // forwarded kernel-side instead of being parsed; the mode ends by
+        // itself after the arranged number of bytes and the fd returns to
+        // normal parsing below.
+        if (m->splice_remaining() > 0) {
+            const int rc = m->DoSplice(&read_eof);
+            if (rc < 0) {
+                return;
+            }
+            if (read_eof) {
+                break;
+            }
+            if (rc == 0 && !m->MoreReadEvents(&progress)) {
+                return;
+            }
+            continue;
+        }
+#endif
         const int64_t received_us = butil::cpuwide_time_us();
         const int64_t base_realtime = butil::gettimeofday_us() - received_us;
 
-        // Calculate bytes to be read.
-        size_t once_read = m->_avg_msg_size * 16;
-        if (once_read < MIN_ONCE_READ) {
-            once_read = MIN_ONCE_READ;
-        } else if (once_read > MAX_ONCE_READ) {
-            once_read = MAX_ONCE_READ;
+        // Calculate bytes to be read. The first read of a burst is sized
+        // by recent bursts of this socket (falling back to the average
+        // message size on young sockets), so trickle connections stay at
+        // small reads while bulk ones start big right away. Within a burst
+        // the size grows geometrically whenever a read fills the requested
+        // bytes completely, see below.
+        if (burst_bytes == 0) {
+            once_read = std::max((size_t)m->_avg_burst_size,
+                                 (size_t)m->_avg_msg_size * 16);
+            if (once_read < MIN_ONCE_READ) {
+                once_read = MIN_ONCE_READ;
+            } else if (once_read > MAX_ONCE_READ) {
+                once_read = MAX_ONCE_READ;
+            }
         }
 
         // Read.
         const ssize_t nr = m->DoRead(once_read);
         if (nr <= 0) {
+            if (burst_bytes > 0 && (0 == nr || errno == EAGAIN)) {
+                // The burst ended (EOF or drained), fold it into the stat
+                // sizing the first read of the next burst. Bigger bursts
+                // can't be read in one piece anyway.
+                if (burst_bytes > MAX_ONCE_READ) {
+                    burst_bytes = MAX_ONCE_READ;
+                }
+                const size_t old_avg = m->_avg_burst_size;
+                if (old_avg != 0) {
+                    m->_avg_burst_size =
+                        (old_avg * (BURST_SIZE_WINDOW - 1) + burst_bytes)
+                        / BURST_SIZE_WINDOW;
+                } else {
+                    m->_avg_burst_size = burst_bytes;
+                }
+                burst_bytes = 0;
+            }
             if (0 == nr) {
                 // Set `read_eof' flag and proceed to feed EOF into `Protocol'
                 // (implied by m->_read_buf.empty), which may produce a new
@@ -396,17 +534,44 @@ void InputMessenger::OnNewMessages(Socket* m) {
                 m->SetFailed(saved_errno, "Fail to read from %s: %s",
                              m->description().c_str(), berror(saved_errno));
                 return;
+            } else if (nlinger < FLAGS_socket_read_linger_rounds) {
+                // Nothing buffered right now but more may arrive shortly.
+                // Yield and retry before paying the epoll notification and
+                // bthread creation of the next event. NOTE: _nevent is not
+                // consumed yet(MoreReadEvents below), so concurrent
+                // StartInputEvent just piles events instead of starting a
+                // second reader of this socket.
+                ++nlinger;
+                bthread_yield();
+                continue;
             } else if (!m->MoreReadEvents(&progress)) {
+                // Drained for good. Follow the flow to its current RX cpu
+                // before sleeping, see -event_dispatcher_rx_affinity.
+                m->RehomeEventDispatcher();
                 return;
             } else { // new events during processing
                 continue;
             }
         }
+        nlinger = 0;
+        burst_bytes += nr;
+        if ((size_t)nr == once_read && once_read < MAX_ONCE_READ) {
+            // The requested bytes were filled completely, more is likely
+            // buffered: grow to cut syscalls of bulk transfers.
+            once_read = std::min(once_read * 2, MAX_ONCE_READ);
+        }
 
         if (m->_rdma_state == Socket::RDMA_OFF && messenger->ProcessNewMessage(
                     m, nr, read_eof, received_us, base_realtime, last_msg) < 0) {
             return;
-        } 
+        }
+        const int yield_every_n = FLAGS_socket_read_yield_every_n;
+        if (yield_every_n > 0 && ++nread_rounds >= yield_every_n) {
+            // Fairness checkpoint: this socket still has buffered data but
+            // other bthreads queued on the worker deserve a chance to run.
+            nread_rounds = 0;
+            bthread_yield();
+        }
     }
 
     if (read_eof) {
@@ -418,14 +583,21 @@ InputMessenger::InputMessenger(size_t capacity)
     : _handlers(NULL)
     , _max_index(-1)
     , _non_protocol(false)
-    , _capacity(capacity) {
+    , _capacity(capacity)
+    , _hit_counts(new (std::nothrow) butil::atomic<uint32_t>[capacity])
+    , _top_index(-1) {
+    if (_hit_counts != NULL) {
+        memset(_hit_counts, 0, sizeof(*_hit_counts) * capacity);
+    }
 }
 
 InputMessenger::~InputMessenger() {
     delete[] _handlers;
-    _handlers = NULL;        
+    _handlers = NULL;
     _max_index.store(-1, butil::memory_order_relaxed);
     _capacity = 0;
+    delete[] _hit_counts;
+    _hit_counts = NULL;
 }
 
 int InputMessenger::AddHandler(const InputMessageHandler& handler) {
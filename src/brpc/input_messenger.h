@@ -132,6 +132,11 @@ private:
     // from m->read_buf, save index of the scissor into `index'.
     ParseResult CutInputMessage(Socket* m, size_t* index, bool read_eof);
 
+    // Called when handler `index' parsed successfully on a connection
+    // without a preferred protocol. Updates _hit_counts/_top_index so
+    // that frequently hit protocols are probed earlier.
+    void RecordProbeHit(int index);
+
     // Process a new message just received in OnNewMessages
     // Return value >= 0 means success
     int ProcessNewMessage(
@@ -147,6 +152,14 @@ private:
     bool _non_protocol;
     size_t _capacity;
 
+    // Probe hits of each handler on connections without a preferred
+    // protocol, sized _capacity. Only counts this messenger(i.e. per
+    // listen port at server-side).
+    butil::atomic<uint32_t>* _hit_counts;
+    // Index of the handler winning most probes recently, tried before
+    // others when probing. -1 means none yet.
+    butil::atomic<int> _top_index;
+
     butil::Mutex _add_handler_mutex;
 };
 
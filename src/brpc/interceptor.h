@@ -18,6 +18,8 @@
 #ifndef BRPC_INTERCEPTOR_H
 #define BRPC_INTERCEPTOR_H
 
+#include <tuple>
+#include <utility>
 #include "brpc/controller.h"
 
 
@@ -36,6 +38,54 @@ public:
 
 };
 
+// Composes a fixed set of interceptors known at compile time. The whole
+// chain costs the one virtual call into Accept() below; calls into the
+// composed interceptors resolve statically and inline, and the chain
+// short-circuits at the first rejection. The composed types only need a
+// const Accept() with the signature above, deriving from Interceptor is
+// not required.
+// Example:
+//   options.interceptor = new InterceptorChain<CheckQuota, CheckSign>(
+//       CheckQuota(quota_conf), CheckSign());
+//   options.server_owns_interceptor = true;
+template <typename... Is>
+class InterceptorChain : public Interceptor {
+public:
+    InterceptorChain() = default;
+
+    explicit InterceptorChain(Is... interceptors)
+        : _interceptors(std::move(interceptors)...) {}
+
+    bool Accept(const brpc::Controller* controller,
+                int& error_code,
+                std::string& error_txt) const override {
+        return AcceptFrom<0>(controller, error_code, error_txt);
+    }
+
+    // The interceptor at position N, counted from zero.
+    template <size_t N>
+    const typename std::tuple_element<N, std::tuple<Is...> >::type&
+    interceptor_at() const { return std::get<N>(_interceptors); }
+
+private:
+    template <size_t N>
+    typename std::enable_if<N == sizeof...(Is), bool>::type
+    AcceptFrom(const brpc::Controller*, int&, std::string&) const {
+        return true;
+    }
+
+    template <size_t N>
+    typename std::enable_if<(N < sizeof...(Is)), bool>::type
+    AcceptFrom(const brpc::Controller* controller,
+               int& error_code, std::string& error_txt) const {
+        return std::get<N>(_interceptors).Accept(
+                    controller, error_code, error_txt)
+            && AcceptFrom<N + 1>(controller, error_code, error_txt);
+    }
+
+    std::tuple<Is...> _interceptors;
+};
+
 } // namespace brpc
 
 
@@ -87,6 +87,11 @@ bool MemcacheRequest::MergePartialFromCodedStream(
             return false;
         }
         tmp.pop_front(sizeof(*header) + total_body_length);
+        if (header->command == (uint8_t)policy::MC_BINARY_GETKQ) {
+            // Quiet ops inside a MultiGet batch are counted by their
+            // terminating NOOP.
+            --count;
+        }
     }
     _buf.append(saved);
     _pipelined_count += count;
@@ -258,6 +263,65 @@ const char* MemcacheResponse::status_str(Status st) {
 // MUST NOT have extras.
 // MUST have key.
 // MUST NOT have value.
+bool MemcacheRequest::MultiGet(const std::vector<butil::StringPiece>& keys) {
+    if (keys.empty()) {
+        return false;
+    }
+    // Build into a temporary buffer so that a failed append leaves the
+    // request untouched.
+    butil::IOBuf batch;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const butil::StringPiece& key = keys[i];
+        const policy::MemcacheRequestHeader header = {
+            policy::MC_MAGIC_REQUEST,
+            policy::MC_BINARY_GETKQ,
+            butil::HostToNet16(key.size()),
+            0,
+            policy::MC_BINARY_RAW_BYTES,
+            0,
+            butil::HostToNet32(key.size()),
+            0,
+            0
+        };
+        if (batch.append(&header, sizeof(header))) {
+            return false;
+        }
+        if (batch.append(key.data(), key.size())) {
+            return false;
+        }
+    }
+    // The server suppresses replies of quiet GETKQ misses; the NOOP is
+    // always answered and marks the end of the batch.
+    const policy::MemcacheRequestHeader noop_header = {
+        policy::MC_MAGIC_REQUEST,
+        policy::MC_BINARY_NOOP,
+        0,
+        0,
+        policy::MC_BINARY_RAW_BYTES,
+        0,
+        0,
+        0,
+        0
+    };
+    if (batch.append(&noop_header, sizeof(noop_header))) {
+        return false;
+    }
+    _buf.append(butil::IOBuf::Movable(batch));
+    // The whole batch ends with one NOOP response, count it as a single
+    // pipelined operation.
+    ++_pipelined_count;
+    return true;
+}
+
+bool MemcacheRequest::MultiGet(const std::vector<std::string>& keys) {
+    std::vector<butil::StringPiece> pieces;
+    pieces.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        pieces.push_back(keys[i]);
+    }
+    return MultiGet(pieces);
+}
+
 bool MemcacheRequest::GetOrDelete(uint8_t command, const butil::StringPiece& key) {
     const policy::MemcacheRequestHeader header = {
         policy::MC_MAGIC_REQUEST,
@@ -418,6 +482,63 @@ bool MemcacheResponse::PopGet(
     return false;
 }
 
+bool MemcacheResponse::PopMultiGet(
+    std::map<std::string, MultiGetValue>* values) {
+    if (values == NULL) {
+        butil::string_printf(&_err, "Param[values] is NULL");
+        return false;
+    }
+    // Responses of the quiet GETKQ hits stream in until the NOOP that
+    // terminates the batch; consume them one by one.
+    while (true) {
+        policy::MemcacheResponseHeader header;
+        if (_buf.size() < sizeof(header)) {
+            butil::string_printf(&_err, "buffer is too small to contain a header");
+            return false;
+        }
+        _buf.copy_to(&header, sizeof(header));
+        if (_buf.size() < sizeof(header) + header.total_body_length) {
+            butil::string_printf(&_err, "response=%u < header=%u + body=%u",
+                      (unsigned)_buf.size(), (unsigned)sizeof(header),
+                      header.total_body_length);
+            return false;
+        }
+        if (header.command == (uint8_t)policy::MC_BINARY_NOOP) {
+            _buf.pop_front(sizeof(header) + header.total_body_length);
+            _err.clear();
+            return true;
+        }
+        if (header.command != (uint8_t)policy::MC_BINARY_GETKQ) {
+            butil::string_printf(&_err, "not a MULTIGET response");
+            return false;
+        }
+        if (header.status != (uint16_t)STATUS_SUCCESS) {
+            // Quiet gets are not answered on misses, skip other statuses.
+            _buf.pop_front(sizeof(header) + header.total_body_length);
+            continue;
+        }
+        const int value_size = (int)header.total_body_length
+            - (int)header.extras_length - (int)header.key_length;
+        if (header.extras_length != 4u || header.key_length == 0 ||
+            value_size < 0) {
+            butil::string_printf(&_err, "Invalid GETKQ response, "
+                      "extras_length=%u key_length=%u value_size=%d",
+                      header.extras_length, header.key_length, value_size);
+            return false;
+        }
+        _buf.pop_front(sizeof(header));
+        uint32_t raw_flags = 0;
+        _buf.cutn(&raw_flags, sizeof(raw_flags));
+        std::string key;
+        _buf.cutn(&key, header.key_length);
+        MultiGetValue& val = (*values)[key];
+        val.flags = butil::NetToHost32(raw_flags);
+        val.cas_value = header.cas_value;
+        val.value.clear();
+        _buf.cutn(&val.value, value_size);
+    }
+}
+
 // MUST NOT have extras
 // MUST NOT have key
 // MUST NOT have value
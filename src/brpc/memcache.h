@@ -19,7 +19,9 @@
 #ifndef BRPC_MEMCACHE_H
 #define BRPC_MEMCACHE_H
 
+#include <map>
 #include <string>
+#include <vector>
 
 #include "butil/iobuf.h"
 #include "butil/strings/string_piece.h"
@@ -53,6 +55,13 @@ public:
 
     bool Get(const butil::StringPiece& key);
 
+    // Fetch multiple keys in one round trip: packs one quiet GETKQ per
+    // key plus a terminating NOOP, so the server streams back only the
+    // hits followed by the NOOP. Counts as a single pipelined operation,
+    // pop the result with MemcacheResponse::PopMultiGet().
+    bool MultiGet(const std::vector<butil::StringPiece>& keys);
+    bool MultiGet(const std::vector<std::string>& keys);
+
     // If the cas_value(Data Version Check) is non-zero, the requested operation
     // MUST only succeed if the item exists and has a cas_value identical to the
     // provided value.
@@ -175,6 +184,17 @@ public:
    
     bool PopGet(butil::IOBuf* value, uint32_t* flags, uint64_t* cas_value);
     bool PopGet(std::string* value, uint32_t* flags, uint64_t* cas_value);
+
+    struct MultiGetValue {
+        butil::IOBuf value;
+        uint32_t flags;
+        uint64_t cas_value;
+    };
+    // Pop the result of a corresponding MemcacheRequest::MultiGet().
+    // Hits are inserted into `values' keyed by the requested key; keys
+    // absent from `values' were misses. Responses are consumed from the
+    // buffer as they are parsed.
+    bool PopMultiGet(std::map<std::string, MultiGetValue>* values);
     bool PopSet(uint64_t* cas_value);
     bool PopAdd(uint64_t* cas_value);
     bool PopReplace(uint64_t* cas_value);
@@ -0,0 +1,179 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "butil/logging.h"
+#include "brpc/mongo_head.h"
+#include "brpc/mongo_msg.h"
+
+namespace brpc {
+
+// All lengths in the mongo wire protocol are little-endian.
+static bool ReadLE32(const butil::IOBuf& buf, size_t pos, uint32_t* out) {
+    uint8_t b[4];
+    if (buf.copy_to(b, sizeof(b), pos) != sizeof(b)) {
+        return false;
+    }
+    *out = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+        ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+static void AppendLE32(butil::IOBuf* buf, uint32_t val) {
+    const uint8_t b[4] = { (uint8_t)val, (uint8_t)(val >> 8),
+                           (uint8_t)(val >> 16), (uint8_t)(val >> 24) };
+    buf->append(b, sizeof(b));
+}
+
+static void AppendLE64(butil::IOBuf* buf, uint64_t val) {
+    AppendLE32(buf, (uint32_t)val);
+    AppendLE32(buf, (uint32_t)(val >> 32));
+}
+
+// Cut the length-prefixed BSON document at the front of `rest' into `doc'
+// by reference, leaving at least `reserved' trailing bytes in `rest'.
+static bool CutBsonSlice(butil::IOBuf* rest, size_t reserved,
+                         butil::IOBuf* doc) {
+    uint32_t doc_len = 0;
+    if (!ReadLE32(*rest, 0, &doc_len)) {
+        return false;
+    }
+    // A BSON document is at least its length plus the terminating zero.
+    if (doc_len < 5 || (size_t)doc_len + reserved > rest->size()) {
+        return false;
+    }
+    doc->clear();
+    rest->cutn(doc, doc_len);
+    return true;
+}
+
+int ParseMongoMsgView(const butil::IOBuf& body, MongoMsgView* view) {
+    butil::IOBuf rest = body;  // shares blocks, copies nothing
+    uint32_t flag_bits = 0;
+    if (!ReadLE32(rest, 0, &flag_bits)) {
+        return -1;
+    }
+    rest.pop_front(4);
+    view->flag_bits = flag_bits;
+    view->sections.clear();
+    // Bit 0 announces a trailing CRC-32C which is skipped, not verified.
+    const size_t tail = (flag_bits & 0x1) ? 4 : 0;
+    if (rest.size() < tail) {
+        return -1;
+    }
+    while (rest.size() > tail) {
+        char kind = 0;
+        rest.cut1(&kind);
+        view->sections.push_back(MongoMsgSection());
+        MongoMsgSection& section = view->sections.back();
+        section.kind = kind;
+        if (kind == 0) {
+            butil::IOBuf doc;
+            if (!CutBsonSlice(&rest, tail, &doc)) {
+                return -1;
+            }
+            section.documents.push_back(butil::IOBuf());
+            section.documents.back().swap(doc);
+        } else if (kind == 1) {
+            uint32_t sec_size = 0;
+            if (!ReadLE32(rest, 0, &sec_size)) {
+                return -1;
+            }
+            // Size includes its own 4 bytes and a non-empty identifier.
+            if (sec_size < 6 || (size_t)sec_size + tail > rest.size()) {
+                return -1;
+            }
+            butil::IOBuf sec;
+            rest.cutn(&sec, sec_size);
+            sec.pop_front(4);
+            // The cstring identifier ("documents", "updates", ...) is short.
+            std::string id_probe;
+            sec.copy_to(&id_probe, std::min(sec.size(), (size_t)256));
+            const size_t id_len = id_probe.find('\0');
+            if (id_len == std::string::npos) {
+                return -1;
+            }
+            section.identifier = id_probe.substr(0, id_len);
+            sec.pop_front(id_len + 1);
+            while (!sec.empty()) {
+                butil::IOBuf doc;
+                if (!CutBsonSlice(&sec, 0, &doc)) {
+                    return -1;
+                }
+                section.documents.push_back(butil::IOBuf());
+                section.documents.back().swap(doc);
+            }
+        } else {
+            // Unknown section kinds can't be skipped: their length is not
+            // self-describing.
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool ValidateBsonDocument(const butil::IOBuf& doc) {
+    uint32_t doc_len = 0;
+    if (!ReadLE32(doc, 0, &doc_len)) {
+        return false;
+    }
+    if (doc_len != doc.size() || doc_len < 5) {
+        return false;
+    }
+    char last = 0;
+    doc.copy_to(&last, 1, doc.size() - 1);
+    return last == 0;
+}
+
+MongoReplyBuilder::MongoReplyBuilder(int32_t request_id, int32_t response_to)
+    : _request_id(request_id)
+    , _response_to(response_to)
+    , _response_flags(0)
+    , _cursor_id(0)
+    , _starting_from(0)
+    , _number_returned(0) {
+}
+
+int MongoReplyBuilder::AddDocument(const butil::IOBuf& doc) {
+    if (!ValidateBsonDocument(doc)) {
+        return -1;
+    }
+    _documents.append(doc);  // referenced, not copied
+    ++_number_returned;
+    return 0;
+}
+
+int MongoReplyBuilder::SerializeTo(butil::IOBuf* out) const {
+    // head(16) + responseFlags(4) + cursorID(8) + startingFrom(4) +
+    // numberReturned(4) + documents
+    const size_t total = 36 + _documents.size();
+    if (total > 0x7FFFFFFFul) {
+        LOG(ERROR) << "Reply batch is too large, size=" << _documents.size();
+        return -1;
+    }
+    AppendLE32(out, total);
+    AppendLE32(out, _request_id);
+    AppendLE32(out, _response_to);
+    AppendLE32(out, MONGO_OPCODE_REPLY);
+    AppendLE32(out, _response_flags);
+    AppendLE64(out, _cursor_id);
+    AppendLE32(out, _starting_from);
+    AppendLE32(out, _number_returned);
+    out->append(_documents);  // referenced, not copied
+    return 0;
+}
+
+} // namespace brpc
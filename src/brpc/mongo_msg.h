@@ -0,0 +1,104 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_MONGO_MSG_H
+#define BRPC_MONGO_MSG_H
+
+#include <string>
+#include <vector>
+#include "butil/iobuf.h"
+
+// Zero-copy access to OP_MSG(opcode 2013) bodies and building of replies.
+// The body of an OP_MSG request reaches the service untouched in
+// Controller.request_attachment() (see ProcessMongoRequest); the helpers
+// below slice it into BSON documents that keep referencing the received
+// blocks, so pass-through documents are never flattened or copied.
+
+namespace brpc {
+
+struct MongoMsgSection {
+    MongoMsgSection() : kind(0) {}
+
+    // 0: a single body document; 1: a document sequence.
+    uint8_t kind;
+    // Only meaningful for kind 1.
+    std::string identifier;
+    // BSON documents as slices of the parsed body. Only the structural
+    // lengths were checked, validate a document with ValidateBsonDocument
+    // when (and if) its content is actually consumed.
+    std::vector<butil::IOBuf> documents;
+};
+
+struct MongoMsgView {
+    MongoMsgView() : flag_bits(0) {}
+
+    uint32_t flag_bits;
+    std::vector<MongoMsgSection> sections;
+};
+
+// Slice the OP_MSG `body' (the bytes after the 16-byte mongo head) into
+// `view' without copying document bytes. A trailing checksum announced by
+// flag bit 0 is skipped, not verified.
+// Returns 0 on success, -1 when the body is structurally broken.
+int ParseMongoMsgView(const butil::IOBuf& body, MongoMsgView* view);
+
+// Cheap structural check of one BSON document slice: the embedded length
+// matches the slice and the document is terminated by a zero byte. Does
+// not walk the elements.
+bool ValidateBsonDocument(const butil::IOBuf& doc);
+
+// Build an OP_REPLY carrying a batch of documents for a cursor, appending
+// each document into the reply by reference.
+// Usage inside a mongo service method:
+//   MongoReplyBuilder builder(request_id, response_to);
+//   builder.set_cursor_id(cursor_id);
+//   for (...) { builder.AddDocument(doc); }
+//   builder.SerializeTo(&cntl->response_attachment());
+// SendMongoResponse writes a non-empty response_attachment as-is.
+class MongoReplyBuilder {
+public:
+    MongoReplyBuilder(int32_t request_id, int32_t response_to);
+
+    void set_response_flags(int32_t flags) { _response_flags = flags; }
+    void set_cursor_id(int64_t cursor_id) { _cursor_id = cursor_id; }
+    void set_starting_from(int32_t starting_from)
+    { _starting_from = starting_from; }
+
+    // Append one BSON document to the batch by referencing its blocks.
+    // Returns 0 on success, -1 when `doc' is not a valid document slice.
+    int AddDocument(const butil::IOBuf& doc);
+
+    int32_t number_returned() const { return _number_returned; }
+
+    // Append the complete wire message (head included) to `out'. The
+    // documents keep referencing their original blocks.
+    // Returns 0 on success, -1 otherwise.
+    int SerializeTo(butil::IOBuf* out) const;
+
+private:
+    int32_t _request_id;
+    int32_t _response_to;
+    int32_t _response_flags;
+    int64_t _cursor_id;
+    int32_t _starting_from;
+    int32_t _number_returned;
+    butil::IOBuf _documents;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_MONGO_MSG_H
@@ -36,8 +36,17 @@ namespace brpc {
 class NamingServiceActions {
 public:
     virtual ~NamingServiceActions() {}
+
+    // Incrementally add/remove `servers'. Cost is proportional to the
+    // number of changed servers rather than the full list, preferred by
+    // naming services that watch deltas in event-driven manner. Servers
+    // already present(for Add) or absent(for Remove) are ignored.
     virtual void AddServers(const std::vector<ServerNode>& servers) = 0;
     virtual void RemoveServers(const std::vector<ServerNode>& servers) = 0;
+
+    // Replace the full list of servers with `servers', diffing against
+    // the previous list internally. Suitable for polling-style naming
+    // services that always see complete snapshots.
     virtual void ResetServers(const std::vector<ServerNode>& servers) = 0;
 };
 
@@ -19,9 +19,12 @@
 #include "bthread/bthread.h"                  // bthread_id_xx
 #include "bthread/unstable.h"                 // bthread_timer_add
 #include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"
 #include "butil/time.h"
 #include "butil/macros.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/timeout_coalescer.h"     // CoalesceTimeout
+#include "brpc/policy/baidu_rpc_protocol.h"   // SerializeRpcRequest
 #include "brpc/parallel_channel.h"
 
 namespace brpc {
@@ -40,10 +43,13 @@ static __thread Memory tls_cached_pchan_mem = { 0, NULL };
 class ParallelChannelDone : public google::protobuf::Closure {
 private:
     ParallelChannelDone(int fail_limit, int success_limit,
+                        bool incremental_merge,
                         int ndone, int nchan, int memsize,
                         Controller* cntl, google::protobuf::Closure* user_done)
         : _fail_limit(fail_limit)
         , _success_limit(success_limit)
+        , _incremental_merge(incremental_merge)
+        , _fail_all_index(-1)
         , _ndone(ndone)
         , _nchan(nchan)
         , _memsize(memsize)
@@ -84,7 +90,7 @@ public:
     };
     
     static ParallelChannelDone* Create(
-        int fail_limit, int success_limit,
+        int fail_limit, int success_limit, bool incremental_merge,
         int ndone, const SubCall* aps, int nchan,
         Controller* cntl, google::protobuf::Closure* user_done) {
         // We need to create the object in this way because _sub_done is
@@ -127,7 +133,8 @@ public:
         }
 #endif
         auto d = new (mem) ParallelChannelDone(
-            fail_limit, success_limit, ndone, nchan, memsize, cntl, user_done);
+            fail_limit, success_limit, incremental_merge,
+            ndone, nchan, memsize, cntl, user_done);
 
         // Apply client settings of _cntl to controllers of sub calls, except
         // timeout. If we let sub channel do their timeout separately, when
@@ -219,12 +226,18 @@ public:
             int error_code = fin->cntl.ErrorCode();
             // EPCHANFINISH is not an error of sub calls.
             bool fail = 0 != error_code && EPCHANFINISH != error_code;
+            if (!fail && 0 == error_code && _incremental_merge) {
+                // Merge the sub response at arrival so that OnComplete()
+                // does not need a merging pass over all responses. A
+                // failed merge is counted as one sub failure.
+                fail = !MergeSubResponse(fin);
+            }
             bool cancel =
                 // Count failed sub calls, if `fail_limit' is reached, cancel others.
                 (fail && _current_fail.fetch_add(1, butil::memory_order_relaxed) + 1
                          == _fail_limit) ||
                 // Count successful sub calls, if `success_limit' is reached, cancel others.
-                (0 == error_code &&
+                (!fail && 0 == error_code &&
                  _current_success.fetch_add(1, butil::memory_order_relaxed) + 1
                  == _success_limit);
 
@@ -316,7 +329,18 @@ public:
         // to be failed since the RPC is still considered to be successful if
         // nfailed is less than fail_limit
         int nfailed = _current_fail.load(butil::memory_order_relaxed);
-        if (nfailed < _fail_limit) {
+        if (_incremental_merge) {
+            // Sub responses were already merged when they arrived and merge
+            // failures were counted into nfailed in OnSubDoneRun().
+            const int fail_all_index =
+                _fail_all_index.load(butil::memory_order_relaxed);
+            if (fail_all_index >= 0) {
+                nfailed = _ndone;
+                _cntl->SetFailed(ERESPONSE,
+                                 "Fail to merge response of channel[%d]",
+                                 fail_all_index);
+            }
+        } else if (nfailed < _fail_limit) {
             for (int i = 0; i < _ndone; ++i) {
                 SubDone* sd = sub_done(i);
                 google::protobuf::Message* sub_res = sd->cntl._response;
@@ -399,6 +423,41 @@ public:
         CHECK_EQ(0, bthread_id_unlock_and_destroy(saved_cid));
     }
 
+    // Merge the response of `sd' into the response of _cntl. Only called
+    // when `incremental_merge' is on. Merges of different sub responses may
+    // happen in different threads and are serialized by _merge_mutex.
+    // Returns false when the merge fails, which is counted as one sub
+    // failure by the caller.
+    bool MergeSubResponse(SubDone* sd) {
+        google::protobuf::Message* sub_res = sd->cntl._response;
+        BAIDU_SCOPED_LOCK(_merge_mutex);
+        if (sd->merger == NULL) {
+            try {
+                _cntl->_response->MergeFrom(*sub_res);
+            } catch (const std::exception& e) {
+                LOG(ERROR) << "Fail to merge response of channel["
+                           << (int)(sd - _sub_done) << "]: " << e.what();
+                _fail_all_index.store((int)(sd - _sub_done),
+                                      butil::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+        const ResponseMerger::Result res =
+            sd->merger->Merge(_cntl->_response, sub_res);
+        switch (res) {
+        case ResponseMerger::MERGED:
+            return true;
+        case ResponseMerger::FAIL:
+            return false;
+        case ResponseMerger::FAIL_ALL:
+            _fail_all_index.store((int)(sd - _sub_done),
+                                  butil::memory_order_relaxed);
+            return false;
+        }
+        return false;
+    }
+
     int sub_done_size() const { return _ndone; }
     SubDone* sub_done(int i) { return &_sub_done[i]; }
     const SubDone* sub_done(int i) const { return &_sub_done[i]; }
@@ -431,6 +490,11 @@ public:
 private:
     int _fail_limit;
     int _success_limit;
+    bool _incremental_merge;
+    // Index of the sub call whose merge returned FAIL_ALL(or threw), -1
+    // when none. Only used when _incremental_merge is on.
+    butil::atomic<int> _fail_all_index;
+    butil::Mutex _merge_mutex;
     int _ndone;
     int _nchan;
 #if defined(__clang__)
@@ -679,7 +743,8 @@ void ParallelChannel::CallMethod(
     }
 
     d = ParallelChannelDone::Create(
-        fail_limit, success_limit, ndone, aps, nchan, cntl, done);
+        fail_limit, success_limit, _options.incremental_merge,
+        ndone, aps, nchan, cntl, done);
     if (NULL == d) {
         cntl->SetFailed(ENOMEM, "Fail to new ParallelChannelDone");
         goto FAIL;
@@ -703,14 +768,17 @@ void ParallelChannel::CallMethod(
     }
     if (cntl->timeout_ms() >= 0) {
         cntl->_deadline_us = cntl->timeout_ms() * 1000L + cntl->_begin_time_us;
-        // Setup timer for RPC timetout
-        const int rc = bthread_timer_add(
-            &cntl->_timeout_id,
-            butil::microseconds_to_timespec(cntl->_deadline_us),
-            HandleTimeout, (void*)cid.value);
-        if (rc != 0) {
-            cntl->SetFailed(rc, "Fail to add timer");
-            goto FAIL;
+        // Setup timer for RPC timetout. Quantized deadlines may share one
+        // timer, see details/timeout_coalescer.h.
+        if (!CoalesceTimeout(cntl->_deadline_us, cid)) {
+            const int rc = bthread_timer_add(
+                &cntl->_timeout_id,
+                butil::microseconds_to_timespec(cntl->_deadline_us),
+                HandleTimeout, (void*)cid.value);
+            if (rc != 0) {
+                cntl->SetFailed(rc, "Fail to add timer");
+                goto FAIL;
+            }
         }
     } else {
         cntl->_deadline_us = -1;
@@ -718,12 +786,42 @@ void ParallelChannel::CallMethod(
     d->SaveThreadInfoOfCallsite();
     CHECK_EQ(0, bthread_id_unlock(cid));
     // Don't touch `cntl' and `d' again (for async RPC)
-    
+
+    {
+    // Scoped so that the gotos above do not jump over the initializations.
+    butil::IOBuf shared_request_buf;
+    Protocol::SerializeRequest shared_serializer = NULL;
     for (int i = 0, j = 0; i < nchan; ++i) {
         if (!aps[i].is_skip()) {
             ParallelChannelDone::SubDone* sd = d->sub_done(j++);
             // Forward the attachment to each sub call
             sd->cntl.request_attachment().append(cntl->request_attachment());
+            // Sub calls sending the original request unchanged through an
+            // ordinary Channel serialize it just once: the first such sub
+            // call serializes into `shared_request_buf' and the others get
+            // an IOBuf copy which references the same blocks instead of
+            // duplicating the payload. Restricted to serializers known to
+            // depend on nothing but the request(the sub controllers are
+            // all fresh at this point, so they would serialize equally).
+            if (sd->ap.request == request) {
+                Channel* ordinary_chan = dynamic_cast<Channel*>(_chans[i].chan);
+                const Protocol::SerializeRequest serializer = ordinary_chan
+                    ? ordinary_chan->_serialize_request : NULL;
+                if (serializer != NULL &&
+                    (serializer == policy::SerializeRpcRequest ||
+                     serializer == SerializeRequestDefault)) {
+                    if (shared_serializer == NULL) {
+                        serializer(&shared_request_buf, &sd->cntl, request);
+                        if (!sd->cntl.FailedInline()) {
+                            shared_serializer = serializer;
+                        }
+                    }
+                    if (serializer == shared_serializer) {
+                        sd->cntl._request_buf = shared_request_buf;
+                        sd->cntl.add_flag(Controller::FLAGS_PRESERIALIZED_REQUEST);
+                    }
+                }
+            }
             _chans[i].chan->CallMethod(sd->ap.method, &sd->cntl,
                                        sd->ap.request, sd->ap.response, sd);
         }
@@ -732,6 +830,7 @@ void ParallelChannel::CallMethod(
         // Destroy()-ed) because we may need to check requests for debugging
         // purposes.
     }
+    }
     if (done == NULL) {
         Join(cid);
         cntl->OnRPCEnd(butil::gettimeofday_us());
@@ -172,6 +172,16 @@ struct ParallelChannelOptions {
     // does not return unless all sub RPC succeed.
     // Note: `success_limit' is only valid when `fail_limit' is not set.
     int success_limit{ -1};
+
+    // Call ResponseMerger (or Message::MergeFrom when the merger is NULL)
+    // on each successful sub response as soon as it arrives, instead of
+    // merging all responses after the last sub call finishes. Merging may
+    // happen in the threads where sub responses arrive and is serialized
+    // by an internal mutex. Combined with `success_limit', the RPC ends at
+    // the latency of the k-th fastest sub call without an extra merging
+    // pass over all responses at the end.
+    // Default: false
+    bool incremental_merge{false};
 };
 
 // ParallelChannel(aka "pchan") accesses all sub channels simultaneously with
@@ -24,17 +24,23 @@
 #include "butil/logging.h"                       // LOG()
 #include "butil/iobuf.h"                         // butil::IOBuf
 #include "butil/raw_pack.h"                      // RawPacker RawUnpacker
+#include "butil/object_pool.h"                   // get_object
 #include "butil/memory/scope_guard.h"
 #include "json2pb/json_to_pb.h"
 #include "json2pb/pb_to_json.h"
 #include "brpc/controller.h"                    // Controller
+#include "brpc/reloadable_flags.h"              // BRPC_VALIDATE_GFLAG
 #include "brpc/socket.h"                        // Socket
 #include "brpc/server.h"                        // Server
 #include "brpc/span.h"
 #include "brpc/compress.h"                      // ParseFromCompressedData
 #include "brpc/checksum.h"
+#include "brpc/policy/crc32c_checksum.h"
 #include "brpc/stream_impl.h"
 #include "brpc/rpc_dump.h"                      // SampledRequest
+#include "brpc/attachment_buffer_pool.h"        // AttachmentBufferPool
+#include "brpc/response_cache.h"                // ResponseCache
+#include "brpc/rpc_deadline.h"
 #include "brpc/rpc_pb_message_factory.h"
 #include "brpc/policy/baidu_rpc_meta.pb.h"      // RpcRequestMeta
 #include "brpc/policy/baidu_rpc_protocol.h"
@@ -50,6 +56,9 @@ void bthread_assign_data(void* data);
 
 
 namespace brpc {
+
+DECLARE_bool(server_reject_expired_requests);
+
 namespace policy {
 
 DEFINE_bool(baidu_protocol_use_fullname, true,
@@ -59,6 +68,15 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
 DEFINE_bool(baidu_std_protocol_deliver_timeout_ms, false,
             "If this flag is true, baidu_std puts timeout_ms in requests.");
 
+DEFINE_int64(baidu_std_progressive_attachment_threshold, -1,
+             "If non-negative and the attachment of an uncompressed baidu_std"
+             " request is at least so many bytes, run the method once meta and"
+             " the request message are buffered and stream the attachment to"
+             " the handler through Controller::ReadProgressiveAttachmentBy()"
+             " instead of buffering the whole body first, -1 disables this");
+BRPC_VALIDATE_GFLAG(baidu_std_progressive_attachment_threshold,
+                    PassValidate);
+
 DECLARE_bool(pb_enum_as_number);
 
 // Notes:
@@ -77,17 +95,48 @@ inline void PackRpcHeader(char* rpc_header, uint32_t meta_size, int payload_size
         .pack32(meta_size);
 }
 
-static void SerializeRpcHeaderAndMeta(
-    butil::IOBuf* out, const RpcMeta& meta, int payload_size) {
+// Payloads not longer than this are copied into the same stack block as
+// header+meta and appended to the socket buffer in one shot, putting the
+// whole request into one contiguous IOBuf block (single iovec in writev)
+// instead of referencing the serialized payload as separate blocks.
+static const size_t MAX_INLINED_PAYLOAD_SIZE = 512;
+
+// Serialize header+meta(+small payload+attachment) of the request/response
+// into `out'. `inlined_payload' and `inlined_attachment' (when not NULL and
+// short enough in total) are copied right after meta so that the caller does
+// not need to append them separately. Returns true iff they were inlined,
+// i.e. the caller has nothing left to append.
+static bool SerializeRpcHeaderAndMeta(
+    butil::IOBuf* out, const RpcMeta& meta, int payload_size,
+    const butil::IOBuf* inlined_payload = NULL,
+    const butil::IOBuf* inlined_attachment = NULL) {
     const uint32_t meta_size = GetProtobufByteSize(meta);
     if (meta_size <= 244) { // most common cases
-        char header_and_meta[12 + meta_size];
+        size_t inlined_size = 0;
+        if (inlined_payload != NULL) {
+            const size_t total = inlined_payload->size() +
+                (inlined_attachment ? inlined_attachment->size() : 0);
+            if (total > 0 && total <= MAX_INLINED_PAYLOAD_SIZE) {
+                inlined_size = total;
+            }
+        }
+        char header_and_meta[12 + meta_size + inlined_size];
         PackRpcHeader(header_and_meta, meta_size, payload_size);
         ::google::protobuf::io::ArrayOutputStream arr_out(header_and_meta + 12, meta_size);
         ::google::protobuf::io::CodedOutputStream coded_out(&arr_out);
         meta.SerializeWithCachedSizes(&coded_out); // not calling ByteSize again
         CHECK(!coded_out.HadError());
+        if (inlined_size) {
+            inlined_payload->copy_to(header_and_meta + 12 + meta_size,
+                                     inlined_payload->size());
+            if (inlined_attachment) {
+                inlined_attachment->copy_to(
+                    header_and_meta + 12 + meta_size + inlined_payload->size(),
+                    inlined_attachment->size());
+            }
+        }
         CHECK_EQ(0, out->append(header_and_meta, sizeof(header_and_meta)));
+        return inlined_size > 0;
     } else {
         char header[12];
         PackRpcHeader(header, meta_size, payload_size);
@@ -97,10 +146,129 @@ static void SerializeRpcHeaderAndMeta(
         meta.SerializeWithCachedSizes(&coded_out);
         CHECK(!coded_out.HadError());
     }
+    return false;
 }
 
+// The attachment of an oversized request being streamed to the handler
+// while the socket is still receiving it, engaged by ParseRpcMessage when
+// -baidu_std_progressive_attachment_threshold is hit. Referenced by the
+// socket's parsing-context slot until the last byte of the attachment
+// arrives and by the Controller until the handler is done with it.
+class BaiduProgressiveAttachment : public ReadableProgressiveAttachment,
+                                   public Destroyable {
+public:
+    explicit BaiduProgressiveAttachment(size_t attachment_size)
+        : _reader(NULL), _remaining(attachment_size), _ended(false) {}
+
+    // @Destroyable, called iff the socket dies with the attachment cut off.
+    void Destroy() override {
+        OnEndOfAttachment(butil::Status(
+            ECONNRESET, "The socket was broken before the whole "
+            "attachment arrived"));
+        RemoveRefManually();
+    }
+
+    // @ReadableProgressiveAttachment
+    void ReadProgressiveAttachmentBy(ProgressiveReader* r) override {
+        CHECK(r != NULL);
+        BAIDU_SCOPED_LOCK(_mutex);
+        CHECK(_reader == NULL) << "reader was already set";
+        while (!_buffered.empty()) {
+            const butil::StringPiece blk = _buffered.backing_block(0);
+            butil::Status st = r->OnReadOnePart(blk.data(), blk.size());
+            if (!st.ok()) {
+                _ended = true;
+                _end_status = st;
+                r->OnEndOfMessage(st);
+                return;
+            }
+            _buffered.pop_front(blk.size());
+        }
+        if (_ended) {
+            r->OnEndOfMessage(_end_status);
+            return;
+        }
+        _reader = r;
+    }
+
+    // Called by ParseRpcMessage with newly-arrived attachment bytes which
+    // are consumed from `part'. Returns false iff the reader failed
+    // permanently and the socket should be closed.
+    bool FeedPart(butil::IOBuf& part) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_ended) { // the reader failed in ReadProgressiveAttachmentBy
+            return false;
+        }
+        _remaining -= part.size();
+        if (_reader == NULL) {
+            _buffered.append(butil::IOBuf::Movable(part));
+            return true;
+        }
+        while (!part.empty()) {
+            const butil::StringPiece blk = part.backing_block(0);
+            butil::Status st = _reader->OnReadOnePart(blk.data(), blk.size());
+            if (!st.ok()) {
+                _ended = true;
+                _end_status = st;
+                _reader->OnEndOfMessage(st);
+                _reader = NULL;
+                return false;
+            }
+            part.pop_front(blk.size());
+        }
+        return true;
+    }
+
+    void OnEndOfAttachment(const butil::Status& st) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_ended) {
+            return;
+        }
+        _ended = true;
+        _end_status = st;
+        if (_reader != NULL) {
+            _reader->OnEndOfMessage(st);
+            _reader = NULL;
+        }
+    }
+
+    size_t remaining() const { return _remaining; }
+
+private:
+    butil::Mutex _mutex;
+    ProgressiveReader* _reader;
+    butil::IOBuf _buffered; // parts arrived before the reader was set
+    size_t _remaining;      // attachment bytes not received yet
+    bool _ended;
+    butil::Status _end_status;
+};
+
 ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
-                            bool /*read_eof*/, const void*) {
+                            bool /*read_eof*/, const void* arg) {
+    BaiduProgressiveAttachment* pa =
+        static_cast<BaiduProgressiveAttachment*>(socket->parsing_context());
+    if (pa != NULL) {
+        // Stage2 of an oversized request: the next remaining() bytes on the
+        // wire belong to the attachment being streamed to the handler.
+        const size_t len = std::min(source->length(), pa->remaining());
+        if (len > 0) {
+            butil::IOBuf part;
+            source->cutn(&part, len);
+            if (!pa->FeedPart(part)) {
+                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG,
+                                      "The attachment reader failed");
+            }
+        }
+        if (pa->remaining() == 0) {
+            // Resume normal parsing from the next message on. If the socket
+            // dies before this point, Destroy() ends the reader instead.
+            CHECK_EQ((Destroyable*)pa, socket->release_parsing_context());
+            pa->OnEndOfAttachment(butil::Status::OK());
+            pa->RemoveRefManually();
+            return MakeMessage(NULL);
+        }
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
     char header_buf[12];
     const size_t n = source->copy_to(header_buf, sizeof(header_buf));
     if (n >= 4) {
@@ -125,7 +293,59 @@ ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
         LOG(ERROR) << "body_size=" << body_size << " from "
                    << socket->remote_side() << " is too large";
         return MakeParseError(PARSE_ERROR_TOO_BIG_DATA);
-    } else if (source->length() < sizeof(header_buf) + body_size) {
+    }
+    const int64_t progressive_threshold =
+        FLAGS_baidu_std_progressive_attachment_threshold;
+    if (arg != NULL/*server-side*/ && progressive_threshold >= 0 &&
+        meta_size <= body_size &&
+        (int64_t)(body_size - meta_size) >= progressive_threshold &&
+        source->length() >= sizeof(header_buf) + meta_size) {
+        // The payload is large enough to possibly contain an oversized
+        // attachment. Meta is buffered, peek into it: parsing meta twice
+        // (again in ProcessRpcRequest) is noise compared to the payload.
+        butil::IOBuf meta_buf;
+        source->append_to(&meta_buf, meta_size, sizeof(header_buf));
+        RpcMeta meta;
+        if (ParsePbFromIOBuf(&meta, meta_buf) &&
+            meta.has_request() &&
+            !meta.has_stream_settings() &&
+            meta.compress_type() == COMPRESS_TYPE_NONE &&
+            meta.checksum_type() == 0 &&
+            meta.attachment_size() >= progressive_threshold &&
+            meta.attachment_size() <= (int64_t)(body_size - meta_size)) {
+            const size_t pb_size =
+                body_size - meta_size - meta.attachment_size();
+            if (source->length() < sizeof(header_buf) + meta_size + pb_size) {
+                return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+            }
+            // Meta and the request message are buffered, hand the request
+            // to ProcessRpcRequest now and stream the attachment through
+            // the parsing-context slot as the rest of it arrives.
+            source->pop_front(sizeof(header_buf));
+            MostCommonMessage* msg = MostCommonMessage::Get();
+            source->cutn(&msg->meta, meta_size);
+            source->cutn(&msg->payload, pb_size);
+            BaiduProgressiveAttachment* new_pa =
+                new BaiduProgressiveAttachment(meta.attachment_size());
+            msg->rpa.reset(new_pa);
+            const size_t len = std::min(source->length(), new_pa->remaining());
+            if (len > 0) {
+                butil::IOBuf part;
+                source->cutn(&part, len);
+                new_pa->FeedPart(part); // no reader yet, never fails
+            }
+            if (new_pa->remaining() == 0) {
+                new_pa->OnEndOfAttachment(butil::Status::OK());
+            } else {
+                new_pa->AddRefManually(); // for the parsing-context slot
+                socket->reset_parsing_context(new_pa);
+            }
+            return MakeMessage(msg);
+        }
+        // Not eligible (unparsable meta, response, compressed or checksumed
+        // payload, small attachment): buffer the whole body as usual.
+    }
+    if (source->length() < sizeof(header_buf) + body_size) {
         return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
     }
     if (meta_size > body_size) {
@@ -149,6 +369,16 @@ bool SerializeRpcMessage(const google::protobuf::Message& message,
     auto serialize = [&](Serializer& serializer) -> bool {
         bool ok;
         if (COMPRESS_TYPE_NONE == compress_type) {
+            if (CHECKSUM_TYPE_CRC32C == checksum_type) {
+                // Fused path: the CRC is accumulated while serialization
+                // fills blocks, saving a second pass over the payload.
+                butil::IOBufAsZeroCopyOutputStreamWithChecksum stream(buf);
+                ok = serializer.SerializeTo(&stream);
+                if (ok) {
+                    Crc32cSetValue(&cntl, stream.checksum());
+                }
+                return ok;
+            }
             butil::IOBufAsZeroCopyOutputStream stream(buf);
             ok = serializer.SerializeTo(&stream);
         } else {
@@ -267,9 +497,13 @@ struct BaiduProxyPBMessages : public RpcPBMessages {
 }
 
 // Used by UT, can't be static.
+// `cache_fill' (when not NULL) asks for the serialized response to be put
+// into the ResponseCache of the method, see Server::RegisterResponseCache.
 void SendRpcResponse(int64_t correlation_id, Controller* cntl,
                      RpcPBMessages* messages, const Server* server,
-                     MethodStatus* method_status, int64_t received_us) {
+                     MethodStatus* method_status, int64_t received_us,
+                     ResponseCacheFill* cache_fill) {
+    std::unique_ptr<ResponseCacheFill> cache_fill_guard(cache_fill);
     ControllerPrivateAccessor accessor(cntl);
     Span* span = accessor.span();
     if (span) {
@@ -327,6 +561,20 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
         attached_size = cntl->response_attachment().length();
     }
 
+    if (cache_fill != NULL && append_body && cntl->ErrorCode() == 0 &&
+        response_stream_ids.empty() && !cntl->has_remote_stream()) {
+        // Capture the response before res_body/attachment are moved into
+        // the output buffer below. The IOBufs only reference the blocks.
+        CachedResponse cached;
+        cached.serialized_response = res_body;
+        cached.attachment = cntl->response_attachment();
+        cached.compress_type = cntl->response_compress_type();
+        cached.content_type = cntl->response_content_type();
+        cached.checksum_type = cntl->response_checksum_type();
+        cached.checksum_value = accessor.checksum_value();
+        cache_fill->cache->Put(cache_fill->key, cached);
+    }
+
     int error_code = cntl->ErrorCode();
     if (error_code == -1) {
         // replace general error (-1) with INTERNAL_SERVER_ERROR to make a
@@ -377,8 +625,12 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
     }
 
     butil::IOBuf res_buf;
-    SerializeRpcHeaderAndMeta(&res_buf, meta, res_size + attached_size);
-    if (append_body) {
+    const bool fully_inlined = SerializeRpcHeaderAndMeta(
+        &res_buf, meta, res_size + attached_size,
+        append_body ? &res_body : NULL,
+        (append_body && attached_size > 0) ?
+        &cntl->response_attachment() : NULL);
+    if (append_body && !fully_inlined) {
         res_buf.append(res_body.movable());
         if (attached_size > 0) {
             res_buf.append(cntl->response_attachment().movable());
@@ -456,6 +708,86 @@ void SendRpcResponse(int64_t correlation_id, Controller* cntl,
     }
 }
 
+// Response path of a ResponseCache hit: frame the cached serialized
+// response under the new correlation id and write it out directly, user
+// code and serialization never run. See Server::RegisterResponseCache.
+static void SendCachedRpcResponse(int64_t correlation_id, Controller* cntl,
+                                  MethodStatus* method_status,
+                                  int64_t received_us,
+                                  const CachedResponse& cached) {
+    ControllerPrivateAccessor accessor(cntl);
+    Span* span = accessor.span();
+    if (span) {
+        span->set_start_send_us(butil::cpuwide_time_us());
+    }
+    Socket* sock = accessor.get_sending_socket();
+
+    BRPC_SCOPE_EXIT {
+        {
+            // Remove concurrency and record latency at first.
+            ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
+        }
+        std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
+    };
+
+    RpcMeta meta;
+    meta.mutable_response()->set_error_code(0);
+    meta.set_correlation_id(correlation_id);
+    meta.set_compress_type(cached.compress_type);
+    meta.set_content_type(cached.content_type);
+    meta.set_checksum_type(cached.checksum_type);
+    if (!cached.checksum_value.empty()) {
+        meta.set_checksum_value(cached.checksum_value);
+    }
+    const size_t res_size = cached.serialized_response.size();
+    const size_t attached_size = cached.attachment.size();
+    if (attached_size > 0) {
+        meta.set_attachment_size(attached_size);
+    }
+
+    // Local copies share blocks with the cache, appending them movable
+    // below does not touch the cached entry.
+    butil::IOBuf res_body = cached.serialized_response;
+    butil::IOBuf attachment = cached.attachment;
+    butil::IOBuf res_buf;
+    const bool fully_inlined = SerializeRpcHeaderAndMeta(
+        &res_buf, meta, res_size + attached_size,
+        res_size > 0 ? &res_body : NULL,
+        (res_size > 0 && attached_size > 0) ? &attachment : NULL);
+    if (res_size > 0 && !fully_inlined) {
+        res_buf.append(res_body.movable());
+        if (attached_size > 0) {
+            res_buf.append(attachment.movable());
+        }
+    }
+
+    ResponseWriteInfo args;
+    bthread_id_t response_id = INVALID_BTHREAD_ID;
+    if (span) {
+        span->set_response_size(res_buf.size());
+        CHECK_EQ(0, bthread_id_create(&response_id, &args, HandleResponseWritten));
+    }
+
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    if (INVALID_BTHREAD_ID != response_id) {
+        wopt.id_wait = response_id;
+        wopt.notify_on_success = true;
+    }
+    if (sock->Write(&res_buf, &wopt) != 0) {
+        const int errcode = errno;
+        PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *sock;
+        cntl->SetFailed(errcode, "Fail to write into %s",
+                        sock->description().c_str());
+        return;
+    }
+
+    if (span) {
+        bthread_id_join(response_id);
+        span->set_sent_us(args.sent_us);
+    }
+}
+
 namespace {
 struct CallMethodInBackupThreadArgs {
     ::google::protobuf::Service* service;
@@ -474,8 +806,10 @@ static void CallMethodInBackupThread(void* void_args) {
     delete args;
 }
 
-// Used by other protocols as well.
+// Used by other protocols as well. `method_status' (when non-NULL) decides
+// which usercode pool runs the method, see MethodStatus.usercode_pool().
 void EndRunningCallMethodInPool(
+    MethodStatus* method_status,
     ::google::protobuf::Service* service,
     const ::google::protobuf::MethodDescriptor* method,
     ::google::protobuf::RpcController* controller,
@@ -489,14 +823,92 @@ void EndRunningCallMethodInPool(
     args->request = request;
     args->response = response;
     args->done = done;
-    return EndRunningUserCodeInPool(CallMethodInBackupThread, args);
+    return EndRunningUserCodeInPool(
+        method_status ? method_status->usercode_pool() : NULL,
+        CallMethodInBackupThread, args);
+};
+
+namespace {
+struct CallMethodInDedicatedTagArgs {
+    const Server* server;
+    ::google::protobuf::Service* service;
+    const ::google::protobuf::MethodDescriptor* method;
+    ::google::protobuf::RpcController* controller;
+    const ::google::protobuf::Message* request;
+    ::google::protobuf::Message* response;
+    ::google::protobuf::Closure* done;
 };
+}
+
+static void* CallMethodInDedicatedTag(void* void_args) {
+    CallMethodInDedicatedTagArgs* args =
+        (CallMethodInDedicatedTagArgs*)void_args;
+    // This bthread got a keytable from the server's pool which may carry
+    // data of a previous request, redo the per-request assignments that
+    // the I/O bthread did before dispatching here.
+    if (args->server->thread_local_options().thread_local_data_factory) {
+        bthread_assign_data((void*)&args->server->thread_local_options());
+    }
+    SetCurrentRpcDeadline(
+        static_cast<Controller*>(args->controller)->deadline_us());
+    args->service->CallMethod(args->method, args->controller, args->request,
+                              args->response, args->done);
+    delete args;
+    return NULL;
+}
+
+// Used by other protocols as well. Runs the method in a bthread of `tag'
+// so that services bound to a dedicated worker group
+// (ServiceOptions.bthread_tag) neither compete with nor delay services
+// running in other groups. Runs the method in-place when the bthread
+// cannot be started.
+void StartCallMethodInDedicatedTag(
+    bthread_tag_t tag,
+    const Server* server,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done) {
+    CallMethodInDedicatedTagArgs* args = new CallMethodInDedicatedTagArgs;
+    args->server = server;
+    args->service = service;
+    args->method = method;
+    args->controller = controller;
+    args->request = request;
+    args->response = response;
+    args->done = done;
+    bthread_attr_t attr = BTHREAD_ATTR_NORMAL;
+    attr.tag = tag;
+    attr.keytable_pool = ServerPrivateAccessor(server).keytable_pool();
+    bthread_t th;
+    if (bthread_start_background(
+            &th, &attr, CallMethodInDedicatedTag, args) != 0) {
+        PLOG_EVERY_SECOND(ERROR)
+            << "Fail to start bthread of tag=" << tag << ", run in place";
+        CallMethodInDedicatedTag(args);
+    }
+}
 
 bool DeserializeRpcMessage(const butil::IOBuf& data, Controller& cntl,
                            ContentType content_type, CompressType compress_type,
                            ChecksumType checksum_type,
                            google::protobuf::Message* message) {
     auto deserialize = [&](Deserializer& deserializer) -> bool {
+        if (COMPRESS_TYPE_NONE == compress_type &&
+            CHECKSUM_TYPE_CRC32C == checksum_type) {
+            // Fused path: the CRC is accumulated while the parser walks
+            // the payload, saving a second pass. Verification moves after
+            // parsing; parsing corrupt bytes is bounded and its result is
+            // discarded when the checksum does not match.
+            butil::IOBufAsZeroCopyInputStreamWithChecksum stream(data);
+            const bool parsed = deserializer.DeserializeFrom(&stream);
+            if (!Crc32cVerifyValue(&cntl, stream.checksum())) {
+                return false;
+            }
+            return parsed;
+        }
         ChecksumIn checksum_in{&data, &cntl};
         bool ok = VerifyDataChecksum(checksum_in, checksum_type);
         if (!ok) {
@@ -611,6 +1023,12 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     }
     if (request_meta.has_timeout_ms()) {
         cntl->set_timeout_ms(request_meta.timeout_ms());
+        // The upstream told us how much time is left, turn it into a
+        // deadline so that sub-calls can inherit the remaining budget.
+        // Counted from the arrival of the message rather than from now:
+        // the time this request waited in queues is part of the budget.
+        accessor.set_deadline_us(msg->base_real_us() + msg->received_us() +
+                                 request_meta.timeout_ms() * 1000L);
     }
     cntl->set_request_content_type(meta.content_type());
     cntl->set_request_compress_type((CompressType)meta.compress_type());
@@ -656,6 +1074,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     }
 
     MethodStatus* method_status = NULL;
+    ResponseCacheFill* cache_fill = NULL;
     do {
         if (!server->IsRunning()) {
             cntl->SetFailed(ELOGOFF, "Server is stopping");
@@ -676,7 +1095,11 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         }
 
         const int req_size = static_cast<int>(msg->payload.size());
-        if (meta.has_attachment_size()) {
+        // When the attachment is streamed (msg->rpa), `payload' carries the
+        // serialized request only, see ParseRpcMessage.
+        const int inlined_attachment_size =
+            (msg->rpa != NULL ? 0 : meta.attachment_size());
+        if (msg->rpa == NULL && meta.has_attachment_size()) {
             if (req_size < meta.attachment_size()) {
                 cntl->SetFailed(EREQUEST,
                     "attachment_size=%d is larger than request_size=%d",
@@ -684,9 +1107,13 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                 break;
             }
         }
+        if (msg->rpa != NULL) {
+            accessor.set_readable_progressive_attachment(msg->rpa.get());
+        }
 
         google::protobuf::Service* svc = NULL;
         google::protobuf::MethodDescriptor* method = NULL;
+        bthread_tag_t service_tag = BTHREAD_TAG_INVALID;
         if (NULL != server->options().baidu_master_service) {
           if (socket->is_overcrowded() &&
               !server->options().ignore_eovercrowded &&
@@ -724,7 +1151,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             messages = BaiduProxyPBMessages::Get();
             msg->payload.cutn(
                 &((SerializedRequest*)messages->Request())->serialized_data(),
-                req_size - meta.attachment_size());
+                req_size - inlined_attachment_size);
             if (!msg->payload.empty()) {
                 cntl->request_attachment().swap(msg->payload);
             }
@@ -778,8 +1205,19 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                     break;
                 }
             }
+            // The dedicated pool of the method (if configured) has its own
+            // too-many-user-code mark which the global check above can't see.
+            if (FLAGS_usercode_in_pthread &&
+                method_status != NULL &&
+                method_status->usercode_pool() != NULL &&
+                TooManyUserCode(method_status->usercode_pool())) {
+                cntl->SetFailed(ELIMIT, "Too many user code to run when"
+                                " -usercode_in_pthread is on");
+                break;
+            }
             svc = mp->service;
             method = const_cast<google::protobuf::MethodDescriptor*>(mp->method);
+            service_tag = mp->bthread_tag;
             accessor.set_method(method);
 
             if (span) {
@@ -791,10 +1229,51 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             }
 
             butil::IOBuf req_buf;
-            int body_without_attachment_size = req_size - meta.attachment_size();
+            int body_without_attachment_size = req_size - inlined_attachment_size;
             msg->payload.cutn(&req_buf, body_without_attachment_size);
-            if (meta.attachment_size() > 0) {
-                cntl->request_attachment().swap(msg->payload);
+            if (inlined_attachment_size > 0) {
+                AttachmentBufferPool* pool = mp->attachment_pool;
+                void* abuf = NULL;
+                if (pool != NULL &&
+                    (size_t)meta.attachment_size() <= pool->buffer_size() &&
+                    (abuf = pool->Acquire()) != NULL) {
+                    // Registered-buffer mode: the attachment lands in one
+                    // contiguous aligned buffer which goes back to the pool
+                    // when the last reference to the data is released.
+                    msg->payload.cutn(abuf, meta.attachment_size());
+                    if (cntl->request_attachment().append_user_data(
+                            abuf, meta.attachment_size(),
+                            [pool](void* data) { pool->Release(data); }) != 0) {
+                        pool->Release(abuf);
+                        cntl->SetFailed(ENOMEM, "Fail to reference buffer of "
+                                        "attachment_size=%d",
+                                        meta.attachment_size());
+                        break;
+                    }
+                } else {
+                    cntl->request_attachment().swap(msg->payload);
+                }
+            }
+
+            if (mp->response_cache != NULL && msg->rpa == NULL) {
+                std::string cache_key;
+                if (mp->response_cache->ComputeKey(*cntl, req_buf, &cache_key)) {
+                    CachedResponse cached;
+                    if (mp->response_cache->Get(cache_key, &cached)) {
+                        // Answer from the cache, the request is not even
+                        // deserialized. `cntl' is deleted inside.
+                        const int64_t received_us = msg->received_us();
+                        msg.reset();
+                        SendCachedRpcResponse(meta.correlation_id(),
+                                              cntl.release(), method_status,
+                                              received_us, cached);
+                        return;
+                    }
+                    // A miss: have SendRpcResponse fill the cache.
+                    cache_fill = new ResponseCacheFill;
+                    cache_fill->cache = mp->response_cache;
+                    cache_fill->key.swap(cache_key);
+                }
             }
 
             ContentType content_type = meta.content_type();
@@ -820,12 +1299,25 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             req_buf.clear();
         }
 
+        // A request that spent its whole budget in queues has certainly
+        // been abandoned by the client, answer ERPCTIMEDOUT right away
+        // instead of wasting cycles on running its handler.
+        if (FLAGS_server_reject_expired_requests &&
+            cntl->deadline_us() >= 0 &&
+            butil::gettimeofday_us() > cntl->deadline_us()) {
+            cntl->SetFailed(ERPCTIMEDOUT, "Deadline=%" PRId64 "us expired "
+                            "before dispatching to the method",
+                            cntl->deadline_us());
+            break;
+        }
+
         // `socket' will be held until response has been sent
         google::protobuf::Closure* done = ::brpc::NewCallback<
             int64_t, Controller*, RpcPBMessages*,
-            const Server*, MethodStatus*, int64_t>(
+            const Server*, MethodStatus*, int64_t, ResponseCacheFill*>(
                 &SendRpcResponse, meta.correlation_id(),cntl.get(),
-                messages, server, method_status, msg->received_us());
+                messages, server, method_status, msg->received_us(),
+                cache_fill);
 
         // optional, just release resource ASAP
         msg.reset();
@@ -834,8 +1326,21 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             span->set_start_callback_us(butil::cpuwide_time_us());
             span->AsParent();
         }
+        if (service_tag != BTHREAD_TAG_INVALID &&
+            service_tag != bthread_self_tag()) {
+            // The service is bound to a dedicated worker group, hand the
+            // method over to a bthread of that group. -usercode_in_pthread
+            // does not apply there, the method runs as a plain bthread.
+            return StartCallMethodInDedicatedTag(
+                service_tag, server, svc, method, cntl.release(),
+                messages->Request(), messages->Response(), done);
+        }
+        // Expose the deadline(if any) to sub-calls issued inside user code.
+        // -1 clears a stale deadline of a previous request served with a
+        // reused keytable.
+        SetCurrentRpcDeadline(cntl->deadline_us());
         if (!FLAGS_usercode_in_pthread) {
-            return svc->CallMethod(method, cntl.release(), 
+            return svc->CallMethod(method, cntl.release(),
                                    messages->Request(),
                                    messages->Response(), done);
         }
@@ -846,7 +1351,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             return EndRunningUserCodeInPlace();
         } else {
             return EndRunningCallMethodInPool(
-                svc, method, cntl.release(),
+                method_status, svc, method, cntl.release(),
                 messages->Request(),
                 messages->Response(), done);
         }
@@ -857,7 +1362,7 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     SendRpcResponse(meta.correlation_id(),
                     cntl.release(), messages,
                     server, method_status,
-                    msg->received_us());
+                    msg->received_us(), cache_fill);
 }
 
 bool VerifyRpcRequest(const InputMessageBase* msg_base) {
@@ -989,7 +1494,7 @@ void ProcessRpcResponse(InputMessageBase* msg_base) {
                     serialized_data().append(*res_buf_ptr);
             } else if (!DeserializeRpcMessage(*res_buf_ptr, *cntl, content_type,
                                               compress_type, checksum_type,
-                                              cntl->response())) {
+                                              accessor.response_parse_target())) {
                 cntl->SetFailed(
                     EREQUEST,
                     "Fail to parse response=%s, ContentType=%s, "
@@ -1044,7 +1549,15 @@ void PackRpcRequest(butil::IOBuf* req_buf,
                     Controller* cntl,
                     const butil::IOBuf& request_body,
                     const Authenticator* auth) {
-    RpcMeta meta;
+    // Reuse a pooled RpcMeta instead of constructing one per call. Clear()
+    // keeps the heap blocks of sub-messages and strings so hot methods pay
+    // the allocations only once per pooled instance.
+    RpcMeta* pooled_meta = butil::get_object<RpcMeta>();
+    BRPC_SCOPE_EXIT {
+        pooled_meta->Clear();
+        butil::return_object(pooled_meta);
+    };
+    RpcMeta& meta = *pooled_meta;
     if (auth && auth->GenerateCredential(
             meta.mutable_authentication_data()) != 0) {
         return cntl->SetFailed(EREQUEST, "Fail to generate credential");
@@ -1121,7 +1634,13 @@ void PackRpcRequest(butil::IOBuf* req_buf,
         request_meta->set_parent_span_id(span->parent_span_id());
     }
 
-    SerializeRpcHeaderAndMeta(req_buf, meta, req_size + attached_size);
+    if (SerializeRpcHeaderAndMeta(
+            req_buf, meta, req_size + attached_size, &request_body,
+            attached_size ? &cntl->request_attachment() : NULL)) {
+        // Short request_body (and attachment) were inlined into the
+        // header+meta block.
+        return;
+    }
     req_buf->append(request_body);
     if (attached_size) {
         req_buf->append(cntl->request_attachment());
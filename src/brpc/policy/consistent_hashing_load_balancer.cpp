@@ -18,6 +18,7 @@
 
 #include <algorithm>                                           // std::set_union
 #include <array>
+#include <math.h>                                              // ceil
 #include <gflags/gflags.h>
 #include <openssl/md5.h>
 #include "butil/containers/flat_map.h"
@@ -145,7 +146,8 @@ void InitReplicaPolicy() {
     g_replica_policy = new std::array<const ReplicaPolicy*, CONS_HASH_LB_LAST>({
         new DefaultReplicaPolicy(MurmurHash32),
         new DefaultReplicaPolicy(MD5Hash32),
-        new KetamaReplicaPolicy
+        new KetamaReplicaPolicy,
+        new DefaultReplicaPolicy(WyHash32)
     });
 }
 
@@ -158,7 +160,10 @@ inline const ReplicaPolicy* GetReplicaPolicy(ConsistentHashingLoadBalancerType t
 
 ConsistentHashingLoadBalancer::ConsistentHashingLoadBalancer(
     ConsistentHashingLoadBalancerType type)
-    : _num_replicas(FLAGS_chash_num_replicas), _type(type) {
+    : _num_replicas(FLAGS_chash_num_replicas)
+    , _type(type)
+    , _load_factor(0)
+    , _total_inflight(0) {
     CHECK(GetReplicaPolicy(_type))
         << "Fail to find replica policy for consistency lb type: '" << _type << '\'';
 }
@@ -231,17 +236,50 @@ size_t ConsistentHashingLoadBalancer::Remove(
     return fg.size() - bg.size();
 }
 
+size_t ConsistentHashingLoadBalancer::RemoveLoadsInBatch(
+    LoadMap& bg, const std::vector<ServerId>& servers) {
+    size_t n = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        n += bg.erase(servers[i].id);
+    }
+    return n;
+}
+
+bool ConsistentHashingLoadBalancer::AddLoad(
+    LoadMap& bg, const std::pair<SocketId, ServerLoad>& p) {
+    // Both buffers insert the same counter, keeping it shared.
+    return bg.insert(p).second;
+}
+
+bool ConsistentHashingLoadBalancer::RemoveLoad(LoadMap& bg, SocketId id) {
+    return bg.erase(id) != 0;
+}
+
 bool ConsistentHashingLoadBalancer::AddServer(const ServerId& server) {
     std::vector<Node> add_nodes;
     add_nodes.reserve(_num_replicas);
     if (!GetReplicaPolicy(_type)->Build(server, _num_replicas, &add_nodes)) {
         return false;
     }
+    ServerLoad load;
+    if (_load_factor > 1) {
+        // One in-flight counter shared by all replicas of the server.
+        // Register it before the ring so that Feedback() of a call picked
+        // right after the ring is modified finds the counter.
+        load = std::make_shared<butil::atomic<int64_t> >(0);
+        for (size_t i = 0; i < add_nodes.size(); ++i) {
+            add_nodes[i].load = load;
+        }
+        _db_server_loads.Modify(AddLoad, std::make_pair(server.id, load));
+    }
     std::sort(add_nodes.begin(), add_nodes.end());
     bool executed = false;
     const size_t ret = _db_hash_ring.ModifyWithForeground(
                         AddBatch, add_nodes, &executed);
     CHECK(ret == 0 || ret == _num_replicas) << ret;
+    if (ret == 0 && load != NULL) {
+        _db_server_loads.Modify(RemoveLoad, server.id);
+    }
     return ret != 0;
 }
 
@@ -254,6 +292,15 @@ size_t ConsistentHashingLoadBalancer::AddServersInBatch(
     for (size_t i = 0; i < servers.size(); ++i) {
         replicas.clear();
         if (GetReplicaPolicy(_type)->Build(servers[i], _num_replicas, &replicas)) {
+            if (_load_factor > 1) {
+                ServerLoad load =
+                    std::make_shared<butil::atomic<int64_t> >(0);
+                for (size_t j = 0; j < replicas.size(); ++j) {
+                    replicas[j].load = load;
+                }
+                _db_server_loads.Modify(
+                    AddLoad, std::make_pair(servers[i].id, load));
+            }
             add_nodes.insert(add_nodes.end(), replicas.begin(), replicas.end());
         }
     }
@@ -272,6 +319,9 @@ bool ConsistentHashingLoadBalancer::RemoveServer(const ServerId& server) {
     bool executed = false;
     const size_t ret = _db_hash_ring.ModifyWithForeground(Remove, server, &executed);
     CHECK(ret == 0 || ret == _num_replicas);
+    if (ret != 0 && _load_factor > 1) {
+        _db_server_loads.Modify(RemoveLoad, server.id);
+    }
     return ret != 0;
 }
 
@@ -281,6 +331,9 @@ size_t ConsistentHashingLoadBalancer::RemoveServersInBatch(
     const size_t ret = _db_hash_ring.ModifyWithForeground(RemoveBatch, servers, &executed);
     CHECK(ret % _num_replicas == 0);
     const size_t n = ret / _num_replicas;
+    if (n != 0 && _load_factor > 1) {
+        _db_server_loads.Modify(RemoveLoadsInBatch, servers);
+    }
     return n;
 }
 
@@ -320,11 +373,28 @@ int ConsistentHashingLoadBalancer::SelectServer(
     if (choice == s->end()) {
         choice = s->begin();
     }
+    // Bounded loads: a server is walked past when its in-flight count
+    // reaches ceil(load_factor * average in-flight over servers).
+    int64_t load_threshold = 0;
+    if (_load_factor > 1) {
+        const int64_t total =
+            _total_inflight.load(butil::memory_order_relaxed);
+        const size_t nserver = std::max<size_t>(s->size() / _num_replicas, 1);
+        load_threshold = (int64_t)ceil(_load_factor * (total + 1) / nserver);
+    }
     for (size_t i = 0; i < s->size(); ++i) {
         if (((i + 1) == s->size() // always take last chance
-             || !ExcludedServers::IsExcluded(in.excluded, choice->server_sock.id))
-            && Socket::Address(choice->server_sock.id, out->ptr) == 0 
+             || (!ExcludedServers::IsExcluded(in.excluded, choice->server_sock.id)
+                 && !(load_threshold > 0 && choice->load != NULL
+                      && choice->load->load(butil::memory_order_relaxed)
+                         >= load_threshold)))
+            && Socket::Address(choice->server_sock.id, out->ptr) == 0
             && (*out->ptr)->IsAvailable()) {
+            if (load_threshold > 0 && choice->load != NULL) {
+                choice->load->fetch_add(1, butil::memory_order_relaxed);
+                _total_inflight.fetch_add(1, butil::memory_order_relaxed);
+                out->need_feedback = true;
+            }
             return 0;
         } else {
             if (++choice == s->end()) {
@@ -335,6 +405,23 @@ int ConsistentHashingLoadBalancer::SelectServer(
     return EHOSTDOWN;
 }
 
+void ConsistentHashingLoadBalancer::Feedback(const CallInfo& info) {
+    if (_load_factor <= 1) {
+        return;
+    }
+    _total_inflight.fetch_sub(1, butil::memory_order_relaxed);
+    butil::DoublyBufferedData<LoadMap>::ScopedPtr s;
+    if (_db_server_loads.Read(&s) != 0) {
+        return;
+    }
+    LoadMap::const_iterator it = s->find(info.server_id);
+    if (it != s->end()) {
+        // The server may have been removed in the middle of the call, in
+        // which case its counter is gone with the map entry.
+        it->second->fetch_sub(1, butil::memory_order_relaxed);
+    }
+}
+
 void ConsistentHashingLoadBalancer::Describe(
     std::ostream &os, const DescribeOptions& options) {
     if (!options.verbose) {
@@ -344,6 +431,11 @@ void ConsistentHashingLoadBalancer::Describe(
     os << "ConsistentHashingLoadBalancer {\n"
        << "  hash function: " << GetReplicaPolicy(_type)->name() << '\n'
        << "  replica per host: " << _num_replicas << '\n';
+    if (_load_factor > 1) {
+        os << "  load factor: " << _load_factor << '\n'
+           << "  total inflight: "
+           << _total_inflight.load(butil::memory_order_relaxed) << '\n';
+    }
     std::map<butil::EndPoint, double> load_map;
     GetLoads(&load_map);
     os << "  number of hosts: " << load_map.size() << '\n';
@@ -403,6 +495,17 @@ bool ConsistentHashingLoadBalancer::SetParameters(const butil::StringPiece& para
             }
             continue;
         }
+        if (sp.key() == "load_factor") {
+            double load_factor = 0;
+            if (!butil::StringToDouble(sp.value().as_string(), &load_factor)
+                || load_factor <= 1.0) {
+                LOG(ERROR) << "Invalid load_factor=" << sp.value()
+                           << " in lb parameter, should be > 1";
+                return false;
+            }
+            _load_factor = load_factor;
+            continue;
+        }
         LOG(ERROR) << "Failed to set this unknown parameters " << sp.key_and_value();
     }
     return true;
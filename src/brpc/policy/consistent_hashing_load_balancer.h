@@ -21,7 +21,10 @@
 
 #include <stdint.h>                                     // uint32_t
 #include <functional>
+#include <map>                                          // std::map
+#include <memory>                                       // std::shared_ptr
 #include <vector>                                       // std::vector
+#include "butil/atomicops.h"                             // butil::atomic
 #include "butil/endpoint.h"                              // butil::EndPoint
 #include "butil/containers/doubly_buffered_data.h"
 #include "brpc/load_balancer.h"
@@ -36,17 +39,25 @@ enum ConsistentHashingLoadBalancerType {
     CONS_HASH_LB_MURMUR3 = 0,
     CONS_HASH_LB_MD5 = 1,
     CONS_HASH_LB_KETAMA = 2,
+    // Faster hashing than murmur3/md5 but a different ring placement,
+    // see the note on WyHash32 in hasher.h before migrating.
+    CONS_HASH_LB_WYHASH = 3,
 
     // Identify the last one.
-    CONS_HASH_LB_LAST = 3
+    CONS_HASH_LB_LAST = 4
 };
 
 class ConsistentHashingLoadBalancer : public LoadBalancer {
 public:
+    // In-flight count of a server, shared by all replicas of the server
+    // on the ring. Only allocated in bounded-load mode(load_factor > 1).
+    typedef std::shared_ptr<butil::atomic<int64_t> > ServerLoad;
+
     struct Node {
         uint32_t hash;
         ServerId server_sock;
         butil::EndPoint server_addr;  // To make sorting stable among all clients
+        ServerLoad load;
         bool operator<(const Node &rhs) const {
             if (hash < rhs.hash) { return true; }
             if (hash > rhs.hash) { return false; }
@@ -67,9 +78,14 @@ public:
     LoadBalancer *New(const butil::StringPiece& params) const;
     void Destroy();
     int SelectServer(const SelectIn &in, SelectOut *out);
+    void Feedback(const CallInfo& info);
     void Describe(std::ostream &os, const DescribeOptions& options);
 
 private:
+    // Maps SocketId to its in-flight count for Feedback(). The counters
+    // are shared with the Nodes on the ring.
+    typedef std::map<SocketId, ServerLoad> LoadMap;
+
     bool SetParameters(const butil::StringPiece& params);
     void GetLoads(std::map<butil::EndPoint, double> *load_map);
     static size_t AddBatch(std::vector<Node> &bg, const std::vector<Node> &fg,
@@ -78,9 +94,19 @@ private:
                               const std::vector<ServerId> &servers, bool *executed);
     static size_t Remove(std::vector<Node> &bg, const std::vector<Node> &fg,
                          const ServerId& server, bool *executed);
+    static bool AddLoad(LoadMap& bg, const std::pair<SocketId, ServerLoad>& p);
+    static bool RemoveLoad(LoadMap& bg, SocketId id);
+    static size_t RemoveLoadsInBatch(LoadMap& bg,
+                                     const std::vector<ServerId>& servers);
     size_t _num_replicas;
     ConsistentHashingLoadBalancerType _type;
+    // When > 1, walk the ring past servers whose in-flight count exceeds
+    // load_factor times the average(consistent hashing with bounded loads).
+    // 0 means unlimited.
+    double _load_factor;
+    butil::atomic<int64_t> _total_inflight;
     butil::DoublyBufferedData<std::vector<Node> > _db_hash_ring;
+    butil::DoublyBufferedData<LoadMap> _db_server_loads;
 };
 
 }  // namespace policy
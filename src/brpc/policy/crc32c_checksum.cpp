@@ -41,6 +41,26 @@ void Crc32cCompute(const ChecksumIn& in) {
         reinterpret_cast<char*>(&crc), sizeof(crc));
 }
 
+void Crc32cSetValue(Controller* cntl, uint32_t crc) {
+    RPC_VLOG << "Crc32cSetValue crc=" << crc;
+    crc = butil::HostToNet32(butil::crc32c::Mask(crc));
+    ControllerPrivateAccessor(cntl).set_checksum_value(
+        reinterpret_cast<char*>(&crc), sizeof(crc));
+}
+
+bool Crc32cVerifyValue(const Controller* cntl, uint32_t crc) {
+    auto& val = ControllerPrivateAccessor(const_cast<Controller*>(cntl))
+                    .checksum_value();
+    if (val.size() != sizeof(crc)) {
+        return false;
+    }
+    auto expected = *reinterpret_cast<const uint32_t*>(val.data());
+    expected = butil::crc32c::Unmask(butil::NetToHost32(expected));
+    RPC_VLOG << "Crc32cVerifyValue crc=" << crc
+             << " expected=" << expected;
+    return crc == expected;
+}
+
 bool Crc32cVerify(const ChecksumIn& in) {
     auto buf = in.buf;
     auto cntl = in.cntl;
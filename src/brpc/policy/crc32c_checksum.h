@@ -31,6 +31,13 @@ void Crc32cCompute(const ChecksumIn& in);
 // Verify checksum
 bool Crc32cVerify(const ChecksumIn& in);
 
+// Entry points of the fused checksum-while-copy path: the raw CRC was
+// already accumulated by an IOBufAsZeroCopy*StreamWithChecksum during
+// serialization/parsing, only mask and set/compare it here. Must stay in
+// sync with the wire format of Crc32cCompute/Crc32cVerify above.
+void Crc32cSetValue(Controller* cntl, uint32_t crc);
+bool Crc32cVerifyValue(const Controller* cntl, uint32_t crc);
+
 }  // namespace policy
 }  // namespace brpc
 
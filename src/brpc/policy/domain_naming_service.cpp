@@ -21,17 +21,65 @@
 #include <stdlib.h>                                   // strtol
 #include <string>                                     // std::string
 #include "bthread/bthread.h"
+#include "butil/time.h"
 #include "brpc/log.h"
 #include "brpc/policy/domain_naming_service.h"
 
 DEFINE_bool(dns_support_ipv6, false, "Resolve DNS by IPV6 address first");
 
+DEFINE_int32(dns_cache_ttl_s, 10,
+             "Cached DNS resolutions younger than this many seconds are "
+             "returned directly, older ones are refreshed in a background "
+             "bthread while the cached list keeps being served, so a slow "
+             "or failing resolver never stalls server-list propagation. "
+             "<= 0 resolves synchronously on every access as before");
+
+DEFINE_int32(dns_max_stale_s, 300,
+             "When the resolver keeps failing, serve the last successful "
+             "DNS resolution for at most this many seconds(beyond the ttl) "
+             "before GetServers starts reporting the failure. 0 reports "
+             "failures as soon as the cache goes beyond -dns_cache_ttl_s");
+
 namespace brpc {
 namespace policy {
 
 DomainNamingService::DomainNamingService(int default_port)
     : _aux_buf_len(0)
-    , _default_port(default_port) {}
+    , _default_port(default_port)
+    , _has_cache(false)
+    , _refreshing(false)
+    , _refresh_tid(0)
+    , _cached_at_us(0)
+    , _last_success_us(0) {}
+
+// Parameters of one asynchronous refresh. `host' and `port' are copied
+// because the naming thread may be parsing another dns_name when the
+// refresh bthread runs.
+struct DnsRefreshArg {
+    DomainNamingService* ns;
+    std::string host;
+    int port;
+};
+
+void* DomainNamingService::RunRefresh(void* arg) {
+    std::unique_ptr<DnsRefreshArg> ra(static_cast<DnsRefreshArg*>(arg));
+    DomainNamingService* ns = ra->ns;
+    std::vector<ServerNode> servers;
+    const int rc = ns->ResolveHost(ra->host.c_str(), ra->port, &servers);
+    const int64_t now_us = butil::gettimeofday_us();
+    BAIDU_SCOPED_LOCK(ns->_cache_mutex);
+    // Updated even on failure so that retries are spaced by the ttl.
+    ns->_cached_at_us = now_us;
+    if (rc == 0) {
+        ns->_cached_servers.swap(servers);
+        ns->_last_success_us = now_us;
+    } else {
+        LOG(WARNING) << "Fail to refresh `" << ra->host
+                     << "', serving the cached resolution";
+    }
+    ns->_refreshing = false;
+    return NULL;
+}
 
 int DomainNamingService::GetServers(const char* dns_name,
                                     std::vector<ServerNode>* servers) {
@@ -79,6 +127,60 @@ int DomainNamingService::GetServers(const char* dns_name,
         return -1;
     }
 
+    if (FLAGS_dns_cache_ttl_s <= 0) {
+        return ResolveHost(buf, port, servers);
+    }
+
+    const int64_t now_us = butil::gettimeofday_us();
+    {
+        BAIDU_SCOPED_LOCK(_cache_mutex);
+        if (_has_cache) {
+            if (!_refreshing &&
+                now_us - _cached_at_us >= FLAGS_dns_cache_ttl_s * 1000000L) {
+                DnsRefreshArg* ra = new DnsRefreshArg;
+                ra->ns = this;
+                ra->host = buf;
+                ra->port = port;
+                _refreshing = true;
+                // Reap the previous refresh bthread which must have
+                // finished since _refreshing was false.
+                if (_refresh_tid != 0) {
+                    bthread_join(_refresh_tid, NULL);
+                }
+                if (bthread_start_background(
+                        &_refresh_tid, NULL, RunRefresh, ra) != 0) {
+                    LOG(ERROR) << "Fail to start DNS refresh bthread";
+                    delete ra;
+                    _refreshing = false;
+                }
+            }
+            if (now_us - _last_success_us >
+                (FLAGS_dns_max_stale_s + FLAGS_dns_cache_ttl_s) * 1000000L) {
+                LOG_EVERY_SECOND(ERROR)
+                    << "Resolution of `" << buf << "' has been failing for"
+                    " more than " << FLAGS_dns_max_stale_s << "s beyond the"
+                    " ttl, stop serving the stale result";
+                return -1;
+            }
+            *servers = _cached_servers;
+            return 0;
+        }
+    }
+    // No cache yet. The first resolution is synchronous so that channels
+    // see servers right after initialization.
+    if (ResolveHost(buf, port, servers) != 0) {
+        return -1;
+    }
+    BAIDU_SCOPED_LOCK(_cache_mutex);
+    _cached_servers = *servers;
+    _cached_at_us = butil::gettimeofday_us();
+    _last_success_us = _cached_at_us;
+    _has_cache = true;
+    return 0;
+}
+
+int DomainNamingService::ResolveHost(const char* buf, int port,
+                                     std::vector<ServerNode>* servers) {
     if (FLAGS_dns_support_ipv6) {
         struct addrinfo hints;
         struct addrinfo* addrResult;
@@ -136,7 +238,7 @@ int DomainNamingService::GetServers(const char* dns_name,
         _aux_buf_len *= 2;
         _aux_buf.reset(new char[_aux_buf_len]);
         RPC_VLOG << "Resized _aux_buf to " << _aux_buf_len
-                 << ", dns_name=" << dns_name;
+                 << ", host=" << buf;
     } while (1);
     if (ret != 0) {
         // `hstrerror' is thread safe under linux
@@ -177,6 +279,16 @@ NamingService* DomainNamingService::New() const {
 }
 
 void DomainNamingService::Destroy() {
+    bthread_t tid = 0;
+    {
+        BAIDU_SCOPED_LOCK(_cache_mutex);
+        tid = _refresh_tid;
+        _refresh_tid = 0;
+    }
+    if (tid != 0) {
+        // Wait for an in-flight refresh which accesses this object.
+        bthread_join(tid, NULL);
+    }
     delete this;
 }
 
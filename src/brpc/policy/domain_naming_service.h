@@ -20,6 +20,8 @@
 #define  BRPC_POLICY_DOMAIN_NAMING_SERVICE_H
 
 #include "brpc/periodic_naming_service.h"
+#include "bthread/types.h"
+#include "butil/synchronization/lock.h"
 #include "butil/unique_ptr.h"
 
 
@@ -38,13 +40,31 @@ private:
     void Describe(std::ostream& os, const DescribeOptions&) const override;
 
     NamingService* New() const override;
-    
+
     void Destroy() override;
 
+    // The blocking resolution, extracted so that it can run in a refresh
+    // bthread without stalling the naming thread.
+    int ResolveHost(const char* host, int port,
+                    std::vector<ServerNode>* servers);
+
+    // Entry of the refresh bthread.
+    static void* RunRefresh(void* arg);
+
 private:
     std::unique_ptr<char[]> _aux_buf;
     size_t _aux_buf_len;
     int _default_port;
+
+    // Cache of the last successful resolution, refreshed asynchronously
+    // when older than -dns_cache_ttl_s. Guarded by _cache_mutex.
+    butil::Mutex _cache_mutex;
+    bool _has_cache;
+    bool _refreshing;
+    bthread_t _refresh_tid;
+    int64_t _cached_at_us;
+    int64_t _last_success_us;
+    std::vector<ServerNode> _cached_servers;
 };
 
 }  // namespace policy
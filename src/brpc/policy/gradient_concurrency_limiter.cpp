@@ -0,0 +1,226 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <cmath>
+#include <gflags/gflags.h>
+#include "brpc/errno.pb.h"
+#include "brpc/policy/gradient_concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(gradient_cl_sample_window_size_ms, 1000,
+             "Duration of the sampling window.");
+DEFINE_int32(gradient_cl_min_sample_count, 100,
+             "During the duration of the sampling window, if the number of "
+             "requests collected is less than this value, the sampling window "
+             "will be discarded.");
+DEFINE_int32(gradient_cl_max_sample_count, 200,
+             "During the duration of the sampling window, once the number of "
+             "requests collected is greater than this value, even if the "
+             "duration of the window has not ended, the max_concurrency will "
+             "be updated and a new sampling window will be started.");
+DEFINE_double(gradient_cl_sampling_interval_ms, 0.1,
+              "Interval for sampling request in gradient concurrency limiter");
+DEFINE_int32(gradient_cl_initial_max_concurrency, 40,
+             "Initial max concurrency for gradient concurrency limiter");
+DEFINE_int32(gradient_cl_min_concurrency, 4,
+             "The lower bound of max_concurrency. It should cover the "
+             "concurrency the service needs when completely idle, otherwise "
+             "recovering from a latency spike takes longer.");
+DEFINE_int32(gradient_cl_max_concurrency, 1000,
+             "The upper bound of max_concurrency, limiting how far the "
+             "limiter explores beyond the measured optimum.");
+DEFINE_double(gradient_cl_alpha_factor_for_rtt_ema, 0.05,
+              "The smoothing coefficient of the long-term RTT ema, the value "
+              "range is 0-1. The smaller the value, the slower the long-term "
+              "RTT follows the current latency, and the more sensitive the "
+              "gradient is to short-term latency changes.");
+DEFINE_double(gradient_cl_adjust_smooth, 0.2,
+              "The proportion of the newly calculated max_concurrency applied "
+              "per sample window, the value range is 0-1. Smaller values "
+              "smooth out the fluctuation of the limit between windows.");
+DEFINE_double(gradient_cl_tolerance, 1.3,
+              "Latency of the latest window within so many times of the "
+              "long-term RTT is not treated as overload. Larger values "
+              "tolerate more latency fluctuation at the price of a higher "
+              "latency when the server is really overloaded.");
+DEFINE_bool(gradient_cl_enable_error_punish, true,
+            "Whether to consider failed requests when calculating the window "
+            "latency");
+DEFINE_double(gradient_cl_fail_punish_ratio, 1.0,
+              "Use the failed requests to punish normal requests. The larger "
+              "the configuration item, the more aggressive the penalty "
+              "strategy.");
+
+GradientConcurrencyLimiter::GradientConcurrencyLimiter()
+    : _max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _raw_max_concurrency(FLAGS_gradient_cl_initial_max_concurrency)
+    , _smoothed_rtt_us(0)
+    , _last_sampling_time_us(0) {
+}
+
+GradientConcurrencyLimiter*
+GradientConcurrencyLimiter::New(const AdaptiveMaxConcurrency&) const {
+    return new (std::nothrow) GradientConcurrencyLimiter;
+}
+
+bool GradientConcurrencyLimiter::OnRequested(int current_concurrency,
+                                             Controller*) {
+    return current_concurrency <= _max_concurrency;
+}
+
+void GradientConcurrencyLimiter::OnResponded(int error_code,
+                                             int64_t latency_us) {
+    if (ELIMIT == error_code) {
+        return;
+    }
+
+    const int64_t now_time_us = butil::gettimeofday_us();
+    int64_t last_sampling_time_us =
+        _last_sampling_time_us.load(butil::memory_order_relaxed);
+
+    if (last_sampling_time_us == 0 ||
+        now_time_us - last_sampling_time_us >=
+            FLAGS_gradient_cl_sampling_interval_ms * 1000) {
+        bool sample_this_call = _last_sampling_time_us.compare_exchange_strong(
+            last_sampling_time_us, now_time_us, butil::memory_order_relaxed);
+        if (sample_this_call) {
+            bool sample_window_submitted =
+                AddSample(error_code, latency_us, now_time_us);
+            if (sample_window_submitted) {
+                // The following log prints has data-race in extreme cases,
+                // unless you are in debug, you should not open it.
+                VLOG(1)
+                    << "Sample window submitted, current max_concurrency:"
+                    << _max_concurrency
+                    << ", smoothed_rtt_us:" << _smoothed_rtt_us;
+            }
+        }
+    }
+}
+
+int GradientConcurrencyLimiter::MaxConcurrency() {
+    return _max_concurrency;
+}
+
+int GradientConcurrencyLimiter::ResetMaxConcurrency(
+    const AdaptiveMaxConcurrency&) {
+    return -1;
+}
+
+bool GradientConcurrencyLimiter::AddSample(int error_code,
+                                           int64_t latency_us,
+                                           int64_t sampling_time_us) {
+    std::unique_lock<butil::Mutex> lock_guard(_sw_mutex);
+    if (_sw.start_time_us == 0) {
+        _sw.start_time_us = sampling_time_us;
+    }
+
+    if (error_code != 0 && FLAGS_gradient_cl_enable_error_punish) {
+        ++_sw.failed_count;
+        _sw.total_failed_us += latency_us;
+    } else if (error_code == 0) {
+        ++_sw.succ_count;
+        _sw.total_succ_us += latency_us;
+    }
+
+    if (_sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_min_sample_count) {
+        if (sampling_time_us - _sw.start_time_us >=
+            FLAGS_gradient_cl_sample_window_size_ms * 1000) {
+            // If the sample size is insufficient at the end of the sampling
+            // window, discard the entire sampling window
+            ResetSampleWindow(sampling_time_us);
+        }
+        return false;
+    }
+    if (sampling_time_us - _sw.start_time_us <
+        FLAGS_gradient_cl_sample_window_size_ms * 1000 &&
+        _sw.succ_count + _sw.failed_count < FLAGS_gradient_cl_max_sample_count) {
+        return false;
+    }
+
+    if (_sw.succ_count > 0) {
+        UpdateMaxConcurrency(sampling_time_us);
+    } else {
+        // All request failed
+        AdjustMaxConcurrency(_raw_max_concurrency / 2);
+    }
+    ResetSampleWindow(sampling_time_us);
+    return true;
+}
+
+void GradientConcurrencyLimiter::ResetSampleWindow(int64_t sampling_time_us) {
+    _sw.start_time_us = sampling_time_us;
+    _sw.succ_count = 0;
+    _sw.failed_count = 0;
+    _sw.total_failed_us = 0;
+    _sw.total_succ_us = 0;
+}
+
+void GradientConcurrencyLimiter::AdjustMaxConcurrency(
+    double next_max_concurrency) {
+    next_max_concurrency = std::max(
+        next_max_concurrency, (double)FLAGS_gradient_cl_min_concurrency);
+    next_max_concurrency = std::min(
+        next_max_concurrency, (double)FLAGS_gradient_cl_max_concurrency);
+    _raw_max_concurrency = next_max_concurrency;
+    _max_concurrency = std::ceil(next_max_concurrency);
+}
+
+void GradientConcurrencyLimiter::UpdateMaxConcurrency(
+    int64_t sampling_time_us) {
+    const double failed_punish =
+        _sw.total_failed_us * FLAGS_gradient_cl_fail_punish_ratio;
+    const double window_rtt_us =
+        (failed_punish + _sw.total_succ_us) / _sw.succ_count;
+
+    const double ema_factor = FLAGS_gradient_cl_alpha_factor_for_rtt_ema;
+    if (_smoothed_rtt_us <= 0) {
+        _smoothed_rtt_us = window_rtt_us;
+    } else {
+        _smoothed_rtt_us = window_rtt_us * ema_factor +
+            _smoothed_rtt_us * (1 - ema_factor);
+    }
+    // A long queue built up in previous overloaded windows keeps the
+    // long-term RTT inflated long after the load dropped, which would make
+    // the gradient read recovering latency as "fine". Drag it down quickly
+    // once the current window is far below it.
+    if (_smoothed_rtt_us > 2 * window_rtt_us) {
+        _smoothed_rtt_us = _smoothed_rtt_us * 0.95;
+    }
+
+    // Gradient of the long-term RTT against the latest window, clamped into
+    // [0.5, 1]: a window slower than tolerance * long-term RTT shrinks the
+    // limit proportionally(at most halving it), a window at or below it
+    // leaves the limit alone and lets the additive sqrt headroom below
+    // explore upwards.
+    double gradient = FLAGS_gradient_cl_tolerance * _smoothed_rtt_us /
+        window_rtt_us;
+    gradient = std::max(0.5, std::min(1.0, gradient));
+
+    // The sqrt term serves both as queueing headroom and as the additive
+    // increase probing whether the service can take more.
+    const double next_max_concurrency =
+        _raw_max_concurrency * gradient + std::sqrt(_raw_max_concurrency);
+    const double smooth = FLAGS_gradient_cl_adjust_smooth;
+    AdjustMaxConcurrency(_raw_max_concurrency * (1 - smooth) +
+                         next_max_concurrency * smooth);
+}
+
+}  // namespace policy
+}  // namespace brpc
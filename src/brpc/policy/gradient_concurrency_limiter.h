@@ -0,0 +1,89 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+#define BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
+
+#include "butil/macros.h"
+#include "brpc/concurrency_limiter.h"
+
+namespace brpc {
+namespace policy {
+
+// An alternative to AutoConcurrencyLimiter that adjusts max_concurrency
+// by the gradient between a long-term smoothed RTT and the RTT of the
+// latest sample window, instead of probing no-load latency by periodically
+// halving the limit. Without the remeasurement drops it produces a much
+// stabler limit for services whose latency distribution is bimodal or
+// fluctuates at low load. Select it with max_concurrency = "gradient".
+class GradientConcurrencyLimiter : public ConcurrencyLimiter {
+public:
+    GradientConcurrencyLimiter();
+
+    bool OnRequested(int current_concurrency, Controller*) override;
+
+    void OnResponded(int error_code, int64_t latency_us) override;
+
+    int MaxConcurrency() override;
+
+    int ResetMaxConcurrency(const AdaptiveMaxConcurrency&) override;
+
+    GradientConcurrencyLimiter* New(const AdaptiveMaxConcurrency&) const override;
+
+private:
+    struct SampleWindow {
+        SampleWindow()
+            : start_time_us(0)
+            , succ_count(0)
+            , failed_count(0)
+            , total_failed_us(0)
+            , total_succ_us(0) {}
+        int64_t start_time_us;
+        int32_t succ_count;
+        int32_t failed_count;
+        int64_t total_failed_us;
+        int64_t total_succ_us;
+    };
+
+    bool AddSample(int error_code, int64_t latency_us, int64_t sampling_time_us);
+
+    // The following methods are not thread safe and can only be called
+    // in AddSample()
+    void UpdateMaxConcurrency(int64_t sampling_time_us);
+    void ResetSampleWindow(int64_t sampling_time_us);
+    void AdjustMaxConcurrency(double next_max_concurrency);
+
+    // modified per sample-window or more
+    int _max_concurrency;
+    // The unsmoothed limit the gradient is applied to, kept as a double so
+    // that adjustments smaller than 1 are not lost between windows.
+    double _raw_max_concurrency;
+    // Long-term EMA of window latency, standing for the RTT the service
+    // delivers when it is not overloaded.
+    double _smoothed_rtt_us;
+
+    // modified per sample.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<int64_t> _last_sampling_time_us;
+    butil::Mutex _sw_mutex;
+    SampleWindow _sw;
+};
+
+}  // namespace policy
+}  // namespace brpc
+
+
+#endif // BRPC_POLICY_GRADIENT_CONCURRENCY_LIMITER_H
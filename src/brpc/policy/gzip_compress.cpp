@@ -16,16 +16,37 @@
 // under the License.
 
 
-#include <google/protobuf/io/gzip_stream.h>    // GzipXXXStream
+#include <zlib.h>
+#include <google/protobuf/io/gzip_stream.h>    // GzipOutputStream::Options
 #include <google/protobuf/text_format.h>
+#include <gflags/gflags.h>
 #include "butil/logging.h"
+#include "butil/thread_local.h"
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/protocol.h"
 #include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
 
 namespace brpc {
 namespace policy {
 
+DEFINE_int32(gzip_parallel_compress_threshold, 0,
+             "Compress gzip bodies not smaller than so many bytes by chunks "
+             "on multiple bthreads, 0 disables the feature. The output "
+             "consists of multiple concatenated gzip members which standard "
+             "decoders (and GzipDecompress in this file) handle, make sure "
+             "non-brpc receivers do before enabling this");
+BRPC_VALIDATE_GFLAG(gzip_parallel_compress_threshold, NonNegativeInteger);
+
+// Chunk size of parallel compression. Small enough to spread medium-sized
+// bodies over several workers, large enough to keep the per-member overhead
+// (~18 bytes of headers plus a flush of the window) negligible.
+static const size_t PARALLEL_COMPRESS_CHUNK_BYTES = 512 * 1024;
+
+// windowBits selecting the format, see deflateInit2() in zlib.h.
+static const int GZIP_WINDOW_BITS = 15 + 16;
+static const int ZLIB_WINDOW_BITS = 15;
+
 const char* Format2CStr(google::protobuf::io::GzipOutputStream::Format format) {
     switch (format) {
     case google::protobuf::io::GzipOutputStream::GZIP:
@@ -48,42 +69,488 @@ const char* Format2CStr(google::protobuf::io::GzipInputStream::Format format) {
     }
 }
 
+static const char* WindowBits2CStr(int window_bits) {
+    return window_bits == GZIP_WINDOW_BITS ? "gzip" : "zlib";
+}
+
+// deflateInit2() at the default settings allocates ~270K of internal state
+// and inflateInit2() another ~44K, costing microseconds per message. Keep
+// the streams in TLS and reuse them with deflateReset/inflateReset which
+// just rewind the state. Safe for bthreads: (de)compressions never suspend
+// in the middle, so they can't migrate to another worker while using the
+// streams.
+struct TlsZlibStreams {
+    z_stream deflater;
+    bool deflater_inited;
+    int deflater_window_bits;
+    int deflater_level;
+    int deflater_strategy;
+    z_stream inflater;
+    bool inflater_inited;
+    int inflater_window_bits;
+};
+static __thread TlsZlibStreams* tls_zlib_streams = NULL;
+
+static void DeleteTlsZlibStreams(void* arg) {
+    TlsZlibStreams* s = (TlsZlibStreams*)arg;
+    if (s->deflater_inited) {
+        deflateEnd(&s->deflater);
+    }
+    if (s->inflater_inited) {
+        inflateEnd(&s->inflater);
+    }
+    delete s;
+    tls_zlib_streams = NULL;
+}
+
+static TlsZlibStreams* GetTlsZlibStreams() {
+    if (tls_zlib_streams != NULL) {
+        return tls_zlib_streams;
+    }
+    TlsZlibStreams* s = new (std::nothrow) TlsZlibStreams;
+    if (NULL == s) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    butil::thread_atexit(DeleteTlsZlibStreams, s);
+    tls_zlib_streams = s;
+    return s;
+}
+
+static z_stream* GetDeflater(int window_bits, int level, int strategy) {
+    TlsZlibStreams* s = GetTlsZlibStreams();
+    if (NULL == s) {
+        return NULL;
+    }
+    if (s->deflater_inited) {
+        if (s->deflater_window_bits == window_bits &&
+            s->deflater_level == level &&
+            s->deflater_strategy == strategy) {
+            if (deflateReset(&s->deflater) == Z_OK) {
+                return &s->deflater;
+            }
+        }
+        deflateEnd(&s->deflater);
+        s->deflater_inited = false;
+    }
+    memset(&s->deflater, 0, sizeof(s->deflater));
+    if (deflateInit2(&s->deflater, level, Z_DEFLATED, window_bits,
+                     8/*default memLevel*/, strategy) != Z_OK) {
+        return NULL;
+    }
+    s->deflater_inited = true;
+    s->deflater_window_bits = window_bits;
+    s->deflater_level = level;
+    s->deflater_strategy = strategy;
+    return &s->deflater;
+}
+
+static z_stream* GetInflater(int window_bits) {
+    TlsZlibStreams* s = GetTlsZlibStreams();
+    if (NULL == s) {
+        return NULL;
+    }
+    if (s->inflater_inited) {
+        if (s->inflater_window_bits == window_bits &&
+            inflateReset(&s->inflater) == Z_OK) {
+            return &s->inflater;
+        }
+        inflateEnd(&s->inflater);
+        s->inflater_inited = false;
+    }
+    memset(&s->inflater, 0, sizeof(s->inflater));
+    if (inflateInit2(&s->inflater, window_bits) != Z_OK) {
+        return NULL;
+    }
+    s->inflater_inited = true;
+    s->inflater_window_bits = window_bits;
+    return &s->inflater;
+}
+
+static bool DeflateIOBuf(const butil::IOBuf& in, butil::IOBuf* out,
+                         int window_bits, int level, int strategy) {
+    z_stream* strm = GetDeflater(window_bits, level, strategy);
+    if (NULL == strm) {
+        LOG(WARNING) << "Fail to get a deflate stream, format="
+                     << WindowBits2CStr(window_bits);
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream src(in);
+    butil::IOBufAsZeroCopyOutputStream dst(out);
+    strm->next_in = NULL;
+    strm->avail_in = 0;
+    strm->next_out = NULL;
+    strm->avail_out = 0;
+    bool read_done = false;
+    while (true) {
+        if (strm->avail_in == 0 && !read_done) {
+            const void* data = NULL;
+            int size = 0;
+            if (src.Next(&data, &size)) {
+                strm->next_in = (Bytef*)data;
+                strm->avail_in = size;
+            } else {
+                read_done = true;
+            }
+        }
+        if (strm->avail_out == 0) {
+            void* data = NULL;
+            int size = 0;
+            if (!dst.Next(&data, &size)) {
+                LOG(WARNING) << "Fail to allocate output of deflate";
+                return false;
+            }
+            strm->next_out = (Bytef*)data;
+            strm->avail_out = size;
+        }
+        const int rc = deflate(strm, read_done ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            break;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            LOG(WARNING) << "Fail to deflate, format="
+                         << WindowBits2CStr(window_bits) << " : "
+                         << (strm->msg ? strm->msg : zError(rc));
+            return false;
+        }
+    }
+    if (strm->avail_out > 0) {
+        dst.BackUp(strm->avail_out);
+    }
+    return true;
+}
+
+static bool InflateIOBuf(const butil::IOBuf& in, butil::IOBuf* out,
+                         int window_bits) {
+    z_stream* strm = GetInflater(window_bits);
+    if (NULL == strm) {
+        LOG(WARNING) << "Fail to get an inflate stream, format="
+                     << WindowBits2CStr(window_bits);
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream src(in);
+    butil::IOBufAsZeroCopyOutputStream dst(out);
+    strm->next_in = NULL;
+    strm->avail_in = 0;
+    strm->next_out = NULL;
+    strm->avail_out = 0;
+    bool read_done = false;
+    while (true) {
+        if (strm->avail_in == 0 && !read_done) {
+            const void* data = NULL;
+            int size = 0;
+            if (src.Next(&data, &size)) {
+                strm->next_in = (Bytef*)data;
+                strm->avail_in = size;
+            } else {
+                read_done = true;
+            }
+        }
+        if (strm->avail_out == 0) {
+            void* data = NULL;
+            int size = 0;
+            if (!dst.Next(&data, &size)) {
+                LOG(WARNING) << "Fail to allocate output of inflate";
+                return false;
+            }
+            strm->next_out = (Bytef*)data;
+            strm->avail_out = size;
+        }
+        const int rc = inflate(strm, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            // The input may be a concatenation of independently compressed
+            // members(e.g. produced by the parallel mode below), continue
+            // with a fresh stream as long as input remains.
+            if (strm->avail_in == 0) {
+                const void* data = NULL;
+                int size = 0;
+                if (read_done || !src.Next(&data, &size)) {
+                    break;
+                }
+                strm->next_in = (Bytef*)data;
+                strm->avail_in = size;
+            }
+            if (inflateReset(strm) != Z_OK) {
+                LOG(WARNING) << "Fail to inflateReset";
+                return false;
+            }
+            continue;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            LOG(WARNING) << "Fail to inflate, format="
+                         << WindowBits2CStr(window_bits) << " : "
+                         << (strm->msg ? strm->msg : zError(rc));
+            return false;
+        }
+        if (read_done && strm->avail_in == 0) {
+            LOG(WARNING) << "Fail to inflate, format="
+                         << WindowBits2CStr(window_bits)
+                         << " : the input is truncated";
+            return false;
+        }
+    }
+    if (strm->avail_out > 0) {
+        dst.BackUp(strm->avail_out);
+    }
+    return true;
+}
+
+// Size of the output window handed to the parser per Next(). Small enough
+// to stay cache-resident while inflation and parsing pipeline, large
+// enough to keep per-call overhead negligible.
+static const size_t INFLATE_STREAM_CHUNK_BYTES = 16 * 1024;
+
+// Inflates compressed input lazily as the consumer pulls, so that
+// decompression and protobuf parsing pipeline through cache-sized chunks
+// instead of materializing the whole decompressed body up-front.
+class InflatingInputStream : public google::protobuf::io::ZeroCopyInputStream {
+public:
+    // `reuse_tls_stream' borrows the thread-local inflater and must only
+    // be true when the consumer cannot suspend the bthread between Next()
+    // calls, otherwise a private stream is initialized(and freed in dtor).
+    InflatingInputStream(const butil::IOBuf& in, int window_bits,
+                         bool reuse_tls_stream);
+    ~InflatingInputStream();
+
+    // @ZeroCopyInputStream
+    bool Next(const void** data, int* size) override;
+    void BackUp(int count) override;
+    bool Skip(int count) override;
+    google::protobuf::int64 ByteCount() const override { return _byte_count; }
+
+    // True if the constructor got a usable inflate stream.
+    bool initialized() const { return _strm != NULL; }
+    // True if inflation failed, which also makes Next() return false.
+    bool failed() const { return _failed; }
+
+private:
+    z_stream* _strm;
+    z_stream _own_strm;
+    bool _own_inited;
+    butil::IOBufAsZeroCopyInputStream _src;
+    int _window_bits;
+    bool _read_done;      // all compressed input consumed
+    bool _inflate_done;   // stream ended cleanly
+    bool _failed;
+    int _buf_bytes;       // bytes returned by the last fresh Next()
+    int _backup_count;
+    google::protobuf::int64 _byte_count;
+    char _buf[INFLATE_STREAM_CHUNK_BYTES];
+};
+
+InflatingInputStream::InflatingInputStream(const butil::IOBuf& in,
+                                           int window_bits,
+                                           bool reuse_tls_stream)
+    : _strm(NULL)
+    , _own_inited(false)
+    , _src(in)
+    , _window_bits(window_bits)
+    , _read_done(false)
+    , _inflate_done(false)
+    , _failed(false)
+    , _buf_bytes(0)
+    , _backup_count(0)
+    , _byte_count(0) {
+    if (reuse_tls_stream) {
+        _strm = GetInflater(window_bits);
+    } else {
+        memset(&_own_strm, 0, sizeof(_own_strm));
+        if (inflateInit2(&_own_strm, window_bits) == Z_OK) {
+            _own_inited = true;
+            _strm = &_own_strm;
+        }
+    }
+    if (NULL == _strm) {
+        LOG(WARNING) << "Fail to get an inflate stream, format="
+                     << WindowBits2CStr(window_bits);
+    } else {
+        _strm->next_in = NULL;
+        _strm->avail_in = 0;
+    }
+}
+
+InflatingInputStream::~InflatingInputStream() {
+    if (_own_inited) {
+        inflateEnd(&_own_strm);
+    }
+}
+
+bool InflatingInputStream::Next(const void** data, int* size) {
+    if (_backup_count > 0) {
+        *data = _buf + _buf_bytes - _backup_count;
+        *size = _backup_count;
+        _byte_count += _backup_count;
+        _backup_count = 0;
+        return true;
+    }
+    if (NULL == _strm || _failed || _inflate_done) {
+        return false;
+    }
+    _strm->next_out = (Bytef*)_buf;
+    _strm->avail_out = sizeof(_buf);
+    while (_strm->avail_out > 0 && !_inflate_done) {
+        if (_strm->avail_in == 0 && !_read_done) {
+            const void* in_data = NULL;
+            int in_size = 0;
+            if (_src.Next(&in_data, &in_size)) {
+                _strm->next_in = (Bytef*)in_data;
+                _strm->avail_in = in_size;
+            } else {
+                _read_done = true;
+            }
+        }
+        const int rc = inflate(_strm, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            // The input may be a concatenation of independently compressed
+            // members(e.g. produced by the parallel mode above), continue
+            // with a fresh stream as long as input remains.
+            if (_strm->avail_in == 0) {
+                const void* in_data = NULL;
+                int in_size = 0;
+                if (_read_done || !_src.Next(&in_data, &in_size)) {
+                    _inflate_done = true;
+                    break;
+                }
+                _strm->next_in = (Bytef*)in_data;
+                _strm->avail_in = in_size;
+            }
+            if (inflateReset(_strm) != Z_OK) {
+                LOG(WARNING) << "Fail to inflateReset";
+                _failed = true;
+                return false;
+            }
+            continue;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            LOG(WARNING) << "Fail to inflate, format="
+                         << WindowBits2CStr(_window_bits) << " : "
+                         << (_strm->msg ? _strm->msg : zError(rc));
+            _failed = true;
+            return false;
+        }
+        if (_read_done && _strm->avail_in == 0 && _strm->avail_out > 0) {
+            LOG(WARNING) << "Fail to inflate, format="
+                         << WindowBits2CStr(_window_bits)
+                         << " : the input is truncated";
+            _failed = true;
+            return false;
+        }
+    }
+    _buf_bytes = (int)(sizeof(_buf) - _strm->avail_out);
+    if (0 == _buf_bytes) {
+        return false;
+    }
+    *data = _buf;
+    *size = _buf_bytes;
+    _byte_count += _buf_bytes;
+    return true;
+}
+
+void InflatingInputStream::BackUp(int count) {
+    CHECK(count >= 0 && count + _backup_count <= _buf_bytes)
+        << "Invalid count=" << count;
+    _backup_count += count;
+    _byte_count -= count;
+}
+
+bool InflatingInputStream::Skip(int count) {
+    while (count > 0) {
+        const void* data = NULL;
+        int size = 0;
+        if (!Next(&data, &size)) {
+            return false;
+        }
+        if (size > count) {
+            BackUp(size - count);
+            return true;
+        }
+        count -= size;
+    }
+    return true;
+}
+
+// Compress one chunk into a standalone gzip member with default settings,
+// suitable for concatenation by ParallelCompress().
+static bool GzipCompressChunk(const butil::IOBuf& in, butil::IOBuf* out) {
+    return DeflateIOBuf(in, out, GZIP_WINDOW_BITS, Z_DEFAULT_COMPRESSION,
+                        Z_DEFAULT_STRATEGY);
+}
+
+bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
+                  const GzipCompressOptions* options_in) {
+    int window_bits = GZIP_WINDOW_BITS;
+    int level = Z_DEFAULT_COMPRESSION;
+    int strategy = Z_DEFAULT_STRATEGY;
+    if (options_in != NULL) {
+        if (options_in->format ==
+            google::protobuf::io::GzipOutputStream::ZLIB) {
+            window_bits = ZLIB_WINDOW_BITS;
+        }
+        level = options_in->compression_level;
+        strategy = options_in->compression_strategy;
+    }
+    if (window_bits == GZIP_WINDOW_BITS &&
+        level == Z_DEFAULT_COMPRESSION &&
+        strategy == Z_DEFAULT_STRATEGY &&
+        FLAGS_gzip_parallel_compress_threshold > 0 &&
+        msg.size() >= (size_t)FLAGS_gzip_parallel_compress_threshold) {
+        return ParallelCompress(msg, buf, PARALLEL_COMPRESS_CHUNK_BYTES,
+                                GzipCompressChunk);
+    }
+    return DeflateIOBuf(msg, buf, window_bits, level, strategy);
+}
+
 static bool Compress(const google::protobuf::Message& msg, butil::IOBuf* buf,
                      google::protobuf::io::GzipOutputStream::Format format) {
-    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
-    GzipCompressOptions options;
-    options.format = format;
-    google::protobuf::io::GzipOutputStream gzip(&wrapper, options);
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
     bool ok;
     if (msg.GetDescriptor() == Serializer::descriptor()) {
-        ok = ((const Serializer&)msg).SerializeTo(&gzip);
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
     } else {
-        ok = msg.SerializeToZeroCopyStream(&gzip);
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
     }
     if (!ok) {
         LOG(WARNING) << "Fail to serialize input message="
                      << msg.GetDescriptor()->full_name()
-                     << ", format=" << Format2CStr(format) << " : "
-                     << (NULL == gzip.ZlibErrorMessage() ? "" : gzip.ZlibErrorMessage());
+                     << ", format=" << Format2CStr(format);
+        return false;
     }
-    return ok && gzip.Close();
+    GzipCompressOptions options;
+    options.format = format;
+    return GzipCompress(serialized_pb, buf, &options);
 }
 
 static bool Decompress(const butil::IOBuf& data, google::protobuf::Message* msg,
                        google::protobuf::io::GzipInputStream::Format format) {
-    butil::IOBufAsZeroCopyInputStream wrapper(data);
-    google::protobuf::io::GzipInputStream gzip(&wrapper, format);
+    const int window_bits =
+        format == google::protobuf::io::GzipInputStream::ZLIB
+        ? ZLIB_WINDOW_BITS : GZIP_WINDOW_BITS;
+    const bool is_deserializer =
+        msg->GetDescriptor() == Deserializer::descriptor();
+    // Feed the parser directly from the inflater instead of inflating the
+    // whole payload first, halving peak memory and overlapping the two
+    // passes. Plain protobuf parsing never suspends the bthread between
+    // pulls so it may borrow the thread-local inflater; custom deserializer
+    // callbacks might block and get a private stream.
+    InflatingInputStream stream(data, window_bits, !is_deserializer);
+    if (!stream.initialized()) {
+        return false;
+    }
     bool ok;
-    if (msg->GetDescriptor() == Deserializer::descriptor()) {
-        ok = ((Deserializer*)msg)->DeserializeFrom(&gzip);
+    if (is_deserializer) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
     } else {
-        ok = msg->ParseFromZeroCopyStream(&gzip);
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (stream.failed()) {
+        // The inflation error was already logged in Next().
+        return false;
     }
     if (!ok) {
         LOG(WARNING) << "Fail to deserialize input message="
                      << msg->GetDescriptor()->full_name()
-                     << ", format=" << Format2CStr(format) << " : "
-                     << (NULL == gzip.ZlibErrorMessage() ? "" : gzip.ZlibErrorMessage());
+                     << ", format=" << Format2CStr(format);
     }
     return ok;
 }
@@ -96,85 +563,6 @@ bool GzipDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
     return Decompress(data, msg, google::protobuf::io::GzipInputStream::GZIP);
 }
 
-bool GzipCompress(const butil::IOBuf& msg, butil::IOBuf* buf,
-                  const GzipCompressOptions* options_in) {
-    butil::IOBufAsZeroCopyOutputStream wrapper(buf);
-    GzipCompressOptions gzip_opt;
-    if (options_in) {
-        gzip_opt = *options_in;
-    }
-    google::protobuf::io::GzipOutputStream out(&wrapper, gzip_opt);
-    butil::IOBufAsZeroCopyInputStream in(msg);
-    const void* data_in = NULL;
-    int size_in = 0;
-    void* data_out = NULL;
-    int size_out = 0;
-    while (1) {
-        if (size_out == 0 && !out.Next(&data_out, &size_out)) {
-            break;
-        }
-        if (size_in == 0 && !in.Next(&data_in, &size_in)) {
-            break;
-        }
-        const int size_cp = std::min(size_in, size_out);
-        memcpy(data_out, data_in, size_cp);
-        size_in -= size_cp;
-        data_in = (char*)data_in + size_cp;
-        size_out -= size_cp;
-        data_out = (char*)data_out + size_cp;
-    }
-    if (size_in != 0 || (size_t)in.ByteCount() != msg.size()) {
-        // If any stage is not fully consumed, something went wrong.
-        LOG(WARNING) << "Fail to compress, format=" << Format2CStr(gzip_opt.format)
-                     << " : " << out.ZlibErrorMessage();
-        return false;
-    }
-    if (size_out != 0) {
-        out.BackUp(size_out);
-    }
-    return out.Close();
-}
-
-inline bool GzipDecompressBase(
-    const butil::IOBuf& data, butil::IOBuf* msg,
-    google::protobuf::io::GzipInputStream::Format format) {
-    butil::IOBufAsZeroCopyInputStream wrapper(data);
-    google::protobuf::io::GzipInputStream in(&wrapper, format);
-    butil::IOBufAsZeroCopyOutputStream out(msg);
-    const void* data_in = NULL;
-    int size_in = 0;
-    void* data_out = NULL;
-    int size_out = 0;
-    while (1) {
-        if (size_out == 0 && !out.Next(&data_out, &size_out)) {
-            break;
-        }
-        if (size_in == 0 && !in.Next(&data_in, &size_in)) {
-            break;
-        }
-        const int size_cp = std::min(size_in, size_out);
-        memcpy(data_out, data_in, size_cp);
-        size_in -= size_cp;
-        data_in = (char*)data_in + size_cp;
-        size_out -= size_cp;
-        data_out = (char*)data_out + size_cp;
-    }
-    if (size_in != 0 ||
-        (size_t)wrapper.ByteCount() != data.size() ||
-        in.Next(&data_in, &size_in)) {
-        // If any stage is not fully consumed, something went wrong.
-        // Here we call in.Next addtitionally to make sure that the gzip
-        // "blackbox" does not have buffer left.
-        LOG(WARNING) << "Fail to decompress, format=" << Format2CStr(format)
-                     << " : " << in.ZlibErrorMessage();
-        return false;
-    }
-    if (size_out != 0) {
-        out.BackUp(size_out);
-    }
-    return true;
-}
-
 bool ZlibCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
     return Compress(msg, buf, google::protobuf::io::GzipOutputStream::ZLIB);
 }
@@ -185,13 +573,11 @@ bool ZlibDecompress(const butil::IOBuf& data,
 }
 
 bool GzipDecompress(const butil::IOBuf& data, butil::IOBuf* msg) {
-    return GzipDecompressBase(
-        data, msg, google::protobuf::io::GzipInputStream::GZIP);
+    return InflateIOBuf(data, msg, GZIP_WINDOW_BITS);
 }
 
 bool ZlibDecompress(const butil::IOBuf& data, butil::IOBuf* msg) {
-    return GzipDecompressBase(
-        data, msg, google::protobuf::io::GzipInputStream::ZLIB);
+    return InflateIOBuf(data, msg, ZLIB_WINDOW_BITS);
 }
 
 }  // namespace policy
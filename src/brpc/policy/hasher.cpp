@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <openssl/md5.h>
 #include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/third_party/wyhash/wyhash.h"
 #include "brpc/policy/hasher.h"
 
 
@@ -73,6 +74,22 @@ uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys) {
     return hash;
 }
 
+uint32_t WyHash32(const void* key, size_t len) {
+    const uint64_t h = butil::wyhash(key, len, 0);
+    // Folding both halves keeps all 64 bits involved.
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+uint32_t WyHash32V(const butil::StringPiece* keys, size_t num_keys) {
+    // Chain the 64-bit result of each piece as the seed of the next one,
+    // same technique as combining rounds inside wyhash itself.
+    uint64_t h = 0;
+    for (size_t i = 0; i < num_keys; ++i) {
+        h = butil::wyhash(keys[i].data(), keys[i].size(), h);
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
 /* The crc32 functions and data was originally written by Spencer
  * Garrett <srg@quick.com> and was gleaned from the PostgreSQL source
  * tree via the files contrib/ltree/crc32.[ch] and from FreeBSD at
@@ -163,6 +180,9 @@ const char *GetHashName(HashFunc hasher) {
     if (hasher == CRCHash32) {
         return "crc32";
     }
+    if (hasher == WyHash32) {
+        return "wyhash";
+    }
 
     return "user_defined";
 }
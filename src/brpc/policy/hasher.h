@@ -36,6 +36,13 @@ uint32_t MD5Hash32V(const butil::StringPiece* keys, size_t num_keys);
 uint32_t MurmurHash32(const void* key, size_t len);
 uint32_t MurmurHash32V(const butil::StringPiece* keys, size_t num_keys);
 
+// Several times faster than MurmurHash32 on short keys (powered by wyhash,
+// see butil/third_party/wyhash). Produces different values than the hashers
+// above, thus a different ring placement: selectable as lb=c_wyhash but NOT
+// a drop-in replacement on an existing c_murmurhash deployment.
+uint32_t WyHash32(const void* key, size_t len);
+uint32_t WyHash32V(const butil::StringPiece* keys, size_t num_keys);
+
 }  // namespace policy
 } // namespace brpc
 
@@ -17,6 +17,7 @@
 
 
 #include "brpc/policy/http2_rpc_protocol.h"
+#include "butil/time.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/server.h"
 #include "butil/base64.h"
@@ -42,6 +43,13 @@ DEFINE_int32(h2_client_max_frame_size,
              H2Settings::DEFAULT_MAX_FRAME_SIZE,
              "Size of the largest frame payload that client is willing to receive");
 
+DEFINE_int32(h2_stream_write_quantum, 256 * 1024,
+             "Max bytes of one stream's DATA appended to the connection per "
+             "write pass. The tail of a larger message is interleaved "
+             "round-robin with DATA of other streams so that bulk streams "
+             "don't starve small RPCs sharing the connection. 0 appends "
+             "messages in one piece regardless of their sizes");
+
 DEFINE_bool(h2_hpack_encode_name, false,
             "Encode name in HTTP2 headers with huffman encoding");
 DEFINE_bool(h2_hpack_encode_value, false,
@@ -51,12 +59,25 @@ static bool CheckStreamWindowSize(const char*, int32_t val) {
     return val >= 0;
 }
 BRPC_VALIDATE_GFLAG(h2_client_stream_window_size, CheckStreamWindowSize);
+BRPC_VALIDATE_GFLAG(h2_stream_write_quantum, NonNegativeInteger);
 
 static bool CheckConnWindowSize(const char*, int32_t val) {
     return val >= (int32_t)H2Settings::DEFAULT_INITIAL_WINDOW_SIZE;
 }
 BRPC_VALIDATE_GFLAG(h2_client_connection_window_size, CheckConnWindowSize);
 
+DEFINE_bool(h2_window_auto_tune, false,
+            "Grow stream/connection-level windows of h2 connections "
+            "automatically towards the bandwidth-delay product measured by "
+            "PING-based probes, so that long-fat links are not capped by the "
+            "initial window sizes");
+DEFINE_int32(h2_max_auto_window_size, 16 * 1024 * 1024,
+             "Limit of the stream-level window grown by -h2_window_auto_tune");
+static bool CheckMaxAutoWindowSize(const char*, int32_t val) {
+    return val > 0 && (uint32_t)val <= H2Settings::MAX_WINDOW_SIZE;
+}
+BRPC_VALIDATE_GFLAG(h2_max_auto_window_size, CheckMaxAutoWindowSize);
+
 const char* H2StreamState2Str(H2StreamState s) {
     switch (s) {
     case H2_STREAM_IDLE: return "idle";
@@ -116,6 +137,11 @@ const uint8_t H2_FLAGS_END_HEADERS = 0x4;
 const uint8_t H2_FLAGS_PADDED = 0x8;
 const uint8_t H2_FLAGS_PRIORITY = 0x20;
 
+// Opaque data of the PINGs probing BDP, distinguishing their acks from acks
+// to PINGs sent by others.
+static const char BDP_PING_DATA[8] =
+    { 'b', 'd', 'p', 'p', 'r', 'o', 'b', 'e' };
+
 #define H2_CONNECTION_PREFACE_PREFIX "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
 const size_t H2_CONNECTION_PREFACE_PREFIX_SIZE = 24;
 
@@ -331,7 +357,9 @@ H2Context::H2Context(Socket* socket, const Server* server)
     , _last_sent_stream_id(1)
     , _goaway_stream_id(-1)
     , _remote_settings_received(false)
-    , _deferred_window_update(0) {
+    , _deferred_window_update(0)
+    , _bdp_ping_sent_us(0)
+    , _bdp_bytes_acc(0) {
     // Stop printing the field which is useless for remote settings.
     _remote_settings.connection_window_size = 0;
     // Maximize the window size to make sending big request possible before
@@ -345,6 +373,7 @@ H2Context::H2Context(Socket* socket, const Server* server)
         _unack_local_settings.max_frame_size = FLAGS_h2_client_max_frame_size;
         _unack_local_settings.connection_window_size = FLAGS_h2_client_connection_window_size;
     }
+    _local_conn_window_size = _unack_local_settings.connection_window_size;
 #if defined(UNIT_TEST)
     // In ut, we hope _last_sent_stream_id run out quickly to test the correctness
     // of creating new h2 socket. This value is 10,000 less than 0x7FFFFFFF.
@@ -711,6 +740,8 @@ H2ParseResult H2Context::OnData(
     frag_size -= pad_length;
     H2StreamContext* sctx = FindStream(frame_head.stream_id);
     if (sctx == NULL) {
+        // The whole payload(including padding) is flow-controlled.
+        MaybeStartBdpProbe(frame_head.payload_size);
         // If a DATA frame is received whose stream is not in "open" or "half-closed (local)" state,
         // the recipient MUST respond with a stream error (Section 5.4.2) of type STREAM_CLOSED.
         // Ignore the message without closing the socket.
@@ -722,16 +753,56 @@ H2ParseResult H2Context::OnData(
         LOG(ERROR) << "Fail to find stream_id=" << frame_head.stream_id;
         return MakeH2Error(H2_STREAM_CLOSED_ERROR, frame_head.stream_id);
     }
-    return sctx->OnData(it, frame_head, frag_size, pad_length);
+    // Coalesce the following complete unpadded DATA frames of the same
+    // stream into this dispatch. gRPC bursts often deliver dozens of small
+    // DATA frames per read; ingesting them in one pass amortizes the
+    // stream-map probe, BDP probing and flow-control bookkeeping across
+    // the burst. Only the last frame of a batch may carry END_STREAM.
+    butil::IOBuf data;
+    it.append_and_forward(&data, frag_size);
+    it.forward(pad_length);
+    uint8_t last_flags = frame_head.flags;
+    uint64_t total_payload = frame_head.payload_size;
+    uint64_t total_frag = frag_size;
+    size_t nframes = 1;
+    while (pad_length == 0 && !(last_flags & H2_FLAGS_END_STREAM)) {
+        butil::IOBufBytesIterator peek(it);
+        H2FrameHead next_head;
+        if (!ConsumeFrameHead(peek, &next_head).is_ok() ||
+            next_head.type != H2_FRAME_DATA ||
+            next_head.stream_id != frame_head.stream_id ||
+            (next_head.flags & H2_FLAGS_PADDED)) {
+            // Not a mergeable frame(or incomplete/invalid), leave it to the
+            // next round of Consume.
+            break;
+        }
+        // The whole frame is in the buffer, consume it for real.
+        it.forward(FRAME_HEAD_SIZE);
+        it.append_and_forward(&data, next_head.payload_size);
+        last_flags = next_head.flags;
+        total_payload += next_head.payload_size;
+        total_frag += next_head.payload_size;
+        ++nframes;
+    }
+    // The whole payload(including padding) is flow-controlled.
+    MaybeStartBdpProbe(total_payload);
+    return sctx->OnData(data, last_flags, total_payload, total_frag, nframes);
 }
 
 H2ParseResult H2StreamContext::OnData(
     butil::IOBufBytesIterator& it, const H2FrameHead& frame_head,
     uint32_t frag_size, uint8_t pad_length) {
-    _parsed_length += FRAME_HEAD_SIZE + frame_head.payload_size;
     butil::IOBuf data;
     it.append_and_forward(&data, frag_size);
     it.forward(pad_length);
+    return OnData(data, frame_head.flags, frame_head.payload_size,
+                  frag_size, 1);
+}
+
+H2ParseResult H2StreamContext::OnData(
+    butil::IOBuf& data, uint8_t last_frame_flags, uint64_t total_payload,
+    uint64_t total_frag, size_t nframes) {
+    _parsed_length += nframes * FRAME_HEAD_SIZE + total_payload;
     for (size_t i = 0; i < data.backing_block_num(); ++i) {
         const butil::StringPiece blk = data.backing_block(i);
         if (OnBody(blk.data(), blk.size()) != 0) {
@@ -740,8 +811,8 @@ H2ParseResult H2StreamContext::OnData(
         }
     }
 
-    int64_t acc = frag_size +
-        _deferred_window_update.fetch_add(frag_size, butil::memory_order_relaxed);
+    int64_t acc = total_frag +
+        _deferred_window_update.fetch_add(total_frag, butil::memory_order_relaxed);
     int64_t quota = static_cast<int64_t>(
         _conn_ctx->local_settings().stream_window_size /
         (_conn_ctx->VolatilePendingStreamSize() + 1));
@@ -749,7 +820,7 @@ H2ParseResult H2StreamContext::OnData(
     if (acc >= quota) {
         if (acc > _conn_ctx->local_settings().stream_window_size) {
             LOG(ERROR) << "Fail to satisfy the stream-level flow control policy";
-            return MakeH2Error(H2_FLOW_CONTROL_ERROR, frame_head.stream_id);
+            return MakeH2Error(H2_FLOW_CONTROL_ERROR, stream_id());
         }
         // Rarely happen for small messages.
         const int64_t stream_wu =
@@ -772,7 +843,7 @@ H2ParseResult H2StreamContext::OnData(
             }
         }
     }
-    if (frame_head.flags & H2_FLAGS_END_STREAM) {
+    if (last_frame_flags & H2_FLAGS_END_STREAM) {
         return OnEndStream();
     }
     return MakeH2Message(NULL);
@@ -889,6 +960,10 @@ H2ParseResult H2Context::OnSettings(
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
     }
+    // Our encoding dynamic table must not outgrow the peer's decoder table,
+    // otherwise indexed headers would desync both sides. The new bound is
+    // applied (with a Dynamic Table Size Update) at the next header block.
+    _hpacker.SetRemoteTableSizeLimit(_remote_settings.header_table_size);
     const int64_t window_diff =
         static_cast<int64_t>(_remote_settings.stream_window_size)
         - old_stream_window_size;
@@ -938,9 +1013,14 @@ H2ParseResult H2Context::OnPing(
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
     if (frame_head.flags & H2_FLAGS_ACK) {
+        char pingdata[8];
+        it.copy_and_forward(pingdata, sizeof(pingdata));
+        if (memcmp(pingdata, BDP_PING_DATA, sizeof(pingdata)) == 0) {
+            OnBdpPingAck();
+        }
         return MakeH2Message(NULL);
     }
-    
+
     char pongbuf[FRAME_HEAD_SIZE + 8];
     SerializeFrameHead(pongbuf, 8, H2_FRAME_PING, H2_FLAGS_ACK, 0);
     it.copy_and_forward(pongbuf + FRAME_HEAD_SIZE, 8);
@@ -1061,8 +1141,14 @@ void H2Context::Describe(std::ostream& os, const DescribeOptions& opt) const {
         BAIDU_SCOPED_LOCK(_abandoned_streams_mutex);
         abandoned_size = _abandoned_streams.size();
     }
+    size_t interleaving_size = 0;
+    {
+        BAIDU_SCOPED_LOCK(_pending_data_mutex);
+        interleaving_size = _pending_data.size();
+    }
     os << sep << "abandoned_streams=" << abandoned_size
-       << sep << "pending_streams=" << VolatilePendingStreamSize();
+       << sep << "pending_streams=" << VolatilePendingStreamSize()
+       << sep << "interleaving_streams=" << interleaving_size;
     if (opt.verbose) {
         os << '\n';
     }
@@ -1094,6 +1180,90 @@ void H2Context::DeferWindowUpdate(int64_t size) {
     }
 }
 
+// Probe the bandwidth-delay product of the connection with PING: the data
+// received between sending the PING and receiving its ack is a lower bound
+// of BDP. When a sample gets close to the current window, the window is
+// probably the limiting factor of the transfer, announce larger windows:
+// the stream-level one by a SETTINGS frame, whose INITIAL_WINDOW_SIZE also
+// applies to established streams at the peer(section 6.9.2 of rfc7540), the
+// connection-level one by a WINDOW_UPDATE. Quotas in DeferWindowUpdate and
+// H2StreamContext::OnData scale with the window, thus WINDOW_UPDATEs sent
+// back for consumed data are batched more aggressively as well.
+void H2Context::MaybeStartBdpProbe(int64_t data_size) {
+    if (!FLAGS_h2_window_auto_tune) {
+        return;
+    }
+    if (_bdp_ping_sent_us != 0) { // probe in flight
+        _bdp_bytes_acc += data_size;
+        return;
+    }
+    if ((int64_t)_unack_local_settings.stream_window_size >=
+        FLAGS_h2_max_auto_window_size) { // already maximized
+        return;
+    }
+    char pingbuf[FRAME_HEAD_SIZE + 8];
+    SerializeFrameHead(pingbuf, 8, H2_FRAME_PING, 0, 0);
+    memcpy(pingbuf + FRAME_HEAD_SIZE, BDP_PING_DATA, sizeof(BDP_PING_DATA));
+    if (WriteAck(_socket, pingbuf, sizeof(pingbuf)) != 0) {
+        LOG(WARNING) << "Fail to send PING to " << *_socket;
+        return;
+    }
+    _bdp_ping_sent_us = butil::gettimeofday_us();
+    _bdp_bytes_acc = data_size;
+}
+
+void H2Context::OnBdpPingAck() {
+    if (_bdp_ping_sent_us == 0) {
+        return;
+    }
+    const int64_t bdp = _bdp_bytes_acc;
+    const int64_t rtt_us = butil::gettimeofday_us() - _bdp_ping_sent_us;
+    _bdp_ping_sent_us = 0;
+    _bdp_bytes_acc = 0;
+    const int64_t cur_size = _unack_local_settings.stream_window_size;
+    if (bdp * 3 < cur_size * 2) {
+        // The peer did not fill 2/3 of the window within one RTT, the window
+        // is not the bottleneck.
+        return;
+    }
+    // Double the window(bounded) and let following probes decide whether to
+    // grow further.
+    int64_t new_size = cur_size * 2;
+    if (new_size > FLAGS_h2_max_auto_window_size) {
+        new_size = FLAGS_h2_max_auto_window_size;
+    }
+    if (new_size <= cur_size) {
+        return;
+    }
+    _unack_local_settings.stream_window_size = new_size;
+    // _local_settings is replaced when the ack to this SETTINGS arrives,
+    // which is ahead of any data sent under the larger window, so the
+    // flow-control checks in H2StreamContext::OnData stay correct.
+    char buf[FRAME_HEAD_SIZE + H2_SETTINGS_MAX_BYTE_SIZE + FRAME_HEAD_SIZE + 4];
+    const size_t nb = SerializeH2Settings(_unack_local_settings, buf + FRAME_HEAD_SIZE);
+    SerializeFrameHead(buf, nb, H2_FRAME_SETTINGS, 0, 0);
+    size_t total = FRAME_HEAD_SIZE + nb;
+    // Keep the connection-level window above stream-level ones so that one
+    // busy stream does not use it up(same 4:1 ratio as the default flags).
+    int64_t conn_target = new_size * 4;
+    if (conn_target > (int64_t)H2Settings::MAX_WINDOW_SIZE) {
+        conn_target = H2Settings::MAX_WINDOW_SIZE;
+    }
+    if (conn_target > _local_conn_window_size) {
+        SerializeFrameHead(buf + total, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+        SaveUint32(buf + total + FRAME_HEAD_SIZE,
+                   conn_target - _local_conn_window_size);
+        total += FRAME_HEAD_SIZE + 4;
+        _local_conn_window_size = conn_target;
+    }
+    if (WriteAck(_socket, buf, total) != 0) {
+        LOG(WARNING) << "Fail to enlarge windows of " << *_socket;
+        return;
+    }
+    RPC_VLOG << "Enlarged stream_window_size=" << new_size << " of "
+             << *_socket << " from bdp=" << bdp << " rtt_us=" << rtt_us;
+}
+
 #if defined(BRPC_PROFILE_H2)
 bvar::Adder<int64_t> g_parse_time;
 bvar::PerSecond<bvar::Adder<int64_t> > g_parse_time_per_second(
@@ -1307,17 +1477,21 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
 
 const CommonStrings* get_common_strings();
 
+// When `end_stream' is false the message is not complete: the tail of its
+// data (and trailers) were stashed by StashPendingData() and no frame packed
+// here may carry END_STREAM.
 static void PackH2Message(butil::IOBuf* out,
                           butil::IOBuf& headers,
                           butil::IOBuf& trailer_headers,
                           const butil::IOBuf& data,
                           int stream_id,
-                          H2Context* conn_ctx) {
+                          H2Context* conn_ctx,
+                          bool end_stream) {
     const H2Settings& remote_settings = conn_ctx->remote_settings();
     char headbuf[FRAME_HEAD_SIZE];
     H2FrameHead headers_head = {
         (uint32_t)headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-    if (data.empty() && trailer_headers.empty()) {
+    if (end_stream && data.empty() && trailer_headers.empty()) {
         headers_head.flags |= H2_FLAGS_END_STREAM;
     }
     if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1350,7 +1524,7 @@ static void PackH2Message(butil::IOBuf* out,
         while (it.bytes_left()) {
             if (it.bytes_left() <= remote_settings.max_frame_size) {
                 data_head.payload_size = it.bytes_left();
-                if (trailer_headers.empty()) {
+                if (end_stream && trailer_headers.empty()) {
                     data_head.flags |= H2_FLAGS_END_STREAM;
                 }
             } else {
@@ -1379,6 +1553,110 @@ static void PackH2Message(butil::IOBuf* out,
     }
 }
 
+// Cut at most `max_bytes' out of `data' and append them as DATA frames of
+// `stream_id'. When data runs empty here, the stream is ended: the last
+// DATA frame carries END_STREAM, or `trailers' (moved) is appended as the
+// ending HEADERS frame when non-empty.
+static void AppendDataFrames(butil::IOBuf* out, butil::IOBuf& data,
+                             butil::IOBuf& trailers, size_t max_bytes,
+                             int stream_id, uint32_t max_frame_size) {
+    char headbuf[FRAME_HEAD_SIZE];
+    size_t left = std::min(max_bytes, data.size());
+    while (left > 0) {
+        H2FrameHead data_head = {0, H2_FRAME_DATA, 0, stream_id};
+        data_head.payload_size = std::min(left, (size_t)max_frame_size);
+        left -= data_head.payload_size;
+        if (left == 0 && data_head.payload_size == data.size() &&
+            trailers.empty()) {
+            data_head.flags |= H2_FLAGS_END_STREAM;
+        }
+        SerializeFrameHead(headbuf, data_head);
+        out->append(headbuf, FRAME_HEAD_SIZE);
+        data.cutn(out, data_head.payload_size);
+    }
+    if (data.empty() && !trailers.empty()) {
+        H2FrameHead trailers_head = {
+            (uint32_t)trailers.size(), H2_FRAME_HEADERS, 0, stream_id};
+        trailers_head.flags |= H2_FLAGS_END_STREAM;
+        trailers_head.flags |= H2_FLAGS_END_HEADERS;
+        SerializeFrameHead(headbuf, trailers_head);
+        out->append(headbuf, FRAME_HEAD_SIZE);
+        out->append(butil::IOBuf::Movable(trailers));
+    }
+}
+
+void H2Context::StashPendingData(int stream_id, butil::IOBuf& data,
+                                 butil::IOBuf& trailers) {
+    std::unique_lock<butil::Mutex> mu(_pending_data_mutex);
+    _pending_data.emplace_back();
+    PendingStreamData& p = _pending_data.back();
+    p.stream_id = stream_id;
+    p.data.swap(data);
+    p.trailers.swap(trailers);
+}
+
+bool H2Context::AppendPendingData(butil::IOBuf* out) {
+    const int64_t quantum = FLAGS_h2_stream_write_quantum;
+    const uint32_t max_frame_size = _remote_settings.max_frame_size;
+    std::unique_lock<butil::Mutex> mu(_pending_data_mutex);
+    // One pass: each stashed stream gets at most one quantum, streams with
+    // data left are rotated to the tail of the queue.
+    size_t npass = _pending_data.size();
+    while (npass-- > 0) {
+        PendingStreamData& f = _pending_data.front();
+        AppendDataFrames(out, f.data, f.trailers,
+                         quantum > 0 ? (size_t)quantum : f.data.size(),
+                         f.stream_id, max_frame_size);
+        if (!f.data.empty()) {
+            _pending_data.emplace_back();
+            PendingStreamData& b = _pending_data.back();
+            // `f' stays valid, deque never invalidates on push_back.
+            b.stream_id = f.stream_id;
+            b.data.swap(f.data);
+            b.trailers.swap(f.trailers);
+        }
+        _pending_data.pop_front();
+    }
+    return !_pending_data.empty();
+}
+
+namespace {
+// Drains one round of DATA stashed by StashPendingData() when its turn in
+// the write path of the socket comes, and re-arms itself at the tail of
+// the write queue while streams still have data left, so that messages
+// queued in between (small RPCs typically) get out in one quantum's time.
+class H2FlushPendingData : public SocketMessage {
+public:
+    butil::Status AppendAndDestroySelf(butil::IOBuf* out, Socket*) override;
+};
+}  // namespace
+
+static void WritePendingDataFlusher(Socket* socket) {
+    SocketMessagePtr<H2FlushPendingData> flusher(new H2FlushPendingData);
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    if (socket->Write(flusher, &wopt) != 0) {
+        // The socket is failed, stashed data dies with the context.
+        PLOG(WARNING) << "Fail to write flusher into " << *socket;
+    }
+}
+
+butil::Status
+H2FlushPendingData::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
+    std::unique_ptr<H2FlushPendingData> destroy_self(this);
+    if (socket == NULL) {
+        return butil::Status::OK();
+    }
+    H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
+    if (ctx == NULL) {
+        return butil::Status::OK();
+    }
+    if (ctx->AppendPendingData(out)) {
+        WritePendingDataFlusher(socket);
+    }
+    return butil::Status::OK();
+}
+
 H2UnsentRequest* H2UnsentRequest::New(Controller* c) {
     const HttpHeader& h = c->http_request();
     const CommonStrings* const common = get_common_strings();
@@ -1589,7 +1867,21 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     butil::IOBuf frag;
     appender.move_to(frag);
     butil::IOBuf dummy_buf;
-    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id, ctx);
+    const butil::IOBuf& body = _cntl->request_attachment();
+    const int64_t quantum = FLAGS_h2_stream_write_quantum;
+    if (quantum > 0 && body.size() > (size_t)quantum) {
+        // Large body: append one quantum now, the rest is interleaved with
+        // DATA of other streams, see -h2_stream_write_quantum.
+        butil::IOBuf rest = body;
+        butil::IOBuf head_part;
+        rest.cutn(&head_part, quantum);
+        PackH2Message(out, frag, dummy_buf, head_part, _stream_id, ctx, false);
+        butil::IOBuf no_trailers;
+        ctx->StashPendingData(_stream_id, rest, no_trailers);
+        WritePendingDataFlusher(socket);
+    } else {
+        PackH2Message(out, frag, dummy_buf, body, _stream_id, ctx, true);
+    }
     return butil::Status::OK();
 }
 
@@ -1745,7 +2037,20 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         appender.move_to(trailer_frag);
     }
 
-    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+    const int64_t quantum = FLAGS_h2_stream_write_quantum;
+    if (quantum > 0 && _data.size() > (size_t)quantum) {
+        // Large body: append one quantum now, the rest (followed by the
+        // grpc trailers, if any) is interleaved with DATA of other streams,
+        // see -h2_stream_write_quantum.
+        butil::IOBuf head_part;
+        _data.cutn(&head_part, quantum);
+        butil::IOBuf no_trailers;
+        PackH2Message(out, frag, no_trailers, head_part, _stream_id, ctx, false);
+        ctx->StashPendingData(_stream_id, _data, trailer_frag);
+        WritePendingDataFlusher(socket);
+    } else {
+        PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx, true);
+    }
     return butil::Status::OK();
 }
 
@@ -19,6 +19,7 @@
 #ifndef BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 #define BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 
+#include <deque>
 #include "brpc/policy/http_rpc_protocol.h"   // HttpContext
 #include "brpc/input_message_base.h"
 #include "brpc/protocol.h"
@@ -240,6 +241,12 @@ public:
 
     H2ParseResult OnData(butil::IOBufBytesIterator&, const H2FrameHead&,
                        uint32_t frag_size, uint8_t pad_length);
+    // Dispatch `nframes' coalesced DATA frames whose payloads were already
+    // gathered into `data' by H2Context::OnData, flags of the last frame in
+    // `last_frame_flags'. The single-frame overload above wraps this one.
+    H2ParseResult OnData(butil::IOBuf& data, uint8_t last_frame_flags,
+                       uint64_t total_payload, uint64_t total_frag,
+                       size_t nframes);
     H2ParseResult OnHeaders(butil::IOBufBytesIterator&, const H2FrameHead&,
                           uint32_t frag_size, uint8_t pad_length);
     H2ParseResult OnContinuation(butil::IOBufBytesIterator&, const H2FrameHead&);
@@ -351,6 +358,17 @@ public:
     void DeferWindowUpdate(int64_t);
     int64_t ReleaseDeferredWindowUpdate();
 
+    // Stash the tail of a large outgoing message (moved from `data' and
+    // `trailers') to be interleaved with DATA of other streams, see
+    // -h2_stream_write_quantum.
+    void StashPendingData(int stream_id, butil::IOBuf& data,
+                          butil::IOBuf& trailers);
+
+    // One round-robin pass over stashed streams: append at most one
+    // quantum of DATA for each of them to `out'. Returns true when some
+    // stream still has data left afterwards.
+    bool AppendPendingData(butil::IOBuf* out);
+
 private:
 friend class H2StreamContext;
 friend class H2UnsentRequest;
@@ -375,6 +393,10 @@ friend void InitFrameHandlers();
 
     H2StreamContext* FindStream(int stream_id);
 
+    // BDP probing for -h2_window_auto_tune, see comments in the cpp.
+    void MaybeStartBdpProbe(int64_t data_size);
+    void OnBdpPingAck();
+
     // True if the connection is established by client, otherwise it's
     // accepted by server.
     Socket* _socket;
@@ -394,6 +416,20 @@ friend void InitFrameHandlers();
     mutable butil::Mutex _stream_mutex;
     StreamMap _pending_streams;
     butil::atomic<int64_t> _deferred_window_update;
+    // Tails of large outgoing messages, drained one quantum per stream at
+    // a time by AppendPendingData() so that concurrent streams interleave.
+    struct PendingStreamData {
+        int stream_id;
+        butil::IOBuf data;
+        butil::IOBuf trailers;  // appended after data runs empty
+    };
+    mutable butil::Mutex _pending_data_mutex;
+    std::deque<PendingStreamData> _pending_data;
+    // States of BDP probing for -h2_window_auto_tune, only accessed in the
+    // parsing thread of _socket.
+    int64_t _bdp_ping_sent_us;       // 0 = no probe in flight
+    int64_t _bdp_bytes_acc;          // data received since the probe was sent
+    int64_t _local_conn_window_size; // connection-level window announced so far
 };
 
 inline int H2Context::AllocateClientStreamId() {
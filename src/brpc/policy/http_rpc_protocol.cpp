@@ -35,14 +35,22 @@
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/span.h"
 #include "brpc/socket.h"                            // Socket
+#include "brpc/websocket.h"                         // WebSocketContext
 #include "brpc/rpc_dump.h"                          // SampledRequest
 #include "brpc/http_status_code.h"                  // HTTP_STATUS_*
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/builtin/index_service.h"             // IndexService
 #include "brpc/policy/gzip_compress.h"
+#if BRPC_WITH_ZSTD
+#include "brpc/policy/zstd_compress.h"
+#endif
+#if BRPC_WITH_LZ4
+#include "brpc/policy/lz4_compress.h"
+#endif
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
 #include "brpc/grpc.h"
+#include "brpc/rpc_deadline.h"
 
 extern "C" {
 void bthread_assign_data(void* data);
@@ -54,6 +62,7 @@ int is_failed_after_queries(const http_parser* parser);
 int is_failed_after_http_version(const http_parser* parser);
 DECLARE_bool(http_verbose);
 DECLARE_int32(http_verbose_max_body_length);
+DECLARE_bool(server_reject_expired_requests);
 // Defined in grpc.cpp
 int64_t ConvertGrpcTimeoutToUS(const std::string* grpc_timeout);
 
@@ -75,6 +84,11 @@ DEFINE_bool(pb_enum_as_number, false,
             "protobuf to json as numbers, affecting both client-side and "
             "server-side");
 
+DEFINE_bool(http_json_parse_insitu, false,
+            "Convert json bodies of http requests/responses to protobuf "
+            "messages with in-situ parsing, which is faster on string-heavy "
+            "jsons, affecting both client-side and server-side");
+
 DEFINE_string(request_id_header, "x-request-id", "The http header to mark a session");
 
 DEFINE_bool(use_http_error_code, false, "Whether set the x-bd-error-code header "
@@ -130,6 +144,8 @@ CommonStrings::CommonStrings()
     , EXPECT("expect")
     , CONTINUE_100("100-continue")
     , GZIP("gzip")
+    , ZSTD("zstd")
+    , LZ4("lz4")
     , CONNECTION("connection")
     , KEEP_ALIVE("keep-alive")
     , CLOSE("close")
@@ -169,6 +185,82 @@ int InitCommonStrings() {
 static const int ALLOW_UNUSED force_creation_of_common = InitCommonStrings();
 const CommonStrings* get_common_strings() { return common; }
 
+// Returns the content/grpc encoding name of compress types usable over
+// http/h2, NULL if the type can't (unknown or not compiled in).
+static const std::string* HttpEncodingOf(CompressType type) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return &common->GZIP;
+#if BRPC_WITH_ZSTD
+    case COMPRESS_TYPE_ZSTD:
+        return &common->ZSTD;
+#endif
+#if BRPC_WITH_LZ4
+    case COMPRESS_TYPE_LZ4:
+        return &common->LZ4;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+// Compress `in' into `out' with `type'. `type' must have an encoding name,
+// i.e. HttpEncodingOf(type) != NULL.
+static bool HttpCompress(CompressType type,
+                         const butil::IOBuf& in, butil::IOBuf* out) {
+    switch (type) {
+    case COMPRESS_TYPE_GZIP:
+        return GzipCompress(in, out, NULL);
+#if BRPC_WITH_ZSTD
+    case COMPRESS_TYPE_ZSTD:
+        return ZstdCompress(in, out);
+#endif
+#if BRPC_WITH_LZ4
+    case COMPRESS_TYPE_LZ4:
+        return Lz4Compress(in, out);
+#endif
+    default:
+        return false;
+    }
+}
+
+// Returns 1 and fills `out' if `encoding' is known and `in' is decompressed
+// successfully, 0 if `encoding' is unknown (leave the body as-is, which is
+// the traditional behavior), -1 on decompression error.
+static int HttpDecompress(const std::string& encoding,
+                          const butil::IOBuf& in, butil::IOBuf* out) {
+    if (encoding == common->GZIP) {
+        return GzipDecompress(in, out) ? 1 : -1;
+    }
+#if BRPC_WITH_ZSTD
+    if (encoding == common->ZSTD) {
+        return ZstdDecompress(in, out) ? 1 : -1;
+    }
+#endif
+#if BRPC_WITH_LZ4
+    if (encoding == common->LZ4) {
+        return Lz4Decompress(in, out) ? 1 : -1;
+    }
+#endif
+    return 0;
+}
+
+// Parse `msg' from `in' while decompressing it in one streaming pass, so
+// that the uncompressed bytes are never materialized into an intermediate
+// IOBuf. Returns 1 on success, 0 if `encoding' has no streaming decoder
+// (the caller should fall back to HttpDecompress), -1 on error.
+static int StreamingDecompressToPb(const std::string& encoding,
+                                   const butil::IOBuf& in,
+                                   google::protobuf::Message* msg) {
+    if (encoding != common->GZIP) {
+        // zstd/lz4 decoders in this tree work buffer-to-buffer.
+        return 0;
+    }
+    butil::IOBufAsZeroCopyInputStream wrapper(in);
+    google::protobuf::io::GzipInputStream gzip(&wrapper);
+    return msg->ParseFromZeroCopyStream(&gzip) ? 1 : -1;
+}
+
 HttpContentType ParseContentType(butil::StringPiece ct, bool* is_grpc_ct) {
     // According to http://www.w3.org/Protocols/rfc2616/rfc2616-sec3.html#sec3.7
     //   media-type  = type "/" subtype *( ";" parameter )
@@ -280,6 +372,7 @@ static bool JsonToProtoMessage(const butil::IOBuf& body,
     json2pb::Json2PbOptions options;
     options.base64_to_bytes = cntl->has_pb_bytes_to_base64();
     options.array_to_single_repeated = cntl->has_pb_single_repeated_to_array();
+    options.insitu_parsing = FLAGS_http_json_parse_insitu;
     std::string error;
     bool ok = json2pb::JsonToProtoMessage(&wrapper, message, options, &error);
     if (!ok) {
@@ -514,18 +607,40 @@ void ProcessHttpResponse(InputMessageBase* msg) {
         } else {
             encoding = res_header->GetHeader(common->CONTENT_ENCODING);
         }
-        if (encoding != NULL && *encoding == common->GZIP) {
-            TRACEPRINTF("Decompressing response=%lu",
-                        (unsigned long)res_body.size());
-            butil::IOBuf uncompressed;
-            if (!policy::GzipDecompress(res_body, &uncompressed)) {
-                cntl->SetFailed(ERESPONSE, "Fail to un-gzip response body");
-                break;
+        bool streaming_parsed = false;
+        if (encoding != NULL) {
+            if (content_type == HTTP_CONTENT_PROTO) {
+                // Decompress and parse the pb response in one pass over the
+                // received blocks instead of materializing the uncompressed
+                // body first.
+                const int rc = StreamingDecompressToPb(
+                    *encoding, res_body, cntl->response());
+                if (rc < 0) {
+                    cntl->SetFailed(ERESPONSE,
+                                    "Fail to parse un-%s-ed content as %s",
+                                    encoding->c_str(),
+                                    cntl->response()->GetDescriptor()->full_name().c_str());
+                    break;
+                }
+                streaming_parsed = (rc > 0);
+            }
+            if (!streaming_parsed) {
+                butil::IOBuf uncompressed;
+                const int rc = HttpDecompress(*encoding, res_body, &uncompressed);
+                if (rc < 0) {
+                    cntl->SetFailed(ERESPONSE, "Fail to un-%s response body",
+                                    encoding->c_str());
+                    break;
+                }
+                if (rc > 0) {
+                    TRACEPRINTF("Decompressed response=%lu",
+                                (unsigned long)res_body.size());
+                    res_body.swap(uncompressed);
+                }
             }
-            res_body.swap(uncompressed);
         }
         if (content_type == HTTP_CONTENT_PROTO) {
-            if (!ParsePbFromIOBuf(cntl->response(), res_body)) {
+            if (!streaming_parsed && !ParsePbFromIOBuf(cntl->response(), res_body)) {
                 cntl->SetFailed(ERESPONSE, "Fail to parse content as %s",
                                 cntl->response()->GetDescriptor()->full_name().c_str());
                 break;
@@ -646,24 +761,28 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     }
     bool grpc_compressed = false;
     if (cntl->request_compress_type() != COMPRESS_TYPE_NONE) {
-        if (cntl->request_compress_type() != COMPRESS_TYPE_GZIP) {
+        const CompressType type = cntl->request_compress_type();
+        const std::string* encoding_name = HttpEncodingOf(type);
+        if (encoding_name == NULL) {
             return cntl->SetFailed(EREQUEST, "http does not support %s",
-                            CompressTypeToCStr(cntl->request_compress_type()));
+                                   CompressTypeToCStr(type));
         }
         const size_t request_size = cntl->request_attachment().size();
         if (request_size >= (size_t)FLAGS_http_body_compress_threshold) {
             TRACEPRINTF("Compressing request=%lu", (unsigned long)request_size);
             butil::IOBuf compressed;
-            if (GzipCompress(cntl->request_attachment(), &compressed, NULL)) {
+            if (HttpCompress(type, cntl->request_attachment(), &compressed)) {
                 cntl->request_attachment().swap(compressed);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    hreq.SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->GRPC_ENCODING, *encoding_name);
                 } else {
-                    hreq.SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    hreq.SetHeader(common->CONTENT_ENCODING, *encoding_name);
                 }
             } else {
-                cntl->SetFailed("Fail to gzip the request body, skip compressing");
+                cntl->SetFailed(butil::string_printf(
+                    "Fail to %s the request body, skip compressing",
+                    encoding_name->c_str()));
             }
         }
     }
@@ -763,10 +882,10 @@ void PackHttpRequest(butil::IOBuf* buf,
     }
 }
 
-inline bool SupportGzip(Controller* cntl) {
+inline bool SupportEncoding(Controller* cntl, const std::string& encoding) {
     const std::string* encodings =
         cntl->http_request().GetHeader(common->ACCEPT_ENCODING);
-    return (encodings && encodings->find(common->GZIP) != std::string::npos);
+    return (encodings && encodings->find(encoding) != std::string::npos);
 }
 
 class HttpResponseSender {
@@ -954,8 +1073,11 @@ HttpResponseSender::~HttpResponseSender() {
             }
         }
     } else if (cntl->has_progressive_writer()) {
-        // Transfer-Encoding is supported since HTTP/1.1
-        if (res_header->major_version() < 2 && !res_header->before_http_1_1()) {
+        // Transfer-Encoding is supported since HTTP/1.1. A 101 response
+        // hands the raw stream to another protocol (e.g. WebSocket), never
+        // chunk-encode it.
+        if (res_header->major_version() < 2 && !res_header->before_http_1_1() &&
+            res_header->status_code() != HTTP_STATUS_SWITCHING_PROTOCOLS) {
             res_header->SetHeader("Transfer-Encoding", "chunked");
         }
         if (!cntl->response_attachment().empty()) {
@@ -964,29 +1086,31 @@ HttpResponseSender::~HttpResponseSender() {
                 " ignored when CreateProgressiveAttachment() was called";
         }
         // not set_content to enable chunked mode.
-    } else if (cntl->response_compress_type() == COMPRESS_TYPE_GZIP) {
+    } else if (cntl->response_compress_type() != COMPRESS_TYPE_NONE) {
+        const CompressType type = cntl->response_compress_type();
+        const std::string* encoding_name = HttpEncodingOf(type);
         const size_t response_size = cntl->response_attachment().size();
-        if (response_size >= (size_t)FLAGS_http_body_compress_threshold
-            && (is_http2 || SupportGzip(cntl))) {
+        if (encoding_name == NULL) {
+            // TODO(gejun): Support snappy (grpc)
+            LOG(ERROR) << "Unknown compress_type=" << type
+                       << ", skip compression.";
+        } else if (response_size >= (size_t)FLAGS_http_body_compress_threshold
+            && (is_http2 || SupportEncoding(cntl, *encoding_name))) {
             TRACEPRINTF("Compressing response=%lu", (unsigned long)response_size);
             butil::IOBuf tmpbuf;
-            if (GzipCompress(cntl->response_attachment(), &tmpbuf, NULL)) {
+            if (HttpCompress(type, cntl->response_attachment(), &tmpbuf)) {
                 cntl->response_attachment().swap(tmpbuf);
                 if (is_grpc) {
                     grpc_compressed = true;
-                    res_header->SetHeader(common->GRPC_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->GRPC_ENCODING, *encoding_name);
                 } else {
-                    res_header->SetHeader(common->CONTENT_ENCODING, common->GZIP);
+                    res_header->SetHeader(common->CONTENT_ENCODING, *encoding_name);
                 }
             } else {
-                LOG(ERROR) << "Fail to gzip the http response, skip compression.";
+                LOG(ERROR) << "Fail to " << *encoding_name
+                           << " the http response, skip compression.";
             }
         }
-    } else {
-        // TODO(gejun): Support snappy (grpc)
-        LOG_IF(ERROR, cntl->response_compress_type() != COMPRESS_TYPE_NONE)
-            << "Unknown compress_type=" << cntl->response_compress_type()
-            << ", skip compression.";
     }
 
     int rc = -1;
@@ -1177,7 +1301,14 @@ FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
 
 ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
                              bool read_eof, const void* arg) {
-    HttpContext* http_imsg = 
+    WebSocketContext* ws_ctx = socket->websocket_context();
+    if (ws_ctx != NULL) {
+        // The connection was upgraded to WebSocket by a previous 101
+        // response (see WebSocketConnection::Accept), following bytes are
+        // frames instead of http.
+        return ws_ctx->OnInput(source, socket, read_eof);
+    }
+    HttpContext* http_imsg =
         static_cast<HttpContext*>(socket->parsing_context());
     if (http_imsg == NULL) {
         if (read_eof || source->empty()) {
@@ -1411,6 +1542,18 @@ bool VerifyHttpRequest(const InputMessageBase* msg) {
 
 // Defined in baidu_rpc_protocol.cpp
 void EndRunningCallMethodInPool(
+    MethodStatus* method_status,
+    ::google::protobuf::Service* service,
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done);
+
+// Defined in baidu_rpc_protocol.cpp
+void StartCallMethodInDedicatedTag(
+    bthread_tag_t tag,
+    const Server* server,
     ::google::protobuf::Service* service,
     const ::google::protobuf::MethodDescriptor* method,
     ::google::protobuf::RpcController* controller,
@@ -1593,7 +1736,11 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                             server->options().max_concurrency);
             return;
         }
-        if (FLAGS_usercode_in_pthread && TooManyUserCode()) {
+        if (FLAGS_usercode_in_pthread &&
+            (TooManyUserCode() ||
+             (method_status != NULL &&
+              method_status->usercode_pool() != NULL &&
+              TooManyUserCode(method_status->usercode_pool())))) {
             cntl->SetFailed(ELIMIT, "Too many user code to run when"
                             " -usercode_in_pthread is on");
             return;
@@ -1658,24 +1805,50 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                 int64_t timeout_value_us =
                     ConvertGrpcTimeoutToUS(req_header.GetHeader(common->GRPC_TIMEOUT));
                 if (timeout_value_us >= 0) {
-                    accessor.set_deadline_us(
-                            butil::gettimeofday_us() + timeout_value_us);
+                    // Counted from the arrival of the message rather than
+                    // from now: the time this request waited in queues is
+                    // part of the budget.
+                    accessor.set_deadline_us(msg->base_real_us() +
+                                             msg->received_us() +
+                                             timeout_value_us);
                 }
             } else { // http or h2 but not grpc
                 encoding = req_header.GetHeader(common->CONTENT_ENCODING);
             }
-            if (encoding != NULL && *encoding == common->GZIP) {
-                TRACEPRINTF("Decompressing request=%lu",
-                            (unsigned long)req_body.size());
-                butil::IOBuf uncompressed;
-                if (!policy::GzipDecompress(req_body, &uncompressed)) {
-                    cntl->SetFailed(EREQUEST, "Fail to un-gzip request body");
-                    return;
+            bool streaming_parsed = false;
+            if (encoding != NULL) {
+                if (content_type == HTTP_CONTENT_PROTO) {
+                    // Decompress and parse the pb request in one pass over
+                    // the received blocks instead of materializing the
+                    // uncompressed body first.
+                    const int rc = StreamingDecompressToPb(
+                        *encoding, req_body, req);
+                    if (rc < 0) {
+                        cntl->SetFailed(EREQUEST,
+                                        "Fail to parse un-%s-ed http body as %s",
+                                        encoding->c_str(),
+                                        req->GetDescriptor()->full_name().c_str());
+                        return;
+                    }
+                    streaming_parsed = (rc > 0);
+                }
+                if (!streaming_parsed) {
+                    butil::IOBuf uncompressed;
+                    const int rc = HttpDecompress(*encoding, req_body, &uncompressed);
+                    if (rc < 0) {
+                        cntl->SetFailed(EREQUEST, "Fail to un-%s request body",
+                                        encoding->c_str());
+                        return;
+                    }
+                    if (rc > 0) {
+                        TRACEPRINTF("Decompressed request=%lu",
+                                    (unsigned long)req_body.size());
+                        req_body.swap(uncompressed);
+                    }
                 }
-                req_body.swap(uncompressed);
             }
             if (content_type == HTTP_CONTENT_PROTO) {
-                if (!ParsePbFromIOBuf(req, req_body)) {
+                if (!streaming_parsed && !ParsePbFromIOBuf(req, req_body)) {
                     cntl->SetFailed(EREQUEST, "Fail to parse http body as %s",
                                     req->GetDescriptor()->full_name().c_str());
                     return;
@@ -1719,6 +1892,18 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         }
     }
 
+    // A request that spent its whole budget in queues has certainly been
+    // abandoned by the client, answer ERPCTIMEDOUT right away instead of
+    // wasting cycles on running its handler.
+    if (FLAGS_server_reject_expired_requests &&
+        cntl->deadline_us() >= 0 &&
+        butil::gettimeofday_us() > cntl->deadline_us()) {
+        cntl->SetFailed(ERPCTIMEDOUT, "Deadline=%" PRId64 "us expired "
+                        "before dispatching to the method",
+                        cntl->deadline_us());
+        return;
+    }
+
     google::protobuf::Closure* done = new HttpResponseSenderAsDone(&resp_sender);
     imsg_guard.reset();  // optional, just release resource ASAP
 
@@ -1726,6 +1911,18 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->set_start_callback_us(butil::cpuwide_time_us());
         span->AsParent();
     }
+    if (mp->bthread_tag != BTHREAD_TAG_INVALID &&
+        mp->bthread_tag != bthread_self_tag()) {
+        // The service is bound to a dedicated worker group
+        // (ServiceOptions.bthread_tag), run the method there.
+        // -usercode_in_pthread does not apply to such services.
+        return StartCallMethodInDedicatedTag(
+            mp->bthread_tag, server, svc, method, cntl, req, res, done);
+    }
+    // Expose the deadline(if any, e.g. from grpc-timeout) to sub-calls issued
+    // inside user code. -1 clears a stale deadline of a previous request
+    // served with a reused keytable.
+    SetCurrentRpcDeadline(cntl->deadline_us());
     if (!FLAGS_usercode_in_pthread) {
         return svc->CallMethod(method, cntl, req, res, done);
     }
@@ -1733,7 +1930,8 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         svc->CallMethod(method, cntl, req, res, done);
         return EndRunningUserCodeInPlace();
     } else {
-        return EndRunningCallMethodInPool(svc, method, cntl, req, res, done);
+        return EndRunningCallMethodInPool(
+            method_status, svc, method, cntl, req, res, done);
     }
 }
 
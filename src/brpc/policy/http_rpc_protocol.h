@@ -46,6 +46,8 @@ struct CommonStrings {
     std::string EXPECT;
     std::string CONTINUE_100;
     std::string GZIP;
+    std::string ZSTD;
+    std::string LZ4;
     std::string CONNECTION;
     std::string KEEP_ALIVE;
     std::string CLOSE;
@@ -0,0 +1,114 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#if BRPC_WITH_LZ4
+
+#include <lz4.h>
+#include "butil/logging.h"
+#include "butil/sys_byteorder.h"
+#include "brpc/policy/lz4_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+
+namespace brpc {
+namespace policy {
+
+bool Lz4Compress(const butil::IOBuf& in, butil::IOBuf* out) {
+    // The LZ4 block API needs contiguous buffers.
+    const std::string src = in.to_string();
+    if (src.size() > LZ4_MAX_INPUT_SIZE) {
+        LOG(WARNING) << "Fail to lz4::compress, size=" << src.size()
+                     << " exceeds LZ4_MAX_INPUT_SIZE";
+        return false;
+    }
+    const int bound = LZ4_compressBound(src.size());
+    std::string dst;
+    dst.resize(bound);
+    const int r = LZ4_compress_default(src.data(), &dst[0], src.size(), bound);
+    if (r <= 0) {
+        LOG(WARNING) << "Fail to lz4::compress, size=" << src.size();
+        return false;
+    }
+    // Prepend the original size which LZ4_decompress_safe requires.
+    const uint32_t size_be = butil::HostToNet32(src.size());
+    out->append(&size_be, sizeof(size_be));
+    out->append(dst.data(), r);
+    return true;
+}
+
+bool Lz4Decompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    uint32_t size_be = 0;
+    butil::IOBuf src_buf = in;
+    if (src_buf.cutn(&size_be, sizeof(size_be)) != sizeof(size_be)) {
+        LOG(WARNING) << "Invalid lz4 data, size=" << in.size();
+        return false;
+    }
+    const uint32_t original_size = butil::NetToHost32(size_be);
+    const std::string src = src_buf.to_string();
+    std::string dst;
+    dst.resize(original_size);
+    const int r = LZ4_decompress_safe(src.data(), &dst[0], src.size(),
+                                      original_size);
+    if (r < 0 || (uint32_t)r != original_size) {
+        LOG(WARNING) << "Fail to lz4::decompress, size=" << src.size();
+        return false;
+    }
+    out->append(dst.data(), r);
+    return true;
+}
+
+bool Lz4Compress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    return Lz4Compress(serialized_pb, buf);
+}
+
+bool Lz4Decompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!Lz4Decompress(data, &binary_pb)) {
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif // BRPC_WITH_LZ4
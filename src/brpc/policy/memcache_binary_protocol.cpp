@@ -61,6 +61,8 @@ static void InitSupportedCommandMap() {
     butil::bit_array_set(supported_cmd_map, MC_BINARY_FLUSH);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_VERSION);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_NOOP);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETK);
+    butil::bit_array_set(supported_cmd_map, MC_BINARY_GETKQ);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_APPEND);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_PREPEND);
     butil::bit_array_set(supported_cmd_map, MC_BINARY_STAT);
@@ -137,6 +139,11 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source,
             DestroyingPtr<MostCommonMessage> auth_msg(
                  static_cast<MostCommonMessage*>(socket->release_parsing_context()));
             socket->GivebackPipelinedInfo(pi);
+        } else if (header->command == MC_BINARY_GETKQ) {
+            // A quiet hit inside a MultiGet batch: more responses of the
+            // same pipelined operation follow until the terminating NOOP,
+            // which is the one counted.
+            socket->GivebackPipelinedInfo(pi);
         } else {
             if (++msg->pi.count >= pi.count) {
                 CHECK_EQ(msg->pi.count, pi.count);
@@ -76,6 +76,11 @@ void SendMongoResponse::Run() {
     butil::IOBuf res_buf;
     if (cntl.Failed()) {
         adaptor->SerializeError(res.header().response_to(), &res_buf);
+    } else if (!cntl.response_attachment().empty()) {
+        // A complete wire message built by the service (e.g. with
+        // MongoReplyBuilder, see mongo_msg.h) is written as-is, still
+        // referencing the attached blocks.
+        res_buf.append(cntl.response_attachment());
     } else if (res.has_message()) {
         mongo_head_t header = {
             res.header().message_length(),
@@ -163,6 +168,7 @@ ParseResult ParseMongoMessage(butil::IOBuf* source,
 
 // Defined in baidu_rpc_protocol.cpp
 void EndRunningCallMethodInPool(
+    MethodStatus* method_status,
     ::google::protobuf::Service* service,
     const ::google::protobuf::MethodDescriptor* method,
     ::google::protobuf::RpcController* controller,
@@ -253,15 +259,30 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
                 break;
             }
         }
-        
+        if (FLAGS_usercode_in_pthread &&
+            method_status != NULL &&
+            method_status->usercode_pool() != NULL &&
+            TooManyUserCode(method_status->usercode_pool())) {
+            mongo_done->cntl.SetFailed(ELIMIT, "Too many user code to run when"
+                                       " -usercode_in_pthread is on");
+            break;
+        }
+
         if (!MongoOp_IsValid(header->op_code)) {
             mongo_done->cntl.SetFailed(EREQUEST, "Unknown op_code:%d", header->op_code);
             break;
         }
         
         mongo_done->cntl.set_log_id(header->request_id);
-        const std::string &body_str = msg->payload.to_string();
-        mongo_done->req.set_message(body_str.c_str(), body_str.size());
+        // Expose the raw body to the service without copying. OP_MSG bodies
+        // can be sliced into BSON documents with ParseMongoMsgView(), see
+        // mongo_msg.h.
+        mongo_done->cntl.request_attachment().append(msg->payload);
+        if (header->op_code != MONGO_OPCODE_OP_MSG) {
+            // Legacy opcodes keep filling the message field for existing
+            // adaptors, with one copy instead of a flatten plus a copy.
+            msg->payload.copy_to(mongo_done->req.mutable_message());
+        }
         mongo_done->req.mutable_header()->set_message_length(header->message_length);
         mongo_done->req.mutable_header()->set_request_id(header->request_id);
         mongo_done->req.mutable_header()->set_response_to(header->response_to);
@@ -286,7 +307,7 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
             return EndRunningUserCodeInPlace();
         } else {
             return EndRunningCallMethodInPool(
-                svc, method, &(mongo_done->cntl), &(mongo_done->req),
+                method_status, svc, method, &(mongo_done->cntl), &(mongo_done->req),
                 &(mongo_done->res), mongo_done);
         }
     } while (false);
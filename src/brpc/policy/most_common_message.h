@@ -21,6 +21,7 @@
 
 #include "butil/object_pool.h"
 #include "brpc/input_messenger.h"
+#include "brpc/progressive_reader.h"    // ReadableProgressiveAttachment
 
 
 namespace brpc {
@@ -34,6 +35,9 @@ struct BAIDU_CACHELINE_ALIGNMENT MostCommonMessage : public InputMessageBase {
     butil::IOBuf meta;
     butil::IOBuf payload;
     PipelinedInfo pi;
+    // Set iff the attachment is streamed instead of carried in `payload',
+    // see -baidu_std_progressive_attachment_threshold.
+    butil::intrusive_ptr<ReadableProgressiveAttachment> rpa;
 
     inline static MostCommonMessage* Get() {
         return butil::get_object<MostCommonMessage>();
@@ -44,6 +48,7 @@ struct BAIDU_CACHELINE_ALIGNMENT MostCommonMessage : public InputMessageBase {
         meta.clear();
         payload.clear();
         pi.reset();
+        rpa.reset(NULL);
         butil::return_object(this);
     }
 };
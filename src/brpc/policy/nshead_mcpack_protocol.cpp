@@ -59,8 +59,8 @@ void NsheadMcpackAdaptor::ParseNsheadMeta(
 void NsheadMcpackAdaptor::ParseRequestFromIOBuf(
     const NsheadMeta&, const NsheadMessage& raw_req,
     Controller* cntl, google::protobuf::Message* pb_req) const {
-    const std::string& msg_name = pb_req->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = pb_req->GetDescriptor();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (!handler.parse_from_iobuf(pb_req, raw_req.body)) {
         cntl->SetFailed(EREQUEST, "Fail to parse request message, "
                         "request_size=%" PRIu64, (uint64_t)raw_req.body.length());
@@ -86,8 +86,9 @@ void NsheadMcpackAdaptor::SerializeResponseToIOBuf(
         return;
     }
 
-    const std::string& msg_name = pb_res->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = pb_res->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (!handler.serialize_to_iobuf(*pb_res, &raw_res->body,
                                    ::mcpack2pb::FORMAT_MCPACK_V2)) {
         cntl->CloseConnection("Fail to serialize %s", msg_name.c_str());
@@ -124,8 +125,8 @@ void ProcessNsheadMcpackResponse(InputMessageBase* msg_base) {
         // silently ignore response.
         return;
     }
-    const std::string& msg_name = res->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = res->GetDescriptor();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (!handler.parse_from_iobuf(res, msg->payload)) {
         return cntl->CloseConnection("Fail to parse response message");
     }
@@ -143,8 +144,9 @@ void SerializeNsheadMcpackRequest(butil::IOBuf* buf, Controller* cntl,
                         "nshead_mcpack protocol doesn't support compression");
         return;
     }
-    const std::string& msg_name = pb_req->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = pb_req->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (!handler.serialize_to_iobuf(*pb_req, buf, ::mcpack2pb::FORMAT_MCPACK_V2)) {
         cntl->SetFailed(EREQUEST, "Fail to serialize %s", msg_name.c_str());
         return;
@@ -138,8 +138,10 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
         if (err != PARSE_OK) {
             return MakeParseError(err);
         }
+        // Declared outside the loop so that steady-state pipelined batches
+        // swap the same two vectors instead of reallocating one per command.
+        std::vector<butil::StringPiece> next_args;
         while (true) {
-            std::vector<butil::StringPiece> next_args;
             err = ctx->parser.Consume(*source, &next_args, &ctx->arena);
             if (err != PARSE_OK) {
                 break;
@@ -0,0 +1,198 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <unordered_set>
+
+#include "butil/fast_rand.h"
+#include "brpc/socket.h"
+#include "brpc/policy/smooth_weighted_round_robin_load_balancer.h"
+#include "butil/strings/string_number_conversions.h"
+
+namespace brpc {
+namespace policy {
+
+bool SmoothWeightedRoundRobinLoadBalancer::Add(Servers& bg, const ServerId& id) {
+    if (bg.server_list.capacity() < 128) {
+        bg.server_list.reserve(128);
+    }
+    uint32_t weight = 0;
+    if (!butil::StringToUint(id.tag, &weight) || weight <= 0) {
+        if (FLAGS_default_weight_of_wlb > 0) {
+            LOG(WARNING) << "Invalid weight is set: " << id.tag
+                         << ". Now, 'weight' has been set to 'FLAGS_default_weight_of_wlb' by default.";
+            weight = FLAGS_default_weight_of_wlb;
+        } else {
+            LOG(ERROR) << "Invalid weight is set: " << id.tag;
+            return false;
+        }
+    }
+    bool insert_server =
+             bg.server_map.emplace(id.id, bg.server_list.size()).second;
+    if (insert_server) {
+        bg.server_list.emplace_back(id.id, weight);
+        bg.weight_sum += weight;
+        return true;
+    }
+    return false;
+}
+
+bool SmoothWeightedRoundRobinLoadBalancer::Remove(Servers& bg, const ServerId& id) {
+    auto iter = bg.server_map.find(id.id);
+    if (iter != bg.server_map.end()) {
+        const size_t index = iter->second;
+        bg.weight_sum -= bg.server_list[index].weight;
+        bg.server_list[index] = bg.server_list.back();
+        bg.server_map[bg.server_list[index].id] = index;
+        bg.server_list.pop_back();
+        bg.server_map.erase(iter);
+        return true;
+    }
+    return false;
+}
+
+size_t SmoothWeightedRoundRobinLoadBalancer::BatchAdd(
+    Servers& bg, const std::vector<ServerId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Add(bg, servers[i]);
+    }
+    return count;
+}
+
+size_t SmoothWeightedRoundRobinLoadBalancer::BatchRemove(
+    Servers& bg, const std::vector<ServerId>& servers) {
+    size_t count = 0;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        count += !!Remove(bg, servers[i]);
+    }
+    return count;
+}
+
+bool SmoothWeightedRoundRobinLoadBalancer::AddServer(const ServerId& id) {
+    return _db_servers.Modify(Add, id);
+}
+
+bool SmoothWeightedRoundRobinLoadBalancer::RemoveServer(const ServerId& id) {
+    return _db_servers.Modify(Remove, id);
+}
+
+size_t SmoothWeightedRoundRobinLoadBalancer::AddServersInBatch(
+    const std::vector<ServerId>& servers) {
+    const size_t n = _db_servers.Modify(BatchAdd, servers);
+    LOG_IF(ERROR, n != servers.size())
+        << "Fail to AddServersInBatch, expected " << servers.size()
+        << " actually " << n;
+    return n;
+}
+
+size_t SmoothWeightedRoundRobinLoadBalancer::RemoveServersInBatch(
+    const std::vector<ServerId>& servers) {
+    const size_t n = _db_servers.Modify(BatchRemove, servers);
+    return n;
+}
+
+int SmoothWeightedRoundRobinLoadBalancer::SelectServer(
+    const SelectIn& in, SelectOut* out) {
+    butil::DoublyBufferedData<Servers, TLS>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        return ENOMEM;
+    }
+    const size_t n = s->server_list.size();
+    if (n == 0) {
+        return ENODATA;
+    }
+    TLS& tls = s.tls();
+    if (tls.weight_sum != s->weight_sum || tls.servers_num != n) {
+        // Server list changed(or first pick of this thread), rebuild the
+        // per-thread state. Give each current_weight a random phase so
+        // that worker threads don't pick servers in lock-step, which
+        // would re-create the burstiness this policy avoids.
+        tls.current_weight.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            tls.current_weight[i] =
+                (int64_t)butil::fast_rand_less_than(s->server_list[i].weight);
+        }
+        tls.weight_sum = s->weight_sum;
+        tls.servers_num = n;
+    }
+    // The servers that can not be chosen.
+    std::unordered_set<SocketId> filter;
+    size_t remain_servers = n;
+    while (remain_servers > 0) {
+        // One smooth pick over the servers not filtered out yet: raise
+        // every candidate by its weight, take the highest current_weight
+        // and lower it by the sum of the raises.
+        int64_t total = 0;
+        size_t best = n;
+        for (size_t i = 0; i < n; ++i) {
+            if (!filter.empty() && filter.count(s->server_list[i].id) > 0) {
+                continue;
+            }
+            tls.current_weight[i] += s->server_list[i].weight;
+            total += s->server_list[i].weight;
+            if (best == n || tls.current_weight[i] > tls.current_weight[best]) {
+                best = i;
+            }
+        }
+        if (best == n) {
+            break;
+        }
+        tls.current_weight[best] -= total;
+        const SocketId server_id = s->server_list[best].id;
+        if ((remain_servers == 1 // always take last chance
+                || !ExcludedServers::IsExcluded(in.excluded, server_id))
+            && Socket::Address(server_id, out->ptr) == 0
+            && (*out->ptr)->IsAvailable()) {
+            return 0;
+        }
+        filter.emplace(server_id);
+        --remain_servers;
+    }
+    return EHOSTDOWN;
+}
+
+LoadBalancer* SmoothWeightedRoundRobinLoadBalancer::New(
+    const butil::StringPiece&) const {
+    return new (std::nothrow) SmoothWeightedRoundRobinLoadBalancer;
+}
+
+void SmoothWeightedRoundRobinLoadBalancer::Destroy() {
+    delete this;
+}
+
+void SmoothWeightedRoundRobinLoadBalancer::Describe(
+    std::ostream &os, const DescribeOptions& options) {
+    if (!options.verbose) {
+        os << "swrr";
+        return;
+    }
+    os << "SmoothWeightedRoundRobin{";
+    butil::DoublyBufferedData<Servers, TLS>::ScopedPtr s;
+    if (_db_servers.Read(&s) != 0) {
+        os << "fail to read _db_servers";
+    } else {
+        os << "n=" << s->server_list.size() << ':';
+        for (const auto& server : s->server_list) {
+            os << ' ' << server.id << '(' << server.weight << ')';
+        }
+    }
+    os << '}';
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -16,15 +16,25 @@
 // under the License.
 
 
+#include <gflags/gflags.h>
 #include "butil/logging.h"
+#include "butil/crc32c.h"
 #include "butil/third_party/snappy/snappy.h"
 #include "brpc/policy/snappy_compress.h"
 #include "brpc/protocol.h"
 #include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
 
 namespace brpc {
 namespace policy {
 
+DEFINE_int32(snappy_framed_parallel_compress_threshold, 0,
+             "Bodies not smaller than this size (in bytes) are cut into "
+             "chunks and compressed concurrently on bthreads when using "
+             "snappy-framed. <= 0 disables parallel compression.");
+BRPC_VALIDATE_GFLAG(snappy_framed_parallel_compress_threshold,
+                    NonNegativeInteger);
+
 bool SnappyCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
     butil::IOBuf serialized_pb;
     butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
@@ -81,5 +91,220 @@ bool SnappyDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
     return butil::snappy::Uncompress(&source, &sink);
 }
 
+// ===== the snappy framing format =====
+// See framing_format.txt in the snappy project. A stream starts with a
+// stream identifier chunk followed by data chunks holding at most 64KB of
+// uncompressed data each, compressed independently and checksummed with a
+// masked CRC32C of the uncompressed data.
+
+static const size_t SNAPPY_FRAME_MAX_DATA_BYTES = 65536;
+// Amount of data handed to each bthread by ParallelCompress(), a multiple
+// of the frame size so that every task emits whole frames. Same value as
+// the gzip/zstd codecs.
+static const size_t PARALLEL_COMPRESS_CHUNK_BYTES = 512 * 1024;
+
+static const uint8_t SNAPPY_CHUNK_COMPRESSED = 0x00;
+static const uint8_t SNAPPY_CHUNK_UNCOMPRESSED = 0x01;
+static const uint8_t SNAPPY_CHUNK_STREAM_IDENTIFIER = 0xff;
+// type=0xff len=6 "sNaPpY"
+static const char SNAPPY_STREAM_IDENTIFIER[10] =
+    { '\xff', '\x06', '\x00', '\x00', 's', 'N', 'a', 'P', 'p', 'Y' };
+
+// Masked CRC32C over the blocks of `data', as stored in data chunks.
+static uint32_t MaskedCrc32cOf(const butil::IOBuf& data) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < data.backing_block_num(); ++i) {
+        const butil::StringPiece blk = data.backing_block(i);
+        crc = butil::crc32c::Extend(crc, blk.data(), blk.size());
+    }
+    return butil::crc32c::Mask(crc);
+}
+
+// Append one data chunk holding `frame_data' (at most 64KB) to `out'.
+// Falls back to an uncompressed chunk when compression does not shrink
+// the data, as the format recommends.
+static bool AppendSnappyFrame(const butil::IOBuf& frame_data,
+                              butil::IOBuf* out) {
+    butil::IOBuf compressed;
+    butil::IOBufAsSnappySource source(frame_data);
+    butil::IOBufAsSnappySink sink(compressed);
+    if (!butil::snappy::Compress(&source, &sink)) {
+        return false;
+    }
+    const bool store_raw = (compressed.size() >= frame_data.size());
+    const butil::IOBuf& payload = store_raw ? frame_data : compressed;
+    const uint32_t masked_crc = MaskedCrc32cOf(frame_data);
+    const uint32_t len = payload.size() + 4/*CRC*/;
+    char header[8];
+    header[0] = store_raw ? SNAPPY_CHUNK_UNCOMPRESSED : SNAPPY_CHUNK_COMPRESSED;
+    header[1] = len & 0xff;
+    header[2] = (len >> 8) & 0xff;
+    header[3] = (len >> 16) & 0xff;
+    header[4] = masked_crc & 0xff;
+    header[5] = (masked_crc >> 8) & 0xff;
+    header[6] = (masked_crc >> 16) & 0xff;
+    header[7] = (masked_crc >> 24) & 0xff;
+    out->append(header, sizeof(header));
+    out->append(payload);
+    return true;
+}
+
+// Cut `in' into 64KB frames, suitable for concatenation by
+// ParallelCompress().
+static bool SnappyFramedCompressChunk(const butil::IOBuf& in,
+                                      butil::IOBuf* out) {
+    butil::IOBuf rest = in;
+    while (!rest.empty()) {
+        butil::IOBuf frame_data;
+        rest.cutn(&frame_data, SNAPPY_FRAME_MAX_DATA_BYTES);
+        if (!AppendSnappyFrame(frame_data, out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SnappyFramedCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    out->append(SNAPPY_STREAM_IDENTIFIER, sizeof(SNAPPY_STREAM_IDENTIFIER));
+    if (in.empty()) {
+        return true;
+    }
+    if (FLAGS_snappy_framed_parallel_compress_threshold > 0 &&
+        in.size() >= (size_t)FLAGS_snappy_framed_parallel_compress_threshold) {
+        return ParallelCompress(in, out, PARALLEL_COMPRESS_CHUNK_BYTES,
+                                SnappyFramedCompressChunk);
+    }
+    return SnappyFramedCompressChunk(in, out);
+}
+
+bool SnappyFramedDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    butil::IOBufBytesIterator it(in);
+    bool saw_stream_identifier = false;
+    while (it.bytes_left() > 0) {
+        if (it.bytes_left() < 4) {
+            LOG(WARNING) << "Truncated chunk header in snappy-framed data";
+            return false;
+        }
+        uint8_t header[4];
+        it.copy_and_forward(header, sizeof(header));
+        const uint8_t type = header[0];
+        const uint32_t len = (uint32_t)header[1] | ((uint32_t)header[2] << 8)
+            | ((uint32_t)header[3] << 16);
+        if (it.bytes_left() < len) {
+            LOG(WARNING) << "Truncated chunk of type=" << (unsigned)type
+                         << " len=" << len << " in snappy-framed data";
+            return false;
+        }
+        if (type == SNAPPY_CHUNK_STREAM_IDENTIFIER) {
+            char magic[6];
+            if (len != sizeof(magic)) {
+                LOG(WARNING) << "Invalid stream identifier, len=" << len;
+                return false;
+            }
+            it.copy_and_forward(magic, sizeof(magic));
+            if (memcmp(magic, SNAPPY_STREAM_IDENTIFIER + 4,
+                       sizeof(magic)) != 0) {
+                LOG(WARNING) << "Invalid magic in stream identifier";
+                return false;
+            }
+            saw_stream_identifier = true;
+        } else if (type == SNAPPY_CHUNK_COMPRESSED ||
+                   type == SNAPPY_CHUNK_UNCOMPRESSED) {
+            if (!saw_stream_identifier) {
+                LOG(WARNING) << "Data chunk before the stream identifier";
+                return false;
+            }
+            if (len < 4/*CRC*/) {
+                LOG(WARNING) << "Too short data chunk, len=" << len;
+                return false;
+            }
+            uint8_t crc_bytes[4];
+            it.copy_and_forward(crc_bytes, sizeof(crc_bytes));
+            const uint32_t masked_crc = (uint32_t)crc_bytes[0]
+                | ((uint32_t)crc_bytes[1] << 8)
+                | ((uint32_t)crc_bytes[2] << 16)
+                | ((uint32_t)crc_bytes[3] << 24);
+            butil::IOBuf payload;
+            it.append_and_forward(&payload, len - 4);
+            butil::IOBuf frame_data;
+            if (type == SNAPPY_CHUNK_COMPRESSED) {
+                butil::IOBufAsSnappySource source(payload);
+                butil::IOBufAsSnappySink sink(frame_data);
+                if (!butil::snappy::Uncompress(&source, &sink)) {
+                    LOG(WARNING) << "Fail to uncompress a chunk, len=" << len;
+                    return false;
+                }
+            } else {
+                frame_data.swap(payload);
+            }
+            if (frame_data.size() > SNAPPY_FRAME_MAX_DATA_BYTES) {
+                LOG(WARNING) << "Chunk inflates to " << frame_data.size()
+                             << " bytes, exceeding the 64K limit";
+                return false;
+            }
+            if (MaskedCrc32cOf(frame_data) != masked_crc) {
+                LOG(WARNING) << "CRC mismatch on a chunk of "
+                             << frame_data.size() << " bytes";
+                return false;
+            }
+            out->append(frame_data);
+        } else if (type >= 0x80) {
+            // Reserved skippable chunks.
+            it.forward(len);
+        } else {
+            // 0x02-0x7f: reserved unskippable chunks.
+            LOG(WARNING) << "Unknown unskippable chunk of type="
+                         << (unsigned)type;
+            return false;
+        }
+    }
+    return saw_stream_identifier;
+}
+
+bool SnappyFramedCompress(const google::protobuf::Message& msg,
+                          butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    ok = SnappyFramedCompress(serialized_pb, buf);
+    if (!ok) {
+        LOG(WARNING) << "Fail to compress snappy-framed, size="
+                     << serialized_pb.size();
+    }
+    return ok;
+}
+
+bool SnappyFramedDecompress(const butil::IOBuf& data,
+                            google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!SnappyFramedDecompress(data, &binary_pb)) {
+        LOG(WARNING) << "Fail to uncompress snappy-framed, size="
+                     << data.size();
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
 }  // namespace policy
 } // namespace brpc
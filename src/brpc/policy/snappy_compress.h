@@ -38,6 +38,17 @@ bool SnappyCompress(const butil::IOBuf& in, butil::IOBuf* out);
 // Put decompressed `in' into `out'.
 bool SnappyDecompress(const butil::IOBuf& in, butil::IOBuf* out);
 
+// Same as above but using the snappy framing format: the input is cut into
+// chunks of at most 64KB which are compressed independently and carry a
+// masked CRC32C each. Peak memory is bounded by the chunk size (instead of
+// the whole body), corrupted transfers are caught by the per-chunk CRC, and
+// large bodies compress concurrently on bthreads just like gzip/zstd when
+// -snappy_framed_parallel_compress_threshold is turned on.
+bool SnappyFramedCompress(const google::protobuf::Message& msg, butil::IOBuf* buf);
+bool SnappyFramedDecompress(const butil::IOBuf& data, google::protobuf::Message* msg);
+bool SnappyFramedCompress(const butil::IOBuf& in, butil::IOBuf* out);
+bool SnappyFramedDecompress(const butil::IOBuf& in, butil::IOBuf* out);
+
 }  // namespace policy
 } // namespace brpc
 
@@ -20,6 +20,7 @@
 #include <google/protobuf/message.h>             // Message
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/io/coded_stream.h>
+#include "butil/memory/scope_guard.h"
 #include "butil/time.h"
 #include "brpc/controller.h"                // Controller
 #include "brpc/socket.h"                    // Socket
@@ -28,11 +29,13 @@
 #include "brpc/span.h"
 #include "brpc/compress.h"                  // ParseFromCompressedData
 #include "brpc/rpc_dump.h"
+#include "brpc/rpc_pb_message_factory.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/sofa_pbrpc_meta.pb.h" // SofaRpcMeta
 #include "brpc/policy/sofa_pbrpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/rpc_deadline.h"
 
 extern "C" {
 void bthread_assign_data(void* data);
@@ -205,9 +208,8 @@ ParseResult ParseSofaMessage(butil::IOBuf* source, Socket* socket,
 // Assemble response packet using `correlation_id', `controller',
 // `res', and then write this packet to `sock'
 static void SendSofaResponse(int64_t correlation_id,
-                             Controller* cntl, 
-                             const google::protobuf::Message* req,
-                             const google::protobuf::Message* res,
+                             Controller* cntl,
+                             RpcPBMessages* messages,
                              const Server* server,
                              MethodStatus* method_status,
                              int64_t received_us) {
@@ -219,8 +221,15 @@ static void SendSofaResponse(int64_t correlation_id,
     Socket* sock = accessor.get_sending_socket();
     std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
     ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
-    std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-    std::unique_ptr<const google::protobuf::Message> recycle_res(res);
+    const google::protobuf::Message* res =
+        NULL == messages ? NULL : messages->Response();
+    // Return request/response messages to the factory at the end of
+    // this function.
+    BRPC_SCOPE_EXIT {
+        if (NULL != messages) {
+            server->options().rpc_pb_message_factory->Return(messages);
+        }
+    };
 
     if (cntl->IsCloseConnection()) {
         sock->SetFailed();
@@ -308,6 +317,7 @@ static void SendSofaResponse(int64_t correlation_id,
 
 // Defined in baidu_rpc_protocol.cpp
 void EndRunningCallMethodInPool(
+    MethodStatus* method_status,
     ::google::protobuf::Service* service,
     const ::google::protobuf::MethodDescriptor* method,
     ::google::protobuf::RpcController* controller,
@@ -346,8 +356,7 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
         LOG(WARNING) << "Fail to new Controller";
         return;
     }
-    std::unique_ptr<google::protobuf::Message> req;
-    std::unique_ptr<google::protobuf::Message> res;
+    RpcPBMessages* messages = NULL;
 
     ControllerPrivateAccessor accessor(cntl.get());
     ServerPrivateAccessor server_accessor(server);
@@ -428,6 +437,14 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
                 break;
             }
         }
+        if (FLAGS_usercode_in_pthread &&
+            method_status != NULL &&
+            method_status->usercode_pool() != NULL &&
+            TooManyUserCode(method_status->usercode_pool())) {
+            cntl->SetFailed(ELIMIT, "Too many user code to run when"
+                            " -usercode_in_pthread is on");
+            break;
+        }
         google::protobuf::Service* svc = sp->service;
         const google::protobuf::MethodDescriptor* method = sp->method;
         accessor.set_method(method);
@@ -439,50 +456,55 @@ void ProcessSofaRequest(InputMessageBase* msg_base) {
         if (span) {
             span->ResetServerSpanName(method->full_name());
         }
-        req.reset(svc->GetRequestPrototype(method).New());
-        if (!ParseFromCompressedData(msg->payload, req.get(), req_cmp_type)) {
+        messages = server->options().rpc_pb_message_factory->Get(*svc, *method);
+        if (!ParseFromCompressedData(
+                msg->payload, messages->Request(), req_cmp_type)) {
             cntl->SetFailed(EREQUEST, "Fail to parse request message, "
-                            "CompressType=%d, size=%d", 
+                            "CompressType=%d, size=%d",
                             req_cmp_type, (int)msg->payload.size());
             break;
         }
 
-        res.reset(svc->GetResponsePrototype(method).New());
         // `socket' will be held until response has been sent
         google::protobuf::Closure* done = ::brpc::NewCallback<
-            int64_t, Controller*, const google::protobuf::Message*,
-            const google::protobuf::Message*, const Server*,
-                  MethodStatus *, int64_t>(
+            int64_t, Controller*, RpcPBMessages*,
+            const Server*, MethodStatus*, int64_t>(
                     &SendSofaResponse, correlation_id, cntl.get(),
-                    req.get(), res.get(), server,
+                    messages, server,
                     method_status, msg->received_us());
 
         msg.reset();  // optional, just release resource ASAP
 
-        // `cntl', `req' and `res' will be deleted inside `done'
+        // `cntl' and `messages' will be recycled inside `done'
         if (span) {
             span->set_start_callback_us(butil::cpuwide_time_us());
             span->AsParent();
         }
+        // Clear a stale deadline possibly left by a previous request served
+        // with a reused keytable.
+        SetCurrentRpcDeadline(cntl->deadline_us());
         if (!FLAGS_usercode_in_pthread) {
-            return svc->CallMethod(method, cntl.release(), 
-                                   req.release(), res.release(), done);
+            return svc->CallMethod(method, cntl.release(),
+                                   messages->Request(),
+                                   messages->Response(), done);
         }
         if (BeginRunningUserCode()) {
-            svc->CallMethod(method, cntl.release(), 
-                            req.release(), res.release(), done);
+            svc->CallMethod(method, cntl.release(),
+                            messages->Request(),
+                            messages->Response(), done);
             return EndRunningUserCodeInPlace();
         } else {
             return EndRunningCallMethodInPool(
-                svc, method, cntl.release(),
-                req.release(), res.release(), done);
+                method_status, svc, method, cntl.release(),
+                messages->Request(),
+                messages->Response(), done);
         }
     } while (false);
 
-    // `cntl', `req' and `res' will be deleted inside `SendSofaResponse'
+    // `cntl' and `messages' will be recycled inside `SendSofaResponse'
     // `socket' will be held until response has been sent
     SendSofaResponse(correlation_id, cntl.release(),
-                     req.release(), res.release(), server,
+                     messages, server,
                      method_status, msg->received_us());
 }
 
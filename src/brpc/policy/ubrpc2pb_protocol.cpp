@@ -169,8 +169,9 @@ void UbrpcAdaptor::ParseNsheadMeta(
 void UbrpcAdaptor::ParseRequestFromIOBuf(
     const NsheadMeta&, const NsheadMessage& raw_req,
     Controller* cntl, google::protobuf::Message* pb_req) const {
-    const std::string& msg_name = pb_req->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = pb_req->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (handler.parse_body == NULL) {
         return cntl->SetFailed(EREQUEST, "Fail to find parser of %s",
                                msg_name.c_str());
@@ -227,8 +228,9 @@ void UbrpcAdaptor::SerializeResponseToIOBuf(
     //     return AppendError(meta, cntl, raw_res->body);
     // }
 
-    const std::string& msg_name = pb_res->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = pb_res->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (handler.serialize_body == NULL) {
         cntl->SetFailed(ERESPONSE, "Fail to find serializer of %s",
                         msg_name.c_str());
@@ -279,8 +281,9 @@ static void ParseResponse(Controller* cntl, butil::IOBuf& buf,
         // silently ignore response.
         return;
     }
-    const std::string& msg_name = res->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = res->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (handler.parse_body == NULL) {
         return cntl->SetFailed(ERESPONSE, "Fail to find parser of %s",
                                msg_name.c_str());
@@ -480,8 +483,9 @@ static void SerializeUbrpcRequest(butil::IOBuf* buf, Controller* cntl,
     if (cntl->method() == NULL) {
         return cntl->SetFailed(ENOMETHOD, "method is NULL");
     }
-    const std::string& msg_name = request->GetDescriptor()->full_name();
-    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(msg_name);
+    const google::protobuf::Descriptor* desc = request->GetDescriptor();
+    const std::string& msg_name = desc->full_name();
+    mcpack2pb::MessageHandler handler = mcpack2pb::find_message_handler(desc);
     if (handler.serialize_body == NULL) {
         return cntl->SetFailed(EREQUEST, "Fail to find serializer of %s",
                                msg_name.c_str());
@@ -16,7 +16,7 @@
 // under the License.
 
 
-#include <algorithm>
+#include <limits>
 
 #include "butil/fast_rand.h"
 #include "bthread/prime_offset.h"
@@ -27,11 +27,6 @@
 namespace brpc {
 namespace policy {
 
-static bool server_compare(const WeightedRandomizedLoadBalancer::Server& lhs,
-                           const WeightedRandomizedLoadBalancer::Server& rhs) {
-        return lhs.current_weight_sum < rhs.current_weight_sum;
-}
-
 bool WeightedRandomizedLoadBalancer::Add(Servers& bg, const ServerId& id) {
     if (bg.server_list.capacity() < 128) {
         bg.server_list.reserve(128);
@@ -81,12 +76,33 @@ bool WeightedRandomizedLoadBalancer::Remove(Servers& bg, const ServerId& id) {
     return false;
 }
 
+bool WeightedRandomizedLoadBalancer::AddAndRebuild(
+    Servers& bg, const ServerId& id) {
+    if (!Add(bg, id)) {
+        return false;
+    }
+    RebuildAliasTable(bg);
+    return true;
+}
+
+bool WeightedRandomizedLoadBalancer::RemoveAndRebuild(
+    Servers& bg, const ServerId& id) {
+    if (!Remove(bg, id)) {
+        return false;
+    }
+    RebuildAliasTable(bg);
+    return true;
+}
+
 size_t WeightedRandomizedLoadBalancer::BatchAdd(
     Servers& bg, const std::vector<ServerId>& servers) {
     size_t count = 0;
     for (size_t i = 0; i < servers.size(); ++i) {
         count += !!Add(bg, servers[i]);
     }
+    if (count > 0) {
+        RebuildAliasTable(bg);
+    }
     return count;
 }
 
@@ -96,15 +112,66 @@ size_t WeightedRandomizedLoadBalancer::BatchRemove(
     for (size_t i = 0; i < servers.size(); ++i) {
         count += !!Remove(bg, servers[i]);
     }
+    if (count > 0) {
+        RebuildAliasTable(bg);
+    }
     return count;
 }
 
+// Rebuild the table for the alias method (Vose's algorithm), O(n). This
+// runs inside Modify() of DoublyBufferedData so that SelectServer, which
+// may run much more frequently than server list changes, never pays for
+// the build.
+void WeightedRandomizedLoadBalancer::RebuildAliasTable(Servers& bg) {
+    const size_t n = bg.server_list.size();
+    bg.alias_table.resize(n);
+    if (n == 0) {
+        return;
+    }
+    // Probabilities scaled to average at 1.
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    small.reserve(n);
+    large.reserve(n);
+    const double multiplier = (double)n / (double)bg.weight_sum;
+    for (size_t i = 0; i < n; ++i) {
+        scaled[i] = bg.server_list[i].weight * multiplier;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+        large.pop_back();
+        bg.alias_table[s].threshold = (uint32_t)(scaled[s] * 4294967296.0);
+        bg.alias_table[s].alias = l;
+        // The large entry fills the rest of the small one's slot.
+        scaled[l] -= 1.0 - scaled[s];
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+    // Remaining entries have probability 1 (modulo floating-point error),
+    // make them choose themselves unconditionally.
+    while (!large.empty()) {
+        const uint32_t l = large.back();
+        large.pop_back();
+        bg.alias_table[l].threshold = std::numeric_limits<uint32_t>::max();
+        bg.alias_table[l].alias = l;
+    }
+    while (!small.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        bg.alias_table[s].threshold = std::numeric_limits<uint32_t>::max();
+        bg.alias_table[s].alias = s;
+    }
+}
+
 bool WeightedRandomizedLoadBalancer::AddServer(const ServerId& id) {
-    return _db_servers.Modify(Add, id);
+    return _db_servers.Modify(AddAndRebuild, id);
 }
 
 bool WeightedRandomizedLoadBalancer::RemoveServer(const ServerId& id) {
-    return _db_servers.Modify(Remove, id);
+    return _db_servers.Modify(RemoveAndRebuild, id);
 }
 
 size_t WeightedRandomizedLoadBalancer::AddServersInBatch(
@@ -132,14 +199,17 @@ int WeightedRandomizedLoadBalancer::SelectServer(const SelectIn& in, SelectOut*
     }
 
     butil::FlatSet<SocketId> random_traversed;
-    uint64_t weight_sum = s->weight_sum;
     for (size_t i = 0; i < n; ++i) {
-        uint64_t random_weight = butil::fast_rand_less_than(weight_sum);
-        const Server random_server(0, 0, random_weight);
-        const auto& server =
-            std::lower_bound(s->server_list.begin(), s->server_list.end(),
-                             random_server, server_compare);
-        const SocketId id = server->id;
+        // O(1) weighted pick with the alias method: high 32 bits of the
+        // random number choose the entry, low 32 bits are the fraction
+        // compared against its threshold.
+        const uint64_t r = butil::fast_rand();
+        size_t index = (size_t)(((r >> 32) * n) >> 32);
+        const AliasNode& node = s->alias_table[index];
+        if ((uint32_t)r >= node.threshold) {
+            index = node.alias;
+        }
+        const SocketId id = s->server_list[index].id;
         if (ExcludedServers::IsExcluded(in.excluded, id)) {
             continue;
         }
@@ -47,9 +47,20 @@ public:
         uint32_t weight;
         uint64_t current_weight_sum;
     };
+    // One entry per server for O(1) weighted selection with the alias
+    // method: pick a uniformly random entry, then return the entry itself
+    // if a uniform 32-bit fraction is below `threshold', or `alias'(an
+    // index into server_list) otherwise.
+    struct AliasNode {
+        uint32_t threshold;
+        uint32_t alias;
+    };
     struct Servers {
         // The value is configured weight and weight_sum for each server.
         std::vector<Server> server_list;
+        // Rebuilt from server_list on each modification, read by
+        // SelectServer. Always sized as server_list.
+        std::vector<AliasNode> alias_table;
         // The value is the index of the server in "server_list".
         std::map<SocketId, size_t> server_map;
         uint64_t weight_sum;
@@ -59,8 +70,11 @@ public:
 private:
     static bool Add(Servers& bg, const ServerId& id);
     static bool Remove(Servers& bg, const ServerId& id);
+    static bool AddAndRebuild(Servers& bg, const ServerId& id);
+    static bool RemoveAndRebuild(Servers& bg, const ServerId& id);
     static size_t BatchAdd(Servers& bg, const std::vector<ServerId>& servers);
     static size_t BatchRemove(Servers& bg, const std::vector<ServerId>& servers);
+    static void RebuildAliasTable(Servers& bg);
     static bool IsServerAvailable(SocketId id, SocketUniquePtr* out);
 
     butil::DoublyBufferedData<Servers> _db_servers;
@@ -0,0 +1,266 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#if BRPC_WITH_ZSTD
+
+#include <pthread.h>
+#include <zstd.h>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/file_util.h"
+#include "butil/thread_local.h"
+#include "brpc/policy/zstd_compress.h"
+#include "brpc/protocol.h"
+#include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
+
+namespace brpc {
+namespace policy {
+
+DEFINE_int32(zstd_compress_level, 3, "Compression level of zstd, smaller "
+             "levels are faster while bigger levels compress better");
+DEFINE_string(zstd_dict_file, "", "If non-empty, load a zstd dictionary from "
+              "this file at the first (de)compression and use it ever after. "
+              "Both sides must load the same dictionary");
+
+static bool validate_zstd_compress_level(const char*, int32_t v) {
+    return v >= 1 && v <= ZSTD_maxCLevel();
+}
+BRPC_VALIDATE_GFLAG(zstd_compress_level, validate_zstd_compress_level);
+
+DEFINE_int32(zstd_parallel_compress_threshold, 0,
+             "Compress zstd bodies not smaller than so many bytes by chunks "
+             "on multiple bthreads, 0 disables the feature. The output "
+             "consists of multiple concatenated zstd frames which standard "
+             "decoders (and ZstdDecompress in this file) handle, make sure "
+             "non-brpc receivers do before enabling this");
+BRPC_VALIDATE_GFLAG(zstd_parallel_compress_threshold, NonNegativeInteger);
+
+// Chunk size of parallel compression, see gzip_compress.cpp for rationale.
+static const size_t PARALLEL_COMPRESS_CHUNK_BYTES = 512 * 1024;
+
+// The dictionary is loaded once and never freed as (de)compressions may
+// happen until process termination.
+static pthread_once_t g_zstd_dict_once = PTHREAD_ONCE_INIT;
+static ZSTD_CDict* g_zstd_cdict = NULL;
+static ZSTD_DDict* g_zstd_ddict = NULL;
+
+static void LoadZstdDict() {
+    if (FLAGS_zstd_dict_file.empty()) {
+        return;
+    }
+    std::string dict;
+    if (!butil::ReadFileToString(
+                butil::FilePath(FLAGS_zstd_dict_file), &dict)) {
+        LOG(ERROR) << "Fail to read zstd dictionary from `"
+                   << FLAGS_zstd_dict_file << "', continue without it";
+        return;
+    }
+    g_zstd_cdict = ZSTD_createCDict(dict.data(), dict.size(),
+                                    FLAGS_zstd_compress_level);
+    g_zstd_ddict = ZSTD_createDDict(dict.data(), dict.size());
+    if (g_zstd_cdict == NULL || g_zstd_ddict == NULL) {
+        LOG(ERROR) << "Fail to create zstd dictionary from `"
+                   << FLAGS_zstd_dict_file << "'";
+    }
+}
+
+// ZSTD_createCCtx/DCtx allocate and initialize sizable workspaces, keep
+// them in TLS and reuse across messages. Safe for bthreads as each
+// (de)compression runs to completion without suspending.
+static __thread ZSTD_CCtx* tls_zstd_cctx = NULL;
+static __thread ZSTD_DCtx* tls_zstd_dctx = NULL;
+
+static void FreeZstdCCtx(void* cctx) {
+    ZSTD_freeCCtx((ZSTD_CCtx*)cctx);
+    tls_zstd_cctx = NULL;
+}
+
+static void FreeZstdDCtx(void* dctx) {
+    ZSTD_freeDCtx((ZSTD_DCtx*)dctx);
+    tls_zstd_dctx = NULL;
+}
+
+static ZSTD_CCtx* GetZstdCCtx() {
+    if (tls_zstd_cctx == NULL) {
+        tls_zstd_cctx = ZSTD_createCCtx();
+        if (tls_zstd_cctx != NULL) {
+            butil::thread_atexit(FreeZstdCCtx, tls_zstd_cctx);
+        }
+    }
+    return tls_zstd_cctx;
+}
+
+static ZSTD_DCtx* GetZstdDCtx() {
+    if (tls_zstd_dctx == NULL) {
+        tls_zstd_dctx = ZSTD_createDCtx();
+        if (tls_zstd_dctx != NULL) {
+            butil::thread_atexit(FreeZstdDCtx, tls_zstd_dctx);
+        }
+    }
+    return tls_zstd_dctx;
+}
+
+// Compress `in' into one zstd frame appended to `out'.
+static bool ZstdCompressFrame(const butil::IOBuf& in, butil::IOBuf* out) {
+    // zstd's one-shot API needs contiguous buffers.
+    const std::string src = in.to_string();
+    const size_t bound = ZSTD_compressBound(src.size());
+    std::string dst;
+    dst.resize(bound);
+    ZSTD_CCtx* cctx = GetZstdCCtx();
+    if (cctx == NULL) {
+        LOG(WARNING) << "Fail to create ZSTD_CCtx";
+        return false;
+    }
+    size_t r;
+    if (g_zstd_cdict != NULL) {
+        r = ZSTD_compress_usingCDict(cctx, &dst[0], bound,
+                                     src.data(), src.size(), g_zstd_cdict);
+    } else {
+        r = ZSTD_compressCCtx(cctx, &dst[0], bound, src.data(), src.size(),
+                              FLAGS_zstd_compress_level);
+    }
+    if (ZSTD_isError(r)) {
+        LOG(WARNING) << "Fail to zstd::compress, " << ZSTD_getErrorName(r);
+        return false;
+    }
+    out->append(dst.data(), r);
+    return true;
+}
+
+bool ZstdCompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    pthread_once(&g_zstd_dict_once, LoadZstdDict);
+    if (FLAGS_zstd_parallel_compress_threshold > 0 &&
+        in.size() >= (size_t)FLAGS_zstd_parallel_compress_threshold) {
+        return ParallelCompress(in, out, PARALLEL_COMPRESS_CHUNK_BYTES,
+                                ZstdCompressFrame);
+    }
+    return ZstdCompressFrame(in, out);
+}
+
+bool ZstdDecompress(const butil::IOBuf& in, butil::IOBuf* out) {
+    pthread_once(&g_zstd_dict_once, LoadZstdDict);
+    ZSTD_DCtx* dctx = GetZstdDCtx();
+    if (dctx == NULL) {
+        LOG(WARNING) << "Fail to create ZSTD_DCtx";
+        return false;
+    }
+    // The streaming API handles inputs consisting of multiple concatenated
+    // frames(e.g. produced by the parallel mode above) and needs no
+    // contiguous copy of the input.
+    size_t r = ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    if (!ZSTD_isError(r) && g_zstd_ddict != NULL) {
+        r = ZSTD_DCtx_refDDict(dctx, g_zstd_ddict);
+    }
+    if (ZSTD_isError(r)) {
+        LOG(WARNING) << "Fail to reset ZSTD_DCtx, " << ZSTD_getErrorName(r);
+        return false;
+    }
+    butil::IOBufAsZeroCopyInputStream src(in);
+    butil::IOBufAsZeroCopyOutputStream dst(out);
+    ZSTD_inBuffer input = { NULL, 0, 0 };
+    ZSTD_outBuffer output = { NULL, 0, 0 };
+    bool read_done = false;
+    r = 0;
+    while (true) {
+        if (input.pos == input.size) {
+            const void* data = NULL;
+            int size = 0;
+            if (src.Next(&data, &size)) {
+                input.src = data;
+                input.size = size;
+                input.pos = 0;
+            } else {
+                read_done = true;
+            }
+        }
+        if (read_done && input.pos == input.size &&
+            (r == 0 || output.pos < output.size)) {
+            // Input exhausted and the frame ended(r == 0), or the last call
+            // did not fill the output, i.e. nothing is buffered in dctx.
+            break;
+        }
+        if (output.pos == output.size) {
+            void* data = NULL;
+            int size = 0;
+            if (!dst.Next(&data, &size)) {
+                LOG(WARNING) << "Fail to allocate output of zstd::decompress";
+                return false;
+            }
+            output.dst = data;
+            output.size = size;
+            output.pos = 0;
+        }
+        r = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(r)) {
+            LOG(WARNING) << "Fail to zstd::decompress, "
+                         << ZSTD_getErrorName(r);
+            return false;
+        }
+    }
+    if (r != 0) {  // in the middle of a frame
+        LOG(WARNING) << "Fail to zstd::decompress, the input is truncated";
+        return false;
+    }
+    if (output.size > output.pos) {
+        dst.BackUp(output.size - output.pos);
+    }
+    return true;
+}
+
+bool ZstdCompress(const google::protobuf::Message& msg, butil::IOBuf* buf) {
+    butil::IOBuf serialized_pb;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&serialized_pb);
+    bool ok;
+    if (msg.GetDescriptor() == Serializer::descriptor()) {
+        ok = ((const Serializer&)msg).SerializeTo(&wrapper);
+    } else {
+        ok = msg.SerializeToZeroCopyStream(&wrapper);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to serialize input pb="
+                     << msg.GetDescriptor()->full_name();
+        return false;
+    }
+    return ZstdCompress(serialized_pb, buf);
+}
+
+bool ZstdDecompress(const butil::IOBuf& data, google::protobuf::Message* msg) {
+    butil::IOBuf binary_pb;
+    if (!ZstdDecompress(data, &binary_pb)) {
+        return false;
+    }
+    bool ok;
+    butil::IOBufAsZeroCopyInputStream stream(binary_pb);
+    if (msg->GetDescriptor() == Deserializer::descriptor()) {
+        ok = ((Deserializer*)msg)->DeserializeFrom(&stream);
+    } else {
+        ok = msg->ParseFromZeroCopyStream(&stream);
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to deserialize input message="
+                     << msg->GetDescriptor()->full_name();
+    }
+    return ok;
+}
+
+}  // namespace policy
+} // namespace brpc
+
+#endif // BRPC_WITH_ZSTD
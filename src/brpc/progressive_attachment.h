@@ -31,6 +31,7 @@ namespace brpc {
 
 class ProgressiveAttachment : public SharedObject {
 friend class Controller;
+friend class WebSocketConnection;
 public:
     // [Thread-safe]
     // Write `data' as one HTTP chunk to peer ASAP.
@@ -0,0 +1,229 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <unistd.h>
+#include <sys/mman.h>                   // mmap, munmap
+#include "butil/logging.h"
+#include "butil/time.h"                 // butil::gettimeofday_us
+#include "bthread/bthread.h"
+#include "brpc/progressive_writer.h"
+#include "brpc/progressive_attachment.h"
+#include "brpc/errno.pb.h"
+
+
+namespace brpc {
+
+// Read the file region in pieces of this size at most, which bounds the
+// memory used by one pull no matter how large the region is.
+static const size_t FILE_REGION_PIECE_SIZE = 512 * 1024;
+
+namespace {
+class FileRegionWriter : public ProgressiveWriter {
+public:
+    FileRegionWriter(int fd, off_t offset, size_t length,
+                     int64_t max_bytes_per_second)
+        : _fd(fd)
+        , _offset(offset)
+        , _remaining(length)
+        , _max_bps(max_bytes_per_second)
+        , _quota_bytes(0)
+        , _last_refill_us(0)
+        , _use_mmap(true) {}
+
+    butil::Status OnWriteOnePart(butil::IOBuf* data) override {
+        if (_remaining == 0) {
+            return butil::Status::OK();  // ends the body.
+        }
+        const size_t max_count =
+            std::min(_remaining, FILE_REGION_PIECE_SIZE);
+        ThrottleBeforeReading(max_count);
+        if (_use_mmap) {
+            const int rc = AppendMappedPiece(data, max_count);
+            if (rc == 0) {
+                return butil::Status::OK();
+            }
+            // Some files (e.g. under /proc) are not mmapable; fall back
+            // to copying reads permanently for this region.
+            _use_mmap = false;
+        }
+        butil::IOPortal portal;
+        ssize_t nr = -1;
+        do {
+            nr = portal.pappend_from_file_descriptor(_fd, _offset, max_count);
+        } while (nr < 0 && errno == EINTR);
+        if (nr < 0) {
+            return butil::Status(errno, "Fail to read fd=%d at offset=%lld: %s",
+                                 _fd, (long long)_offset, berror());
+        }
+        if (nr == 0) {
+            // The file is shorter than the declared region. Aborting is
+            // better than ending the chunked body normally which would
+            // make the truncation invisible to the peer.
+            return butil::Status(EIO, "Reach EOF of fd=%d at offset=%lld"
+                                 " with %llu bytes left", _fd,
+                                 (long long)_offset,
+                                 (unsigned long long)_remaining);
+        }
+        _offset += nr;
+        _remaining -= nr;
+        data->append(butil::IOBuf::Movable(portal));
+        return butil::Status::OK();
+    }
+
+    void OnEndOfWriting(const butil::Status&) override { delete this; }
+
+private:
+    ~FileRegionWriter() override { close(_fd); }
+
+    // Append [_offset, _offset + count) as a zero-copy block referencing
+    // a private mapping of the file: no user-space copy is made and the
+    // bytes go from the page cache to the socket in writev(), keeping
+    // memory flat for multi-GB downloads. The mapping is released by the
+    // IOBuf deleter after the block was transmitted.
+    // Returns 0 on success, -1 otherwise.
+    int AppendMappedPiece(butil::IOBuf* data, size_t count) {
+        static const size_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+        const off_t aligned_offset = _offset & ~(off_t)page_mask;
+        const size_t head = _offset - aligned_offset;
+        const size_t map_len = count + head;
+        void* m = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE,
+                       _fd, aligned_offset);
+        if (m == MAP_FAILED) {
+            return -1;
+        }
+        // The piece is about to be written out sequentially exactly once.
+        madvise(m, map_len, MADV_SEQUENTIAL);
+        if (data->append_user_data(
+                (char*)m + head, count,
+                [m, map_len](void*) { munmap(m, map_len); }) != 0) {
+            munmap(m, map_len);
+            return -1;
+        }
+        _offset += count;
+        _remaining -= count;
+        return 0;
+    }
+
+    // Token-bucket pacing: delay the pull until `count' more bytes fit
+    // into the budget of _max_bps bytes per second. Blocking here simply
+    // delays the transmission (see ProgressiveWriter's doc), the peer
+    // keeps receiving at the configured rate.
+    void ThrottleBeforeReading(size_t count) {
+        if (_max_bps <= 0) {
+            return;
+        }
+        const int64_t now_us = butil::gettimeofday_us();
+        if (_last_refill_us == 0) {
+            _last_refill_us = now_us;
+        }
+        _quota_bytes += (now_us - _last_refill_us) * _max_bps / 1000000;
+        // Cap the accumulated burst at one second worth of quota.
+        _quota_bytes = std::min(_quota_bytes, _max_bps);
+        _last_refill_us = now_us;
+        if (_quota_bytes < (int64_t)count) {
+            const int64_t wait_us =
+                ((int64_t)count - _quota_bytes) * 1000000 / _max_bps;
+            bthread_usleep(wait_us);
+            // The sleep earned exactly the missing part of the budget.
+            _quota_bytes = count;
+            _last_refill_us = butil::gettimeofday_us();
+        }
+        _quota_bytes -= count;
+    }
+
+    int _fd;
+    off_t _offset;
+    size_t _remaining;
+    int64_t _max_bps;
+    int64_t _quota_bytes;
+    int64_t _last_refill_us;
+    bool _use_mmap;
+};
+}  // namespace
+
+ProgressiveWriter* NewFileRegionWriter(int fd, off_t offset, size_t length) {
+    return NewFileRegionWriter(fd, offset, length, 0);
+}
+
+ProgressiveWriter* NewFileRegionWriter(int fd, off_t offset, size_t length,
+                                       int64_t max_bytes_per_second) {
+    if (fd < 0) {
+        LOG(ERROR) << "Invalid fd=" << fd;
+        return NULL;
+    }
+    return new FileRegionWriter(fd, offset, length, max_bytes_per_second);
+}
+
+struct ProgressiveWritingArgs {
+    butil::intrusive_ptr<ProgressiveAttachment> attachment;
+    ProgressiveWriter* writer;
+};
+
+static void* RunProgressiveWriting(void* raw_args) {
+    std::unique_ptr<ProgressiveWritingArgs> args(
+        static_cast<ProgressiveWritingArgs*>(raw_args));
+    butil::Status st;
+    while (true) {
+        butil::IOBuf part;
+        st = args->writer->OnWriteOnePart(&part);
+        if (!st.ok() || part.empty()) {
+            break;
+        }
+        int64_t sleep_us = 100;
+        while (args->attachment->Write(part) != 0) {
+            if (errno != EOVERCROWDED) {
+                st = butil::Status(errno, "Fail to write the attachment"
+                                   " into the socket: %s", berror());
+                break;
+            }
+            // The unwritten bytes of the connection (or the buffer saved
+            // before the RPC is done) exceeded the limit. Wait for the
+            // peer to consume some data before pulling the next part,
+            // which is what keeps memory flat for slow readers.
+            bthread_usleep(sleep_us);
+            if (sleep_us < 50000) {
+                sleep_us *= 2;
+            }
+        }
+        if (!st.ok()) {
+            break;
+        }
+    }
+    args->writer->OnEndOfWriting(st);
+    return NULL;
+}
+
+int StartProgressiveWriting(ProgressiveAttachment* pa,
+                            ProgressiveWriter* writer) {
+    std::unique_ptr<ProgressiveWritingArgs> args(new ProgressiveWritingArgs);
+    args->attachment.reset(pa);
+    args->writer = writer;
+    bthread_t th;
+    const int rc = bthread_start_background(
+        &th, NULL, RunProgressiveWriting, args.get());
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to start progressive writing: " << berror(rc);
+        writer->OnEndOfWriting(
+            butil::Status(rc, "Fail to start bthread: %s", berror(rc)));
+        return -1;
+    }
+    args.release();
+    return 0;
+}
+
+} // namespace brpc
@@ -0,0 +1,90 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_PROGRESSIVE_WRITER_H
+#define BRPC_PROGRESSIVE_WRITER_H
+
+#include "butil/iobuf.h"
+#include "butil/status.h"
+
+
+namespace brpc {
+
+class ProgressiveAttachment;
+
+// [Implement by user]
+// To write a very long or infinitely long body progressively without
+// buffering it entirely in memory. This is the pull-based counterpart of
+// ProgressiveAttachment: instead of user pushing chunks with Write(),
+// brpc pulls parts from this object in a background bthread whenever the
+// connection can accept more data, so memory usage stays flat regardless
+// of the body size.
+// Server-side usage:
+//   cntl->http_response().set_content_type("application/octet-stream");
+//   cntl->WriteProgressiveAttachmentBy(new MyProgressiveWriter);
+class ProgressiveWriter {
+public:
+    // Called to get the next part of the body.
+    // - Fill `*data' and return Status::OK() to continue the body.
+    // - Leave `*data' empty and return Status::OK() to end the body
+    //   normally.
+    // - Error returned is treated as *permanent*: the transmission is
+    //   aborted and the socket is closed.
+    // Blocking this function just delays the transmission, which is often
+    // the simplest way to wait for slowly-produced data.
+    virtual butil::Status OnWriteOnePart(butil::IOBuf* data) = 0;
+
+    // Called when no more parts will be pulled. The `status' is a hint
+    // for why this method is called.
+    // - status.ok(): all parts were written successfully.
+    // - otherwise: socket was broken or OnWriteOnePart() failed.
+    // This method will be called once and only once. No other methods
+    // will be called after. User can release the memory of this object
+    // inside.
+    virtual void OnEndOfWriting(const butil::Status& status) = 0;
+
+protected:
+    virtual ~ProgressiveWriter() {}
+};
+
+// Create a ProgressiveWriter emitting bytes [offset, offset + length) of
+// the file referred by `fd'. Pieces are appended as zero-copy blocks
+// referencing a mapping of the file (no user-space copy, flat memory even
+// for multi-GB regions); files that cannot be mmaped fall back to bounded
+// copying reads. `fd' is owned by the returned writer and closed when the
+// writing ends. The returned writer destroys itself inside
+// OnEndOfWriting().
+// `max_bytes_per_second' > 0 limits the transmission rate (with at most
+// one second of burst); 0 means unlimited.
+// Returns NULL if `fd' is invalid.
+ProgressiveWriter* NewFileRegionWriter(int fd, off_t offset, size_t length);
+ProgressiveWriter* NewFileRegionWriter(int fd, off_t offset, size_t length,
+                                       int64_t max_bytes_per_second);
+
+// [Called by Controller only]
+// Start a bthread pulling parts from `writer' and writing them as chunks
+// into `pa'. The bthread adds a reference to `pa' and guarantees that
+// writer->OnEndOfWriting() is called exactly once.
+// Returns 0 on success, -1 otherwise (OnEndOfWriting was already called).
+int StartProgressiveWriting(ProgressiveAttachment* pa,
+                            ProgressiveWriter* writer);
+
+} // namespace brpc
+
+
+#endif  // BRPC_PROGRESSIVE_WRITER_H
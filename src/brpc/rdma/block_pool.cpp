@@ -19,12 +19,16 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <vector>
 #include <gflags/gflags.h>
+#include "butil/atomicops.h"
 #include "butil/fast_rand.h"
 #include "butil/iobuf.h"
 #include "butil/object_pool.h"
+#include "butil/string_printf.h"
 #include "butil/thread_local.h"
+#include "bvar/passive_status.h"
 #include "bthread/bthread.h"
 #include "brpc/rdma/block_pool.h"
 
@@ -42,6 +46,10 @@ DEFINE_int32(rdma_memory_pool_tls_cache_num, 128, "Number of cached block in tls
 DEFINE_bool(rdma_memory_pool_user_specified_memory, false,
             "If true, the user must call UserExtendBlockPool() to extend "
             "memory. bRPC will not handle memory extension.");
+DEFINE_bool(rdma_memory_pool_use_hugepages, false,
+            "Try to back new regions with 2MB huge pages (MAP_HUGETLB), "
+            "falling back to regular pages when none are reserved. Fewer "
+            "page-table levels in the MR reduce NIC translation cost.");
 
 static RegisterCallback g_cb = NULL;
 
@@ -60,12 +68,22 @@ struct IdleNode {
     IdleNode* next;
 };
 
+// Tiers exchange memory in chunks of the largest block size, which also
+// equals the x86-64 huge page size.
+static const size_t CHUNK_SIZE = 2 * BYTES_IN_MB;
+
 struct Region {
-    Region() { start = 0; }
+    Region() { start = 0; chunk_types = NULL; hugepage = false; alloc_len = 0; }
     uintptr_t start;
     size_t size;
     uint32_t block_type;
     uint32_t id;  // lkey
+    // Block type of each CHUNK_SIZE chunk (offsets relative to start).
+    // Initially all block_type, changed when idle chunks migrate to
+    // another tier. NULL if allocation failed, disabling migration.
+    uint8_t* chunk_types;
+    bool hugepage;
+    size_t alloc_len;  // length to munmap for hugepage regions
 };
 
 static const int32_t RDMA_MEMORY_POOL_MIN_REGIONS = 1;
@@ -100,6 +118,10 @@ struct GlobalInfo {
 };
 static GlobalInfo* g_info = NULL;
 
+// Registered bytes currently tagged for each tier, for sizing the
+// rdma_memory_pool_* flags from data.
+static butil::atomic<size_t> g_tier_capacity[BLOCK_SIZE_COUNT];
+
 static inline Region* GetRegion(const void* buf) {
     if (!buf) {
         errno = EINVAL;
@@ -128,8 +150,26 @@ uint32_t GetRegionId(const void* buf) {
     return r->id;
 }
 
+static inline uint32_t GetBlockTypeOf(const Region* r, const void* buf) {
+    if (r->chunk_types) {
+        return r->chunk_types[((uintptr_t)buf - r->start) / CHUNK_SIZE];
+    }
+    return r->block_type;
+}
+
+static void FreeRegionMemory(void* base, bool hugepage, size_t alloc_len) {
+#ifdef MAP_HUGETLB
+    if (hugepage) {
+        munmap(base, alloc_len);
+        return;
+    }
+#endif
+    free(base);
+}
+
 static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
-                                 int block_type) {
+                                 int block_type, bool hugepage,
+                                 size_t alloc_len) {
     if (g_region_num == FLAGS_rdma_memory_pool_max_regions) {
         LOG(INFO) << "Memory pool reaches max regions";
         errno = ENOMEM;
@@ -137,7 +177,7 @@ static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
     }
     uint32_t id = g_cb(region_base, region_size);
     if (id == 0) {
-        free(region_base);
+        FreeRegionMemory(region_base, hugepage, alloc_len);
         return NULL;
     }
 
@@ -149,7 +189,7 @@ static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
             for (size_t j = 0; j < i; ++j) {
                 butil::return_object<IdleNode>(node[j]);
             }
-            free(region_base);
+            FreeRegionMemory(region_base, hugepage, alloc_len);
             return NULL;
         }
     }
@@ -159,6 +199,15 @@ static void* ExtendBlockPoolImpl(void* region_base, size_t region_size,
     region->size = region_size;
     region->id = id;
     region->block_type = block_type;
+    region->hugepage = hugepage;
+    region->alloc_len = alloc_len;
+    const size_t nchunk = (region_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    region->chunk_types = (uint8_t*)malloc(nchunk);
+    if (region->chunk_types) {
+        memset(region->chunk_types, block_type, nchunk);
+    }
+    g_tier_capacity[block_type].fetch_add(region_size,
+                                          butil::memory_order_relaxed);
 
     for (size_t i = 0; i < g_buckets; ++i) {
         node[i]->start = (void*)(region->start + i * (region_size / g_buckets));
@@ -192,12 +241,36 @@ static void* ExtendBlockPool(size_t region_size, int block_type) {
     LOG(INFO) << "Start extend rdma memory " << region_size / BYTES_IN_MB << "MB";
 
     void* region_base = NULL;
-    if (posix_memalign(&region_base, 4096, region_size) != 0) {
-        PLOG_EVERY_SECOND(ERROR) << "Memory not enough";
-        return NULL;
+    bool hugepage = false;
+    size_t alloc_len = region_size;
+#ifdef MAP_HUGETLB
+    if (FLAGS_rdma_memory_pool_use_hugepages) {
+        // mmap length must be a multiple of the huge page size; only
+        // region_size bytes of it are handed to the pool.
+        alloc_len = (region_size + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+        region_base = mmap(NULL, alloc_len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region_base == MAP_FAILED) {
+            PLOG_EVERY_SECOND(WARNING)
+                << "Fail to mmap " << alloc_len / BYTES_IN_MB << "MB of huge"
+                   " pages, falling back to regular pages. Reserve huge pages"
+                   " via vm.nr_hugepages to make use of them";
+            region_base = NULL;
+        } else {
+            hugepage = true;
+        }
+    }
+#endif
+    if (!region_base) {
+        alloc_len = region_size;
+        if (posix_memalign(&region_base, 4096, region_size) != 0) {
+            PLOG_EVERY_SECOND(ERROR) << "Memory not enough";
+            return NULL;
+        }
     }
 
-    return ExtendBlockPoolImpl(region_base, region_size, block_type);
+    return ExtendBlockPoolImpl(region_base, region_size, block_type,
+                               hugepage, alloc_len);
 }
 
 void* ExtendBlockPoolByUser(void* region_base, size_t region_size,
@@ -224,7 +297,46 @@ void* ExtendBlockPoolByUser(void* region_base, size_t region_size,
         region_size * BYTES_IN_MB / g_block_size[block_type] / g_buckets;
     region_size *= g_block_size[block_type] * g_buckets;
 
-    return ExtendBlockPoolImpl(region_base, region_size, block_type);
+    return ExtendBlockPoolImpl(region_base, region_size, block_type,
+                               false/*hugepage*/, region_size);
+}
+
+static size_t GetTierIdleBytes(void* arg) {
+    const int type = (int)(intptr_t)arg;
+    if (g_info == NULL) {
+        return 0;
+    }
+    size_t len = 0;
+    for (size_t i = 0; i < g_buckets; ++i) {
+        len += g_info->idle_size[type][i];
+    }
+    if (type == BLOCK_DEFAULT) {
+        for (size_t i = 0; i < g_tls_info_cnt; ++i) {
+            len += *g_tls_info[i] * g_block_size[BLOCK_DEFAULT];
+        }
+    }
+    return len;
+}
+
+static size_t GetTierCapacityBytes(void* arg) {
+    return g_tier_capacity[(int)(intptr_t)arg].load(
+        butil::memory_order_relaxed);
+}
+
+// Read-only probes, values are approximate under concurrent alloc/dealloc.
+// Registered once and never deleted so that UT-style Init/Destroy cycles
+// do not re-register the same bvar names.
+static pthread_once_t s_tier_bvar_once = PTHREAD_ONCE_INIT;
+static void CreateTierBvarsOrDie() {
+    for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
+        const size_t kb = g_block_size[i] / 1024;
+        new bvar::PassiveStatus<size_t>(
+            butil::string_printf("rdma_memory_pool_tier_%zuk_capacity_bytes", kb),
+            GetTierCapacityBytes, (void*)(intptr_t)i);
+        new bvar::PassiveStatus<size_t>(
+            butil::string_printf("rdma_memory_pool_tier_%zuk_idle_bytes", kb),
+            GetTierIdleBytes, (void*)(intptr_t)i);
+    }
 }
 
 bool InitBlockPool(RegisterCallback cb) {
@@ -310,6 +422,7 @@ bool InitBlockPool(RegisterCallback cb) {
 
     g_dump_mutex = new butil::Mutex;
     g_tls_info_mutex = new butil::Mutex;
+    pthread_once(&s_tier_bvar_once, CreateTierBvarsOrDie);
 
     if (FLAGS_rdma_memory_pool_user_specified_memory) {
         return true;
@@ -413,6 +526,125 @@ static void* AllocBlockFrom(int block_type) {
     return ptr;
 }
 
+// Carve one idle CHUNK_SIZE chunk out of another tier's free lists and
+// retag it for `to_type', without touching the registration: all tiers
+// live inside registered regions, only the per-chunk type changes. The
+// span must be chunk-aligned relative to its region so the type tags
+// stay exact. Such spans exist in parts of a region that have not been
+// carved into blocks yet -- precisely the "tier sitting idle" case;
+// individual freed blocks of a churned tier are not coalesced back.
+// Returns NULL if no tier can donate.
+static void* BorrowChunkFrom(int to_type) {
+    for (int from = 0; from < BLOCK_SIZE_COUNT; ++from) {
+        if (from == to_type) {
+            continue;
+        }
+        for (size_t j = 0; j < g_buckets; ++j) {
+            void* chunk = NULL;
+            Region* chunk_region = NULL;
+            {
+                BAIDU_SCOPED_LOCK(*g_info->lock[from][j]);
+                IdleNode* prev = NULL;
+                for (IdleNode* n = g_info->idle_list[from][j]; n;
+                     prev = n, n = n->next) {
+                    Region* r = GetRegion(n->start);
+                    if (!r || !r->chunk_types) {
+                        continue;
+                    }
+                    const uintptr_t base = (uintptr_t)n->start;
+                    const uintptr_t aligned = base +
+                        (CHUNK_SIZE - (base - r->start) % CHUNK_SIZE) % CHUNK_SIZE;
+                    if (aligned + CHUNK_SIZE > base + n->len) {
+                        continue;
+                    }
+                    const size_t head = aligned - base;
+                    const size_t tail = base + n->len - (aligned + CHUNK_SIZE);
+                    if (head == 0 && tail == 0) {
+                        if (prev) {
+                            prev->next = n->next;
+                        } else {
+                            g_info->idle_list[from][j] = n->next;
+                        }
+                        butil::return_object<IdleNode>(n);
+                    } else if (head == 0) {
+                        n->start = (void*)(aligned + CHUNK_SIZE);
+                        n->len = tail;
+                    } else if (tail == 0) {
+                        n->len = head;
+                    } else {
+                        IdleNode* tn = butil::get_object<IdleNode>();
+                        if (!tn) {
+                            continue;
+                        }
+                        tn->start = (void*)(aligned + CHUNK_SIZE);
+                        tn->len = tail;
+                        tn->next = n->next;
+                        n->next = tn;
+                        n->len = head;
+                    }
+                    g_info->idle_size[from][j] -= CHUNK_SIZE;
+                    chunk = (void*)aligned;
+                    chunk_region = r;
+                    break;
+                }
+            }
+            if (chunk) {
+                // The chunk is now owned exclusively by this thread, the
+                // type tag can be flipped without a lock.
+                chunk_region->chunk_types[
+                    ((uintptr_t)chunk - chunk_region->start) / CHUNK_SIZE] =
+                    to_type;
+                g_tier_capacity[from].fetch_sub(
+                    CHUNK_SIZE, butil::memory_order_relaxed);
+                g_tier_capacity[to_type].fetch_add(
+                    CHUNK_SIZE, butil::memory_order_relaxed);
+                LOG(INFO) << "Migrated " << CHUNK_SIZE / BYTES_IN_MB
+                          << "MB of rdma memory from tier "
+                          << g_block_size[from] << "B to tier "
+                          << g_block_size[to_type] << "B";
+                return chunk;
+            }
+        }
+    }
+    errno = ENOMEM;
+    return NULL;
+}
+
+// Serve an allocation by borrowing an idle chunk from other tiers, used
+// after the tier's own lists ran dry and region extension failed.
+static void* AllocBlockFromOtherTiers(int block_type) {
+    bool locked = false;
+    if (BAIDU_UNLIKELY(g_dump_enable)) {
+        g_dump_mutex->lock();
+        locked = true;
+    }
+    void* ptr = BorrowChunkFrom(block_type);
+    if (ptr) {
+        // Keep the first block, hand the rest of the chunk to the free
+        // list of this tier.
+        const size_t remain = CHUNK_SIZE - g_block_size[block_type];
+        if (remain > 0) {
+            IdleNode* node = butil::get_object<IdleNode>();
+            if (node) {
+                Region* r = GetRegion(ptr);
+                node->start = (char*)ptr + g_block_size[block_type];
+                node->len = remain;
+                uint64_t index =
+                    ((uintptr_t)node->start - r->start) * g_buckets / r->size;
+                BAIDU_SCOPED_LOCK(*g_info->lock[block_type][index]);
+                node->next = g_info->idle_list[block_type][index];
+                g_info->idle_list[block_type][index] = node;
+                g_info->idle_size[block_type][index] += remain;
+            }
+            // else: the remainder is leaked, same policy as DeallocBlock
+        }
+    }
+    if (locked) {
+        g_dump_mutex->unlock();
+    }
+    return ptr;
+}
+
 void* AllocBlock(size_t size) {
     if (size == 0 || size > g_block_size[BLOCK_SIZE_COUNT - 1]) {
         errno = EINVAL;
@@ -420,7 +652,11 @@ void* AllocBlock(size_t size) {
     }
     for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
         if (size <= g_block_size[i]) {
-            return AllocBlockFrom(i);;
+            void* ptr = AllocBlockFrom(i);
+            if (ptr == NULL) {
+                ptr = AllocBlockFromOtherTiers(i);
+            }
+            return ptr;
         }
     }
     return NULL;
@@ -462,7 +698,7 @@ int DeallocBlock(void* buf) {
         return 0;
     }
 
-    uint32_t block_type = r->block_type;
+    uint32_t block_type = GetBlockTypeOf(r, buf);
     size_t block_size = g_block_size[block_type];
     node->start = buf;
     node->len = block_size;
@@ -543,6 +779,11 @@ void DumpMemoryPoolInfo(std::ostream& os) {
            << "\t\tBlock Type: " << g_regions[i].block_type << "\n"
            << "\t\tId: " << g_regions[i].id << "\n";
     }
+    os << "Tier Info:\n";
+    for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
+        os << "\tFor block size " << GetBlockSize(i) << ": capacity "
+           << g_tier_capacity[i].load(butil::memory_order_relaxed) << "\n";
+    }
     os << "Idle List Info:\n";
     for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
         os << "\tFor block size " << GetBlockSize(i) << ":\n";
@@ -578,9 +819,15 @@ void DestroyBlockPool() {
         if (g_regions[i].start == 0) {
             break;
         }
-        free((void*)g_regions[i].start);
+        free(g_regions[i].chunk_types);
+        g_regions[i].chunk_types = NULL;
+        FreeRegionMemory((void*)g_regions[i].start,
+                         g_regions[i].hugepage, g_regions[i].alloc_len);
         g_regions[i].start = 0;
     }
+    for (int i = 0; i < BLOCK_SIZE_COUNT; ++i) {
+        g_tier_capacity[i].store(0, butil::memory_order_relaxed);
+    }
     g_region_num = 0;
     g_cb = NULL;
 }
@@ -591,7 +838,7 @@ int GetBlockType(void* buf) {
     if (!r) {
         return -1;
     }
-    return r->block_type;
+    return GetBlockTypeOf(r, buf);
 }
 
 // Just for UT
@@ -19,7 +19,9 @@
 
 #include <gflags/gflags.h>
 #include "butil/fd_utility.h"
+#include "bvar/bvar.h"                       // bvar::IntRecorder
 #include "butil/logging.h"                   // CHECK, LOG
+#include "butil/object_pool.h"               // butil::get_object
 #include "butil/sys_byteorder.h"             // HostToNet,NetToHost
 #include "bthread/bthread.h"
 #include "brpc/errno.pb.h"
@@ -42,6 +44,8 @@ extern ibv_comp_channel* (*IbvCreateCompChannel)(ibv_context*);
 extern int (*IbvDestroyCompChannel)(ibv_comp_channel*);
 extern int (*IbvGetCqEvent)(ibv_comp_channel*, ibv_cq**, void**);
 extern void (*IbvAckCqEvents)(ibv_cq*, unsigned int);
+extern ibv_srq* (*IbvCreateSrq)(ibv_pd*, ibv_srq_init_attr*);
+extern int (*IbvDestroySrq)(ibv_srq*);
 extern ibv_qp* (*IbvCreateQp)(ibv_pd*, ibv_qp_init_attr*);
 extern int (*IbvModifyQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask);
 extern int (*IbvQueryQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask, ibv_qp_init_attr*);
@@ -55,6 +59,12 @@ DEFINE_int32(rdma_zerocopy_min_size, 512, "The minimal size for receive zerocopy
 DEFINE_string(rdma_recv_block_type, "default", "Default size type for recv WR: "
               "default(8KB - 32B)/large(64KB - 32B)/huge(2MB - 32B)");
 DEFINE_int32(rdma_cqe_poll_once, 32, "The maximum of cqe number polled once.");
+DEFINE_int32(rdma_cqe_adaptive_poll_us, 5, "Keep polling an empty CQ for this "
+             "many microseconds before re-arming its completion event, since "
+             "completions usually arrive in bursts. Saves the interrupt and "
+             "event-channel round trip between close bursts. 0 disables it.");
+DEFINE_int32(rdma_doorbell_batch, 16, "The maximum of send WRs chained into "
+             "one ibv_post_send (one doorbell).");
 DEFINE_int32(rdma_prepared_qp_size, 128, "SQ and RQ size for prepared QP.");
 DEFINE_int32(rdma_prepared_qp_cnt, 1024, "Initial count of prepared QP.");
 DEFINE_bool(rdma_trace_verbose, false, "Print log message verbosely");
@@ -64,6 +74,14 @@ DEFINE_int32(rdma_poller_num, 1, "Poller number in RDMA polling mode.");
 DEFINE_bool(rdma_poller_yield, false, "Yield thread in RDMA polling mode.");
 DEFINE_bool(rdma_edisp_unsched, false, "Disable event dispatcher schedule");
 DEFINE_bool(rdma_disable_bthread, false, "Disable bthread in RDMA");
+DEFINE_int32(rdma_max_inline_data, 64, "Send payloads not larger than this "
+             "inline in the WR to skip the DMA read (0 disables inline send). "
+             "The device may round it up or refuse it.");
+DEFINE_bool(rdma_use_srq, false, "Use one shared receive queue for all RDMA "
+            "connections so that receive blocks are pooled instead of "
+            "pinning a full RQ per QP.");
+DEFINE_int32(rdma_srq_size, 1024, "WR capacity of the shared receive queue, "
+             "which bounds the number of pooled receive blocks.");
 
 static const size_t IOBUF_BLOCK_HEADER_LEN = 32; // implementation-dependent
 
@@ -90,7 +108,6 @@ static uint16_t g_rdma_hello_version = 2;
 static uint16_t g_rdma_impl_version = 1;
 static uint32_t g_rdma_recv_block_size = 0;
 
-// static const uint32_t MAX_INLINE_DATA = 64;
 static const uint8_t MAX_HOP_LIMIT = 16;
 static const uint8_t TIMEOUT = 14;
 static const uint8_t RETRY_CNT = 7;
@@ -102,6 +119,16 @@ static const uint32_t ACK_MSG_RDMA_OK = 0x1;
 static butil::Mutex* g_rdma_resource_mutex = NULL;
 static RdmaResource* g_rdma_resource_list = NULL;
 
+// The shared receive queue used by all QPs when rdma_use_srq is on
+static ibv_srq* g_srq = NULL;
+
+// A receive block posted to the SRQ. The completion identifies it by
+// wr_id since SRQ buffers are consumed by QPs in arbitrary order.
+struct SrqBlock {
+    butil::IOBuf buf;
+    void* data;
+};
+
 struct HelloMessage {
     void Serialize(void* data) const;
     void Deserialize(void* data);
@@ -147,10 +174,11 @@ void HelloMessage::Deserialize(void* data) {
     qp_num = butil::NetToHost32(*(uint32_t*)((char*)current_pos + 16));
 }
 
-RdmaResource::RdmaResource() 
+RdmaResource::RdmaResource()
     : qp(NULL)
     , cq(NULL)
     , comp_channel(NULL)
+    , max_inline_data(0)
     , next(NULL) { }
 
 RdmaResource::~RdmaResource() {
@@ -773,6 +801,12 @@ private:
     }
 };
 
+// Number of CQEs drained by one ibv_poll_cq and of WRs rung out by one
+// doorbell. Growing averages confirm that interrupt/MMIO costs are being
+// amortized at small message sizes.
+static bvar::IntRecorder g_rdma_cqe_batch_size("rdma_cqe_batch_size");
+static bvar::IntRecorder g_rdma_doorbell_batch_size("rdma_doorbell_batch_size");
+
 // Note this function is coupled with the implementation of IOBuf
 ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
     if (BAIDU_UNLIKELY(g_skip_rdma_init)) {
@@ -787,9 +821,15 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
     size_t total_len = 0;
     size_t current = 0;
     uint32_t window = 0;
-    ibv_send_wr wr;
     int max_sge = GetRdmaMaxSge();
-    ibv_sge sglist[max_sge];
+    // Chain up to `max_batch' WRs and ring the doorbell once for all of
+    // them: the MMIO write in ibv_post_send is the top per-message cost
+    // at small sizes, chaining amortizes it across the write queue.
+    const int max_batch =
+        std::max(1, std::min(FLAGS_rdma_doorbell_batch, 64));
+    ibv_send_wr wrs[max_batch];
+    ibv_sge sglist[max_batch][max_sge];
+    int nbatch = 0;
     while (current < ndata) {
         window = _window_size.load(butil::memory_order_relaxed);
         if (window == 0) {
@@ -803,8 +843,9 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
         butil::IOBuf* to = &_sbuf[_sq_current];
         size_t this_len = 0;
 
+        ibv_send_wr& wr = wrs[nbatch];
         memset(&wr, 0, sizeof(wr));
-        wr.sg_list = sglist;
+        wr.sg_list = sglist[nbatch];
         wr.opcode = IBV_WR_SEND_WITH_IMM;
 
         RdmaIOBuf* data = (RdmaIOBuf*)from[current];
@@ -822,7 +863,7 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
             }
 
             ssize_t len = data->cut_into_sglist_and_iobuf(
-                    sglist, &sge_index, to, max_sge,
+                    sglist[nbatch], &sge_index, to, max_sge,
                     _remote_recv_block_size - this_len);
             if (len < 0) {
                 return -1;
@@ -836,6 +877,11 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
         }
 
         wr.num_sge = sge_index;
+        if (this_len <= _resource->max_inline_data) {
+            // The device copies inline payload at ibv_post_send,
+            // saving the DMA read of the registered blocks.
+            wr.send_flags |= IBV_SEND_INLINE;
+        }
 
         uint32_t imm = _new_rq_wrs.exchange(0, butil::memory_order_relaxed);
         wr.imm_data = butil::HostToNet32(imm);
@@ -877,12 +923,23 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
             _sq_unsignaled = 0;
         }
 
-        ibv_send_wr* bad = NULL;
-        if (ibv_post_send(_resource->qp, &wr, &bad) < 0) {
-            // We use other way to guarantee the Send Queue is not full.
-            // So we just consider this error as an unrecoverable error.
-            PLOG(WARNING) << "Fail to ibv_post_send";
-            return -1;
+        // Chain the WR behind the previous one and defer the doorbell.
+        // Note that inline payloads are only copied at ibv_post_send, but
+        // all referenced data is kept alive in _sbuf until completion.
+        if (nbatch > 0) {
+            wrs[nbatch - 1].next = &wr;
+        }
+        ++nbatch;
+        if (nbatch == max_batch) {
+            ibv_send_wr* bad = NULL;
+            if (ibv_post_send(_resource->qp, wrs, &bad) < 0) {
+                // We use other way to guarantee the Send Queue is not full.
+                // So we just consider this error as an unrecoverable error.
+                PLOG(WARNING) << "Fail to ibv_post_send";
+                return -1;
+            }
+            g_rdma_doorbell_batch_size << nbatch;
+            nbatch = 0;
         }
 
         ++_sq_current;
@@ -897,6 +954,15 @@ ssize_t RdmaEndpoint::CutFromIOBufList(butil::IOBuf** from, size_t ndata) {
         _window_size.fetch_sub(1, butil::memory_order_relaxed);
     }
 
+    if (nbatch > 0) {
+        ibv_send_wr* bad = NULL;
+        if (ibv_post_send(_resource->qp, wrs, &bad) < 0) {
+            PLOG(WARNING) << "Fail to ibv_post_send";
+            return -1;
+        }
+        g_rdma_doorbell_batch_size << nbatch;
+    }
+
     return total_len;
 }
 
@@ -929,6 +995,39 @@ int RdmaEndpoint::SendImm(uint32_t imm) {
     return 0;
 }
 
+// (Re)allocate the receive block and post it to the SRQ
+// Return 0 if success, -1 if failed and errno set
+static int PostSrqRecv(SrqBlock* block) {
+    block->buf.clear();
+    butil::IOBufAsZeroCopyOutputStream os(&block->buf,
+            g_rdma_recv_block_size + IOBUF_BLOCK_HEADER_LEN);
+    int size = 0;
+    if (!os.Next(&block->data, &size)) {
+        // Memory is not enough for preparing a block
+        PLOG(WARNING) << "Fail to allocate srq block";
+        return -1;
+    }
+    CHECK(static_cast<uint32_t>(size) == g_rdma_recv_block_size) << size;
+
+    ibv_recv_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    ibv_sge sge;
+    sge.addr = (uint64_t)block->data;
+    sge.length = g_rdma_recv_block_size;
+    sge.lkey = GetRegionId(block->data);
+    wr.wr_id = (uint64_t)block;
+    wr.num_sge = 1;
+    wr.sg_list = &sge;
+
+    ibv_recv_wr* bad = NULL;
+    if (ibv_post_srq_recv(g_srq, &wr, &bad) < 0) {
+        PLOG(WARNING) << "Fail to ibv_post_srq_recv";
+        block->buf.clear();
+        return -1;
+    }
+    return 0;
+}
+
 ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
     bool zerocopy = FLAGS_rdma_recv_zerocopy;
     switch (wc.opcode) {
@@ -937,19 +1036,23 @@ ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
         break;
     }
     case IBV_WC_RECV: {  // recv completion
+        // The block does not belong to this endpoint in SRQ mode
+        SrqBlock* block = g_srq ? (SrqBlock*)wc.wr_id : NULL;
         // Please note that only the first wc.byte_len bytes is valid
         if (wc.byte_len > 0) {
             if (wc.byte_len < (uint32_t)FLAGS_rdma_zerocopy_min_size) {
                 zerocopy = false;
             }
             CHECK(_state != FALLBACK_TCP);
+            butil::IOBuf& rbuf = block ? block->buf : _rbuf[_rq_received];
+            void* rbuf_data = block ? block->data : _rbuf_data[_rq_received];
             if (zerocopy) {
                 butil::IOBuf tmp;
-                _rbuf[_rq_received].cutn(&tmp, wc.byte_len);
+                rbuf.cutn(&tmp, wc.byte_len);
                 _socket->_read_buf.append(tmp);
             } else {
                 // Copy data when the receive data is really small
-                _socket->_read_buf.append(_rbuf_data[_rq_received], wc.byte_len);
+                _socket->_read_buf.append(rbuf_data, wc.byte_len);
             }
         }
         if (wc.imm_data > 0) {
@@ -975,7 +1078,12 @@ ssize_t RdmaEndpoint::HandleCompletion(ibv_wc& wc) {
             }
         }
         // We must re-post recv WR
-        if (PostRecv(1, zerocopy) < 0) {
+        if (block) {
+            if (PostSrqRecv(block) < 0) {
+                butil::return_object<SrqBlock>(block);
+                return -1;
+            }
+        } else if (PostRecv(1, zerocopy) < 0) {
             return -1;
         }
         if (wc.byte_len > 0) {
@@ -1093,16 +1201,30 @@ static RdmaResource* AllocateQpCq(uint16_t sq_size, uint16_t rq_size) {
     // problem, we enlarge the size of SQ to contain redundant 1/4 of the wnd,
     // which is the maximum number of unsignaled send_wrs.
     attr.cap.max_send_wr = sq_size * 5 / 4; /*NOTE*/
-    attr.cap.max_recv_wr = rq_size;
+    if (g_srq) {
+        attr.srq = g_srq;
+    } else {
+        attr.cap.max_recv_wr = rq_size;
+        attr.cap.max_recv_sge = 1;
+    }
     attr.cap.max_send_sge = GetRdmaMaxSge();
-    attr.cap.max_recv_sge = 1;
+    if (FLAGS_rdma_max_inline_data > 0) {
+        attr.cap.max_inline_data = FLAGS_rdma_max_inline_data;
+    }
     attr.qp_type = IBV_QPT_RC;
     res->qp = IbvCreateQp(GetRdmaPd(), &attr);
+    if (!res->qp && attr.cap.max_inline_data > 0) {
+        // The device may refuse the requested inline capacity
+        attr.cap.max_inline_data = 0;
+        res->qp = IbvCreateQp(GetRdmaPd(), &attr);
+    }
     if (!res->qp) {
         PLOG(WARNING) << "Fail to create QP";
         delete res;
         return NULL;
     }
+    // The driver returns the actual inline capacity in attr
+    res->max_inline_data = attr.cap.max_inline_data;
 
     return res;
 }
@@ -1162,13 +1284,15 @@ int RdmaEndpoint::AllocateResources() {
     if (_sbuf.size() != _sq_size - RESERVED_WR_NUM) {
         return -1;
     }
-    _rbuf.resize(_rq_size);
-    if (_rbuf.size() != _rq_size) {
-        return -1;
-    }
-    _rbuf_data.resize(_rq_size, NULL);
-    if (_rbuf_data.size() != _rq_size) {
-        return -1;
+    if (!g_srq) {  // recv blocks are pooled in the SRQ
+        _rbuf.resize(_rq_size);
+        if (_rbuf.size() != _rq_size) {
+            return -1;
+        }
+        _rbuf_data.resize(_rq_size, NULL);
+        if (_rbuf_data.size() != _rq_size) {
+            return -1;
+        }
     }
 
     return 0;
@@ -1195,9 +1319,11 @@ int RdmaEndpoint::BringUpQp(uint16_t lid, ibv_gid gid, uint32_t qp_num) {
         return -1;
     }
 
-    if (PostRecv(_rq_size, true) < 0) {
-        PLOG(WARNING) << "Fail to post recv wr";
-        return -1;
+    if (!g_srq) {  // the SRQ is filled once in GlobalInitialize
+        if (PostRecv(_rq_size, true) < 0) {
+            PLOG(WARNING) << "Fail to post recv wr";
+            return -1;
+        }
     }
 
     attr.qp_state = IBV_QPS_RTR;
@@ -1371,6 +1497,7 @@ void RdmaEndpoint::PollCq(Socket* m) {
 
     int progress = Socket::PROGRESS_INIT;
     bool notified = false;
+    int64_t idle_deadline_us = 0;
     InputMessenger::InputMessageClosure last_msg;
     ibv_wc wc[FLAGS_rdma_cqe_poll_once];
     while (true) {
@@ -1386,6 +1513,20 @@ void RdmaEndpoint::PollCq(Socket* m) {
             if (FLAGS_rdma_use_polling) {
                 return;
             }
+            if (!notified && FLAGS_rdma_cqe_adaptive_poll_us > 0) {
+                // Completions usually arrive in bursts. Keep polling the
+                // empty CQ briefly before paying for re-arming the event
+                // and taking an interrupt plus an event-channel round
+                // trip on the next burst.
+                const int64_t now_us = butil::cpuwide_time_us();
+                if (idle_deadline_us == 0) {
+                    idle_deadline_us = now_us + FLAGS_rdma_cqe_adaptive_poll_us;
+                    continue;
+                }
+                if (now_us < idle_deadline_us) {
+                    continue;
+                }
+            }
             if (!notified) {
                 // Since RDMA only provides one shot event, we have to call the
                 // notify function every time. Because there is a possibility
@@ -1414,6 +1555,8 @@ void RdmaEndpoint::PollCq(Socket* m) {
             continue;
         }
         notified = false;
+        idle_deadline_us = 0;
+        g_rdma_cqe_batch_size << cnt;
 
         ssize_t bytes = 0;
         for (int i = 0; i < cnt; ++i) {
@@ -1500,6 +1643,24 @@ int RdmaEndpoint::GlobalInitialize() {
         return -1;
     }
 
+    if (FLAGS_rdma_use_srq) {
+        ibv_srq_init_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.attr.max_wr = FLAGS_rdma_srq_size;
+        attr.attr.max_sge = 1;
+        g_srq = IbvCreateSrq(GetRdmaPd(), &attr);
+        if (!g_srq) {
+            PLOG(ERROR) << "Fail to create SRQ";
+            return -1;
+        }
+        for (int i = 0; i < FLAGS_rdma_srq_size; ++i) {
+            SrqBlock* block = butil::get_object<SrqBlock>();
+            if (!block || PostSrqRecv(block) < 0) {
+                return -1;
+            }
+        }
+    }
+
     g_rdma_resource_mutex = new butil::Mutex;
     for (int i = 0; i < FLAGS_rdma_prepared_qp_cnt; ++i) {
         RdmaResource* res = AllocateQpCq(FLAGS_rdma_prepared_qp_size,
@@ -1527,6 +1688,14 @@ void RdmaEndpoint::GlobalRelease() {
             delete res;
         }
     }
+    if (g_srq) {
+        // Blocks still posted to the SRQ are not reclaimed, this is
+        // only called at exit.
+        if (IbvDestroySrq(g_srq) < 0) {
+            PLOG(WARNING) << "Fail to destroy SRQ";
+        }
+        g_srq = NULL;
+    }
     // release polling mode at exit or call RdmaEndpoint::PollingModeRelease
     // explicitly
     if (FLAGS_rdma_use_polling) {
@@ -61,6 +61,9 @@ struct RdmaResource {
     ibv_qp* qp;
     ibv_cq* cq;
     ibv_comp_channel* comp_channel;
+    // The actual inline data capacity of the QP, may be larger than
+    // the requested rdma_max_inline_data. 0 if inline is unsupported.
+    uint32_t max_inline_data;
     RdmaResource* next;
     RdmaResource();
     ~RdmaResource();
@@ -59,6 +59,8 @@ ibv_pd* (*IbvAllocPd)(ibv_context*) = NULL;
 int (*IbvDeallocPd)(ibv_pd*) = NULL;
 ibv_cq* (*IbvCreateCq)(ibv_context*, int, void*, ibv_comp_channel*, int) = NULL;
 int (*IbvDestroyCq)(ibv_cq*) = NULL;
+ibv_srq* (*IbvCreateSrq)(ibv_pd*, ibv_srq_init_attr*) = NULL;
+int (*IbvDestroySrq)(ibv_srq*) = NULL;
 ibv_qp* (*IbvCreateQp)(ibv_pd*, ibv_qp_init_attr*) = NULL;
 int (*IbvModifyQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask) = NULL;
 int (*IbvQueryQp)(ibv_qp*, ibv_qp_attr*, ibv_qp_attr_mask, ibv_qp_init_attr*) = NULL;
@@ -74,7 +76,8 @@ void (*IbvAckAsyncEvent)(ibv_async_event*) = NULL;
 const char* (*IbvEventTypeStr)(ibv_event_type) = NULL;
 
 // NOTE:
-// ibv_post_send, ibv_post_recv, ibv_poll_cq, ibv_req_notify_cq are all inline function
+// ibv_post_send, ibv_post_recv, ibv_post_srq_recv, ibv_poll_cq,
+// ibv_req_notify_cq are all inline function
 // defined in infiniband/verbs.h.
 
 static int g_gid_tbl_len = 0;
@@ -286,7 +289,9 @@ static void OnRdmaAsyncEvent(Socket* m) {
         }
         case IBV_EVENT_SRQ_ERR:
         case IBV_EVENT_SRQ_LIMIT_REACHED: {
-            // SRQ not used, should not happen
+            // The SRQ is refilled on every recv completion and no limit
+            // is armed, so these events are not expected even with
+            // rdma_use_srq on. Just ignore them.
             IbvAckAsyncEvent(&event);
             break;
         }
@@ -373,6 +378,8 @@ static int ReadRdmaDynamicLib() {
     LoadSymbol(g_handle_ibverbs, IbvDeallocPd, "ibv_dealloc_pd");
     LoadSymbol(g_handle_ibverbs, IbvCreateCq, "ibv_create_cq");
     LoadSymbol(g_handle_ibverbs, IbvDestroyCq, "ibv_destroy_cq");
+    LoadSymbol(g_handle_ibverbs, IbvCreateSrq, "ibv_create_srq");
+    LoadSymbol(g_handle_ibverbs, IbvDestroySrq, "ibv_destroy_srq");
     LoadSymbol(g_handle_ibverbs, IbvCreateQp, "ibv_create_qp");
     LoadSymbol(g_handle_ibverbs, IbvModifyQp, "ibv_modify_qp");
     LoadSymbol(g_handle_ibverbs, IbvQueryQp, "ibv_query_qp");
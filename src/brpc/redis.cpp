@@ -20,8 +20,12 @@
 #include <gflags/gflags.h>
 #include <google/protobuf/reflection_ops.h> // ReflectionOps::Merge
 
+#include "brpc/callback.h"             // NewCallback
+#include "brpc/channel.h"
+#include "brpc/controller.h"
 #include "brpc/redis_command.h"
 #include "brpc/proto_base.pb.h"
+#include "bthread/countdown_event.h"
 #include "butil/status.h"
 #include "butil/strings/string_util.h" // StringToLowerASCII
 
@@ -346,6 +350,131 @@ std::ostream& operator<<(std::ostream& os, const RedisResponse& response) {
     return os;
 }
 
+// ========== impl of RedisCommandBatcher ==========
+
+// One pipelined request shared by the Reply handles of its commands. The
+// done closure keeps the batch alive until the RPC finishes, handles keep
+// it alive as long as replies may be read.
+struct RedisCommandBatcher::Batch {
+    explicit Batch(RedisCommandBatcher* owner2)
+        : event(1), owner(owner2) {}
+
+    RedisRequest request;
+    RedisResponse response;
+    Controller cntl;
+    bthread::CountdownEvent event;
+    // The batcher accumulating this batch, NULL after the batch is flushed.
+    RedisCommandBatcher* owner;
+};
+
+RedisCommandBatcher::Reply::Reply() : _index(0) {}
+
+RedisCommandBatcher::Reply::~Reply() {}
+
+const RedisReply& RedisCommandBatcher::Reply::get() {
+    if (NULL == _batch) {
+        static RedisReply redis_nil(NULL);
+        return redis_nil;
+    }
+    RedisCommandBatcher* const owner = _batch->owner;
+    if (owner != NULL) {
+        // The batch was not flushed yet, flush to unblock the wait below.
+        owner->Flush();
+    }
+    _batch->event.wait();
+    return _batch->response.reply(_index);
+}
+
+bool RedisCommandBatcher::Reply::Failed() {
+    if (NULL == _batch) {
+        return true;
+    }
+    get();
+    return _batch->cntl.Failed();
+}
+
+std::string RedisCommandBatcher::Reply::ErrorText() {
+    if (NULL == _batch) {
+        return "The command was not added successfully";
+    }
+    get();
+    return _batch->cntl.Failed() ? _batch->cntl.ErrorText() : std::string();
+}
+
+RedisCommandBatcher::RedisCommandBatcher(Channel* channel, int max_batch_size)
+    : _channel(channel), _max_batch_size(max_batch_size) {}
+
+RedisCommandBatcher::~RedisCommandBatcher() {
+    Flush();
+}
+
+RedisCommandBatcher::Batch* RedisCommandBatcher::CurrentBatch() {
+    if (NULL == _cur) {
+        _cur = std::make_shared<Batch>(this);
+    }
+    return _cur.get();
+}
+
+RedisCommandBatcher::Reply RedisCommandBatcher::MakeReply(bool add_ok) {
+    Reply r;
+    if (!add_ok) {
+        return r;
+    }
+    r._batch = _cur;
+    r._index = _cur->request.command_size() - 1;
+    if (_max_batch_size > 0 &&
+        _cur->request.command_size() >= _max_batch_size) {
+        Flush();
+    }
+    return r;
+}
+
+RedisCommandBatcher::Reply
+RedisCommandBatcher::AddCommand(const butil::StringPiece& command) {
+    return MakeReply(CurrentBatch()->request.AddCommand(command));
+}
+
+RedisCommandBatcher::Reply
+RedisCommandBatcher::AddCommandV(const char* fmt, va_list args) {
+    return MakeReply(CurrentBatch()->request.AddCommandV(fmt, args));
+}
+
+RedisCommandBatcher::Reply
+RedisCommandBatcher::AddCommandByComponents(
+    const butil::StringPiece* components, size_t n) {
+    return MakeReply(
+        CurrentBatch()->request.AddCommandByComponents(components, n));
+}
+
+RedisCommandBatcher::Reply
+RedisCommandBatcher::AddCommandWithArgs(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const Reply r = AddCommandV(fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+int RedisCommandBatcher::pending_command_size() const {
+    return _cur != NULL ? _cur->request.command_size() : 0;
+}
+
+void RedisCommandBatcher::OnBatchDone(std::shared_ptr<Batch> batch) {
+    batch->event.signal();
+}
+
+void RedisCommandBatcher::Flush() {
+    if (NULL == _cur || _cur->request.command_size() == 0) {
+        return;
+    }
+    std::shared_ptr<Batch> batch;
+    batch.swap(_cur);
+    batch->owner = NULL;
+    ::google::protobuf::Closure* done = NewCallback(OnBatchDone, batch);
+    _channel->CallMethod(NULL, &batch->cntl, &batch->request,
+                         &batch->response, done);
+}
+
 bool RedisService::AddCommandHandler(const std::string& name, RedisCommandHandler* handler) {
     std::string lcname = StringToLowerASCII(name);
     auto it = _command_map.find(lcname);
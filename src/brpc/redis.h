@@ -19,6 +19,7 @@
 #ifndef BRPC_REDIS_H
 #define BRPC_REDIS_H
 
+#include <memory>
 #include <unordered_map>
 
 #include "brpc/destroyable.h"
@@ -187,6 +188,111 @@ private:
 std::ostream& operator<<(std::ostream& os, const RedisRequest&);
 std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 
+class Channel;
+
+// Accumulate commands from multiple logical call sites and send them to
+// the server in ONE pipelined request(a single socket write), so that the
+// whole client stack(load balancing, serialization, writing) is amortized
+// over the batch instead of being paid per command. Replies are
+// demultiplexed back to the per-command handles returned by AddCommand.
+// Example:
+//   RedisCommandBatcher batcher(&channel);
+//   RedisCommandBatcher::Reply r1 = batcher.AddCommand("GET key1");
+//   RedisCommandBatcher::Reply r2 = batcher.AddCommand("GET key2");
+//   batcher.Flush();
+//   if (!r1.Failed()) {
+//       LOG(INFO) << r1.get();
+//   }
+// Adding and flushing must be done in one thread(or bthread), like
+// RedisRequest. Flushed Reply handles may be waited in any thread.
+class RedisCommandBatcher {
+public:
+    struct Batch;
+
+    // Handle of one command inside a batch, valid even after the batcher
+    // is destroyed. A default-constructed handle or the handle of a
+    // command that failed to be added yields a nil reply and Failed()=true.
+    class Reply {
+    public:
+        Reply();
+        ~Reply();
+        Reply(const Reply&) = default;
+        Reply& operator=(const Reply&) = default;
+        // Wait until the reply of the command is back and return it.
+        // Flushes the owning batch first if it's still pending, thus must
+        // be called in the adding thread unless Flush() was called.
+        // Returns a nil reply if the RPC carrying the command failed.
+        const RedisReply& get();
+        // Wait(same as get()) and tell whether the RPC carrying the
+        // command failed.
+        bool Failed();
+        // Error text of the RPC carrying the command, empty if the RPC
+        // succeeded.
+        std::string ErrorText();
+    private:
+    friend class RedisCommandBatcher;
+        std::shared_ptr<Batch> _batch;
+        int _index;
+    };
+
+    // `channel' must be initialized with PROTOCOL_REDIS and outlive this
+    // object. If `max_batch_size' is positive, accumulated commands are
+    // flushed automatically when they reach the size.
+    explicit RedisCommandBatcher(Channel* channel, int max_batch_size = 0);
+
+    // Remaining commands are flushed(without waiting for replies).
+    ~RedisCommandBatcher();
+
+    // Counterparts of RedisRequest::AddCommand[V|ByComponents], returning
+    // the handle to read the reply of the added command.
+    Reply AddCommand(const butil::StringPiece& command);
+    Reply AddCommandV(const char* fmt, va_list args);
+    Reply AddCommandByComponents(const butil::StringPiece* components, size_t n);
+
+    template <typename A1>
+    Reply AddCommand(const char* format, A1 a1)
+    { return AddCommandWithArgs(format, a1); }
+
+    template <typename A1, typename A2>
+    Reply AddCommand(const char* format, A1 a1, A2 a2)
+    { return AddCommandWithArgs(format, a1, a2); }
+
+    template <typename A1, typename A2, typename A3>
+    Reply AddCommand(const char* format, A1 a1, A2 a2, A3 a3)
+    { return AddCommandWithArgs(format, a1, a2, a3); }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    Reply AddCommand(const char* format, A1 a1, A2 a2, A3 a3, A4 a4)
+    { return AddCommandWithArgs(format, a1, a2, a3, a4); }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    Reply AddCommand(const char* format, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5)
+    { return AddCommandWithArgs(format, a1, a2, a3, a4, a5); }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    Reply AddCommand(const char* format, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6)
+    { return AddCommandWithArgs(format, a1, a2, a3, a4, a5, a6); }
+
+    // Number of commands not flushed yet.
+    int pending_command_size() const;
+
+    // Send all pending commands in one pipelined request. Does not wait
+    // for replies, wait on the Reply handles instead.
+    void Flush();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RedisCommandBatcher);
+
+    Batch* CurrentBatch();
+    Reply MakeReply(bool add_ok);
+    Reply AddCommandWithArgs(const char* fmt, ...);
+    static void OnBatchDone(std::shared_ptr<Batch> batch);
+
+    Channel* _channel;
+    int _max_batch_size;
+    std::shared_ptr<Batch> _cur;
+};
+
 class RedisCommandHandler;
 
 // Container of CommandHandlers.
@@ -18,6 +18,10 @@
 #include <cctype>
 #include <limits>
 
+#include "butil/build_config.h"
+#if defined(ARCH_CPU_X86_64)
+#include <emmintrin.h>      // _mm_cmpeq_epi8 for CRLF scanning
+#endif
 #include "butil/logging.h"
 #include "brpc/log.h"
 #include "brpc/redis_command.h"
@@ -374,6 +378,69 @@ size_t RedisCommandParser::ParsedArgsSize() {
     return _args.size();
 }
 
+// Offset of the first "\r\n" starting in the first `max_scan' bytes of
+// `buf', or npos. Iterates backing blocks without copying anything out;
+// within a block the '\r' candidates are located 16 bytes at a time with
+// SSE2, and a '\r' ending one block is matched against the first byte of
+// the next one.
+static size_t FindCRLF(const butil::IOBuf& buf, size_t max_scan) {
+    const size_t npos = butil::StringPiece::npos;
+    const size_t nblock = buf.backing_block_num();
+    size_t offset = 0;  // offset of the current block in buf
+    bool prev_cr = false;  // last byte of the previous block was '\r'
+    for (size_t i = 0; i < nblock; ++i) {
+        const butil::StringPiece blk = buf.backing_block(i);
+        if (blk.empty()) {
+            continue;
+        }
+        const char* const s = blk.data();
+        const size_t n = blk.size();
+        if (prev_cr) {
+            if (s[0] == '\n') {
+                return offset - 1;
+            }
+            prev_cr = false;
+        }
+        if (offset >= max_scan) {
+            return npos;
+        }
+        // Only a '\r' starting before max_scan counts.
+        const size_t scan_n = std::min(n, max_scan - offset);
+        size_t j = 0;
+#if defined(ARCH_CPU_X86_64)
+        const __m128i cr16 = _mm_set1_epi8('\r');
+        for (; j + 16 <= scan_n; j += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(s + j));
+            uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr16));
+            while (mask != 0) {
+                const size_t pos = j + __builtin_ctz(mask);
+                if (pos + 1 < n) {
+                    if (s[pos + 1] == '\n') {
+                        return offset + pos;
+                    }
+                } else {
+                    prev_cr = true;  // '\r' ends the block
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; j < scan_n; ++j) {
+            if (s[j] == '\r') {
+                if (j + 1 < n) {
+                    if (s[j + 1] == '\n') {
+                        return offset + j;
+                    }
+                } else {
+                    prev_cr = true;
+                }
+            }
+        }
+        offset += n;
+    }
+    return npos;
+}
+
 ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
                                        std::vector<butil::StringPiece>* args,
                                        butil::Arena* arena) {
@@ -386,17 +453,18 @@ ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
         if (!std::isalpha(static_cast<unsigned char>(*pfc))) {
             return PARSE_ERROR_TRY_OTHERS;
         }
-        const size_t buf_size = buf.size();
-        const auto copy_str = static_cast<char *>(arena->allocate(buf_size + 1));
-        buf.copy_to(copy_str, buf_size);
-        if (*copy_str == ' ') {
+        if (*pfc == ' ') {
             return PARSE_ERROR_ABSOLUTELY_WRONG;
         }
-        copy_str[buf_size] = '\0';
-        const size_t crlf_pos = butil::StringPiece(copy_str, buf_size).find("\r\n");
+        // Locate the end of the line first so that only the line is copied
+        // out, instead of the whole (possibly pipelined) buffer.
+        const size_t crlf_pos = FindCRLF(buf, buf.size());
         if (crlf_pos == butil::StringPiece::npos) {  // not enough data
             return PARSE_ERROR_NOT_ENOUGH_DATA;
         }
+        const auto copy_str = static_cast<char *>(arena->allocate(crlf_pos + 1));
+        buf.copy_to(copy_str, crlf_pos);
+        copy_str[crlf_pos] = '\0';
         args->clear();
         size_t offset = 0;
         while (offset < crlf_pos && copy_str[offset] != ' ') {
@@ -441,21 +509,26 @@ ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
     if (_parsing_array && *pfc != '$') {
         return PARSE_ERROR_ABSOLUTELY_WRONG;
     }
+    // "*<count>\r\n" or "$<length>\r\n". The decimal and the CRLF behind it
+    // are parsed in one pass: lengths in RESP are non-negative so a single
+    // unsigned digit test replaces strtoll and the separate CRLF search.
     char intbuf[32];  // enough for fc + 64-bit decimal + \r\n
     const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf) - 1);
-    intbuf[ncopied] = '\0';
-    const size_t crlf_pos = butil::StringPiece(intbuf, ncopied).find("\r\n");
-    if (crlf_pos == butil::StringPiece::npos) {  // not enough data
-        return PARSE_ERROR_NOT_ENOUGH_DATA;
+    size_t crlf_pos = 1;  // skip fc
+    int64_t value = 0;
+    for (; crlf_pos < ncopied; ++crlf_pos) {
+        const uint32_t d = (uint32_t)(unsigned char)intbuf[crlf_pos] - '0';
+        if (d > 9) {
+            break;
+        }
+        value = value * 10 + d;
     }
-    char* endptr = NULL;
-    int64_t value = strtoll(intbuf + 1/*skip fc*/, &endptr, 10);
-    if (endptr != intbuf + crlf_pos) {
-        LOG(ERROR) << '`' << intbuf + 1 << "' is not a valid 64-bit decimal";
-        return PARSE_ERROR_ABSOLUTELY_WRONG;
+    if (crlf_pos + 1 >= ncopied) {  // no room for CRLF yet
+        return PARSE_ERROR_NOT_ENOUGH_DATA;
     }
-    if (value < 0) {
-        LOG(ERROR) << "Invalid len=" << value << " in redis command";
+    if (crlf_pos == 1 || crlf_pos > 20/*19 digits at most*/ ||
+        intbuf[crlf_pos] != '\r' || intbuf[crlf_pos + 1] != '\n') {
+        LOG(ERROR) << "Invalid length in redis command";
         return PARSE_ERROR_ABSOLUTELY_WRONG;
     }
     if (!_parsing_array) {
@@ -475,10 +548,6 @@ ParseError RedisCommandParser::Consume(butil::IOBuf& buf,
     CHECK(_index < _length) << "a complete command has been parsed. "
             "impl of RedisCommandParser::Parse is buggy";
     const int64_t len = value;  // `value' is length of the string
-    if (len < 0) {
-        LOG(ERROR) << "string in command is nil!";
-        return PARSE_ERROR_ABSOLUTELY_WRONG;
-    }
     if (len > FLAGS_redis_max_allocation_size) {
         LOG(ERROR) << "command string exceeds max allocation size! max=" 
                    << FLAGS_redis_max_allocation_size << ", actually=" << len;
@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/scoped_lock.h"          // BAIDU_SCOPED_LOCK
+#include "brpc/response_cache.h"
+
+namespace brpc {
+
+static size_t get_response_cache_size(void* arg) {
+    return static_cast<ResponseCache*>(arg)->size();
+}
+
+ResponseCache::ResponseCache(const ResponseCacheOptions& options)
+    : _options(options)
+    , _size_bvar(get_response_cache_size, this) {
+    CHECK_EQ(0, _cache.init(_options.max_entries * 2));
+    if (!_options.name.empty()) {
+        const std::string prefix = "response_cache_" + _options.name;
+        _hit_count.expose(prefix + "_hit_count");
+        _lookup_count.expose(prefix + "_lookup_count");
+        _size_bvar.expose(prefix + "_size");
+    }
+}
+
+ResponseCache::~ResponseCache() {
+    _hit_count.hide();
+    _lookup_count.hide();
+    _size_bvar.hide();
+}
+
+void ResponseCache::Invalidate(const std::string& key) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _cache.erase(key);
+}
+
+void ResponseCache::InvalidateAll() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _cache.clear();
+}
+
+size_t ResponseCache::size() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _cache.size();
+}
+
+bool ResponseCache::ComputeKey(const Controller& cntl,
+                               const butil::IOBuf& serialized_request,
+                               std::string* key) const {
+    if (_options.compute_key != NULL) {
+        return _options.compute_key(cntl, serialized_request, key);
+    }
+    key->clear();
+    serialized_request.copy_to(key);
+    return true;
+}
+
+bool ResponseCache::Get(const std::string& key, CachedResponse* out) {
+    _lookup_count << 1;
+    BAIDU_SCOPED_LOCK(_mutex);
+    const CachedResponse* entry = _cache.seek(key);
+    if (NULL == entry) {
+        return false;
+    }
+    // IOBufs share the cached blocks, no payload bytes are copied.
+    *out = *entry;
+    _hit_count << 1;
+    return true;
+}
+
+void ResponseCache::Put(const std::string& key, const CachedResponse& response) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_cache.seek(key) == NULL && _cache.size() >= _options.max_entries) {
+        // Entries never expire by themselves, so a full cache means either
+        // max_entries is too small or compute_key admits unbounded keys.
+        // Restarting from empty keeps the footprint bounded either way.
+        _cache.clear();
+    }
+    _cache[key] = response;
+}
+
+} // namespace brpc
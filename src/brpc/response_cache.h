@@ -0,0 +1,134 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_RESPONSE_CACHE_H
+#define BRPC_RESPONSE_CACHE_H
+
+#include <functional>
+#include <string>
+#include "butil/iobuf.h"
+#include "butil/macros.h"
+#include "butil/containers/flat_map.h"
+#include "butil/synchronization/lock.h"
+#include "bvar/bvar.h"
+#include "brpc/options.pb.h"            // CompressType/ContentType/ChecksumType
+
+namespace brpc {
+
+class Controller;
+
+// What a ResponseCache stores for one key: the response exactly as it left
+// serialization (and possibly compression), plus the meta fields needed to
+// frame it again. A hit is framed under the new correlation id and written
+// straight into the socket, without running user code or serializing the
+// message again.
+struct CachedResponse {
+    butil::IOBuf serialized_response;
+    butil::IOBuf attachment;
+    CompressType compress_type;
+    ContentType content_type;
+    ChecksumType checksum_type;
+    std::string checksum_value;
+
+    CachedResponse()
+        : compress_type(COMPRESS_TYPE_NONE)
+        , content_type(CONTENT_TYPE_PB)
+        , checksum_type(CHECKSUM_TYPE_NONE) {}
+};
+
+struct ResponseCacheOptions {
+    // Maps a request to its cache key. `serialized_request' is the request
+    // exactly as it came off the wire (possibly compressed). Return false
+    // to bypass the cache for that call, e.g. for requests known to be
+    // unique. When NULL, the serialized request bytes themselves are the
+    // key, i.e. exact-match caching.
+    std::function<bool(const Controller& cntl,
+                       const butil::IOBuf& serialized_request,
+                       std::string* key)> compute_key;
+
+    // The cache restarts from empty when a fill would exceed this many
+    // entries.
+    size_t max_entries;
+
+    // If non-empty, expose "response_cache_<name>_hit_count",
+    // "response_cache_<name>_lookup_count" and "response_cache_<name>_size"
+    // as bvars for monitoring the hit rate.
+    std::string name;
+
+    ResponseCacheOptions() : max_entries(1024) {}
+};
+
+// Caches successful serialized responses of one method so that repeated
+// identical requests are answered without entering user code. Register with
+// Server::RegisterResponseCache() and call Invalidate()/InvalidateAll()
+// whenever the data behind the method changes -- the cache itself never
+// expires entries. Thread-safe.
+//
+// Only cache methods whose response is a pure function of the request
+// between invalidations; anything depending on the caller or on time must
+// either stay uncached or exclude such requests in compute_key.
+class ResponseCache {
+public:
+    explicit ResponseCache(const ResponseCacheOptions& options);
+    ~ResponseCache();
+
+    // Drop the entry of `key' if present.
+    void Invalidate(const std::string& key);
+
+    // Drop all entries, typically right after the underlying data changed.
+    void InvalidateAll();
+
+    size_t size() const;
+
+    // ===== Called by protocol code, not by users =====
+
+    // Compute the key of a request. Returns false when the call should
+    // bypass the cache.
+    bool ComputeKey(const Controller& cntl,
+                    const butil::IOBuf& serialized_request,
+                    std::string* key) const;
+
+    // Copy the entry of `key' into `out', referencing the cached blocks
+    // without copying payload bytes. Returns false on miss.
+    bool Get(const std::string& key, CachedResponse* out);
+
+    // Store `response' under `key', replacing any existing entry.
+    void Put(const std::string& key, const CachedResponse& response);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ResponseCache);
+
+    ResponseCacheOptions _options;
+    mutable butil::Mutex _mutex;
+    butil::FlatMap<std::string, CachedResponse> _cache;
+    bvar::Adder<int64_t> _hit_count;
+    bvar::Adder<int64_t> _lookup_count;
+    bvar::PassiveStatus<size_t> _size_bvar;
+};
+
+// Internal: carries a pending fill from the request path to the moment the
+// protocol serializes the response. Heap-allocated per cacheable miss and
+// freed by the response-sending code.
+struct ResponseCacheFill {
+    ResponseCache* cache;
+    std::string key;
+};
+
+} // namespace brpc
+
+#endif  // BRPC_RESPONSE_CACHE_H
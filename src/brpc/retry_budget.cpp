@@ -0,0 +1,96 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/logging.h"
+#include "brpc/retry_budget.h"
+
+namespace brpc {
+
+static const int64_t TOKEN_SCALE = 1000;
+
+static double GetRemainingTokens(void* arg) {
+    return static_cast<RetryBudget*>(arg)->remaining_tokens();
+}
+
+RetryBudget::Options::Options()
+    : token_ratio(0.1)
+    , max_tokens(100) {
+}
+
+RetryBudget::RetryBudget() : RetryBudget(Options()) {}
+
+RetryBudget::RetryBudget(const Options& options)
+    : _millitokens(options.max_tokens * TOKEN_SCALE)
+    , _options(options)
+    , _exhausted_second(&_exhausted)
+    , _tokens_bvar(GetRemainingTokens, this) {
+    if (_options.token_ratio <= 0) {
+        LOG(ERROR) << "Invalid token_ratio=" << _options.token_ratio
+                   << ", changed to 0.1";
+        _options.token_ratio = 0.1;
+    }
+    if (_options.max_tokens < 1) {
+        LOG(ERROR) << "Invalid max_tokens=" << _options.max_tokens
+                   << ", changed to 1";
+        _options.max_tokens = 1;
+        _millitokens.store(TOKEN_SCALE, butil::memory_order_relaxed);
+    }
+}
+
+RetryBudget::~RetryBudget() {}
+
+bool RetryBudget::TakeToken() {
+    int64_t expected = _millitokens.load(butil::memory_order_relaxed);
+    do {
+        if (expected < TOKEN_SCALE) {
+            _exhausted << 1;
+            return false;
+        }
+    } while (!_millitokens.compare_exchange_weak(
+                 expected, expected - TOKEN_SCALE,
+                 butil::memory_order_relaxed));
+    return true;
+}
+
+void RetryBudget::OnCallSucceeded() {
+    const int64_t deposit = (int64_t)(_options.token_ratio * TOKEN_SCALE);
+    const int64_t cap = _options.max_tokens * TOKEN_SCALE;
+    int64_t expected = _millitokens.load(butil::memory_order_relaxed);
+    do {
+        if (expected >= cap) {
+            return;
+        }
+    } while (!_millitokens.compare_exchange_weak(
+                 expected, std::min(expected + deposit, cap),
+                 butil::memory_order_relaxed));
+}
+
+double RetryBudget::remaining_tokens() const {
+    return (double)_millitokens.load(butil::memory_order_relaxed) / TOKEN_SCALE;
+}
+
+int RetryBudget::ExposeAs(const butil::StringPiece& prefix) {
+    std::string name(prefix.data(), prefix.size());
+    if (_tokens_bvar.expose_as(name, "retry_budget_tokens") != 0 ||
+        _exhausted_second.expose_as(name, "retry_budget_exhausted_second") != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+}  // namespace brpc
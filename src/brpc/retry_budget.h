@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_RETRY_BUDGET_H
+#define BRPC_RETRY_BUDGET_H
+
+#include "butil/atomicops.h"
+#include "butil/strings/string_piece.h"
+#include "bvar/bvar.h"
+
+namespace brpc {
+
+// A token bucket that retries and backup requests must draw from, bounding
+// the extra load a channel generates during downstream brownouts: per-call
+// max_retry amplifies traffic by several times exactly when the downstream
+// can afford it least, while a budget replenished by successful calls caps
+// the overall retry ratio the way ratio-based retry throttles do.
+//
+// Usage:
+//   static brpc::RetryBudget g_budget;   // shared by channels to a cluster
+//   options.retry_budget = &g_budget;
+// A budget set on ChannelOptions applies to every call of the channel;
+// Controller::set_retry_budget() overrides it for one call, e.g. to give a
+// critical method its own reserve. The budget object must outlive all
+// channels/calls using it and is NOT owned by them.
+class RetryBudget {
+public:
+    struct Options {
+        Options();
+        // Tokens deposited by each successful call. 0.1 means at most 1
+        // extra try per 10 successes once the initial reserve runs out.
+        double token_ratio;
+        // Capacity of the bucket, bounding the burst of retries after a
+        // long healthy period. Also the initial number of tokens.
+        int max_tokens;
+    };
+
+    RetryBudget();
+    explicit RetryBudget(const Options& options);
+    ~RetryBudget();
+
+    // Returns true and consumes one token if the budget allows another
+    // retry/backup request, false when the budget is exhausted.
+    // Called by Controller before retrying, generally not by users.
+    bool TakeToken();
+
+    // Deposit `token_ratio' tokens for a successful call.
+    // Called by Controller at the end of RPC, generally not by users.
+    void OnCallSucceeded();
+
+    // Number of retries rejected so far because the budget ran out.
+    int64_t exhausted_count() const { return _exhausted.get_value(); }
+
+    // Current (approximate) number of tokens in the bucket.
+    double remaining_tokens() const;
+
+    // Expose "<prefix>_retry_budget_tokens" and
+    // "<prefix>_retry_budget_exhausted_second" bvars for monitoring.
+    // Returns 0 on success, -1 otherwise.
+    int ExposeAs(const butil::StringPiece& prefix);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RetryBudget);
+
+    // Tokens scaled by 1000 so that fractional token_ratio deposits are
+    // not lost to rounding.
+    butil::atomic<int64_t> _millitokens;
+    Options _options;
+    bvar::Adder<int64_t> _exhausted;
+    bvar::PerSecond<bvar::Adder<int64_t>> _exhausted_second;
+    bvar::PassiveStatus<double> _tokens_bvar;
+};
+
+}  // namespace brpc
+
+#endif  // BRPC_RETRY_BUDGET_H
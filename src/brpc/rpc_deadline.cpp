@@ -0,0 +1,66 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include <stdlib.h>                    // malloc/free
+#include "butil/logging.h"
+#include "bthread/bthread.h"           // bthread_key_create
+#include "brpc/rpc_deadline.h"
+
+namespace brpc {
+
+// The deadline is kept in bthread-local storage so that it follows the
+// request no matter which worker the serving bthread is stolen to, and it
+// works in pthreads as well (bthread keys fall back to a pthread-local
+// keytable). The slot is a heap-allocated int64_t reused for the lifetime
+// of the (b)thread, freed by the key's destructor.
+static bthread_key_t s_rpc_deadline_key;
+static pthread_once_t s_rpc_deadline_key_once = PTHREAD_ONCE_INIT;
+
+static void CreateRpcDeadlineKey() {
+    CHECK_EQ(0, bthread_key_create(&s_rpc_deadline_key, ::free));
+}
+
+int64_t GetCurrentRpcDeadline() {
+    pthread_once(&s_rpc_deadline_key_once, CreateRpcDeadlineKey);
+    const int64_t* slot =
+        static_cast<int64_t*>(bthread_getspecific(s_rpc_deadline_key));
+    return slot != NULL ? *slot : -1;
+}
+
+void SetCurrentRpcDeadline(int64_t deadline_us) {
+    pthread_once(&s_rpc_deadline_key_once, CreateRpcDeadlineKey);
+    int64_t* slot =
+        static_cast<int64_t*>(bthread_getspecific(s_rpc_deadline_key));
+    if (slot == NULL) {
+        if (deadline_us < 0) {
+            // Nothing to clear.
+            return;
+        }
+        slot = static_cast<int64_t*>(malloc(sizeof(int64_t)));
+        if (slot == NULL ||
+            bthread_setspecific(s_rpc_deadline_key, slot) != 0) {
+            LOG(ERROR) << "Fail to set rpc deadline";
+            free(slot);
+            return;
+        }
+    }
+    *slot = (deadline_us < 0 ? -1 : deadline_us);
+}
+
+}  // namespace brpc
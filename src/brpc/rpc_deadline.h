@@ -0,0 +1,43 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_RPC_DEADLINE_H
+#define BRPC_RPC_DEADLINE_H
+
+#include <stdint.h>
+
+namespace brpc {
+
+// Deadline of the RPC being served on the current (b)thread, in microseconds
+// since the Epoch, or -1 when the RPC has no deadline. Server-side protocol
+// code stores the deadline right before invoking user code so that sub-calls
+// issued from the service implementation can inherit the remaining budget
+// automatically, see -propagate_rpc_deadline in channel.cpp.
+// NOTE: bthreads spawned by user code and callbacks deferred to the
+// -usercode_in_pthread backup pool do not inherit the deadline.
+int64_t GetCurrentRpcDeadline();
+
+// Store `deadline_us' as the deadline of the RPC being served on the current
+// (b)thread. -1 clears the deadline possibly left by a previous request
+// served on the same thread. Called by server-side protocol code, generally
+// not by users.
+void SetCurrentRpcDeadline(int64_t deadline_us);
+
+}  // namespace brpc
+
+#endif  // BRPC_RPC_DEADLINE_H
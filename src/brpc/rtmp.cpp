@@ -2882,4 +2882,172 @@ std::string MakeRtmpURL(const butil::StringPiece& host,
     return result;
 }
 
+RtmpGopCacheOptions::RtmpGopCacheOptions()
+    : max_gop_count(1)
+    , max_cached_bytes(0) {
+}
+
+RtmpGopCache::RtmpGopCache()
+    : _has_metadata(false)
+    , _has_video_seq_header(false)
+    , _has_audio_seq_header(false)
+    , _cached_bytes(0) {
+}
+
+RtmpGopCache::RtmpGopCache(const RtmpGopCacheOptions& options)
+    : _options(options)
+    , _has_metadata(false)
+    , _has_video_seq_header(false)
+    , _has_audio_seq_header(false)
+    , _cached_bytes(0) {
+}
+
+void RtmpGopCache::OnMetaData(const RtmpMetaData& metadata,
+                              const butil::StringPiece& name) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _metadata = metadata;
+    _metadata_name.assign(name.data(), name.size());
+    _has_metadata = true;
+}
+
+void RtmpGopCache::OnAudioMessage(const RtmpAudioMessage& msg) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (msg.IsAACSequenceHeader()) {
+        _audio_seq_header = msg;
+        _has_audio_seq_header = true;
+        return;
+    }
+    if (_current_gop.empty()) {
+        // Subscribers join at a keyframe, audio before the first one is
+        // not replayable.
+        return;
+    }
+    CachedFrame frame;
+    frame.is_video = false;
+    frame.audio = msg;
+    _current_gop.push_back(frame);
+    _cached_bytes += msg.data.size();
+}
+
+void RtmpGopCache::OnVideoMessage(const RtmpVideoMessage& msg) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (msg.IsAVCSequenceHeader() || msg.IsHEVCSequenceHeader()) {
+        _video_seq_header = msg;
+        _has_video_seq_header = true;
+        return;
+    }
+    if (msg.frame_type == FLV_VIDEO_FRAME_KEYFRAME) {
+        PushCompleteGOP();
+    } else if (_current_gop.empty()) {
+        // Inter frames are not decodable without the preceding keyframe.
+        return;
+    }
+    CachedFrame frame;
+    frame.is_video = true;
+    frame.video = msg;
+    _current_gop.push_back(frame);
+    _cached_bytes += msg.data.size();
+}
+
+void RtmpGopCache::PushCompleteGOP() {
+    if (!_current_gop.empty()) {
+        _gops.push_back(GOP());
+        _gops.back().swap(_current_gop);
+    }
+    while (_gops.size() > _options.max_gop_count) {
+        for (size_t i = 0; i < _gops.front().size(); ++i) {
+            const CachedFrame& f = _gops.front()[i];
+            _cached_bytes -= (f.is_video ? f.video.data : f.audio.data).size();
+        }
+        _gops.pop_front();
+    }
+    if (_options.max_cached_bytes > 0) {
+        while (!_gops.empty() && _cached_bytes > _options.max_cached_bytes) {
+            for (size_t i = 0; i < _gops.front().size(); ++i) {
+                const CachedFrame& f = _gops.front()[i];
+                _cached_bytes -=
+                    (f.is_video ? f.video.data : f.audio.data).size();
+            }
+            _gops.pop_front();
+        }
+    }
+}
+
+int RtmpGopCache::Replay(RtmpStreamBase* subscriber) const {
+    if (subscriber == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Snapshot the cache under lock. Copying IOBufs just references the
+    // blocks shared with the cache (and the publisher), no media byte is
+    // copied here or inside SendXXX below.
+    bool has_metadata = false;
+    RtmpMetaData metadata;
+    std::string metadata_name;
+    bool has_video_seq_header = false;
+    RtmpVideoMessage video_seq_header;
+    bool has_audio_seq_header = false;
+    RtmpAudioMessage audio_seq_header;
+    GOP frames;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        has_metadata = _has_metadata;
+        if (_has_metadata) {
+            metadata = _metadata;
+            metadata_name = _metadata_name;
+        }
+        has_video_seq_header = _has_video_seq_header;
+        if (_has_video_seq_header) {
+            video_seq_header = _video_seq_header;
+        }
+        has_audio_seq_header = _has_audio_seq_header;
+        if (_has_audio_seq_header) {
+            audio_seq_header = _audio_seq_header;
+        }
+        size_t nframe = _current_gop.size();
+        for (size_t i = 0; i < _gops.size(); ++i) {
+            nframe += _gops[i].size();
+        }
+        frames.reserve(nframe);
+        for (size_t i = 0; i < _gops.size(); ++i) {
+            frames.insert(frames.end(), _gops[i].begin(), _gops[i].end());
+        }
+        frames.insert(frames.end(), _current_gop.begin(), _current_gop.end());
+    }
+    if (has_metadata && subscriber->SendMetaData(metadata, metadata_name) != 0) {
+        return -1;
+    }
+    if (has_video_seq_header &&
+        subscriber->SendVideoMessage(video_seq_header) != 0) {
+        return -1;
+    }
+    if (has_audio_seq_header &&
+        subscriber->SendAudioMessage(audio_seq_header) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        const CachedFrame& f = frames[i];
+        const int rc = f.is_video ? subscriber->SendVideoMessage(f.video)
+                                  : subscriber->SendAudioMessage(f.audio);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void RtmpGopCache::Clear() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    _has_metadata = false;
+    _metadata.data.Clear();
+    _metadata_name.clear();
+    _has_video_seq_header = false;
+    _video_seq_header.data.clear();
+    _has_audio_seq_header = false;
+    _audio_seq_header.data.clear();
+    _gops.clear();
+    _current_gop.clear();
+    _cached_bytes = 0;
+}
+
 } // namespace brpc
@@ -19,6 +19,7 @@
 #ifndef BRPC_RTMP_H
 #define BRPC_RTMP_H
 
+#include <deque>
 #include "butil/strings/string_piece.h"   // butil::StringPiece
 #include "butil/endpoint.h"               // butil::EndPoint
 #include "brpc/shared_object.h"          // SharedObject, intrusive_ptr
@@ -1124,6 +1125,82 @@ friend class policy::RtmpChunkStream;
     bthread_id_t _onfail_id;
 };
 
+struct RtmpGopCacheOptions {
+    // Max # of complete GOPs kept besides the one currently being filled.
+    // Default: 1
+    size_t max_gop_count;
+
+    // Drop complete GOPs from the oldest one when the cached media bytes
+    // exceed this limit. The GOP being filled is never dropped.
+    // Default: 0 (unlimited)
+    size_t max_cached_bytes;
+
+    // Constructed with default options.
+    RtmpGopCacheOptions();
+};
+
+// Server-side cache of the last group(s) of pictures of a published stream.
+// Feed it with the messages received from the publisher and Replay() it on
+// streams of joining subscribers: they start playing from the keyframe
+// heading the oldest cached GOP instead of waiting for the next one. Since
+// IOBufs share refcounted blocks, both caching and replaying cost reference
+// bumps rather than copying media bytes, no matter how many subscribers
+// join at once.
+// Feeding (OnXXX) must be serialized, which is already the case when called
+// within the publisher's OnMetaData/OnAudioMessage/OnVideoMessage. Replay()
+// and Clear() can be called from any thread.
+class RtmpGopCache {
+public:
+    RtmpGopCache();
+    explicit RtmpGopCache(const RtmpGopCacheOptions& options);
+
+    // Call these methods with messages from the publisher. Codec sequence
+    // headers are cached separately from GOPs and always replayed first.
+    // Audio/video messages preceding the first keyframe are not cached.
+    void OnMetaData(const RtmpMetaData& metadata,
+                    const butil::StringPiece& name = "onMetaData");
+    void OnAudioMessage(const RtmpAudioMessage& msg);
+    void OnVideoMessage(const RtmpVideoMessage& msg);
+
+    // Send cached metadata, sequence headers and GOPs to a joining
+    // subscriber, in the order they were received from the publisher.
+    // Returns 0 on success, -1 when any send fails (errno is set by the
+    // failed SendXXX).
+    int Replay(RtmpStreamBase* subscriber) const;
+
+    // Drop everything cached, e.g. when the publisher is gone.
+    void Clear();
+
+    // Bytes of media data currently cached. Racy, only for monitoring.
+    size_t cached_bytes() const { return _cached_bytes; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RtmpGopCache);
+
+    struct CachedFrame {
+        bool is_video;
+        RtmpAudioMessage audio;
+        RtmpVideoMessage video;
+    };
+    typedef std::vector<CachedFrame> GOP;
+
+    // _mutex must be held.
+    void PushCompleteGOP();
+
+    RtmpGopCacheOptions _options;
+    mutable butil::Mutex _mutex;
+    bool _has_metadata;
+    RtmpMetaData _metadata;
+    std::string _metadata_name;
+    bool _has_video_seq_header;
+    RtmpVideoMessage _video_seq_header;
+    bool _has_audio_seq_header;
+    RtmpAudioMessage _audio_seq_header;
+    std::deque<GOP> _gops;   // complete GOPs, oldest first.
+    GOP _current_gop;        // started by the last keyframe, maybe empty.
+    size_t _cached_bytes;    // media bytes in _gops and _current_gop.
+};
+
 } // namespace brpc
 
 
@@ -19,6 +19,7 @@
 #include <map>
 #include <gflags/gflags.h>
 #include "bthread/bthread.h"                         // bthread_id_xx
+#include "butil/object_pool.h"                       // get_object
 #include "brpc/socket.h"                             // SocketUser
 #include "brpc/load_balancer.h"                      // LoadBalancer
 #include "brpc/details/controller_private_accessor.h"        // RPCSender
@@ -87,6 +88,11 @@ public:
                    SelectiveChannel::ChannelHandle* handle);
     void RemoveAndDestroyChannel(SelectiveChannel::ChannelHandle handle);
     int SelectChannel(const LoadBalancer::SelectIn& in, SelectOut* out);
+    // Return the only sub channel when exactly one was added and its fake
+    // socket is still connectable, holding a reference to the fake socket
+    // in *fake_sock, otherwise return NULL. Lets SelectiveChannel bypass
+    // the sub-call machinery when there is no failover target anyway.
+    ChannelBase* SingleHealthyChannel(SocketUniquePtr* fake_sock);
     int CheckHealth();
     void Describe(std::ostream& os, const DescribeOptions&);
 
@@ -128,11 +134,16 @@ class Sender : public RPCSender,
                public google::protobuf::Closure {
 friend class SubDone;
 public:
-    Sender(Controller* cntl,
-           const google::protobuf::Message* request,
-           google::protobuf::Message* response,
-           google::protobuf::Closure* user_done);
+    Sender();
     ~Sender() { Clear(); }
+    // Take a sender out of the ObjectPool, primed for one call. Paired
+    // with Destroy() which resets the embedded sub-call state and gives
+    // the object back to the pool.
+    static Sender* Get(Controller* cntl,
+                       const google::protobuf::Message* request,
+                       google::protobuf::Message* response,
+                       google::protobuf::Closure* user_done);
+    void Destroy();
     int IssueRPC(int64_t start_realtime_us);
     Resource PopFree();
     bool PushFree(const Resource& r);
@@ -242,6 +253,19 @@ void ChannelBalancer::RemoveAndDestroyChannel(SelectiveChannel::ChannelHandle ha
     }
 }
 
+ChannelBase* ChannelBalancer::SingleHealthyChannel(SocketUniquePtr* fake_sock) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (_chan_map.size() != 1) {
+        return NULL;
+    }
+    ChannelToIdMap::const_iterator it = _chan_map.begin();
+    if (it->second->Failed() ||
+        Socket::Address(it->second->id(), fake_sock) != 0) {
+        return NULL;
+    }
+    return it->first;
+}
+
 inline int ChannelBalancer::SelectChannel(const LoadBalancer::SelectIn& in,
                                           SelectOut* out) {
     LoadBalancer::SelectOut sel_out(&out->fake_sock);
@@ -283,20 +307,54 @@ void ChannelBalancer::Describe(std::ostream& os,
 
 // ===================================
 
-Sender::Sender(Controller* cntl,
-               const google::protobuf::Message* request,
-               google::protobuf::Message* response,
-               google::protobuf::Closure* user_done)
-    : _main_cntl(cntl)
-    , _request(request)
-    , _response(response)
-    , _user_done(user_done)
+Sender::Sender()
+    : _main_cntl(NULL)
+    , _request(NULL)
+    , _response(NULL)
+    , _user_done(NULL)
     , _nfree(0)
     , _nalloc(0)
     , _finished(false)
     , _sub_done0(this) {
 }
 
+Sender* Sender::Get(Controller* cntl,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* user_done) {
+    Sender* sndr = butil::get_object<Sender>();
+    if (NULL == sndr) {
+        return NULL;
+    }
+    sndr->_main_cntl = cntl;
+    sndr->_request = request;
+    sndr->_response = response;
+    sndr->_user_done = user_done;
+    sndr->_nfree = 0;
+    sndr->_nalloc = 0;
+    sndr->_finished = false;
+    return sndr;
+}
+
+void Sender::Destroy() {
+    Clear();  // guard against senders that never finished, normally no-op.
+    // Reset the embedded sub-call state so that the next call popping this
+    // sender from the pool starts from a clean slate. Reset() of the sub
+    // controller keeps its largest arena block, making a pooled sender as
+    // cheap to rearm as a reused Controller.
+    _sub_done0._cid = INVALID_BTHREAD_ID;
+    _sub_done0._peer_id = INVALID_SOCKET_ID;
+    _sub_done0._cntl.Reset();
+    _free_resources[0] = Resource();
+    _free_resources[1] = Resource();
+    _alloc_resources[0] = Resource();
+    _alloc_resources[1] = Resource();
+    _request = NULL;
+    _response = NULL;
+    _user_done = NULL;
+    butil::return_object(this);
+}
+
 int Sender::IssueRPC(int64_t start_realtime_us) {
     _main_cntl->_current_call.need_feedback = false;
     LoadBalancer::SelectIn sel_in = { start_realtime_us,
@@ -329,6 +387,9 @@ int Sender::IssueRPC(int64_t start_realtime_us) {
     // timeout occurs, sub calls are canceled with ERPCTIMEDOUT.
     sub_cntl->_timeout_ms = -1;
     sub_cntl->_real_timeout_ms = _main_cntl->timeout_ms();
+    // PopFree() keeps _accessed across sub_cntl's Reset(), it must not sit
+    // in sub_cntl's arena which Reset() recycles.
+    sub_cntl->add_flag(Controller::FLAGS_ACCESSED_OUTLIVES_RESET);
 
     // Inherit following fields of _main_cntl.
     // TODO(gejun): figure out a better way to maintain these fields.
@@ -563,8 +624,25 @@ void SelectiveChannel::CallMethod(
     if (!initialized()) {
         cntl->SetFailed(EINVAL, "SelectiveChannel=%p is not initialized yet",
                         this);
+    } else {
+        // Fast path: with exactly one connectable sub channel there is
+        // nothing to select and nowhere to fail over, the sub-call hop
+        // (an extra Controller and correlation id) is pure overhead.
+        // Delegate the call to the sub channel directly. The fake socket
+        // is held across CallMethod so that the sub channel cannot be
+        // destroyed by RemoveAndDestroyChannel() in the middle.
+        SocketUniquePtr fake_sock;
+        ChannelBase* only_chan =
+            static_cast<schan::ChannelBalancer*>(_chan._lb.get())
+            ->SingleHealthyChannel(&fake_sock);
+        if (only_chan != NULL) {
+            only_chan->CallMethod(method, cntl, request, response, user_done);
+            return;
+        }
     }
-    schan::Sender* sndr = new schan::Sender(cntl, request, response, user_done);
+    schan::Sender* sndr =
+        schan::Sender::Get(cntl, request, response, user_done);
+    CHECK(sndr != NULL) << "Fail to get sender from the pool";
     cntl->_sender = sndr;
     cntl->add_flag(Controller::FLAGS_DESTROY_CID_IN_DONE);
     const CallId cid = cntl->call_id();
@@ -33,6 +33,7 @@
 #include "butil/debug/leak_annotations.h"
 #include "brpc/log.h"
 #include "brpc/compress.h"
+#include "brpc/reloadable_flags.h"
 #include "brpc/checksum.h"
 #include "brpc/policy/nova_pbrpc_protocol.h"
 #include "brpc/global.h"
@@ -63,12 +64,18 @@
 #include "brpc/builtin/dir_service.h"          // DirService
 #include "brpc/builtin/pprof_service.h"        // PProfService
 #include "brpc/builtin/bthreads_service.h"     // BthreadsService
+#include "brpc/builtin/offcpu_service.h"       // OffCpuService
+#include "brpc/builtin/heap_snapshots_service.h" // HeapSnapshotsService
 #include "brpc/builtin/ids_service.h"          // IdsService
 #include "brpc/builtin/sockets_service.h"      // SocketsService
 #include "brpc/builtin/hotspots_service.h"     // HotspotsService
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/builtin/memory_service.h"
+#include "brpc/builtin/iobuf_service.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/cached_authenticator.h"  // CachedAuthenticator
+#include "brpc/details/listen_fd_handover.h"    // ListenFdHandover
 #include "brpc/load_balancer.h"
 #include "brpc/naming_service.h"
 #include "brpc/simple_data_pool.h"
@@ -78,6 +85,9 @@
 #include "brpc/rtmp.h"
 #include "brpc/builtin/common.h"               // GetProgramName
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/continuous_profiler.h"  // GetContinuousProfiler
+#include "brpc/details/heap_snapshots.h"       // GetHeapSnapshotKeeper
+#include "brpc/egress_rate_limiter.h"          // EgressRateLimiter
 #include "brpc/rdma/rdma_helper.h"
 #include "brpc/baidu_master_service.h"
 
@@ -117,8 +127,24 @@ butil::static_atomic<int> g_running_server_count = BUTIL_STATIC_ATOMIC_INIT(0);
 DEFINE_bool(enable_dir_service, false, "Enable /dir");
 DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
+DEFINE_string(graceful_restart_uds, "",
+              "If non-empty, each started server serves its listen fds at "
+              "this unix-socket path (suffixed with the port) and a "
+              "starting server takes the fds over from a former generation "
+              "of the process instead of binding the port again, so rolling "
+              "restarts keep established listen queues. See "
+              "details/listen_fd_handover.h");
+
+DEFINE_bool(server_reject_expired_requests, false,
+            "Answer ERPCTIMEDOUT right before dispatching to user code for "
+            "requests whose propagated deadline already passed while they "
+            "were queued, instead of running handlers the client has "
+            "abandoned. Only affects requests carrying a timeout/deadline.");
+BRPC_VALIDATE_GFLAG(server_reject_expired_requests, PassValidate);
+
 DECLARE_int32(usercode_backup_threads);
 DECLARE_bool(usercode_in_pthread);
+DECLARE_int32(auth_result_cache_ttl_ms);
 
 // NOTE: never make s_ncore extern const whose ctor seq against other
 // compilation units is undefined.
@@ -135,6 +161,7 @@ ServerOptions::ServerOptions()
     , server_owns_interceptor(false)
     , num_threads(8)
     , max_concurrency(0)
+    , reserved_concurrency_for_high_priority(0)
     , session_local_data_factory(NULL)
     , reserved_session_local_data(0)
     , thread_local_data_factory(NULL)
@@ -146,6 +173,8 @@ ServerOptions::ServerOptions()
     , has_builtin_services(true)
     , force_ssl(false)
     , use_rdma(false)
+    , num_acceptors(1)
+    , run_to_completion(false)
     , baidu_master_service(NULL)
     , http_master_service(NULL)
     , health_reporter(NULL)
@@ -153,7 +182,8 @@ ServerOptions::ServerOptions()
     , redis_service(NULL)
     , bthread_tag(BTHREAD_TAG_DEFAULT)
     , rpc_pb_message_factory(NULL)
-    , ignore_eovercrowded(false) {
+    , ignore_eovercrowded(false)
+    , max_egress_bytes_per_second(0) {
     if (s_ncore > 0) {
         num_threads = s_ncore + 1;
     }
@@ -181,7 +211,10 @@ Server::MethodProperty::MethodProperty()
     , service(NULL)
     , method(NULL)
     , status(NULL)
-    , ignore_eovercrowded(false) {
+    , ignore_eovercrowded(false)
+    , attachment_pool(NULL)
+    , response_cache(NULL)
+    , bthread_tag(BTHREAD_TAG_INVALID) {
 }
 
 static timeval GetUptime(void* arg/*start_time*/) {
@@ -392,6 +425,11 @@ void* Server::UpdateDerivedVars(void* arg) {
         if (server->_am) {
             server->_am->ListConnections(&conns);
         }
+        for (size_t i = 0; i < server->_extra_ams.size(); ++i) {
+            std::vector<SocketId> extra_conns;
+            server->_extra_ams[i]->ListConnections(&extra_conns);
+            conns.insert(conns.end(), extra_conns.begin(), extra_conns.end());
+        }
         if (server->_internal_am) {
             server->_internal_am->ListConnections(&internal_conns);
         }
@@ -423,6 +461,7 @@ const std::string& Server::ServiceProperty::service_name() const {
 
 Server::Server(ProfilerLinker)
     : _session_local_data_pool(NULL)
+    , _cached_auth(NULL)
     , _status(UNINITIALIZED)
     , _builtin_service_count(0)
     , _virtual_service_count(0)
@@ -430,6 +469,7 @@ Server::Server(ProfilerLinker)
     , _failed_to_set_ignore_eovercrowded(false)
     , _am(NULL)
     , _internal_am(NULL)
+    , _fd_handover(NULL)
     , _first_service(NULL)
     , _tab_info_list(NULL)
     , _global_restful_map(NULL)
@@ -452,6 +492,9 @@ Server::~Server() {
     delete _session_local_data_pool;
     _session_local_data_pool = NULL;
 
+    delete _cached_auth;
+    _cached_auth = NULL;
+
     delete _options.nshead_service;
     _options.nshead_service = NULL;
 
@@ -469,8 +512,15 @@ Server::~Server() {
     delete _options.rpc_pb_message_factory;
     _options.rpc_pb_message_factory = NULL;
 
+    delete _fd_handover;
+    _fd_handover = NULL;
+
     delete _am;
     _am = NULL;
+    for (size_t i = 0; i < _extra_ams.size(); ++i) {
+        delete _extra_ams[i];
+    }
+    _extra_ams.clear();
     delete _internal_am;
     _internal_am = NULL;
 
@@ -561,6 +611,10 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add MemoryService";
         return -1;
     }
+    if (AddBuiltinService(new (std::nothrow) IOBufService)) {
+        LOG(ERROR) << "Fail to add IOBufService";
+        return -1;
+    }
 
 #if !BRPC_WITH_GLOG
     if (AddBuiltinService(new (std::nothrow) VLogService)) {
@@ -582,6 +636,14 @@ int Server::AddBuiltinServices() {
         LOG(ERROR) << "Fail to add BthreadsService";
         return -1;
     }
+    if (AddBuiltinService(new (std::nothrow) OffCpuService)) {
+        LOG(ERROR) << "Fail to add OffCpuService";
+        return -1;
+    }
+    if (AddBuiltinService(new (std::nothrow) HeapSnapshotsService)) {
+        LOG(ERROR) << "Fail to add HeapSnapshotsService";
+        return -1;
+    }
     if (AddBuiltinService(new (std::nothrow) IdsService)) {
         LOG(ERROR) << "Fail to add IdsService";
         return -1;
@@ -732,6 +794,42 @@ static void* BthreadInitEntry(void* void_args) {
     return NULL;
 }
 
+struct SSLContextInitArgs {
+    Server* server;
+    int result;
+};
+
+void* Server::RunInitSSLContexts(void* void_args) {
+    SSLContextInitArgs* args = (SSLContextInitArgs*)void_args;
+    args->result = args->server->InitSSLContexts();
+    return NULL;
+}
+
+int Server::InitSSLContexts() {
+    // Change ServerSSLOptions.alpns to _raw_alpns.
+    // AddCertificate function maybe access raw_alpns variable.
+    if (InitALPNOptions(_options.mutable_ssl_options()) != 0) {
+        return -1;
+    }
+    CertInfo& default_cert = _options.mutable_ssl_options()->default_cert;
+    if (default_cert.certificate.empty()) {
+        LOG(ERROR) << "default_cert is empty";
+        return -1;
+    }
+    if (AddCertificate(default_cert) != 0) {
+        return -1;
+    }
+    _default_ssl_ctx = _ssl_ctx_map.begin()->second.ctx;
+
+    const std::vector<CertInfo>& certs = _options.mutable_ssl_options()->certs;
+    for (size_t i = 0; i < certs.size(); ++i) {
+        if (AddCertificate(certs[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 struct RevertServerStatus {
     inline void operator()(Server* s) const {
         if (s != NULL) {
@@ -945,6 +1043,19 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         _session_local_data_pool->Reserve(_options.reserved_session_local_data);
     }
 
+    if (FLAGS_auth_result_cache_ttl_ms > 0 && _options.auth != NULL) {
+        // Let identical credentials across connections skip the real
+        // VerifyCredential, see details/cached_authenticator.h. All
+        // protocols read the authenticator from _options.auth.
+        delete _cached_auth;
+        _cached_auth = new (std::nothrow) CachedAuthenticator(_options.auth);
+        if (NULL == _cached_auth) {
+            LOG(ERROR) << "Fail to new CachedAuthenticator";
+            return -1;
+        }
+        _options.auth = _cached_auth;
+    }
+
     // Leak of `_keytable_pool' and others is by design.
     // See comments in Server::Join() for details.
     // Instruct LeakSanitizer to ignore the designated memory leak.
@@ -1031,42 +1142,34 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
 
     // Free last SSL contexts
     FreeSSLContexts();
-    if (_options.has_ssl_options()) {
-
-        // Change ServerSSLOptions.alpns to _raw_alpns.
-        // AddCertificate function maybe access raw_alpns variable.
-        if (InitALPNOptions(_options.mutable_ssl_options()) != 0) {
-            return -1;
-        }
-        CertInfo& default_cert = _options.mutable_ssl_options()->default_cert;
-        if (default_cert.certificate.empty()) {
-            LOG(ERROR) << "default_cert is empty";
-            return -1;
-        }
-        if (AddCertificate(default_cert) != 0) {
-            return -1;
-        }
-        _default_ssl_ctx = _ssl_ctx_map.begin()->second.ctx;
-
-        const std::vector<CertInfo>& certs = _options.mutable_ssl_options()->certs;
-        for (size_t i = 0; i < certs.size(); ++i) {
-            if (AddCertificate(certs[i]) != 0) {
-                return -1;
-            }
-        }
-    } else if (_options.force_ssl) {
+    if (!_options.has_ssl_options() && _options.force_ssl) {
         LOG(ERROR) << "Fail to force SSL for all connections "
                       "without ServerOptions.ssl_options";
         return -1;
     }
+    // Building SSL contexts (parsing certificates/keys) and registering
+    // builtin services touch disjoint state; overlap them to cut start-up
+    // latency of binaries with many certificates or services.
+    SSLContextInitArgs ssl_init_args = { this, 0 };
+    bthread_t ssl_init_tid = 0;
+    bool ssl_init_in_background = false;
+    if (_options.has_ssl_options()) {
+        if (bthread_start_background(&ssl_init_tid, NULL,
+                                     RunInitSSLContexts, &ssl_init_args) == 0) {
+            ssl_init_in_background = true;
+        } else {
+            ssl_init_args.result = InitSSLContexts();
+        }
+    }
 
     _concurrency = 0;
 
+    int builtin_rc = 0;
     if (_options.has_builtin_services &&
         _builtin_service_count <= 0 &&
         AddBuiltinServices() != 0) {
         LOG(ERROR) << "Fail to add builtin services";
-        return -1;
+        builtin_rc = -1;
     }
     // If a server is started/stopped for mutiple times and one of the options
     // sets has_builtin_service to true, builtin services will be enabled for
@@ -1074,6 +1177,14 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
     if (!_options.has_builtin_services && _builtin_service_count > 0) {
         LOG(ERROR) << "A server started/stopped for multiple times must be "
             "consistent on ServerOptions.has_builtin_services";
+        builtin_rc = -1;
+    }
+    // Join the SSL bthread before any return so that it never outlives
+    // this frame.
+    if (ssl_init_in_background) {
+        bthread_join(ssl_init_tid, NULL);
+    }
+    if (builtin_rc != 0 || ssl_init_args.result != 0) {
         return -1;
     }
 
@@ -1137,10 +1248,35 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         LOG(ERROR) << "Only IPv4 address supports port range feature";
         return -1;
     }
+    if (_options.num_acceptors < 1) {
+        LOG(WARNING) << "Invalid ServerOptions.num_acceptors="
+                     << _options.num_acceptors << ", changed to 1";
+        _options.num_acceptors = 1;
+    }
+    // All sockets sharing the port must turn on SO_REUSEPORT before bind.
+    const bool reuse_port = (_options.num_acceptors > 1);
     _listen_addr = endpoint;
+    // Inherit listen fds from a former generation of this process
+    // (-graceful_restart_uds) so that restarts neither drop the kernel
+    // listen queue nor race on rebinding the port. Only for concrete
+    // single ports: with a range or port=0 the path of the former
+    // generation is unknown.
+    std::vector<int> inherited_fds;
+    size_t ninherited_used = 0;
+    if (!FLAGS_graceful_restart_uds.empty() &&
+        port_range.min_port == port_range.max_port &&
+        port_range.min_port > 0) {
+        ListenFdHandover::TakeOver(
+            butil::string_printf("%s_%d", FLAGS_graceful_restart_uds.c_str(),
+                                 port_range.min_port),
+            &inherited_fds);
+    }
     for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
         _listen_addr.port = port;
-        butil::fd_guard sockfd(tcp_listen(_listen_addr));
+        butil::fd_guard sockfd(
+            ninherited_used < inherited_fds.size()
+            ? inherited_fds[ninherited_used++]
+            : tcp_listen(_listen_addr, reuse_port));
         if (sockfd < 0) {
             if (port != port_range.max_port) { // not the last port, try next
                 continue;
@@ -1170,6 +1306,7 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
                 return -1;
             }
             _am->_use_rdma = _options.use_rdma;
+            _am->_run_to_completion = _options.run_to_completion;
             _am->_bthread_tag = _options.bthread_tag;
         }
         // Set `_status' to RUNNING before accepting connections
@@ -1179,16 +1316,88 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
         GenerateVersionIfNeeded();
         g_running_server_count.fetch_add(1, butil::memory_order_relaxed);
 
+        // One token bucket shared by all accepted connections. Kept over
+        // restarts so that a Stop+Start does not forgive accumulated debt.
+        if (_options.max_egress_bytes_per_second > 0 &&
+            _egress_limiter == NULL) {
+            _egress_limiter = std::make_shared<EgressRateLimiter>(
+                _options.max_egress_bytes_per_second);
+        } else if (_egress_limiter != NULL) {
+            _egress_limiter->set_max_bytes_per_second(
+                _options.max_egress_bytes_per_second);
+        }
+
         // Pass ownership of `sockfd' to `_am'
         if (_am->StartAccept(sockfd, _options.idle_timeout_sec,
                              _default_ssl_ctx,
-                             _options.force_ssl) != 0) {
+                             _options.force_ssl, _egress_limiter) != 0) {
             LOG(ERROR) << "Fail to start acceptor";
             return -1;
         }
         sockfd.release();
         break; // stop trying
     }
+    // Listen on the same port with extra SO_REUSEPORT sockets, each with
+    // its own Acceptor, so that the kernel load-balances new connections
+    // over the acceptors. `_listen_addr.port' is concrete now even if
+    // port=0 was given. Acceptors created by a former Start() are reused.
+    for (int i = 0; i + 1 < _options.num_acceptors; ++i) {
+        butil::fd_guard sockfd(
+            ninherited_used < inherited_fds.size()
+            ? inherited_fds[ninherited_used++]
+            : tcp_listen(_listen_addr, true));
+        if (sockfd < 0) {
+            LOG(ERROR) << "Fail to listen " << _listen_addr
+                       << " (SO_REUSEPORT socket #" << i + 1 << ')';
+            return -1;
+        }
+        if ((size_t)i >= _extra_ams.size()) {
+            Acceptor* extra_am = BuildAcceptor();
+            if (NULL == extra_am) {
+                LOG(ERROR) << "Fail to build extra acceptor";
+                return -1;
+            }
+            extra_am->_use_rdma = _options.use_rdma;
+            extra_am->_run_to_completion = _options.run_to_completion;
+            extra_am->_bthread_tag = _options.bthread_tag;
+            _extra_ams.push_back(extra_am);
+        }
+        // Pass ownership of `sockfd' to the acceptor
+        if (_extra_ams[i]->StartAccept(sockfd, _options.idle_timeout_sec,
+                                       _default_ssl_ctx, _options.force_ssl,
+                                       _egress_limiter) != 0) {
+            LOG(ERROR) << "Fail to start extra acceptor";
+            return -1;
+        }
+        sockfd.release();
+    }
+    for (; ninherited_used < inherited_fds.size(); ++ninherited_used) {
+        // The former generation had more acceptors than this one.
+        ::close(inherited_fds[ninherited_used]);
+    }
+    if (!FLAGS_graceful_restart_uds.empty() && _listen_addr.port > 0) {
+        // Offer our own listen fds to the generation after us.
+        std::vector<int> listen_fds;
+        listen_fds.push_back(_am->listened_fd());
+        for (int i = 0; i + 1 < _options.num_acceptors; ++i) {
+            listen_fds.push_back(_extra_ams[i]->listened_fd());
+        }
+        if (NULL == _fd_handover) {
+            _fd_handover = new (std::nothrow) ListenFdHandover;
+            if (NULL == _fd_handover) {
+                LOG(ERROR) << "Fail to new ListenFdHandover";
+                return -1;
+            }
+        }
+        if (_fd_handover->Serve(
+                butil::string_printf("%s_%d",
+                                     FLAGS_graceful_restart_uds.c_str(),
+                                     _listen_addr.port),
+                listen_fds) != 0) {
+            LOG(WARNING) << "Fail to serve listen fds for graceful restart, "
+                            "the next generation will bind the port itself";
+        }
+    }
     if (_options.internal_port >= 0 && _options.has_builtin_services) {
         if (_options.internal_port  == _listen_addr.port) {
             LOG(ERROR) << "ServerOptions.internal_port=" << _options.internal_port
@@ -1232,6 +1441,14 @@ int Server::StartInternal(const butil::EndPoint& endpoint,
 
     PutPidFileIfNeeded();
 
+    // Start collecting chunks when -enable_continuous_profiling is on so
+    // that /hotspots/cpu?continuous=1 has data right away.
+    GetContinuousProfiler();
+
+    // Ditto for -enable_heap_snapshots: the first snapshot taken at start
+    // is the natural base for diffs on /heap_snapshots.
+    GetHeapSnapshotKeeper();
+
     // Launch _derivative_thread.
     CHECK_EQ(INVALID_BTHREAD, _derivative_thread);
     bthread_attr_t tmp = BTHREAD_ATTR_NORMAL;
@@ -1319,9 +1536,18 @@ int Server::Stop(int timeout_ms) {
 
     LOG(INFO) << "Server[" << version() << "] is going to quit";
 
+    if (_fd_handover != NULL) {
+        // Stop offering the listen fds; a next generation that already
+        // took them keeps accepting while we drain below.
+        _fd_handover->Stop();
+    }
+
     if (_am) {
         _am->StopAccept(timeout_ms);
     }
+    for (size_t i = 0; i < _extra_ams.size(); ++i) {
+        _extra_ams[i]->StopAccept(timeout_ms);
+    }
     if (_internal_am) {
         // TODO: calculate timeout?
         _internal_am->StopAccept(timeout_ms);
@@ -1337,6 +1563,9 @@ int Server::Join() {
     if (_am) {
         _am->Join();
     }
+    for (size_t i = 0; i < _extra_ams.size(); ++i) {
+        _extra_ams[i]->Join();
+    }
     if (_internal_am) {
         _internal_am->Join();
     }
@@ -1420,6 +1649,28 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
     // defined `option (idl_support) = true' or not.
     const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
 
+    if (svc_opt.bthread_tag != BTHREAD_TAG_INVALID &&
+        (svc_opt.bthread_tag < BTHREAD_TAG_DEFAULT ||
+         svc_opt.bthread_tag >= FLAGS_task_group_ntags)) {
+        LOG(ERROR) << "Fail to set tag " << svc_opt.bthread_tag
+                   << " to service=" << sd->full_name() << ", tag range is ["
+                   << BTHREAD_TAG_DEFAULT << ":" << FLAGS_task_group_ntags
+                   << ")";
+        return -1;
+    }
+
+    // Created before filling methods so that their statuses can refer to it.
+    UserCodeBackupPool* usercode_pool = NULL;
+    if (svc_opt.dedicated_usercode_backup_threads > 0) {
+        usercode_pool = NewUserCodeBackupPool(
+            sd->name(), svc_opt.dedicated_usercode_backup_threads);
+        if (usercode_pool == NULL) {
+            LOG(ERROR) << "Fail to create usercode pool for "
+                       << sd->full_name();
+            return -1;
+        }
+    }
+
     Tabbed* tabbed = dynamic_cast<Tabbed*>(service);
     for (int i = 0; i < sd->method_count(); ++i) {
         const google::protobuf::MethodDescriptor* md = sd->method(i);
@@ -1437,7 +1688,12 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         }
         mp.service = service;
         mp.method = md;
+        mp.bthread_tag = svc_opt.bthread_tag;
         mp.status = new MethodStatus;
+        mp.status->_usercode_pool = usercode_pool;
+        // Builtin services must stay reachable during overload.
+        mp.status->_request_priority = is_builtin_service ?
+            REQUEST_PRIORITY_HIGH : svc_opt.request_priority;
         _method_map[md->full_name()] = mp;
         if (is_idl_support && sd->name() != sd->full_name()/*has ns*/) {
             MethodProperty mp2 = mp;
@@ -1454,13 +1710,14 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
             } else {
                 LOG(ERROR) << '`' << full_name_wo_ns << "' already exists";
                 RemoveMethodsOf(service);
+                DestroyUserCodeBackupPool(usercode_pool);
                 return -1;
             }
         }
     }
 
     const ServiceProperty ss = {
-        is_builtin_service, svc_opt.ownership, service, NULL };
+        is_builtin_service, svc_opt.ownership, service, NULL, usercode_pool };
     _fullname_service_map[sd->full_name()] = ss;
     _service_map[sd->name()] = ss;
     if (is_builtin_service) {
@@ -1583,7 +1840,7 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
             }
             if (sp == NULL) {
                 ServiceProperty ss =
-                    { false, SERVER_DOESNT_OWN_SERVICE, NULL, m };
+                    { false, SERVER_DOESNT_OWN_SERVICE, NULL, m, NULL };
                 _fullname_service_map[svc_name] = ss;
                 _service_map[svc_name] = ss;
                 ++_virtual_service_count;
@@ -1623,6 +1880,9 @@ ServiceOptions::ServiceOptions()
 #endif
     , pb_single_repeated_to_array(false)
     , enable_progressive_read(false)
+    , dedicated_usercode_backup_threads(0)
+    , request_priority(REQUEST_PRIORITY_NORMAL)
+    , bthread_tag(BTHREAD_TAG_INVALID)
     {}
 
 int Server::AddService(google::protobuf::Service* service,
@@ -1738,6 +1998,9 @@ int Server::RemoveService(google::protobuf::Service* service) {
     if (ss->ownership == SERVER_OWNS_SERVICE) {
         delete ss->service;
     }
+    // Services are only removable before Start() or after Stop()+Join(), no
+    // user code can be pending inside the pool at this point.
+    DestroyUserCodeBackupPool(ss->usercode_pool);
     const bool is_builtin_service = ss->is_builtin_service;
     _fullname_service_map.erase(sd->full_name());
     _service_map.erase(sd->name());
@@ -1766,6 +2029,7 @@ void Server::ClearServices() {
             delete it->second.service;
         }
         delete it->second.restful_map;
+        DestroyUserCodeBackupPool(it->second.usercode_pool);
     }
     for (MethodMap::const_iterator it = _method_map.begin();
          it != _method_map.end(); ++it) {
@@ -1799,6 +2063,9 @@ void Server::GetStat(ServerStatistics* stat) const {
     if (_am) {
         stat->connection_count += _am->ConnectionCount();
     }
+    for (size_t i = 0; i < _extra_ams.size(); ++i) {
+        stat->connection_count += _extra_ams[i]->ConnectionCount();
+    }
     if (_internal_am) {
         stat->connection_count += _internal_am->ConnectionCount();
     }
@@ -2357,12 +2624,46 @@ bool Server::IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name) co
     return mp->ignore_eovercrowded;
 }
 
-bool Server::AcceptRequest(Controller* cntl) const {
-    const Interceptor* interceptor = _options.interceptor;
-    if (!interceptor) {
-        return true;
+int Server::RegisterAttachmentPool(const butil::StringPiece& full_method_name,
+                                   AttachmentBufferPool* pool) {
+    if (NULL == pool) {
+        LOG(ERROR) << "Param[pool] is NULL";
+        return -1;
+    }
+    if (IsRunning()) {
+        LOG(ERROR) << "RegisterAttachmentPool is only allowed before Server started";
+        return -1;
+    }
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
+    }
+    mp->attachment_pool = pool;
+    return 0;
+}
+
+int Server::RegisterResponseCache(const butil::StringPiece& full_method_name,
+                                  ResponseCache* cache) {
+    if (NULL == cache) {
+        LOG(ERROR) << "Param[cache] is NULL";
+        return -1;
+    }
+    if (IsRunning()) {
+        LOG(ERROR) << "RegisterResponseCache is only allowed before Server started";
+        return -1;
+    }
+    MethodProperty* mp = _method_map.seek(full_method_name);
+    if (mp == NULL) {
+        LOG(ERROR) << "Fail to find method=" << full_method_name;
+        return -1;
     }
+    mp->response_cache = cache;
+    return 0;
+}
 
+bool Server::InterceptRequest(Controller* cntl) const {
+    const Interceptor* interceptor = _options.interceptor;
     int error_code = 0;
     std::string error_text;
     if (cntl &&
@@ -57,7 +57,12 @@ class MongoServiceAdaptor;
 class RestfulMap;
 class RtmpService;
 class RedisService;
+class UserCodeBackupPool;
+class AttachmentBufferPool;
+class ResponseCache;
+class ListenFdHandover;
 struct SocketSSLContext;
+class EgressRateLimiter;
 
 struct ServerOptions {
     ServerOptions();  // Constructed with default options.
@@ -131,6 +136,17 @@ struct ServerOptions {
     // Default: 0 (unlimited)
     int max_concurrency;
 
+    // Slice of max_concurrency reserved for methods whose
+    // ServiceOptions.request_priority is REQUEST_PRIORITY_HIGH (builtin
+    // services are always HIGH). When this option is positive, NORMAL
+    // methods are only admitted while the server-level concurrency is
+    // below (max_concurrency - this option) and LOW methods are shed even
+    // earlier, controlled by -low_priority_concurrency_percent, so that
+    // HIGH methods keep flowing during overload.
+    // Only effective when max_concurrency is positive.
+    // Default: 0 (no priority lanes)
+    int reserved_concurrency_for_high_priority;
+
     // Default value of method-level max concurrencies,
     // Overridable by Server.MaxConcurrencyOf().
     AdaptiveMaxConcurrency method_max_concurrency;
@@ -227,6 +243,32 @@ struct ServerOptions {
     // Default: false
     bool use_rdma;
 
+    // Number of acceptors accepting connections from the port to Start().
+    // When this option is larger than 1, the server listens on the port
+    // with `num_acceptors' SO_REUSEPORT sockets, each owned by a separate
+    // Acceptor, so that the kernel spreads incoming connections over the
+    // sockets and accept processing (along with creation of server-side
+    // Sockets) is no longer serialized in one event handler. Useful against
+    // connection storms, e.g. tens of thousands of reconnections at the
+    // same time. Distinct listened fds are hashed to different
+    // EventDispatchers, enlarge -event_dispatcher_num to parallelize
+    // event dispatching as well. Requires SO_REUSEPORT(linux 3.9+).
+    // The port to `internal_port' is not affected.
+    // Default: 1
+    int num_acceptors;
+
+    // [CAUTION] Only for services whose handlers NEVER block(no synchronous
+    // RPC, no bthread/pthread-blocking calls, no long computation).
+    // Run-to-completion mode: input events of accepted connections are
+    // processed inline in the EventDispatcher thread that noticed them, so
+    // parse->process->respond of a request happen on one core without any
+    // cross-core handoff or bthread creation. Combine with num_acceptors >
+    // 1 and a matching -event_dispatcher_num to shard connections over
+    // cores SO_REUSEPORT-style. A blocking handler in this mode stalls
+    // every connection assigned to the same dispatcher.
+    // Default: false
+    bool run_to_completion;
+
     // [CAUTION] This option is for implementing specialized baidu-std proxies,
     // most users don't need it. Don't change this option unless you fully
     // understand the description below.
@@ -292,6 +334,13 @@ struct ServerOptions {
     // [CUATION] You should not enabling this option if your rpc is heavy-loaded.
     bool ignore_eovercrowded;
 
+    // Limit the total bytes per second written into all connections
+    // accepted by this server(one shared token bucket, excluding the
+    // internal_port), so that bulk responses cannot saturate the NIC and
+    // delay other traffic on the box. See egress_rate_limiter.h.
+    // Default: 0 (unlimited)
+    int64_t max_egress_bytes_per_second;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ServerOptions from being bloated in most cases.
@@ -356,6 +405,36 @@ struct ServiceOptions {
     // enable server end progressive reading, mainly for http server
     // Default: false.
     bool enable_progressive_read;
+
+    // If this option is positive and -usercode_in_pthread is on, user code
+    // of the service runs in a dedicated pool with so many backup pthreads
+    // instead of the global one shared by all services, so that queueing
+    // delays caused by slow methods elsewhere do not affect this service.
+    // Default: 0 (share the global pool)
+    int dedicated_usercode_backup_threads;
+
+    // Priority lane of all methods in the service. Only effective when
+    // ServerOptions.reserved_concurrency_for_high_priority is positive:
+    // during overload, REQUEST_PRIORITY_LOW methods are shed first and
+    // REQUEST_PRIORITY_HIGH methods keep being served out of the reserved
+    // concurrency slice. Builtin services are always HIGH so that health
+    // checks and admin calls survive overload.
+    // Default: REQUEST_PRIORITY_NORMAL
+    RequestPriority request_priority;
+
+    // Run methods of the service in bthread workers of this tag, giving
+    // the service a dedicated worker group with its own parking lot and
+    // steal domain. Requests of other services (and the server's internal
+    // work) cannot delay this service by occupying its workers, and slow
+    // methods of this service cannot delay others, without splitting the
+    // process into multiple binaries. The tag must be inside
+    // [BTHREAD_TAG_DEFAULT, FLAGS_task_group_ntags) and the user must
+    // assign workers to it with bthread_setconcurrency_by_tag(), otherwise
+    // requests of the service never run. Currently only effective for
+    // baidu_std and http/h2 server protocols, other protocols run the
+    // service in the server's worker group(ServerOptions.bthread_tag).
+    // Default: BTHREAD_TAG_INVALID (run in the server's worker group)
+    bthread_tag_t bthread_tag;
 };
 
 // Represent ports inside [min_port, max_port]
@@ -386,6 +465,9 @@ public:
         // further matched by it.
         google::protobuf::Service* service;
         RestfulMap* restful_map;
+        // Dedicated pool running user code of the service's methods, owned
+        // by this property. NULL means sharing the global pool.
+        UserCodeBackupPool* usercode_pool;
 
         bool is_user_service() const {
             return !is_builtin_service && !restful_map;
@@ -421,8 +503,19 @@ public:
         // It might introduce inbalance between methods, 
         // as some methods(ignore_eovercrowded=true) might never return eovercrowded 
         // while other methods(ignore_eovercrowded=false) keep returning eovercrowded.
-        // currently only valid for baidu_master_service, baidu_rpc, http_rpc, hulu_pbrpc and sofa_pbrpc protocols 
+        // currently only valid for baidu_master_service, baidu_rpc, http_rpc, hulu_pbrpc and sofa_pbrpc protocols
         bool ignore_eovercrowded;
+        // Attachments of this method land in aligned buffers of this pool
+        // (baidu_std only). Set by RegisterAttachmentPool(), not owned.
+        AttachmentBufferPool* attachment_pool;
+        // Serialized responses of this method are cached here and hits skip
+        // user code (baidu_std only). Set by RegisterResponseCache(), not
+        // owned.
+        ResponseCache* response_cache;
+        // Dedicated worker group running this method, from
+        // ServiceOptions.bthread_tag. BTHREAD_TAG_INVALID means running
+        // in the server's worker group.
+        bthread_tag_t bthread_tag;
 
         MethodProperty();
     };
@@ -604,12 +697,39 @@ public:
     bool& IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name);
     bool IgnoreEovercrowdedOf(const butil::StringPiece& full_method_name) const;
 
+    // Receive attachments of `full_method_name' (= "full_service_name.method")
+    // into aligned buffers acquired from `pool' so that user code can use
+    // them for O_DIRECT I/O without copying, e.g.
+    //   server.RegisterAttachmentPool("example.EchoService.Echo", &pool);
+    // Only effective for baidu_std requests whose attachment fits into one
+    // buffer of the pool; others fall back to ordinary IOBuf blocks.
+    // `pool' is not owned and must outlive the server.
+    // This interface can ONLY be called after AddService() and before the
+    // server is started. Returns 0 on success, -1 otherwise.
+    int RegisterAttachmentPool(const butil::StringPiece& full_method_name,
+                               AttachmentBufferPool* pool);
+
+    // Answer repeated identical requests to `full_method_name'
+    // (= "full_service_name.method") from `cache' instead of calling user
+    // code, see comments in response_cache.h for when this is safe and how
+    // keys are computed. Only effective for baidu_std requests.
+    // `cache' is not owned and must outlive the server.
+    // This interface can ONLY be called after AddService() and before the
+    // server is started. Returns 0 on success, -1 otherwise.
+    int RegisterResponseCache(const butil::StringPiece& full_method_name,
+                              ResponseCache* cache);
+
     int Concurrency() const {
         return butil::subtle::NoBarrier_Load(&_concurrency);
     };
   
     // Returns true if accept request, reject request otherwise.
-    bool AcceptRequest(Controller* cntl) const;
+    // Inlined so that servers without an interceptor only pay one
+    // well-predicted branch per request instead of a function call.
+    bool AcceptRequest(Controller* cntl) const {
+        return BAIDU_LIKELY(NULL == _options.interceptor)
+            || InterceptRequest(cntl);
+    }
 
     bool has_progressive_read_method() const {
         return this->_has_progressive_read_method;
@@ -624,6 +744,9 @@ friend class ServerPrivateAccessor;
 friend class PrometheusMetricsService;
 friend class Controller;
 
+    // Slow path of AcceptRequest, called when an interceptor is set.
+    bool InterceptRequest(Controller* cntl) const;
+
     int AddServiceInternal(google::protobuf::Service* service,
                            bool is_builtin_service,
                            const ServiceOptions& options);
@@ -641,6 +764,14 @@ friend class Controller;
 
     int InitALPNOptions(const ServerSSLOptions* options);
 
+    // Build SSL contexts from ServerOptions.ssl_options. Called by
+    // StartInternal, possibly in a background bthread overlapping with
+    // registration of builtin services.
+    int InitSSLContexts();
+
+    // bthread entry wrapping InitSSLContexts().
+    static void* RunInitSSLContexts(void* args);
+
     // Create acceptor with handlers of protocols.
     Acceptor* BuildAcceptor();
 
@@ -735,6 +866,10 @@ friend class Controller;
     SimpleDataPool* _session_local_data_pool;
     ThreadLocalOptions _tl_options;
 
+    // Wraps user's ServerOptions.auth when -auth_result_cache_ttl_ms is
+    // positive, owned by this server.
+    Authenticator* _cached_auth;
+
     Status _status;
     int _builtin_service_count;
     // number of the virtual services for mapping URL to methods.
@@ -743,6 +878,14 @@ friend class Controller;
     bool _failed_to_set_ignore_eovercrowded;
     Acceptor* _am;
     Acceptor* _internal_am;
+    // Additional acceptors listening on SO_REUSEPORT sockets of the main
+    // port when ServerOptions.num_acceptors > 1.
+    std::vector<Acceptor*> _extra_ams;
+
+    // Serves our listen fds to the next generation of the process when
+    // -graceful_restart_uds is on. Created by StartInternal, stopped by
+    // Stop(), owned by this server.
+    ListenFdHandover* _fd_handover;
 
     // Use method->full_name() as key
     MethodMap _method_map;
@@ -768,6 +911,10 @@ friend class Controller;
     // Default certificate which can't be reloaded
     std::shared_ptr<SocketSSLContext> _default_ssl_ctx;
 
+    // Token bucket shared by all accepted connections when
+    // ServerOptions.max_egress_bytes_per_second is positive.
+    std::shared_ptr<EgressRateLimiter> _egress_limiter;
+
     // Reloadable SSL mappings
     butil::DoublyBufferedData<CertMaps> _reload_cert_maps;
 
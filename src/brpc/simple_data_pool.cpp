@@ -16,16 +16,43 @@
 // under the License.
 
 
+#include <sched.h>                           // sched_getcpu
+#include <unistd.h>                          // sysconf
 #include "brpc/simple_data_pool.h"
 
 namespace brpc {
 
+size_t SimpleDataPool::data_pool_nshard() {
+    static size_t nshard = 0;
+    if (nshard == 0) {
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t n = 1;
+        while (n < (size_t)ncpu && n < POOL_MAX_NSHARD) {
+            n <<= 1;
+        }
+        nshard = n;
+    }
+    return nshard;
+}
+
+size_t SimpleDataPool::current_shard_index() {
+#if defined(OS_LINUX)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return (size_t)cpu & (data_pool_nshard() - 1);
+    }
+#endif
+    return ((size_t)pthread_self() >> 5) & (data_pool_nshard() - 1);
+}
+
 SimpleDataPool::SimpleDataPool(const DataFactory* factory)
-    : _capacity(0)
-    , _size(0)
+    : _reserved(0)
+    , _nfree(0)
     , _ncreated(0)
-    , _pool(NULL)
     , _factory(factory) {
+    for (size_t i = 0; i < POOL_MAX_NSHARD; ++i) {
+        _shards[i].head.store(NULL, butil::memory_order_relaxed);
+    }
 }
 
 SimpleDataPool::~SimpleDataPool() {
@@ -33,72 +60,117 @@ SimpleDataPool::~SimpleDataPool() {
 }
 
 void SimpleDataPool::Reset(const DataFactory* factory) {
-    unsigned saved_size = 0;
-    void** saved_pool = NULL;
     const DataFactory* saved_factory = NULL;
+    FreeNode* saved_heads[POOL_MAX_NSHARD];
     {
         BAIDU_SCOPED_LOCK(_mutex);
-        saved_size = _size;
-        saved_pool = _pool;
         saved_factory = _factory;
-        _capacity = 0;
-        _size = 0;
+        for (size_t i = 0; i < POOL_MAX_NSHARD; ++i) {
+            saved_heads[i] =
+                _shards[i].head.exchange(NULL, butil::memory_order_acquire);
+        }
+        _reserved = 0;
+        _nfree.store(0, butil::memory_order_relaxed);
         _ncreated.store(0, butil::memory_order_relaxed);
-        _pool = NULL;
         _factory = factory;
     }
-    if (saved_pool) {
-        if (saved_factory) {
-            for (unsigned i = 0; i < saved_size; ++i) {
-                saved_factory->DestroyData(saved_pool[i]);
+    for (size_t i = 0; i < POOL_MAX_NSHARD; ++i) {
+        for (FreeNode* p = saved_heads[i]; p != NULL;) {
+            FreeNode* const next = p->next;
+            if (saved_factory) {
+                saved_factory->DestroyData(p->data);
             }
+            free(p);
+            p = next;
         }
-        free(saved_pool);
     }
 }
 
 void SimpleDataPool::Reserve(unsigned n) {
-    if (_capacity >= n) {
-        return;
-    }
     BAIDU_SCOPED_LOCK(_mutex);
-    if (_capacity >= n) {
-        return;
-    }
-    // Resize.
-    const unsigned new_cap = std::max(_capacity * 3 / 2, n);
-    void** new_pool = (void**)malloc(new_cap * sizeof(void*));
-    if (NULL == new_pool) {
-        return;
-    }
-    if (_pool) {
-        memcpy(new_pool, _pool, _capacity * sizeof(void*));
-        free(_pool);
-    }
-    unsigned i = _capacity;
-    _capacity = new_cap;
-    _pool = new_pool;
-
-    for (; i < n; ++i) {
+    for (; _reserved < n; ++_reserved) {
         void* data = _factory->CreateData();
         if (data == NULL) {
             break;
         }
-        _ncreated.fetch_add(1,  butil::memory_order_relaxed);
-        _pool[_size++] = data;
+        _ncreated.fetch_add(1, butil::memory_order_relaxed);
+        if (!PushFree(data)) {
+            _factory->DestroyData(data);
+            break;
+        }
     }
 }
 
+SimpleDataPool::FreeNode* SimpleDataPool::PopFromShard(Shard& s) {
+    if (NULL == s.head.load(butil::memory_order_relaxed)) {
+        return NULL;
+    }
+    FreeNode* p = s.head.exchange(NULL, butil::memory_order_acquire);
+    if (NULL == p) {
+        return NULL;
+    }
+    FreeNode* rest = p->next;
+    if (rest) {
+        FreeNode* tail = rest;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        FreeNode* head = s.head.load(butil::memory_order_relaxed);
+        do {
+            tail->next = head;
+        } while (!s.head.compare_exchange_weak(
+                     head, rest, butil::memory_order_release,
+                     butil::memory_order_relaxed));
+    }
+    return p;
+}
+
+void* SimpleDataPool::PopFree() {
+    const size_t nshard = data_pool_nshard();
+    const size_t index = current_shard_index();
+    FreeNode* p = PopFromShard(_shards[index]);
+    // Steal from other shards before creating new data, critical for
+    // the case that borrowing and returning threads run on different
+    // cores steadily.
+    for (size_t i = 1; i < nshard && NULL == p; ++i) {
+        p = PopFromShard(_shards[(index + i) & (nshard - 1)]);
+    }
+    if (NULL == p) {
+        return NULL;
+    }
+    _nfree.fetch_sub(1, butil::memory_order_relaxed);
+    void* const data = p->data;
+    free(p);
+    return data;
+}
+
+bool SimpleDataPool::PushFree(void* data) {
+    FreeNode* p = (FreeNode*)malloc(sizeof(FreeNode));
+    if (NULL == p) {
+        return false;
+    }
+    p->data = data;
+    Shard& s = _shards[current_shard_index()];
+    FreeNode* head = s.head.load(butil::memory_order_relaxed);
+    do {
+        p->next = head;
+    } while (!s.head.compare_exchange_weak(
+                 head, p, butil::memory_order_release,
+                 butil::memory_order_relaxed));
+    _nfree.fetch_add(1, butil::memory_order_relaxed);
+    return true;
+}
+
 void* SimpleDataPool::Borrow() {
-    if (_size) {
-        BAIDU_SCOPED_LOCK(_mutex);
-        if (_size) {
-            return _pool[--_size];
+    if (_nfree.load(butil::memory_order_relaxed)) {
+        void* data = PopFree();
+        if (data) {
+            return data;
         }
     }
     void* data = _factory->CreateData();
     if (data) {
-        _ncreated.fetch_add(1,  butil::memory_order_relaxed);
+        _ncreated.fetch_add(1, butil::memory_order_relaxed);
     }
     return data;
 }
@@ -108,30 +180,17 @@ void SimpleDataPool::Return(void* data) {
         return;
     }
     if (!_factory->ResetData(data)) {
-        return _factory->DestroyData(data); 
-    }
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    if (_capacity == _size) {
-        const unsigned new_cap = (_capacity <= 1 ? 128 : (_capacity * 3 / 2));
-        void** new_pool = (void**)malloc(new_cap * sizeof(void*));
-        if (NULL == new_pool) {
-            mu.unlock();
-            return _factory->DestroyData(data);
-        }
-        if (_pool) {
-            memcpy(new_pool, _pool, _capacity * sizeof(void*));
-            free(_pool);
-        }
-        _capacity = new_cap;
-        _pool = new_pool;
+        return _factory->DestroyData(data);
+    }
+    if (!PushFree(data)) {
+        return _factory->DestroyData(data);
     }
-    _pool[_size++] = data;
 }
 
 SimpleDataPool::Stat SimpleDataPool::stat() const {
-    Stat s = { _size, _ncreated.load(butil::memory_order_relaxed) };
+    Stat s = { _nfree.load(butil::memory_order_relaxed),
+               _ncreated.load(butil::memory_order_relaxed) };
     return s;
 }
 
 } // namespace brpc
-
@@ -19,6 +19,8 @@
 #ifndef BRPC_SIMPLE_DATA_POOL_H
 #define BRPC_SIMPLE_DATA_POOL_H
 
+#include "butil/atomicops.h"
+#include "butil/macros.h"
 #include "butil/scoped_lock.h"
 #include "brpc/data_factory.h"
 
@@ -29,8 +31,12 @@ namespace brpc {
 // reusing void* data. We're assuming that data consumes considerable
 // memory and should be reused as much as possible, thus unlike the
 // multi-threaded allocator caching objects thread-locally, we just
-// put everything in a global list to maximize sharing. It's currently
-// used by Server to reuse session-local data. 
+// put everything in a global structure to maximize sharing. It's
+// currently used by Server to reuse session-local data.
+// Borrow/Return are lock-free: free data is chained into per-core
+// (Treiber) stacks so that workers handling requests concurrently do
+// not serialize on a mutex. The mutex is only taken by the rarely
+// called Reset/Reserve.
 class SimpleDataPool {
 public:
     struct Stat {
@@ -45,14 +51,39 @@ public:
     void* Borrow();
     void Return(void*);
     Stat stat() const;
-    
+
 private:
-    butil::Mutex _mutex;
-    unsigned _capacity;
-    unsigned _size;
+    // Chains one free data into the stack of a Shard.
+    struct FreeNode {
+        FreeNode* next;
+        void* data;
+    };
+    // A lock-free (Treiber) stack of free data. Data is returned to the
+    // shard of the core it's freed on. Pops take the whole stack in one
+    // exchange(and prepend the rest back), which avoids the ABA problem
+    // of popping a single node.
+    struct BAIDU_CACHELINE_ALIGNMENT Shard {
+        butil::atomic<FreeNode*> head;
+    };
+
+    static size_t data_pool_nshard();
+    static size_t current_shard_index();
+
+    FreeNode* PopFromShard(Shard& s);
+    // Pop one free data or return NULL when all shards are empty.
+    void* PopFree();
+    // Push `data' to the shard of the current core. Returns false when
+    // the node can't be allocated(caller shall destroy `data').
+    bool PushFree(void* data);
+
+    static const size_t POOL_MAX_NSHARD = 32;
+
+    butil::Mutex _mutex;  // serializes Reset/Reserve only.
+    unsigned _reserved;
+    butil::atomic<unsigned> _nfree;
     butil::atomic<unsigned> _ncreated;
-    void** _pool;
     const DataFactory* _factory;
+    Shard _shards[POOL_MAX_NSHARD];
 };
 
 } // namespace brpc
@@ -26,6 +26,13 @@
 #include <mesalink/openssl/x509.h>
 #endif
 #include <netinet/tcp.h>                         // getsockopt
+#if defined(OS_LINUX)
+#include <netinet/in.h>                          // IP_RECVERR
+#include <linux/errqueue.h>                      // sock_extended_err
+#include <linux/sockios.h>                       // SIOCOUTQNSD
+#include <sys/ioctl.h>                           // ioctl
+#include <fcntl.h>                               // splice, pipe2
+#endif
 #include <gflags/gflags.h>
 #include "bthread/unstable.h"                    // bthread_timer_del
 #include "butil/fd_utility.h"                     // make_non_blocking
@@ -42,6 +49,7 @@
 #include "brpc/event_dispatcher.h"          // RemoveConsumer
 #include "brpc/socket.h"
 #include "brpc/describable.h"               // Describable
+#include "brpc/egress_rate_limiter.h"       // EgressRateLimiter
 #include "brpc/circuit_breaker.h"           // CircuitBreaker
 #include "brpc/input_messenger.h"
 #include "brpc/details/sparse_minute_counter.h"
@@ -50,6 +58,7 @@
 #include "brpc/policy/rtmp_protocol.h"  // FIXME
 #include "brpc/periodic_task.h"
 #include "brpc/details/health_check.h"
+#include "brpc/websocket.h"                 // WebSocketContext
 #include "brpc/rdma/rdma_endpoint.h"
 #include "brpc/rdma/rdma_helper.h"
 #if defined(OS_MACOSX)
@@ -73,6 +82,13 @@ DEFINE_bool(log_idle_connection_close, false,
             "Print log when an idle connection is closed");
 BRPC_VALIDATE_GFLAG(log_idle_connection_close, PassValidate);
 
+DEFINE_bool(client_tcp_fastopen, false,
+            "Carry the beginning of the first write in the SYN via TCP Fast "
+            "Open when connecting, saving one RTT on reconnections to "
+            "servers that handed out a TFO cookie before. Falls back to "
+            "ordinary connect silently when TFO is unavailable");
+BRPC_VALIDATE_GFLAG(client_tcp_fastopen, PassValidate);
+
 DEFINE_int32(socket_recv_buffer_size, -1, 
             "Set the recv buffer size of socket if this value is positive");
 
@@ -80,8 +96,59 @@ DEFINE_int32(socket_recv_buffer_size, -1,
 DEFINE_int32(socket_send_buffer_size, -1, 
             "Set send buffer size of sockets if this value is positive");
 
+DEFINE_int32(socket_so_busy_poll_us, 0,
+             "(Linux only) If positive, set SO_BUSY_POLL on sockets to let "
+             "the kernel busy-poll the device queue for so many microseconds "
+             "before sleeping, reducing wakeup latency at the cost of CPU. "
+             "Requires CAP_NET_ADMIN on most kernels");
+
 DEFINE_int32(ssl_bio_buffer_size, 16*1024, "Set buffer size for SSL read/write");
 
+DEFINE_bool(socket_zerocopy, false,
+            "(Linux only) Write non-SSL data with MSG_ZEROCOPY, pinning "
+            "IOBuf blocks until the kernel completes the send");
+
+DEFINE_int32(socket_zerocopy_min_bytes, 64 * 1024,
+             "Minimum batch size (in bytes) for a MSG_ZEROCOPY write, "
+             "smaller writes go through the ordinary copying path");
+
+DEFINE_int32(socket_write_coalesce_us, 0,
+             "If positive, an explicit userspace Nagle: on connections "
+             "writing more than -socket_write_coalesce_min_message_rate "
+             "messages per second, hold the first write for up to so many "
+             "microseconds so that writes queued meanwhile share one writev");
+BRPC_VALIDATE_GFLAG(socket_write_coalesce_us, PassValidate);
+
+DEFINE_int32(socket_write_coalesce_min_message_rate, 10000,
+             "Messages per second a connection must exceed before "
+             "-socket_write_coalesce_us takes effect");
+BRPC_VALIDATE_GFLAG(socket_write_coalesce_min_message_rate, PassValidate);
+
+DEFINE_int32(socket_write_coalesce_max_bytes, 64 * 1024,
+             "Do not delay writes whose head request already carries at "
+             "least so many bytes, they fill a writev on their own");
+BRPC_VALIDATE_GFLAG(socket_write_coalesce_max_bytes, PositiveInteger);
+
+DEFINE_int32(socket_notsent_lowat, 0,
+             "(Linux only) If positive, set TCP_NOTSENT_LOWAT on sockets to "
+             "this value(bytes) and pause KeepWrite until EPOLLOUT once "
+             "kernel-buffered unsent bytes exceed it, bounding kernel-queued "
+             "data ahead of later writes on the same connection");
+BRPC_VALIDATE_GFLAG(socket_notsent_lowat, PassValidate);
+
+DEFINE_int32(socket_resident_writer_min_message_rate, 0,
+             "If positive, a connection writing at least this many messages "
+             "per second keeps its KeepWrite bthread parked on a butex "
+             "between incomplete writes instead of spawning a new bthread "
+             "for each one, removing create/join churn on streaming-heavy "
+             "sockets. 0 disables resident writers.");
+BRPC_VALIDATE_GFLAG(socket_resident_writer_min_message_rate, PassValidate);
+
+DEFINE_int32(socket_resident_writer_idle_ms, 100,
+             "A resident writer retires after going this many milliseconds "
+             "without being handed new writes");
+BRPC_VALIDATE_GFLAG(socket_resident_writer_idle_ms, PositiveInteger);
+
 DEFINE_int64(socket_max_unwritten_bytes, 64 * 1024 * 1024,
              "Max unwritten bytes in each socket, if the limit is reached,"
              " Socket.Write fails with EOVERCROWDED");
@@ -94,6 +161,13 @@ DEFINE_int32(max_connection_pool_size, 100,
              "Max number of pooled connections to a single endpoint");
 BRPC_VALIDATE_GFLAG(max_connection_pool_size, PassValidate);
 
+DEFINE_int32(connection_pool_local_cache_size, 4,
+             "Number of pooled connections each worker thread may cache "
+             "locally per endpoint so that get/return of hot pooled "
+             "connections don't contend on the shared pool mutex. 0 "
+             "disables the cache.");
+BRPC_VALIDATE_GFLAG(connection_pool_local_cache_size, NonNegativeInteger);
+
 DEFINE_int32(connect_timeout_as_unreachable, 3,
              "If the socket failed to connect due to ETIMEDOUT for so many "
              "times *continuously*, the error is changed to ENETUNREACH which "
@@ -127,13 +201,31 @@ public:
     void ListSockets(std::vector<SocketId>* list, size_t max_count);
     
 private:
+    // Number of per-worker cache slots, must be a power of 2. Each worker
+    // thread sticks to one slot so a slot mutex is effectively uncontended.
+    static const size_t CACHE_SLOT_NUM = 32;
+
+    // Per-worker stack of recently returned pooled sockets. Aligned so
+    // that neighbouring slots don't share cachelines.
+    struct BAIDU_CACHELINE_ALIGNMENT CacheSlot {
+        butil::Mutex mutex;
+        std::vector<SocketId> stack;
+    };
+
+    // Index of the slot the calling thread sticks to.
+    static size_t tls_slot_index();
+
     // options used to create this instance
     SocketOptions _options;
     butil::Mutex _mutex;
     std::vector<SocketId> _pool;
+    CacheSlot _cache_slots[CACHE_SLOT_NUM];
     butil::EndPoint _remote_side;
     butil::atomic<int> _numfree; // #free sockets in all sub pools.
     butil::atomic<int> _numinflight; // #inflight sockets in all sub pools.
+    // Floor set by Socket::SetMinPooledSocketCount: idle pruning in
+    // socket_map.cpp keeps (and replenishes to) this many pooled sockets.
+    butil::atomic<int> _min_count;
 };
 
 // NOTE: sizeof of this class is 1200 bytes. If we have 10K sockets, total
@@ -194,6 +286,11 @@ public:
 
     butil::atomic<uint64_t> recent_error_count;
 
+    // Time(cpuwide, in us) of the last successful in-band response through
+    // any socket sharing this part. Read by health checking as passive
+    // evidence that the server is reachable.
+    butil::atomic<int64_t> last_inband_success_time_us;
+
     explicit SharedPart(SocketId creator_socket_id);
     ~SharedPart();
 
@@ -210,7 +307,8 @@ Socket::SharedPart::SharedPart(SocketId creator_socket_id2)
     , out_size(0)
     , out_num_messages(0)
     , extended_stat(NULL)
-    , recent_error_count(0) {
+    , recent_error_count(0)
+    , last_inband_success_time_us(0) {
 }
 
 Socket::SharedPart::~SharedPart() {
@@ -456,19 +554,24 @@ Socket::Socket(Forbidden f)
     , _tos(0)
     , _reset_fd_real_us(-1)
     , _on_edge_triggered_events(NULL)
+    , _process_event_inline(false)
     , _user(NULL)
     , _conn(NULL)
     , _preferred_index(-1)
     , _hc_count(0)
     , _last_msg_size(0)
     , _avg_msg_size(0)
+    , _avg_burst_size(0)
     , _last_readtime_us(0)
     , _parsing_context(NULL)
     , _correlation_id(0)
+    , _ninprocess(1)
+#if defined(OS_LINUX)
+    , _splice_bytes_left(0)
+#endif
     , _health_check_interval_s(-1)
     , _is_hc_related_ref_held(false)
     , _hc_started(false)
-    , _ninprocess(1)
     , _auth_flag_error(0)
     , _auth_id(INVALID_BTHREAD_ID)
     , _auth_context(NULL)
@@ -478,29 +581,51 @@ Socket::Socket(Forbidden f)
     , _rdma_state(RDMA_OFF)
     , _connection_type_for_progressive_read(CONNECTION_TYPE_UNKNOWN)
     , _controller_released_socket(false)
-    , _overcrowded(false)
     , _fail_me_at_server_stop(false)
     , _logoff_flag(false)
     , _error_code(0)
     , _pipeline_q(NULL)
-    , _last_writetime_us(0)
+    , _write_head(NULL)
     , _unwritten_bytes(0)
+    , _last_writetime_us(0)
     , _epollout_butex(NULL)
-    , _write_head(NULL)
+    , _writer_state(WRITER_NONE)
+    , _writer_req(NULL)
+    , _writer_butex(NULL)
     , _is_write_shutdown(false)
+    , _overcrowded(false)
+#if defined(OS_LINUX)
+    , _zc_state(ZEROCOPY_OFF)
+    , _zc_base_seq(0)
+    , _zc_pinned(NULL)
+    , _splice_dest_id(0)
+    , _splice_pipe{-1, -1}
+#endif
     , _stream_set(NULL)
     , _total_streams_unconsumed_size(0)
     , _ninflight_app_health_check(0)
     , _tcp_user_timeout_ms(-1)
-    , _http_request_method(HTTP_METHOD_GET) {
+    , _http_request_method(HTTP_METHOD_GET)
+    , _websocket_context(NULL) {
     CreateVarsOnce();
     pthread_mutex_init(&_id_wait_list_mutex, NULL);
     _epollout_butex = bthread::butex_create_checked<butil::atomic<int> >();
+    _writer_butex = bthread::butex_create_checked<butil::atomic<int> >();
 }
 
 Socket::~Socket() {
     pthread_mutex_destroy(&_id_wait_list_mutex);
     bthread::butex_destroy(_epollout_butex);
+    bthread::butex_destroy(_writer_butex);
+#if defined(OS_LINUX)
+    delete _zc_pinned;
+#endif
+}
+
+void Socket::ResetWebSocketContext(WebSocketContext* ctx) {
+    WebSocketContext* old_ctx = _websocket_context.exchange(
+        ctx, butil::memory_order_acq_rel);
+    delete old_ctx;
 }
 
 void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest* p) {
@@ -571,6 +696,7 @@ int Socket::ResetFileDescriptor(int fd) {
     // Reset message sizes when fd is changed.
     _last_msg_size = 0;
     _avg_msg_size = 0;
+    _avg_burst_size = 0;
     // MUST store `_fd' before adding itself into epoll device to avoid
     // race conditions with the callback function inside epoll
     _fd.store(fd, butil::memory_order_release);
@@ -642,6 +768,28 @@ void Socket::SetSocketOptions(int fd) {
             PLOG(ERROR) << "Fail to set TCP_USER_TIMEOUT of fd=" << fd;
         }
     }
+
+#if defined(TCP_NOTSENT_LOWAT)
+    if (FLAGS_socket_notsent_lowat > 0) {
+        int lowat = FLAGS_socket_notsent_lowat;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       &lowat, sizeof(lowat)) != 0) {
+            PLOG(ERROR) << "Fail to set TCP_NOTSENT_LOWAT of fd=" << fd
+                        << " to " << lowat;
+        }
+    }
+#endif
+
+#if defined(SO_BUSY_POLL)
+    if (FLAGS_socket_so_busy_poll_us > 0) {
+        int busy_poll_us = FLAGS_socket_so_busy_poll_us;
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                       &busy_poll_us, sizeof(busy_poll_us)) != 0) {
+            PLOG(ERROR) << "Fail to set SO_BUSY_POLL of fd=" << fd << " to "
+                        << busy_poll_us;
+        }
+    }
+#endif
 #endif
 
     if (!_keepalive_options) {
@@ -731,6 +879,7 @@ int Socket::OnCreated(const SocketOptions& options) {
     _remote_side = options.remote_side;
     _local_side = butil::EndPoint();
     _on_edge_triggered_events = options.on_edge_triggered_events;
+    _process_event_inline = options.process_event_inline;
     _user = options.user;
     _conn = options.conn;
     _app_connect = options.app_connect;
@@ -758,6 +907,7 @@ int Socket::OnCreated(const SocketOptions& options) {
     _ssl_state = (options.initial_ssl_ctx == NULL ? SSL_OFF : SSL_UNKNOWN);
     _ssl_session = NULL;
     _ssl_ctx = options.initial_ssl_ctx;
+    _egress_limiter = options.egress_limiter;
 #if BRPC_WITH_RDMA
     CHECK(_rdma_ep == NULL);
     if (options.use_rdma) {
@@ -797,6 +947,11 @@ int Socket::OnCreated(const SocketOptions& options) {
     _tcp_user_timeout_ms = options.tcp_user_timeout_ms;
     CHECK(NULL == _write_head.load(butil::memory_order_relaxed));
     _is_write_shutdown = false;
+#if defined(OS_LINUX)
+    _zc_state = ZEROCOPY_UNKNOWN;
+    _zc_base_seq = 0;
+    CHECK(NULL == _zc_pinned || _zc_pinned->empty());
+#endif
     int fd = options.fd;
     if (!ValidFileDescriptor(fd) && options.connect_on_create) {
         // Connect on create.
@@ -870,7 +1025,33 @@ void Socket::BeforeRecycled() {
     }
 #endif
 
+#if defined(OS_LINUX)
+    // Completions of the closed fd can't be read anymore (its error queue
+    // is gone), keeping the pins would leak the blocks, so drop them.
+    // NOTE: close(2) does not drop references of pages still sitting in
+    // the TCP send queue, so for a short while after an orderly close the
+    // kernel may (re)transmit from blocks that were just returned to the
+    // pool and could already carry new content, which the peer of the
+    // dying connection may observe. The window only exists when a
+    // connection is recycled with unsent or unacknowledged data.
+    if (_zc_pinned != NULL) {
+        BAIDU_SCOPED_LOCK(_zc_mutex);
+        _zc_pinned->clear();
+    }
+    _zc_state = ZEROCOPY_OFF;
+
+    if (_splice_pipe[0] >= 0) {
+        close(_splice_pipe[0]);
+        close(_splice_pipe[1]);
+        _splice_pipe[0] = -1;
+        _splice_pipe[1] = -1;
+    }
+    _splice_bytes_left.store(0, butil::memory_order_relaxed);
+    _splice_dest_id = 0;
+#endif
+
     reset_parsing_context(NULL);
+    ResetWebSocketContext(NULL);
     _read_buf.clear();
 
     _auth_flag_error.store(0, butil::memory_order_relaxed);
@@ -884,6 +1065,7 @@ void Socket::BeforeRecycled() {
     }
 
     _ssl_ctx = NULL;
+    _egress_limiter = NULL;
 
     delete _pipeline_q;
     _pipeline_q = NULL;
@@ -933,6 +1115,11 @@ void Socket::OnFailed(int error_code, const std::string& error_text) {
     _epollout_butex->fetch_add(1, butil::memory_order_relaxed);
     bthread::butex_wake_all(_epollout_butex);
 
+    // A resident writer parked between chains holds a socket reference;
+    // wake it so that it retires now instead of after the idle timeout.
+    _writer_butex->fetch_add(1, butil::memory_order_relaxed);
+    bthread::butex_wake_all(_writer_butex);
+
     // Wake up all unresponded RPC.
     CHECK_EQ(0, bthread_id_list_reset2_pthreadsafe(
         &_id_wait_list, error_code, error_text,
@@ -1040,6 +1227,21 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     }
 #endif
 
+#if defined(OS_LINUX)
+    // The revived connection gets a new fd which has not been probed for
+    // SO_ZEROCOPY and whose completion counter restarts at 0. Blocks pinned
+    // for the closed fd can't be matched with completions anymore (the
+    // error queue died with the fd), drop them. See the comment in
+    // BeforeRecycled about the window in which the kernel may still
+    // reference their pages.
+    if (_zc_pinned != NULL) {
+        BAIDU_SCOPED_LOCK(_zc_mutex);
+        _zc_pinned->clear();
+    }
+    _zc_state = ZEROCOPY_UNKNOWN;
+    _zc_base_seq = 0;
+#endif
+
     _local_side = butil::EndPoint();
     if (_ssl_session) {
         SSL_free(_ssl_session);
@@ -1050,6 +1252,7 @@ int Socket::WaitAndReset(int32_t expected_nref) {
     // parsing_context is very likely to be associated with the fd,
     // removing it is a safer choice and required by http2.
     reset_parsing_context(NULL);
+    ResetWebSocketContext(NULL);
     // Must clear _read_buf otehrwise even if the connections is recovered,
     // the kept old data is likely to make parsing fail.
     _read_buf.clear();
@@ -1096,6 +1299,24 @@ int64_t Socket::recent_error_count() const {
     return 0;
 }
 
+void Socket::RecordInbandSuccess() {
+    // Don't create the SharedPart just for the record: a socket without
+    // one has no health checking watching it either.
+    SharedPart* sp = GetSharedPart();
+    if (sp) {
+        sp->last_inband_success_time_us.store(
+            butil::cpuwide_time_us(), butil::memory_order_relaxed);
+    }
+}
+
+int64_t Socket::last_inband_success_time_us() const {
+    SharedPart* sp = GetSharedPart();
+    if (sp) {
+        return sp->last_inband_success_time_us.load(butil::memory_order_relaxed);
+    }
+    return 0;
+}
+
 int Socket::isolated_times() const {
     SharedPart* sp = GetSharedPart();
     if (sp) {
@@ -1114,7 +1335,8 @@ void Socket::FeedbackCircuitBreaker(int error_code, int64_t latency_us) {
 
 int Socket::ReleaseReferenceIfIdle(int idle_seconds) {
     const int64_t last_active_us = last_active_time_us();
-    if (butil::cpuwide_time_us() - last_active_us <= idle_seconds * 1000000L) {
+    if (butil::coarse_cpuwide_time_us() - last_active_us <=
+        idle_seconds * 1000000L) {
         return 0;
     }
     LOG_IF(WARNING, FLAGS_log_idle_connection_close)
@@ -1288,7 +1510,8 @@ int Socket::WaitEpollOut(int fd, bool pollin, const timespec* abstime) {
 }
 
 int Socket::Connect(const timespec* abstime,
-                    int (*on_connect)(int, int, void*), void* data) {
+                    int (*on_connect)(int, int, void*), void* data,
+                    WriteRequest* first_write) {
     if (_ssl_ctx) {
         _ssl_state = SSL_CONNECTING;
     } else {
@@ -1309,8 +1532,40 @@ int Socket::Connect(const timespec* abstime,
     // We need to do async connect (to manage the timeout by ourselves).
     CHECK_EQ(0, butil::make_non_blocking(sockfd));
     
-    const int rc = ::connect(
-        sockfd, (struct sockaddr*)&serv_addr, addr_size);
+    int rc = -1;
+#if defined(OS_LINUX) && defined(MSG_FASTOPEN)
+    if (FLAGS_client_tcp_fastopen &&
+        first_write != NULL &&
+        first_write->user_message() == NULL &&  // data fully serialized
+        !first_write->data.empty() &&
+        _ssl_ctx == NULL &&          // payload in the SYN is plaintext
+        _app_connect == NULL &&      // app-level handshake must go first
+        serv_addr.ss_family != AF_UNIX) {
+        // Carry the head of the first write in the SYN. Without a cookie
+        // for this server the kernel sends an ordinary SYN and returns
+        // EINPROGRESS; with one, accepted bytes are popped from the
+        // request so that KeepWrite resumes from the right position
+        // after the connection completes.
+        const butil::StringPiece block = first_write->data.backing_block(0);
+        const ssize_t nw = sendto(sockfd, block.data(), block.size(),
+                                  MSG_FASTOPEN,
+                                  (struct sockaddr*)&serv_addr, addr_size);
+        if (nw >= 0) {
+            first_write->data.pop_front(nw);
+            rc = 0;
+        } else if (errno == EOPNOTSUPP || errno == EPERM) {
+            // TFO turned off by sysctl or blackhole-detected, downgrade
+            // to an ordinary connect.
+            rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, addr_size);
+        }
+        // Other errors (notably EINPROGRESS) are handled below just like
+        // the ones from connect().
+    } else {
+        rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, addr_size);
+    }
+#else
+    rc = ::connect(sockfd, (struct sockaddr*)&serv_addr, addr_size);
+#endif
     if (rc != 0 && errno != EINPROGRESS) {
         PLOG(WARNING) << "Fail to connect to " << remote_side();
         return -1;
@@ -1410,11 +1665,12 @@ int Socket::CheckConnected(int sockfd) {
 }
 
 int Socket::DoConnect(const timespec* abstime,
-                      int (*on_connect)(int, int, void*), void* data) {
+                      int (*on_connect)(int, int, void*), void* data,
+                      WriteRequest* first_write) {
     if (_conn) {
         return _conn->Connect(this, abstime, on_connect, data);
     } else {
-        return Connect(abstime, on_connect, data);
+        return Connect(abstime, on_connect, data, first_write);
     }
 }
 
@@ -1428,13 +1684,44 @@ int Socket::ConnectIfNot(const timespec* abstime, WriteRequest* req) {
     SocketUniquePtr s;
     ReAddress(&s);
     req->set_socket(s.get());
-    if (DoConnect(abstime, KeepWriteIfConnected, req) < 0) {
+    if (DoConnect(abstime, KeepWriteIfConnected, req, req) < 0) {
         return -1;
     }
     s.release();
     return 1;    
 }
 
+int Socket::Warmup(const timespec* abstime) {
+    if (_fd.load(butil::memory_order_consume) >= 0) {
+        return 0;
+    }
+    if (_app_connect) {
+        // Application-level connects (e.g. RTMP) only run inside the
+        // write path, a pre-installed fd would skip them.
+        LOG(WARNING) << "Skip warming up " << *this
+                     << " which has an app-level connect";
+        return -1;
+    }
+    // Set tag for client side socket
+    _io_event.set_bthread_tag(bthread_self_tag());
+    butil::fd_guard sockfd(DoConnect(abstime, NULL, NULL));
+    if (sockfd < 0) {
+        return -1;
+    }
+    if (_fd.load(butil::memory_order_consume) >= 0) {
+        // A racing Write connected in the meantime, keep its fd.
+        return 0;
+    }
+    if (ResetFileDescriptor(sockfd) != 0) {
+        return -1;
+    }
+    if (CreatedByConnect()) {
+        g_vars->channel_conn << 1;
+    }
+    sockfd.release();
+    return 0;
+}
+
 void Socket::WakeAsEpollOut() {
     _epollout_butex->fetch_add(1, butil::memory_order_release);
     bthread::butex_wake_except(_epollout_butex, 0);
@@ -1502,12 +1789,7 @@ void Socket::AfterAppConnected(int err, void* data) {
         }
         // requests are not setup yet. check the comment on Setup() in Write()
         req->Setup(s);
-        bthread_t th;
-        if (bthread_start_background(
-                &th, &BTHREAD_ATTR_NORMAL, KeepWrite, req) != 0) {
-            PLOG(WARNING) << "Fail to start KeepWrite";
-            KeepWrite(req);
-        }
+        s->StartKeepWrite(req);
     } else {
         SocketUniquePtr s(req->get_socket());
         if (err == ETIMEDOUT) {
@@ -1701,6 +1983,236 @@ int Socket::Write(SocketMessagePtr<>& msg, const WriteOptions* options_in) {
     return StartWrite(req, opt);
 }
 
+int Socket::WriteBatch(butil::IOBuf* msgs, size_t n,
+                       const WriteOptions* options_in) {
+    WriteOptions opt;
+    if (options_in) {
+        opt = *options_in;
+    }
+    if (opt.pipelined_count != 0) {
+        // The single id_wait cannot correspond with multiple responses.
+        LOG(ERROR) << "WriteBatch does not support pipelined_count";
+        return SetError(opt.id_wait, EINVAL);
+    }
+    if (Failed()) {
+        const int rc = ConductError(opt.id_wait);
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+    if (!opt.ignore_eovercrowded && _overcrowded) {
+        return SetError(opt.id_wait, EOVERCROWDED);
+    }
+
+    // Allocate a WriteRequest per non-empty message before touching any
+    // of them, so that all messages remain intact on ENOMEM. The chain is
+    // linked from `newest' to `oldest' which is the direction of the list
+    // headed by _write_head, reversed into submission order by the writing
+    // thread(check IsWriteComplete).
+    WriteRequest* newest = NULL;
+    WriteRequest* oldest = NULL;
+    for (size_t i = 0; i < n; ++i) {
+        if (msgs[i].empty()) {
+            continue;
+        }
+        WriteRequest* const req = butil::get_object<WriteRequest>();
+        if (!req) {
+            while (newest) {
+                WriteRequest* const saved_next = newest->next;
+                butil::return_object(newest);
+                newest = saved_next;
+            }
+            return SetError(opt.id_wait, ENOMEM);
+        }
+        req->next = newest;
+        newest = req;
+        if (NULL == oldest) {
+            oldest = req;
+        }
+    }
+    if (NULL == newest) {  // all messages are empty.
+        return SetError(opt.id_wait, EINVAL);
+    }
+
+    // Fill requests by walking messages backwards(the chain goes from the
+    // last message to the first one). Options act on the last message.
+    WriteRequest* q = newest;
+    for (size_t i = n; i > 0; --i) {
+        if (msgs[i - 1].empty()) {
+            continue;
+        }
+        q->data.swap(msgs[i - 1]);
+        q->id_wait = INVALID_BTHREAD_ID;
+        q->clear_and_set_control_bits(false, false);
+        q->set_pipelined_count_and_user_message(0, DUMMY_USER_MESSAGE, 0);
+        q = q->next;
+    }
+    newest->id_wait = opt.id_wait;
+    newest->clear_and_set_control_bits(opt.notify_on_success,
+                                       opt.shutdown_write);
+    // All links inside the batch are valid before the exchange, only
+    // `oldest->next' is pending like in Write(), so the spin in
+    // IsWriteComplete is as short as with a single request.
+    oldest->next = WriteRequest::UNCONNECTED;
+    return StartBatchWrite(newest, oldest, opt);
+}
+
+int Socket::StartBatchWrite(WriteRequest* newest, WriteRequest* oldest,
+                            const WriteOptions& opt) {
+    // Release fence makes sure the thread getting request sees *newest
+    WriteRequest* const prev_head =
+        _write_head.exchange(newest, butil::memory_order_release);
+    if (prev_head != NULL) {
+        // Someone is writing to the fd. The whole batch is queued with the
+        // single exchange above, requests will be Setup() in submission
+        // order by IsWriteComplete in the writing thread.
+        oldest->next = prev_head;
+        return 0;
+    }
+
+    int saved_errno = 0;
+    SocketUniquePtr ptr_for_keep_write;
+    ssize_t nw = 0;
+    int ret = 0;
+    WriteRequest* req = NULL;
+
+    // We've got the right to write. Reverse the batch into submission
+    // order, just like IsWriteComplete does with appended requests.
+    oldest->next = NULL;
+    for (WriteRequest* p = newest; p != NULL;) {
+        WriteRequest* const saved_next = p->next;
+        p->next = req;
+        req = p;
+        p = saved_next;
+    }
+    // `req' is now `oldest' and heads the chain to write.
+
+    // Fast fail when write has been shutdown.
+    if (_is_write_shutdown) {
+        goto FAIL_TO_WRITE;
+    }
+    _is_write_shutdown = req->need_shutdown_write();
+
+    // Batched requests carry no real SocketMessage(data is serialized
+    // already), so unlike StartWrite they can be Setup before connecting.
+    // The head is left to the code below or KeepWriteIfConnected to keep
+    // the same sequence with StartWrite.
+    for (WriteRequest* p = req->next; p != NULL; p = p->next) {
+        p->Setup(this);
+    }
+
+    // Connect to remote_side() if not.
+    ret = ConnectIfNot(opt.abstime, req);
+    if (ret < 0) {
+        saved_errno = errno;
+        SetFailed(errno, "Fail to connect %s directly: %m", description().c_str());
+        goto FAIL_TO_WRITE;
+    } else if (ret == 1) {
+        // We are doing connection. Callback `KeepWriteIfConnected'
+        // will be called with `req' at any moment after
+        return 0;
+    }
+
+    req->Setup(this);
+
+    if (opt.write_in_background || ssl_state() != SSL_OFF) {
+        // Writing into SSL may block the current bthread, always write
+        // in the background.
+        goto KEEPWRITE_IN_BACKGROUND;
+    }
+    if (_egress_limiter != NULL && _egress_limiter->SuggestedWaitUs() > 0) {
+        // The bucket is in debt, let KeepWrite sleep it off instead of
+        // blocking the calling thread here.
+        goto KEEPWRITE_IN_BACKGROUND;
+    }
+
+    // Write once in the calling thread. DoWrite fills iovecs across
+    // message boundaries, so the batch needs few writev(). If the write
+    // is not complete, continue it in KeepWrite thread.
+    nw = DoWrite(req);
+    if (nw < 0) {
+        // RTMP may return EOVERCROWDED
+        if (errno != EAGAIN && errno != EOVERCROWDED) {
+            saved_errno = errno;
+            // EPIPE is common in pooled connections + backup requests.
+            PLOG_IF(WARNING, errno != EPIPE) << "Fail to write into " << *this;
+            SetFailed(saved_errno, "Fail to write into %s: %s",
+                      description().c_str(), berror(saved_errno));
+            goto FAIL_TO_WRITE;
+        }
+    } else {
+        AddOutputBytes(nw);
+        if (_egress_limiter != NULL) {
+            _egress_limiter->Consume(nw);
+        }
+    }
+    // Release fully-written requests except the last one.
+    while (req->next != NULL && req->data.empty()) {
+        WriteRequest* const saved_req = req;
+        req = req->next;
+        ReturnSuccessfulWriteRequest(saved_req);
+    }
+    if (req->next == NULL && IsWriteComplete(req, true, NULL)) {
+        ReturnSuccessfulWriteRequest(req);
+        return 0;
+    }
+
+KEEPWRITE_IN_BACKGROUND:
+    ReAddress(&ptr_for_keep_write);
+    req->set_socket(ptr_for_keep_write.release());
+    StartKeepWrite(req);
+    return 0;
+
+FAIL_TO_WRITE:
+    // `SetFailed' before `ReturnFailedWriteRequest' (which will calls
+    // `on_reset' callback inside the id object) so that we immediately
+    // know this socket has failed inside the `on_reset' callback
+    ReleaseAllFailedWriteRequests(req);
+    errno = saved_errno;
+    return -1;
+}
+
+bool Socket::ShouldCoalesceWrites() const {
+    if (FLAGS_socket_write_coalesce_us <= 0) {
+        return false;
+    }
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL || sp->extended_stat == NULL) {
+        return false;
+    }
+    // out_num_messages_s is refreshed by UpdateStatsEverySecond for both
+    // accepted and connected sockets; pooled sockets count into their main
+    // socket and share its decision.
+    return sp->extended_stat->out_num_messages_s >=
+        (uint32_t)FLAGS_socket_write_coalesce_min_message_rate;
+}
+
+void Socket::WaitForMicroBatch(WriteRequest* head, const WriteOptions& opt) {
+    const int64_t deadline_us =
+        butil::cpuwide_time_us() + opt.micro_batch_window_us;
+    const int64_t slice_us = std::max(opt.micro_batch_window_us / 4, 1);
+    do {
+        bthread_usleep(slice_us);
+        if (opt.micro_batch_max_count <= 0) {
+            continue;
+        }
+        // Count requests queued above `head' since we took the write head.
+        // A link may still be UNCONNECTED for the 1~2 instructions between
+        // a writer exchanging _write_head and linking its request(see
+        // StartWrite); stopping at it merely undercounts and delays the
+        // early flush by one slice.
+        size_t queued = 1;
+        for (WriteRequest* p = _write_head.load(butil::memory_order_acquire);
+             p != head && p != NULL && p != WriteRequest::UNCONNECTED;
+             p = p->next) {
+            ++queued;
+        }
+        if (queued >= (size_t)opt.micro_batch_max_count) {
+            return;
+        }
+    } while (butil::cpuwide_time_us() < deadline_us);
+}
+
 int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
     // Release fence makes sure the thread getting request sees *req
     WriteRequest* const prev_head =
@@ -1716,7 +2228,6 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
     }
 
     int saved_errno = 0;
-    bthread_t th;
     SocketUniquePtr ptr_for_keep_write;
     ssize_t nw = 0;
     int ret = 0;
@@ -1752,7 +2263,66 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         // in the background.
         goto KEEPWRITE_IN_BACKGROUND;
     }
-    
+    if (_egress_limiter != NULL && _egress_limiter->SuggestedWaitUs() > 0) {
+        // The bucket is in debt, let KeepWrite sleep it off instead of
+        // blocking the calling thread here.
+        goto KEEPWRITE_IN_BACKGROUND;
+    }
+
+    if ((opt.micro_batch_window_us > 0 || ShouldCoalesceWrites()) &&
+        req->data.size() < (size_t)FLAGS_socket_write_coalesce_max_bytes) {
+        // Userspace Nagle with bounded latency cost: hold the write briefly
+        // so that writes queued meanwhile share the first writev.
+        if (opt.micro_batch_window_us > 0) {
+            WaitForMicroBatch(req, opt);
+        } else {
+            bthread_usleep(FLAGS_socket_write_coalesce_us);
+        }
+        WriteRequest* coalesced_tail = NULL;
+        if (IsWriteComplete(req, true, &coalesced_tail)) {
+            // Data was cleared(e.g. by an error inside Setup) and no newer
+            // requests arrived, nothing to write.
+            ReturnSuccessfulWriteRequest(req);
+            return 0;
+        }
+        if (req->next != NULL) {
+            size_t nmsg = 0;
+            for (WriteRequest* p = req; p != NULL; p = p->next) {
+                ++nmsg;
+            }
+            g_vars->ncoalescedwrite << 1;
+            g_vars->ncoalescedmsg << nmsg;
+            // DoWrite fills iovecs across message boundaries, writing the
+            // collected chain with as few writev() as possible.
+            nw = DoWrite(req);
+            if (nw < 0) {
+                if (errno != EAGAIN && errno != EOVERCROWDED) {
+                    saved_errno = errno;
+                    PLOG_IF(WARNING, errno != EPIPE) << "Fail to write into " << *this;
+                    SetFailed(saved_errno, "Fail to write into %s: %s",
+                              description().c_str(), berror(saved_errno));
+                    goto FAIL_TO_WRITE;
+                }
+            } else {
+                AddOutputBytes(nw);
+                if (_egress_limiter != NULL) {
+                    _egress_limiter->Consume(nw);
+                }
+            }
+            while (req->next != NULL && req->data.empty()) {
+                WriteRequest* const saved_req = req;
+                req = req->next;
+                ReturnSuccessfulWriteRequest(saved_req);
+            }
+            if (req->next == NULL && IsWriteComplete(req, true, NULL)) {
+                ReturnSuccessfulWriteRequest(req);
+                return 0;
+            }
+            goto KEEPWRITE_IN_BACKGROUND;
+        }
+        // Nothing arrived during the delay, write the single request below.
+    }
+
     // Write once in the calling thread. If the write is not complete,
     // continue it in KeepWrite thread.
     if (_conn) {
@@ -1782,6 +2352,9 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
         }
     } else {
         AddOutputBytes(nw);
+        if (_egress_limiter != NULL) {
+            _egress_limiter->Consume(nw);
+        }
     }
     if (IsWriteComplete(req, true, NULL)) {
         ReturnSuccessfulWriteRequest(req);
@@ -1791,11 +2364,7 @@ int Socket::StartWrite(WriteRequest* req, const WriteOptions& opt) {
 KEEPWRITE_IN_BACKGROUND:
     ReAddress(&ptr_for_keep_write);
     req->set_socket(ptr_for_keep_write.release());
-    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
-                                 KeepWrite, req) != 0) {
-        LOG(FATAL) << "Fail to start KeepWrite";
-        KeepWrite(req);
-    }
+    StartKeepWrite(req);
     return 0;
 
 FAIL_TO_WRITE:
@@ -1809,11 +2378,111 @@ FAIL_TO_WRITE:
 
 static const size_t DATA_LIST_MAX = 256;
 
+void Socket::StartKeepWrite(WriteRequest* req) {
+    // Hand the chain to a parked resident writer if there is one; only
+    // the thread winning the CAS below may fill _writer_req, and a new
+    // chain head appears only after the previous drain completed, so at
+    // most one handoff is ever outstanding.
+    int parked = WRITER_PARKED;
+    if (_writer_state.compare_exchange_strong(
+            parked, WRITER_BUSY, butil::memory_order_acq_rel,
+            butil::memory_order_relaxed)) {
+        _writer_req.store(req, butil::memory_order_release);
+        _writer_butex->fetch_add(1, butil::memory_order_release);
+        bthread::butex_wake(_writer_butex);
+        return;
+    }
+    bthread_t th;
+    if (bthread_start_background(&th, &BTHREAD_ATTR_NORMAL,
+                                 KeepWrite, req) != 0) {
+        LOG(FATAL) << "Fail to start KeepWrite";
+        KeepWrite(req);
+    }
+}
+
+bool Socket::ShouldKeepWriterResident() const {
+    if (FLAGS_socket_resident_writer_min_message_rate <= 0) {
+        return false;
+    }
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL || sp->extended_stat == NULL) {
+        return false;
+    }
+    // Same source as ShouldCoalesceWrites: refreshed by
+    // UpdateStatsEverySecond, pooled sockets count into their main socket.
+    return sp->extended_stat->out_num_messages_s >=
+        (uint32_t)FLAGS_socket_resident_writer_min_message_rate;
+}
+
+Socket::WriteRequest* Socket::WaitAsResidentWriter() {
+    if (Failed() || !ShouldKeepWriterResident()) {
+        return NULL;
+    }
+    int none = WRITER_NONE;
+    if (!_writer_state.compare_exchange_strong(
+            none, WRITER_PARKED, butil::memory_order_acq_rel,
+            butil::memory_order_relaxed)) {
+        // Another writer already parked on this socket.
+        return NULL;
+    }
+    while (true) {
+        // Sample the butex before checking the slot: a handoff completed
+        // between the exchange and the wait bumps the butex, failing the
+        // wait immediately instead of losing the wakeup.
+        const int expected_val =
+            _writer_butex->load(butil::memory_order_acquire);
+        WriteRequest* req =
+            _writer_req.exchange(NULL, butil::memory_order_acquire);
+        if (req != NULL) {
+            g_vars->nresidentwrite << 1;
+            return req;
+        }
+        const timespec duetime = butil::milliseconds_from_now(
+            FLAGS_socket_resident_writer_idle_ms);
+        const int rc = bthread::butex_wait(
+            _writer_butex, expected_val, &duetime);
+        req = _writer_req.exchange(NULL, butil::memory_order_acquire);
+        if (req != NULL) {
+            g_vars->nresidentwrite << 1;
+            return req;
+        }
+        if ((rc < 0 && errno == ETIMEDOUT) || Failed() ||
+            !ShouldKeepWriterResident()) {
+            int parked = WRITER_PARKED;
+            if (_writer_state.compare_exchange_strong(
+                    parked, WRITER_NONE, butil::memory_order_acq_rel,
+                    butil::memory_order_relaxed)) {
+                return NULL;
+            }
+            // A producer won the CAS to hand us a chain between the
+            // exchange above and this CAS; loop back to take it.
+        }
+    }
+}
+
 void* Socket::KeepWrite(void* void_arg) {
-    g_vars->nkeepwrite << 1;
     WriteRequest* req = static_cast<WriteRequest*>(void_arg);
     SocketUniquePtr s(req->get_socket());
+    while (true) {
+        g_vars->nkeepwrite << 1;
+        s->DoKeepWrite(req);
+        // The chain is fully drained (or failed). Go back from BUSY so
+        // that a future producer may park us again via StartKeepWrite.
+        int busy = WRITER_BUSY;
+        s->_writer_state.compare_exchange_strong(
+            busy, WRITER_NONE, butil::memory_order_acq_rel,
+            butil::memory_order_relaxed);
+        req = s->WaitAsResidentWriter();
+        if (req == NULL) {
+            return NULL;
+        }
+        // A handed-off chain carries its own socket reference taken by
+        // the producer; `s' already keeps the socket alive, drop it.
+        SocketUniquePtr handed(req->get_socket());
+    }
+}
 
+void Socket::DoKeepWrite(WriteRequest* req) {
     // When error occurs, spin until there's no more requests instead of
     // returning directly otherwise _write_head is permantly non-NULL which
     // makes later Write() abnormal.
@@ -1825,37 +2494,50 @@ void* Socket::KeepWrite(void* void_arg) {
             WriteRequest* const saved_req = req;
             need_shutdown = req->need_shutdown_write();
             req = req->next;
-            s->ReturnSuccessfulWriteRequest(saved_req);
+            ReturnSuccessfulWriteRequest(saved_req);
         }
         if (need_shutdown) {
-            LOG(WARNING) << "Shutdown write of " << *s;
+            LOG(WARNING) << "Shutdown write of " << *this;
             break;
         }
 
-        const ssize_t nw = s->DoWrite(req);
+        if (_egress_limiter) {
+            // Sleep off the debt of previous writes before writing again.
+            // bthread_usleep parks this bthread in the timer thread, the
+            // worker is free to run others meanwhile.
+            const int64_t wait_us = _egress_limiter->SuggestedWaitUs();
+            if (wait_us > 0) {
+                g_vars->negressthrottle << 1;
+                bthread_usleep(wait_us);
+            }
+        }
+        const ssize_t nw = DoWrite(req);
         if (nw < 0) {
             if (errno != EAGAIN && errno != EOVERCROWDED) {
                 const int saved_errno = errno;
-                PLOG(WARNING) << "Fail to keep-write into " << *s;
-                s->SetFailed(saved_errno, "Fail to keep-write into %s: %s",
-                             s->description().c_str(), berror(saved_errno));
+                PLOG(WARNING) << "Fail to keep-write into " << *this;
+                SetFailed(saved_errno, "Fail to keep-write into %s: %s",
+                             description().c_str(), berror(saved_errno));
                 break;
             }
         } else {
-            s->AddOutputBytes(nw);
+            AddOutputBytes(nw);
+            if (_egress_limiter) {
+                _egress_limiter->Consume(nw);
+            }
         }
         // Release WriteRequest until non-empty data, last request or shutdown write.
         while (req->next != NULL && req->data.empty()) {
             WriteRequest* const saved_req = req;
             need_shutdown = req->need_shutdown_write();
             req = req->next;
-            s->ReturnSuccessfulWriteRequest(saved_req);
+            ReturnSuccessfulWriteRequest(saved_req);
             if (need_shutdown) {
                 break;
             }
         }
         if (need_shutdown) {
-            LOG(WARNING) << "Shutdown write of " << *s;
+            LOG(WARNING) << "Shutdown write of " << *this;
             break;
         }
         // TODO(gejun): wait for epollout when we actually have written
@@ -1864,7 +2546,17 @@ void* Socket::KeepWrite(void* void_arg) {
         // Update(1/8/2016, r31823): Still working.
         // Update(8/15/2017): Not working, performance downgraded.
         //if (nw <= 0 || req->data.empty()/*note*/) {
-        if (nw <= 0) {
+        bool over_lowat = false;
+        if (nw > 0 && FLAGS_socket_notsent_lowat > 0 &&
+            GetKernelNotsentBytes() > FLAGS_socket_notsent_lowat) {
+            // Stop stuffing the send buffer: with TCP_NOTSENT_LOWAT set(in
+            // SetSocketOptions), EPOLLOUT fires when unsent bytes drop below
+            // the watermark again, so waiting here bounds kernel-queued data
+            // instead of filling the buffer until EAGAIN.
+            over_lowat = true;
+            g_vars->nnotsentlowat << 1;
+        }
+        if (nw <= 0 || over_lowat) {
             // NOTE: Waiting epollout within timeout is a must to force
             // KeepWrite to check and setup pending WriteRequests periodically,
             // which may turn on _overcrowded to stop pending requests from
@@ -1872,21 +2564,21 @@ void* Socket::KeepWrite(void* void_arg) {
             const timespec duetime =
                 butil::milliseconds_from_now(WAIT_EPOLLOUT_TIMEOUT_MS);
 #if BRPC_WITH_RDMA
-            if (s->_rdma_state == RDMA_ON) {
-                const int expected_val = s->_epollout_butex
+            if (_rdma_state == RDMA_ON) {
+                const int expected_val = _epollout_butex
                     ->load(butil::memory_order_acquire);
-                CHECK(s->_rdma_ep != NULL);
-                if (!s->_rdma_ep->IsWritable()) {
+                CHECK(_rdma_ep != NULL);
+                if (!_rdma_ep->IsWritable()) {
                     g_vars->nwaitepollout << 1;
-                    if (bthread::butex_wait(s->_epollout_butex,
+                    if (bthread::butex_wait(_epollout_butex,
                             expected_val, &duetime) < 0) {
                         if (errno != EAGAIN && errno != ETIMEDOUT) {
                             const int saved_errno = errno;
-                            PLOG(WARNING) << "Fail to wait rdma window of " << *s;
-                            s->SetFailed(saved_errno, "Fail to wait rdma window of %s: %s",
-                                    s->description().c_str(), berror(saved_errno));
+                            PLOG(WARNING) << "Fail to wait rdma window of " << *this;
+                            SetFailed(saved_errno, "Fail to wait rdma window of %s: %s",
+                                    description().c_str(), berror(saved_errno));
                         }
-                        if (s->Failed()) {
+                        if (Failed()) {
                             // NOTE:
                             // Different from TCP, we cannot find the RDMA channel
                             // failed by writing to it. Thus we must check if it
@@ -1900,13 +2592,13 @@ void* Socket::KeepWrite(void* void_arg) {
             {
 #endif
                 g_vars->nwaitepollout << 1;
-                bool pollin = (s->_on_edge_triggered_events != NULL);
-                const int rc = s->WaitEpollOut(s->fd(), pollin, &duetime);
+                bool pollin = (_on_edge_triggered_events != NULL);
+                const int rc = WaitEpollOut(fd(), pollin, &duetime);
                 if (rc < 0 && errno != ETIMEDOUT) {
                     const int saved_errno = errno;
-                    PLOG(WARNING) << "Fail to wait epollout of " << *s;
-                    s->SetFailed(saved_errno, "Fail to wait epollout of %s: %s",
-                             s->description().c_str(), berror(saved_errno));
+                    PLOG(WARNING) << "Fail to wait epollout of " << *this;
+                    SetFailed(saved_errno, "Fail to wait epollout of %s: %s",
+                             description().c_str(), berror(saved_errno));
                     break;
                 }
             }
@@ -1917,16 +2609,16 @@ void* Socket::KeepWrite(void* void_arg) {
         }
         // Return when there's no more WriteRequests and req is completely
         // written.
-        if (s->IsWriteComplete(cur_tail, (req == cur_tail), &cur_tail)) {
+        if (IsWriteComplete(cur_tail, (req == cur_tail), &cur_tail)) {
             CHECK_EQ(cur_tail, req);
-            s->ReturnSuccessfulWriteRequest(req);
-            return NULL;
+            ReturnSuccessfulWriteRequest(req);
+            return;
         }
     } while (1);
 
     // Error occurred, release all requests until no new requests.
-    s->ReleaseAllFailedWriteRequests(req);
-    return NULL;
+    ReleaseAllFailedWriteRequests(req);
+    return;
 }
 
 ssize_t Socket::DoWrite(WriteRequest* req) {
@@ -1952,6 +2644,11 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
             if (_rdma_ep && _rdma_state != RDMA_OFF) {
                 return _rdma_ep->CutFromIOBufList(data_list, ndata);
             }
+#endif
+#if defined(OS_LINUX)
+            if (UseZerocopy(data_list, ndata)) {
+                return ZerocopyWrite(data_list, ndata);
+            }
 #endif
             return butil::IOBuf::cut_multiple_into_file_descriptor(
                 fd(), data_list, ndata);
@@ -1999,6 +2696,143 @@ ssize_t Socket::DoWrite(WriteRequest* req) {
     return nw;
 }
 
+#if defined(OS_LINUX)
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+bool Socket::UseZerocopy(butil::IOBuf* const* data_list, size_t ndata) {
+    if (!FLAGS_socket_zerocopy || ZEROCOPY_OFF == _zc_state) {
+        return false;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < ndata; ++i) {
+        total += data_list[i]->size();
+    }
+    if (total < (size_t)FLAGS_socket_zerocopy_min_bytes) {
+        return false;
+    }
+    if (ZEROCOPY_UNKNOWN == _zc_state) {
+        // Only called from the (single) writing thread, no race on _zc_state.
+        const int enable = 1;
+        if (setsockopt(fd(), SOL_SOCKET, SO_ZEROCOPY,
+                       &enable, sizeof(enable)) != 0) {
+            // Old kernel or non-TCP socket, stick to the copying path.
+            _zc_state = ZEROCOPY_OFF;
+            return false;
+        }
+        _zc_state = ZEROCOPY_ON;
+    }
+    return true;
+}
+
+ssize_t Socket::ZerocopyWrite(butil::IOBuf* const* data_list, size_t ndata) {
+    // Group the batch into one sendmsg so that the kernel assigns a single
+    // completion sequence number to it.
+    // Same limit as IOBUF_IOV_MAX in iobuf.cpp, never beyond IOV_MAX(1024).
+    struct iovec vec[256];
+    size_t nvec = 0;
+    for (size_t i = 0; i < ndata && nvec < ARRAY_SIZE(vec); ++i) {
+        const butil::IOBuf* buf = data_list[i];
+        const size_t nblock = buf->backing_block_num();
+        for (size_t j = 0; j < nblock && nvec < ARRAY_SIZE(vec); ++j) {
+            butil::StringPiece blk = buf->backing_block(j);
+            if (!blk.empty()) {
+                vec[nvec].iov_base = (void*)blk.data();
+                vec[nvec].iov_len = blk.size();
+                ++nvec;
+            }
+        }
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vec;
+    msg.msg_iovlen = nvec;
+    const ssize_t nw = sendmsg(fd(), &msg, MSG_ZEROCOPY);
+    if (nw < 0) {
+        if (ENOBUFS == errno) {
+            // Out of optmem for completion notifications, downgrade this
+            // write to the copying path instead of failing it.
+            return butil::IOBuf::cut_multiple_into_file_descriptor(
+                fd(), data_list, ndata);
+        }
+        return nw;
+    }
+    if (0 == nw) {
+        return nw;
+    }
+    // The kernel references the sent blocks until the completion arrives
+    // on the error queue. Move the bytes (sharing block refs) into
+    // _zc_pinned instead of releasing them.
+    butil::IOBuf pinned;
+    size_t left = (size_t)nw;
+    for (size_t i = 0; i < ndata && left > 0; ++i) {
+        const size_t n = std::min(left, data_list[i]->size());
+        data_list[i]->cutn(&pinned, n);
+        left -= n;
+    }
+    BAIDU_SCOPED_LOCK(_zc_mutex);
+    if (NULL == _zc_pinned) {
+        _zc_pinned = new std::deque<butil::IOBuf>;
+    }
+    _zc_pinned->push_back(butil::IOBuf());
+    _zc_pinned->back().swap(pinned);
+    return nw;
+}
+
+void Socket::HandleZerocopyCompletions() {
+    if (ZEROCOPY_ON != _zc_state || NULL == _zc_pinned) {
+        return;
+    }
+    const int sockfd = fd();
+    if (sockfd < 0) {
+        return;
+    }
+    char control[128];
+    for (;;) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+            // EAGAIN: error queue drained. Other errors: nothing we can
+            // do here, the read/write paths report them.
+            break;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const struct sock_extended_err* ee =
+                (const struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // [ee_info, ee_data] is the completed range of send sequence
+            // numbers. Entries of _zc_pinned are in sequence order starting
+            // at _zc_base_seq.
+            const uint32_t hi = ee->ee_data;
+            BAIDU_SCOPED_LOCK(_zc_mutex);
+            while (!_zc_pinned->empty() &&
+                   (int32_t)(hi - _zc_base_seq) >= 0) {
+                _zc_pinned->pop_front();
+                ++_zc_base_seq;
+            }
+        }
+    }
+}
+
+#endif  // OS_LINUX
+
 int Socket::SSLHandshake(int fd, bool server_mode) {
     if (_ssl_ctx == NULL) {
         if (server_mode) {
@@ -2008,7 +2842,6 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         return 0;
     }
 
-    // TODO: Reuse ssl session id for client
     if (_ssl_session) {
         // Free the last session, which may be deprecated when socket failed
         SSL_free(_ssl_session);
@@ -2018,6 +2851,17 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
         LOG(ERROR) << "Fail to CreateSSLSession";
         return -1;
     }
+    if (!server_mode) {
+        // Offer the session negotiated by a previous Socket to the same
+        // endpoint so that the handshake resumes(abbreviated in TLS1.2,
+        // PSK in TLS1.3) instead of redoing full crypto. Stale sessions
+        // are simply rejected by the server and a full handshake follows.
+        SSL_SESSION* saved = _ssl_ctx->GetSessionToResume(remote_side());
+        if (saved != NULL) {
+            SSL_set_session(_ssl_session, saved);  // takes its own reference
+            SSL_SESSION_free(saved);
+        }
+    }
 #if defined(SSL_CTRL_SET_TLSEXT_HOSTNAME) || defined(USE_MESALINK)
     if (!_ssl_ctx->sni_name.empty()) {
         SSL_set_tlsext_host_name(_ssl_session, _ssl_ctx->sni_name.c_str());
@@ -2061,7 +2905,15 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
             }
 
             _ssl_state = SSL_CONNECTED;
-            AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
+            if (IsSSLKTLSActive(_ssl_session)) {
+                // Records are en/decrypted by the kernel. Keep the socket
+                // BIO installed during the handshake: replacing it with a
+                // buffer BIO would drop the offload and fall back to
+                // userspace crypto.
+                RPC_VLOG << "SSL with kTLS offload on fd=" << fd;
+            } else {
+                AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
+            }
             return 0;
         }
 
@@ -2105,6 +2957,9 @@ int Socket::SSLHandshake(int fd, bool server_mode) {
 }
 
 ssize_t Socket::DoRead(size_t size_hint) {
+    // Attribute blocks filled below to socket ingress, see /iobuf.
+    butil::ScopedBlockAllocSite alloc_site_guard(
+        butil::IOBuf::BLOCK_SITE_SOCKET_INGRESS);
     if (ssl_state() == SSL_UNKNOWN) {
         int error_code = 0;
         _ssl_state = DetectSSLState(fd(), &error_code);
@@ -2185,6 +3040,188 @@ ssize_t Socket::DoRead(size_t size_hint) {
     return nr;
 }
 
+void Socket::RehomeEventDispatcher() {
+    const int sockfd = fd();
+    if (sockfd < 0 || Failed() || !_on_edge_triggered_events) {
+        return;
+    }
+    if (_io_event.RehomeConsumer(sockfd) != 0) {
+        // The fd left its old dispatcher but could not enter the new one,
+        // events would be lost from now on. Fail the socket to trigger
+        // the usual recovery.
+        SetFailed(EINTERNAL, "Fail to re-home %s into EventDispatcher",
+                  description().c_str());
+    }
+}
+
+#if defined(OS_LINUX)
+int Socket::StartSpliceTo(SocketId dest_id, uint64_t nbytes) {
+    if (nbytes == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ssl_state() != SSL_OFF || _rdma_state != RDMA_OFF) {
+        // Kernel-side forwarding cannot see into SSL/RDMA framing.
+        errno = EINVAL;
+        return -1;
+    }
+    if (splice_remaining() != 0) {
+        errno = EINPROGRESS;
+        return -1;
+    }
+    SocketUniquePtr dest;
+    if (Socket::Address(dest_id, &dest) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    _splice_dest_id = dest_id;
+    _splice_bytes_left.store(nbytes, butil::memory_order_release);
+    return 0;
+}
+
+int Socket::DoSplice(bool* read_eof) {
+    SocketUniquePtr dest;
+    if (Socket::Address(_splice_dest_id, &dest) != 0) {
+        SetFailed(ECONNRESET, "Splice destination SocketId=%" PRIu64
+                  " of %s is gone", _splice_dest_id, description().c_str());
+        return -1;
+    }
+    uint64_t left = _splice_bytes_left.load(butil::memory_order_relaxed);
+    // Flush bytes that were already cut into the read buffer when the
+    // caller determined the framing, through the regular write path so
+    // that they are not reordered with data queued in the destination.
+    if (!_read_buf.empty()) {
+        const size_t n = std::min<uint64_t>(left, _read_buf.size());
+        butil::IOBuf flushed;
+        _read_buf.cutn(&flushed, n);
+        if (dest->Write(&flushed) != 0) {
+            const int saved_errno = errno;
+            SetFailed(saved_errno, "Fail to flush %lu buffered bytes of %s "
+                      "to %s: %s", (unsigned long)n, description().c_str(),
+                      dest->description().c_str(), berror(saved_errno));
+            return -1;
+        }
+        left = _splice_bytes_left.fetch_sub(n, butil::memory_order_relaxed) - n;
+        if (left == 0) {
+            return 1;
+        }
+    }
+    if (_splice_pipe[0] < 0 &&
+        pipe2(_splice_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        const int saved_errno = errno;
+        SetFailed(saved_errno, "Fail to create splice pipe for %s: %s",
+                  description().c_str(), berror(saved_errno));
+        return -1;
+    }
+    bool use_userspace = false;
+    while (left > 0) {
+        // Splicing directly into the destination fd bypasses its write
+        // queue and is only safe while the queue is empty; fall back to a
+        // regular read+write round otherwise to preserve byte order.
+        if (use_userspace ||
+            dest->_write_head.load(butil::memory_order_acquire) != NULL ||
+            dest->ssl_state() != SSL_OFF) {
+            butil::IOPortal buf;
+            const ssize_t nr = buf.append_from_file_descriptor(
+                fd(), std::min<uint64_t>(left, 512 * 1024UL));
+            if (nr == 0) {
+                break;  // EOF before all bytes arrived
+            }
+            if (nr < 0) {
+                if (errno == EAGAIN) {
+                    return 0;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                const int saved_errno = errno;
+                SetFailed(saved_errno, "Fail to read from %s: %s",
+                          description().c_str(), berror(saved_errno));
+                return -1;
+            }
+            if (dest->Write(&buf) != 0) {
+                const int saved_errno = errno;
+                SetFailed(saved_errno, "Fail to forward %ld bytes of %s "
+                          "to %s: %s", (long)nr, description().c_str(),
+                          dest->description().c_str(), berror(saved_errno));
+                return -1;
+            }
+            left = _splice_bytes_left.fetch_sub(
+                nr, butil::memory_order_relaxed) - nr;
+            continue;
+        }
+        const size_t chunk = std::min<uint64_t>(left, 1024 * 1024UL);
+        const ssize_t in = splice(fd(), NULL, _splice_pipe[1], NULL, chunk,
+                                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == 0) {
+            break;  // EOF before all bytes arrived
+        }
+        if (in < 0) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL) {
+                // The fd pair refuses splicing, move through userspace.
+                use_userspace = true;
+                continue;
+            }
+            const int saved_errno = errno;
+            SetFailed(saved_errno, "Fail to splice from %s: %s",
+                      description().c_str(), berror(saved_errno));
+            return -1;
+        }
+        // Drain the pipe completely so that no bytes are parked in it
+        // when this function returns.
+        size_t in_pipe = in;
+        while (in_pipe > 0) {
+            const ssize_t out = splice(_splice_pipe[0], NULL, dest->fd(),
+                                       NULL, in_pipe,
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (out > 0) {
+                in_pipe -= out;
+                continue;
+            }
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out < 0 && errno == EAGAIN) {
+                // Destination congested: waiting here (instead of
+                // buffering) propagates backpressure to the source's
+                // TCP window.
+                if (dest->Failed()) {
+                    SetFailed(ECONNRESET, "Splice destination %s of %s "
+                              "was SetFailed", dest->description().c_str(),
+                              description().c_str());
+                    return -1;
+                }
+                const timespec duetime = butil::microseconds_to_timespec(
+                    butil::gettimeofday_us() + 100000L/*100ms*/);
+                dest->WaitEpollOut(dest->fd(), false, &duetime);
+                continue;
+            }
+            const int saved_errno = errno;
+            SetFailed(saved_errno, "Fail to splice %lu bytes of %s to %s: %s",
+                      (unsigned long)in_pipe, description().c_str(),
+                      dest->description().c_str(), berror(saved_errno));
+            return -1;
+        }
+        left = _splice_bytes_left.fetch_sub(
+            in, butil::memory_order_relaxed) - in;
+    }
+    if (left > 0) {
+        // EOF before all arranged bytes were forwarded.
+        LOG(WARNING) << *this << " was closed by remote side with "
+                     << left << " splice bytes left";
+        *read_eof = true;
+        _splice_bytes_left.store(0, butil::memory_order_relaxed);
+    }
+    return 1;
+}
+#endif  // OS_LINUX
+
 int Socket::FightAuthentication(int* auth_error) {
     // Use relaxed fence since `bthread_id_trylock' ensures thread safety
     // Here `flag_error' just acts like a cache information
@@ -2236,6 +3273,9 @@ AuthContext* Socket::mutable_auth_context() {
 int Socket::OnInputEvent(void* user_data, uint32_t events,
                          const bthread_attr_t& thread_attr) {
     auto id = reinterpret_cast<SocketId>(user_data);
+    // Get the leading cachelines (versioned ref + read-path section) in
+    // flight before Address() stalls on the first of them.
+    Socket::Prefetch(id);
     SocketUniquePtr s;
     if (Address(id, &s) < 0) {
         return -1;
@@ -2245,6 +3285,13 @@ int Socket::OnInputEvent(void* user_data, uint32_t events,
         // (Added into epoll by `WaitConnected')
         return 0;
     }
+#if defined(OS_LINUX)
+    if (events & EPOLLERR) {
+        // MSG_ZEROCOPY completions arrive on the error queue and are
+        // reported as EPOLLERR, unpin the finished blocks.
+        s->HandleZerocopyCompletions();
+    }
+#endif
     if (s->fd() < 0) {
 #if defined(OS_LINUX)
         CHECK(!(events & EPOLLIN)) << "epoll_events=" << events;
@@ -2273,7 +3320,9 @@ int Socket::OnInputEvent(void* user_data, uint32_t events,
         bthread_attr_t attr = thread_attr;
         attr.keytable_pool = p->_keytable_pool;
         attr.tag = bthread_self_tag();
-        if (FLAGS_usercode_in_coroutine) {
+        if (FLAGS_usercode_in_coroutine || p->_process_event_inline) {
+            // Run-to-completion: parse and process right here in the
+            // dispatcher thread, no cross-core handoff.
             ProcessEvent(p);
 #if BRPC_WITH_RDMA
         } else if (rdma::FLAGS_rdma_edisp_unsched == false) {
@@ -2406,11 +3455,15 @@ void Socket::DebugSocket(std::ostream& os, SocketId id) {
     const int64_t cpuwide_now = butil::cpuwide_time_us();
     os << "\nhc_count=" << ptr->_hc_count
        << "\navg_input_msg_size=" << ptr->_avg_msg_size
+       << "\navg_read_burst_size=" << ptr->_avg_burst_size
         // NOTE: We're assuming that butil::IOBuf.size() is thread-safe, it is now
         // however it's not guaranteed.
        << "\nread_buf=" << ptr->_read_buf.size()
        << "\nlast_read_to_now=" << cpuwide_now - ptr->_last_readtime_us << "us"
        << "\nlast_write_to_now=" << cpuwide_now - ptr->_last_writetime_us << "us"
+       << "\nunwritten_bytes="
+       << ptr->_unwritten_bytes.load(butil::memory_order_relaxed)
+       << "\nkernel_notsent_bytes=" << ptr->GetKernelNotsentBytes()
        << "\novercrowded=" << ptr->_overcrowded;
     os << "\nid_wait_list={";
     for (size_t i = 0; i < nidsize; ++i) {
@@ -2667,7 +3720,8 @@ inline SocketPool::SocketPool(const SocketOptions& opt)
     : _options(opt)
     , _remote_side(opt.remote_side)
     , _numfree(0)
-    , _numinflight(0) {
+    , _numinflight(0)
+    , _min_count(0) {
 }
 
 inline SocketPool::~SocketPool() {
@@ -2678,10 +3732,29 @@ inline SocketPool::~SocketPool() {
             ptr->ReleaseAdditionalReference();
         }
     }
+    for (size_t i = 0; i < CACHE_SLOT_NUM; ++i) {
+        for (std::vector<SocketId>::iterator it = _cache_slots[i].stack.begin();
+             it != _cache_slots[i].stack.end(); ++it) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(*it, &ptr) == 0) {
+                ptr->ReleaseAdditionalReference();
+            }
+        }
+    }
+}
+
+size_t SocketPool::tls_slot_index() {
+    static butil::atomic<size_t> s_next_index(0);
+    static __thread size_t tls_index = (size_t)-1;
+    if (tls_index == (size_t)-1) {
+        tls_index = s_next_index.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return tls_index;
 }
 
 inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
     const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int cache_size = FLAGS_connection_pool_local_cache_size;
 
     // In prev rev, SocketPool could be sharded into multiple SubSocketPools to
     // reduce thread contentions. The sharding key is mixed from pthread-id so
@@ -2696,10 +3769,39 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
     // Thus the sharding is merely a mechanism only meaningful in benchmarking
     // scenarios where one server is connected by one client with many threads.
     // Starting from r32203 the sharding capability is removed.
+    // The per-worker cache slots below differ from the removed sharding:
+    // slots are small(-connection_pool_local_cache_size) and overflow/refill
+    // to the shared _pool in batches, so sockets are still shared among
+    // threads instead of being stranded in a sub pool.
 
     SocketId sid = 0;
     if (connection_pool_size > 0) {
+        if (cache_size > 0) {
+            // Fast path: sockets this worker returned recently. The slot
+            // mutex is only touched by threads mapped to the slot, thus
+            // mostly uncontended.
+            CacheSlot& slot =
+                _cache_slots[tls_slot_index() & (CACHE_SLOT_NUM - 1)];
+            for (;;) {
+                {
+                    BAIDU_SCOPED_LOCK(slot.mutex);
+                    if (slot.stack.empty()) {
+                        break;
+                    }
+                    sid = slot.stack.back();
+                    slot.stack.pop_back();
+                }
+                _numfree.fetch_sub(1, butil::memory_order_relaxed);
+                if (Socket::Address(sid, ptr) == 0) {
+                    _numinflight.fetch_add(1, butil::memory_order_relaxed);
+                    return 0;
+                }
+            }
+        }
+        bool refilled = false;
         for (;;) {
+            SocketId extras[8];
+            size_t nextra = 0;
             {
                 BAIDU_SCOPED_LOCK(_mutex);
                 if (_pool.empty()) {
@@ -2707,6 +3809,25 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
                 }
                 sid = _pool.back();
                 _pool.pop_back();
+                if (cache_size > 0 && !refilled) {
+                    // Refill the worker's slot in the same critical
+                    // section instead of coming back for each miss.
+                    size_t want = (size_t)cache_size / 2;
+                    if (want > arraysize(extras)) {
+                        want = arraysize(extras);
+                    }
+                    while (nextra < want && !_pool.empty()) {
+                        extras[nextra++] = _pool.back();
+                        _pool.pop_back();
+                    }
+                }
+            }
+            if (nextra > 0) {
+                refilled = true;
+                CacheSlot& slot =
+                    _cache_slots[tls_slot_index() & (CACHE_SLOT_NUM - 1)];
+                BAIDU_SCOPED_LOCK(slot.mutex);
+                slot.stack.insert(slot.stack.end(), extras, extras + nextra);
             }
             _numfree.fetch_sub(1, butil::memory_order_relaxed);
             // Not address inside the lock since at most time the pooled socket
@@ -2731,13 +3852,41 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
 inline void SocketPool::ReturnSocket(Socket* sock) {
     // NOTE: save the gflag which may be reloaded at any time.
     const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int cache_size = FLAGS_connection_pool_local_cache_size;
 
     // Check if the pool is full.
     if (_numfree.fetch_add(1, butil::memory_order_relaxed) <
         connection_pool_size) {
         const SocketId sid = sock->id();
-        BAIDU_SCOPED_LOCK(_mutex);
-        _pool.push_back(sid);
+        if (cache_size > 0) {
+            CacheSlot& slot =
+                _cache_slots[tls_slot_index() & (CACHE_SLOT_NUM - 1)];
+            SocketId drained[8];
+            size_t ndrain = 0;
+            {
+                BAIDU_SCOPED_LOCK(slot.mutex);
+                if ((int)slot.stack.size() >= cache_size) {
+                    // Drain half of the slot into the shared pool in one
+                    // batch so other workers may reuse the sockets.
+                    size_t want = slot.stack.size() / 2 + 1;
+                    if (want > arraysize(drained)) {
+                        want = arraysize(drained);
+                    }
+                    while (ndrain < want) {
+                        drained[ndrain++] = slot.stack.back();
+                        slot.stack.pop_back();
+                    }
+                }
+                slot.stack.push_back(sid);
+            }
+            if (ndrain > 0) {
+                BAIDU_SCOPED_LOCK(_mutex);
+                _pool.insert(_pool.end(), drained, drained + ndrain);
+            }
+        } else {
+            BAIDU_SCOPED_LOCK(_mutex);
+            _pool.push_back(sid);
+        }
     } else {
         // Cancel the addition and close the pooled socket.
         _numfree.fetch_sub(1, butil::memory_order_relaxed);
@@ -2768,6 +3917,20 @@ inline void SocketPool::ListSockets(std::vector<SocketId>* out, size_t max_count
         }
     }
     _mutex.unlock();
+    // Sockets cached in per-worker slots are free as well and must be
+    // visible to callers(e.g. idle pruning in socket_map.cpp).
+    for (size_t i = 0; i < CACHE_SLOT_NUM; ++i) {
+        if (max_count > 0 && out->size() >= max_count) {
+            break;
+        }
+        BAIDU_SCOPED_LOCK(_cache_slots[i].mutex);
+        for (size_t j = 0; j < _cache_slots[i].stack.size(); ++j) {
+            if (max_count > 0 && out->size() >= max_count) {
+                break;
+            }
+            out->push_back(_cache_slots[i].stack[j]);
+        }
+    }
 }
 
 Socket::SharedPart* Socket::GetOrNewSharedPartSlower() {
@@ -2864,7 +4027,8 @@ int Socket::ReturnToPool() {
     // Reset the write timestamp to make the returned connection live (longer)
     // This is useful for using a fake Socket + SocketConnection impl. to integrate
     // 3rd-party client into bRPC (like MySQL Client).
-    _last_writetime_us.store(butil::cpuwide_time_us(), butil::memory_order_relaxed);
+    _last_writetime_us.store(butil::coarse_cpuwide_time_us(),
+                             butil::memory_order_relaxed);
     pool->ReturnSocket(this);
     sp->RemoveRefManually();
     return 0;
@@ -2904,6 +4068,30 @@ bool Socket::GetPooledSocketStats(int* numfree, int* numinflight) {
     *numinflight = pool->_numinflight.load(butil::memory_order_relaxed);
     return true;
 }
+
+void Socket::SetMinPooledSocketCount(int count) {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool == NULL) {
+        return;
+    }
+    pool->_min_count.store(count, butil::memory_order_relaxed);
+}
+
+int Socket::GetMinPooledSocketCount() const {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return 0;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool == NULL) {
+        return 0;
+    }
+    return pool->_min_count.load(butil::memory_order_relaxed);
+}
     
 int Socket::GetShortSocket(SocketUniquePtr* short_socket) {
     if (short_socket == NULL) {
@@ -2979,6 +4167,19 @@ void Socket::GetStat(SocketStat* s) const {
     }
 }
 
+int64_t Socket::GetKernelNotsentBytes() const {
+#if defined(OS_LINUX) && defined(SIOCOUTQNSD)
+    const int fd = _fd.load(butil::memory_order_relaxed);
+    int notsent = 0;
+    if (fd < 0 || ioctl(fd, SIOCOUTQNSD, &notsent) != 0) {
+        return -1;
+    }
+    return notsent;
+#else
+    return -1;
+#endif
+}
+
 void Socket::AddInputBytes(size_t bytes) {
     GetOrNewSharedPart()->in_size.fetch_add(bytes, butil::memory_order_relaxed);
 }
@@ -2994,7 +4195,9 @@ void Socket::CancelUnwrittenBytes(size_t bytes) {
 }
 void Socket::AddOutputBytes(size_t bytes) {
     GetOrNewSharedPart()->out_size.fetch_add(bytes, butil::memory_order_relaxed);
-    _last_writetime_us.store(butil::cpuwide_time_us(),
+    // Bookkeeping only, ~100us inaccuracy is fine and the cached read
+    // avoids a clock read per output batch.
+    _last_writetime_us.store(butil::coarse_cpuwide_time_us(),
                              butil::memory_order_relaxed);
     CancelUnwrittenBytes(bytes);
 }
@@ -3028,11 +4231,57 @@ SocketSSLContext::SocketSSLContext()
 {}
 
 SocketSSLContext::~SocketSSLContext() {
+    for (std::map<butil::EndPoint, SSL_SESSION*>::iterator
+             it = _session_map.begin(); it != _session_map.end(); ++it) {
+        SSL_SESSION_free(it->second);
+    }
     if (raw_ctx) {
         SSL_CTX_free(raw_ctx);
     }
 }
 
+SSL_SESSION* SocketSSLContext::GetSessionToResume(const butil::EndPoint& peer) {
+#ifndef USE_MESALINK
+    BAIDU_SCOPED_LOCK(_session_map_mutex);
+    std::map<butil::EndPoint, SSL_SESSION*>::iterator it =
+        _session_map.find(peer);
+    if (it == _session_map.end()) {
+        return NULL;
+    }
+#if (OPENSSL_VERSION_NUMBER >= SSL_VERSION_NUMBER(1, 1, 0)) || \
+    defined(OPENSSL_IS_BORINGSSL)
+    SSL_SESSION_up_ref(it->second);
+#else
+    CRYPTO_add(&it->second->references, 1, CRYPTO_LOCK_SSL_SESSION);
+#endif
+    return it->second;
+#else
+    return NULL;
+#endif
+}
+
+void SocketSSLContext::RememberSession(const butil::EndPoint& peer,
+                                       SSL_SESSION* sess) {
+    SSL_SESSION* old = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_session_map_mutex);
+        SSL_SESSION*& slot = _session_map[peer];
+        old = slot;
+        slot = sess;
+    }
+    if (old) {
+        SSL_SESSION_free(old);
+    }
+}
+
+void Socket::CacheSSLSession(SSL_SESSION* sess) {
+    if (_ssl_ctx) {
+        _ssl_ctx->RememberSession(remote_side(), sess);
+    } else {
+        SSL_SESSION_free(sess);
+    }
+}
+
 } // namespace brpc
 
 
@@ -22,6 +22,7 @@
 #include <iostream>                            // std::ostream
 #include <deque>                               // std::deque
 #include <set>                                 // std::set
+#include <map>                                 // std::map
 #include "butil/atomicops.h"                    // butil::atomic
 #include "bthread/types.h"                      // bthread_id_t
 #include "butil/iobuf.h"                        // butil::IOBuf, IOPortal
@@ -59,8 +60,10 @@ class RdmaConnect;
 
 class Socket;
 class AuthContext;
+class EgressRateLimiter;
 class EventDispatcher;
 class Stream;
+class WebSocketContext;
 
 // A special closure for processing the about-to-recycle socket. Socket does
 // not delete SocketUser, if you want, `delete this' at the end of
@@ -142,8 +145,15 @@ struct SocketVarsCollector {
         , neventthread_second("rpc_event_thread_second", &neventthread)
         , nhealthcheck("rpc_health_check_count")
         , nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite)
+        , nresidentwrite_second("rpc_residentwrite_second", &nresidentwrite)
         , nwaitepollout("rpc_waitepollout_count")
         , nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout)
+        , nnotsentlowat_second("rpc_notsent_lowat_pause_second", &nnotsentlowat)
+        , ncoalescedwrite_second("rpc_coalesced_write_second", &ncoalescedwrite)
+        , ncoalescedmsg_second("rpc_coalesced_write_messages_second",
+                               &ncoalescedmsg)
+        , negressthrottle_second("rpc_egress_throttle_second",
+                                 &negressthrottle)
     {}
 
     bvar::Adder<int64_t> nsocket;
@@ -153,8 +163,23 @@ struct SocketVarsCollector {
     bvar::Adder<int64_t> nhealthcheck;
     bvar::Adder<int64_t> nkeepwrite;
     bvar::PerSecond<bvar::Adder<int64_t> > nkeepwrite_second;
+    // Chains drained by a parked resident writer instead of a fresh
+    // KeepWrite bthread (-socket_resident_writer_min_message_rate).
+    bvar::Adder<int64_t> nresidentwrite;
+    bvar::PerSecond<bvar::Adder<int64_t> > nresidentwrite_second;
     bvar::Adder<int64_t> nwaitepollout;
     bvar::PerSecond<bvar::Adder<int64_t> > nwaitepollout_second;
+    bvar::Adder<int64_t> nnotsentlowat;
+    bvar::PerSecond<bvar::Adder<int64_t> > nnotsentlowat_second;
+    // messages/writes is the batching factor achieved by
+    // -socket_write_coalesce_us.
+    bvar::Adder<int64_t> ncoalescedwrite;
+    bvar::PerSecond<bvar::Adder<int64_t> > ncoalescedwrite_second;
+    bvar::Adder<int64_t> ncoalescedmsg;
+    bvar::PerSecond<bvar::Adder<int64_t> > ncoalescedmsg_second;
+    // Times a write bthread slept to respect an EgressRateLimiter.
+    bvar::Adder<int64_t> negressthrottle;
+    bvar::PerSecond<bvar::Adder<int64_t> > negressthrottle_second;
 };
 
 struct PipelinedInfo {
@@ -229,9 +254,25 @@ struct SocketSSLContext {
     SocketSSLContext();
     ~SocketSSLContext();
 
+    // Get the last session negotiated with `peer' for resumption(session
+    // tickets in TLS1.2, PSK in TLS1.3), surviving recreations of Sockets
+    // to the same endpoint. Returns NULL when absent, otherwise a reference
+    // owned by the caller(freed with SSL_SESSION_free).
+    SSL_SESSION* GetSessionToResume(const butil::EndPoint& peer);
+    // Remember `sess' as the latest reusable session of `peer', taking
+    // ownership of one reference. Called by the new-session callback
+    // installed in CreateClientSSLContext.
+    void RememberSession(const butil::EndPoint& peer, SSL_SESSION* sess);
+
     SSL_CTX* raw_ctx;                        // owned
     std::string sni_name;                    // useful for clients
     std::vector<std::string> alpn_protocols; // useful for clients
+
+private:
+    butil::Mutex _session_map_mutex;
+    // Owned references, keyed like SocketMap entries by the remote endpoint
+    // so that reconnections resume instead of paying full handshakes.
+    std::map<butil::EndPoint, SSL_SESSION*> _session_map;
 };
 
 struct SocketKeepaliveOptions {
@@ -266,10 +307,19 @@ struct SocketOptions {
     // until new data arrives. The callback will not be called from more than
     // one thread at any time.
     void (*on_edge_triggered_events)(Socket*){NULL};
+    // Run `on_edge_triggered_events' in the thread noticing the event(i.e.
+    // the event dispatcher) instead of starting a bthread, so that
+    // parse->process->respond of a request stays on the dispatcher's core.
+    // Only for sockets whose processing never blocks, see
+    // ServerOptions.run_to_completion.
+    bool process_event_inline{false};
     int health_check_interval_s{-1};
     // Only accept ssl connection.
     bool force_ssl{false};
     std::shared_ptr<SocketSSLContext> initial_ssl_ctx;
+    // Shape bytes written into this socket, possibly shared with other
+    // sockets of the same server/channel/group. See egress_rate_limiter.h
+    std::shared_ptr<EgressRateLimiter> egress_limiter;
     bool use_rdma{false};
     bthread_keytable_pool_t* keytable_pool{NULL};
     SocketConnection* conn{NULL};
@@ -367,6 +417,18 @@ public:
         // Default: false
         bool ignore_eovercrowded;
 
+        // Hold the write for so many microseconds so that writes issued
+        // meanwhile(e.g. other calls of the same Channel) are flushed with
+        // one write. Like -socket_write_coalesce_us but opted in per write,
+        // regardless of the message rate of this socket.
+        // Default: 0 (follow the global coalescing policy)
+        int32_t micro_batch_window_us;
+
+        // [Only effective when micro_batch_window_us is positive]
+        // Flush before the window expires once so many writes are queued.
+        // Default: 0 (never flush early)
+        int32_t micro_batch_max_count;
+
         // The calling thread directly creates KeepWrite thread to write into
         // this socket, skipping writing once.
         // In situations like when you are continually issuing lots of
@@ -389,6 +451,8 @@ public:
             , pipelined_count(0)
             , auth_flags(0)
             , ignore_eovercrowded(false)
+            , micro_batch_window_us(0)
+            , micro_batch_max_count(0)
             , write_in_background(false)
             , shutdown_write(false) {}
     };
@@ -402,6 +466,19 @@ public:
     // successful and *may* remain unchanged otherwise.
     int Write(SocketMessagePtr<>& msg, const WriteOptions* options = NULL);
 
+    // Write `n' messages in `msgs' into this Socket and clear them. Each
+    // message should be an intact request or response; they are written in
+    // order without other writes interleaving in between. Comparing to
+    // calling Write() per message, the whole batch is appended to the
+    // internal write queue with one atomic exchange and adjacent messages
+    // are combined into as few writev() as possible, which matters when
+    // fanning one message out to many sockets. Empty messages are skipped.
+    // `options->id_wait'(with notify_on_success/shutdown_write) acts on
+    // the last message. `options->pipelined_count' must be 0 since one
+    // id_wait cannot correspond with multiple responses.
+    int WriteBatch(butil::IOBuf* msgs, size_t n,
+                   const WriteOptions* options = NULL);
+
     // The file descriptor
     int fd() const { return _fd.load(butil::memory_order_relaxed); }
 
@@ -478,6 +555,16 @@ public:
 
     int64_t recent_error_count() const;
 
+    // Record a successful in-band response on this socket(or on the main
+    // socket when this is a pooled connection). Health checking treats it
+    // as passive evidence that the server is reachable, see
+    // -passive_health_check in details/health_check.cpp.
+    void RecordInbandSuccess();
+
+    // Time(cpuwide, in us) of the last successful in-band response, 0 if
+    // none was recorded.
+    int64_t last_inband_success_time_us() const;
+
     int isolated_times() const;
 
     void FeedbackCircuitBreaker(int error_code, int64_t latency_us);
@@ -499,6 +586,24 @@ public:
     // Check Whether the socket is available for user requests.
     bool IsAvailable() const;
 
+#if defined(OS_LINUX)
+    // Forward the next `nbytes' arriving on this socket directly into the
+    // socket of `dest_id' with splice(2) through an internal pipe, so that
+    // body bytes never enter userspace. Bytes already cut into the read
+    // buffer (beyond what the caller parsed) are flushed to the
+    // destination through its regular write path first. After `nbytes'
+    // have been forwarded the fd returns to normal parsing.
+    // Must be called from the callback processing the message that
+    // determined the framing, before the read loop resumes, and this
+    // socket must not use SSL or RDMA.
+    // Returns 0 on success, -1 otherwise and errno is set.
+    int StartSpliceTo(SocketId dest_id, uint64_t nbytes);
+
+    // Remaining bytes to be spliced, 0 when not in splice mode.
+    uint64_t splice_remaining() const
+    { return _splice_bytes_left.load(butil::memory_order_acquire); }
+#endif
+
     // Start to process edge-triggered events from the fd.
     // This function does not block caller.
     static int OnInputEvent(void* user_data, uint32_t events,
@@ -549,6 +654,10 @@ public:
     // fields will be zero.
     void GetStat(SocketStat* out) const;
 
+    // Bytes queued in the kernel send buffer but not yet sent to the wire.
+    // Returns -1 when unknown(no fd, failed ioctl or non-Linux systems).
+    int64_t GetKernelNotsentBytes() const;
+
     // Call this when you receive an EOF event. `SetFailed' will be
     // called at last if EOF event is no longer postponed
     void SetEOF();
@@ -560,6 +669,12 @@ public:
     bool is_ssl() const { return ssl_state() == SSL_CONNECTED; }
     X509* GetPeerCertificate() const;
 
+    // Remember `sess' for resuming later handshakes to remote_side().
+    // Takes ownership of one reference. Called by the new-session callback
+    // of client SSL_CTXs, notably for TLS1.3 whose tickets arrive after
+    // the handshake.
+    void CacheSSLSession(SSL_SESSION* sess);
+
     // Print debugging inforamtion of `id' into the ostream.
     static void DebugSocket(std::ostream&, SocketId id);
 
@@ -586,6 +701,23 @@ public:
     // Return true on success
     bool GetPooledSocketStats(int* numfree, int* numinflight);
 
+    // [Warm-up] Establish the connection (including SSL handshake) right
+    // now instead of inside the first Write, blocking the calling thread
+    // until connected or `abstime'. No-op when already connected.
+    // NOTE: Do not call this on a socket with concurrent writes; it's
+    // intended for pre-establishing connections before issuing traffic.
+    // Returns 0 on success, -1 otherwise.
+    int Warmup(const timespec* abstime);
+
+    // [Warm-up] Keep at least `count' pooled sockets of this (main)
+    // socket away from idle pruning in SocketMap, which also
+    // re-establishes pooled sockets when the pool falls below `count'.
+    // Effective after the SocketPool was created (e.g. by Warmup of the
+    // Channel or a first pooled RPC).
+    void SetMinPooledSocketCount(int count);
+    // Returns 0 when unset or the SocketPool does not exist.
+    int GetMinPooledSocketCount() const;
+
     // Create a socket connecting to the same place as this socket.
     int GetShortSocket(SocketUniquePtr* short_socket);
 
@@ -648,6 +780,13 @@ public:
     void set_http_request_method(const HttpMethod& method) { _http_request_method = method; }
     HttpMethod http_request_method() const { return _http_request_method; }
 
+    // Take ownership of `ctx' and treat further input of this connection
+    // as WebSocket frames, see websocket.h. The previous context (if any)
+    // is destroyed; pass NULL to just destroy it.
+    void ResetWebSocketContext(WebSocketContext* ctx);
+    WebSocketContext* websocket_context() const
+    { return _websocket_context.load(butil::memory_order_acquire); }
+
 private:
     DISALLOW_COPY_AND_ASSIGN(Socket);
 
@@ -660,6 +799,18 @@ private:
 
     int ConductError(bthread_id_t);
     int StartWrite(WriteRequest*, const WriteOptions&);
+    // True when this connection writes messages fast enough for flush
+    // coalescing to pay off, see -socket_write_coalesce_us.
+    bool ShouldCoalesceWrites() const;
+    // Sleep up to opt.micro_batch_window_us before flushing `head', so
+    // that writes issued meanwhile share the flush. Returns early once
+    // opt.micro_batch_max_count writes are queued.
+    void WaitForMicroBatch(WriteRequest* head, const WriteOptions& opt);
+    // Start writing a pre-linked chain of WriteRequests built by
+    // WriteBatch(). `newest' is the head pushed into _write_head, `oldest'
+    // maps to the first message and ends the chain.
+    int StartBatchWrite(WriteRequest* newest, WriteRequest* oldest,
+                        const WriteOptions&);
 
     // Create a Socket according to `options', put the identifier into `id'.
     // Returns 0 on success, -1 otherwise.
@@ -694,11 +845,42 @@ private:
     // bytes on success, 0 on EOF, -1 otherwise and errno is set
     ssize_t DoRead(size_t size_hint);
 
+    // Move this socket to the event dispatcher matching its current RX
+    // cpu, rate-limited and only effective when
+    // -event_dispatcher_rx_affinity is on. Called by InputMessenger after
+    // draining the fd.
+    void RehomeEventDispatcher();
+
+#if defined(OS_LINUX)
+    // Move up to the remaining splice bytes from the fd into the
+    // destination socket, called by InputMessenger's read loop while
+    // splice mode is on. Returns 1 when progress was made or the mode
+    // ended, 0 when the source fd has no data (wait for the next read
+    // event), -1 when this socket was SetFailed().
+    int DoSplice(bool* read_eof);
+#endif
+
     // Based upon whether the underlying channel is using SSL, write
     // `req' using the corresponding method. Returns written bytes on
     // success, -1 otherwise and errno is set
     ssize_t DoWrite(WriteRequest* req);
 
+#if defined(OS_LINUX)
+    // True if the batch should be written with MSG_ZEROCOPY. Sets
+    // SO_ZEROCOPY on the fd at the first call.
+    bool UseZerocopy(butil::IOBuf* const* data_list, size_t ndata);
+
+    // Write the batched IOBufs with MSG_ZEROCOPY. Blocks of the written
+    // bytes are pinned in `_zc_pinned' (keeping their refcounts) until
+    // the kernel reports completion on the error queue. Returns written
+    // bytes on success, -1 otherwise and errno is set.
+    ssize_t ZerocopyWrite(butil::IOBuf* const* data_list, size_t ndata);
+
+    // Drain SO_EE_ORIGIN_ZEROCOPY notifications from the error queue
+    // and unpin blocks of completed sends. Called on EPOLLERR.
+    void HandleZerocopyCompletions();
+#endif
+
     // [Not thread-safe] Wait for EPOLLOUT event on `fd'. If `pollin' is
     // true, EPOLLIN event will also be included and EPOLL_CTL_MOD will
     // be used instead of EPOLL_CTL_ADD. Note that spurious wakeups may
@@ -711,11 +893,16 @@ private:
     // until connected/timeout. Otherwise, it returns immediately after
     // starting a connection request and `on_connect' will be called
     // when connecting completes (whether it succeeds or not)
+    // If `first_write' is not NULL and -client_tcp_fastopen is on, its
+    // (already-serialized) data may be carried in the SYN via TCP Fast
+    // Open, saving one RTT before the first protocol bytes.
     // Returns the socket fd on success, -1 otherwise
     int DoConnect(const timespec* abstime,
-                  int (*on_connect)(int fd, int err, void* data), void* data);
+                  int (*on_connect)(int fd, int err, void* data), void* data,
+                  WriteRequest* first_write = NULL);
     int Connect(const timespec* abstime,
-                int (*on_connect)(int fd, int err, void* data), void* data);
+                int (*on_connect)(int fd, int err, void* data), void* data,
+                WriteRequest* first_write = NULL);
 
     int CheckConnected(int sockfd);
 
@@ -737,6 +924,22 @@ private:
 
     static void* KeepWrite(void*);
 
+    // Drain the chain headed by `req'. Extracted from KeepWrite so that a
+    // resident writer can drain successive chains without restarting.
+    void DoKeepWrite(WriteRequest* req);
+
+    // Park as the resident writer and wait for the next handed-off chain.
+    // Returns NULL when retiring: idle timeout, socket failure or message
+    // rate below -socket_resident_writer_min_message_rate.
+    WriteRequest* WaitAsResidentWriter();
+
+    // Continue `req' in background: hand it to the parked resident writer
+    // if any, otherwise start a KeepWrite bthread. Ownership of the socket
+    // reference inside `req' is transferred.
+    void StartKeepWrite(WriteRequest* req);
+
+    bool ShouldKeepWriterResident() const;
+
     bool IsWriteComplete(WriteRequest* old_head, bool singular_node,
                          WriteRequest** new_tail);
 
@@ -838,6 +1041,9 @@ private:
     // carefully before implementing the callback.
     void (*_on_edge_triggered_events)(Socket*);
 
+    // Initialized by SocketOptions.process_event_inline
+    bool _process_event_inline;
+
     // A set of callbacks to monitor important events of this socket.
     // Initialized by SocketOptions.user
     SocketUser* _user;
@@ -859,10 +1065,17 @@ private:
     // socket is revived. Only set in HealthCheckTask::OnTriggeringTask()
     int _hc_count;
 
+    // ---- Read path ----
+    // Kept together and close to the head of the object so that an input
+    // event touches as few cachelines as possible.
     // Size of current incomplete message, set to 0 on complete.
     uint32_t _last_msg_size;
     // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
     uint32_t _avg_msg_size;
+    // Average bytes received per read burst (wakeup to EAGAIN) of last
+    // #BURST_SIZE_WINDOW bursts, sizes the first read of the next burst.
+    // Only accessed by the single reading bthread of this socket.
+    uint32_t _avg_burst_size;
 
     // Storing data read from `_fd' but cut-off yet.
     butil::IOPortal _read_buf;
@@ -878,6 +1091,20 @@ private:
     // connection simultaneously.
     uint64_t _correlation_id;
 
+    // +-1 bit-+---31 bit---+
+    // |  flag |   counter  |
+    // +-------+------------+
+    // 1-bit flag to ensure `SetEOF' to be called only once
+    // 31-bit counter of requests that are currently being processed
+    // Updated per message, kept in the read-path section.
+    butil::atomic<uint32_t> _ninprocess;
+
+#if defined(OS_LINUX)
+    // Remaining bytes to forward kernel-side into `_splice_dest_id',
+    // 0 = normal parsing. See StartSpliceTo().
+    butil::atomic<uint64_t> _splice_bytes_left;
+#endif
+
     // Non-zero when health-checking is on.
     int _health_check_interval_s;
 
@@ -890,13 +1117,6 @@ private:
     // true, if health checking is started.
     butil::atomic<bool> _hc_started;
 
-    // +-1 bit-+---31 bit---+
-    // |  flag |   counter  |
-    // +-------+------------+
-    // 1-bit flag to ensure `SetEOF' to be called only once
-    // 31-bit counter of requests that are currently being processed
-    butil::atomic<uint32_t> _ninprocess;
-
     // +---32 bit---+---32 bit---+
     // |  auth flag | auth error |
     // +------------+------------+
@@ -920,6 +1140,9 @@ private:
     SSL* _ssl_session;               // owner
     std::shared_ptr<SocketSSLContext> _ssl_ctx;
 
+    // Token bucket shaping writes, possibly shared with other sockets.
+    std::shared_ptr<EgressRateLimiter> _egress_limiter;
+
     // The RdmaEndpoint
     rdma::RdmaEndpoint* _rdma_ep;
     // Should use RDMA or not
@@ -929,9 +1152,6 @@ private:
     ConnectionType _connection_type_for_progressive_read;
     butil::atomic<bool> _controller_released_socket;
 
-    // True if the socket is too full to write.
-    volatile bool _overcrowded;
-
     bool _fail_me_at_server_stop;
 
     // Set by SetLogOff
@@ -952,19 +1172,60 @@ private:
     pthread_mutex_t _id_wait_list_mutex;
     bthread_id_list_t _id_wait_list;
 
-    // Set with cpuwide_time_us() at last write operation
-    butil::atomic<int64_t> _last_writetime_us;
+    // ---- Write path ----
+    // Starts on its own cacheline so that the CAS-contended write queue
+    // does not false-share with the wait-list mutex above or with the
+    // read-path timestamps.
+    // Storing data that are not flushed into `fd' yet.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<WriteRequest*> _write_head;
     // Queued but written
     butil::atomic<int64_t> _unwritten_bytes;
+    // Set with cpuwide_time_us() at last write operation
+    butil::atomic<int64_t> _last_writetime_us;
 
     // Butex to wait for EPOLLOUT event
     butil::atomic<int>* _epollout_butex;
 
-    // Storing data that are not flushed into `fd' yet.
-    butil::atomic<WriteRequest*> _write_head;
+    // [Resident writer] See -socket_resident_writer_min_message_rate. At
+    // most one KeepWrite bthread parks on _writer_butex between chains;
+    // producers hand the next chain over through _writer_req after
+    // claiming WRITER_PARKED.
+    enum WriterState {
+        WRITER_NONE = 0,    // no resident writer
+        WRITER_PARKED = 1,  // resident writer waits for a handoff
+        WRITER_BUSY = 2,    // resident writer drains a handed-off chain
+    };
+    butil::atomic<int> _writer_state;
+    butil::atomic<WriteRequest*> _writer_req;
+    butil::atomic<int>* _writer_butex;
 
     bool _is_write_shutdown;
 
+    // True if the socket is too full to write.
+    volatile bool _overcrowded;
+
+#if defined(OS_LINUX)
+    enum ZerocopyState {
+        ZEROCOPY_UNKNOWN = 0,  // SO_ZEROCOPY not tried on the fd yet
+        ZEROCOPY_ON = 1,
+        ZEROCOPY_OFF = 2,
+    };
+    int8_t _zc_state;
+    // Sequence number of the first IOBuf in `_zc_pinned', matching the
+    // per-send counter maintained by the kernel for SO_EE_ORIGIN_ZEROCOPY
+    // notifications.
+    uint32_t _zc_base_seq;
+    butil::Mutex _zc_mutex;
+    // Blocks written with MSG_ZEROCOPY but not yet completed by kernel,
+    // one IOBuf per zerocopy sendmsg, in sequence order.
+    std::deque<butil::IOBuf>* _zc_pinned;
+
+    // Destination socket and pipe of splice mode, see StartSpliceTo().
+    // The pipe is created lazily and kept for the connection's lifetime.
+    SocketId _splice_dest_id;
+    int _splice_pipe[2];
+#endif
+
     butil::Mutex _stream_mutex;
     std::set<StreamId> *_stream_set;
     butil::atomic<int64_t> _total_streams_unconsumed_size;
@@ -986,6 +1247,9 @@ private:
     int _tcp_user_timeout_ms;
 
     HttpMethod _http_request_method;
+    // Set once the connection was upgraded to WebSocket, owned by this
+    // socket and destroyed at recycling just like _parsing_context.
+    butil::atomic<WebSocketContext*> _websocket_context;
     HealthCheckOption _hc_option;
 };
 
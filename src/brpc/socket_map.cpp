@@ -17,6 +17,7 @@
 
 
 #include <gflags/gflags.h>
+#include <algorithm>
 #include <map>
 #include "bthread/bthread.h"
 #include "butil/time.h"
@@ -53,6 +54,17 @@ BRPC_VALIDATE_GFLAG(show_socketmap_in_vars, PassValidate);
 DEFINE_bool(reserve_one_idle_socket, false,
             "Reserve one idle socket for pooled connections when idle_timeout_second > 0");
 
+DEFINE_int32(warmup_connect_timeout_ms, 500,
+             "Timeout of establishing one replacement connection for "
+             "connection pools warmed up by Channel::Warmup()");
+BRPC_VALIDATE_GFLAG(warmup_connect_timeout_ms, PositiveInteger);
+
+DEFINE_int32(socket_map_num_shards, 8,
+             "Number of sub maps that the client-side SocketMap is sharded "
+             "into. Each shard has its own mutex and scanning bthread so "
+             "that contention and periodic scan cost scale with cores.");
+BRPC_VALIDATE_GFLAG(socket_map_num_shards, PositiveInteger);
+
 static pthread_once_t g_socket_map_init = PTHREAD_ONCE_INIT;
 static butil::static_atomic<SocketMap*> g_socket_map = BUTIL_STATIC_ATOMIC_INIT(NULL);
 
@@ -69,6 +81,7 @@ static void CreateClientSideSocketMap() {
     SocketMap* socket_map = new SocketMap;
     SocketMapOptions options;
     options.socket_creator = new GlobalSocketCreator;
+    options.num_shards = FLAGS_socket_map_num_shards;
     options.idle_timeout_second_dynamic = &FLAGS_idle_timeout_second;
     options.defer_close_second_dynamic = &FLAGS_defer_close_second;
     if (socket_map->Init(options) != 0) {
@@ -92,9 +105,11 @@ SocketMap* get_or_new_client_side_socket_map() {
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool use_rdma,
-                    const HealthCheckOption& hc_option) {
-    return get_or_new_client_side_socket_map()->Insert(key, id, ssl_ctx, use_rdma, hc_option);
-}    
+                    const HealthCheckOption& hc_option,
+                    const std::shared_ptr<EgressRateLimiter>& egress_limiter) {
+    return get_or_new_client_side_socket_map()->Insert(
+        key, id, ssl_ctx, use_rdma, hc_option, egress_limiter);
+}
 
 int SocketMapFind(const SocketMapKey& key, SocketId* id) {
     SocketMap* m = get_client_side_socket_map();
@@ -129,6 +144,7 @@ void SocketMapList(std::vector<SocketId>* ids) {
 SocketMapOptions::SocketMapOptions()
     : socket_creator(NULL)
     , suggested_map_size(1024)
+    , num_shards(1)
     , idle_timeout_second_dynamic(NULL)
     , idle_timeout_second(0)
     , defer_close_second_dynamic(NULL)
@@ -136,21 +152,28 @@ SocketMapOptions::SocketMapOptions()
 }
 
 SocketMap::SocketMap()
-    : _exposed_in_bvar(false)
-    , _this_map_bvar(NULL)
-    , _has_close_idle_thread(false) {
+    : _shards(NULL)
+    , _nshard(0)
+    , _exposed_in_bvar(false)
+    , _this_map_bvar(NULL) {
 }
 
 SocketMap::~SocketMap() {
     RPC_VLOG << "Destroying SocketMap=" << this;
-    if (_has_close_idle_thread) {
-        bthread_stop(_close_idle_thread);
-        bthread_join(_close_idle_thread, NULL);
+    for (size_t i = 0; i < _nshard; ++i) {
+        if (_shards[i].has_close_idle_thread) {
+            bthread_stop(_shards[i].close_idle_thread);
+            bthread_join(_shards[i].close_idle_thread, NULL);
+        }
     }
-    if (!_map.empty()) {
+    for (size_t i = 0; i < _nshard; ++i) {
+        Map& map = _shards[i].map;
+        if (map.empty()) {
+            continue;
+        }
         std::ostringstream err;
         int nleft = 0;
-        for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
+        for (Map::iterator it = map.begin(); it != map.end(); ++it) {
             SingleConnection* sc = &it->second;
             if ((!sc->socket->Failed() ||
                  sc->socket->HCEnabled()) &&
@@ -166,6 +189,8 @@ SocketMap::~SocketMap() {
             LOG(ERROR) << err.str();
         }
     }
+    delete [] _shards;
+    _shards = NULL;
 
     delete _this_map_bvar;
     _this_map_bvar = NULL;
@@ -184,18 +209,30 @@ int SocketMap::Init(const SocketMapOptions& options) {
         LOG(ERROR) << "SocketOptions.socket_creator must be set";
         return -1;
     }
-    if (_map.init(_options.suggested_map_size, 70) != 0) {
-        LOG(ERROR) << "Fail to init _map";
+    _nshard = std::max<size_t>(_options.num_shards, 1);
+    _shards = new (std::nothrow) Shard[_nshard];
+    if (NULL == _shards) {
+        LOG(ERROR) << "Fail to new _shards";
         return -1;
     }
-    if (_options.idle_timeout_second_dynamic != NULL ||
-        _options.idle_timeout_second > 0) {
-        if (bthread_start_background(&_close_idle_thread, NULL,
-                                     RunWatchConnections, this) != 0) {
-            LOG(FATAL) << "Fail to start bthread";
+    const size_t shard_map_size =
+        std::max<size_t>(_options.suggested_map_size / _nshard, 32);
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard& shard = _shards[i];
+        shard.owner = this;
+        if (shard.map.init(shard_map_size, 70) != 0) {
+            LOG(ERROR) << "Fail to init _shards[" << i << "].map";
             return -1;
         }
-        _has_close_idle_thread = true;
+        if (_options.idle_timeout_second_dynamic != NULL ||
+            _options.idle_timeout_second > 0) {
+            if (bthread_start_background(&shard.close_idle_thread, NULL,
+                                         RunWatchConnections, &shard) != 0) {
+                LOG(FATAL) << "Fail to start bthread";
+                return -1;
+            }
+            shard.has_close_idle_thread = true;
+        }
     }
     return 0;
 }
@@ -203,9 +240,9 @@ int SocketMap::Init(const SocketMapOptions& options) {
 void SocketMap::Print(std::ostream& os) {
     // TODO: Elaborate.
     size_t count = 0;
-    {
-        std::unique_lock<butil::Mutex> mu(_mutex);
-        count = _map.size();
+    for (size_t i = 0; i < _nshard; ++i) {
+        std::unique_lock<butil::Mutex> mu(_shards[i].mutex);
+        count += _shards[i].map.size();
     }
     os << "count=" << count;
 }
@@ -227,11 +264,13 @@ void SocketMap::ShowSocketMapInBvarIfNeed() {
 int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
                       const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                       bool use_rdma,
-                      const HealthCheckOption& hc_option) {
+                      const HealthCheckOption& hc_option,
+                      const std::shared_ptr<EgressRateLimiter>& egress_limiter) {
     ShowSocketMapInBvarIfNeed();
 
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = ShardOfKey(key);
+    std::unique_lock<butil::Mutex> mu(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         if (!sc->socket->Failed() || sc->socket->HCEnabled()) {
             ++sc->ref_count;
@@ -240,18 +279,22 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
         }
         // A socket w/o HC is failed (permanently), replace it.
         ReleaseReference(sc->socket);
-        _map.erase(key); // in principle, we can override the entry in map w/o
+        shard.map.erase(key); // in principle, we can override the entry in map w/o
         // removing and inserting it again. But this would make error branches
         // below have to remove the entry before returning, which is
         // error-prone. We prefer code maintainability here.
         sc = NULL;
     }
+    // Create the socket outside the lock, otherwise creations of distinct
+    // keys inside the shard are serialized behind each other.
+    mu.unlock();
     SocketId tmp_id;
     SocketOptions opt;
     opt.remote_side = key.peer.addr;
     opt.initial_ssl_ctx = ssl_ctx;
     opt.use_rdma = use_rdma;
     opt.hc_option = hc_option;
+    opt.egress_limiter = egress_limiter;
     if (_options.socket_creator->CreateSocket(opt, &tmp_id) != 0) {
         PLOG(FATAL) << "Fail to create socket to " << key.peer;
         return -1;
@@ -271,8 +314,25 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
     // If health check is enabled, a health-checking-related reference
     // is hold in Socket::Create.
     // If health check is disabled, hold a reference in SocketMap.
-    SingleConnection new_sc = { 1, ptr->HCEnabled() ? ptr.get() : ptr.release(), 0 };
-    _map[key] = new_sc;
+    Socket* const new_socket = ptr->HCEnabled() ? ptr.get() : ptr.release();
+    mu.lock();
+    sc = shard.map.seek(key);
+    if (sc != NULL) {
+        if (!sc->socket->Failed() || sc->socket->HCEnabled()) {
+            // Another thread inserted a usable socket for the key during our
+            // creation, share it and discard ours like an entry's removal.
+            ++sc->ref_count;
+            *id = sc->socket->id();
+            mu.unlock();
+            new_socket->ReleaseAdditionalReference();
+            ReleaseReference(new_socket);
+            return 0;
+        }
+        ReleaseReference(sc->socket);
+        shard.map.erase(key);
+    }
+    SingleConnection new_sc = { 1, new_socket, 0 };
+    shard.map[key] = new_sc;
     *id = tmp_id;
     mu.unlock();
     return 0;
@@ -287,8 +347,9 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
                                bool remove_orphan) {
     ShowSocketMapInBvarIfNeed();
 
-    std::unique_lock<butil::Mutex> mu(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = ShardOfKey(key);
+    std::unique_lock<butil::Mutex> mu(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (!sc) {
         return;
     }
@@ -306,7 +367,7 @@ void SocketMap::RemoveInternal(const SocketMapKey& key,
             sc->no_ref_us = butil::cpuwide_time_us();
         } else {
             Socket* const s = sc->socket;
-            _map.erase(key);
+            shard.map.erase(key);
             mu.unlock();
             s->ReleaseAdditionalReference(); // release extra ref
             ReleaseReference(s);
@@ -324,8 +385,9 @@ void SocketMap::ReleaseReference(Socket* s) {
 }
 
 int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
-    BAIDU_SCOPED_LOCK(_mutex);
-    SingleConnection* sc = _map.seek(key);
+    Shard& shard = ShardOfKey(key);
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    SingleConnection* sc = shard.map.seek(key);
     if (sc) {
         *id = sc->socket->id();
         return 0;
@@ -335,25 +397,42 @@ int SocketMap::Find(const SocketMapKey& key, SocketId* id) {
 
 void SocketMap::List(std::vector<SocketId>* ids) {
     ids->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard& shard = _shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        for (Map::iterator it = shard.map.begin();
+             it != shard.map.end(); ++it) {
+            ids->push_back(it->second.socket->id());
+        }
+    }
+}
+
+void SocketMap::List(Shard& shard, std::vector<SocketId>* ids) {
+    ids->clear();
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    for (Map::iterator it = shard.map.begin(); it != shard.map.end(); ++it) {
         ids->push_back(it->second.socket->id());
     }
 }
 
 void SocketMap::List(std::vector<butil::EndPoint>* pts) {
     pts->clear();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
-        pts->push_back(it->second.socket->remote_side());
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard& shard = _shards[i];
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        for (Map::iterator it = shard.map.begin();
+             it != shard.map.end(); ++it) {
+            pts->push_back(it->second.socket->remote_side());
+        }
     }
 }
 
-void SocketMap::ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out) {
+void SocketMap::ListOrphans(Shard& shard, int64_t defer_us,
+                            std::vector<SocketMapKey>* out) {
     out->clear();
     const int64_t now = butil::cpuwide_time_us();
-    BAIDU_SCOPED_LOCK(_mutex);
-    for (Map::iterator it = _map.begin(); it != _map.end(); ++it) {
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    for (Map::iterator it = shard.map.begin(); it != shard.map.end(); ++it) {
         SingleConnection& sc = it->second;
         if (sc.ref_count == 0 && now - sc.no_ref_us >= defer_us) {
             out->push_back(it->first);
@@ -361,12 +440,49 @@ void SocketMap::ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out) {
     }
 }
 
+// Re-establish pooled connections of `main_socket' in the background
+// until the pool holds the floor set by Channel::Warmup() again, so that
+// pruned or failed connections don't leave the pool cold.
+static void ReplenishPooledSockets(Socket* main_socket) {
+    const int min_count = main_socket->GetMinPooledSocketCount();
+    if (min_count <= 0) {
+        return;
+    }
+    int numfree = 0;
+    int numinflight = 0;
+    if (!main_socket->GetPooledSocketStats(&numfree, &numinflight) ||
+        numfree + numinflight >= min_count) {
+        return;
+    }
+    // Take sockets out of the pool (idle ones first, newly-created ones
+    // once it's empty), connect the fresh ones and give all of them back.
+    std::vector<SocketUniquePtr> pooled_socks;
+    const int target = min_count - numinflight;
+    for (int i = 0; i < target; ++i) {
+        SocketUniquePtr ptr;
+        if (main_socket->GetPooledSocket(&ptr) != 0) {
+            break;
+        }
+        const timespec duetime =
+            butil::milliseconds_from_now(FLAGS_warmup_connect_timeout_ms);
+        if (ptr->Warmup(&duetime) != 0) {
+            ptr->SetFailed(ENOTCONN, "Fail to replace pooled connection");
+            break;
+        }
+        pooled_socks.push_back(std::move(ptr));
+    }
+    for (size_t i = 0; i < pooled_socks.size(); ++i) {
+        pooled_socks[i]->ReturnToPool();
+    }
+}
+
 void* SocketMap::RunWatchConnections(void* arg) {
-    static_cast<SocketMap*>(arg)->WatchConnections();
+    Shard* shard = static_cast<Shard*>(arg);
+    shard->owner->WatchConnections(*shard);
     return NULL;
 }
 
-void SocketMap::WatchConnections() {
+void SocketMap::WatchConnections(Shard& shard) {
     std::vector<SocketId> main_sockets;
     std::vector<SocketId> pooled_sockets;
     std::vector<SocketMapKey> orphan_sockets;
@@ -377,19 +493,27 @@ void SocketMap::WatchConnections() {
             *_options.idle_timeout_second_dynamic
             : _options.idle_timeout_second;
         if (idle_seconds > 0) {
-            // Check idle pooled connections
-            List(&main_sockets);
+            // Check idle pooled connections of this shard
+            List(shard, &main_sockets);
             for (auto main_socket : main_sockets) {
                 SocketUniquePtr s;
                 if (Socket::Address(main_socket, &s) == 0) {
+                    // Pooled sockets below the floor set by
+                    // Channel::Warmup() are never pruned.
+                    size_t reserved = FLAGS_reserve_one_idle_socket ? 1 : 0;
+                    const int min_count = s->GetMinPooledSocketCount();
+                    if (min_count > 0 && (size_t)min_count > reserved) {
+                        reserved = min_count;
+                    }
                     s->ListPooledSockets(&pooled_sockets);
-                    for (size_t i = FLAGS_reserve_one_idle_socket ? 1 : 0;
+                    for (size_t i = reserved;
                          i < pooled_sockets.size(); ++i) {
                         SocketUniquePtr s2;
                         if (Socket::Address(pooled_sockets[i], &s2) == 0) {
                             s2->ReleaseReferenceIfIdle(idle_seconds);
                         }
                     }
+                    ReplenishPooledSockets(s.get());
                 }
             }
         }
@@ -400,7 +524,7 @@ void SocketMap::WatchConnections() {
         const int defer_seconds = _options.defer_close_second_dynamic ?
             *_options.defer_close_second_dynamic :
             _options.defer_close_second;
-        ListOrphans(defer_seconds * 1000000L, &orphan_sockets);
+        ListOrphans(shard, defer_seconds * 1000000L, &orphan_sockets);
         for (size_t i = 0; i < orphan_sockets.size(); ++i) {
             RemoveInternal(orphan_sockets[i], INVALID_SOCKET_ID, true);
         }
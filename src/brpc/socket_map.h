@@ -29,6 +29,8 @@
 
 namespace brpc {
 
+class EgressRateLimiter;
+
 // Different signature means that the Channel needs separate sockets.
 struct ChannelSignature {
     uint64_t data[2];
@@ -82,7 +84,9 @@ struct SocketMapKeyHasher {
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool use_rdma,
-                    const HealthCheckOption& hc_option);
+                    const HealthCheckOption& hc_option,
+                    const std::shared_ptr<EgressRateLimiter>& egress_limiter =
+                        std::shared_ptr<EgressRateLimiter>());
 
 inline int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
@@ -128,7 +132,15 @@ struct SocketMapOptions {
     // Initial size of the map (proper size reduces number of resizes)
     // Default: 1024
     size_t suggested_map_size;
-  
+
+    // Number of independent sub maps that keys are sharded into by hash.
+    // Each shard has its own mutex and connection-scanning bthread, so that
+    // contention on Insert/Remove and the cost of periodic scans spread over
+    // shards instead of stalling each other behind one mutex. Values not
+    // greater than 1 keep the single-map behavior.
+    // Default: 1
+    size_t num_shards;
+
     // Pooled connections without data transmission for so many seconds will
     // be closed. No effect for non-positive values.
     // If idle_timeout_second_dynamic is not NULL, use the dereferenced value
@@ -155,7 +167,9 @@ public:
     int Insert(const SocketMapKey& key, SocketId* id,
                const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                bool use_rdma,
-               const HealthCheckOption& hc_option);
+               const HealthCheckOption& hc_option,
+               const std::shared_ptr<EgressRateLimiter>& egress_limiter =
+                   std::shared_ptr<EgressRateLimiter>());
 
     int Insert(const SocketMapKey& key, SocketId* id,
                const std::shared_ptr<SocketSSLContext>& ssl_ctx) {
@@ -175,34 +189,48 @@ public:
     const SocketMapOptions& options() const { return _options; }
 
 private:
+    struct SingleConnection {
+        int ref_count;
+        Socket* socket;
+        int64_t no_ref_us;
+    };
+
+    typedef butil::FlatMap<SocketMapKey, SingleConnection,
+                           SocketMapKeyHasher> Map;
+
+    // A shard of the whole mapping with its own mutex and scanning bthread,
+    // operated independently from other shards.
+    struct Shard {
+        Shard() : owner(NULL), has_close_idle_thread(false) {}
+        SocketMap* owner;
+        butil::Mutex mutex;
+        Map map;
+        bool has_close_idle_thread;
+        bthread_t close_idle_thread;
+    };
+
+    Shard& ShardOfKey(const SocketMapKey& key) {
+        return _nshard > 1 ?
+            _shards[SocketMapKeyHasher()(key) % _nshard] : _shards[0];
+    }
     void RemoveInternal(const SocketMapKey& key, SocketId id,
                         bool remove_orphan);
     static void ReleaseReference(Socket* s);
-    void ListOrphans(int64_t defer_us, std::vector<SocketMapKey>* out);
-    void WatchConnections();
+    void List(Shard& shard, std::vector<SocketId>* ids);
+    void ListOrphans(Shard& shard, int64_t defer_us,
+                     std::vector<SocketMapKey>* out);
+    void WatchConnections(Shard& shard);
     static void* RunWatchConnections(void*);
     void Print(std::ostream& os);
     static void PrintSocketMap(std::ostream& os, void* arg);
     void ShowSocketMapInBvarIfNeed();
 
 private:
-    struct SingleConnection {
-        int ref_count;
-        Socket* socket;
-        int64_t no_ref_us;
-    };
-
-    // TODO: When RpcChannels connecting to one EndPoint are frequently created
-    //       and destroyed, a single map+mutex may become hot-spots.
-    typedef butil::FlatMap<SocketMapKey, SingleConnection,
-                           SocketMapKeyHasher> Map;
     SocketMapOptions _options;
-    butil::Mutex _mutex;
-    Map _map;
+    Shard* _shards;
+    size_t _nshard;
     butil::atomic<bool> _exposed_in_bvar;
     bvar::PassiveStatus<std::string>* _this_map_bvar;
-    bool _has_close_idle_thread;
-    bthread_t _close_idle_thread;
 };
 
 } // namespace brpc
@@ -17,11 +17,14 @@
 
 
 #include <netinet/in.h>
+#include <algorithm>
 #include <functional>
+#include <vector>
 #include <gflags/gflags.h>
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
 #include "bthread/bthread.h"
+#include "butil/atomicops.h"
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
 #include "butil/string_printf.h"
@@ -64,6 +67,17 @@ DEFINE_bool(rpcz_keep_span_db, false, "Don't remove DB of rpcz at program's exit
 DEFINE_int64(rpcz_save_span_min_latency_us, 0, "The minimum latency microseconds of span saved");
 BRPC_VALIDATE_GFLAG(rpcz_save_span_min_latency_us, NonNegativeInteger);
 
+DEFINE_bool(rpcz_lean, false,
+            "Record finished spans as POD records in fixed-size per-worker "
+            "ring buffers instead of indexing them through the background "
+            "collector, making rpcz cheap enough to leave on in production. "
+            "Only the newest records are kept and annotations are dropped.");
+BRPC_VALIDATE_GFLAG(rpcz_lean, PassValidate);
+
+DEFINE_int32(rpcz_lean_ring_size, 1024,
+             "Number of span records kept in each worker's ring buffer "
+             "when -rpcz_lean is on");
+
 struct IdGen {
     bool init;
     uint16_t seq;
@@ -469,9 +483,186 @@ inline int GetSpanDB(butil::intrusive_ptr<SpanDB>* db) {
     return -1;
 }
 
+// ====== lean rpcz (-rpcz_lean) ======
+// Finished spans are flattened into POD records written into a fixed-size
+// ring owned by the recording thread with plain stores: no collector
+// handoff, no leveldb indexing, no annotation strings. /rpcz harvests the
+// rings on demand. Readers are racy against writers by design -- a record
+// being overwritten during a scan may expose mixed fields -- which is
+// acceptable for a diagnosis page and keeps recording synchronization-free.
+
+struct LeanSpanRecord {
+    uint64_t trace_id;
+    uint64_t span_id;
+    uint64_t parent_span_id;
+    uint64_t log_id;
+    uint32_t remote_ip;
+    int remote_port;
+    SpanType type;
+    bool async;
+    ProtocolType protocol;
+    int error_code;
+    int request_size;
+    int response_size;
+    int64_t received_real_us;
+    int64_t start_parse_real_us;
+    int64_t start_callback_real_us;
+    int64_t start_send_real_us;
+    int64_t sent_real_us;
+    char full_method_name[64];
+
+    int64_t start_real_us() const {
+        return type == SPAN_TYPE_SERVER ? received_real_us : start_send_real_us;
+    }
+    int64_t end_real_us() const {
+        int64_t result = received_real_us;
+        result = std::max(result, start_parse_real_us);
+        result = std::max(result, start_callback_real_us);
+        result = std::max(result, start_send_real_us);
+        result = std::max(result, sent_real_us);
+        return result;
+    }
+};
+
+class LeanSpanRing {
+public:
+    explicit LeanSpanRing(size_t cap)
+        : _ndone(0), _cap(cap), _recs(new LeanSpanRecord[cap]) {}
+
+    // Only called by the owning thread.
+    void Append(const Span* s) {
+        const size_t n = _ndone.load(butil::memory_order_relaxed);
+        LeanSpanRecord* r = &_recs[n % _cap];
+        r->trace_id = s->trace_id();
+        r->span_id = s->span_id();
+        r->parent_span_id = s->parent_span_id();
+        r->log_id = s->log_id();
+        r->remote_ip = butil::ip2int(s->remote_side().ip);
+        r->remote_port = s->remote_side().port;
+        r->type = s->type();
+        r->async = s->async();
+        r->protocol = s->protocol();
+        r->error_code = s->error_code();
+        r->request_size = s->request_size();
+        r->response_size = s->response_size();
+        r->received_real_us = s->received_real_us();
+        r->start_parse_real_us = s->start_parse_real_us();
+        r->start_callback_real_us = s->start_callback_real_us();
+        r->start_send_real_us = s->start_send_real_us();
+        r->sent_real_us = s->sent_real_us();
+        const std::string& name = s->full_method_name();
+        const size_t len =
+            std::min(name.size(), sizeof(r->full_method_name) - 1);
+        memcpy(r->full_method_name, name.data(), len);
+        r->full_method_name[len] = '\0';
+        _ndone.store(n + 1, butil::memory_order_release);
+    }
+
+    // Copy presently readable records into `out'. Racy against Append().
+    void CopyRecords(std::vector<LeanSpanRecord>* out) const {
+        const size_t n = _ndone.load(butil::memory_order_acquire);
+        const size_t begin = n > _cap ? n - _cap : 0;
+        for (size_t i = begin; i < n; ++i) {
+            out->push_back(_recs[i % _cap]);
+        }
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(LeanSpanRing);
+    butil::atomic<size_t> _ndone;
+    const size_t _cap;
+    LeanSpanRecord* _recs;
+};
+
+static pthread_mutex_t g_lean_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Rings are never removed so that records of exited threads stay
+// harvestable; memory is bounded by the peak number of recording threads.
+static std::vector<LeanSpanRing*>* g_lean_rings = NULL;
+static __thread LeanSpanRing* tls_lean_ring = NULL;
+
+static LeanSpanRing* GetLeanSpanRing() {
+    LeanSpanRing* ring = tls_lean_ring;
+    if (ring != NULL) {
+        return ring;
+    }
+    const size_t cap = std::max(FLAGS_rpcz_lean_ring_size, 16);
+    ring = new (std::nothrow) LeanSpanRing(cap);
+    if (NULL == ring) {
+        return NULL;
+    }
+    {
+        BAIDU_SCOPED_LOCK(g_lean_rings_mutex);
+        if (NULL == g_lean_rings) {
+            g_lean_rings = new std::vector<LeanSpanRing*>;
+        }
+        g_lean_rings->push_back(ring);
+    }
+    tls_lean_ring = ring;
+    return ring;
+}
+
+static void CopyAllLeanRecords(std::vector<LeanSpanRecord>* out) {
+    std::vector<LeanSpanRing*> rings;
+    {
+        BAIDU_SCOPED_LOCK(g_lean_rings_mutex);
+        if (g_lean_rings != NULL) {
+            rings = *g_lean_rings;
+        }
+    }
+    for (size_t i = 0; i < rings.size(); ++i) {
+        rings[i]->CopyRecords(out);
+    }
+}
+
+static void LeanRecord2Brief(const LeanSpanRecord& rec, BriefSpan* out) {
+    out->set_trace_id(rec.trace_id);
+    out->set_span_id(rec.span_id);
+    out->set_log_id(rec.log_id);
+    out->set_type(rec.type);
+    out->set_error_code(rec.error_code);
+    out->set_request_size(rec.request_size);
+    out->set_response_size(rec.response_size);
+    out->set_start_real_us(rec.start_real_us());
+    out->set_latency_us(rec.end_real_us() - rec.start_real_us());
+    out->set_full_method_name(rec.full_method_name);
+}
+
+static void LeanRecord2Rpcz(const LeanSpanRecord& rec, RpczSpan* out) {
+    out->set_trace_id(rec.trace_id);
+    out->set_span_id(rec.span_id);
+    out->set_parent_span_id(rec.parent_span_id);
+    out->set_log_id(rec.log_id);
+    out->set_remote_ip(rec.remote_ip);
+    out->set_remote_port(rec.remote_port);
+    out->set_type(rec.type);
+    out->set_async(rec.async);
+    out->set_protocol(rec.protocol);
+    out->set_error_code(rec.error_code);
+    out->set_request_size(rec.request_size);
+    out->set_response_size(rec.response_size);
+    out->set_received_real_us(rec.received_real_us);
+    out->set_start_parse_real_us(rec.start_parse_real_us);
+    out->set_start_callback_real_us(rec.start_callback_real_us);
+    out->set_start_send_real_us(rec.start_send_real_us);
+    out->set_sent_real_us(rec.sent_real_us);
+    out->set_full_method_name(rec.full_method_name);
+}
+
+void Span::submit_lean() {
+    LeanSpanRing* ring = GetLeanSpanRing();
+    if (ring != NULL) {
+        traversal(this, [ring](Span* s) { ring->Append(s); });
+    }
+    destroy();
+}
+
 void Span::Submit(Span* span, int64_t cpuwide_time_us) {
     if (span->local_parent() == NULL) {
-        span->submit(cpuwide_time_us);
+        if (FLAGS_rpcz_lean) {
+            span->submit_lean();
+        } else {
+            span->submit(cpuwide_time_us);
+        }
     }
 }
 
@@ -750,6 +941,17 @@ void Span::dump_and_destroy(size_t /*round*/) {
 }
 
 int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
+    if (FLAGS_rpcz_lean) {
+        std::vector<LeanSpanRecord> recs;
+        CopyAllLeanRecords(&recs);
+        for (size_t i = 0; i < recs.size(); ++i) {
+            if (recs[i].trace_id == trace_id && recs[i].span_id == span_id) {
+                LeanRecord2Rpcz(recs[i], response);
+                return 0;
+            }
+        }
+        return -1;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return -1;
@@ -772,6 +974,18 @@ int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
 
 void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
     out->clear();
+    if (FLAGS_rpcz_lean) {
+        std::vector<LeanSpanRecord> recs;
+        CopyAllLeanRecords(&recs);
+        for (size_t i = 0; i < recs.size(); ++i) {
+            if (recs[i].trace_id == trace_id) {
+                RpczSpan span;
+                LeanRecord2Rpcz(recs[i], &span);
+                out->push_back(span);
+            }
+        }
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -804,6 +1018,29 @@ void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
 void ListSpans(int64_t starting_realtime, size_t max_scan,
                std::deque<BriefSpan>* out, SpanFilter* filter) {
     out->clear();
+    if (FLAGS_rpcz_lean) {
+        std::vector<LeanSpanRecord> recs;
+        CopyAllLeanRecords(&recs);
+        // Newest first, like the time-indexed scan below.
+        std::sort(recs.begin(), recs.end(),
+                  [](const LeanSpanRecord& a, const LeanSpanRecord& b) {
+                      return a.start_real_us() > b.start_real_us();
+                  });
+        BriefSpan brief;
+        size_t nscan = 0;
+        for (size_t i = 0; i < recs.size() && nscan < max_scan; ++i) {
+            if (recs[i].start_real_us() > starting_realtime) {
+                continue;
+            }
+            brief.Clear();
+            LeanRecord2Brief(recs[i], &brief);
+            if (NULL == filter || filter->Keep(brief)) {
+                out->push_back(brief);
+            }
+            ++nscan;
+        }
+        return;
+    }
     butil::intrusive_ptr<SpanDB> db;
     if (GetSpanDB(&db) != 0) {
         return;
@@ -146,6 +146,9 @@ private:
 
     void dump_and_destroy(size_t round_index);
     void destroy();
+    // Flatten this span and its client spans into POD records of the
+    // worker-local ring (-rpcz_lean), then destroy.
+    void submit_lean();
     void traversal(Span*, const std::function<void(Span*)>&) const;
     bvar::CollectorSpeedLimit* speed_limit();
     bvar::CollectorPreprocessor* preprocessor();
@@ -20,6 +20,7 @@
 
 #include <gflags/gflags.h>
 #include "butil/time.h"
+#include "butil/sys_byteorder.h"
 #include "butil/object_pool.h"
 #include "butil/unique_ptr.h"
 #include "bthread/unstable.h"
@@ -51,6 +52,11 @@ Stream::Stream()
     , _produced(0)
     , _remote_consumed(0)
     , _cur_buf_size(0)
+    , _bdp_probe_start_us(0)
+    , _bdp_probe_produced(0)
+    , _rtt_us(0)
+    , _drain_rate(0)
+    , _last_feedback_us(0)
     , _local_consumed(0)
     , _parse_rpc_response(false)
     , _pending_buf(NULL)
@@ -93,6 +99,16 @@ int Stream::Create(const StreamOptions &options,
     if (FLAGS_socket_max_streams_unconsumed_bytes > 0 && s->_options.min_buf_size > 0) {
         s->_cur_buf_size = s->_options.min_buf_size;
     }
+    if (s->_options.auto_tune_buf_size) {
+        if (s->_options.max_buf_size > 0 && s->_options.min_buf_size > 0) {
+            // Start small and grow towards the probed BDP.
+            s->_cur_buf_size = s->_options.min_buf_size;
+        } else {
+            s->_options.auto_tune_buf_size = false;
+            LOG(WARNING) << "options.auto_tune_buf_size requires positive "
+                "min_buf_size and max_buf_size, it will be set to false.";
+        }
+    }
 
     if (remote_settings != NULL) {
         s->_remote_settings.MergeFrom(*remote_settings);
@@ -160,6 +176,14 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
         errno = EBADF;
         return -1;
     }
+    if (_options.message_aggregation_us > 0 && size == 1) {
+        // Messages reach this function in the batches formed by the write
+        // path of _fake_socket. When only one message made it into the
+        // batch, wait the configured window so that messages written
+        // meanwhile pile up and the next batch is merged into one frame
+        // instead of each message being framed on its own.
+        bthread_usleep(_options.message_aggregation_us);
+    }
     butil::IOBuf out;
     ssize_t len = 0;
     ssize_t unwritten_data_size = 0;
@@ -189,22 +213,63 @@ ssize_t Stream::CutMessageIntoFileDescriptor(int /*fd*/,
                 WriteToHostSocket(&out);
                 out.clear();
             }
-        } else {
-            if (unwritten_data_size + length > FLAGS_stream_write_max_segment_size) {
+            continue;
+        }
+        size_t group_end = i + 1;
+        if (_options.message_aggregation_us > 0) {
+            // Extend the group while following messages still fit into one
+            // merged frame, each costing a 4-byte length prefix.
+            size_t group_bytes = length + 4;
+            while (group_end < size) {
+                const size_t l = data_list[group_end]->length();
+                if (group_bytes + l + 4 >
+                        (size_t)FLAGS_stream_write_max_segment_size) {
+                    break;
+                }
+                group_bytes += l + 4;
+                ++group_end;
+            }
+        }
+        if (group_end > i + 1) {
+            if (!out.empty()) {
                 WriteToHostSocket(&out);
                 unwritten_data_size = 0;
                 out.clear();
             }
-            unwritten_data_size += length;
+            butil::IOBuf merged;
+            for (size_t k = i; k < group_end; ++k) {
+                char lenbuf[4];
+                *(uint32_t*)lenbuf = butil::HostToNet32(data_list[k]->length());
+                merged.append(lenbuf, sizeof(lenbuf));
+                len += data_list[k]->length();
+                merged.append(butil::IOBuf::Movable(*data_list[k]));
+            }
             StreamFrameMeta fm;
             fm.set_stream_id(_remote_settings.stream_id());
             fm.set_source_stream_id(id());
             fm.set_frame_type(FRAME_TYPE_DATA);
             fm.set_has_continuation(false);
-            policy::PackStreamMessage(&out, fm, data_list[i]);
-            len += length;
-            data_list[i]->clear();
+            fm.set_has_multiple_messages(true);
+            policy::PackStreamMessage(&out, fm, &merged);
+            WriteToHostSocket(&out);
+            out.clear();
+            i = group_end - 1;
+            continue;
+        }
+        if (unwritten_data_size + length > FLAGS_stream_write_max_segment_size) {
+            WriteToHostSocket(&out);
+            unwritten_data_size = 0;
+            out.clear();
         }
+        unwritten_data_size += length;
+        StreamFrameMeta fm;
+        fm.set_stream_id(_remote_settings.stream_id());
+        fm.set_source_stream_id(id());
+        fm.set_frame_type(FRAME_TYPE_DATA);
+        fm.set_has_continuation(false);
+        policy::PackStreamMessage(&out, fm, data_list[i]);
+        len += length;
+        data_list[i]->clear();
     }
 
     if (!out.empty()) {
@@ -331,6 +396,13 @@ int Stream::AppendIfNotFull(const butil::IOBuf &data,
             return 1;
         }
         _produced += data.length();
+        if (_options.auto_tune_buf_size && 0 == _bdp_probe_start_us) {
+            // Arm a BDP probe: the feedback acknowledging everything
+            // produced so far tells how long a full round trip(including
+            // remote consumption) takes.
+            _bdp_probe_start_us = butil::gettimeofday_us();
+            _bdp_probe_produced = _produced;
+        }
     }
 
     size_t data_length = data.length();
@@ -362,6 +434,10 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
     }
     const bool was_full = _produced >= _remote_consumed + _cur_buf_size;
 
+    if (_options.auto_tune_buf_size) {
+        TuneBufSize(new_remote_consumed, butil::gettimeofday_us());
+    }
+
     if (FLAGS_socket_max_streams_unconsumed_bytes > 0) {
         _host_socket->_total_streams_unconsumed_size -= new_remote_consumed - _remote_consumed;
         if (_host_socket->_total_streams_unconsumed_size > FLAGS_socket_max_streams_unconsumed_bytes) {
@@ -371,7 +447,8 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
                 _cur_buf_size /= 2;
             }
             LOG(INFO) << "stream consumers on socket " << _host_socket->id() << " is crowded, " <<  "cut stream " << id() << " buffer to " << _cur_buf_size;
-        } else if (_produced >= new_remote_consumed + _cur_buf_size && (_options.max_buf_size <= 0 || _cur_buf_size < (size_t)_options.max_buf_size)) {
+        } else if (!_options.auto_tune_buf_size &&
+                   _produced >= new_remote_consumed + _cur_buf_size && (_options.max_buf_size <= 0 || _cur_buf_size < (size_t)_options.max_buf_size)) {
             if (_options.max_buf_size > 0 && _cur_buf_size * 2 > (size_t)_options.max_buf_size) {
                 _cur_buf_size = _options.max_buf_size;
             } else {
@@ -392,6 +469,45 @@ void Stream::SetRemoteConsumed(size_t new_remote_consumed) {
     bthread_id_list_destroy(&tmplist);
 }
 
+void Stream::TuneBufSize(size_t new_remote_consumed, int64_t now_us) {
+    // Drain rate from consecutive feedbacks.
+    if (_last_feedback_us > 0 && now_us > _last_feedback_us) {
+        const double rate = (double)(new_remote_consumed - _remote_consumed)
+            / (now_us - _last_feedback_us);
+        // EWMA smoothes out bursty consumption at remote side.
+        _drain_rate = (_drain_rate <= 0 ? rate : (_drain_rate * 7 + rate) / 8);
+    }
+    _last_feedback_us = now_us;
+
+    if (0 == _bdp_probe_start_us || new_remote_consumed < _bdp_probe_produced) {
+        return;
+    }
+    // The probe is acknowledged, the elapse approximates one RTT.
+    const int64_t rtt_us = now_us - _bdp_probe_start_us;
+    _bdp_probe_start_us = 0;
+    _rtt_us = (_rtt_us <= 0 ? rtt_us : (_rtt_us * 7 + rtt_us) / 8);
+    if (_rtt_us <= 0 || _drain_rate <= 0) {
+        return;
+    }
+    // Cover twice the bandwidth-delay product so that the pipe stays full
+    // and there's headroom to probe for more bandwidth, similar to h2
+    // window management. Both growing and shrinking follow the estimate,
+    // clamped into [min_buf_size, max_buf_size].
+    size_t target = (size_t)(2 * _drain_rate * _rtt_us);
+    if (target > (size_t)_options.max_buf_size) {
+        target = _options.max_buf_size;
+    }
+    if (target < (size_t)_options.min_buf_size) {
+        target = _options.min_buf_size;
+    }
+    if (target != _cur_buf_size) {
+        RPC_VLOG << "Stream=" << _id << " tuned buf size from " << _cur_buf_size
+                 << " to " << target << " rtt_us=" << _rtt_us
+                 << " drain_rate(bytes/us)=" << _drain_rate;
+        _cur_buf_size = target;
+    }
+}
+
 void* Stream::RunOnWritable(void* arg) {
     WritableMeta *wm = (WritableMeta*)arg;
     wm->on_writable(wm->id, wm->arg, wm->error_code);
@@ -488,6 +604,16 @@ int Stream::Wait(const timespec* due_time) {
     return rc;
 }
 
+int Stream::EnqueueMessage(butil::IOBuf* message) {
+    const int rc = bthread::execution_queue_execute(_consumer_queue, message);
+    if (rc != 0) {
+        CHECK(false) << "Fail to push into channel";
+        delete message;
+        Close(rc, "Fail to push into channel");
+    }
+    return rc;
+}
+
 int Stream::OnReceived(const StreamFrameMeta& fm, butil::IOBuf *buf, Socket* sock) {
     if (_host_socket == NULL) {
         if (SetHostSocket(sock) != 0) {
@@ -510,11 +636,28 @@ int Stream::OnReceived(const StreamFrameMeta& fm, butil::IOBuf *buf, Socket* soc
         if (!fm.has_continuation()) {
             butil::IOBuf *tmp = _pending_buf;
             _pending_buf = NULL;
-            int rc = bthread::execution_queue_execute(_consumer_queue, tmp);
-            if (rc != 0) {
-                CHECK(false) << "Fail to push into channel";
-                delete tmp;
-                Close(rc, "Fail to push into channel");
+            if (!fm.has_multiple_messages()) {
+                EnqueueMessage(tmp);
+                break;
+            }
+            // A merged frame written by a peer with message aggregation on,
+            // split it back into the original messages, each prefixed with
+            // its 4-byte length (see StreamOptions.message_aggregation_us).
+            std::unique_ptr<butil::IOBuf> merged(tmp);
+            while (!merged->empty()) {
+                char lenbuf[4];
+                uint32_t length = 0;
+                if (merged->cutn(lenbuf, sizeof(lenbuf)) != sizeof(lenbuf) ||
+                    (length = butil::NetToHost32(*(uint32_t*)lenbuf))
+                        > merged->size()) {
+                    Close(EINVAL, "Received corrupted merged frame");
+                    return -1;
+                }
+                butil::IOBuf* one_msg = new butil::IOBuf;
+                merged->cutn(one_msg, length);
+                if (EnqueueMessage(one_msg) != 0) {
+                    break;
+                }
             }
         }
         break;
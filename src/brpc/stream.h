@@ -56,8 +56,10 @@ struct StreamOptions {
     StreamOptions()
         : min_buf_size(1024 * 1024)
         , max_buf_size(2 * 1024 * 1024)
+        , auto_tune_buf_size(false)
         , idle_timeout_ms(-1)
         , messages_in_batch(128)
+        , message_aggregation_us(0)
         , handler(NULL)
     {}
 
@@ -66,11 +68,21 @@ struct StreamOptions {
     // default: 1048576 (1M)
     int min_buf_size;
 
-    // The max size of unconsumed data allowed at remote side. 
+    // The max size of unconsumed data allowed at remote side.
     // If |max_buf_size| <= 0, there's no limit of buf size
     // default: 2097152 (2M)
     int max_buf_size;
 
+    // Tune the buffer size limit within [min_buf_size, max_buf_size]
+    // automatically from the RTT and drain rate observed on feedbacks, so
+    // that the window covers the bandwidth-delay product of the connection:
+    // long-haul streams get a window large enough to not stall while
+    // intra-rack streams don't over-buffer. The stream starts from
+    // |min_buf_size| and |max_buf_size| caps the growth. Only effective
+    // when both sizes are positive.
+    // default: false
+    bool auto_tune_buf_size;
+
     // Notify user when there's no data for at least |idle_timeout_ms|
     // milliseconds since the last time that HandleIdleTimeout or HandleInput 
     // finished.
@@ -81,6 +93,16 @@ struct StreamOptions {
     // default: 128
     size_t messages_in_batch;
 
+    // If positive, messages written to this stream may be delayed for at
+    // most so many microseconds so that messages written meanwhile are
+    // merged into a single frame (within -stream_write_max_segment_size),
+    // cutting the per-message framing and write cost of chatty streams at
+    // the price of that much extra latency. The receiving side unpacks
+    // merged frames transparently but must run a build aware of them: keep
+    // this off until both ends are upgraded.
+    // default: 0 (every message is framed on its own)
+    int message_aggregation_us;
+
     // Handle input message, if handler is NULL, the remote side is not allowed to
     // write any message, who will get EBADF on writting
     // default: NULL
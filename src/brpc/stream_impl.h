@@ -82,10 +82,16 @@ friend struct butil::DefaultDeleter<Stream>;
     void Wait(void (*on_writable)(StreamId, void*, int), void* arg, 
               const timespec* due_time, bool new_thread, bthread_id_t *join_id);
     void SendFeedback();
+    // Update _cur_buf_size from the BDP estimated on this feedback.
+    // Called with _congestion_control_mutex held.
+    void TuneBufSize(size_t new_remote_consumed, int64_t now_us);
     void StartIdleTimer();
     void StopIdleTimer();
     void HandleRpcResponse(butil::IOBuf* response_buffer);
     void WriteToHostSocket(butil::IOBuf* b);
+    // Push one complete message to the consumer queue, closing the stream
+    // on failure. Returns 0 on success.
+    int EnqueueMessage(butil::IOBuf* message);
 
     static int Consume(void *meta, bthread::TaskIterator<butil::IOBuf*>& iter);
     static int TriggerOnWritable(bthread_id_t id, void *data, int error_code);
@@ -126,6 +132,16 @@ friend struct butil::DefaultDeleter<Stream>;
     size_t _cur_buf_size;
     bthread_id_list_t _writable_wait_list;
 
+    // States of BDP probing for auto_tune_buf_size, protected by
+    // _congestion_control_mutex. A probe is armed in AppendIfNotFull and
+    // resolved when the feedback covering all data produced by then
+    // returns, the elapse approximating RTT.
+    int64_t _bdp_probe_start_us;   // 0 means no probe in flight
+    size_t  _bdp_probe_produced;
+    int64_t _rtt_us;               // EWMA of probed RTT, 0 = unknown
+    double  _drain_rate;           // EWMA of consumed bytes per us
+    int64_t _last_feedback_us;
+
     int64_t _local_consumed;
     StreamSettings _remote_settings;   
 
@@ -0,0 +1,260 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "brpc/thrift_field_cursor.h"
+
+#include "butil/logging.h"
+#include "butil/sys_byteorder.h"
+
+namespace brpc {
+
+// TBinaryProtocol wire types, kept local to avoid a libthrift dependency.
+static const int THRIFT_T_STOP = 0;
+static const int THRIFT_T_BOOL = 2;
+static const int THRIFT_T_BYTE = 3;
+static const int THRIFT_T_DOUBLE = 4;
+static const int THRIFT_T_I16 = 6;
+static const int THRIFT_T_I32 = 8;
+static const int THRIFT_T_I64 = 10;
+static const int THRIFT_T_STRING = 11;
+static const int THRIFT_T_STRUCT = 12;
+static const int THRIFT_T_MAP = 13;
+static const int THRIFT_T_SET = 14;
+static const int THRIFT_T_LIST = 15;
+static const int THRIFT_T_UUID = 16;
+
+// Same bound as thrift's default recursion limit, against crafted input.
+static const int MAX_SKIP_DEPTH = 64;
+
+static bool ReadU8(butil::IOBufBytesIterator& it, uint8_t* out) {
+    return it.copy_and_forward(out, 1) == 1;
+}
+
+static bool ReadU16(butil::IOBufBytesIterator& it, uint16_t* out) {
+    uint16_t nval;
+    if (it.copy_and_forward(&nval, 2) != 2) {
+        return false;
+    }
+    *out = butil::NetToHost16(nval);
+    return true;
+}
+
+static bool ReadU32(butil::IOBufBytesIterator& it, uint32_t* out) {
+    uint32_t nval;
+    if (it.copy_and_forward(&nval, 4) != 4) {
+        return false;
+    }
+    *out = butil::NetToHost32(nval);
+    return true;
+}
+
+static bool ReadU64(butil::IOBufBytesIterator& it, uint64_t* out) {
+    uint64_t nval;
+    if (it.copy_and_forward(&nval, 8) != 8) {
+        return false;
+    }
+    *out = butil::NetToHost64(nval);
+    return true;
+}
+
+ThriftFieldCursor::ThriftFieldCursor(const butil::IOBuf& body)
+    : _body(&body), _it(body) {
+}
+
+void ThriftFieldCursor::Rewind() {
+    _it = butil::IOBufBytesIterator(*_body);
+}
+
+bool ThriftFieldCursor::SkipValue(int type, int depth) {
+    if (depth > MAX_SKIP_DEPTH) {
+        LOG(WARNING) << "Exceed max skip depth=" << MAX_SKIP_DEPTH;
+        return false;
+    }
+    switch (type) {
+    case THRIFT_T_BOOL:
+    case THRIFT_T_BYTE:
+        return _it.forward(1) == 1;
+    case THRIFT_T_I16:
+        return _it.forward(2) == 2;
+    case THRIFT_T_I32:
+        return _it.forward(4) == 4;
+    case THRIFT_T_I64:
+    case THRIFT_T_DOUBLE:
+        return _it.forward(8) == 8;
+    case THRIFT_T_UUID:
+        return _it.forward(16) == 16;
+    case THRIFT_T_STRING: {
+        uint32_t len;
+        if (!ReadU32(_it, &len) || len > _it.bytes_left()) {
+            return false;
+        }
+        return _it.forward(len) == len;
+    }
+    case THRIFT_T_STRUCT: {
+        while (true) {
+            uint8_t ftype;
+            if (!ReadU8(_it, &ftype)) {
+                return false;
+            }
+            if (ftype == THRIFT_T_STOP) {
+                return true;
+            }
+            uint16_t fid;
+            if (!ReadU16(_it, &fid) || !SkipValue(ftype, depth + 1)) {
+                return false;
+            }
+        }
+    }
+    case THRIFT_T_MAP: {
+        uint8_t ktype;
+        uint8_t vtype;
+        uint32_t size;
+        if (!ReadU8(_it, &ktype) || !ReadU8(_it, &vtype) ||
+            !ReadU32(_it, &size)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            if (!SkipValue(ktype, depth + 1) ||
+                !SkipValue(vtype, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case THRIFT_T_SET:
+    case THRIFT_T_LIST: {
+        uint8_t etype;
+        uint32_t size;
+        if (!ReadU8(_it, &etype) || !ReadU32(_it, &size)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            if (!SkipValue(etype, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+        LOG(WARNING) << "Unknown thrift wire type=" << type;
+        return false;
+    }
+}
+
+int ThriftFieldCursor::FindField(int16_t fid) {
+    while (true) {
+        uint8_t ftype;
+        if (!ReadU8(_it, &ftype)) {
+            return -1;
+        }
+        if (ftype == THRIFT_T_STOP) {
+            return -1;
+        }
+        uint16_t cur_fid;
+        if (!ReadU16(_it, &cur_fid)) {
+            return -1;
+        }
+        if ((int16_t)cur_fid == fid) {
+            return ftype;
+        }
+        if (!SkipValue(ftype, 0)) {
+            return -1;
+        }
+    }
+}
+
+bool ThriftFieldCursor::EnterStruct(int16_t fid) {
+    return FindField(fid) == THRIFT_T_STRUCT;
+}
+
+bool ThriftFieldCursor::GetBool(int16_t fid, bool* out) {
+    uint8_t val;
+    if (FindField(fid) != THRIFT_T_BOOL || !ReadU8(_it, &val)) {
+        return false;
+    }
+    *out = (val != 0);
+    return true;
+}
+
+bool ThriftFieldCursor::GetByte(int16_t fid, int8_t* out) {
+    uint8_t val;
+    if (FindField(fid) != THRIFT_T_BYTE || !ReadU8(_it, &val)) {
+        return false;
+    }
+    *out = (int8_t)val;
+    return true;
+}
+
+bool ThriftFieldCursor::GetI16(int16_t fid, int16_t* out) {
+    uint16_t val;
+    if (FindField(fid) != THRIFT_T_I16 || !ReadU16(_it, &val)) {
+        return false;
+    }
+    *out = (int16_t)val;
+    return true;
+}
+
+bool ThriftFieldCursor::GetI32(int16_t fid, int32_t* out) {
+    uint32_t val;
+    if (FindField(fid) != THRIFT_T_I32 || !ReadU32(_it, &val)) {
+        return false;
+    }
+    *out = (int32_t)val;
+    return true;
+}
+
+bool ThriftFieldCursor::GetI64(int16_t fid, int64_t* out) {
+    uint64_t val;
+    if (FindField(fid) != THRIFT_T_I64 || !ReadU64(_it, &val)) {
+        return false;
+    }
+    *out = (int64_t)val;
+    return true;
+}
+
+bool ThriftFieldCursor::GetDouble(int16_t fid, double* out) {
+    uint64_t val;
+    if (FindField(fid) != THRIFT_T_DOUBLE || !ReadU64(_it, &val)) {
+        return false;
+    }
+    // TBinaryProtocol sends doubles as big-endian bit patterns.
+    memcpy(out, &val, sizeof(*out));
+    return true;
+}
+
+bool ThriftFieldCursor::GetString(int16_t fid, std::string* out) {
+    uint32_t len;
+    if (FindField(fid) != THRIFT_T_STRING || !ReadU32(_it, &len) ||
+        len > _it.bytes_left()) {
+        return false;
+    }
+    out->clear();
+    return _it.copy_and_forward(out, len) == len;
+}
+
+bool ThriftFieldCursor::GetString(int16_t fid, butil::IOBuf* out) {
+    uint32_t len;
+    if (FindField(fid) != THRIFT_T_STRING || !ReadU32(_it, &len) ||
+        len > _it.bytes_left()) {
+        return false;
+    }
+    out->clear();
+    return _it.append_and_forward(out, len) == len;
+}
+
+} // namespace brpc
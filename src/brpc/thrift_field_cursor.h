@@ -0,0 +1,89 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_THRIFT_FIELD_CURSOR_H
+#define BRPC_THRIFT_FIELD_CURSOR_H
+
+#include <stdint.h>
+#include <string>
+
+#include "butil/iobuf.h"
+
+namespace brpc {
+
+// Reads selected fields out of a thrift struct serialized with
+// TBinaryProtocol while the payload stays as an IOBuf, so that routers
+// which only need a header field do not pay the full decode + re-encode
+// of the generated codec. Does not depend on libthrift.
+//
+// Typical usage on a server-side ThriftFramedMessage `req':
+//
+//   ThriftFieldCursor cursor(req->body);
+//   cursor.EnterStruct(req->field_id);  // the user struct inside args
+//   std::string token;
+//   if (cursor.GetString(1, &token)) {
+//       ... route by token, forward req->body untouched ...
+//   }
+//
+// Fields are scanned strictly forward from the current position: fields
+// other than the requested one are skipped byte-wise, never
+// materialized. Accessing fields in increasing id order costs a single
+// pass over the skipped bytes; call Rewind() (and EnterStruct() again)
+// to go back.
+//
+// The cursor references the IOBuf and must not outlive it.
+class ThriftFieldCursor {
+public:
+    explicit ThriftFieldCursor(const butil::IOBuf& body);
+
+    // Descend into the struct-typed field `fid' of the current struct.
+    // Returns false when the field is absent or not a struct.
+    bool EnterStruct(int16_t fid);
+
+    // Materialize the value of field `fid' of the current struct.
+    // Returns false when the field is absent (searched up to the end of
+    // the struct), has a different wire type, or the bytes are corrupt.
+    bool GetBool(int16_t fid, bool* out);
+    bool GetByte(int16_t fid, int8_t* out);
+    bool GetI16(int16_t fid, int16_t* out);
+    bool GetI32(int16_t fid, int32_t* out);
+    bool GetI64(int16_t fid, int64_t* out);
+    bool GetDouble(int16_t fid, double* out);
+    bool GetString(int16_t fid, std::string* out);
+    // Zero-copy variant: blocks are referenced rather than copied.
+    bool GetString(int16_t fid, butil::IOBuf* out);
+
+    // Restart from the beginning of the body (the top-level struct).
+    void Rewind();
+
+private:
+    // Position the cursor at the value of field `fid' of the current
+    // struct, skipping preceding fields. Returns the wire type of the
+    // field, or -1 when it is absent or the bytes are corrupt.
+    int FindField(int16_t fid);
+
+    // Skip a value of `type' at the current position.
+    bool SkipValue(int type, int depth);
+
+    const butil::IOBuf* _body;
+    butil::IOBufBytesIterator _it;
+};
+
+} // namespace brpc
+
+#endif // BRPC_THRIFT_FIELD_CURSOR_H
@@ -17,6 +17,7 @@
 
 
 #include <ctype.h>                         // isalnum
+#include <string.h>                        // memchr
 
 #include <unordered_set>
 
@@ -424,6 +425,159 @@ void URI::SetH2Path(const char* h2_path) {
     }
 }
 
+URIView::URIView()
+    : _port(-1)
+    , _initialized_query_map(false) {
+}
+
+void URIView::Clear() {
+    _st.reset();
+    _port = -1;
+    _initialized_query_map = false;
+    _buf.clear();
+    _host.clear();
+    _path.clear();
+    _user_info.clear();
+    _fragment.clear();
+    _scheme.clear();
+    _query.clear();
+    _query_map.clear();
+}
+
+int URIView::SetHttpURL(const butil::StringPiece& url) {
+    Clear();
+    // Normalize by trimming surrounding spaces, making any interior space
+    // invalid below (same set of accepted urls as URI::SetHttpURL).
+    butil::StringPiece trimmed = url;
+    while (!trimmed.empty() && trimmed.front() == ' ') {
+        trimmed.remove_prefix(1);
+    }
+    while (!trimmed.empty() && trimmed.back() == ' ') {
+        trimmed.remove_suffix(1);
+    }
+    // The single copy all components point into. c_str() keeps the parsing
+    // loops below identical to URI's NUL-terminated ones.
+    _buf.assign(trimmed.data(), trimmed.size());
+    const char* p = _buf.c_str();
+    const char* start = p;
+    bool need_scheme = true;
+    bool need_user_info = true;
+    for (; true; ++p) {
+        const char action = g_url_parsing_fast_action_map[(int)*p];
+        if (action == URI_PARSE_CONTINUE) {
+            continue;
+        }
+        if (action == URI_PARSE_BREAK) {
+            break;
+        }
+        if (!is_valid_char(*p)) {
+            _st.set_error(EINVAL, "invalid character in url");
+            return -1;
+        } else if (*p == ':') {
+            if (p[1] == '/' && p[2] == '/' && need_scheme) {
+                need_scheme = false;
+                _scheme.set(start, p - start);
+                p += 2;
+                start = p + 1;
+            }
+        } else if (*p == '@') {
+            if (need_user_info) {
+                need_user_info = false;
+                _user_info.set(start, p - start);
+                start = p + 1;
+            }
+        } else if (*p == ' ') {
+            _st.set_error(EINVAL, "Invalid space in url");
+            return -1;
+        }
+    }
+    const char* host_end = SplitHostAndPort(start, p, &_port);
+    _host.set(start, host_end - start);
+    if (*p == '/') {
+        start = p; //slash pointed by p is counted into _path
+        ++p;
+        for (; *p && *p != '?' && *p != '#'; ++p) {
+            if (*p == ' ') {
+                _st.set_error(EINVAL, "Invalid space in path");
+                return -1;
+            }
+        }
+        _path.set(start, p - start);
+    }
+    if (*p == '?') {
+        start = ++p;
+        for (; *p && *p != '#'; ++p) {
+            if (*p == ' ') {
+                _st.set_error(EINVAL, "Invalid space in query");
+                return -1;
+            }
+        }
+        _query.set(start, p - start);
+    }
+    if (*p == '#') {
+        start = ++p;
+        for (; *p; ++p) {
+            if (*p == ' ') {
+                _st.set_error(EINVAL, "Invalid space in fragment");
+                return -1;
+            }
+        }
+        _fragment.set(start, p - start);
+    }
+    return 0;
+}
+
+void URIView::InitializeQueryMap() const {
+    _query_map.clear();
+    for (QuerySplitter sp(_query); sp; ++sp) {
+        if (!sp.key().empty()) {
+            // Both key and value reference _buf, no string is constructed.
+            _query_map[sp.key()] = sp.value();
+        }
+    }
+    _initialized_query_map = true;
+}
+
+inline int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool DecodePercentEncoded(const butil::StringPiece& in, std::string* out) {
+    out->reserve(out->size() + in.size());
+    const char* p = in.data();
+    const char* const end = p + in.size();
+    while (p != end) {
+        // memchr is vectorized by libc, copying the run between escapes in
+        // bulk beats inspecting every byte.
+        const char* pct = (const char*)memchr(p, '%', end - p);
+        if (pct == NULL) {
+            out->append(p, end - p);
+            return true;
+        }
+        out->append(p, pct - p);
+        if (end - pct < 3) {
+            return false;
+        }
+        const int hi = hex_digit_value(pct[1]);
+        const int lo = hex_digit_value(pct[2]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out->push_back((char)((hi << 4) | lo));
+        p = pct + 3;
+    }
+    return true;
+}
+
 QueryRemover::QueryRemover(const std::string* str)
     : _query(str)
     , _qs(str->data(), str->data() + str->size())
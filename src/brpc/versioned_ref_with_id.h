@@ -225,6 +225,13 @@ public:
     // Returns 0 on success, 1 on failed socket, -1 on recycled.
     static int AddressFailedAsWell(VRefId id, VersionedRefWithIdUniquePtr<T>* ptr);
 
+    // Issue a non-binding prefetch of the leading cachelines of the T
+    // associated with `id' so that they are likely cached when Address()
+    // is called shortly after, e.g. for each event returned by one
+    // epoll_wait before processing the batch. Takes no reference, never
+    // fails and tolerates invalid `id'.
+    static void Prefetch(VRefId id);
+
     // Re-address current VersionedRefWithId into `ptr'.
     // Always succeed even if this socket is failed.
     void ReAddress(VersionedRefWithIdUniquePtr<T>* ptr);
@@ -394,6 +401,17 @@ int VersionedRefWithId<T>::AddressFailedAsWell(
     return AddressImpl(id, true, ptr);
 }
 
+template<typename T>
+void VersionedRefWithId<T>::Prefetch(VRefId id) {
+    T* const t = address_resource(SlotOfVRefId<T>(id));
+    if (__builtin_expect(t != NULL, 1)) {
+        // Both the versioned ref touched by Address() and the hot fields
+        // right behind it.
+        __builtin_prefetch((const void*)t, 0/*read*/, 3/*high locality*/);
+        __builtin_prefetch((const char*)t + BAIDU_CACHELINE_SIZE, 0, 3);
+    }
+}
+
 template<typename T>
 int VersionedRefWithId<T>::AddressImpl(
     VRefId id, bool failed_as_well, VersionedRefWithIdUniquePtr<T>* ptr) {
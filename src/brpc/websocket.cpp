@@ -0,0 +1,396 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <string.h>                    // strcasecmp
+#include <algorithm>                   // std::min
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/base64.h"              // butil::Base64Encode
+#include "butil/sha1.h"                // butil::SHA1HashString
+#include "brpc/controller.h"
+#include "brpc/socket.h"
+#include "brpc/http_status_code.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/websocket.h"
+
+namespace brpc {
+
+DEFINE_int64(max_websocket_frame_size, 64 * 1024 * 1024,
+             "Reject websocket frames with payloads longer than so many bytes");
+BRPC_VALIDATE_GFLAG(max_websocket_frame_size, PositiveInteger);
+
+// Fixed GUID of RFC 6455 section 1.3.
+static const char* const WS_HANDSHAKE_GUID =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+std::string ComputeWebSocketAcceptKey(
+    const butil::StringPiece& sec_websocket_key) {
+    std::string to_hash = sec_websocket_key.as_string();
+    to_hash.append(WS_HANDSHAKE_GUID);
+    std::string accept_key;
+    butil::Base64Encode(butil::SHA1HashString(to_hash), &accept_key);
+    return accept_key;
+}
+
+// XOR `in' with the 4-byte `key' repeated over it into `out', walking the
+// backing blocks of `in' directly so that nothing is coalesced first. The
+// inner loop works on 8 bytes at a time (the key replicated to match the
+// running offset) which compilers turn into SIMD on x86_64/ARM.
+static void ApplyWebSocketMasking(const butil::IOBuf& in, const uint8_t key[4],
+                                  butil::IOBuf* out) {
+    size_t pos = 0;
+    const size_t nblocks = in.backing_block_num();
+    for (size_t i = 0; i < nblocks; ++i) {
+        const butil::StringPiece blk = in.backing_block(i);
+        const char* data = blk.data();
+        size_t left = blk.size();
+        while (left > 0) {
+            char buf[4096];
+            const size_t len = std::min(left, sizeof(buf));
+            uint8_t rep[8];
+            for (int j = 0; j < 8; ++j) {
+                rep[j] = key[(pos + j) & 3];
+            }
+            uint64_t wide_key;
+            memcpy(&wide_key, rep, 8);
+            size_t j = 0;
+            for (; j + 8 <= len; j += 8) {
+                uint64_t word;
+                memcpy(&word, data + j, 8);
+                word ^= wide_key;
+                memcpy(buf + j, &word, 8);
+            }
+            for (; j < len; ++j) {
+                buf[j] = data[j] ^ (char)key[(pos + j) & 3];
+            }
+            out->append(buf, len);
+            data += len;
+            left -= len;
+            pos += len;
+        }
+    }
+}
+
+inline bool is_valid_ws_opcode(uint8_t opcode) {
+    return opcode <= WS_OPCODE_BINARY ||
+        (opcode >= WS_OPCODE_CLOSE && opcode <= WS_OPCODE_PONG);
+}
+
+int ParseWebSocketFrame(butil::IOBuf* source, WebSocketFrame* frame) {
+    uint8_t hdr[14];  // maximal header: 2 + 8(extended length) + 4(mask key)
+    if (source->size() < 2) {
+        return 0;
+    }
+    source->copy_to(hdr, 2);
+    if (hdr[0] & 0x70) {  // RSV1-3, no extension is negotiated
+        return -1;
+    }
+    const uint8_t opcode = hdr[0] & 0x0F;
+    if (!is_valid_ws_opcode(opcode)) {
+        return -1;
+    }
+    const bool final = hdr[0] & 0x80;
+    const bool masked = hdr[1] & 0x80;
+    uint64_t payload_len = hdr[1] & 0x7F;
+    size_t header_len = 2;
+    if (payload_len == 126) {
+        header_len += 2;
+    } else if (payload_len == 127) {
+        header_len += 8;
+    }
+    if (masked) {
+        header_len += 4;
+    }
+    if (source->size() < header_len) {
+        return 0;
+    }
+    source->copy_to(hdr, header_len);
+    if (payload_len == 126) {
+        payload_len = ((uint64_t)hdr[2] << 8) | hdr[3];
+    } else if (payload_len == 127) {
+        payload_len = 0;
+        for (int i = 0; i < 8; ++i) {
+            payload_len = (payload_len << 8) | hdr[2 + i];
+        }
+        if (payload_len & 0x8000000000000000ULL) {  // MSB must be 0
+            return -1;
+        }
+    }
+    if (payload_len > (uint64_t)FLAGS_max_websocket_frame_size) {
+        return -1;
+    }
+    if (opcode >= WS_OPCODE_CLOSE && (payload_len > 125 || !final)) {
+        // Control frames must not be fragmented or carry big payloads.
+        return -1;
+    }
+    if (source->size() < header_len + payload_len) {
+        return 0;
+    }
+    source->pop_front(header_len);
+    frame->opcode = (WebSocketOpcode)opcode;
+    frame->final = final;
+    frame->payload.clear();
+    if (!masked) {
+        source->cutn(&frame->payload, payload_len);
+    } else {
+        butil::IOBuf masked_payload;
+        source->cutn(&masked_payload, payload_len);
+        ApplyWebSocketMasking(masked_payload, hdr + header_len - 4,
+                              &frame->payload);
+    }
+    return 1;
+}
+
+void SerializeWebSocketFrame(butil::IOBuf* out, const WebSocketFrame& frame,
+                             const uint32_t* mask_key) {
+    uint8_t hdr[14];
+    size_t n = 0;
+    hdr[n++] = (frame.final ? 0x80 : 0) | (frame.opcode & 0x0F);
+    const uint8_t mask_bit = (mask_key != NULL ? 0x80 : 0);
+    const uint64_t len = frame.payload.size();
+    if (len < 126) {
+        hdr[n++] = mask_bit | (uint8_t)len;
+    } else if (len <= 0xFFFF) {
+        hdr[n++] = mask_bit | 126;
+        hdr[n++] = (uint8_t)(len >> 8);
+        hdr[n++] = (uint8_t)len;
+    } else {
+        hdr[n++] = mask_bit | 127;
+        for (int i = 7; i >= 0; --i) {
+            hdr[n++] = (uint8_t)(len >> (8 * i));
+        }
+    }
+    if (mask_key == NULL) {
+        out->append(hdr, n);
+        out->append(frame.payload);  // referenced, not copied
+        return;
+    }
+    uint8_t key[4] = { (uint8_t)(*mask_key >> 24), (uint8_t)(*mask_key >> 16),
+                       (uint8_t)(*mask_key >> 8), (uint8_t)*mask_key };
+    memcpy(hdr + n, key, 4);
+    n += 4;
+    out->append(hdr, n);
+    ApplyWebSocketMasking(frame.payload, key, out);
+}
+
+WebSocketContext::WebSocketContext(std::shared_ptr<WebSocketHandler> handler)
+    : _handler(std::move(handler))
+    , _fragmented_opcode(WS_OPCODE_CONTINUATION)
+    , _in_fragmented_message(false)
+    , _peer_closed(false)
+    , _on_close_called(false) {
+}
+
+WebSocketContext::~WebSocketContext() {
+    CallOnCloseOnce();
+}
+
+void WebSocketContext::CallOnCloseOnce() {
+    if (!_on_close_called) {
+        _on_close_called = true;
+        if (_handler != NULL) {
+            _handler->OnClose();
+        }
+    }
+}
+
+ParseResult WebSocketContext::OnInput(butil::IOBuf* source, Socket* socket,
+                                      bool read_eof) {
+    if (read_eof) {
+        CallOnCloseOnce();
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    if (_peer_closed) {
+        // The closing handshake was already answered, ignore trailing bytes
+        // and let the released socket be recycled.
+        source->clear();
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    while (!source->empty()) {
+        WebSocketFrame frame;
+        const int rc = ParseWebSocketFrame(source, &frame);
+        if (rc == 0) {
+            break;
+        }
+        if (rc < 0) {
+            CallOnCloseOnce();
+            return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG,
+                                  "malformed websocket frame");
+        }
+        switch (frame.opcode) {
+        case WS_OPCODE_PING: {
+            WebSocketFrame pong;
+            pong.opcode = WS_OPCODE_PONG;
+            pong.payload.swap(frame.payload);
+            butil::IOBuf wbuf;
+            SerializeWebSocketFrame(&wbuf, pong);
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            socket->Write(&wbuf, &wopt);
+            break;
+        }
+        case WS_OPCODE_PONG:
+            // Unsolicited pongs are explicitly allowed and ignored.
+            break;
+        case WS_OPCODE_CLOSE: {
+            // Echo the close frame back and close the connection in the
+            // same way the 400-response path of ParseHttpMessage does:
+            // remove the additional reference so that the fd is closed
+            // right after the reply is flushed.
+            _peer_closed = true;
+            butil::IOBuf wbuf;
+            SerializeWebSocketFrame(&wbuf, frame);
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            socket->Write(&wbuf, &wopt);
+            CallOnCloseOnce();
+            socket->ReleaseAdditionalReference();
+            return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+        }
+        case WS_OPCODE_CONTINUATION:
+            if (!_in_fragmented_message) {
+                CallOnCloseOnce();
+                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG,
+                                      "websocket continuation without start");
+            }
+            _fragments.append(butil::IOBuf::Movable(frame.payload));
+            if (frame.final) {
+                WebSocketFrame msg;
+                msg.opcode = _fragmented_opcode;
+                msg.payload.swap(_fragments);
+                _in_fragmented_message = false;
+                _handler->OnMessage(msg);
+            }
+            break;
+        case WS_OPCODE_TEXT:
+        case WS_OPCODE_BINARY:
+            if (_in_fragmented_message) {
+                CallOnCloseOnce();
+                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG,
+                                      "websocket frame interleaved with a"
+                                      " fragmented message");
+            }
+            if (frame.final) {
+                _handler->OnMessage(frame);
+            } else {
+                _in_fragmented_message = true;
+                _fragmented_opcode = frame.opcode;
+                _fragments.swap(frame.payload);
+            }
+            break;
+        }
+    }
+    return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+}
+
+WebSocketConnection::WebSocketConnection(
+    butil::intrusive_ptr<ProgressiveAttachment> pa)
+    : _pa(std::move(pa)) {
+}
+
+butil::intrusive_ptr<WebSocketConnection> WebSocketConnection::Accept(
+    Controller* cntl, std::shared_ptr<WebSocketHandler> handler) {
+    if (cntl == NULL || handler == NULL) {
+        LOG(ERROR) << "Param[cntl] or Param[handler] is NULL";
+        return NULL;
+    }
+    const HttpHeader& req = cntl->http_request();
+    HttpHeader& res = cntl->http_response();
+    if (req.before_http_1_1() || req.major_version() >= 2) {
+        // RFC 6455 requires at least HTTP/1.1 (RFC 8441 maps the handshake
+        // onto h2 differently and is not supported).
+        res.set_status_code(HTTP_STATUS_BAD_REQUEST);
+        return NULL;
+    }
+    const std::string* upgrade = req.GetHeader("Upgrade");
+    const std::string* conn = req.GetHeader("Connection");
+    if (req.method() != HTTP_METHOD_GET ||
+        upgrade == NULL || strcasecmp(upgrade->c_str(), "websocket") != 0 ||
+        conn == NULL || strcasestr(conn->c_str(), "upgrade") == NULL) {
+        res.set_status_code(HTTP_STATUS_BAD_REQUEST);
+        return NULL;
+    }
+    const std::string* version = req.GetHeader("Sec-WebSocket-Version");
+    if (version == NULL || *version != "13") {
+        // 426 Upgrade Required, with the version we do speak.
+        res.set_status_code(426);
+        res.SetHeader("Sec-WebSocket-Version", "13");
+        return NULL;
+    }
+    const std::string* key = req.GetHeader("Sec-WebSocket-Key");
+    if (key == NULL || key->empty()) {
+        res.set_status_code(HTTP_STATUS_BAD_REQUEST);
+        return NULL;
+    }
+    res.set_status_code(HTTP_STATUS_SWITCHING_PROTOCOLS);
+    res.SetHeader("Upgrade", "websocket");
+    res.SetHeader("Connection", "Upgrade");
+    res.SetHeader("Sec-WebSocket-Accept", ComputeWebSocketAcceptKey(*key));
+
+    butil::intrusive_ptr<ProgressiveAttachment> pa =
+        cntl->CreateProgressiveAttachment(FORCE_STOP);
+    if (pa == NULL) {
+        res.set_status_code(HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return NULL;
+    }
+    WebSocketContext* ctx =
+        new (std::nothrow) WebSocketContext(std::move(handler));
+    if (ctx == NULL) {
+        LOG(FATAL) << "Fail to new WebSocketContext";
+        res.set_status_code(HTTP_STATUS_INTERNAL_SERVER_ERROR);
+        return NULL;
+    }
+    // The peer must not send frames before seeing our 101 which is written
+    // after the service method returns, so installing the context here does
+    // not race with parsing.
+    pa->_httpsock->ResetWebSocketContext(ctx);
+    return butil::intrusive_ptr<WebSocketConnection>(
+        new (std::nothrow) WebSocketConnection(std::move(pa)));
+}
+
+int WebSocketConnection::SendFrame(WebSocketOpcode opcode,
+                                   const butil::IOBuf& payload) {
+    WebSocketFrame frame;
+    frame.opcode = opcode;
+    frame.payload = payload;
+    butil::IOBuf buf;
+    SerializeWebSocketFrame(&buf, frame);
+    return _pa->Write(buf);
+}
+
+int WebSocketConnection::SendText(const butil::IOBuf& message) {
+    return SendFrame(WS_OPCODE_TEXT, message);
+}
+
+int WebSocketConnection::SendBinary(const butil::IOBuf& message) {
+    return SendFrame(WS_OPCODE_BINARY, message);
+}
+
+int WebSocketConnection::SendPing(const butil::IOBuf& payload) {
+    return SendFrame(WS_OPCODE_PING, payload);
+}
+
+int WebSocketConnection::SendClose(uint16_t status_code) {
+    butil::IOBuf payload;
+    const uint8_t code[2] = { (uint8_t)(status_code >> 8),
+                              (uint8_t)status_code };
+    payload.append(code, 2);
+    return SendFrame(WS_OPCODE_CLOSE, payload);
+}
+
+} // namespace brpc
@@ -0,0 +1,177 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_WEBSOCKET_H
+#define BRPC_WEBSOCKET_H
+
+#include <memory>
+#include "butil/iobuf.h"
+#include "butil/strings/string_piece.h"
+#include "butil/intrusive_ptr.hpp"
+#include "brpc/parse_result.h"
+#include "brpc/progressive_attachment.h"
+#include "brpc/shared_object.h"
+
+// Server-side WebSocket (RFC 6455) on top of the http protocol. A http
+// service accepts the upgrade request by calling WebSocketConnection::Accept
+// inside its method, after which the connection stops being http: incoming
+// frames are parsed by ParseHttpMessage and dispatched to the user-provided
+// WebSocketHandler, outgoing frames are pushed at any time through the
+// returned WebSocketConnection which reuses ProgressiveAttachment to own
+// the socket. Example:
+//
+//   void EchoService::default_method(..., Controller* cntl, ...) {
+//       brpc::ClosureGuard done_guard(done);
+//       auto handler = std::make_shared<MyHandler>();
+//       handler->conn = brpc::WebSocketConnection::Accept(cntl, handler);
+//       // response was filled by Accept(), just return.
+//   }
+
+namespace brpc {
+
+class Controller;
+class Socket;
+
+enum WebSocketOpcode {
+    WS_OPCODE_CONTINUATION = 0x0,
+    WS_OPCODE_TEXT         = 0x1,
+    WS_OPCODE_BINARY       = 0x2,
+    WS_OPCODE_CLOSE        = 0x8,
+    WS_OPCODE_PING         = 0x9,
+    WS_OPCODE_PONG         = 0xA
+};
+
+struct WebSocketFrame {
+    WebSocketFrame() : opcode(WS_OPCODE_BINARY), final(true) {}
+
+    WebSocketOpcode opcode;
+    bool final;
+    butil::IOBuf payload;
+};
+
+// Cut one intact frame off the front of `source' into `frame'. The payload
+// of an unmasked frame is referenced rather than copied; a masked payload
+// is unmasked with a word-wide XOR while being moved into `frame'.
+// Returns 1 when a frame was parsed, 0 when `source' does not contain an
+// intact frame yet (`source' is left untouched), -1 when the input is
+// malformed (reserved bits or opcodes, oversized or non-final control
+// frames, frames longer than -max_websocket_frame_size).
+int ParseWebSocketFrame(butil::IOBuf* source, WebSocketFrame* frame);
+
+// Append `frame' to `out'. An unmasked payload (servers never mask) is
+// appended by reference without copying. When `mask_key' is non-NULL the
+// payload is masked with its 4 bytes (big-endian) as clients must do.
+void SerializeWebSocketFrame(butil::IOBuf* out, const WebSocketFrame& frame,
+                             const uint32_t* mask_key = NULL);
+
+// The Sec-WebSocket-Accept value proving to the client that its
+// Sec-WebSocket-Key was seen, as defined in RFC 6455 section 4.2.2.
+std::string ComputeWebSocketAcceptKey(const butil::StringPiece& sec_websocket_key);
+
+// Implemented by users to consume frames arriving on an upgraded
+// connection.
+class WebSocketHandler {
+public:
+    virtual ~WebSocketHandler() {}
+
+    // Called with each complete data message. Fragmented messages are
+    // reassembled before delivery, thus `frame.opcode' is WS_OPCODE_TEXT or
+    // WS_OPCODE_BINARY and `frame.final' is always true. Runs in the
+    // parsing thread of the connection and blocks further reads from it:
+    // start a bthread for anything heavy.
+    virtual void OnMessage(const WebSocketFrame& frame) = 0;
+
+    // Called at most once, when the peer sends a close frame, shuts down
+    // its end, or sends malformed input. Failures that do not come through
+    // reading (e.g. broken writes) are observable through
+    // WebSocketConnection::NotifyOnStopped instead.
+    virtual void OnClose() {}
+};
+
+// Parses the bytes following the 101 response. Owned by the upgraded
+// Socket and driven by ParseHttpMessage; not used directly.
+class WebSocketContext {
+public:
+    explicit WebSocketContext(std::shared_ptr<WebSocketHandler> handler);
+    ~WebSocketContext();
+
+    // Consume frames from `source' with the contract of a protocol parser:
+    // PARSE_ERROR_NOT_ENOUGH_DATA after all intact frames were dispatched,
+    // PARSE_ERROR_ABSOLUTELY_WRONG on malformed input.
+    ParseResult OnInput(butil::IOBuf* source, Socket* socket, bool read_eof);
+
+private:
+    void CallOnCloseOnce();
+
+    std::shared_ptr<WebSocketHandler> _handler;
+    butil::IOBuf _fragments;       // payloads of an unfinished message
+    WebSocketOpcode _fragmented_opcode;
+    bool _in_fragmented_message;
+    bool _peer_closed;
+    bool _on_close_called;
+};
+
+// The server end of an upgraded connection, handed to user code for
+// pushing frames. Thread-safe and kept alive by intrusive_ptr; the
+// underlying socket is owned the same way ProgressiveAttachment owns it
+// and is closed when the last reference goes away.
+class WebSocketConnection : public SharedObject {
+public:
+    // Validate the upgrade request in `cntl', fill the 101 response
+    // (including Sec-WebSocket-Accept) and take over the connection so that
+    // incoming frames are delivered to `handler'. On an invalid request the
+    // response is filled with a proper error status and NULL is returned.
+    // Must be called from a http service method before `done' runs; the
+    // 101 response is still written by the server as usual, frames pushed
+    // earlier are queued after it.
+    static butil::intrusive_ptr<WebSocketConnection> Accept(
+        Controller* cntl, std::shared_ptr<WebSocketHandler> handler);
+
+    // Push one message/control frame to the peer ASAP.
+    // Returns 0 on success, -1 otherwise and errno is set (same errnos as
+    // Socket.Write).
+    int SendText(const butil::IOBuf& message);
+    int SendBinary(const butil::IOBuf& message);
+    int SendPing(const butil::IOBuf& payload);
+
+    // Send a close frame with `status_code' (RFC 6455 section 7.4).
+    // The TCP connection is closed when the last intrusive_ptr to this
+    // object is released.
+    int SendClose(uint16_t status_code = 1000/*normal closure*/);
+
+    // Get ip/port of peer/self.
+    butil::EndPoint remote_side() const { return _pa->remote_side(); }
+    butil::EndPoint local_side() const { return _pa->local_side(); }
+
+    // [Not thread-safe and can only be called once]
+    // Run the callback when the underlying connection is broken.
+    void NotifyOnStopped(google::protobuf::Closure* callback)
+    { _pa->NotifyOnStopped(callback); }
+
+private:
+    explicit WebSocketConnection(butil::intrusive_ptr<ProgressiveAttachment> pa);
+
+    int SendFrame(WebSocketOpcode opcode, const butil::IOBuf& payload);
+
+    butil::intrusive_ptr<ProgressiveAttachment> _pa;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_WEBSOCKET_H
@@ -546,6 +546,14 @@ int bthread_yield(void) {
     return sched_yield();
 }
 
+int bthread_yield_if_preempted(void) {
+    bthread::TaskGroup* g = bthread::BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
+    if (NULL != g && !g->is_current_pthread_task()) {
+        return bthread::TaskGroup::yield_if_preempted(&g) ? 1 : 0;
+    }
+    return 0;
+}
+
 int bthread_set_worker_startfn(void (*start_fn)()) {
     if (start_fn == NULL) {
         return EINVAL;
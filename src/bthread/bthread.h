@@ -165,11 +165,18 @@ extern int bthread_getconcurrency_by_tag(bthread_tag_t tag);
 // Set number of worker pthreads to `num' for specified tag
 extern int bthread_setconcurrency_by_tag(int num, bthread_tag_t tag);
 
-// Yield processor to another bthread. 
-// Notice that current implementation is not fair, which means that 
+// Yield processor to another bthread.
+// Notice that current implementation is not fair, which means that
 // even if bthread_yield() is called, suspended threads may still starve.
 extern int bthread_yield(void);
 
+// Yield processor iff the preemption watchdog flagged the current bthread
+// for occupying its worker beyond --bthread_worker_preempt_slice_ms.
+// Nearly free when not flagged; sprinkle into long computational loops as
+// a safe preemption point.
+// Returns 1 if the caller yielded, 0 otherwise.
+extern int bthread_yield_if_preempted(void);
+
 // Suspend current thread for at least `microseconds'
 // Interruptible by bthread_interrupt().
 extern int bthread_usleep(uint64_t microseconds);
@@ -19,6 +19,7 @@
 
 // Date: Tue Jul 22 17:30:12 CST 2014
 
+#include <vector>
 #include "butil/atomicops.h"                // butil::atomic
 #include "butil/scoped_lock.h"              // BAIDU_SCOPED_LOCK
 #include "butil/macros.h"
@@ -37,6 +38,7 @@
 #include "bthread/timer_thread.h"
 #include "bthread/butex.h"
 #include "bthread/mutex.h"
+#include "bthread/offcpu_sampler.h"
 
 // This file implements butex.h
 // Provides futex-like semantics which is sequenced wait and wake operations
@@ -302,6 +304,30 @@ inline void run_in_local_task_group(TaskGroup* g, TaskMeta* next_meta, bool nosi
     }
 }
 
+// Chains of woken bthreads grouped by their target TaskGroup, so that a
+// broadcast locks and signals each remote run queue once per group rather
+// than once per waiter. The number of distinct groups is bounded by the
+// number of workers, a linear scan is cheaper than hashing here.
+typedef std::vector<std::pair<TaskGroup*, std::vector<TaskMeta*> > > WakeChains;
+
+inline void append_to_wake_chain(WakeChains& chains, TaskGroup* g,
+                                 TaskMeta* meta) {
+    for (size_t i = 0; i < chains.size(); ++i) {
+        if (chains[i].first == g) {
+            chains[i].second.push_back(meta);
+            return;
+        }
+    }
+    chains.push_back(std::make_pair(g, std::vector<TaskMeta*>(1, meta)));
+}
+
+inline void run_wake_chains(WakeChains& chains) {
+    for (size_t i = 0; i < chains.size(); ++i) {
+        chains[i].first->ready_to_run_remote_batch(
+            chains[i].second.data(), chains[i].second.size(), true/*nosignal*/);
+    }
+}
+
 int butex_wake(void* arg, bool nosignal) {
     Butex* b = container_of(static_cast<butil::atomic<int>*>(arg), Butex, value);
     ButexWaiter* front = NULL;
@@ -367,6 +393,7 @@ int butex_wake_n(void* arg, size_t n, bool nosignal) {
     next->RemoveFromList();
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
+    WakeChains wake_chains;
     while (!bthread_waiters.empty()) {
         // pop reversely
         ButexBthreadWaiter* w = static_cast<ButexBthreadWaiter*>(
@@ -374,10 +401,15 @@ int butex_wake_n(void* arg, size_t n, bool nosignal) {
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
         auto g = get_task_group(w->control, w->tag);
-        g->ready_to_run_general(w->task_meta, true);
+        if (g == tls_task_group) {
+            g->ready_to_run(w->task_meta, true);
+        } else {
+            append_to_wake_chain(wake_chains, g, w->task_meta);
+        }
         nwakeups[g->tag()] = g;
         ++nwakeup;
     }
+    run_wake_chains(wake_chains);
     for (auto it = nwakeups.begin(); it != nwakeups.end(); ++it) {
         auto g = it->second;
         if (!check_nosignal(nosignal, g->tag())) {
@@ -441,16 +473,22 @@ int butex_wake_except(void* arg, bthread_t excluded_bthread) {
     }
     butil::FlatMap<bthread_tag_t, TaskGroup*> nwakeups;
     nwakeups.init(FLAGS_task_group_ntags);
+    WakeChains wake_chains;
     do {
         // pop reversely
         ButexBthreadWaiter* w = static_cast<ButexBthreadWaiter*>(bthread_waiters.tail()->value());
         w->RemoveFromList();
         unsleep_if_necessary(w, get_global_timer_thread());
         auto g = get_task_group(w->control, w->tag);
-        g->ready_to_run_general(w->task_meta, true);
+        if (g == tls_task_group) {
+            g->ready_to_run(w->task_meta, true);
+        } else {
+            append_to_wake_chain(wake_chains, g, w->task_meta);
+        }
         nwakeups[g->tag()] = g;
         ++nwakeup;
     } while (!bthread_waiters.empty());
+    run_wake_chains(wake_chains);
     for (auto it = nwakeups.begin(); it != nwakeups.end(); ++it) {
         auto g = it->second;
         g->flush_nosignal_tasks_general();
@@ -674,8 +712,20 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime, bool prep
         // Sometimes we may take actions immediately after unmatched butex,
         // this fence makes sure that we see changes before changing butex.
         butil::atomic_thread_fence(butil::memory_order_acquire);
+        // A preemption-safe point for bthreads spinning on butexes(e.g.
+        // repeated trylocks): give the worker back when the watchdog
+        // flagged this task, see --bthread_worker_preempt_slice_ms.
+        // errno survives the switch since sched_to saves/restores it.
+        TaskGroup* g = tls_task_group;
+        if (NULL != g) {
+            TaskGroup::yield_if_preempted(&g);
+        }
         return -1;
     }
+    // Samples the time blocked here into the off-CPU profile when picked,
+    // see -bthread_offcpu_sample_ratio. Placed after the fast path above so
+    // that non-blocking calls are never sampled.
+    OffCpuSampleScope offcpu_scope;
     TaskGroup* g = tls_task_group;
     if (NULL == g || g->is_current_pthread_task()) {
         return butex_wait_from_pthread(g, b, expected_value, abstime, prepend);
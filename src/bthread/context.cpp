@@ -348,14 +348,14 @@ __asm (
 "    pushq  %r13  \n"
 "    pushq  %r12  \n"
 "    leaq  -0x8(%rsp), %rsp\n"
-"    cmp  $0, %rcx\n"
+"    test  $0x1, %rcx\n"
 "    je  1f\n"
 "    stmxcsr  (%rsp)\n"
 "    fnstcw   0x4(%rsp)\n"
 "1:\n"
 "    movq  %rsp, (%rdi)\n"
 "    movq  %rsi, %rsp\n"
-"    cmp  $0, %rcx\n"
+"    test  $0x2, %rcx\n"
 "    je  2f\n"
 "    ldmxcsr  (%rsp)\n"
 "    fldcw  0x4(%rsp)\n"
@@ -80,9 +80,13 @@ typedef void* bthread_fcontext_t;
 extern "C"{
 #endif
 
+// `preserve_fpu' historically was a single bool. On linux x86-64 it is a
+// bit mask now: bit 0 saves the FP control words of the outgoing context,
+// bit 1 restores those of the incoming one. Other platforms still treat
+// any non-zero value as "save and restore both".
 intptr_t BTHREAD_CONTEXT_CALL_CONVENTION
 bthread_jump_fcontext(bthread_fcontext_t * ofc, bthread_fcontext_t nfc,
-                      intptr_t vp, bool preserve_fpu = false);
+                      intptr_t vp, intptr_t preserve_fpu = 0);
 bthread_fcontext_t BTHREAD_CONTEXT_CALL_CONVENTION
 bthread_make_fcontext(void* sp, size_t size, void (* fn)( intptr_t));
 
@@ -104,6 +104,44 @@ void ExecutionQueueBase::start_execute(TaskNode* node) {
         }
     }
 
+    _start_execution(node);
+}
+
+void ExecutionQueueBase::start_execute_batch(
+        TaskNode* head, TaskNode* tail, size_t num_high_priority) {
+    if (num_high_priority > 0) {
+        // See the note in start_execute about ordering.
+        _high_priority_tasks.fetch_add(
+                num_high_priority, butil::memory_order_relaxed);
+    }
+    tail->next = TaskNode::UNCONNECTED;
+    TaskNode* const prev_head = _head.exchange(head, butil::memory_order_release);
+    if (prev_head != NULL) {
+        tail->next = prev_head;
+        return;
+    }
+    // Got the right to execute. Reverse the chain into submission order by
+    // ourselves (the reversal normally done in _more_tasks) and start the
+    // consumer from the earliest task. _head still refers to |head| which
+    // would be the old_head of the next _more_tasks.
+    tail->next = NULL;
+    TaskNode* prev = NULL;
+    TaskNode* p = head;
+    do {
+        TaskNode* const saved_next = p->next;
+        p->next = prev;
+        prev = p;
+        p = saved_next;
+    } while (p != NULL);
+    CHECK_EQ(prev, tail);
+    CHECK(head->next == NULL);
+    tail->q = this;
+
+    get_execq_vars()->execq_active_count << 1;
+    _start_execution(tail);
+}
+
+void ExecutionQueueBase::_start_execution(TaskNode* node) {
     if (nullptr == _options.executor) {
         if (_options.use_pthread) {
             if (_pthread_started) {
@@ -426,6 +464,17 @@ inline bool TaskIteratorBase::should_break_for_high_priority_tasks() {
     return false;
 }
 
+size_t TaskIteratorBase::num_ready() const {
+    // All the nodes reachable from _cur_node have been connected (ending
+    // with NULL) before the execution started, walking them is safe.
+    size_t n = 0;
+    for (const TaskNode* p = _cur_node; p != NULL && !p->stop_task;
+         p = p->next) {
+        ++n;
+    }
+    return n;
+}
+
 void TaskIteratorBase::operator++() {
     if (!(*this)) {
         return;
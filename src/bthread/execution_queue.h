@@ -45,6 +45,12 @@ public:
     // after.
     bool is_queue_stopped() const { return _is_stopped; }
     explicit operator bool() const;
+    // Number of tasks already linked into the queue and reachable from this
+    // iterator, including the current one. It's merely a hint for consumers
+    // that want to reserve buffers before iterating: more tasks might be
+    // linked during the iteration, and tasks of the other priority class are
+    // counted in although this iterator skips them.
+    size_t num_ready() const;
 protected:
     TaskIteratorBase(TaskNode* head, ExecutionQueueBase* queue,
                      bool is_stopped, bool high_priority)
@@ -217,6 +223,22 @@ int execution_queue_execute(ExecutionQueueId<T> id,
                             const TaskOptions* options,
                             TaskHandle* handle);
 
+// Thread-safe and Wait-free.
+// Execute a batch of |n| tasks which are linked into the queue with a single
+// atomic exchange, so that producers amortize the synchronization cost (and
+// the possible bthread creation) across the whole batch. Tasks are executed
+// in the order of the array. All tasks share |options|;
+// TaskOptions.in_place_if_possible is ignored for batches.
+// Returns 0 on success, errno otherwise. On error none of the tasks is
+// queued.
+template <typename T>
+int execution_queue_execute_batch(ExecutionQueueId<T> id,
+                                  const T* tasks, size_t n);
+template <typename T>
+int execution_queue_execute_batch(ExecutionQueueId<T> id,
+                                  const T* tasks, size_t n,
+                                  const TaskOptions* options);
+
 // [Thread safe and ABA free] Cancel the corresponding task.
 // Returns:
 //  -1: The task was executed or h is an invalid handle
@@ -194,6 +194,13 @@ protected:
                       void* meta, void* type_specific_function);
     static scoped_ptr_t address(uint64_t id) WARN_UNUSED_RESULT;
     void start_execute(TaskNode* node);
+    // Link a caller-built chain of tasks into the queue with a single atomic
+    // exchange. |head| is the latest task and |tail| the earliest one, i.e.
+    // the chain is linked from head to tail via `next' in reverse submission
+    // order, just like nodes pushed one by one. |num_high_priority| is the
+    // number of high-priority tasks in the chain.
+    void start_execute_batch(TaskNode* head, TaskNode* tail,
+                             size_t num_high_priority);
     TaskNode* allocate_node();
     void return_task_node(TaskNode* node);
 
@@ -205,6 +212,9 @@ private:
         dereference();
     }
     void _on_recycle();
+    // Start the consumer (bthread/pthread/executor) from |node| which must
+    // have got the right to execute.
+    void _start_execution(TaskNode* node);
     int _execute(TaskNode* head, bool high_priority, int* niterated);
     static void* _execute_tasks(void* arg);
     static void* _execute_tasks_pthread(void* arg);
@@ -339,6 +349,60 @@ public:
         start_execute(node);
         return 0;
     }
+
+    int execute_batch(const T* tasks, size_t n, const TaskOptions* options) {
+        if (stopped()) {
+            return EINVAL;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        TaskOptions opt;
+        if (options) {
+            opt = *options;
+        }
+        // Build the chain in reverse submission order (latest first) so that
+        // the reversal in _more_tasks restores the order of the array.
+        TaskNode* chain_head = NULL;  // latest task
+        TaskNode* chain_tail = NULL;  // earliest task
+        for (size_t i = 0; i < n; ++i) {
+            TaskNode* node = allocate_node();
+            void* mem = NULL;
+            if (BAIDU_LIKELY(node != NULL)) {
+                mem = allocator::allocate(node);
+                if (BAIDU_UNLIKELY(!mem)) {
+                    return_task_node(node);
+                    node = NULL;
+                }
+            }
+            if (BAIDU_UNLIKELY(node == NULL)) {
+                // Destroy the tasks built so far, none of them is visible to
+                // the consumer yet.
+                while (chain_head != NULL) {
+                    TaskNode* const next = chain_head->next;
+                    chain_head->status = TaskNode::EXECUTED;
+                    chain_head->iterated = true;
+                    return_task_node(chain_head);
+                    chain_head = next;
+                }
+                return ENOMEM;
+            }
+            new (mem) T(tasks[i]);
+            node->stop_task = false;
+            node->status = TaskNode::UNEXECUTED;
+            node->iterated = false;
+            node->high_priority = opt.high_priority;
+            node->in_place = false;
+            node->next = chain_head;
+            chain_head = node;
+            if (chain_tail == NULL) {
+                chain_tail = node;
+            }
+        }
+        start_execute_batch(chain_head, chain_tail,
+                            opt.high_priority ? n : 0);
+        return 0;
+    }
 };
 
 inline ExecutionQueueOptions::ExecutionQueueOptions()
@@ -416,6 +480,25 @@ inline int execution_queue_execute(ExecutionQueueId<T> id,
     }
 }
 
+template <typename T>
+inline int execution_queue_execute_batch(ExecutionQueueId<T> id,
+                                         const T* tasks, size_t n) {
+    return execution_queue_execute_batch(id, tasks, n, NULL);
+}
+
+template <typename T>
+inline int execution_queue_execute_batch(ExecutionQueueId<T> id,
+                                         const T* tasks, size_t n,
+                                         const TaskOptions* options) {
+    typename ExecutionQueue<T>::scoped_ptr_t
+        ptr = ExecutionQueue<T>::address(id);
+    if (ptr != NULL) {
+        return ptr->execute_batch(tasks, n, options);
+    } else {
+        return EINVAL;
+    }
+}
+
 template <typename T>
 inline int execution_queue_stop(ExecutionQueueId<T> id) {
     typename ExecutionQueue<T>::scoped_ptr_t 
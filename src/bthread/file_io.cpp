@@ -0,0 +1,199 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// bthread - An M:N threading library to make applications more concurrent.
+
+// Offload blocking file I/O of bthreads onto dedicated pthreads.
+//
+// Unlike network fds which bthread_fd_* make non-blocking, regular file
+// reads/writes block the calling pthread no matter what, stalling every
+// bthread scheduled on that worker. bthread_pread/bthread_pwrite hand the
+// syscall to a small pool of plain pthreads and suspend only the calling
+// bthread on a butex until the I/O pthread posts the result.
+// The request node lives on the caller's stack(the caller blocks for the
+// whole duration anyway), so submission allocates nothing but the butex.
+// An io_uring backend could replace the pool on kernels that support it;
+// the handoff and wakeup protocol here would stay the same.
+
+#include <unistd.h>                        // pread, pwrite
+#include <pthread.h>
+#include <errno.h>
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/threading/platform_thread.h"
+#include <gflags/gflags.h>
+#include "bthread/butex.h"                 // butex_*
+#include "bthread/task_group.h"            // tls_task_group
+#include "bthread/unstable.h"
+
+DEFINE_int32(bthread_file_io_threads, 4,
+             "Number of dedicated pthreads running the file I/O submitted "
+             "by bthread_pread/bthread_pwrite");
+
+namespace bthread {
+
+extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
+
+struct FileIORequest {
+    FileIORequest* next;
+    int fd;
+    bool is_write;
+    void* buf;
+    size_t count;
+    off_t offset;
+    ssize_t result;
+    int saved_errno;
+    // 0 until the I/O pthread finished the request.
+    butil::atomic<int>* done_butex;
+};
+
+// Requests are taken in FIFO order under a plain mutex: compared to the
+// milliseconds a disk access takes, queueing cost is irrelevant.
+static pthread_mutex_t g_file_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_file_io_cond = PTHREAD_COND_INITIALIZER;
+static FileIORequest* g_file_io_head = NULL;
+static FileIORequest* g_file_io_tail = NULL;
+static pthread_once_t g_file_io_once = PTHREAD_ONCE_INIT;
+static bool g_file_io_started = false;
+
+static ssize_t run_file_io(FileIORequest* req) {
+    ssize_t nr;
+    do {
+        if (req->is_write) {
+            nr = pwrite(req->fd, req->buf, req->count, req->offset);
+        } else {
+            nr = pread(req->fd, req->buf, req->count, req->offset);
+        }
+    } while (nr < 0 && errno == EINTR);
+    return nr;
+}
+
+static void* file_io_thread(void* arg) {
+    butil::PlatformThread::SetName(
+        butil::string_printf("brpc_fio:%d", (int)(intptr_t)arg).c_str());
+    while (true) {
+        pthread_mutex_lock(&g_file_io_mutex);
+        while (NULL == g_file_io_head) {
+            pthread_cond_wait(&g_file_io_cond, &g_file_io_mutex);
+        }
+        FileIORequest* req = g_file_io_head;
+        g_file_io_head = req->next;
+        if (NULL == g_file_io_head) {
+            g_file_io_tail = NULL;
+        }
+        pthread_mutex_unlock(&g_file_io_mutex);
+
+        req->result = run_file_io(req);
+        req->saved_errno = errno;
+        // `req' lives on the submitter's stack and is invalid right after
+        // the wakeup, don't touch it past this point.
+        butil::atomic<int>* done = req->done_butex;
+        done->store(1, butil::memory_order_release);
+        butex_wake(done);
+    }
+    return NULL;
+}
+
+static void start_file_io_threads() {
+    int nthread = FLAGS_bthread_file_io_threads;
+    if (nthread < 1) {
+        nthread = 1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int started = 0;
+    for (int i = 0; i < nthread; ++i) {
+        pthread_t th;
+        if (pthread_create(&th, &attr, file_io_thread,
+                           (void*)(intptr_t)i) == 0) {
+            ++started;
+        } else {
+            PLOG(ERROR) << "Fail to create file_io_thread[" << i << "]";
+        }
+    }
+    pthread_attr_destroy(&attr);
+    g_file_io_started = (started > 0);
+}
+
+static ssize_t submit_file_io(int fd, bool is_write, void* buf, size_t count,
+                              off_t offset) {
+    FileIORequest req;
+    req.next = NULL;
+    req.fd = fd;
+    req.is_write = is_write;
+    req.buf = buf;
+    req.count = count;
+    req.offset = offset;
+    req.result = -1;
+    req.saved_errno = 0;
+
+    if (NULL == tls_task_group) {
+        // Already on a plain pthread, blocking it is fine.
+        const ssize_t nr = run_file_io(&req);
+        return nr;
+    }
+    pthread_once(&g_file_io_once, start_file_io_threads);
+    if (!g_file_io_started) {
+        // No I/O pthread came up, degrade to blocking the worker.
+        return run_file_io(&req);
+    }
+
+    butil::atomic<int>* done = butex_create_checked<butil::atomic<int> >();
+    if (NULL == done) {
+        errno = ENOMEM;
+        return -1;
+    }
+    done->store(0, butil::memory_order_relaxed);
+    req.done_butex = done;
+
+    pthread_mutex_lock(&g_file_io_mutex);
+    if (NULL == g_file_io_tail) {
+        g_file_io_head = &req;
+    } else {
+        g_file_io_tail->next = &req;
+    }
+    g_file_io_tail = &req;
+    pthread_cond_signal(&g_file_io_cond);
+    pthread_mutex_unlock(&g_file_io_mutex);
+
+    // Only the calling bthread is suspended, the worker pthread goes on
+    // running other bthreads. No timeout/interruption: the request holds
+    // stack memory of this bthread and must be completed first.
+    while (done->load(butil::memory_order_acquire) != 1) {
+        butex_wait(done, 0, NULL);
+    }
+    butex_destroy(done);
+    errno = req.saved_errno;
+    return req.result;
+}
+
+}  // namespace bthread
+
+__BEGIN_DECLS
+
+ssize_t bthread_pread(int fd, void* buf, size_t count, off_t offset) {
+    return bthread::submit_file_io(fd, false, buf, count, offset);
+}
+
+ssize_t bthread_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    return bthread::submit_file_io(fd, true, const_cast<void*>(buf), count,
+                                   offset);
+}
+
+__END_DECLS
@@ -20,11 +20,14 @@
 // Date: Sun Aug  3 12:46:15 CST 2014
 
 #include <deque>
+#include "butil/atomicops.h"
 #include "butil/logging.h"
 #include "bthread/butex.h"                       // butex_*
 #include "bthread/mutex.h"
 #include "bthread/list_of_abafree_id.h"
+#include "bthread/processor.h"                   // cpu_relax
 #include "butil/resource_pool.h"
+#include "butil/time.h"
 #include "bthread/bthread.h"
 
 namespace bthread {
@@ -167,6 +170,13 @@ inline uint32_t get_version(bthread_id_t id) {
     return (uint32_t)(id.value & 0xFFFFFFFFul);
 }
 
+// The wait-free fast paths in bthread_id_lock/unlock CAS the version value
+// without holding Id.mutex, thus every mutation of the value - even the
+// ones under the mutex - must be atomic to coexist with them.
+inline butil::atomic<uint32_t>* id_versions(uint32_t* butex_value) {
+    return reinterpret_cast<butil::atomic<uint32_t>*>(butex_value);
+}
+
 inline bool id_exists_with_true_negatives(bthread_id_t id) {
     Id* const meta = address_resource(get_slot(id));
     if (meta == NULL) {
@@ -334,15 +344,17 @@ static int id_create_impl(
         meta->on_error2 = on_error2;
         CHECK(meta->pending_q.empty());
         uint32_t* butex = meta->butex;
-        if (0 == *butex || *butex + ID_MAX_RANGE + 2 < *butex) {
+        uint32_t ver = id_versions(butex)->load(butil::memory_order_relaxed);
+        if (0 == ver || ver + ID_MAX_RANGE + 2 < ver) {
             // Skip 0 so that bthread_id_t is never 0
             // avoid overflow to make comparisons simpler.
-            *butex = 1;
+            ver = 1;
+            id_versions(butex)->store(ver, butil::memory_order_relaxed);
         }
-        *meta->join_butex = *butex;
-        meta->first_ver = *butex;
-        meta->locked_ver = *butex + 1;
-        *id = make_id(*butex, slot);
+        *meta->join_butex = ver;
+        meta->first_ver = ver;
+        meta->locked_ver = ver + 1;
+        *id = make_id(ver, slot);
         return 0;
     }
     return ENOMEM;
@@ -367,15 +379,17 @@ static int id_create_ranged_impl(
         meta->on_error2 = on_error2;
         CHECK(meta->pending_q.empty());
         uint32_t* butex = meta->butex;
-        if (0 == *butex || *butex + ID_MAX_RANGE + 2 < *butex) {
+        uint32_t ver = id_versions(butex)->load(butil::memory_order_relaxed);
+        if (0 == ver || ver + ID_MAX_RANGE + 2 < ver) {
             // Skip 0 so that bthread_id_t is never 0
             // avoid overflow to make comparisons simpler.
-            *butex = 1;
+            ver = 1;
+            id_versions(butex)->store(ver, butil::memory_order_relaxed);
         }
-        *meta->join_butex = *butex;
-        meta->first_ver = *butex;
-        meta->locked_ver = *butex + range;
-        *id = make_id(*butex, slot);
+        *meta->join_butex = ver;
+        meta->first_ver = ver;
+        meta->locked_ver = ver + range;
+        *id = make_id(ver, slot);
         return 0;
     }
     return ENOMEM;
@@ -410,10 +424,35 @@ int bthread_id_lock_and_reset_range_verbose(
     }
     const uint32_t id_ver = bthread::get_version(id);
     uint32_t* butex = meta->butex;
+    if (range == 0) {
+        // Wait-free fast path for the common uncontended lock: a single
+        // CAS from first_ver to locked_ver without grabbing the mutex.
+        // The unfenced reads below are as racy as the ones in
+        // id_exists_with_true_negatives: any staleness makes the CAS
+        // fail (versions never roll back before uint32 wraps) and we
+        // just fall through to the original mutex path.
+        const uint32_t fv = meta->first_ver;
+        const uint32_t lv = meta->locked_ver;
+        if (id_ver >= fv && id_ver < lv &&
+            lv - fv <= (uint32_t)bthread::ID_MAX_RANGE) {
+            uint32_t expected = fv;
+            if (bthread::id_versions(butex)->compare_exchange_strong(
+                    expected, lv, butil::memory_order_acquire,
+                    butil::memory_order_relaxed)) {
+                meta->lock_location = location;
+                if (pdata) {
+                    *pdata = meta->data;
+                }
+                return 0;
+            }
+        }
+    }
     bool ever_contended = false;
     meta->mutex.lock();
     while (meta->has_version(id_ver)) {
-        if (*butex == meta->first_ver) {
+        const uint32_t ver =
+            bthread::id_versions(butex)->load(butil::memory_order_relaxed);
+        if (ver == meta->first_ver) {
             // contended locker always wakes up the butex at unlock.
             meta->lock_location = location;
             if (range == 0) {
@@ -429,15 +468,31 @@ int bthread_id_lock_and_reset_range_verbose(
             } else {
                 meta->locked_ver = meta->first_ver + range;
             }
-            *butex = (ever_contended ? meta->contended_ver() : meta->locked_ver);
+            uint32_t expected = ver;
+            if (!bthread::id_versions(butex)->compare_exchange_strong(
+                    expected,
+                    (ever_contended ? meta->contended_ver() : meta->locked_ver),
+                    butil::memory_order_acquire, butil::memory_order_relaxed)) {
+                // Lost the slot to a fast-path locker, re-examine.
+                continue;
+            }
             meta->mutex.unlock();
             if (pdata) {
                 *pdata = meta->data;
             }
             return 0;
-        } else if (*butex != meta->unlockable_ver()) {
-            *butex = meta->contended_ver();
-            uint32_t expected_ver = *butex;
+        } else if (ver != meta->unlockable_ver()) {
+            // Mark the id contended with a CAS: a plain store could
+            // overwrite a concurrent fast-path unlock and leave the id
+            // locked forever.
+            uint32_t expected = ver;
+            if (ver != meta->contended_ver() &&
+                !bthread::id_versions(butex)->compare_exchange_strong(
+                    expected, meta->contended_ver(),
+                    butil::memory_order_relaxed, butil::memory_order_relaxed)) {
+                continue;
+            }
+            const uint32_t expected_ver = meta->contended_ver();
             meta->mutex.unlock();
             ever_contended = true;
             if (bthread::butex_wait(butex, expected_ver, NULL) < 0 &&
@@ -477,7 +532,8 @@ int bthread_id_about_to_destroy(bthread_id_t id) {
         return EPERM;
     }
     const bool contended = (*butex == meta->contended_ver());
-    *butex = meta->unlockable_ver();
+    bthread::id_versions(butex)->store(meta->unlockable_ver(),
+                                       butil::memory_order_relaxed);
     meta->mutex.unlock();
     if (contended) {
         // wake up all waiting lockers.
@@ -498,19 +554,23 @@ int bthread_id_cancel(bthread_id_t id) {
         meta->mutex.unlock();
         return EINVAL;
     }
-    if (*butex != meta->first_ver) {
+    uint32_t expected = meta->first_ver;
+    const uint32_t next_ver = meta->end_ver();
+    if (!bthread::id_versions(butex)->compare_exchange_strong(
+            expected, next_ver, butil::memory_order_relaxed,
+            butil::memory_order_relaxed)) {
+        // Raced with a fast-path locker.
         meta->mutex.unlock();
         return EPERM;
-    }       
-    *butex = meta->end_ver();
-    meta->first_ver = *butex;
-    meta->locked_ver = *butex;
+    }
+    meta->first_ver = next_ver;
+    meta->locked_ver = next_ver;
     meta->mutex.unlock();
     return_resource(bthread::get_slot(id));
     return 0;
 }
 
-int bthread_id_join(bthread_id_t id) {
+static int id_join_impl(bthread_id_t id, int64_t spin_us) {
     const bthread::IdResourceId slot = bthread::get_slot(id);
     bthread::Id* const meta = address_resource(slot);
     if (!meta) {
@@ -519,6 +579,27 @@ int bthread_id_join(bthread_id_t id) {
     }
     const uint32_t id_ver = bthread::get_version(id);
     uint32_t* join_butex = meta->join_butex;
+    if (spin_us > 0) {
+        meta->mutex.lock();
+        const bool has_ver = meta->has_version(id_ver);
+        const uint32_t expected_ver = *join_butex;
+        meta->mutex.unlock();
+        if (!has_ver) {
+            return 0;
+        }
+        // join_butex is incremented exactly once, by
+        // bthread_id_unlock_and_destroy. A changed value means the id was
+        // destroyed and the join is done without parking.
+        const int64_t spin_deadline_ns =
+            butil::cpuwide_time_ns() + spin_us * 1000L;
+        do {
+            if (((butil::atomic<uint32_t>*)join_butex)->load(
+                    butil::memory_order_acquire) != expected_ver) {
+                return 0;
+            }
+            cpu_relax();
+        } while (butil::cpuwide_time_ns() < spin_deadline_ns);
+    }
     while (1) {
         meta->mutex.lock();
         const bool has_ver = meta->has_version(id_ver);
@@ -535,6 +616,14 @@ int bthread_id_join(bthread_id_t id) {
     return 0;
 }
 
+int bthread_id_join(bthread_id_t id) {
+    return id_join_impl(id, 0);
+}
+
+int bthread_id_join_spin(bthread_id_t id, int64_t spin_us) {
+    return id_join_impl(id, spin_us);
+}
+
 int bthread_id_trylock(bthread_id_t id, void** pdata) {
     bthread::Id* const meta = address_resource(bthread::get_slot(id));
     if (!meta) {
@@ -547,11 +636,13 @@ int bthread_id_trylock(bthread_id_t id, void** pdata) {
         meta->mutex.unlock();
         return EINVAL;
     }
-    if (*butex != meta->first_ver) {
+    uint32_t expected = meta->first_ver;
+    if (!bthread::id_versions(butex)->compare_exchange_strong(
+            expected, meta->locked_ver, butil::memory_order_acquire,
+            butil::memory_order_relaxed)) {
         meta->mutex.unlock();
         return EBUSY;
     }
-    *butex = meta->locked_ver;
     meta->mutex.unlock();
     if (pdata != NULL) {
         *pdata = meta->data;
@@ -573,6 +664,25 @@ int bthread_id_unlock(bthread_id_t id) {
     // Release fence makes sure all changes made before signal visible to
     // woken-up waiters.
     const uint32_t id_ver = bthread::get_version(id);
+    {
+        // Wait-free fast path pairing with the one in bthread_id_lock:
+        // anyone who queues an error or waits for the lock marks the id
+        // contended first, thus a successful CAS from locked_ver back to
+        // first_ver proves that pending_q is empty and nobody needs a
+        // wakeup. The reads are stable for a legitimate lock owner since
+        // first_ver/locked_ver only change while unlocked or by the owner.
+        const uint32_t fv = meta->first_ver;
+        const uint32_t lv = meta->locked_ver;
+        if (id_ver >= fv && id_ver < lv &&
+            lv - fv <= (uint32_t)bthread::ID_MAX_RANGE) {
+            uint32_t expected = lv;
+            if (bthread::id_versions(butex)->compare_exchange_strong(
+                    expected, fv, butil::memory_order_release,
+                    butil::memory_order_relaxed)) {
+                return 0;
+            }
+        }
+    }
     meta->mutex.lock();
     if (!meta->has_version(id_ver)) {
         meta->mutex.unlock();
@@ -596,13 +706,14 @@ int bthread_id_unlock(bthread_id_t id) {
         }
     } else {
         const bool contended = (*butex == meta->contended_ver());
-        *butex = meta->first_ver;
+        bthread::id_versions(butex)->store(meta->first_ver,
+                                           butil::memory_order_release);
         meta->mutex.unlock();
         if (contended) {
             // We may wake up already-reused id, but that's OK.
             bthread::butex_wake(butex);
         }
-        return 0; 
+        return 0;
     }
 }
 
@@ -626,7 +737,7 @@ int bthread_id_unlock_and_destroy(bthread_id_t id) {
         return EPERM;
     }
     const uint32_t next_ver = meta->end_ver();
-    *butex = next_ver;
+    bthread::id_versions(butex)->store(next_ver, butil::memory_order_release);
     *join_butex = next_ver;
     meta->first_ver = next_ver;
     meta->locked_ver = next_ver;
@@ -720,16 +831,36 @@ int bthread_id_error2_verbose(bthread_id_t id, int error_code,
         meta->mutex.unlock();
         return EINVAL;
     }
-    if (*butex == meta->first_ver) {
-        *butex = meta->locked_ver;
-        meta->lock_location = location;
-        meta->mutex.unlock();
-        if (meta->on_error) {
-            return meta->on_error(id, meta->data, error_code);
-        } else {
-            return meta->on_error2(id, meta->data, error_code, error_text);
+    while (true) {
+        const uint32_t ver =
+            bthread::id_versions(butex)->load(butil::memory_order_relaxed);
+        if (ver == meta->first_ver) {
+            uint32_t expected = ver;
+            if (!bthread::id_versions(butex)->compare_exchange_strong(
+                    expected, meta->locked_ver, butil::memory_order_acquire,
+                    butil::memory_order_relaxed)) {
+                // Raced with a fast-path locker, re-examine.
+                continue;
+            }
+            meta->lock_location = location;
+            meta->mutex.unlock();
+            if (meta->on_error) {
+                return meta->on_error(id, meta->data, error_code);
+            } else {
+                return meta->on_error2(id, meta->data, error_code, error_text);
+            }
+        }
+        if (ver == meta->locked_ver) {
+            // Force the owner's unlock out of its wait-free fast path so
+            // that the queued error is surely processed at unlock. If the
+            // CAS fails the owner just unlocked, re-examine.
+            uint32_t expected = ver;
+            if (!bthread::id_versions(butex)->compare_exchange_strong(
+                    expected, meta->contended_ver(),
+                    butil::memory_order_relaxed, butil::memory_order_relaxed)) {
+                continue;
+            }
         }
-    } else {
         bthread::PendingError e;
         e.id = id;
         e.error_code = error_code;
@@ -63,6 +63,12 @@ int bthread_id_create_ranged(
 // Returns 0 on success, error code otherwise.
 int bthread_id_join(bthread_id_t id);
 
+// Same as bthread_id_join() but busy-spin up to `spin_us' microseconds
+// before parking the caller. Worth it only when the waited event usually
+// completes within the spin budget: the caller skips a park/unpark pair
+// and a context switch, at the price of burning its worker while spinning.
+int bthread_id_join_spin(bthread_id_t id, int64_t spin_us);
+
 // Destroy a created but never-used bthread_id_t.
 // Returns 0 on success, EINVAL otherwise.
 int bthread_id_cancel(bthread_id_t id);
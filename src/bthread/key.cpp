@@ -69,6 +69,13 @@ static const uint32_t KEY_1STLEVEL_SIZE = 31;
 // for most projects throughout baidu.
 static const uint32_t KEYS_MAX = KEY_2NDLEVEL_SIZE * KEY_1STLEVEL_SIZE;
 
+// Keys with indexes below this threshold live in a flat array embedded in
+// KeyTable: get/set is a direct index plus a version check, without the
+// second-level indirection above. Since indexes are allocated from 0, the
+// keys created at startup (e.g. tracing contexts looked up many times per
+// request) are the ones that benefit.
+static const uint32_t KEY_FAST_SIZE = 32;
+
 // destructors/version of TLS.
 struct KeyInfo {
     uint32_t version;
@@ -152,6 +159,7 @@ private:
 class BAIDU_CACHELINE_ALIGNMENT KeyTable {
 public:
     KeyTable() : next(NULL) {
+        memset(_fast, 0, sizeof(_fast));
         memset(_subs, 0, sizeof(_subs));
         nkeytable.fetch_add(1, butil::memory_order_relaxed);
     }
@@ -159,16 +167,16 @@ public:
     ~KeyTable() {
         nkeytable.fetch_sub(1, butil::memory_order_relaxed);
         for (int ntry = 0; ntry < PTHREAD_DESTRUCTOR_ITERATIONS; ++ntry) {
+            clear_fast();
             for (uint32_t i = 0; i < KEY_1STLEVEL_SIZE; ++i) {
                 if (_subs[i]) {
                     _subs[i]->clear(i * KEY_2NDLEVEL_SIZE);
                 }
             }
-            bool all_cleared = true;
-            for (uint32_t i = 0; i < KEY_1STLEVEL_SIZE; ++i) {
+            bool all_cleared = fast_cleared();
+            for (uint32_t i = 0; all_cleared && i < KEY_1STLEVEL_SIZE; ++i) {
                 if (_subs[i] != NULL && !_subs[i]->cleared()) {
                     all_cleared = false;
-                    break;
                 }
             }
             if (all_cleared) {
@@ -182,6 +190,11 @@ public:
     }
 
     inline void* get_data(bthread_key_t key) const {
+        if (key.index < KEY_FAST_SIZE) {
+            // Direct index + generation check, no second-level load.
+            const FastData& d = _fast[key.index];
+            return (d.version == key.version) ? d.ptr : NULL;
+        }
         const uint32_t subidx = key.index / KEY_2NDLEVEL_SIZE;
         if (subidx < KEY_1STLEVEL_SIZE) {
             const SubKeyTable* sub_kt = _subs[subidx];
@@ -194,8 +207,15 @@ public:
     }
 
     inline int set_data(bthread_key_t key, void* data) {
+        if (key.index < KEY_FAST_SIZE &&
+            key.version == s_key_info[key.index].version) {
+            _fast[key.index].version = key.version;
+            _fast[key.index].ptr = data;
+            return 0;
+        }
         const uint32_t subidx = key.index / KEY_2NDLEVEL_SIZE;
         if (subidx < KEY_1STLEVEL_SIZE &&
+            key.index >= KEY_FAST_SIZE &&
             key.version == s_key_info[key.index].version) {
             SubKeyTable* sub_kt = _subs[subidx];
             if (sub_kt == NULL) {
@@ -216,6 +236,37 @@ public:
 public:
     KeyTable* next;
 private:
+    struct FastData {
+        uint32_t version;
+        void* ptr;
+    };
+
+    void clear_fast() {
+        for (uint32_t i = 0; i < KEY_FAST_SIZE; ++i) {
+            void* p = _fast[i].ptr;
+            if (p) {
+                // Set the position to NULL before calling dtor which may set
+                // the position again.
+                _fast[i].ptr = NULL;
+
+                KeyInfo info = s_key_info[i];
+                if (info.dtor && _fast[i].version == info.version) {
+                    info.dtor(p, info.dtor_args);
+                }
+            }
+        }
+    }
+
+    bool fast_cleared() const {
+        for (uint32_t i = 0; i < KEY_FAST_SIZE; ++i) {
+            if (_fast[i].ptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FastData _fast[KEY_FAST_SIZE];
     SubKeyTable* _subs[KEY_1STLEVEL_SIZE];
 };
 
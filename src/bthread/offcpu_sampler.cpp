@@ -0,0 +1,178 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <gflags/gflags.h>
+#include "butil/containers/hash_tables.h"   // hash_map
+#include "butil/debug/stack_trace.h"
+#include "butil/macros.h"
+#include "butil/scoped_lock.h"
+#include "butil/third_party/murmurhash3/murmurhash3.h"
+#include "butil/reloadable_flags.h"
+#include "bthread/offcpu_sampler.h"
+
+namespace bthread {
+
+DEFINE_int32(bthread_offcpu_sample_ratio, 0,
+             "Sample one out of this many blocking butex waits (which "
+             "includes bthread mutex/condition waits) per thread with a "
+             "stack capture into a ring of recent off-CPU samples, ranked "
+             "by total wait time on /offcpu. 0 disables the sampling");
+
+static bool validate_offcpu_sample_ratio(const char*, int32_t val) {
+    return val >= 0;
+}
+BUTIL_VALIDATE_GFLAG(bthread_offcpu_sample_ratio,
+                     validate_offcpu_sample_ratio);
+
+namespace {
+
+const size_t OFFCPU_RING_CAP = 1024;
+const int OFFCPU_MAX_FRAMES = 26;
+// Frames which are always same: offcpu_record_sample() itself.
+const int OFFCPU_SKIPPED_FRAMES = 1;
+
+struct OffCpuSample {
+    int64_t wait_us;
+    int nframes;
+    void* frames[OFFCPU_MAX_FRAMES];
+};
+
+// A ring of recent samples so that the ranking reflects the near past
+// rather than the whole process lifetime. Guarded by a pthread mutex:
+// recording is rare (1/N of blocking events) and copies ~200 bytes.
+pthread_mutex_t g_offcpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+OffCpuSample* g_offcpu_ring = NULL;
+size_t g_offcpu_next = 0;    // next slot to overwrite
+size_t g_offcpu_size = 0;    // valid entries, caps at OFFCPU_RING_CAP
+int64_t g_offcpu_nsamples = 0;  // total recorded since start
+
+}  // namespace
+
+bool offcpu_pick_sample() {
+    const int32_t ratio = FLAGS_bthread_offcpu_sample_ratio;
+    if (ratio <= 0) {
+        return false;
+    }
+    // Per-thread ticking approximates 1/ratio of all blocking events
+    // without bouncing a shared counter.
+    static __thread uint32_t tls_ticker = 0;
+    return (++tls_ticker % (uint32_t)ratio) == 0;
+}
+
+void offcpu_record_sample(int64_t wait_us) {
+    butil::debug::StackTrace st(true/*exclude_self*/);
+    size_t nframes = 0;
+    const void* const* frames = st.Addresses(&nframes);
+    if (frames == NULL || nframes == 0) {
+        return;
+    }
+    if (nframes > (size_t)OFFCPU_MAX_FRAMES) {
+        nframes = OFFCPU_MAX_FRAMES;
+    }
+    BAIDU_SCOPED_LOCK(g_offcpu_mutex);
+    if (g_offcpu_ring == NULL) {
+        g_offcpu_ring = new (std::nothrow) OffCpuSample[OFFCPU_RING_CAP];
+        if (g_offcpu_ring == NULL) {
+            return;
+        }
+    }
+    OffCpuSample& s = g_offcpu_ring[g_offcpu_next];
+    s.wait_us = wait_us;
+    s.nframes = (int)nframes;
+    memcpy(s.frames, frames, sizeof(void*) * nframes);
+    g_offcpu_next = (g_offcpu_next + 1) % OFFCPU_RING_CAP;
+    if (g_offcpu_size < OFFCPU_RING_CAP) {
+        ++g_offcpu_size;
+    }
+    ++g_offcpu_nsamples;
+}
+
+namespace {
+
+struct OffCpuSite {
+    int64_t total_wait_us;
+    int64_t count;
+    const OffCpuSample* sample;  // a representative for the stack
+};
+
+}  // namespace
+
+void print_offcpu_sites(std::ostream& os) {
+    if (FLAGS_bthread_offcpu_sample_ratio <= 0) {
+        os << "Off-CPU sampling is disabled, set "
+           << "-bthread_offcpu_sample_ratio to a positive N to sample 1/N "
+           << "blocking waits\n";
+        return;
+    }
+    // Snapshot the ring so that symbolization (slow) runs unlocked.
+    std::vector<OffCpuSample> samples;
+    int64_t nsamples = 0;
+    {
+        BAIDU_SCOPED_LOCK(g_offcpu_mutex);
+        if (g_offcpu_ring != NULL) {
+            samples.assign(g_offcpu_ring, g_offcpu_ring + g_offcpu_size);
+        }
+        nsamples = g_offcpu_nsamples;
+    }
+    os << "sample_ratio: 1/" << FLAGS_bthread_offcpu_sample_ratio
+       << "\ntotal_samples: " << nsamples
+       << "\nring_samples: " << samples.size() << '\n';
+    if (samples.empty()) {
+        return;
+    }
+    // Group by stack.
+    butil::hash_map<uint32_t, OffCpuSite> sites;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const OffCpuSample& s = samples[i];
+        uint32_t h = 0;
+        butil::MurmurHash3_x86_32(s.frames, sizeof(void*) * s.nframes,
+                                  (uint32_t)s.nframes, &h);
+        OffCpuSite& site = sites[h];
+        if (site.count == 0) {
+            site.sample = &s;
+        }
+        site.total_wait_us += s.wait_us;
+        ++site.count;
+    }
+    std::vector<const OffCpuSite*> ranked;
+    ranked.reserve(sites.size());
+    for (butil::hash_map<uint32_t, OffCpuSite>::const_iterator
+             it = sites.begin(); it != sites.end(); ++it) {
+        ranked.push_back(&it->second);
+    }
+    std::sort(ranked.begin(), ranked.end(),
+              [](const OffCpuSite* a, const OffCpuSite* b) {
+                  return a->total_wait_us > b->total_wait_us;
+              });
+    for (size_t i = 0; i < ranked.size(); ++i) {
+        const OffCpuSite& site = *ranked[i];
+        const OffCpuSample& rep = *site.sample;
+        os << "\n[" << i + 1 << "] total_wait_us=" << site.total_wait_us
+           << " samples=" << site.count
+           << " avg_wait_us=" << site.total_wait_us / site.count << '\n';
+        const int skip = std::min(OFFCPU_SKIPPED_FRAMES, rep.nframes);
+        butil::debug::StackTrace st(
+            rep.frames + skip, (size_t)(rep.nframes - skip));
+        st.OutputToStream(&os);
+    }
+}
+
+}  // namespace bthread
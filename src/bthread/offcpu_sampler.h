@@ -0,0 +1,64 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BTHREAD_OFFCPU_SAMPLER_H
+#define BTHREAD_OFFCPU_SAMPLER_H
+
+#include <iostream>
+#include <gflags/gflags_declare.h>
+#include "butil/macros.h"
+#include "butil/time.h"
+
+namespace bthread {
+
+DECLARE_int32(bthread_offcpu_sample_ratio);
+
+// True when this blocking event is picked by -bthread_offcpu_sample_ratio.
+bool offcpu_pick_sample();
+
+// Capture the caller's stack and push {stack, wait_us} into a ring of
+// recent off-CPU samples.
+void offcpu_record_sample(int64_t wait_us);
+
+// Aggregate the ring and print blocking sites ranked by total wait time,
+// used by /offcpu.
+void print_offcpu_sites(std::ostream& os);
+
+// Times one blocking butex wait and records it into the sample ring when
+// picked. Constructed after the fast path of butex_wait so that only waits
+// which really block are sampled. Since bthread mutexes and condition
+// variables park on butexes, their contention sites are covered as well.
+class OffCpuSampleScope {
+public:
+    OffCpuSampleScope()
+        : _start_us(offcpu_pick_sample() ? butil::cpuwide_time_us() : 0) {}
+
+    ~OffCpuSampleScope() {
+        if (_start_us != 0) {
+            offcpu_record_sample(butil::cpuwide_time_us() - _start_us);
+        }
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(OffCpuSampleScope);
+
+    int64_t _start_us;
+};
+
+}  // namespace bthread
+
+#endif  // BTHREAD_OFFCPU_SAMPLER_H
@@ -22,60 +22,146 @@
 #ifndef BTHREAD_REMOTE_TASK_QUEUE_H
 #define BTHREAD_REMOTE_TASK_QUEUE_H
 
-#include "butil/containers/bounded_queue.h"
+#include <new>
+#include "butil/atomicops.h"
 #include "butil/macros.h"
+#include "bthread/types.h"
 
 namespace bthread {
 
 class TaskGroup;
 
-// A queue for storing bthreads created by non-workers. Since non-workers
-// randomly choose a TaskGroup to push which distributes the contentions,
-// this queue is simply implemented as a queue protected with a lock.
-// The function names should be self-explanatory.
+// A queue for storing bthreads created by non-workers. This used to be a
+// BoundedQueue protected with a mutex, which became the bottleneck when
+// many pthreads submit to the same group (e.g. callbacks of external event
+// loops). It is now a lock-free bounded ring with per-slot sequence
+// numbers: producers claim a slot with one CAS on _push_pos and publish
+// the value by bumping the slot's sequence, consumers do the symmetric
+// dance on _pop_pos. Both ends support multiple threads since workers
+// other than the owner also pop from this queue when stealing.
+// push() fails instead of blocking when the ring is full, callers decide
+// how to back off.
 class RemoteTaskQueue {
 public:
-    RemoteTaskQueue() {}
+    RemoteTaskQueue() : _slots(NULL), _cap_mask(0), _push_pos(0), _pop_pos(0) {}
+
+    ~RemoteTaskQueue() {
+        delete [] _slots;
+        _slots = NULL;
+    }
 
     int init(size_t cap) {
-        const size_t memsize = sizeof(bthread_t) * cap;
-        void* q_mem = malloc(memsize);
-        if (q_mem == NULL) {
+        // Round up to power of 2 so that positions can be mapped to slots
+        // with a mask.
+        size_t rounded_cap = 2;
+        while (rounded_cap < cap) {
+            rounded_cap <<= 1;
+        }
+        Slot* slots = new (std::nothrow) Slot[rounded_cap];
+        if (slots == NULL) {
             return -1;
         }
-        butil::BoundedQueue<bthread_t> q(q_mem, memsize, butil::OWNS_STORAGE);
-        _tasks.swap(q);
+        for (size_t i = 0; i < rounded_cap; ++i) {
+            slots[i].seq.store(i, butil::memory_order_relaxed);
+        }
+        delete [] _slots;
+        _slots = slots;
+        _cap_mask = rounded_cap - 1;
+        _push_pos.store(0, butil::memory_order_relaxed);
+        _pop_pos.store(0, butil::memory_order_relaxed);
         return 0;
     }
 
+    // Returns false when the queue is full.
+    bool push(bthread_t task) {
+        size_t pos = _push_pos.load(butil::memory_order_relaxed);
+        Slot* slot = NULL;
+        while (true) {
+            slot = _slots + (pos & _cap_mask);
+            const size_t seq = slot->seq.load(butil::memory_order_acquire);
+            const int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0) {
+                // The slot is free, try to claim it.
+                if (_push_pos.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The slot still holds a value pushed one lap ago: full.
+                return false;
+            } else {
+                // Another producer claimed the slot, move on.
+                pos = _push_pos.load(butil::memory_order_relaxed);
+            }
+        }
+        slot->value = task;
+        slot->seq.store(pos + 1, butil::memory_order_release);
+        return true;
+    }
+
+    // Returns false when the queue is empty.
     bool pop(bthread_t* task) {
-        if (_tasks.empty()) {
+        if (_pop_pos.load(butil::memory_order_relaxed) ==
+            _push_pos.load(butil::memory_order_relaxed)) {
+            // Cheap filter for stealers polling empty queues.
             return false;
         }
-        _mutex.lock();
-        const bool result = _tasks.pop(task);
-        _mutex.unlock();
-        return result;
+        size_t pos = _pop_pos.load(butil::memory_order_relaxed);
+        Slot* slot = NULL;
+        while (true) {
+            slot = _slots + (pos & _cap_mask);
+            const size_t seq = slot->seq.load(butil::memory_order_acquire);
+            const int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+            if (diff == 0) {
+                if (_pop_pos.compare_exchange_weak(
+                        pos, pos + 1, butil::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The slot is not published yet: empty.
+                return false;
+            } else {
+                pos = _pop_pos.load(butil::memory_order_relaxed);
+            }
+        }
+        *task = slot->value;
+        // Mark the slot free for the producer one lap later.
+        slot->seq.store(pos + _cap_mask + 1, butil::memory_order_release);
+        return true;
     }
 
-    bool push(bthread_t task) {
-        _mutex.lock();
-        const bool res = push_locked(task);
-        _mutex.unlock();
-        return res;
+    // Pop at most |n| tasks, returns # of popped ones.
+    size_t pop_batch(bthread_t* tasks, size_t n) {
+        size_t npopped = 0;
+        while (npopped < n && pop(tasks + npopped)) {
+            ++npopped;
+        }
+        return npopped;
     }
 
-    bool push_locked(bthread_t task) {
-        return _tasks.push(task);
+    size_t capacity() const { return _cap_mask + 1; }
+
+    // Racy snapshot, only for monitoring.
+    size_t volatile_size() const {
+        const size_t pushed = _push_pos.load(butil::memory_order_relaxed);
+        const size_t popped = _pop_pos.load(butil::memory_order_relaxed);
+        return pushed >= popped ? pushed - popped : 0;
     }
 
-    size_t capacity() const { return _tasks.capacity(); }
-    
 private:
-friend class TaskGroup;
     DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
-    butil::BoundedQueue<bthread_t> _tasks;
-    butil::Mutex _mutex;
+
+    struct Slot {
+        butil::atomic<size_t> seq;
+        bthread_t value;
+    };
+
+    Slot* _slots;
+    size_t _cap_mask;
+    // On different cachelines so that producers do not false-share with
+    // consumers.
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _push_pos;
+    BAIDU_CACHELINE_ALIGNMENT butil::atomic<size_t> _pop_pos;
 };
 
 }  // namespace bthread
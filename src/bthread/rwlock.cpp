@@ -15,10 +15,19 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <unistd.h>                        // sysconf
+#include <new>                             // std::nothrow
 #include "bvar/collector.h"
+#include "bvar/detail/percpu_counter.h"    // get_current_cpu
 #include "bthread/rwlock.h"
 #include "bthread/butex.h"
 
+// One shard of the reader counter of a big-reader rwlock. Defined out of
+// any namespace, bthread_rwlock_t in types.h refers to this tag.
+struct BAIDU_CACHELINE_ALIGNMENT bthread_rwlock_reader_slot_t {
+    butil::atomic<int> count;
+};
+
 namespace bthread {
 
 // A `bthread_rwlock_t' is a reader/writer mutual exclusion lock,
@@ -38,13 +47,31 @@ extern void submit_contention(const bthread_contention_site_t& csite, int64_t no
 // need to use `int64_t' instead of `int'.
 const int RWLockMaxReaders = 1 << 30;
 
+// For the big-reader kind(BTHREAD_RWLOCK_KIND_BIGREADER_NP) the reader
+// counter is sharded into cacheline-aligned per-cpu slots and the scheme
+// above runs unchanged on the slot of the running cpu: flipping one slot
+// by -RWLockMaxReaders snapshots its active readers atomically just like
+// flipping the single counter does, and a writer sweeps all slots,
+// accumulating the per-slot snapshots. A slot may dip slightly below
+// zero when a reader migrates between cpus while holding the lock(its +1
+// and -1 land on different slots), so "a writer is pending" is told by
+// being below -RWLockMaxReaders/2 instead of below zero; the sum over
+// all slots is still the exact number of active readers.
+static inline butil::atomic<int>* rwlock_reader_counter(bthread_rwlock_t* rwlock) {
+    if (BAIDU_LIKELY(0 == rwlock->nslot)) {
+        return (butil::atomic<int>*)&rwlock->reader_count;
+    }
+    return &rwlock->reader_slots[bvar::detail::get_current_cpu() &
+                                 (rwlock->nslot - 1)].count;
+}
+
 // For reading.
 static int rwlock_rdlock_impl(bthread_rwlock_t* __restrict rwlock,
                               const struct timespec* __restrict abstime) {
-    int reader_count = ((butil::atomic<int>*)&rwlock->reader_count)
+    int reader_count = rwlock_reader_counter(rwlock)
         ->fetch_add(1, butil::memory_order_acquire) + 1;
     // Fast path.
-    if (reader_count >= 0) {
+    if (reader_count > -RWLockMaxReaders / 2) {
         CHECK_LT(reader_count, RWLockMaxReaders);
         return 0;
     }
@@ -85,13 +112,13 @@ static inline int rwlock_timedrdlock(bthread_rwlock_t* __restrict rwlock,
 // Returns 0 if the lock was acquired, otherwise errno.
 static  inline int rwlock_tryrdlock(bthread_rwlock_t* rwlock) {
     while (true) {
-        int reader_count = ((butil::atomic<int>*)&rwlock->reader_count)
-            ->load(butil::memory_order_relaxed);
-        if (reader_count < 0) {
+        butil::atomic<int>* reader_counter = rwlock_reader_counter(rwlock);
+        int reader_count = reader_counter->load(butil::memory_order_relaxed);
+        if (reader_count < -RWLockMaxReaders / 2) {
             // Failed to acquire the read lock because there is a writer.
             return EBUSY;
         }
-        if (((butil::atomic<int>*)&rwlock->reader_count)
+        if (reader_counter
                 ->compare_exchange_weak(reader_count, reader_count + 1,
                                         butil::memory_order_acquire,
                                         butil::memory_order_relaxed)) {
@@ -101,7 +128,7 @@ static  inline int rwlock_tryrdlock(bthread_rwlock_t* rwlock) {
 }
 
 static inline int rwlock_unrdlock(bthread_rwlock_t* rwlock) {
-    int reader_count = ((butil::atomic<int>*)&rwlock->reader_count)
+    int reader_count = rwlock_reader_counter(rwlock)
         ->fetch_add(-1, butil::memory_order_relaxed) - 1;
     // Fast path.
     if (reader_count >= 0) {
@@ -109,9 +136,16 @@ static inline int rwlock_unrdlock(bthread_rwlock_t* rwlock) {
     }
     // Slow path.
 
-    if (BAIDU_UNLIKELY(reader_count + 1 == 0 || reader_count + 1 == -RWLockMaxReaders)) {
-        CHECK(false) << "rwlock_unrdlock of unlocked rwlock";
-        return EINVAL;
+    if (0 == rwlock->nslot) {
+        if (BAIDU_UNLIKELY(reader_count + 1 == 0 ||
+                           reader_count + 1 == -RWLockMaxReaders)) {
+            CHECK(false) << "rwlock_unrdlock of unlocked rwlock";
+            return EINVAL;
+        }
+    } else if (reader_count > -RWLockMaxReaders / 2) {
+        // The slot dipped below zero because this reader migrated
+        // between cpus while holding the lock; no writer is pending.
+        return 0;
     }
 
     // A writer is pending.
@@ -189,8 +223,19 @@ static inline int rwlock_wrlock_impl(bthread_rwlock_t* __restrict rwlock,
     }
 
     // Announce to readers there is a pending writer.
-    int reader_count = ((butil::atomic<int>*)&rwlock->reader_count)
-        ->fetch_add(-RWLockMaxReaders, butil::memory_order_release);
+    int reader_count;
+    if (0 == rwlock->nslot) {
+        reader_count = ((butil::atomic<int>*)&rwlock->reader_count)
+            ->fetch_add(-RWLockMaxReaders, butil::memory_order_release);
+    } else {
+        // Sweep all slots; each flip snapshots the active readers of one
+        // slot and the sum is the exact number of active readers.
+        reader_count = 0;
+        for (int i = 0; i < rwlock->nslot; ++i) {
+            reader_count += rwlock->reader_slots[i].count.fetch_add(
+                -RWLockMaxReaders, butil::memory_order_release);
+        }
+    }
     // Wait for active readers.
     if (reader_count != 0 &&
         ((butil::atomic<int>*)&rwlock->reader_wait)
@@ -234,14 +279,38 @@ static inline int rwlock_trywrlock(bthread_rwlock_t* rwlock) {
         return rc;
     }
 
-    int expected = 0;
-    if (!((butil::atomic<int>*)&rwlock->reader_count)
-            ->compare_exchange_strong(expected, -RWLockMaxReaders,
-                                      butil::memory_order_acquire,
-                                      butil::memory_order_relaxed)) {
-        // Failed to acquire the write lock because there are active readers.
-        bthread_mutex_unlock(&rwlock->write_queue_mutex);
-        return EBUSY;
+    if (0 == rwlock->nslot) {
+        int expected = 0;
+        if (!((butil::atomic<int>*)&rwlock->reader_count)
+                ->compare_exchange_strong(expected, -RWLockMaxReaders,
+                                          butil::memory_order_acquire,
+                                          butil::memory_order_relaxed)) {
+            // Failed to acquire the write lock because there are active readers.
+            bthread_mutex_unlock(&rwlock->write_queue_mutex);
+            return EBUSY;
+        }
+    } else {
+        for (int i = 0; i < rwlock->nslot; ++i) {
+            int expected = 0;
+            if (!rwlock->reader_slots[i].count
+                    .compare_exchange_strong(expected, -RWLockMaxReaders,
+                                             butil::memory_order_acquire,
+                                             butil::memory_order_relaxed)) {
+                // Unflip the slots already marked; readers trapped on
+                // them meanwhile are woken like in rwlock_unwrlock.
+                int trapped = 0;
+                for (int j = 0; j < i; ++j) {
+                    trapped += rwlock->reader_slots[j].count.fetch_add(
+                        RWLockMaxReaders, butil::memory_order_release)
+                        + RWLockMaxReaders;
+                }
+                if (trapped > 0) {
+                    bthread_sem_post_n(&rwlock->reader_sema, trapped);
+                }
+                bthread_mutex_unlock(&rwlock->write_queue_mutex);
+                return EBUSY;
+            }
+        }
     }
     rwlock->wlock_flag = true;
 
@@ -258,11 +327,28 @@ static inline int rwlock_unwrlock(bthread_rwlock_t* rwlock) {
     rwlock->wlock_flag = false;
 
     // Announce to readers there is no active writer.
-    int reader_count = ((butil::atomic<int>*)&rwlock->reader_count)->fetch_add(
-        RWLockMaxReaders, butil::memory_order_release) + RWLockMaxReaders;
-    if (BAIDU_UNLIKELY(reader_count >= RWLockMaxReaders)) {
-        CHECK(false) << "rwlock_unwlock of unlocked rwlock";
-        return EINVAL;
+    int reader_count;
+    if (0 == rwlock->nslot) {
+        reader_count = ((butil::atomic<int>*)&rwlock->reader_count)->fetch_add(
+            RWLockMaxReaders, butil::memory_order_release) + RWLockMaxReaders;
+        if (BAIDU_UNLIKELY(reader_count >= RWLockMaxReaders)) {
+            CHECK(false) << "rwlock_unwlock of unlocked rwlock";
+            return EINVAL;
+        }
+    } else {
+        // Sweep all slots; the sum counts the readers that blocked on
+        // reader_sema while the write lock was held.
+        reader_count = 0;
+        for (int i = 0; i < rwlock->nslot; ++i) {
+            int slot_count = rwlock->reader_slots[i].count.fetch_add(
+                RWLockMaxReaders, butil::memory_order_release)
+                + RWLockMaxReaders;
+            if (BAIDU_UNLIKELY(slot_count >= RWLockMaxReaders / 2)) {
+                CHECK(false) << "rwlock_unwlock of unlocked rwlock";
+                return EINVAL;
+            }
+            reader_count += slot_count;
+        }
     }
 
     bool is_valid = bthread::is_contention_site_valid(rwlock->writer_csite);
@@ -295,7 +381,10 @@ static inline int rwlock_unlock(bthread_rwlock_t* rwlock) {
 __BEGIN_DECLS
 
 int bthread_rwlock_init(bthread_rwlock_t* __restrict rwlock,
-                        const bthread_rwlockattr_t* __restrict) {
+                        const bthread_rwlockattr_t* __restrict attr) {
+    rwlock->reader_slots = NULL;
+    rwlock->nslot = 0;
+
     int rc = bthread_sem_init(&rwlock->reader_sema, 0);
     if (BAIDU_UNLIKELY(0 != rc)) {
         return rc;
@@ -312,16 +401,39 @@ int bthread_rwlock_init(bthread_rwlock_t* __restrict rwlock,
     rwlock->reader_wait = 0;
     rwlock->wlock_flag = false;
 
-    bthread_mutexattr_t attr;
-    bthread_mutexattr_init(&attr);
-    bthread_mutexattr_disable_csite(&attr);
-    rc = bthread_mutex_init(&rwlock->write_queue_mutex, &attr);
+    bthread_mutexattr_t mutex_attr;
+    bthread_mutexattr_init(&mutex_attr);
+    bthread_mutexattr_disable_csite(&mutex_attr);
+    rc = bthread_mutex_init(&rwlock->write_queue_mutex, &mutex_attr);
     if (BAIDU_UNLIKELY(0 != rc)) {
         bthread_sem_destroy(&rwlock->reader_sema);
         bthread_sem_destroy(&rwlock->writer_sema);
         return rc;
     }
-    bthread_mutexattr_destroy(&attr);
+    bthread_mutexattr_destroy(&mutex_attr);
+
+    if (NULL != attr && BTHREAD_RWLOCK_KIND_BIGREADER_NP == attr->kind) {
+        long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+        if (ncpu <= 0) {
+            ncpu = 1;
+        }
+        int nslot = 1;
+        while (nslot < ncpu) {
+            nslot <<= 1;
+        }
+        rwlock->reader_slots =
+            new (std::nothrow) bthread_rwlock_reader_slot_t[nslot];
+        if (BAIDU_UNLIKELY(NULL == rwlock->reader_slots)) {
+            bthread_sem_destroy(&rwlock->reader_sema);
+            bthread_sem_destroy(&rwlock->writer_sema);
+            bthread_mutex_destroy(&rwlock->write_queue_mutex);
+            return ENOMEM;
+        }
+        for (int i = 0; i < nslot; ++i) {
+            rwlock->reader_slots[i].count.store(0, butil::memory_order_relaxed);
+        }
+        rwlock->nslot = nslot;
+    }
 
     bthread::make_contention_site_invalid(&rwlock->writer_csite);
 
@@ -332,6 +444,9 @@ int bthread_rwlock_destroy(bthread_rwlock_t* rwlock) {
     bthread_sem_destroy(&rwlock->reader_sema);
     bthread_sem_destroy(&rwlock->writer_sema);
     bthread_mutex_destroy(&rwlock->write_queue_mutex);
+    delete [] rwlock->reader_slots;
+    rwlock->reader_slots = NULL;
+    rwlock->nslot = 0;
     return 0;
 }
 
@@ -365,4 +480,29 @@ int bthread_rwlock_unlock(bthread_rwlock_t* rwlock) {
     return bthread::rwlock_unlock(rwlock);
 }
 
+int bthread_rwlockattr_init(bthread_rwlockattr_t* attr) {
+    attr->kind = BTHREAD_RWLOCK_KIND_DEFAULT_NP;
+    return 0;
+}
+
+int bthread_rwlockattr_destroy(bthread_rwlockattr_t* attr) {
+    attr->kind = BTHREAD_RWLOCK_KIND_DEFAULT_NP;
+    return 0;
+}
+
+int bthread_rwlockattr_getkind_np(const bthread_rwlockattr_t* attr,
+                                  int* kind) {
+    *kind = attr->kind;
+    return 0;
+}
+
+int bthread_rwlockattr_setkind_np(bthread_rwlockattr_t* attr, int kind) {
+    if (kind != BTHREAD_RWLOCK_KIND_DEFAULT_NP &&
+        kind != BTHREAD_RWLOCK_KIND_BIGREADER_NP) {
+        return EINVAL;
+    }
+    attr->kind = kind;
+    return 0;
+}
+
 __END_DECLS
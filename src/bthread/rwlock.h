@@ -32,8 +32,21 @@ class RWLock {
 public:
     typedef bthread_rwlock_t* native_handler_type;
 
-    RWLock() {
-        int rc = bthread_rwlock_init(&_rwlock, NULL);
+    RWLock() : RWLock(BTHREAD_RWLOCK_KIND_DEFAULT_NP) {}
+
+    // `kind' is one of the BTHREAD_RWLOCK_KIND_*_NP constants. Pick the
+    // big-reader kind for long-lived read-mostly locks: read acquisition
+    // becomes an uncontended per-cpu increment that scales with the core
+    // count, at the price of several KB per lock and writers sweeping
+    // all per-cpu slots.
+    explicit RWLock(int kind) {
+        bthread_rwlockattr_t attr;
+        bthread_rwlockattr_init(&attr);
+        int rc = bthread_rwlockattr_setkind_np(&attr, kind);
+        if (0 == rc) {
+            rc = bthread_rwlock_init(&_rwlock, &attr);
+        }
+        bthread_rwlockattr_destroy(&attr);
         if (rc) {
             throw std::system_error(std::error_code(rc, std::system_category()),
                                     "RWLock constructor failed");
@@ -23,6 +23,7 @@
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
+#include "butil/build_config.h"                   // OS_LINUX
 #include "butil/macros.h"                          // BAIDU_CASSERT
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/third_party/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
@@ -37,6 +38,13 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_int32(tc_stack_resident, -1, "maximum pooled stacks kept fully resident"
+             " by each thread, cold pages of stacks returned beyond this"
+             " watermark are handed back to the kernel with madvise(),"
+             " negative values disable the releasing");
+DEFINE_bool(huge_page_stacks, false, "hint the kernel with madvise("
+            "MADV_HUGEPAGE) to back mmap-ed stacks with transparent huge"
+            " pages, cutting dTLB misses of deep stacks");
 
 namespace bthread {
 
@@ -53,6 +61,21 @@ static int64_t get_stack_count(void*) {
 static bvar::PassiveStatus<int64_t> bvar_stack_count(
     "bthread_stack_count", get_stack_count, NULL);
 
+// Accumulated count/bytes of cold stack pages handed back to the kernel
+// by advise_free_stack_storage(), for observing pool residency.
+static butil::static_atomic<int64_t> s_stack_advised_count = BUTIL_STATIC_ATOMIC_INIT(0);
+static butil::static_atomic<int64_t> s_stack_advised_bytes = BUTIL_STATIC_ATOMIC_INIT(0);
+static int64_t get_stack_advised_count(void*) {
+    return s_stack_advised_count.load(butil::memory_order_relaxed);
+}
+static int64_t get_stack_advised_bytes(void*) {
+    return s_stack_advised_bytes.load(butil::memory_order_relaxed);
+}
+static bvar::PassiveStatus<int64_t> bvar_stack_advised_count(
+    "bthread_stack_advised_count", get_stack_advised_count, NULL);
+static bvar::PassiveStatus<int64_t> bvar_stack_advised_bytes(
+    "bthread_stack_advised_bytes", get_stack_advised_bytes, NULL);
+
 int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in) {
     const static int PAGESIZE = getpagesize();
     const int PAGESIZE_M1 = PAGESIZE - 1;
@@ -116,6 +139,14 @@ int allocate_stack_storage(StackStorage* s, int stacksize_in, int guardsize_in)
             return -1;
         }
 
+#if defined(OS_LINUX) && defined(MADV_HUGEPAGE)
+        if (FLAGS_huge_page_stacks) {
+            // Best-effort hint, only complete 2MB-aligned ranges inside the
+            // stack(excluding the guard) may be promoted by the kernel.
+            madvise((char*)mem + guardsize, stacksize, MADV_HUGEPAGE);
+        }
+#endif
+
         s_stack_count.fetch_add(1, butil::memory_order_relaxed);
         s->bottom = (char*)mem + memsize;
         s->stacksize = stacksize;
@@ -146,6 +177,41 @@ void deallocate_stack_storage(StackStorage* s) {
     }
 }
 
+void advise_free_stack_storage(StackStorage* s, void* parked_sp) {
+#if defined(OS_LINUX)
+    const static uintptr_t PAGESIZE_M1 = getpagesize() - 1;
+    // malloc-ed stacks may share pages with other allocations, only
+    // mmap-ed stacks (guardsize != 0) can be released partially.
+    if (s->guardsize == 0 || NULL == s->bottom || NULL == parked_sp ||
+        RunningOnValgrind()) {
+        return;
+    }
+    char* const low = (char*)s->bottom - s->stacksize;
+    // The context saved by the last bthread_jump_fcontext and everything
+    // the resumed code may touch live at addresses >= `parked_sp'. Keep
+    // one extra page under it resident for the red zone, pages below hold
+    // only dead frames of finished tasks.
+    char* const end = (char*)(((uintptr_t)parked_sp - PAGESIZE_M1 - 1)
+                              & ~PAGESIZE_M1);
+    if (end <= low) {
+        return;
+    }
+#if defined(MADV_FREE)
+    // Lazily reclaimed under memory pressure, cheaper than MADV_DONTNEED.
+    const int advice = MADV_FREE;
+#else
+    const int advice = MADV_DONTNEED;
+#endif
+    if (madvise(low, end - low, advice) == 0) {
+        s_stack_advised_count.fetch_add(1, butil::memory_order_relaxed);
+        s_stack_advised_bytes.fetch_add(end - low, butil::memory_order_relaxed);
+    }
+#else
+    (void)s;
+    (void)parked_sp;
+#endif
+}
+
 int* SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
 int* NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
 int* LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
@@ -52,6 +52,11 @@ int allocate_stack_storage(StackStorage* s, int stacksize, int guardsize);
 // Deallocate a piece of stack. Parameters MUST be returned or set by the
 // corresponding allocate_stack_storage() otherwise behavior is undefined.
 void deallocate_stack_storage(StackStorage* s);
+// Hand cold pages of a pooled stack back to the kernel with madvise().
+// `parked_sp' is the stack pointer saved by the last jump out of the stack,
+// data below it is dead and can be dropped safely while the stack stays in
+// the pool. No-op on non-linux systems and for stacks allocated by malloc.
+void advise_free_stack_storage(StackStorage* s, void* parked_sp);
 
 enum StackType {
     STACK_TYPE_MAIN = 0,
@@ -74,8 +79,12 @@ ContextualStack* get_stack(StackType type, void (*entry)(intptr_t));
 // Recycle a stack. NULL does nothing.
 void return_stack(ContextualStack*);
 // Jump from stack `from' to stack `to'. `from' must be the stack of callsite
-// (to save contexts before jumping)
-void jump_stack(ContextualStack* from, ContextualStack* to);
+// (to save contexts before jumping). `save_fp_state' additionally saves
+// the FP control words of `from', `restore_fp_state' restores those of
+// `to', see BTHREAD_PRESERVE_FP_STATE. Only implemented on linux x86-64,
+// no-ops elsewhere.
+void jump_stack(ContextualStack* from, ContextualStack* to,
+                bool save_fp_state = false, bool restore_fp_state = false);
 
 }  // namespace bthread
 
@@ -25,6 +25,7 @@
 DECLARE_int32(guard_page_size);
 DECLARE_int32(tc_stack_small);
 DECLARE_int32(tc_stack_normal);
+DECLARE_int32(tc_stack_resident);
 
 namespace bthread {
 
@@ -148,18 +149,35 @@ template <typename StackClass> struct StackFactory {
     
     static ContextualStack* get_stack(void (*entry)(intptr_t)) {
         ContextualStack* cs = butil::get_object<Wrapper>(entry);
+        if (tls_pooled_count > 0) {
+            --tls_pooled_count;
+        }
         // Marks stack as addressable.
         BTHREAD_ASAN_UNPOISON_MEMORY_REGION(cs->storage);
         return cs;
     }
-    
+
     static void return_stack(ContextualStack* cs) {
         // Marks stack as unaddressable.
         BTHREAD_ASAN_POISON_MEMORY_REGION(cs->storage);
+        if (FLAGS_tc_stack_resident >= 0 &&
+            ++tls_pooled_count > FLAGS_tc_stack_resident) {
+            // The stack is cold, hand its pages below the parked context
+            // back to the kernel while keeping the stack pooled.
+            advise_free_stack_storage(&cs->storage, cs->context);
+        }
         butil::return_object(static_cast<Wrapper*>(cs));
     }
+
+private:
+    // Approximate number of stacks of this type pooled by this thread,
+    // compared against FLAGS_tc_stack_resident in return_stack().
+    static __thread int tls_pooled_count;
 };
 
+template <typename StackClass>
+__thread int StackFactory<StackClass>::tls_pooled_count = 0;
+
 template <> struct StackFactory<MainStackClass> {
     static ContextualStack* get_stack(void (*)(intptr_t)) {
         ContextualStack* s = new (std::nothrow) ContextualStack;
@@ -212,8 +230,21 @@ inline void return_stack(ContextualStack* s) {
     }
 }
 
-inline void jump_stack(ContextualStack* from, ContextualStack* to) {
+inline void jump_stack(ContextualStack* from, ContextualStack* to,
+                       bool save_fp_state, bool restore_fp_state) {
+#if defined(BTHREAD_CONTEXT_PLATFORM_linux_x86_64)
+    // Bit 0: save the FP control words of `from', bit 1: restore those of
+    // `to'. Split so that a declaring bthread pairs with integer-only
+    // ones without ever restoring an unwritten slot.
+    bthread_jump_fcontext(&from->context, to->context, 0/*not skip remained*/,
+                          (save_fp_state ? 1 : 0) | (restore_fp_state ? 2 : 0));
+#else
+    // Other platforms keep the historical behavior: FP control words are
+    // not carried across switches(BTHREAD_PRESERVE_FP_STATE unsupported).
+    (void)save_fp_state;
+    (void)restore_fp_state;
     bthread_jump_fcontext(&from->context, to->context, 0/*not skip remained*/);
+#endif
 }
 
 }  // namespace bthread
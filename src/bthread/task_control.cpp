@@ -20,6 +20,7 @@
 // Date: Tue Jul 10 17:40:58 CST 2012
 
 #include <sys/syscall.h>                   // SYS_gettid
+#include <algorithm>                       // std::max
 #include "butil/scoped_lock.h"             // BAIDU_SCOPED_LOCK
 #include "butil/errno.h"                   // berror
 #include "butil/logging.h"
@@ -32,6 +33,7 @@
 #include "bthread/task_control.h"
 #include "bthread/timer_thread.h"         // global_timer_thread
 #include <gflags/gflags.h>
+#include "butil/reloadable_flags.h"
 #include "bthread/log.h"
 
 DEFINE_int32(task_group_delete_delay, 1,
@@ -41,9 +43,40 @@ DEFINE_int32(task_group_runqueue_capacity, 4096,
 DEFINE_int32(task_group_yield_before_idle, 0,
              "TaskGroup yields so many times before idle");
 DEFINE_int32(task_group_ntags, 1, "TaskGroup will be grouped by number ntags");
+DEFINE_bool(bthread_numa_aware, false,
+            "Prefer stealing bthreads from workers on the same NUMA node, "
+            "only steal from remote nodes when local run queues are exhausted");
+DEFINE_int32(task_group_steal_batch_size, 8,
+             "Max number of bthreads taken from a victim's runqueue in one "
+             "steal, extra ones land in the thief's own runqueue");
+DEFINE_bool(bthread_elastic_workers, false,
+            "Deeply park surplus workers when load is low: they stop "
+            "spinning and stealing until signal_task cannot hand new tasks "
+            "to regular waiters, cutting idle CPU burn without restart");
+BUTIL_VALIDATE_GFLAG(bthread_elastic_workers, butil::PassValidate);
+DEFINE_int32(bthread_elastic_min_workers, 1,
+             "Keep at least so many workers per tag out of deep parking");
+BUTIL_VALIDATE_GFLAG(bthread_elastic_min_workers, butil::PositiveInteger);
+DEFINE_int32(bthread_elastic_park_after_idle, 64,
+             "Deeply park a worker after so many consecutive wakeups that "
+             "found nothing to run");
+BUTIL_VALIDATE_GFLAG(bthread_elastic_park_after_idle, butil::PositiveInteger);
+DEFINE_int32(bthread_worker_preempt_slice_ms, 0,
+             "When positive, a watchdog flags bthreads occupying a worker "
+             "for longer than so many milliseconds; flagged bthreads give "
+             "the worker back at the next preemption-safe point(an "
+             "unmatched butex or bthread_yield_if_preempted) and requeue "
+             "at normal priority. 0 disables the watchdog");
+BUTIL_VALIDATE_GFLAG(bthread_worker_preempt_slice_ms,
+                     butil::NonNegativeInteger);
 
 namespace bthread {
 
+// steals and stolen tasks of batched steals; the ratio of the two is the
+// average batch size and tells how bursty wakeups are.
+static bvar::Adder<int64_t> g_steal_count("bthread_steal_count");
+static bvar::Adder<int64_t> g_stolen_task_count("bthread_stolen_task_count");
+
 DECLARE_int32(bthread_concurrency);
 DECLARE_int32(bthread_min_concurrency);
 
@@ -71,6 +104,19 @@ struct WorkerThreadArgs {
     bthread_tag_t tag;
 };
 
+// NUMA node of the calling pthread. Workers are generally not bound to
+// cores, the node sampled at startup is a best-effort locality hint.
+static int get_numa_node_of_this_thread() {
+#if defined(OS_LINUX) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
 void* TaskControl::worker_thread(void* arg) {
     run_worker_startfn();
 #ifdef BAIDU_INTERNAL
@@ -91,6 +137,11 @@ void* TaskControl::worker_thread(void* arg) {
     }
 
     g->_tid = syscall(SYS_gettid);
+    if (FLAGS_bthread_numa_aware) {
+        // TaskGroup was just initialized by this pthread, its run queue
+        // pages are first-touched on the local node as well.
+        g->set_numa_node(get_numa_node_of_this_thread());
+    }
 
     std::string worker_thread_name = butil::string_printf(
         "brpc_wkr:%d-%d", g->tag(),
@@ -163,6 +214,18 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+static int64_t get_run_queue_size_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_run_queue_size();
+}
+
+static int64_t get_active_worker_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_active_worker_count();
+}
+
+static int64_t get_deep_parked_worker_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_deep_parked_worker_count();
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _tagged_ngroup(FLAGS_task_group_ntags)
@@ -173,6 +236,7 @@ TaskControl::TaskControl()
     , _next_worker_id(0)
     , _nworkers("bthread_worker_count")
     , _pending_time(NULL)
+    , _sched_delay(NULL)
       // Delay exposure of following two vars because they rely on TC which
       // is not initialized yet.
     , _cumulated_worker_time(get_cumulated_worker_time_from_this, this)
@@ -183,6 +247,14 @@ TaskControl::TaskControl()
     , _signal_per_second(&_cumulated_signal_count)
     , _status(print_rq_sizes_in_the_tc, this)
     , _nbthreads("bthread_count")
+    , _run_queue_size(get_run_queue_size_from_this, this)
+    , _deep_pl(FLAGS_task_group_ntags)
+    , _deep_parked(FLAGS_task_group_ntags)
+    , _active_worker_count(get_active_worker_count_from_this, this)
+    , _parked_worker_count(get_deep_parked_worker_count_from_this, this)
+    , _stop_watchdog(false)
+    , _preempt_signal_count("bthread_preempt_signal_count")
+    , _preempt_yield_count("bthread_preempt_yield_count")
     , _priority_queues(FLAGS_task_group_ntags)
     , _pl(FLAGS_task_group_ntags)
 {}
@@ -201,6 +273,7 @@ int TaskControl::init(int concurrency) {
     // task group group by tags
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         _tagged_ngroup[i].store(0, std::memory_order_relaxed);
+        _deep_parked[i].store(0, std::memory_order_relaxed);
         auto tag_str = std::to_string(i);
         _tagged_nworkers.push_back(new bvar::Adder<int64_t>("bthread_worker_count", tag_str));
         _tagged_cumulated_worker_time.push_back(new bvar::PassiveStatus<double>(
@@ -241,6 +314,9 @@ int TaskControl::init(int concurrency) {
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
     _status.expose("bthread_group_status");
+    _run_queue_size.expose("bthread_runqueue_size");
+    _active_worker_count.expose("bthread_active_worker_count");
+    _parked_worker_count.expose("bthread_deep_parked_worker_count");
 
     // Wait for at least one group is added so that choose_one_group()
     // never returns NULL.
@@ -255,9 +331,68 @@ int TaskControl::init(int concurrency) {
 
     _init.store(true, butil::memory_order_release);
 
+    // Kick off the preemption watchdog. It re-arms itself on the global
+    // timer thread and stays dormant while the flag is off, making
+    // --bthread_worker_preempt_slice_ms effectively reloadable.
+    if (0 == get_global_timer_thread()->schedule(
+            preempt_watchdog, this, butil::milliseconds_from_now(100))) {
+        LOG(WARNING) << "Fail to schedule preemption watchdog";
+    }
+
     return 0;
 }
 
+void TaskControl::preempt_watchdog(void* arg) {
+    static_cast<TaskControl*>(arg)->run_preempt_watchdog();
+}
+
+void TaskControl::run_preempt_watchdog() {
+    if (_stop_watchdog.load(butil::memory_order_relaxed)) {
+        return;
+    }
+    const int slice_ms = FLAGS_bthread_worker_preempt_slice_ms;
+    if (slice_ms > 0) {
+        const int64_t slice_ns = slice_ms * 1000000L;
+        const int64_t now_ns = butil::cpuwide_time_ns();
+        BAIDU_SCOPED_LOCK(_modify_group_mutex);
+        for_each_task_group([&](TaskGroup* g) {
+            if (NULL == g) {
+                return;
+            }
+            const TaskGroup::CPUTimeStat stat = g->_cpu_time_stat.load();
+            if (stat.is_main_task()) {
+                // The worker is idling in run_main_task().
+                return;
+            }
+            const int64_t last_run_ns = stat.last_run_ns();
+            if (0 == last_run_ns || now_ns - last_run_ns < slice_ns ||
+                // This overlong run was already flagged.
+                g->_preempt_signaled_run_ns == last_run_ns) {
+                return;
+            }
+            g->_preempt_signaled_run_ns = last_run_ns;
+            g->_preempt_requested.store(true, butil::memory_order_relaxed);
+            _preempt_signal_count << 1;
+            // TaskMeta is pool-allocated and never freed, dereferencing a
+            // possibly stale _cur_meta is safe; the values are diagnostics.
+            TaskMeta* m = g->_cur_meta;
+            LOG_EVERY_SECOND(WARNING)
+                << "bthread=" << m->tid << " fn=" << (void*)m->fn
+                << " has occupied worker=" << g->tid() << " for "
+                << (now_ns - last_run_ns) / 1000000L
+                << "ms, preemption requested";
+        });
+    }
+    // Re-arm: scan twice per slice(at least every 1ms) so that a hog is
+    // caught within 1.5 slices; poll coarsely while the feature is off.
+    const int64_t next_ms = slice_ms > 0 ?
+        std::max(int64_t(slice_ms) / 2, int64_t(1)) : 100;
+    if (0 == get_global_timer_thread()->schedule(
+            preempt_watchdog, this, butil::milliseconds_from_now(next_ms))) {
+        LOG(WARNING) << "Fail to reschedule preemption watchdog";
+    }
+}
+
 int TaskControl::add_workers(int num, bthread_tag_t tag) {
     if (num <= 0) {
         return 0;
@@ -292,6 +427,19 @@ TaskGroup* TaskControl::choose_one_group(bthread_tag_t tag) {
     auto& groups = tag_group(tag);
     const auto ngroup = tag_ngroup(tag).load(butil::memory_order_acquire);
     if (ngroup != 0) {
+        if (FLAGS_bthread_numa_aware) {
+            // Prefer a group on the caller's node so that bthreads handed
+            // off by pinned non-worker threads (e.g. busy-polling event
+            // dispatchers) and the data they first touch stay on one node.
+            const int node = get_numa_node_of_this_thread();
+            const size_t r = butil::fast_rand_less_than(ngroup);
+            for (size_t i = 0; i < ngroup; ++i) {
+                TaskGroup* g = groups[(r + i) % ngroup];
+                if (g != NULL && g->numa_node() == node) {
+                    return g;
+                }
+            }
+        }
         return groups[butil::fast_rand_less_than(ngroup)];
     }
     CHECK(false) << "Impossible: ngroup is 0";
@@ -311,6 +459,10 @@ std::string TaskControl::stack_trace(bthread_t tid) {
 extern int stop_and_join_epoll_threads();
 
 void TaskControl::stop_and_join() {
+    // The watchdog stops re-arming itself; a possibly in-flight run only
+    // touches this object which outlives the workers.
+    _stop_watchdog.store(true, butil::memory_order_relaxed);
+
     // Close epoll threads so that worker threads are not waiting on epoll(
     // which cannot be woken up by signal_task below)
     CHECK_EQ(0, stop_and_join_epoll_threads());
@@ -327,6 +479,7 @@ void TaskControl::stop_and_join() {
         for (auto& pl : _pl[i]) {
             pl.stop();
         }
+        _deep_pl[i].stop();
     }
 
     for (auto worker: _workers) {
@@ -348,10 +501,14 @@ TaskControl::~TaskControl() {
     // NOTE: g_task_control is not destructed now because the situation
     //       is extremely racy.
     delete _pending_time.exchange(NULL, butil::memory_order_relaxed);
+    delete _sched_delay.exchange(NULL, butil::memory_order_relaxed);
     _worker_usage_second.hide();
     _switch_per_second.hide();
     _signal_per_second.hide();
     _status.hide();
+    _run_queue_size.hide();
+    _active_worker_count.hide();
+    _parked_worker_count.hide();
     
     stop_and_join();
 }
@@ -432,6 +589,46 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
+bool TaskControl::steal_batch_from(TaskGroup* victim, bthread_t* tid) {
+    // Latency-critical tasks are stolen first and one at a time: they are
+    // about to be run rather than parked in the thief's normal runqueue.
+    if (victim->_hp_rq.steal(tid)) {
+        g_steal_count << 1;
+        g_stolen_task_count << 1;
+        return true;
+    }
+    TaskGroup* thief = tls_task_group;
+    bthread_t tids[64];
+    size_t max_n = FLAGS_task_group_steal_batch_size;
+    if (max_n < 1) {
+        max_n = 1;
+    } else if (max_n > arraysize(tids)) {
+        max_n = arraysize(tids);
+    }
+    // Extra tasks are pushed into the thief's own runqueue, never take more
+    // than fits. Only the owner pushes into _rq, so the free space estimated
+    // below can only grow concurrently.
+    const size_t free_space =
+        thief->_rq.capacity() - thief->_rq.volatile_size();
+    if (max_n > free_space + 1) {
+        max_n = free_space + 1; // the 1st task is returned, not pushed.
+    }
+    const size_t n = victim->_rq.steal_batch(tids, max_n);
+    if (0 == n) {
+        return false;
+    }
+    *tid = tids[0];
+    // No signal for the extras: they were already signaled when pushed into
+    // the victim's runqueue, and workers woken by that can steal them from
+    // this group as well.
+    for (size_t i = 1; i < n; ++i) {
+        CHECK(thief->_rq.push(tids[i]));
+    }
+    g_steal_count << 1;
+    g_stolen_task_count << (int64_t)n;
+    return true;
+}
+
 bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     auto tag = tls_task_group->tag();
 
@@ -450,17 +647,41 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     bool stolen = false;
     size_t s = *seed;
     auto& groups = tag_group(tag);
-    for (size_t i = 0; i < ngroup; ++i, s += offset) {
-        TaskGroup* g = groups[s % ngroup];
-        // g is possibly NULL because of concurrent _destroy_group
-        if (g) {
-            if (g->_rq.steal(tid)) {
-                stolen = true;
-                break;
+    if (!FLAGS_bthread_numa_aware) {
+        for (size_t i = 0; i < ngroup; ++i, s += offset) {
+            TaskGroup* g = groups[s % ngroup];
+            // g is possibly NULL because of concurrent _destroy_group
+            if (g) {
+                if (steal_batch_from(g, tid)) {
+                    stolen = true;
+                    break;
+                }
+                if (g->_remote_rq.pop(tid)) {
+                    stolen = true;
+                    break;
+                }
             }
-            if (g->_remote_rq.pop(tid)) {
-                stolen = true;
-                break;
+        }
+    } else {
+        // Pass 0 only looks at groups on this worker's NUMA node, pass 1
+        // falls back to the remote nodes. Cross-node steals pull the whole
+        // task state over the interconnect and are much more expensive.
+        const int local_node = tls_task_group->numa_node();
+        for (int pass = 0; pass < 2 && !stolen; ++pass) {
+            for (size_t i = 0; i < ngroup; ++i, s += offset) {
+                TaskGroup* g = groups[s % ngroup];
+                if (NULL == g ||
+                    (g->numa_node() == local_node) != (0 == pass)) {
+                    continue;
+                }
+                if (steal_batch_from(g, tid)) {
+                    stolen = true;
+                    break;
+                }
+                if (g->_remote_rq.pop(tid)) {
+                    stolen = true;
+                    break;
+                }
             }
         }
     }
@@ -468,6 +689,52 @@ bool TaskControl::steal_task(bthread_t* tid, size_t* seed, size_t offset) {
     return stolen;
 }
 
+bool TaskControl::begin_deep_park(TaskGroup* g) {
+    const bthread_tag_t tag = g->tag();
+    int min_active = FLAGS_bthread_elastic_min_workers;
+    if (min_active < 1) {
+        min_active = 1;
+    }
+    const int nworker = (int)tag_ngroup(tag).load(butil::memory_order_acquire);
+    int parked = _deep_parked[tag].load(butil::memory_order_relaxed);
+    do {
+        if (nworker - parked <= min_active) {
+            return false;
+        }
+        // seq_cst so that a producer pushing a task and then reading
+        // _deep_parked in signal_task either sees this worker parked(and
+        // wakes the deep lot) or ran entirely before, in which case the
+        // caller's re-examination of the queues finds the task.
+    } while (!_deep_parked[tag].compare_exchange_weak(
+                 parked, parked + 1, butil::memory_order_seq_cst,
+                 butil::memory_order_relaxed));
+    // Captured before the caller re-examines the queues, signals arriving
+    // in between are not missed by deep_park_wait().
+    g->_deep_pl_state = _deep_pl[tag].get_state();
+    return true;
+}
+
+void TaskControl::cancel_deep_park(TaskGroup* g) {
+    _deep_parked[g->tag()].fetch_sub(1, butil::memory_order_relaxed);
+}
+
+void TaskControl::deep_park_wait(TaskGroup* g) {
+    _deep_pl[g->tag()].wait(g->_deep_pl_state);
+    _deep_parked[g->tag()].fetch_sub(1, butil::memory_order_relaxed);
+}
+
+int64_t TaskControl::get_active_worker_count() {
+    return concurrency() - get_deep_parked_worker_count();
+}
+
+int64_t TaskControl::get_deep_parked_worker_count() {
+    int64_t parked = 0;
+    for (size_t i = 0; i < _deep_parked.size(); ++i) {
+        parked += _deep_parked[i].load(butil::memory_order_relaxed);
+    }
+    return parked;
+}
+
 void TaskControl::signal_task(int num_task, bthread_tag_t tag) {
     if (num_task <= 0) {
         return;
@@ -490,6 +757,14 @@ void TaskControl::signal_task(int num_task, bthread_tag_t tag) {
             num_task -= pl[start_index].signal(1);
         }
     }
+    if (num_task > 0 && FLAGS_bthread_elastic_workers &&
+        // seq_cst pairs with the parked worker's counter update, see
+        // begin_deep_park().
+        _deep_parked[tag].load(butil::memory_order_seq_cst) > 0) {
+        // Regular waiters did not absorb all signals, queue pressure is
+        // building up: pull deeply parked workers back into the active set.
+        num_task -= _deep_pl[tag].signal(num_task);
+    }
     if (num_task > 0 &&
         FLAGS_bthread_min_concurrency > 0 &&    // test min_concurrency for performance
         _concurrency.load(butil::memory_order_relaxed) < FLAGS_bthread_concurrency) {
@@ -542,6 +817,50 @@ double TaskControl::get_cumulated_worker_time(bthread_tag_t tag) {
     return cputime_ns / 1000000000.0;
 }
 
+int64_t TaskControl::get_run_queue_size() {
+    int64_t c = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    for_each_task_group([&](TaskGroup* g) {
+        if (g) {
+            c += g->rq_size() + g->_remote_rq.volatile_size();
+        }
+    });
+    return c;
+}
+
+void TaskControl::print_sched_stat(std::ostream& os) {
+    os << "workers=" << concurrency()
+       << "\nrunqueue_size=" << get_run_queue_size()
+       << "\nsteal_count=" << g_steal_count.get_value()
+       << "\nstolen_task_count=" << g_stolen_task_count.get_value() << '\n';
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    int i = 0;
+    for_each_task_group([&](TaskGroup* g) {
+        if (g) {
+            os << "group[" << i << "]: tag=" << g->tag()
+               << " worker_tid=" << g->tid()
+               << " rq=" << g->_rq.volatile_size()
+               << " hp_rq=" << g->_hp_rq.volatile_size()
+               << " remote_rq=" << g->_remote_rq.volatile_size()
+               << " nswitch=" << g->_nswitch
+               << " nsignaled=" << g->_nsignaled + g->_remote_nsignaled
+               << '\n';
+        }
+        ++i;
+    });
+}
+
+// Scheduler counters for the /bthreads builtin service.
+void print_sched_stat(std::ostream& os) {
+    extern TaskControl* g_task_control;
+    TaskControl* c = g_task_control;
+    if (c != NULL) {
+        c->print_sched_stat(os);
+    } else {
+        os << "bthread workers are not started yet\n";
+    }
+}
+
 int64_t TaskControl::get_cumulated_switch_count() {
     int64_t c = 0;
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
@@ -564,6 +883,22 @@ int64_t TaskControl::get_cumulated_signal_count() {
     return c;
 }
 
+bvar::LatencyRecorder* TaskControl::create_exposed_sched_delay() {
+    bool is_creator = false;
+    _pending_time_mutex.lock();
+    bvar::LatencyRecorder* sd = _sched_delay.load(butil::memory_order_consume);
+    if (!sd) {
+        sd = new bvar::LatencyRecorder;
+        _sched_delay.store(sd, butil::memory_order_release);
+        is_creator = true;
+    }
+    _pending_time_mutex.unlock();
+    if (is_creator) {
+        sd->expose("bthread_sched_delay");
+    }
+    return sd;
+}
+
 bvar::LatencyRecorder* TaskControl::create_exposed_pending_time() {
     bool is_creator = false;
     _pending_time_mutex.lock();
@@ -82,6 +82,16 @@ public:
     double get_cumulated_worker_time(bthread_tag_t tag);
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
+    // Sum of runnable tasks parked in local/hp/remote queues of all groups.
+    int64_t get_run_queue_size();
+
+    // Print per-group scheduler counters, surfaced in /bthreads.
+    void print_sched_stat(std::ostream& os);
+
+    // Workers of this control that are not deeply parked.
+    int64_t get_active_worker_count();
+    // Workers deeply parked by --bthread_elastic_workers.
+    int64_t get_deep_parked_worker_count();
 
     // [Not thread safe] Add more worker threads.
     // Return the number of workers actually added, which may be less than |num|
@@ -119,15 +129,44 @@ private:
     // Tag parking slot
     TaggedParkingLot& tag_pl(bthread_tag_t tag) { return _pl[tag]; }
 
+    // Steal a burst of tasks from `victim': the first one is returned
+    // through `tid', extra ones land in the thief's own run queue.
+    // Returns true iff at least one task was stolen.
+    bool steal_batch_from(TaskGroup* victim, bthread_t* tid);
+
+    // Elastic worker scaling(--bthread_elastic_workers): a worker whose
+    // wakeups keep finding nothing to run offers itself as surplus and
+    // sleeps on a per-tag deep parking lot, out of the spin/steal set,
+    // until signal_task() cannot hand its signals to regular waiters.
+    //
+    // Count the calling worker into the parked set of its tag and capture
+    // the deep lot state. Returns false if the tag cannot spare a worker.
+    bool begin_deep_park(TaskGroup* g);
+    // Undo begin_deep_park() without sleeping(a task showed up).
+    void cancel_deep_park(TaskGroup* g);
+    // Sleep until queue pressure or stopping wakes the caller, then leave
+    // the parked set.
+    void deep_park_wait(TaskGroup* g);
+
     static void delete_task_group(void* arg);
 
     static void* worker_thread(void* task_control);
 
+    // Preemption watchdog(--bthread_worker_preempt_slice_ms): re-arms
+    // itself on the global TimerThread and flags tasks that occupied their
+    // worker for a whole slice, see TaskGroup::yield_if_preempted().
+    static void preempt_watchdog(void* arg);
+    void run_preempt_watchdog();
+
     template <typename F>
     void for_each_task_group(F const& f);
 
     bvar::LatencyRecorder& exposed_pending_time();
     bvar::LatencyRecorder* create_exposed_pending_time();
+    // Ready-to-run delay of tasks sampled by
+    // --bthread_sched_delay_sample_rate, in microseconds.
+    bvar::LatencyRecorder& exposed_sched_delay();
+    bvar::LatencyRecorder* create_exposed_sched_delay();
     bvar::Adder<int64_t>& tag_nworkers(bthread_tag_t tag);
     bvar::Adder<int64_t>& tag_nbthreads(bthread_tag_t tag);
 
@@ -144,6 +183,7 @@ private:
     bvar::Adder<int64_t> _nworkers;
     butil::Mutex _pending_time_mutex;
     butil::atomic<bvar::LatencyRecorder*> _pending_time;
+    butil::atomic<bvar::LatencyRecorder*> _sched_delay;
     bvar::PassiveStatus<double> _cumulated_worker_time;
     bvar::PerSecond<bvar::PassiveStatus<double> > _worker_usage_second;
     bvar::PassiveStatus<int64_t> _cumulated_switch_count;
@@ -152,6 +192,21 @@ private:
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
     bvar::PassiveStatus<std::string> _status;
     bvar::Adder<int64_t> _nbthreads;
+    bvar::PassiveStatus<int64_t> _run_queue_size;
+
+    // One deep parking lot and parked counter per tag, for
+    // --bthread_elastic_workers.
+    std::vector<ParkingLot> _deep_pl;
+    std::vector<butil::atomic<int>> _deep_parked;
+    bvar::PassiveStatus<int64_t> _active_worker_count;
+    bvar::PassiveStatus<int64_t> _parked_worker_count;
+
+    // Stops rescheduling of the preemption watchdog.
+    butil::atomic<bool> _stop_watchdog;
+    // # of tasks flagged by the watchdog for running beyond the slice.
+    bvar::Adder<int64_t> _preempt_signal_count;
+    // # of flagged tasks that actually yielded at a safe point.
+    bvar::Adder<int64_t> _preempt_yield_count;
 
     std::vector<bvar::Adder<int64_t>*> _tagged_nworkers;
     std::vector<bvar::PassiveStatus<double>*> _tagged_cumulated_worker_time;
@@ -175,6 +230,14 @@ inline bvar::LatencyRecorder& TaskControl::exposed_pending_time() {
     return *pt;
 }
 
+inline bvar::LatencyRecorder& TaskControl::exposed_sched_delay() {
+    bvar::LatencyRecorder* sd = _sched_delay.load(butil::memory_order_consume);
+    if (!sd) {
+        sd = create_exposed_sched_delay();
+    }
+    return *sd;
+}
+
 inline bvar::Adder<int64_t>& TaskControl::tag_nworkers(bthread_tag_t tag) {
     return *_tagged_nworkers[tag];
 }
@@ -21,6 +21,7 @@
 
 #include <sys/types.h>
 #include <stddef.h>                         // size_t
+#include <algorithm>                        // std::min, std::max
 #include <gflags/gflags.h>
 #include "butil/compat.h"                   // OS_MACOSX
 #include "butil/macros.h"                   // ARRAY_SIZE
@@ -62,6 +63,52 @@ DEFINE_bool(bthread_enable_cpu_clock_stat, false,
             "Enable CPU clock statistics for bthread");
 BUTIL_VALIDATE_GFLAG(bthread_enable_cpu_clock_stat, butil::PassValidate);
 
+DEFINE_int32(bthread_idle_spin, 0,
+             "Max busy-spin iterations of an idle worker polling for new "
+             "tasks before parking into futex_wait, 0 disables spinning");
+BUTIL_VALIDATE_GFLAG(bthread_idle_spin, butil::PassValidate);
+
+DEFINE_int32(bthread_max_spinning_workers, 1,
+             "Max number of workers spinning concurrently in "
+             "--bthread_idle_spin mode, the rest park directly");
+BUTIL_VALIDATE_GFLAG(bthread_max_spinning_workers, butil::PassValidate);
+
+DEFINE_int32(bthread_priority_burst, 16,
+             "Max number of consecutive BTHREAD_LATENCY_CRITICAL bthreads "
+             "run by a worker before a waiting normal bthread is let "
+             "through, preventing a flood of critical tasks from starving "
+             "normal ones");
+static bool validate_bthread_priority_burst(const char*, int32_t val) {
+    return val > 0;
+}
+BUTIL_VALIDATE_GFLAG(bthread_priority_burst, validate_bthread_priority_burst);
+
+DEFINE_int32(bthread_sched_delay_sample_rate, 0,
+             "Stamp one in so many bthreads pushed to runqueues with the "
+             "enqueue time and record how long it took them to actually get "
+             "a worker into /vars/bthread_sched_delay_*, 0 disables sampling");
+BUTIL_VALIDATE_GFLAG(bthread_sched_delay_sample_rate, butil::PassValidate);
+
+DECLARE_bool(bthread_elastic_workers);
+DECLARE_int32(bthread_elastic_park_after_idle);
+
+// Number of workers currently inside spin_for_task().
+static butil::atomic<int> g_spinning_workers(0);
+
+// Sampling for --bthread_sched_delay_sample_rate. Unsampled tasks only pay
+// a flag load, sampled ones a clock read; the delay itself is computed in
+// sched_to from a timestamp it reads anyway.
+inline void stamp_ready_time(TaskMeta* meta) {
+    const int rate = FLAGS_bthread_sched_delay_sample_rate;
+    if (rate > 0) {
+        static __thread int tls_sched_delay_tick = 0;
+        if (++tls_sched_delay_tick >= rate) {
+            tls_sched_delay_tick = 0;
+            meta->ready_ns = butil::cpuwide_time_ns();
+        }
+    }
+}
+
 BAIDU_VOLATILE_THREAD_LOCAL(TaskGroup*, tls_task_group, NULL);
 // Sync with TaskMeta::local_storage when a bthread is created or destroyed.
 // During running, the two fields may be inconsistent, use tls_bls as the
@@ -158,25 +205,111 @@ bool TaskGroup::is_stopped(bthread_t tid) {
     return true;
 }
 
+bool TaskGroup::spin_for_task(bthread_t* tid) {
+    const int spin_max = FLAGS_bthread_idle_spin;
+    if (spin_max <= 0) {
+        return false;
+    }
+    if (g_spinning_workers.fetch_add(1, butil::memory_order_relaxed)
+        >= FLAGS_bthread_max_spinning_workers) {
+        // Enough workers are burning cycles already, park instead.
+        g_spinning_workers.fetch_sub(1, butil::memory_order_relaxed);
+        return false;
+    }
+    if (_idle_spin_budget <= 0) {
+        _idle_spin_budget = spin_max / 2 + 1;
+    }
+    const int budget = std::min(_idle_spin_budget, spin_max);
+    bool found = false;
+    for (int i = 0; i < budget; ++i) {
+        cpu_relax();
+        if (_remote_rq.pop(tid)) {
+            found = true;
+            break;
+        }
+        // Scanning all groups is much costlier than polling our own
+        // remote queue, do it once per 16 spins.
+        if ((i & 15) == 15 && steal_task(tid)) {
+            found = true;
+            break;
+        }
+    }
+    g_spinning_workers.fetch_sub(1, butil::memory_order_relaxed);
+    // The budget follows the recent task arrival rate: grow it while
+    // spinning keeps paying off, shrink it when the loop expires so that
+    // mostly-idle workers fall back to parking quickly.
+    if (found) {
+        _idle_spin_budget = std::min(spin_max, budget * 2);
+    } else {
+        _idle_spin_budget = std::max(16, budget / 2);
+    }
+    return found;
+}
+
 bool TaskGroup::wait_task(bthread_t* tid) {
     do {
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         if (_last_pl_state.stopped()) {
             return false;
         }
+        // steal_task() inside refreshes _last_pl_state, signals arriving
+        // while we were spinning are not missed by the wait() below.
+        if (spin_for_task(tid)) {
+            _idle_wakeup_streak = 0;
+            return true;
+        }
+        // A long streak of wakeups that found nothing to run means there
+        // are more active workers than runnable tasks: offer this one as
+        // surplus and sleep deeply until queue pressure builds up again.
+        if (FLAGS_bthread_elastic_workers &&
+            _idle_wakeup_streak >= FLAGS_bthread_elastic_park_after_idle &&
+            _control->begin_deep_park(this)) {
+            // Tasks pushed before the parked count became visible do not
+            // wake the deep lot, re-examine the queues before sleeping.
+            if (steal_task(tid)) {
+                _control->cancel_deep_park(this);
+                _idle_wakeup_streak = 0;
+                return true;
+            }
+            _control->deep_park_wait(this);
+            // Woken by queue pressure(or stopping); rejoin the active set
+            // and earn the idle streak from scratch.
+            _idle_wakeup_streak = 0;
+            continue;
+        }
         _pl->wait(_last_pl_state);
         if (steal_task(tid)) {
+            _idle_wakeup_streak = 0;
             return true;
         }
+        ++_idle_wakeup_streak;
 #else
         const ParkingLot::State st = _pl->get_state();
         if (st.stopped()) {
             return false;
         }
         if (steal_task(tid)) {
+            _idle_wakeup_streak = 0;
+            return true;
+        }
+        if (spin_for_task(tid)) {
+            _idle_wakeup_streak = 0;
             return true;
         }
+        if (FLAGS_bthread_elastic_workers &&
+            _idle_wakeup_streak >= FLAGS_bthread_elastic_park_after_idle &&
+            _control->begin_deep_park(this)) {
+            if (steal_task(tid)) {
+                _control->cancel_deep_park(this);
+                _idle_wakeup_streak = 0;
+                return true;
+            }
+            _control->deep_park_wait(this);
+            _idle_wakeup_streak = 0;
+            continue;
+        }
         _pl->wait(st);
+        ++_idle_wakeup_streak;
 #endif
     } while (true);
 }
@@ -274,6 +407,10 @@ int TaskGroup::init(size_t runqueue_capacity) {
         LOG(FATAL) << "Fail to init _rq";
         return -1;
     }
+    if (_hp_rq.init(runqueue_capacity) != 0) {
+        LOG(FATAL) << "Fail to init _hp_rq";
+        return -1;
+    }
     if (_remote_rq.init(runqueue_capacity / 2) != 0) {
         LOG(FATAL) << "Fail to init _remote_rq";
         return -1;
@@ -307,6 +444,7 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = butil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->attr = BTHREAD_ATTR_TASKGROUP;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
@@ -496,6 +634,7 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -561,6 +700,7 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -633,18 +773,43 @@ TaskStatistics TaskGroup::main_stat() const {
     return m ? m->stat : EMPTY_STAT;
 }
 
+// Pop from the owned queue.
+// When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
+// WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
+// to 2.9%
+static inline bool pop_from_own_queue(WorkStealingQueue<bthread_t>& rq,
+                                      bthread_t* tid) {
+#ifndef BTHREAD_FAIR_WSQ
+    return rq.pop(tid);
+#else
+    return rq.steal(tid);
+#endif
+}
+
+bool TaskGroup::pop_local(bthread_t* tid) {
+    // Starvation protection: after --bthread_priority_burst consecutive
+    // high-priority tasks, let one normal task through if any is waiting.
+    if (_hp_run_streak >= FLAGS_bthread_priority_burst &&
+        pop_from_own_queue(_rq, tid)) {
+        _hp_run_streak = 0;
+        return true;
+    }
+    if (pop_from_own_queue(_hp_rq, tid)) {
+        ++_hp_run_streak;
+        return true;
+    }
+    if (pop_from_own_queue(_rq, tid)) {
+        _hp_run_streak = 0;
+        return true;
+    }
+    return false;
+}
+
 void TaskGroup::ending_sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     bthread_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef BTHREAD_FAIR_WSQ
-    // When BTHREAD_FAIR_WSQ is defined, profiling shows that cpu cost of
-    // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
-    // to 2.9%
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
+    const bool popped = g->pop_local(&next_tid);
     if (!popped && !g->steal_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
@@ -685,11 +850,7 @@ void TaskGroup::sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     bthread_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef BTHREAD_FAIR_WSQ
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
+    const bool popped = g->pop_local(&next_tid);
     if (!popped && !g->steal_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
@@ -713,14 +874,30 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta, bool cur_ending) {
 
     TaskMeta* const cur_meta = g->_cur_meta;
     int64_t now = butil::cpuwide_time_ns();
+    // Refresh butil's coarse clock with the value read anyway, making
+    // scheduling boundaries additional tick points besides its ticker.
+    butil::detail::set_coarse_cpuwide_time_ns(now);
     CPUTimeStat cpu_time_stat = g->_cpu_time_stat.load_unsafe();
     int64_t elp_ns = now - cpu_time_stat.last_run_ns();
     cur_meta->stat.cputime_ns += elp_ns;
+
+    if (next_meta->ready_ns != 0) {
+        // Stamped by stamp_ready_time: time from entering a runqueue to
+        // getting a worker, including any cross-group steal.
+        g->_control->exposed_sched_delay() << (now - next_meta->ready_ns) / 1000L;
+        next_meta->ready_ns = 0;
+    }
     // Update cpu_time_stat.
     cpu_time_stat.set_last_run_ns(now, is_main_task(g, next_meta->tid));
     cpu_time_stat.add_cumulated_cputime_ns(elp_ns, is_main_task(g, cur_meta->tid));
     g->_cpu_time_stat.store(cpu_time_stat);
 
+    // The task occupying this worker changes, a pending preemption request
+    // targeted the previous one.
+    if (g->_preempt_requested.load(butil::memory_order_relaxed)) {
+        g->_preempt_requested.store(false, butil::memory_order_relaxed);
+    }
+
     if (FLAGS_bthread_enable_cpu_clock_stat) {
         const int64_t cpu_thread_time = butil::cputhread_time_ns();
         if (g->_last_cpu_clock_ns != 0) {
@@ -755,9 +932,35 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta, bool cur_ending) {
                 g->_control->_task_tracer.set_status(TASK_STATUS_JUMPING, cur_meta);
                 g->_control->_task_tracer.set_status(TASK_STATUS_JUMPING, next_meta);
 #endif // BRPC_BTHREAD_TRACER
+#if !defined(NDEBUG) && defined(__x86_64__)
+                // Verify the lazy-FP contract: a bthread without
+                // BTHREAD_PRESERVE_FP_STATE must not change the MXCSR
+                // control bits, such a change would leak into unrelated
+                // bthreads since default switches skip FP state. Status
+                // flags(bit 0-5) are set by ordinary FP math and ignored.
+                if (!(cur_meta->attr.flags & BTHREAD_PRESERVE_FP_STATE)) {
+                    static __thread uint32_t tls_expected_mxcsr = 0;
+                    uint32_t mxcsr = 0;
+                    __asm__ __volatile__("stmxcsr %0" : "=m"(mxcsr));
+                    mxcsr &= ~(uint32_t)0x3F;
+                    if (tls_expected_mxcsr == 0) {
+                        tls_expected_mxcsr = mxcsr;
+                    } else {
+                        CHECK_EQ(tls_expected_mxcsr, mxcsr)
+                            << "bthread=" << cur_meta->tid << " changed MXCSR"
+                            " without BTHREAD_PRESERVE_FP_STATE";
+                    }
+                }
+#endif
                 {
                     BTHREAD_SCOPED_ASAN_FIBER_SWITCHER(next_meta->stack->storage);
-                    jump_stack(cur_meta->stack, next_meta->stack);
+                    // FP control words ride along only for bthreads that
+                    // declared to depend on them, each side independently.
+                    jump_stack(cur_meta->stack, next_meta->stack,
+                               (cur_meta->attr.flags
+                                & BTHREAD_PRESERVE_FP_STATE) != 0,
+                               (next_meta->attr.flags
+                                & BTHREAD_PRESERVE_FP_STATE) != 0);
                 }
                 // probably went to another group, need to assign g again.
                 g = BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
@@ -815,7 +1018,12 @@ void TaskGroup::ready_to_run(TaskMeta* meta, bool nosignal) {
 #ifdef BRPC_BTHREAD_TRACER
     _control->_task_tracer.set_status(TASK_STATUS_READY, meta);
 #endif // BRPC_BTHREAD_TRACER
-    push_rq(meta->tid);
+    stamp_ready_time(meta);
+    if (meta->attr.flags & BTHREAD_LATENCY_CRITICAL) {
+        push_hp_rq(meta->tid);
+    } else {
+        push_rq(meta->tid);
+    }
     if (nosignal) {
         ++_num_nosignal;
     } else {
@@ -839,38 +1047,96 @@ void TaskGroup::ready_to_run_remote(TaskMeta* meta, bool nosignal) {
 #ifdef BRPC_BTHREAD_TRACER
     _control->_task_tracer.set_status(TASK_STATUS_READY, meta);
 #endif // BRPC_BTHREAD_TRACER
-    _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(meta->tid)) {
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    stamp_ready_time(meta);
+    push_remote_task(meta->tid);
+    if (nosignal) {
+        _remote_num_nosignal.fetch_add(1, butil::memory_order_relaxed);
+    } else {
+        const int additional_signal =
+            _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
+        _remote_nsignaled.fetch_add(1 + additional_signal,
+                                    butil::memory_order_relaxed);
+        _control->signal_task(1 + additional_signal, _tag);
+    }
+}
+
+void TaskGroup::push_remote_task(bthread_t tid) {
+    if (_remote_rq.push(tid)) {
+        return;
+    }
+    // The ring is full: consumers are severely behind. Deliver signals
+    // buffered by nosignal-submissions so that workers surely drain the
+    // ring, then yield to them before escalating to sleeps.
+    int sleep_us = 0;
+    do {
+        flush_nosignal_tasks_remote();
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
                                 << _remote_rq.capacity();
-        ::usleep(1000);
-        _remote_rq._mutex.lock();
+        if (0 == sleep_us) {
+            sched_yield();
+            sleep_us = 10;
+        } else {
+            ::usleep(sleep_us);
+            sleep_us = std::min(sleep_us * 2, 1000);
+        }
+    } while (!_remote_rq.push(tid));
+}
+
+void TaskGroup::ready_to_run_remote_batch(TaskMeta* const* metas, size_t n,
+                                          bool nosignal) {
+    if (0 == n) {
+        return;
+    }
+#ifdef BRPC_BTHREAD_TRACER
+    for (size_t i = 0; i < n; ++i) {
+        _control->_task_tracer.set_status(TASK_STATUS_READY, metas[i]);
+    }
+#endif // BRPC_BTHREAD_TRACER
+    for (size_t i = 0; i < n; ++i) {
+        stamp_ready_time(metas[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        push_remote_task(metas[i]->tid);
     }
     if (nosignal) {
-        ++_remote_num_nosignal;
-        _remote_rq._mutex.unlock();
+        _remote_num_nosignal.fetch_add((int)n, butil::memory_order_relaxed);
     } else {
-        const int additional_signal = _remote_num_nosignal;
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += 1 + additional_signal;
-        _remote_rq._mutex.unlock();
-        _control->signal_task(1 + additional_signal, _tag);
+        const int additional_signal =
+            _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
+        _remote_nsignaled.fetch_add((int)n + additional_signal,
+                                    butil::memory_order_relaxed);
+        _control->signal_task((int)n + additional_signal, _tag);
     }
 }
 
-void TaskGroup::flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex) {
-    const int val = _remote_num_nosignal;
+void TaskGroup::flush_nosignal_tasks_remote() {
+    const int val = _remote_num_nosignal.exchange(0, butil::memory_order_relaxed);
     if (!val) {
-        locked_mutex.unlock();
         return;
     }
-    _remote_num_nosignal = 0;
-    _remote_nsignaled += val;
-    locked_mutex.unlock();
+    _remote_nsignaled.fetch_add(val, butil::memory_order_relaxed);
     _control->signal_task(val, _tag);
 }
 
+bool TaskGroup::drain_remote_tasks(bthread_t* tid) {
+    bthread_t tasks[REMOTE_DRAIN_BATCH];
+    // Never move more into _rq than it can take, push_rq blocks on full.
+    const size_t rq_free = _rq.capacity() - _rq.volatile_size();
+    const size_t limit = std::min((size_t)REMOTE_DRAIN_BATCH, rq_free + 1);
+    const size_t n = _remote_rq.pop_batch(tasks, limit);
+    if (0 == n) {
+        return false;
+    }
+    *tid = tasks[0];
+    // The rest go to the local runqueue where they are either run by this
+    // worker right after |*tid| or stolen by the workers that were already
+    // signaled when the tasks were submitted.
+    for (size_t i = 1; i < n; ++i) {
+        push_rq(tasks[i]);
+    }
+    return true;
+}
+
 void TaskGroup::ready_to_run_general(TaskMeta* meta, bool nosignal) {
     if (tls_task_group == this) {
         return ready_to_run(meta, nosignal);
@@ -896,9 +1162,29 @@ void TaskGroup::ready_to_run_in_worker_ignoresignal(void* args_in) {
     tls_task_group->_control->_task_tracer.set_status(
         TASK_STATUS_READY, args->meta);
 #endif // BRPC_BTHREAD_TRACER
+    stamp_ready_time(args->meta);
+    if (args->meta->attr.flags & BTHREAD_LATENCY_CRITICAL) {
+        return tls_task_group->push_hp_rq(args->meta->tid);
+    }
     return tls_task_group->push_rq(args->meta->tid);
 }
 
+void TaskGroup::preempted_to_run(void* args_in) {
+    ReadyToRunArgs* args = static_cast<ReadyToRunArgs*>(args_in);
+#ifdef BRPC_BTHREAD_TRACER
+    tls_task_group->_control->_task_tracer.set_status(
+        TASK_STATUS_READY, args->meta);
+#endif // BRPC_BTHREAD_TRACER
+    stamp_ready_time(args->meta);
+    // Demote to the normal runqueue even for BTHREAD_LATENCY_CRITICAL
+    // tasks: a task that overran its slice does not get to jump the queue
+    // again. Signal so that an idle worker may steal it while this worker
+    // keeps running other tasks.
+    TaskGroup* g = tls_task_group;
+    g->push_rq(args->meta->tid);
+    g->_control->signal_task(1, args->tag);
+}
+
 void TaskGroup::priority_to_run(void* args_in) {
     ReadyToRunArgs* args = static_cast<ReadyToRunArgs*>(args_in);
 #ifdef BRPC_BTHREAD_TRACER
@@ -1088,6 +1374,24 @@ void TaskGroup::yield(TaskGroup** pg) {
     sched(pg);
 }
 
+bool TaskGroup::yield_if_preempted(TaskGroup** pg) {
+    TaskGroup* g = *pg;
+    if (__builtin_expect(
+            !g->_preempt_requested.load(butil::memory_order_relaxed), 1)) {
+        return false;
+    }
+    g->_preempt_requested.store(false, butil::memory_order_relaxed);
+    if (g->is_current_pthread_task()) {
+        // The worker's pthread context cannot be scheduled away.
+        return false;
+    }
+    g->_control->_preempt_yield_count << 1;
+    ReadyToRunArgs args = { g->tag(), g->_cur_meta, false };
+    g->set_remained(preempted_to_run, &args);
+    sched(pg);
+    return true;
+}
+
 void print_task(std::ostream& os, bthread_t tid) {
     TaskMeta* const m = TaskGroup::address_meta(tid);
     if (m == NULL) {
@@ -135,6 +135,14 @@ public:
     // is undefined.
     static void yield(TaskGroup** pg);
 
+    // Give up the worker iff the preemption watchdog flagged the current
+    // task for occupying its worker beyond --bthread_worker_preempt_slice_ms.
+    // The caller is requeued in the normal runqueue regardless of
+    // BTHREAD_LATENCY_CRITICAL so that it cannot jump the queue again right
+    // away. Nearly free when the task was not flagged.
+    // Returns true iff the caller yielded.
+    static bool yield_if_preempted(TaskGroup** pg);
+
     // Suspend caller until bthread `tid' terminates.
     static int join(bthread_t tid, void** return_value);
 
@@ -187,7 +195,10 @@ public:
 
     // Push a bthread into the runqueue from another non-worker thread.
     void ready_to_run_remote(TaskMeta* meta, bool nosignal = false);
-    void flush_nosignal_tasks_remote_locked(butil::Mutex& locked_mutex);
+    // Push a batch of bthreads into the runqueue from another non-worker
+    // thread, signaling once for the whole batch instead of per bthread.
+    void ready_to_run_remote_batch(TaskMeta* const* metas, size_t n,
+                                   bool nosignal = false);
     void flush_nosignal_tasks_remote();
 
     // Automatically decide the caller is remote or local, and call
@@ -212,13 +223,21 @@ public:
     // process make go on indefinitely.
     void push_rq(bthread_t tid);
 
+    // Ditto for the high-priority queue of latency-critical tasks.
+    void push_hp_rq(bthread_t tid);
+
     // Returns size of local run queue.
     size_t rq_size() const {
-        return _rq.volatile_size();
+        return _rq.volatile_size() + _hp_rq.volatile_size();
     }
 
     bthread_tag_t tag() const { return _tag; }
 
+    // NUMA node of the worker pthread running this group. Always 0 unless
+    // --bthread_numa_aware is on.
+    int numa_node() const { return _numa_node; }
+    void set_numa_node(int node) { _numa_node = node; }
+
     pid_t tid() const { return _tid; }
 
     int64_t current_task_cpu_clock_ns() {
@@ -322,14 +341,36 @@ friend class TaskControl;
     static void ready_to_run_in_worker(void*);
     static void ready_to_run_in_worker_ignoresignal(void*);
     static void priority_to_run(void*);
+    static void preempted_to_run(void*);
+
+    // Max # of tasks drain_remote_tasks() moves out of _remote_rq at once.
+    static const size_t REMOTE_DRAIN_BATCH = 16;
+
+    // Push |tid| into _remote_rq, backing off until a slot frees up when
+    // the ring is full.
+    void push_remote_task(bthread_t tid);
 
     // Wait for a task to run.
     // Returns true on success, false is treated as permanent error and the
     // loop calling this function should end.
     bool wait_task(bthread_t* tid);
 
+    // Busy-poll the remote queue and other groups for a task before
+    // parking, bounded by --bthread_idle_spin and the number of workers
+    // already spinning. Returns true iff a task was found.
+    bool spin_for_task(bthread_t* tid);
+
+    // Pop a task from the local runqueues, latency-critical ones first
+    // with protection against starving the normal queue.
+    bool pop_local(bthread_t* tid);
+
+    // Pop a batch of tasks from _remote_rq: the first one is returned in
+    // |*tid|, the rest are moved into the local runqueue so that one wakeup
+    // drains several remote submissions. Returns true iff a task was popped.
+    bool drain_remote_tasks(bthread_t* tid);
+
     bool steal_task(bthread_t* tid) {
-        if (_remote_rq.pop(tid)) {
+        if (drain_remote_tasks(tid)) {
             return true;
         }
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
@@ -369,14 +410,39 @@ friend class TaskControl;
     ContextualStack* _main_stack{NULL};
     bthread_t _main_tid{INVALID_BTHREAD};
     WorkStealingQueue<bthread_t> _rq;
+    // Runqueue of BTHREAD_LATENCY_CRITICAL tasks, drained before _rq.
+    WorkStealingQueue<bthread_t> _hp_rq;
+    // Consecutive tasks popped from _hp_rq, see --bthread_priority_burst.
+    int _hp_run_streak{0};
     RemoteTaskQueue _remote_rq;
-    int _remote_num_nosignal{0};
-    int _remote_nsignaled{0};
+    // Updated by concurrent non-worker producers, thus atomic.
+    butil::atomic<int> _remote_num_nosignal{0};
+    butil::atomic<int> _remote_nsignaled{0};
 
     int _sched_recursive_guard{0};
     // tag of this taskgroup
     bthread_tag_t _tag{BTHREAD_TAG_DEFAULT};
 
+    int _numa_node{0};
+
+    // Adaptive spin count of spin_for_task(), see --bthread_idle_spin.
+    int _idle_spin_budget{0};
+
+    // Consecutive wakeups of wait_task() that found nothing to run, the
+    // park-deeply hysteresis of --bthread_elastic_workers.
+    int _idle_wakeup_streak{0};
+
+    // Set by TaskControl's preemption watchdog when the current task has
+    // been running beyond --bthread_worker_preempt_slice_ms, consumed by
+    // yield_if_preempted() and cleared on every task switch.
+    butil::atomic<bool> _preempt_requested{false};
+    // last_run_ns that the watchdog already flagged, so that one overlong
+    // run is flagged at most once. Only touched by the watchdog.
+    int64_t _preempt_signaled_run_ns{0};
+    // State of the deep parking lot, captured by
+    // TaskControl::begin_deep_park().
+    ParkingLot::State _deep_pl_state;
+
     // Worker thread id.
     pid_t _tid{-1};
 };
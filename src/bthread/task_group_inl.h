@@ -101,13 +101,17 @@ inline void TaskGroup::push_rq(bthread_t tid) {
     }
 }
 
-inline void TaskGroup::flush_nosignal_tasks_remote() {
-    if (_remote_num_nosignal) {
-        _remote_rq._mutex.lock();
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+inline void TaskGroup::push_hp_rq(bthread_t tid) {
+    while (!_hp_rq.push(tid)) {
+        // See the comments in push_rq().
+        flush_nosignal_tasks();
+        LOG_EVERY_SECOND(ERROR) << "_hp_rq is full, capacity="
+                                << _hp_rq.capacity();
+        ::usleep(1000);
     }
 }
 
+
 }  // namespace bthread
 
 #endif  // BTHREAD_TASK_GROUP_INL_H
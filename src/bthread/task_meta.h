@@ -25,6 +25,7 @@
 #include <pthread.h>                 // pthread_spin_init
 #include "bthread/butex.h"           // butex_construct/destruct
 #include "butil/atomicops.h"          // butil::atomic
+#include "butil/resource_pool.h"     // ResourcePoolSpareFreeChunk
 #include "bthread/types.h"           // bthread_attr_t
 #include "bthread/stack.h"           // ContextualStack
 #include "bthread/timer_thread.h"
@@ -102,6 +103,12 @@ struct TaskMeta {
     int64_t cpuwide_start_ns{0};
     TaskStatistics stat{};
 
+    // Time when the task was pushed into a runqueue, stamped for 1/N
+    // ready tasks when --bthread_sched_delay_sample_rate is on and
+    // consumed (reset to 0) when the task gets a worker, see
+    // TaskGroup::sched_to.
+    int64_t ready_ns{0};
+
     // bthread local storage, sync with tls_bls (defined in task_group.cpp)
     // when the bthread is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
@@ -147,4 +154,16 @@ public:
 
 }  // namespace bthread
 
+namespace butil {
+// TaskMeta is typically allocated by the spawning thread and freed by the
+// worker ending the bthread; the spare chunk doubles the per-thread cache
+// and halves the resulting traffic on the global free list under heavy
+// fan-outs. Note that version_butex is created in the constructor which
+// only runs when a block slot is carved for the first time -- reusing a
+// free TaskMeta involves no butex creation.
+template <> struct ResourcePoolSpareFreeChunk<bthread::TaskMeta> {
+    static const bool value = true;
+};
+}  // namespace butil
+
 #endif  // BTHREAD_TASK_META_H
@@ -19,6 +19,7 @@
 
 
 #include <queue>                           // heap functions
+#include <gflags/gflags.h>
 #include "butil/scoped_lock.h"
 #include "butil/logging.h"
 #include "butil/third_party/murmurhash3/murmurhash3.h"   // fmix64
@@ -31,6 +32,11 @@
 
 namespace bthread {
 
+DEFINE_bool(bthread_timer_use_wheel, false,
+            "Drive TimerThread by a hierarchical timer wheel instead of a "
+            "min-heap. Insertion into the wheel is O(1) and tasks may fire "
+            "up to one tick (128us) late");
+
 // Defined in task_control.cpp
 void run_worker_startfn();
 
@@ -312,6 +318,187 @@ static T deref_value(void* arg) {
     return *(T*)arg;
 }
 
+// A hierarchical timer wheel. 4 levels of 64 slots each, one tick is
+// 128us, spanning 128us * 64^4 (~35 minutes); farther tasks are clamped
+// into the last slot of the top level and re-inserted when it cascades.
+// add() is O(1); cascading relinks whole slot chains at once. Tasks in a
+// slot fire at the slot's upper boundary, i.e. at most one tick late and
+// never early.
+class TimerWheel {
+public:
+    static const int64_t TICK_US = 128;
+    static const int LEVEL_BITS = 6;
+    static const int NUM_SLOTS = 1 << LEVEL_BITS;       // 64
+    static const int SLOT_MASK = NUM_SLOTS - 1;
+    static const int NUM_LEVELS = 4;
+
+    explicit TimerWheel(int64_t now_us)
+        : _start_us(now_us)
+        , _cur_tick(0)
+        , _ntasks(0) {
+        memset(_slots, 0, sizeof(_slots));
+    }
+
+    size_t ntasks() const { return _ntasks; }
+
+    void add(TimerThread::Task* task) {
+        int64_t expire_tick =
+            (task->run_time - _start_us + TICK_US - 1) / TICK_US;
+        if (expire_tick < _cur_tick) {
+            expire_tick = _cur_tick;
+        }
+        const int64_t max_tick =
+            _cur_tick + ((int64_t)1 << (LEVEL_BITS * NUM_LEVELS)) - 1;
+        if (expire_tick > max_tick) {
+            expire_tick = max_tick;  // re-inserted on cascade
+        }
+        const int64_t d = expire_tick - _cur_tick;
+        int level = 0;
+        while (d >= ((int64_t)1 << (LEVEL_BITS * (level + 1)))) {
+            ++level;
+        }
+        TimerThread::Task** slot =
+            &_slots[level][(expire_tick >> (LEVEL_BITS * level)) & SLOT_MASK];
+        task->next = *slot;
+        *slot = task;
+        ++_ntasks;
+    }
+
+    // Detach and return the chain of all tasks due at `now_us'.
+    TimerThread::Task* take_due(int64_t now_us) {
+        TimerThread::Task* due = NULL;
+        if (0 == _ntasks) {
+            // Skip idle periods in one step.
+            const int64_t now_tick = (now_us - _start_us) / TICK_US;
+            if (now_tick > _cur_tick) {
+                _cur_tick = now_tick;
+            }
+            return NULL;
+        }
+        while (_start_us + _cur_tick * TICK_US <= now_us) {
+            const int idx = _cur_tick & SLOT_MASK;
+            if (0 == idx) {
+                cascade(1);
+            }
+            TimerThread::Task* p = _slots[0][idx];
+            _slots[0][idx] = NULL;
+            while (p) {
+                TimerThread::Task* const saved_next = p->next;
+                p->next = due;
+                due = p;
+                --_ntasks;
+                p = saved_next;
+            }
+            ++_cur_tick;
+        }
+        return due;
+    }
+
+    // Lower bound of the time the earliest task fires at, or max() if the
+    // wheel is empty. May be coarse for tasks in higher levels, they are
+    // re-examined after the corresponding cascade.
+    int64_t next_run_time() const {
+        if (0 == _ntasks) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        for (int level = 0; level < NUM_LEVELS; ++level) {
+            const int64_t level_tick = _cur_tick >> (LEVEL_BITS * level);
+            for (int64_t t = level_tick; t < level_tick + NUM_SLOTS; ++t) {
+                if (_slots[level][t & SLOT_MASK] != NULL) {
+                    return _start_us + (t << (LEVEL_BITS * level)) * TICK_US;
+                }
+            }
+        }
+        // Unreachable while _ntasks > 0.
+        return _start_us + _cur_tick * TICK_US;
+    }
+
+private:
+    // Move the chain in the current slot of `level' down by re-adding it.
+    void cascade(int level) {
+        if (level >= NUM_LEVELS) {
+            return;
+        }
+        const int idx = (_cur_tick >> (LEVEL_BITS * level)) & SLOT_MASK;
+        if (0 == idx) {
+            cascade(level + 1);
+        }
+        TimerThread::Task* p = _slots[level][idx];
+        _slots[level][idx] = NULL;
+        while (p) {
+            TimerThread::Task* const saved_next = p->next;
+            --_ntasks;
+            add(p);
+            p = saved_next;
+        }
+    }
+
+    int64_t _start_us;
+    int64_t _cur_tick;  // next tick to process
+    size_t _ntasks;
+    TimerThread::Task* _slots[NUM_LEVELS][NUM_SLOTS];
+};
+
+void TimerThread::run_with_wheel(size_t* nscheduled, size_t* ntriggered,
+                                 double* busy_seconds,
+                                 int64_t last_sleep_time) {
+    TimerWheel wheel(butil::gettimeofday_us());
+    while (!_stop.load(butil::memory_order_relaxed)) {
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (BAIDU_UNLIKELY(_stop.load(butil::memory_order_relaxed))) {
+                break;
+            }
+            _nearest_run_time = std::numeric_limits<int64_t>::max();
+        }
+
+        for (size_t i = 0; i < _options.num_buckets; ++i) {
+            Bucket& bucket = _buckets[i];
+            for (Task* p = bucket.consume_tasks(); p != nullptr;
+                 ++*nscheduled) {
+                Task* next_task = p->next;
+                if (!p->try_delete()) {
+                    wheel.add(p);
+                }
+                p = next_task;
+            }
+        }
+
+        for (Task* p = wheel.take_due(butil::gettimeofday_us());
+             p != nullptr;) {
+            Task* const next_task = p->next;
+            if (p->run_and_delete()) {
+                ++*ntriggered;
+            }
+            p = next_task;
+        }
+
+        const int64_t next_run_time = wheel.next_run_time();
+        int expected_nsignals = 0;
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (next_run_time > _nearest_run_time) {
+                // A task earlier than anything in the wheel was scheduled,
+                // pull the buckets again.
+                continue;
+            } else {
+                _nearest_run_time = next_run_time;
+                expected_nsignals = _nsignals;
+            }
+        }
+        timespec* ptimeout = NULL;
+        timespec next_timeout = { 0, 0 };
+        const int64_t now = butil::gettimeofday_us();
+        if (next_run_time != std::numeric_limits<int64_t>::max()) {
+            next_timeout = butil::microseconds_to_timespec(next_run_time - now);
+            ptimeout = &next_timeout;
+        }
+        *busy_seconds += (now - last_sleep_time) / 1000000.0;
+        futex_wait_private(&_nsignals, expected_nsignals, ptimeout);
+        last_sleep_time = butil::gettimeofday_us();
+    }
+}
+
 void TimerThread::run() {
     run_worker_startfn();
 #ifdef BAIDU_INTERNAL
@@ -340,7 +527,14 @@ void TimerThread::run() {
         ntriggered_second.expose_as(_options.bvar_prefix, "triggered_second");
         busy_seconds_second.expose_as(_options.bvar_prefix, "usage");
     }
-    
+
+    if (FLAGS_bthread_timer_use_wheel) {
+        run_with_wheel(&nscheduled, &ntriggered, &busy_seconds,
+                       last_sleep_time);
+        BT_VLOG << "Ended TimerThread=" << pthread_self();
+        return;
+    }
+
     while (!_stop.load(butil::memory_order_relaxed)) {
         // Clear _nearest_run_time before consuming tasks from buckets.
         // This helps us to be aware of earliest task of the new tasks before we
@@ -90,6 +90,11 @@ private:
     void run();
     static void* run_this(void* arg);
 
+    // Main loop driven by a hierarchical timer wheel instead of the task
+    // heap, enabled by --bthread_timer_use_wheel.
+    void run_with_wheel(size_t* nscheduled, size_t* ntriggered,
+                        double* busy_seconds, int64_t last_sleep_time);
+
     bool _started;            // whether the timer thread was started successfully.
     butil::atomic<bool> _stop;
 
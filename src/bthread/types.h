@@ -54,6 +54,20 @@ static const bthread_attrflags_t BTHREAD_NOSIGNAL = 32;
 static const bthread_attrflags_t BTHREAD_NEVER_QUIT = 64;
 static const bthread_attrflags_t BTHREAD_INHERIT_SPAN = 128;
 static const bthread_attrflags_t BTHREAD_GLOBAL_PRIORITY = 256;
+// Scheduled from a per-worker high-priority runqueue drained before the
+// normal one, so short latency-critical bthreads don't queue after long
+// ones. Guarded against starving normal bthreads by
+// -bthread_priority_burst.
+static const bthread_attrflags_t BTHREAD_LATENCY_CRITICAL = 512;
+// The bthread changes the FP environment(MXCSR/x87 control words, e.g.
+// rounding mode or exception masks) and needs it carried across context
+// switches. Switches where neither side sets this flag skip FP state
+// save/restore entirely -- the short path of the common integer-only
+// case. Data registers are never part of the switch(clobbered by the
+// call ABI anyway), only the control words are concerned. Debug builds
+// verify that bthreads without the flag leave MXCSR untouched.
+// Currently only effective on linux x86-64.
+static const bthread_attrflags_t BTHREAD_PRESERVE_FP_STATE = 1024;
 
 // Key of thread-local data, created by bthread_key_create.
 typedef struct {
@@ -219,10 +233,22 @@ typedef struct bthread_sem_t {
     bool enable_csite;
 } bthread_sem_t;
 
+// Kinds of bthread_rwlock, settable via bthread_rwlockattr_setkind_np.
+// The default kind keeps reader state in one shared counter.
+#define BTHREAD_RWLOCK_KIND_DEFAULT_NP 0
+// The big-reader kind shards the reader counter into per-cpu slots so
+// that read acquisition is an uncontended increment; writers sweep all
+// slots. Costs several KB per lock, intended for a few long-lived
+// read-mostly locks(e.g. config lookup), not for massive allocation.
+#define BTHREAD_RWLOCK_KIND_BIGREADER_NP 1
+
+struct bthread_rwlock_reader_slot_t;
+
 typedef struct bthread_rwlock_t {
 #if defined(__cplusplus)
     bthread_rwlock_t()
-        : reader_count(0), reader_wait(0), wlock_flag(false), writer_csite{} {}
+        : reader_count(0), reader_wait(0), wlock_flag(false), writer_csite{}
+        , reader_slots(NULL), nslot(0) {}
     DISALLOW_COPY_AND_ASSIGN(bthread_rwlock_t);
 #endif
     bthread_sem_t reader_sema; // Semaphore for readers to wait for completing writers.
@@ -232,9 +258,17 @@ typedef struct bthread_rwlock_t {
     bool wlock_flag; // Flag used to indicate that a write lock has been held.
     bthread_mutex_t write_queue_mutex; // Held if there are pending writers.
     bthread_contention_site_t writer_csite;
+    // Per-cpu sharding of reader_count for the big-reader kind,
+    // NULL/0 for the default kind.
+    struct bthread_rwlock_reader_slot_t* reader_slots;
+    int nslot; // power of 2 covering all cpus.
 } bthread_rwlock_t;
 
-typedef struct {
+typedef struct bthread_rwlockattr_t {
+#if defined(__cplusplus)
+    bthread_rwlockattr_t() : kind(BTHREAD_RWLOCK_KIND_DEFAULT_NP) {}
+#endif
+    int kind;
 } bthread_rwlockattr_t;
 
 typedef struct {
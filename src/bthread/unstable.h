@@ -76,6 +76,16 @@ extern int bthread_fd_timedwait(int fd, unsigned epoll_events,
 // NOTE: This function does not wake up pthread waiters.(tested on linux 2.6.32)
 extern int bthread_close(int fd);
 
+// Replacements of pread(2)/pwrite(2) in bthreads: the I/O runs on a small
+// dedicated pool of pthreads and only the calling bthread is suspended, so
+// blocking disk I/O overlaps with RPC processing instead of stalling a
+// worker pthread. Same returning values and errno as pread(2)/pwrite(2).
+// Calls from non-worker pthreads fall through to the syscall directly.
+// Size of the pool is --bthread_file_io_threads.
+extern ssize_t bthread_pread(int fd, void* buf, size_t count, off_t offset);
+extern ssize_t bthread_pwrite(int fd, const void* buf, size_t count,
+                              off_t offset);
+
 // Replacement of connect(2) in bthreads.
 extern int bthread_connect(int sockfd, const struct sockaddr* serv_addr,
                            socklen_t addrlen);
@@ -134,6 +134,54 @@ public:
         return true;
     }
 
+    // Steal up to `max_n' items from the queue, writing them to `vals'.
+    // Returns number of stolen items which may be 0.
+    // May run in parallel with push() pop() or another steal().
+    //
+    // At most half of the items present are taken so that the victim keeps
+    // draining from its own end. Advancing _top by more than 1 in a single
+    // CAS would be unsound here: pop() only competes on _top for the very
+    // last item, so a pop() racing with a multi-slot reservation could
+    // return an item that the reservation also covers. Hence one CAS per
+    // item, but a batched caller still drains bursts much cheaper than
+    // repeated steal() calls: _top stays in this thread's cache between
+    // the CASes, and losing _top to another thief after getting at least
+    // one item returns immediately instead of fighting on.
+    size_t steal_batch(T* vals, size_t max_n) {
+        size_t t = _top.load(butil::memory_order_acquire);
+        size_t b = _bottom.load(butil::memory_order_acquire);
+        if (t >= b) {
+            // Permit false negative for performance considerations.
+            return 0;
+        }
+        // Take at most half of the items present, the victim keeps draining
+        // the rest from its own end.
+        const size_t half = (b - t + 1) / 2;
+        if (max_n > half) {
+            max_n = half;
+        }
+        size_t stolen = 0;
+        while (stolen < max_n) {
+            butil::atomic_thread_fence(butil::memory_order_seq_cst);
+            b = _bottom.load(butil::memory_order_acquire);
+            if (t >= b) {
+                break;
+            }
+            const T val = _buffer[t & (_capacity - 1)];
+            if (_top.compare_exchange_strong(t, t + 1,
+                                             butil::memory_order_seq_cst,
+                                             butil::memory_order_relaxed)) {
+                vals[stolen++] = val;
+            } else if (stolen > 0) {
+                // Lost _top to another thief after getting at least one
+                // item, return instead of fighting on.
+                break;
+            }
+            // On CAS failure `t' was updated to the current _top, retry.
+        }
+        return stolen;
+    }
+
     size_t volatile_size() const {
         const size_t b = _bottom.load(butil::memory_order_relaxed);
         const size_t t = _top.load(butil::memory_order_relaxed);
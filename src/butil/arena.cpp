@@ -63,6 +63,17 @@ void Arena::clear() {
     swap(a);
 }
 
+void Arena::reset() {
+    while (_isolated_blocks != NULL) {
+        Block* const saved_next = _isolated_blocks->next;
+        free(_isolated_blocks);
+        _isolated_blocks = saved_next;
+    }
+    if (_cur_block != NULL) {
+        _cur_block->alloc_size = 0;
+    }
+}
+
 void* Arena::allocate_new_block(size_t n) {
     Block* b = (Block*)malloc(offsetof(Block, data) + n);
     b->next = _isolated_blocks;
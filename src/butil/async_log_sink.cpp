@@ -0,0 +1,203 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unistd.h>
+#include <algorithm>
+#include "butil/async_log_sink.h"
+#include "butil/compiler_specific.h"
+
+namespace logging {
+
+AsyncLogSinkOptions::AsyncLogSinkOptions()
+    : records_per_thread(1024)
+    , flush_interval_ms(10) {
+}
+
+// SPSC ring: the owning thread pushes at _head, the flush thread pops at
+// _tail. Full rings drop instead of blocking the producer.
+class AsyncLogSink::ThreadBuffer {
+public:
+    explicit ThreadBuffer(size_t cap)
+        : _records(cap)
+        , _head(0)
+        , _tail(0)
+        , _dead(false) {
+    }
+
+    bool Push(int severity, const char* file, int line, const char* func,
+              const butil::StringPiece& content) {
+        const size_t head = _head.load(butil::memory_order_relaxed);
+        if (head - _tail.load(butil::memory_order_acquire)
+            >= _records.size()) {
+            return false;
+        }
+        Record& r = _records[head % _records.size()];
+        r.severity = severity;
+        r.line = line;
+        r.file = file;
+        r.func = func;
+        // Reuses the slot's capacity after the first lap.
+        r.content.assign(content.data(), content.size());
+        _head.store(head + 1, butil::memory_order_release);
+        return true;
+    }
+
+    // Forward all currently visible records to |sink|.
+    size_t DrainTo(LogSink* sink) {
+        size_t tail = _tail.load(butil::memory_order_relaxed);
+        const size_t head = _head.load(butil::memory_order_acquire);
+        const size_t n = head - tail;
+        for (; tail != head; ++tail) {
+            const Record& r = _records[tail % _records.size()];
+            sink->OnLogMessage(r.severity, r.file, r.line, r.func, r.content);
+            // Publish slot by slot so a blocked sink does not keep the
+            // whole ring unavailable to the producer.
+            _tail.store(tail + 1, butil::memory_order_release);
+        }
+        return n;
+    }
+
+    void set_dead() { _dead.store(true, butil::memory_order_release); }
+    bool dead() const { return _dead.load(butil::memory_order_acquire); }
+    bool empty() const {
+        return _head.load(butil::memory_order_relaxed) ==
+            _tail.load(butil::memory_order_relaxed);
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ThreadBuffer);
+    std::vector<Record> _records;
+    butil::atomic<size_t> _head;
+    butil::atomic<size_t> _tail;
+    // Set when the owning thread exited; the flush thread deletes the
+    // buffer once it is drained.
+    butil::atomic<bool> _dead;
+};
+
+AsyncLogSink::AsyncLogSink(LogSink* underlying)
+    : AsyncLogSink(underlying, AsyncLogSinkOptions()) {
+}
+
+AsyncLogSink::AsyncLogSink(LogSink* underlying,
+                           const AsyncLogSinkOptions& options)
+    : _underlying(underlying)
+    , _options(options)
+    , _flush_thread(0)
+    , _stop(false)
+    , _discarded(0) {
+    CHECK(underlying != NULL);
+    if (_options.records_per_thread == 0) {
+        _options.records_per_thread = 1;
+    }
+    if (_options.flush_interval_ms <= 0) {
+        _options.flush_interval_ms = 1;
+    }
+    CHECK_EQ(0, pthread_key_create(&_buffer_key, DeleteThreadBufferKey));
+    CHECK_EQ(0, pthread_create(&_flush_thread, NULL, RunFlushThread, this));
+}
+
+AsyncLogSink::~AsyncLogSink() {
+    _stop.store(true, butil::memory_order_release);
+    pthread_join(_flush_thread, NULL);
+    pthread_key_delete(_buffer_key);
+    // The flush thread drained everything before exiting; buffers of
+    // still-running threads are freed here, those threads must not log
+    // into this sink anymore (restore the previous sink first).
+    for (size_t i = 0; i < _buffers.size(); ++i) {
+        delete _buffers[i];
+    }
+}
+
+void AsyncLogSink::DeleteThreadBufferKey(void* arg) {
+    // Owned by _buffers, just mark it so that the flush thread reclaims
+    // the memory after draining the remaining records.
+    static_cast<ThreadBuffer*>(arg)->set_dead();
+}
+
+AsyncLogSink::ThreadBuffer* AsyncLogSink::GetOrNewThreadBuffer() {
+    ThreadBuffer* b = static_cast<ThreadBuffer*>(
+        pthread_getspecific(_buffer_key));
+    if (BAIDU_LIKELY(b != NULL)) {
+        return b;
+    }
+    b = new (std::nothrow) ThreadBuffer(_options.records_per_thread);
+    if (b == NULL) {
+        return NULL;
+    }
+    if (pthread_setspecific(_buffer_key, b) != 0) {
+        delete b;
+        return NULL;
+    }
+    butil::AutoLock lock_guard(_buffers_lock);
+    _buffers.push_back(b);
+    return b;
+}
+
+bool AsyncLogSink::OnLogMessage(int severity, const char* file, int line,
+                                const butil::StringPiece& log_content) {
+    return OnLogMessage(severity, file, line, NULL, log_content);
+}
+
+bool AsyncLogSink::OnLogMessage(int severity, const char* file, int line,
+                                const char* func,
+                                const butil::StringPiece& log_content) {
+    ThreadBuffer* b = GetOrNewThreadBuffer();
+    if (b == NULL || !b->Push(severity, file, line, func, log_content)) {
+        _discarded.fetch_add(1, butil::memory_order_relaxed);
+    }
+    return true;
+}
+
+void* AsyncLogSink::RunFlushThread(void* arg) {
+    static_cast<AsyncLogSink*>(arg)->FlushLoop();
+    return NULL;
+}
+
+size_t AsyncLogSink::DrainOnce() {
+    // Snapshot the list; buffers are only appended or deleted by this
+    // thread (below), appends after the snapshot are seen next round.
+    std::vector<ThreadBuffer*> buffers;
+    {
+        butil::AutoLock lock_guard(_buffers_lock);
+        buffers = _buffers;
+    }
+    size_t nflushed = 0;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        nflushed += buffers[i]->DrainTo(_underlying);
+        if (buffers[i]->dead() && buffers[i]->empty()) {
+            {
+                butil::AutoLock lock_guard(_buffers_lock);
+                _buffers.erase(std::find(_buffers.begin(), _buffers.end(),
+                                         buffers[i]));
+            }
+            delete buffers[i];
+        }
+    }
+    return nflushed;
+}
+
+void AsyncLogSink::FlushLoop() {
+    while (!_stop.load(butil::memory_order_acquire)) {
+        if (DrainOnce() == 0) {
+            ::usleep(_options.flush_interval_ms * 1000L);
+        }
+    }
+    // Final drain: everything staged before the destructor is written out.
+    DrainOnce();
+}
+
+}  // namespace logging
@@ -0,0 +1,114 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Decouple logging threads from the cost of writing logs out.
+
+#ifndef BUTIL_ASYNC_LOG_SINK_H
+#define BUTIL_ASYNC_LOG_SINK_H
+
+#include <pthread.h>
+#include <vector>
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "butil/synchronization/lock.h"
+
+namespace logging {
+
+// Options to setup AsyncLogSink.
+struct AsyncLogSinkOptions {
+    AsyncLogSinkOptions();
+
+    // Capacity of each thread's staging ring, in records. When a thread
+    // outpaces the background flusher by this many records, further logs
+    // from the thread are dropped and counted in discarded().
+    // default: 1024
+    size_t records_per_thread;
+
+    // The background thread scans staging rings at least this often.
+    // default: 10
+    int flush_interval_ms;
+};
+
+// A LogSink that makes logging in request paths cost a bounded few hundred
+// nanoseconds: OnLogMessage() appends the already-formatted content into a
+// staging ring private to the calling thread (a write to it never takes a
+// lock or blocks on IO) and a dedicated background thread forwards the
+// records to `underlying'. When a ring is full the record is dropped and
+// counted rather than stalling the logging thread.
+// Records of one thread keep their order; records of different threads are
+// interleaved by flush order, timestamps in the content remain correct
+// since they were captured at LOG() time.
+// Usage:
+//   logging::LogSink* old = logging::SetLogSink(new AsyncLogSink(...));
+// Restore the previous sink before destroying this one.
+class BUTIL_EXPORT AsyncLogSink : public LogSink {
+public:
+    // Forward flushed records to `underlying', which is only called from
+    // the background thread (thus needs no thread-safety of its own) and
+    // must outlive this sink. Not owned.
+    explicit AsyncLogSink(LogSink* underlying);
+    AsyncLogSink(LogSink* underlying, const AsyncLogSinkOptions& options);
+    // Stops the background thread after draining all staged records.
+    ~AsyncLogSink() override;
+
+    // @LogSink
+    bool OnLogMessage(int severity, const char* file, int line,
+                      const butil::StringPiece& log_content) override;
+    bool OnLogMessage(int severity, const char* file, int line,
+                      const char* func,
+                      const butil::StringPiece& log_content) override;
+
+    // # of records dropped because the logging thread's ring was full.
+    int64_t discarded() const
+    { return _discarded.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(AsyncLogSink);
+
+    struct Record {
+        int severity;
+        int line;
+        const char* file;  // __FILE__ literals, safe to keep.
+        const char* func;
+        std::string content;
+    };
+
+    // Ring written by one logging thread and read by the flush thread.
+    // Slots (including the std::string capacity inside) are reused, a
+    // thread logging steadily stops allocating once warmed up.
+    class ThreadBuffer;
+
+    ThreadBuffer* GetOrNewThreadBuffer();
+    static void DeleteThreadBufferKey(void* arg);
+    static void* RunFlushThread(void* arg);
+    void FlushLoop();
+    // Returns # of records forwarded.
+    size_t DrainOnce();
+
+    LogSink* _underlying;
+    AsyncLogSinkOptions _options;
+    pthread_key_t _buffer_key;
+    pthread_t _flush_thread;
+    butil::atomic<bool> _stop;
+    butil::atomic<int64_t> _discarded;
+    butil::Lock _buffers_lock;
+    std::vector<ThreadBuffer*> _buffers;
+};
+
+}  // namespace logging
+
+#endif  // BUTIL_ASYNC_LOG_SINK_H
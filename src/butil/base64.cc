@@ -4,6 +4,7 @@
 
 #include "butil/base64.h"
 
+#include "butil/base64_simd.h"
 #include "third_party/modp_b64/modp_b64.h"
 
 namespace butil {
@@ -12,8 +13,15 @@ void Base64Encode(const StringPiece& input, std::string* output) {
   std::string temp;
   temp.resize(modp_b64_encode_len(input.size()));  // makes room for null byte
 
+  // The vectorized kernel encodes the bulk of the input; modp_b64
+  // handles the tail (and everything when no kernel is available).
+  size_t body = internal::Base64EncodeSimd(
+      &(temp[0]), input.data(), input.size());
+
   // modp_b64_encode_len() returns at least 1, so temp[0] is safe to use.
-  size_t output_size = modp_b64_encode(&(temp[0]), input.data(), input.size());
+  size_t output_size = body / 3 * 4 +
+      modp_b64_encode(&(temp[0]) + body / 3 * 4,
+                      input.data() + body, input.size() - body);
 
   temp.resize(output_size);  // strips off null byte
   output->swap(temp);
@@ -23,13 +31,21 @@ bool Base64Decode(const StringPiece& input, std::string* output) {
   std::string temp;
   temp.resize(modp_b64_decode_len(input.size()));
 
-  // does not null terminate result since result is binary data!
+  // The vectorized kernel decodes whole 4-char groups up to the first
+  // group with a non-alphabet character; modp_b64 decodes and validates
+  // the rest, so padding and error semantics are unchanged.
   size_t input_size = input.size();
-  size_t output_size = modp_b64_decode(&(temp[0]), input.data(), input_size);
+  size_t body = internal::Base64DecodeSimd(
+      &(temp[0]), input.data(), input_size);
+
+  // does not null terminate result since result is binary data!
+  size_t output_size = modp_b64_decode(&(temp[0]) + body / 4 * 3,
+                                       input.data() + body,
+                                       input_size - body);
   if (output_size == MODP_B64_ERROR)
     return false;
 
-  temp.resize(output_size);
+  temp.resize(output_size + body / 4 * 3);
   output->swap(temp);
   return true;
 }
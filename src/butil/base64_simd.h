@@ -0,0 +1,49 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BUTIL_BASE64_SIMD_H
+#define BUTIL_BASE64_SIMD_H
+
+#include <stddef.h>
+
+// Vectorized base64 kernels used by butil::Base64Encode/Decode. They
+// process the bulk of the buffer 16/32 bytes at a time (SSE/AVX2 with
+// runtime dispatch on x86-64, NEON on aarch64) and leave the tail -
+// and anything they cannot handle - to the scalar modp_b64 codec, so
+// callers see unchanged semantics.
+
+namespace butil {
+namespace internal {
+
+// Encode a prefix of [src, src+len) into `dst', returning the number of
+// input bytes consumed (a multiple of 12, possibly 0). The caller
+// encodes the remaining bytes with the scalar codec at
+// dst + consumed / 3 * 4.
+size_t Base64EncodeSimd(char* dst, const char* src, size_t len);
+
+// Decode a prefix of [src, src+len) into `dst', returning the number of
+// input characters consumed (a multiple of 4, possibly 0). Stops before
+// the first block containing a character outside the base64 alphabet
+// (including '=' padding and whitespace), which the scalar codec then
+// validates. May scribble a few bytes past dst + consumed / 4 * 3;
+// callers must size `dst' with modp_b64_decode_len().
+size_t Base64DecodeSimd(char* dst, const char* src, size_t len);
+
+}  // namespace internal
+}  // namespace butil
+
+#endif  // BUTIL_BASE64_SIMD_H
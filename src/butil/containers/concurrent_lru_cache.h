@@ -0,0 +1,301 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef BUTIL_CONTAINERS_CONCURRENT_LRU_CACHE_H
+#define BUTIL_CONTAINERS_CONCURRENT_LRU_CACHE_H
+
+#include "butil/atomicops.h"
+#include "butil/macros.h"
+#include "butil/containers/flat_map.h"
+#include "butil/containers/linked_list.h"
+#include "butil/scoped_lock.h"
+#include "butil/synchronization/lock.h"
+
+// A thread-safe LRU cache with a memory budget, unlike the single-threaded
+// MRUCache in mru_cache.h. Entries are spread over power-of-2 segments
+// hashed by key, each protected by its own lock so that lookups of
+// different keys rarely contend. Within a segment the recency order is an
+// intrusive linked list through the entries; a hit only moves its entry to
+// the most-recent end once every kPromotionSample-th access, which keeps
+// hot entries resident without turning every read into writes of the
+// list-head cachelines.
+//
+// Keys and values are stored by copy, like FlatMap. The byte budget is
+// divided evenly among segments and enforced per segment: inserting past
+// the budget evicts least-recently-used entries of the same segment.
+//
+// Hits/misses/evictions are counted with plain atomics; callers that want
+// them in /vars should wrap the getters in bvar::PassiveStatus (bvar
+// depends on butil and cannot be used from here).
+//
+// Example:
+//   butil::ConcurrentLRUCache<std::string, AuthResult> cache;
+//   cache.init(64 * 1024 * 1024);
+//   cache.Put(token, result, token.size() + sizeof(result));
+//   AuthResult result;
+//   if (cache.Get(token, &result)) { ... }
+
+namespace butil {
+
+template <typename _K, typename _V,
+          typename _Hash = DefaultHasher<_K>,
+          typename _Equal = DefaultEqualTo<_K>>
+class ConcurrentLRUCache {
+public:
+    ConcurrentLRUCache()
+        : _shards(NULL), _nshard(0), _shard_budget(0)
+        , _num_hit(0), _num_miss(0), _num_eviction(0) {}
+    ~ConcurrentLRUCache();
+
+    // Initialize with a budget of `max_bytes' split over `nshard' segments
+    // (rounded up to a power of 2).
+    // Returns 0 on success, -1 otherwise.
+    int init(size_t max_bytes, size_t nshard = 16);
+
+    // Copy the cached value of `key' into *value and count a hit. `value'
+    // may be NULL to only probe for existence.
+    // Returns true when `key' was present.
+    bool Get(const _K& key, _V* value);
+
+    // Insert or overwrite the value of `key', accounting `bytes' against
+    // the budget (use the actual memory footprint of key+value; the
+    // default of 1 turns the budget into an entry count). May evict
+    // least-recently-used entries of the same segment.
+    void Put(const _K& key, const _V& value, size_t bytes = 1);
+
+    // Returns true when `key' was present and removed.
+    bool Remove(const _K& key);
+
+    // Remove all entries. Counters are kept.
+    void Clear();
+
+    size_t size() const;
+    size_t bytes() const;
+
+    size_t hit_count() const
+    { return _num_hit.load(butil::memory_order_relaxed); }
+    size_t miss_count() const
+    { return _num_miss.load(butil::memory_order_relaxed); }
+    size_t eviction_count() const
+    { return _num_eviction.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ConcurrentLRUCache);
+
+    // Promote an entry on every kPromotionSample-th hit only.
+    static const uint32_t kPromotionSample = 8;
+
+    struct Node : public LinkNode<Node> {
+        Node(const _K& key2, const _V& value2, size_t bytes2)
+            : key(key2), value(value2), bytes(bytes2), hits_left(0) {}
+        _K key;
+        _V value;
+        size_t bytes;
+        uint32_t hits_left;
+    };
+
+    struct Shard {
+        Shard() : bytes(0) {}
+        Mutex mutex;
+        // Least-recent at head(), most-recent at tail().
+        LinkedList<Node> lru;
+        FlatMap<_K, Node*, _Hash, _Equal> index;
+        size_t bytes;
+    };
+
+    Shard* shard_of(const _K& key)
+    { return &_shards[_hashfn(key) & (_nshard - 1)]; }
+
+    // Called with s->mutex held.
+    void EvictOverBudgetEntries(Shard* s);
+
+    Shard* _shards;
+    size_t _nshard;
+    size_t _shard_budget;
+    _Hash _hashfn;
+    butil::atomic<size_t> _num_hit;
+    butil::atomic<size_t> _num_miss;
+    butil::atomic<size_t> _num_eviction;
+};
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+ConcurrentLRUCache<_K, _V, _Hash, _Equal>::~ConcurrentLRUCache() {
+    Clear();
+    delete [] _shards;
+    _shards = NULL;
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+int ConcurrentLRUCache<_K, _V, _Hash, _Equal>::init(
+    size_t max_bytes, size_t nshard) {
+    if (_shards != NULL) {
+        LOG(ERROR) << "Already initialized";
+        return -1;
+    }
+    if (max_bytes == 0 || nshard == 0) {
+        LOG(ERROR) << "Invalid max_bytes=" << max_bytes
+                   << " nshard=" << nshard;
+        return -1;
+    }
+    size_t n = 1;
+    while (n < nshard) {
+        n <<= 1;
+    }
+    Shard* shards = new (std::nothrow) Shard[n];
+    if (NULL == shards) {
+        LOG(ERROR) << "Fail to new " << n << " shards";
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (shards[i].index.init(32) != 0) {
+            LOG(ERROR) << "Fail to init index of shard " << i;
+            delete [] shards;
+            return -1;
+        }
+    }
+    _shards = shards;
+    _nshard = n;
+    // Round up so that small budgets still admit one entry per shard.
+    _shard_budget = (max_bytes + n - 1) / n;
+    return 0;
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+bool ConcurrentLRUCache<_K, _V, _Hash, _Equal>::Get(const _K& key, _V* value) {
+    Shard* s = shard_of(key);
+    {
+        BAIDU_SCOPED_LOCK(s->mutex);
+        Node** pnode = s->index.seek(key);
+        if (pnode != NULL) {
+            Node* node = *pnode;
+            if (node->hits_left == 0) {
+                node->RemoveFromList();
+                s->lru.Append(node);
+                node->hits_left = kPromotionSample - 1;
+            } else {
+                --node->hits_left;
+            }
+            if (value != NULL) {
+                *value = node->value;
+            }
+            _num_hit.fetch_add(1, butil::memory_order_relaxed);
+            return true;
+        }
+    }
+    _num_miss.fetch_add(1, butil::memory_order_relaxed);
+    return false;
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+void ConcurrentLRUCache<_K, _V, _Hash, _Equal>::Put(
+    const _K& key, const _V& value, size_t bytes) {
+    Shard* s = shard_of(key);
+    BAIDU_SCOPED_LOCK(s->mutex);
+    Node** pnode = s->index.seek(key);
+    if (pnode != NULL) {
+        Node* node = *pnode;
+        node->value = value;
+        s->bytes += bytes - node->bytes;
+        node->bytes = bytes;
+        node->RemoveFromList();
+        s->lru.Append(node);
+    } else {
+        Node* node = new (std::nothrow) Node(key, value, bytes);
+        if (NULL == node) {
+            return;
+        }
+        s->index[key] = node;
+        s->lru.Append(node);
+        s->bytes += bytes;
+    }
+    EvictOverBudgetEntries(s);
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+void ConcurrentLRUCache<_K, _V, _Hash, _Equal>::EvictOverBudgetEntries(
+    Shard* s) {
+    while (s->bytes > _shard_budget && !s->lru.empty()) {
+        Node* victim = s->lru.head()->value();
+        if (s->lru.head() == s->lru.tail()) {
+            // Never evict the entry just touched, even when it alone
+            // exceeds the per-shard budget.
+            break;
+        }
+        victim->RemoveFromList();
+        s->index.erase(victim->key);
+        s->bytes -= victim->bytes;
+        delete victim;
+        _num_eviction.fetch_add(1, butil::memory_order_relaxed);
+    }
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+bool ConcurrentLRUCache<_K, _V, _Hash, _Equal>::Remove(const _K& key) {
+    Shard* s = shard_of(key);
+    BAIDU_SCOPED_LOCK(s->mutex);
+    Node** pnode = s->index.seek(key);
+    if (NULL == pnode) {
+        return false;
+    }
+    Node* node = *pnode;
+    node->RemoveFromList();
+    s->index.erase(key);
+    s->bytes -= node->bytes;
+    delete node;
+    return true;
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+void ConcurrentLRUCache<_K, _V, _Hash, _Equal>::Clear() {
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard* s = &_shards[i];
+        BAIDU_SCOPED_LOCK(s->mutex);
+        while (!s->lru.empty()) {
+            Node* node = s->lru.head()->value();
+            node->RemoveFromList();
+            delete node;
+        }
+        s->index.clear();
+        s->bytes = 0;
+    }
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+size_t ConcurrentLRUCache<_K, _V, _Hash, _Equal>::size() const {
+    size_t n = 0;
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard* s = &_shards[i];
+        BAIDU_SCOPED_LOCK(s->mutex);
+        n += s->index.size();
+    }
+    return n;
+}
+
+template <typename _K, typename _V, typename _Hash, typename _Equal>
+size_t ConcurrentLRUCache<_K, _V, _Hash, _Equal>::bytes() const {
+    size_t n = 0;
+    for (size_t i = 0; i < _nshard; ++i) {
+        Shard* s = &_shards[i];
+        BAIDU_SCOPED_LOCK(s->mutex);
+        n += s->bytes;
+    }
+    return n;
+}
+
+} // namespace butil
+
+#endif // BUTIL_CONTAINERS_CONCURRENT_LRU_CACHE_H
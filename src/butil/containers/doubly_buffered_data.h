@@ -24,6 +24,7 @@
 #include <vector>
 #include <memory>
 #include <pthread.h>
+#include <sched.h>
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
 #include "butil/logging.h"
@@ -43,15 +44,17 @@ namespace butil {
 // a thread-local data for user.
 //
 // --- `AllowBthreadSuspended=false' ---
-// Read(): Begin with a thread-local mutex locked then read the foreground
-// instance which will not be changed before the mutex is unlocked. Since the
-// mutex is only locked by Modify() with an empty critical section, the
-// function is almost lock-free.
+// Read(): Begin with publishing the version of foreground instance into a
+// thread-local slot, then read the foreground instance which will not be
+// changed before the slot is cleared or rewritten with a newer version.
+// The read path does no atomic read-modify-write op, just plain loads,
+// stores and a full fence.
 //
 // Modify(): Modify background instance which is not used by any Read(), flip
-// foreground and background, lock thread-local mutexes one by one to make
-// sure all existing Read() finish and later Read() see new foreground,
-// then modify background(foreground before flip) again.
+// foreground and background, bump the version and wait until thread-local
+// slots are cleared or hold newer versions one by one to make sure all
+// existing Read() finish and later Read() see new foreground, then modify
+// background(foreground before flip) again.
 //
 // But, when `AllowBthreadSuspended=false', it is not allowed to suspend bthread
 // while reading. Otherwise, it may cause deadlock.
@@ -163,6 +166,12 @@ private:
     // Index of foreground instance.
     butil::atomic<int> _index;
 
+    // Version of the data, bumped after each flip of _index. Published by
+    // readers into thread-local slots so that Modify() knows when reads of
+    // the old foreground instance are done. Only for
+    // `AllowBthreadSuspended=false'.
+    butil::atomic<int64_t> _version;
+
     // Key to access thread-local wrappers.
     WrapperTLSId _wrapper_key;
 
@@ -305,6 +314,7 @@ friend class DoublyBufferedData;
 public:
     explicit Wrapper()
         : _control(NULL)
+        , _reading_version(0)
         , _modify_wait(false) {
         pthread_mutex_init(&_mutex, NULL);
         if (AllowBthreadSuspended) {
@@ -325,6 +335,7 @@ public:
         pthread_mutex_destroy(&_mutex);
     }
 
+    // For `AllowBthreadSuspended=true'.
     // _mutex will be locked by the calling pthread and DoublyBufferedData.
     // Most of the time, no modifications are done, so the mutex is
     // uncontended and fast.
@@ -337,8 +348,18 @@ public:
         pthread_mutex_unlock(&_mutex);
     }
 
+    // For `AllowBthreadSuspended=false'.
+    // Publish the version being read into the thread-local slot without any
+    // atomic RMW op. The full fence pairs with the one in Modify() after
+    // flipping _index: either Modify() sees the published version and waits
+    // for this read, or this read sees the flipped _index.
+    inline void BeginRead(int64_t version) {
+        _reading_version.store(version, butil::memory_order_relaxed);
+        atomic_thread_fence(butil::memory_order_seq_cst);
+    }
+
     inline void EndRead() {
-        pthread_mutex_unlock(&_mutex);
+        _reading_version.store(0, butil::memory_order_release);
     }
 
     // For `AllowBthreadSuspended=true'.
@@ -350,8 +371,18 @@ public:
         SignalReadCond(index);
     }
 
-    inline void WaitReadDone() {
-        BAIDU_SCOPED_LOCK(_mutex);
+    // For `AllowBthreadSuspended=false'.
+    // Wait until the owner thread is not reading `version' or older ones.
+    // Readers never suspend inside a read, so spinning here is short.
+    inline void WaitVersionReadDone(int64_t version) {
+        while (true) {
+            const int64_t reading =
+                _reading_version.load(butil::memory_order_acquire);
+            if (reading == 0 || reading > version) {
+                return;
+            }
+            sched_yield();
+        }
     }
 
     // For `AllowBthreadSuspended=true'.
@@ -386,6 +417,9 @@ public:
 private:
     DoublyBufferedData* _control;
     pthread_mutex_t _mutex{};
+    // For `AllowBthreadSuspended=false'.
+    // Version of the data being read by the owner thread, 0 for not reading.
+    butil::atomic<int64_t> _reading_version;
     // For `AllowBthreadSuspended=true'.
     // _cond[0] for _ref[0], _cond[1] for _ref[1]
     pthread_cond_t _cond[2]{};
@@ -433,6 +467,7 @@ DoublyBufferedData<T, TLS, AllowBthreadSuspended>::GetWrapper() {
 template <typename T, typename TLS, bool AllowBthreadSuspended>
 DoublyBufferedData<T, TLS, AllowBthreadSuspended>::DoublyBufferedData()
     : _index(0)
+    , _version(1)  // Readers store versions into slots where 0 = not reading.
     , _wrapper_key(0) {
     BAIDU_CASSERT(!(AllowBthreadSuspended && !IsVoid<TLS>::value),
                   "Forbidden to allow bthread suspended with non-Void TLS");
@@ -489,7 +524,7 @@ int DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Read(
         w->AddRef(ptr->_index);
         w->BeginReadRelease();
     } else {
-        w->BeginRead();
+        w->BeginRead(_version.load(butil::memory_order_acquire));
         ptr->_data = UnsafeRead();
     }
     ptr->_w.swap(w);
@@ -531,7 +566,19 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
     // all changes made in fn.
     _index.store(bg_index, butil::memory_order_release);
     bg_index = !bg_index;
-    
+
+    int64_t old_version = 0;
+    if (!AllowBthreadSuspended) {
+        // Bump the version so that reads beginning from now on are
+        // distinguishable from on-going reads of the old foreground
+        // instance. The full fence pairs with the one in
+        // Wrapper::BeginRead(int64_t): readers publishing `old_version' or
+        // older are seen below, the others see the updated _index.
+        old_version = _version.load(butil::memory_order_relaxed);
+        _version.store(old_version + 1, butil::memory_order_release);
+        atomic_thread_fence(butil::memory_order_seq_cst);
+    }
+
     // Wait until all threads finishes current reading. When they begin next
     // read, they should see updated _index.
     {
@@ -539,7 +586,7 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
         // The chance to remove expired weak_ptr.
         _wrappers.erase(
             std::remove_if(_wrappers.begin(), _wrappers.end(),
-                           [bg_index](const WrapperWeakPtr& weak) {
+                           [bg_index, old_version](const WrapperWeakPtr& weak) {
                 WrapperSharedPtr w = weak.lock();
                 bool expired = NULL == w;
                 if (!expired) {
@@ -547,7 +594,7 @@ size_t DoublyBufferedData<T, TLS, AllowBthreadSuspended>::Modify(Fn&& fn, Args&&
                     if (AllowBthreadSuspended) {
                         w->WaitReadDone(bg_index);
                     } else {
-                        w->WaitReadDone();
+                        w->WaitVersionReadDone(old_version);
                     }
                }
                 // Remove expired weak_ptr.
@@ -0,0 +1,556 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// An open addressing hash-map probing "swiss table" style: a byte of
+// metadata per slot holds 7 bits of the hash, 16 bytes of metadata are
+// scanned at a time with SSE2/NEON (or a scalar loop elsewhere), so a
+// lookup usually touches one cacheline of metadata plus the matched slot.
+// Compared to FlatMap which chains colliding keys through allocated nodes,
+// collisions here stay in the flat arrays and cost no extra indirection,
+// making the map attractive for hot read-mostly tables such as method and
+// header maps.
+//
+// The API mirrors the subset of FlatMap used by such tables:
+// init(nbucket)/seek/insert/erase/operator[]/clear and forward iteration.
+// Objects stored MUST be copyable, keys are never moved once inserted
+// until erased or the map is resized.
+
+#ifndef BUTIL_SWISS_FLAT_MAP_H
+#define BUTIL_SWISS_FLAT_MAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "butil/logging.h"
+#include "butil/containers/flat_map.h"  // FlatMapElement, DefaultHasher
+
+namespace butil {
+
+namespace swiss_internal {
+
+// Metadata byte per slot. Full slots store the lowest 7 bits of the hash
+// (H2) with the sign bit clear; the special values below have it set.
+const int8_t CTRL_EMPTY = (int8_t)0x80;
+const int8_t CTRL_DELETED = (int8_t)0xFE;
+
+inline bool ctrl_is_full(int8_t c) { return c >= 0; }
+
+// A set of lanes matched within one group. Lane indexes come out in
+// ascending order. `Stride' is the distance in bits between two lanes.
+template <typename MaskT, int Stride>
+struct BitMask {
+    explicit BitMask(MaskT m) : mask(m) {}
+    operator bool() const { return mask != 0; }
+    int lowest_index() const { return __builtin_ctzll(mask) / Stride; }
+    void remove_lowest() { mask &= (mask - 1); }
+    MaskT mask;
+};
+
+#if defined(__SSE2__)
+
+struct Group {
+    static const size_t WIDTH = 16;
+    typedef BitMask<uint32_t, 1> MatchMask;
+
+    explicit Group(const int8_t* ctrl)
+        : _v(_mm_loadu_si128((const __m128i*)ctrl)) {}
+
+    MatchMask match(int8_t h2) const {
+        return MatchMask(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_v, _mm_set1_epi8(h2))));
+    }
+    MatchMask match_empty() const {
+        return MatchMask(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_v, _mm_set1_epi8(CTRL_EMPTY))));
+    }
+    // Matches both CTRL_EMPTY and CTRL_DELETED by the sign bit.
+    MatchMask match_empty_or_deleted() const {
+        return MatchMask(_mm_movemask_epi8(_v));
+    }
+
+private:
+    __m128i _v;
+};
+
+#elif defined(__ARM_NEON)
+
+struct Group {
+    static const size_t WIDTH = 16;
+    typedef BitMask<uint64_t, 4> MatchMask;
+
+    explicit Group(const int8_t* ctrl)
+        : _v(vld1q_s8(ctrl)) {}
+
+    MatchMask match(int8_t h2) const {
+        return to_mask(vceqq_s8(_v, vdupq_n_s8(h2)));
+    }
+    MatchMask match_empty() const {
+        return to_mask(vceqq_s8(_v, vdupq_n_s8(CTRL_EMPTY)));
+    }
+    MatchMask match_empty_or_deleted() const {
+        return to_mask(vcltq_s8(_v, vdupq_n_s8(0)));
+    }
+
+private:
+    // Narrow the 16 0x00/0xFF lanes into a 64-bit value of one nibble per
+    // lane, then keep one bit per nibble so remove_lowest() works.
+    static MatchMask to_mask(uint8x16_t eq) {
+        const uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        return MatchMask(nibbles & 0x1111111111111111ULL);
+    }
+
+    int8x16_t _v;
+};
+
+#else
+
+struct Group {
+    static const size_t WIDTH = 16;
+    typedef BitMask<uint32_t, 1> MatchMask;
+
+    explicit Group(const int8_t* ctrl) : _ctrl(ctrl) {}
+
+    MatchMask match(int8_t h2) const {
+        uint32_t m = 0;
+        for (size_t i = 0; i < WIDTH; ++i) {
+            m |= (uint32_t)(_ctrl[i] == h2) << i;
+        }
+        return MatchMask(m);
+    }
+    MatchMask match_empty() const { return match(CTRL_EMPTY); }
+    MatchMask match_empty_or_deleted() const {
+        uint32_t m = 0;
+        for (size_t i = 0; i < WIDTH; ++i) {
+            m |= (uint32_t)(_ctrl[i] < 0) << i;
+        }
+        return MatchMask(m);
+    }
+
+private:
+    const int8_t* _ctrl;
+};
+
+#endif
+
+} // namespace swiss_internal
+
+template <typename _Map, typename _Element> class SwissFlatMapIterator;
+
+template <typename _K, typename _T,
+          typename _Hash = DefaultHasher<_K>,
+          typename _Equal = DefaultEqualTo<_K> >
+class SwissFlatMap {
+public:
+    typedef _K key_type;
+    typedef _T mapped_type;
+    typedef FlatMapElement<_K, _T> Element;
+    typedef typename Element::value_type value_type;
+    typedef SwissFlatMapIterator<SwissFlatMap, value_type> iterator;
+    typedef SwissFlatMapIterator<SwissFlatMap, const value_type> const_iterator;
+    typedef _Hash hasher;
+    typedef _Equal key_equal;
+
+    static const size_t DEFAULT_NSLOT = 16;
+
+    explicit SwissFlatMap(const hasher& hashfn = hasher(),
+                          const key_equal& eql = key_equal())
+        : _ctrl(NULL)
+        , _slots(NULL)
+        , _nslot(0)
+        , _size(0)
+        , _ndeleted(0)
+        , _load_factor(80)
+        , _hashfn(hashfn)
+        , _eql(eql) {
+    }
+
+    SwissFlatMap(const SwissFlatMap& rhs)
+        : SwissFlatMap(rhs._hashfn, rhs._eql) {
+        _load_factor = rhs._load_factor;
+        if (!rhs.empty() && new_table(rhs._nslot) == 0) {
+            for (const_iterator it = rhs.begin(); it != rhs.end(); ++it) {
+                insert(it->first, it->second);
+            }
+        }
+    }
+
+    ~SwissFlatMap() {
+        clear();
+        free(_ctrl);
+        free(_slots);
+        _ctrl = NULL;
+        _slots = NULL;
+    }
+
+    SwissFlatMap& operator=(const SwissFlatMap& rhs) {
+        if (this != &rhs) {
+            SwissFlatMap tmp(rhs);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    void swap(SwissFlatMap& rhs) {
+        std::swap(_ctrl, rhs._ctrl);
+        std::swap(_slots, rhs._slots);
+        std::swap(_nslot, rhs._nslot);
+        std::swap(_size, rhs._size);
+        std::swap(_ndeleted, rhs._ndeleted);
+        std::swap(_load_factor, rhs._load_factor);
+        std::swap(_hashfn, rhs._hashfn);
+        std::swap(_eql, rhs._eql);
+    }
+
+    // Reserve `nbucket' slots. Optional: the map initializes itself with
+    // DEFAULT_NSLOT slots at the first insertion.
+    // Returns 0 on success, -1 otherwise.
+    int init(size_t nbucket, u_int load_factor = 80) {
+        if (initialized()) {
+            LOG(ERROR) << "Already initialized";
+            return -1;
+        }
+        if (load_factor < 10 || load_factor > 90) {
+            LOG(ERROR) << "Invalid load_factor=" << load_factor;
+            return -1;
+        }
+        _load_factor = load_factor;
+        return new_table(round_up_nslot(nbucket));
+    }
+
+    // Search for the value associated with `key'.
+    // Returns: address of the value, NULL on absence.
+    template <typename K2>
+    mapped_type* seek(const K2& key) const {
+        if (NULL == _ctrl) {
+            return NULL;
+        }
+        const size_t h = _hashfn(key);
+        const int8_t h2 = H2(h);
+        const size_t ngroup = _nslot / GROUP_WIDTH;
+        size_t g = H1(h) & (ngroup - 1);
+        for (size_t nprobe = 0; nprobe < ngroup; ++nprobe) {
+            const swiss_internal::Group group(_ctrl + g * GROUP_WIDTH);
+            for (typename swiss_internal::Group::MatchMask m = group.match(h2);
+                 m; m.remove_lowest()) {
+                const size_t s = g * GROUP_WIDTH + m.lowest_index();
+                if (_eql(_slots[s].element().first_ref(), key)) {
+                    return &_slots[s].element().second_ref();
+                }
+            }
+            if (group.match_empty()) {
+                // The probe of insert() would have stopped here as well,
+                // `key' is absent.
+                return NULL;
+            }
+            g = (g + nprobe + 1) & (ngroup - 1);
+        }
+        return NULL;
+    }
+
+    // Insert a pair of `key' and `value'. The value associated with an
+    // existing key is overwritten.
+    // Returns address of the inserted value, NULL on error.
+    mapped_type* insert(const key_type& key, const mapped_type& value) {
+        mapped_type* p = get_or_insert_key(key);
+        if (p != NULL) {
+            *p = value;
+        }
+        return p;
+    }
+
+    mapped_type* insert(const std::pair<key_type, mapped_type>& kv) {
+        return insert(kv.first, kv.second);
+    }
+
+    // Get the value associated with `key', insert a default-constructed
+    // value first if `key' does not exist.
+    mapped_type& operator[](const key_type& key) {
+        return *get_or_insert_key(key);
+    }
+
+    // Remove `key' and its associated value which is copied into
+    // `old_value' when non-NULL.
+    // Returns: 1 on erased, 0 otherwise.
+    template <typename K2>
+    size_t erase(const K2& key, mapped_type* old_value = NULL) {
+        if (NULL == _ctrl) {
+            return 0;
+        }
+        const size_t h = _hashfn(key);
+        const int8_t h2 = H2(h);
+        const size_t ngroup = _nslot / GROUP_WIDTH;
+        size_t g = H1(h) & (ngroup - 1);
+        for (size_t nprobe = 0; nprobe < ngroup; ++nprobe) {
+            const swiss_internal::Group group(_ctrl + g * GROUP_WIDTH);
+            for (typename swiss_internal::Group::MatchMask m = group.match(h2);
+                 m; m.remove_lowest()) {
+                const size_t s = g * GROUP_WIDTH + m.lowest_index();
+                if (_eql(_slots[s].element().first_ref(), key)) {
+                    if (old_value != NULL) {
+                        *old_value = _slots[s].element().second_ref();
+                    }
+                    _slots[s].destroy();
+                    --_size;
+                    if (group.match_empty()) {
+                        // Any probe passing this slot stops at this group
+                        // anyway, no tombstone needed.
+                        _ctrl[s] = swiss_internal::CTRL_EMPTY;
+                    } else {
+                        _ctrl[s] = swiss_internal::CTRL_DELETED;
+                        ++_ndeleted;
+                    }
+                    return 1;
+                }
+            }
+            if (group.match_empty()) {
+                return 0;
+            }
+            g = (g + nprobe + 1) & (ngroup - 1);
+        }
+        return 0;
+    }
+
+    // Remove all items. Allocated spaces are kept.
+    void clear() {
+        if (NULL == _ctrl) {
+            return;
+        }
+        if (_size != 0) {
+            for (size_t i = 0; i < _nslot; ++i) {
+                if (swiss_internal::ctrl_is_full(_ctrl[i])) {
+                    _slots[i].destroy();
+                }
+            }
+        }
+        memset(_ctrl, swiss_internal::CTRL_EMPTY, _nslot);
+        _size = 0;
+        _ndeleted = 0;
+    }
+
+    // Resize to at least `nbucket' slots and rehash all items.
+    // Returns successful or not.
+    bool resize(size_t nbucket) {
+        return rehash(round_up_nslot(nbucket)) == 0;
+    }
+
+    iterator begin() { return iterator(this, first_full(0)); }
+    iterator end() { return iterator(this, _nslot); }
+    const_iterator begin() const { return const_iterator(this, first_full(0)); }
+    const_iterator end() const { return const_iterator(this, _nslot); }
+
+    bool initialized() const { return _ctrl != NULL; }
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    size_t bucket_count() const { return _nslot; }
+    u_int load_factor() const { return _load_factor; }
+
+private:
+template <typename _Map, typename _Element> friend class SwissFlatMapIterator;
+
+    static const size_t GROUP_WIDTH = swiss_internal::Group::WIDTH;
+
+    // A slot stores one key/value, constructed in place when its control
+    // byte turns full.
+    struct Slot {
+        Element& element() { return *(Element*)_space; }
+        const Element& element() const { return *(const Element*)_space; }
+        void construct(const key_type& key) { new (_space) Element(key); }
+        void construct(const Element& e) { new (_space) Element(e); }
+        void destroy() { element().~Element(); }
+    private:
+        char _space[sizeof(Element)] __attribute__((aligned(__alignof__(Element))));
+    };
+
+    static size_t H1(size_t h) { return h >> 7; }
+    static int8_t H2(size_t h) { return (int8_t)(h & 0x7F); }
+
+    static size_t round_up_nslot(size_t n) {
+        size_t nslot = GROUP_WIDTH;
+        while (nslot < n) {
+            nslot <<= 1;
+        }
+        return nslot;
+    }
+
+    size_t first_full(size_t from) const {
+        for (size_t i = from; i < _nslot; ++i) {
+            if (swiss_internal::ctrl_is_full(_ctrl[i])) {
+                return i;
+            }
+        }
+        return _nslot;
+    }
+
+    bool is_too_crowded(size_t occupied) const {
+        return occupied * 100 >= _nslot * _load_factor;
+    }
+
+    int new_table(size_t nslot) {
+        int8_t* ctrl = (int8_t*)malloc(nslot);
+        Slot* slots = (Slot*)malloc(nslot * sizeof(Slot));
+        if (NULL == ctrl || NULL == slots) {
+            free(ctrl);
+            free(slots);
+            return -1;
+        }
+        memset(ctrl, swiss_internal::CTRL_EMPTY, nslot);
+        _ctrl = ctrl;
+        _slots = slots;
+        _nslot = nslot;
+        _size = 0;
+        _ndeleted = 0;
+        return 0;
+    }
+
+    // Move all items into a fresh table of `nslot' slots, which also
+    // reclaims tombstones.
+    int rehash(size_t nslot) {
+        int8_t* const old_ctrl = _ctrl;
+        Slot* const old_slots = _slots;
+        const size_t old_nslot = _nslot;
+        const size_t old_size = _size;
+        if (new_table(nslot) != 0) {
+            _ctrl = old_ctrl;
+            _slots = old_slots;
+            _nslot = old_nslot;
+            return -1;
+        }
+        for (size_t i = 0; i < old_nslot; ++i) {
+            if (swiss_internal::ctrl_is_full(old_ctrl[i])) {
+                const size_t s = find_insert_slot(
+                    _hashfn(old_slots[i].element().first_ref()));
+                _slots[s].construct(old_slots[i].element());
+                old_slots[i].destroy();
+            }
+        }
+        _size = old_size;
+        free(old_ctrl);
+        free(old_slots);
+        return 0;
+    }
+
+    // Find a non-full slot along the probe sequence of a hash and mark it
+    // full. The key must be absent and the table must not be crowded.
+    size_t find_insert_slot(size_t h) {
+        const size_t ngroup = _nslot / GROUP_WIDTH;
+        size_t g = H1(h) & (ngroup - 1);
+        for (size_t nprobe = 0; nprobe < ngroup; ++nprobe) {
+            const swiss_internal::Group group(_ctrl + g * GROUP_WIDTH);
+            const typename swiss_internal::Group::MatchMask m =
+                group.match_empty_or_deleted();
+            if (m) {
+                const size_t s = g * GROUP_WIDTH + m.lowest_index();
+                if (_ctrl[s] == swiss_internal::CTRL_DELETED) {
+                    --_ndeleted;
+                }
+                _ctrl[s] = H2(h);
+                return s;
+            }
+            g = (g + nprobe + 1) & (ngroup - 1);
+        }
+        CHECK(false) << "never here, the table is not crowded";
+        return 0;
+    }
+
+    mapped_type* get_or_insert_key(const key_type& key) {
+        if (NULL == _ctrl && new_table(DEFAULT_NSLOT) != 0) {
+            return NULL;
+        }
+        mapped_type* p = seek(key);
+        if (p != NULL) {
+            return p;
+        }
+        // Tombstones occupy probe positions as full slots do, count them
+        // in when judging crowdedness.
+        if (is_too_crowded(_size + _ndeleted + 1)) {
+            // Rehashing at the same size is enough when most of the
+            // occupancy consists of tombstones.
+            const size_t new_nslot =
+                is_too_crowded(_size * 2) ? _nslot * 2 : _nslot;
+            if (rehash(new_nslot) != 0) {
+                return NULL;
+            }
+        }
+        const size_t s = find_insert_slot(_hashfn(key));
+        _slots[s].construct(key);
+        ++_size;
+        return &_slots[s].element().second_ref();
+    }
+
+    int8_t* _ctrl;
+    Slot* _slots;
+    size_t _nslot;
+    size_t _size;
+    size_t _ndeleted;
+    u_int _load_factor;
+    hasher _hashfn;
+    key_equal _eql;
+};
+
+template <typename _Map, typename _Element>
+class SwissFlatMapIterator {
+public:
+    typedef _Element value_type;
+    typedef _Element& reference;
+    typedef _Element* pointer;
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ptrdiff_t difference_type;
+
+    SwissFlatMapIterator() : _map(NULL), _index(0) {}
+    SwissFlatMapIterator(const _Map* map, size_t index)
+        : _map(map), _index(index) {}
+    SwissFlatMapIterator(const SwissFlatMapIterator<
+                         _Map, typename remove_const<_Element>::type>& rhs)
+        : _map(rhs._map), _index(rhs._index) {}
+
+    reference operator*() const
+    { return const_cast<_Map*>(_map)->_slots[_index].element().value_ref(); }
+    pointer operator->() const { return &operator*(); }
+
+    SwissFlatMapIterator& operator++() {
+        _index = _map->first_full(_index + 1);
+        return *this;
+    }
+    SwissFlatMapIterator operator++(int) {
+        SwissFlatMapIterator tmp = *this;
+        ++*this;
+        return tmp;
+    }
+
+    bool operator==(const SwissFlatMapIterator& rhs) const
+    { return _map == rhs._map && _index == rhs._index; }
+    bool operator!=(const SwissFlatMapIterator& rhs) const
+    { return !operator==(rhs); }
+
+private:
+friend class SwissFlatMapIterator<_Map, typename add_const<_Element>::type>;
+
+    const _Map* _map;
+    size_t _index;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_SWISS_FLAT_MAP_H
@@ -27,6 +27,7 @@
 #include <stdlib.h>                            // strtol
 #include <sys/un.h>                            // sockaddr_un
 #include <sys/socket.h>                        // SO_REUSEADDR SO_REUSEPORT
+#include <netinet/tcp.h>                       // TCP_FASTOPEN
 #include <memory>
 #include <gflags/gflags.h>
 #include <sys/poll.h>
@@ -39,6 +40,8 @@
 #include "butil/logging.h"
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/strings/string_piece.h"
+#include "butil/thread_local.h"                // thread_atexit
+#include "butil/third_party/murmurhash3/murmurhash3.h"  // fmix32
 #include "butil/fd_utility.h"
 #include "butil/memory/scope_guard.h"
 
@@ -49,6 +52,12 @@ DEFINE_bool(reuse_addr, true, "Enable SO_REUSEADDR for all listened sockets");
 
 DEFINE_bool(reuse_uds_path, false, "remove unix domain socket file before listen to it");
 
+//supported since Linux 3.7.
+DEFINE_int32(tcp_fastopen_queue_size, 0,
+             "Enable TCP Fast Open on listened sockets and limit the queue "
+             "of connections waiting with pending SYN-data to this size, "
+             "<=0 disables TFO");
+
 __BEGIN_DECLS
 int BAIDU_WEAK bthread_connect(
     int sockfd, const struct sockaddr *serv_addr, socklen_t addrlen) {
@@ -165,6 +174,54 @@ int ip2hostname(ip_t ip, std::string* host) {
     return -1;
 }
 
+// Write `v'(< 100000) in decimal, returning the new tail.
+static inline char* write_small_decimal(char* p, uint32_t v) {
+    char tmp[5];
+    char* t = tmp;
+    do {
+        *t++ = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (t != tmp) {
+        *p++ = *--t;
+    }
+    return p;
+}
+
+// Formatted endpoints recently seen by this thread, typically covering the
+// bounded set of peers it logs about or refreshes from naming services.
+// Thread-local and direct-mapped: hits need no locking and never contend.
+struct CachedEndPointStr {
+    uint32_t ip_raw;
+    int32_t port;
+    bool valid;
+    uint8_t len;
+    char text[sizeof("255.255.255.255:65535")];
+};
+static const size_t EP_STR_CACHE_SIZE = 128;  // must be power of 2
+static __thread CachedEndPointStr* tls_ep_str_cache = NULL;
+
+static void delete_ep_str_cache(void* arg) {
+    delete[] static_cast<CachedEndPointStr*>(arg);
+    tls_ep_str_cache = NULL;
+}
+
+static CachedEndPointStr* get_ep_str_cache() {
+    if (tls_ep_str_cache == NULL) {
+        CachedEndPointStr* c =
+            new (std::nothrow) CachedEndPointStr[EP_STR_CACHE_SIZE];
+        if (NULL == c) {
+            return NULL;
+        }
+        for (size_t i = 0; i < EP_STR_CACHE_SIZE; ++i) {
+            c[i].valid = false;
+        }
+        thread_atexit(delete_ep_str_cache, c);
+        tls_ep_str_cache = c;
+    }
+    return tls_ep_str_cache;
+}
+
 EndPointStr endpoint2str(const EndPoint& point) {
     EndPointStr str;
     if (ExtendedEndPoint::is_extended(point)) {
@@ -176,6 +233,42 @@ EndPointStr endpoint2str(const EndPoint& point) {
         }
         return str;
     }
+    if ((unsigned)point.port <= 65535u) {
+        const uint32_t ip_raw = point.ip.s_addr;
+        CachedEndPointStr* e = NULL;
+        CachedEndPointStr* cache = get_ep_str_cache();
+        if (cache != NULL) {
+            e = &cache[fmix32(ip_raw ^ ((uint32_t)point.port << 8)) &
+                       (EP_STR_CACHE_SIZE - 1)];
+            if (e->valid && e->ip_raw == ip_raw && e->port == point.port) {
+                memcpy(str._buf, e->text, e->len + 1);
+                return str;
+            }
+        }
+        // Format in one pass: inet_ntop and snprintf dominate
+        // logging-heavy profiles.
+        const uint8_t* q = (const uint8_t*)&point.ip;
+        char* p = str._buf;
+        p = write_small_decimal(p, q[0]);
+        *p++ = '.';
+        p = write_small_decimal(p, q[1]);
+        *p++ = '.';
+        p = write_small_decimal(p, q[2]);
+        *p++ = '.';
+        p = write_small_decimal(p, q[3]);
+        *p++ = ':';
+        p = write_small_decimal(p, (uint32_t)point.port);
+        *p = '\0';
+        if (e != NULL) {
+            e->ip_raw = ip_raw;
+            e->port = point.port;
+            e->len = (uint8_t)(p - str._buf);
+            memcpy(e->text, str._buf, e->len + 1);
+            e->valid = true;
+        }
+        return str;
+    }
+    // Unusual ports(callers passing raw ints), keep the old path.
     if (inet_ntop(AF_INET, &point.ip, str._buf, INET_ADDRSTRLEN) == NULL) {
         return endpoint2str(EndPoint(IP_NONE, 0));
     }
@@ -264,10 +357,70 @@ const char* my_hostname() {
     return get_leaky_singleton<MyAddressInfo>()->my_hostname;
 }
 
+// Single-pass parser of the plain "a.b.c.d:port" form, dominating bulk
+// ingestion of server lists from naming files. Returns true when fully
+// parsed, false to let the caller fall back to the generic path which
+// stays the authority on corner cases(leading zeros, signs after the
+// colon and so on).
+static bool parse_plain_ipv4(const char* str, EndPoint* point) {
+    const char* p = str;
+    for (; isspace(*p); ++p);
+    uint32_t ip = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        if (*p == '0' && p[1] >= '0' && p[1] <= '9') {
+            // inet_pton rejects leading zeros, let it decide.
+            return false;
+        }
+        uint32_t octet = 0;
+        int nd = 0;
+        for (; *p >= '0' && *p <= '9' && nd < 4; ++p, ++nd) {
+            octet = octet * 10 + (*p - '0');
+        }
+        if (octet > 255) {
+            return false;
+        }
+        if (i < 3) {
+            if (*p != '.') {
+                return false;
+            }
+            ++p;
+        }
+        ip = (ip << 8) | octet;
+    }
+    if (*p != ':') {
+        return false;
+    }
+    ++p;
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+    uint32_t port = 0;
+    int nd = 0;
+    for (; *p >= '0' && *p <= '9' && nd < 6; ++p, ++nd) {
+        port = port * 10 + (*p - '0');
+    }
+    if (port > 65535 || (*p >= '0' && *p <= '9')) {
+        return false;
+    }
+    for (; isspace(*p); ++p);
+    if (*p) {
+        return false;
+    }
+    point->ip.s_addr = htonl(ip);
+    point->port = (int)port;
+    return true;
+}
+
 int str2endpoint(const char* str, EndPoint* point) {
     if (ExtendedEndPoint::create(str, point)) {
         return 0;
     }
+    if (parse_plain_ipv4(str, point)) {
+        return 0;
+    }
 
     // Should be enough to hold ip address
     char buf[64];
@@ -537,6 +690,10 @@ int tcp_connect(const EndPoint& server, int* self_port, int connect_timeout_ms)
 }
 
 int tcp_listen(EndPoint point) {
+    return tcp_listen(point, false);
+}
+
+int tcp_listen(EndPoint point, bool reuse_port) {
     struct sockaddr_storage serv_addr;
     socklen_t serv_addr_size = 0;
     if (endpoint2sockaddr(point, &serv_addr, &serv_addr_size) != 0) {
@@ -560,7 +717,7 @@ int tcp_listen(EndPoint point) {
 #endif
     }
 
-    if (FLAGS_reuse_port) {
+    if (FLAGS_reuse_port || reuse_port) {
 #if defined(SO_REUSEPORT)
         const int on = 1;
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
@@ -568,7 +725,7 @@ int tcp_listen(EndPoint point) {
             LOG(WARNING) << "Fail to setsockopt SO_REUSEPORT of sockfd=" << sockfd;
         }
 #else
-        LOG(ERROR) << "Missing def of SO_REUSEPORT while -reuse_port is on";
+        LOG(ERROR) << "Missing def of SO_REUSEPORT while SO_REUSEPORT is requested";
         return -1;
 #endif
     }
@@ -580,6 +737,21 @@ int tcp_listen(EndPoint point) {
     if (::bind(sockfd, (struct sockaddr*)& serv_addr, serv_addr_size) != 0) {
         return -1;
     }
+    if (FLAGS_tcp_fastopen_queue_size > 0 && serv_addr.ss_family != AF_UNIX) {
+#if defined(OS_LINUX) && defined(TCP_FASTOPEN)
+        const int qlen = FLAGS_tcp_fastopen_queue_size;
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN,
+                       &qlen, sizeof(qlen)) != 0) {
+            // Old kernels or tcp_fastopen turned off by sysctl, ordinary
+            // handshakes still work.
+            LOG(WARNING) << "Fail to setsockopt TCP_FASTOPEN of sockfd="
+                         << sockfd;
+        }
+#else
+        LOG(WARNING) << "Missing def of TCP_FASTOPEN while"
+            " -tcp_fastopen_queue_size is on";
+#endif
+    }
     if (listen(sockfd, 65535) != 0) {
         //             ^^^ kernel would silently truncate backlog to the value
         //             defined in /proc/sys/net/core/somaxconn if it is less
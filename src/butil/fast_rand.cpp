@@ -146,6 +146,122 @@ uint64_t fast_rand_in_u64(uint64_t min, uint64_t max) {
     return min + fast_rand_impl(range, &_tls_seed);
 }
 
+// ===== batched generator =====
+
+// Per-thread buffer refilled by 4 interleaved xoshiro256+ lanes. The
+// lane-parallel layout below lets the compiler vectorize the refill loop
+// (verified with gcc/clang at -O2 on x86-64 and aarch64); no intrinsics
+// are needed. xoshiro256+ passes BigCrush except for the lowest 3 bits,
+// which is fine here since consumers either use the whole word or the
+// high bits (multiply-shift in fast_rand_batched_less_than).
+struct FastRandBatch {
+    static const size_t NBUF = 64;   // 512-byte buffer, refilled 16x less
+    static const size_t NLANE = 4;   // often than a per-call generator
+    uint64_t buf[NBUF];
+    size_t next;                     // == NBUF when buffer is exhausted
+    uint64_t s0[NLANE];
+    uint64_t s1[NLANE];
+    uint64_t s2[NLANE];
+    uint64_t s3[NLANE];
+    bool seeded;
+};
+
+static __thread FastRandBatch _tls_batch = { {0}, 0, {0}, {0}, {0}, {0}, false };
+
+inline uint64_t rotl_u64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static void seed_batch(FastRandBatch* b) {
+    SplitMix64Seed seed4seed = butil::gettimeofday_us() + (uintptr_t)b;
+    for (size_t l = 0; l < FastRandBatch::NLANE; ++l) {
+        b->s0[l] = splitmix64_next(&seed4seed);
+        b->s1[l] = splitmix64_next(&seed4seed);
+        b->s2[l] = splitmix64_next(&seed4seed);
+        b->s3[l] = splitmix64_next(&seed4seed);
+    }
+    b->next = FastRandBatch::NBUF;
+    b->seeded = true;
+}
+
+static void refill_batch(FastRandBatch* b) {
+    uint64_t s0[FastRandBatch::NLANE];
+    uint64_t s1[FastRandBatch::NLANE];
+    uint64_t s2[FastRandBatch::NLANE];
+    uint64_t s3[FastRandBatch::NLANE];
+    for (size_t l = 0; l < FastRandBatch::NLANE; ++l) {
+        s0[l] = b->s0[l];
+        s1[l] = b->s1[l];
+        s2[l] = b->s2[l];
+        s3[l] = b->s3[l];
+    }
+    for (size_t i = 0; i < FastRandBatch::NBUF; i += FastRandBatch::NLANE) {
+        for (size_t l = 0; l < FastRandBatch::NLANE; ++l) {
+            b->buf[i + l] = s0[l] + s3[l];
+            const uint64_t t = s1[l] << 17;
+            s2[l] ^= s0[l];
+            s3[l] ^= s1[l];
+            s1[l] ^= s2[l];
+            s0[l] ^= s3[l];
+            s2[l] ^= t;
+            s3[l] = rotl_u64(s3[l], 45);
+        }
+    }
+    for (size_t l = 0; l < FastRandBatch::NLANE; ++l) {
+        b->s0[l] = s0[l];
+        b->s1[l] = s1[l];
+        b->s2[l] = s2[l];
+        b->s3[l] = s3[l];
+    }
+    b->next = 0;
+}
+
+uint64_t fast_rand_batched() {
+    FastRandBatch* b = &_tls_batch;
+    if (b->next >= FastRandBatch::NBUF) {
+        if (!b->seeded) {
+            seed_batch(b);
+        }
+        refill_batch(b);
+    }
+    return b->buf[b->next++];
+}
+
+uint64_t fast_rand_batched_less_than(uint64_t range) {
+    if (range == 0) {
+        return 0;
+    }
+#if defined(__SIZEOF_INT128__)
+    // Lemire's multiply-shift: map a 64-bit random x into [0, range) as
+    // (x * range) >> 64. The low 64 bits of the product tell whether x
+    // fell into the biased remainder (2^64 % range values), which is
+    // rejected to keep the result exactly uniform. The rejection branch
+    // is taken with probability < range/2^64, essentially never for
+    // server-list sizes.
+    uint64_t x = fast_rand_batched();
+    __uint128_t m = (__uint128_t)x * range;
+    uint64_t lo = (uint64_t)m;
+    if (lo < range) {
+        const uint64_t threshold = -range % range;
+        while (lo < threshold) {
+            x = fast_rand_batched();
+            m = (__uint128_t)x * range;
+            lo = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+#else
+    // No 128-bit multiply: fall back to the division method over the
+    // batched source.
+    const uint64_t div = std::numeric_limits<uint64_t>::max() / range;
+    uint64_t result;
+    do {
+        result = fast_rand_batched() / div;
+    } while (result >= range);
+    return result;
+#endif
+}
+
 inline double fast_rand_double(FastRandSeed* seed) {
     // Copied from rand_util.cc
     COMPILE_ASSERT(std::numeric_limits<double>::radix == 2, otherwise_use_scalbn);
@@ -33,11 +33,18 @@
 #include <stdexcept>                       // std::invalid_argument
 #include <gflags/gflags.h>                 // gflags
 #include "butil/build_config.h"             // ARCH_CPU_X86_64
+#if defined(ARCH_CPU_X86_64)
+#include <emmintrin.h>                     // _mm_stream_si128, _mm_prefetch
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>                      // vld1q_u8, vst1q_u8
+#endif
 #include "butil/atomicops.h"                // butil::atomic
 #include "butil/thread_local.h"             // thread_atexit
 #include "butil/macros.h"                   // BAIDU_CASSERT
 #include "butil/logging.h"                  // CHECK, LOG
 #include "butil/fd_guard.h"                 // butil::fd_guard
+#include "butil/time.h"                     // cpuwide_time_us
+#include "butil/crc32c.h"                   // crc32c::Extend
 #include "butil/iobuf.h"
 #include "butil/iobuf_profiler.h"
 
@@ -46,6 +53,11 @@ namespace iobuf {
 
 DEFINE_int32(iobuf_aligned_buf_block_size, 0, "iobuf aligned buf block size");
 
+DEFINE_bool(iobuf_size_classed_blocks, false,
+            "Back large appends with size-classed blocks (4K/16K/64K/256K) "
+            "chosen by append size and recycle their memory through "
+            "per-thread magazines");
+
 typedef ssize_t (*iov_function)(int fd, const struct iovec *vector,
                                    int count, off_t offset);
 
@@ -164,17 +176,117 @@ void* cp(void *__restrict dest, const void *__restrict src, size_t n) {
     return memcpy(dest, src, n);
 }
 
+DEFINE_uint64(iobuf_nontemporal_copy_threshold, 1024 * 1024,
+              "Bulk copies (copy_to/cutn/append/fetch) moving at least this "
+              "many bytes in total use cache-bypassing streaming stores, so "
+              "that copying a large attachment does not evict the working "
+              "set of the handler from L2/L3. 0 disables the streaming "
+              "kernel.");
+
+// A copy kernel for bulk data: prefetch the source ahead with the
+// non-temporal hint and write the destination with streaming stores that
+// bypass the cache. Only worthwhile well above cache sizes, see
+// choose_cp() below. The dispatch is by total size of the operation
+// rather than per 8K block, since the pollution comes from the sum.
+#if defined(ARCH_CPU_X86_64)
+static void* cp_non_temporal(void* __restrict dest,
+                             const void* __restrict src, size_t n) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+    // Streaming stores require a 16-byte aligned destination.
+    const uintptr_t misalign = (uintptr_t)d & 15;
+    if (misalign != 0 && n >= 16) {
+        const size_t head = 16 - misalign;
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+    }
+    if (((uintptr_t)s & 15) == 0) {
+        for (; n >= 64; n -= 64, d += 64, s += 64) {
+            _mm_prefetch(s + 256, _MM_HINT_NTA);
+            const __m128i v0 = _mm_load_si128((const __m128i*)s);
+            const __m128i v1 = _mm_load_si128((const __m128i*)(s + 16));
+            const __m128i v2 = _mm_load_si128((const __m128i*)(s + 32));
+            const __m128i v3 = _mm_load_si128((const __m128i*)(s + 48));
+            _mm_stream_si128((__m128i*)d, v0);
+            _mm_stream_si128((__m128i*)(d + 16), v1);
+            _mm_stream_si128((__m128i*)(d + 32), v2);
+            _mm_stream_si128((__m128i*)(d + 48), v3);
+        }
+    } else {
+        for (; n >= 64; n -= 64, d += 64, s += 64) {
+            _mm_prefetch(s + 256, _MM_HINT_NTA);
+            const __m128i v0 = _mm_loadu_si128((const __m128i*)s);
+            const __m128i v1 = _mm_loadu_si128((const __m128i*)(s + 16));
+            const __m128i v2 = _mm_loadu_si128((const __m128i*)(s + 32));
+            const __m128i v3 = _mm_loadu_si128((const __m128i*)(s + 48));
+            _mm_stream_si128((__m128i*)d, v0);
+            _mm_stream_si128((__m128i*)(d + 16), v1);
+            _mm_stream_si128((__m128i*)(d + 32), v2);
+            _mm_stream_si128((__m128i*)(d + 48), v3);
+        }
+    }
+    // Order the streamed data with following normal stores/loads.
+    _mm_sfence();
+    if (n) {
+        memcpy(d, s, n);
+    }
+    return dest;
+}
+#elif defined(__ARM_NEON)
+// AArch64 has no cacheable-bypass store intrinsic in gcc; prefetching the
+// source with the streaming hint at least avoids polluting the cache with
+// source lines. Destination pollution remains.
+static void* cp_non_temporal(void* __restrict dest,
+                             const void* __restrict src, size_t n) {
+    char* d = (char*)dest;
+    const char* s = (const char*)src;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __builtin_prefetch(s + 256, 0 /*read*/, 0 /*no temporal locality*/);
+        vst1q_u8((uint8_t*)d, vld1q_u8((const uint8_t*)s));
+        vst1q_u8((uint8_t*)(d + 16), vld1q_u8((const uint8_t*)(s + 16)));
+        vst1q_u8((uint8_t*)(d + 32), vld1q_u8((const uint8_t*)(s + 32)));
+        vst1q_u8((uint8_t*)(d + 48), vld1q_u8((const uint8_t*)(s + 48)));
+    }
+    if (n) {
+        memcpy(d, s, n);
+    }
+    return dest;
+}
+#else
+static void* cp_non_temporal(void* __restrict dest,
+                             const void* __restrict src, size_t n) {
+    return memcpy(dest, src, n);
+}
+#endif
+
+typedef void* (*CopyFn)(void* __restrict, const void* __restrict, size_t);
+
+// Pick the copy kernel for an operation moving `total' bytes. Decided
+// once per bulk call: the per-BlockRef chunks are typically just 8K and
+// would never pass a per-chunk threshold.
+inline CopyFn choose_cp(size_t total) {
+    if (FLAGS_iobuf_nontemporal_copy_threshold > 0 &&
+        total >= FLAGS_iobuf_nontemporal_copy_threshold) {
+        return cp_non_temporal;
+    }
+    return cp;
+}
+
 // Function pointers to allocate or deallocate memory for a IOBuf::Block
 void* (*blockmem_allocate)(size_t) = ::malloc;
 void  (*blockmem_deallocate)(void*) = ::free;
 
 void remove_tls_block_chain();
+void clear_tls_magazines();
 
 // Use default function pointers
 void reset_blockmem_allocate_and_deallocate() {
     // There maybe block allocated by previous hooks, it's wrong to free them using
     // mismatched hook.
     remove_tls_block_chain();
+    clear_tls_magazines();
     blockmem_allocate = ::malloc;
     blockmem_deallocate = ::free;
 }
@@ -183,6 +295,45 @@ butil::static_atomic<size_t> g_nblock = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_blockmem = BUTIL_STATIC_ATOMIC_INIT(0);
 butil::static_atomic<size_t> g_newbigview = BUTIL_STATIC_ATOMIC_INIT(0);
 
+// Per-site accounting of blocks, see IOBuf::BlockAllocSite. Updated with
+// the same relaxed counters as g_nblock/g_blockmem above.
+static butil::static_atomic<size_t> g_site_nblock[IOBuf::BLOCK_SITE_NUM];
+static butil::static_atomic<size_t> g_site_blockmem[IOBuf::BLOCK_SITE_NUM];
+static butil::static_atomic<size_t>
+    g_site_lifetime[IOBuf::BLOCK_SITE_NUM][IOBuf::BlockSiteStat::NLIFETIME_BUCKET];
+
+static __thread int tls_alloc_site = IOBuf::BLOCK_SITE_UNKNOWN;
+
+int get_tls_alloc_site() { return tls_alloc_site; }
+
+void set_tls_alloc_site(int site) {
+    if (site < 0 || site >= IOBuf::BLOCK_SITE_NUM) {
+        site = IOBuf::BLOCK_SITE_UNKNOWN;
+    }
+    tls_alloc_site = site;
+}
+
+// Upper bounds(us) of the lifetime buckets, last bucket is unbounded.
+static const int64_t LIFETIME_BUCKET_LIMIT_US[] =
+    { 1000, 10000, 100000, 1000000, 10000000 };
+BAIDU_CASSERT(arraysize(LIFETIME_BUCKET_LIMIT_US) + 1 ==
+              IOBuf::BlockSiteStat::NLIFETIME_BUCKET,
+              inconsistent_lifetime_buckets);
+
+static size_t lifetime_bucket(int64_t lifetime_us) {
+    size_t i = 0;
+    while (i < arraysize(LIFETIME_BUCKET_LIMIT_US) &&
+           lifetime_us >= LIFETIME_BUCKET_LIMIT_US[i]) {
+        ++i;
+    }
+    return i;
+}
+
+// Try to cache the raw memory of a dying block (allocated with size
+// `block_size') in the magazine of the calling thread. Returns false if
+// the memory should be deallocated normally.
+bool release_block_mem(void* mem, size_t block_size);
+
 }  // namespace iobuf
 
 size_t IOBuf::block_count() {
@@ -197,8 +348,35 @@ size_t IOBuf::new_bigview_count() {
     return iobuf::g_newbigview.load(butil::memory_order_relaxed);
 }
 
+const char* IOBuf::block_alloc_site_name(int site) {
+    switch (site) {
+    case BLOCK_SITE_UNKNOWN: return "unknown";
+    case BLOCK_SITE_SOCKET_INGRESS: return "socket_ingress";
+    case BLOCK_SITE_SERIALIZATION: return "serialization";
+    case BLOCK_SITE_USER: return "user";
+    }
+    return "invalid";
+}
+
+void IOBuf::get_block_site_stat(int site, BlockSiteStat* stat) {
+    memset(stat, 0, sizeof(*stat));
+    if (site < 0 || site >= BLOCK_SITE_NUM) {
+        return;
+    }
+    stat->nblock = iobuf::g_site_nblock[site].load(butil::memory_order_relaxed);
+    stat->memory = iobuf::g_site_blockmem[site].load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < BlockSiteStat::NLIFETIME_BUCKET; ++i) {
+        stat->lifetime_buckets[i] =
+            iobuf::g_site_lifetime[site][i].load(butil::memory_order_relaxed);
+    }
+}
+
 const uint16_t IOBUF_BLOCK_FLAGS_USER_DATA = 1 << 0;
 const uint16_t IOBUF_BLOCK_FLAGS_SAMPLED = 1 << 1;
+// Bits 2-3 hold the IOBuf::BlockAllocSite the block was created at.
+const uint16_t IOBUF_BLOCK_FLAGS_SITE_SHIFT = 2;
+const uint16_t IOBUF_BLOCK_FLAGS_SITE_MASK = 0x3 << IOBUF_BLOCK_FLAGS_SITE_SHIFT;
+BAIDU_CASSERT(IOBuf::BLOCK_SITE_NUM <= 4, alloc_site_must_fit_in_2_bits);
 using UserDataDeleter = std::function<void(void*)>;
 
 struct UserDataExtension {
@@ -221,7 +399,9 @@ struct IOBuf::Block {
     // When flag & IOBUF_BLOCK_FLAGS_USER_DATA is non-0, data points to the user data and
     // the deleter is put in UserDataExtension at `(char*)this+sizeof(Block)'
     char* data;
-        
+    // When the block was created, for the lifetime histogram at /iobuf.
+    int64_t birth_us;
+
     Block(char* data_in, uint32_t data_size)
         : nshared(1)
         , flags(0)
@@ -229,10 +409,16 @@ struct IOBuf::Block {
         , size(0)
         , cap(data_size)
         , u({NULL})
-        , data(data_in) {
+        , data(data_in)
+        , birth_us(butil::cpuwide_time_us()) {
         iobuf::g_nblock.fetch_add(1, butil::memory_order_relaxed);
         iobuf::g_blockmem.fetch_add(data_size + sizeof(Block),
                                     butil::memory_order_relaxed);
+        const int site = iobuf::get_tls_alloc_site();
+        flags |= (uint16_t)(site << IOBUF_BLOCK_FLAGS_SITE_SHIFT);
+        iobuf::g_site_nblock[site].fetch_add(1, butil::memory_order_relaxed);
+        iobuf::g_site_blockmem[site].fetch_add(
+            data_size + sizeof(Block), butil::memory_order_relaxed);
         if (is_samplable()) {
             SubmitIOBufSample(this, 1);
         }
@@ -245,7 +431,8 @@ struct IOBuf::Block {
         , size(data_size)
         , cap(data_size)
         , u({0})
-        , data(data_in) {
+        , data(data_in)
+        , birth_us(butil::cpuwide_time_us()) {
         auto ext = new (get_user_data_extension()) UserDataExtension();
         ext->deleter = std::move(deleter);
         if (is_samplable()) {
@@ -287,8 +474,23 @@ struct IOBuf::Block {
                 iobuf::g_nblock.fetch_sub(1, butil::memory_order_relaxed);
                 iobuf::g_blockmem.fetch_sub(cap + sizeof(Block),
                                             butil::memory_order_relaxed);
+                const int site = (flags & IOBUF_BLOCK_FLAGS_SITE_MASK)
+                    >> IOBUF_BLOCK_FLAGS_SITE_SHIFT;
+                iobuf::g_site_nblock[site].fetch_sub(
+                    1, butil::memory_order_relaxed);
+                iobuf::g_site_blockmem[site].fetch_sub(
+                    cap + sizeof(Block), butil::memory_order_relaxed);
+                iobuf::g_site_lifetime[site][iobuf::lifetime_bucket(
+                    butil::cpuwide_time_us() - birth_us)].fetch_add(
+                        1, butil::memory_order_relaxed);
+                // Blocks created by create_block_aligned() shift `data',
+                // only in-place blocks have a recoverable allocation size.
+                const bool inplace = (data == (char*)this + sizeof(Block));
+                const size_t alloc_size = cap + sizeof(Block);
                 this->~Block();
-                iobuf::blockmem_deallocate(this);
+                if (!inplace || !iobuf::release_block_mem(this, alloc_size)) {
+                    iobuf::blockmem_deallocate(this);
+                }
             } else if (flags & IOBUF_BLOCK_FLAGS_USER_DATA) {
                 auto ext = get_user_data_extension();
                 ext->deleter(data);
@@ -341,12 +543,101 @@ uint32_t block_size(IOBuf::Block const* b) {
     return b->size;
 }
 
+// === Size-classed blocks (--iobuf_size_classed_blocks) ===
+// Large appends pick a block size matching the data instead of chaining
+// DEFAULT_BLOCK_SIZE blocks. Memory of dying class-sized blocks is kept
+// in small per-thread magazines; recycling and first-touch allocation on
+// the using thread also keep the backing pages NUMA-local.
+static const size_t BLOCK_SIZE_CLASSES[] = {
+    4096, 16384, 65536, 262144
+};
+const int NUM_BLOCK_SIZE_CLASSES = ARRAY_SIZE(BLOCK_SIZE_CLASSES);
+// Per class per thread; 4 * (4K+16K+64K+256K) < 1.4MB per thread at worst.
+const int MAX_MAGAZINE_BLOCKS = 4;
+
+struct FreeBlockMem {
+    FreeBlockMem* next;
+};
+
+struct TLSBlockMagazines {
+    FreeBlockMem* head[NUM_BLOCK_SIZE_CLASSES];
+    int num[NUM_BLOCK_SIZE_CLASSES];
+    bool registered;
+};
+
+static __thread TLSBlockMagazines g_tls_mags = { {NULL}, {0}, false };
+
+static int size_class_index(size_t block_size) {
+    for (int i = 0; i < NUM_BLOCK_SIZE_CLASSES; ++i) {
+        if (BLOCK_SIZE_CLASSES[i] == block_size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Smallest class able to hold `count' payload bytes, or the largest class.
+size_t block_size_for_append(size_t count) {
+    for (int i = 0; i < NUM_BLOCK_SIZE_CLASSES; ++i) {
+        if (BLOCK_SIZE_CLASSES[i] - sizeof(IOBuf::Block) >= count) {
+            return BLOCK_SIZE_CLASSES[i];
+        }
+    }
+    return BLOCK_SIZE_CLASSES[NUM_BLOCK_SIZE_CLASSES - 1];
+}
+
+void clear_tls_magazines() {
+    TLSBlockMagazines& mags = g_tls_mags;
+    for (int i = 0; i < NUM_BLOCK_SIZE_CLASSES; ++i) {
+        FreeBlockMem* p = mags.head[i];
+        mags.head[i] = NULL;
+        mags.num[i] = 0;
+        while (p) {
+            FreeBlockMem* const saved_next = p->next;
+            iobuf::blockmem_deallocate(p);
+            p = saved_next;
+        }
+    }
+}
+
+static void* acquire_block_mem(size_t block_size) {
+    if (FLAGS_iobuf_size_classed_blocks) {
+        const int i = size_class_index(block_size);
+        if (i >= 0 && g_tls_mags.head[i] != NULL) {
+            FreeBlockMem* const p = g_tls_mags.head[i];
+            g_tls_mags.head[i] = p->next;
+            --g_tls_mags.num[i];
+            return p;
+        }
+    }
+    return iobuf::blockmem_allocate(block_size);
+}
+
+bool release_block_mem(void* mem, size_t block_size) {
+    if (!FLAGS_iobuf_size_classed_blocks || IsIOBufProfilerEnabled()) {
+        return false;
+    }
+    const int i = size_class_index(block_size);
+    if (i < 0 || g_tls_mags.num[i] >= MAX_MAGAZINE_BLOCKS) {
+        return false;
+    }
+    FreeBlockMem* const p = (FreeBlockMem*)mem;
+    p->next = g_tls_mags.head[i];
+    g_tls_mags.head[i] = p;
+    ++g_tls_mags.num[i];
+    if (!g_tls_mags.registered) {
+        g_tls_mags.registered = true;
+        butil::thread_atexit(clear_tls_magazines);
+    }
+    return true;
+}
+
 inline IOBuf::Block* create_block(const size_t block_size) {
     if (block_size > 0xFFFFFFFFULL) {
         LOG(FATAL) << "block_size=" << block_size << " is too large";
         return NULL;
     }
-    char* mem = (char*)iobuf::blockmem_allocate(block_size);
+    char* mem = (char*)acquire_block_mem(block_size);
     if (mem == NULL) {
         return NULL;
     }
@@ -889,15 +1180,16 @@ size_t IOBuf::cutn(void* out, size_t n) {
         n = len;
     }
     const size_t saved_n = n;
+    const iobuf::CopyFn copy = iobuf::choose_cp(n);
     while (n) {   // length() == 0 does not enter
         IOBuf::BlockRef &r = _front_ref();
         if (r.length <= n) {
-            iobuf::cp(out, r.block->data + r.offset, r.length);
+            copy(out, r.block->data + r.offset, r.length);
             out = (char*)out + r.length;
             n -= r.length;
             _pop_front_ref();
         } else {
-            iobuf::cp(out, r.block->data + r.offset, n);
+            copy(out, r.block->data + r.offset, n);
             out = (char*)out + n;
             r.offset += n;
             r.length -= n;
@@ -1236,14 +1528,34 @@ int IOBuf::append(void const* data, size_t count) {
         return push_back(*((char const*)data));
     }
     size_t total_nc = 0;
+    const iobuf::CopyFn copy = iobuf::choose_cp(count);
     while (total_nc < count) {  // excluded count == 0
+        const size_t remaining = count - total_nc;
+        if (iobuf::FLAGS_iobuf_size_classed_blocks &&
+            remaining > IOBuf::DEFAULT_BLOCK_SIZE) {
+            // A large stretch gets a dedicated block of matching size
+            // class instead of chaining default-sized blocks.
+            IOBuf::Block* b = iobuf::create_block(
+                iobuf::block_size_for_append(remaining));
+            if (BAIDU_UNLIKELY(!b)) {
+                return -1;
+            }
+            const size_t nc = std::min(remaining, b->left_space());
+            copy(b->data, (char*)data + total_nc, nc);
+            b->size = nc;
+            const IOBuf::BlockRef r = { 0, (uint32_t)nc, b };
+            _push_back_ref(r);
+            b->dec_ref();  // drop the creation ref, owned by this IOBuf now
+            total_nc += nc;
+            continue;
+        }
         IOBuf::Block* b = iobuf::share_tls_block();
         if (BAIDU_UNLIKELY(!b)) {
             return -1;
         }
-        const size_t nc = std::min(count - total_nc, b->left_space());
-        iobuf::cp(b->data + b->size, (char*)data + total_nc, nc);
-        
+        const size_t nc = std::min(remaining, b->left_space());
+        copy(b->data + b->size, (char*)data + total_nc, nc);
+
         const IOBuf::BlockRef r = { (uint32_t)b->size, (uint32_t)nc, b };
         _push_back_ref(r);
         b->size += nc;
@@ -1465,10 +1777,11 @@ size_t IOBuf::copy_to(void* d, size_t n, size_t pos) const {
         offset -= r.length;
     }
     size_t m = n;
+    const iobuf::CopyFn copy = iobuf::choose_cp(std::min(n, length() - pos));
     for (; m != 0 && i < nref; ++i) {
         IOBuf::BlockRef const& r = _ref_at(i);
         const size_t nc = std::min(m, (size_t)r.length - offset);
-        iobuf::cp(d, r.block->data + r.offset + offset, nc);
+        copy(d, r.block->data + r.offset + offset, nc);
         offset = 0;
         d = (char*)d + nc;
         m -= nc;
@@ -1516,17 +1829,18 @@ void const* IOBuf::fetch(void* d, size_t n) const {
             return r0.block->data + r0.offset;
         }
     
-        iobuf::cp(d, r0.block->data + r0.offset, r0.length);
+        const iobuf::CopyFn copy = iobuf::choose_cp(n);
+        copy(d, r0.block->data + r0.offset, r0.length);
         size_t total_nc = r0.length;
         const size_t nref = _ref_num();
         for (size_t i = 1; i < nref; ++i) {
             IOBuf::BlockRef const& r = _ref_at(i);
             if (n <= r.length + total_nc) {
-                iobuf::cp((char*)d + total_nc,
-                            r.block->data + r.offset, n - total_nc);
+                copy((char*)d + total_nc,
+                     r.block->data + r.offset, n - total_nc);
                 return d;
             }
-            iobuf::cp((char*)d + total_nc, r.block->data + r.offset, r.length);
+            copy((char*)d + total_nc, r.block->data + r.offset, r.length);
             total_nc += r.length;
         }
     }
@@ -2057,11 +2371,18 @@ IOBufAsZeroCopyOutputStream::~IOBufAsZeroCopyOutputStream() {
 bool IOBufAsZeroCopyOutputStream::Next(void** data, int* size) {
     if (_cur_block == NULL || _cur_block->full()) {
         _release_block();
+        // Attribute blocks of this stream(the serializing path) unless the
+        // caller already set a more specific site.
+        const int saved_site = iobuf::get_tls_alloc_site();
+        if (saved_site == IOBuf::BLOCK_SITE_UNKNOWN) {
+            iobuf::set_tls_alloc_site(IOBuf::BLOCK_SITE_SERIALIZATION);
+        }
         if (_block_size > 0) {
             _cur_block = iobuf::create_block(_block_size);
         } else {
             _cur_block = iobuf::acquire_tls_block();
         }
+        iobuf::set_tls_alloc_site(saved_site);
         if (_cur_block == NULL) {
             return false;
         }
@@ -2166,6 +2487,152 @@ void IOBufAsZeroCopyOutputStream::_release_block() {
     _cur_block = NULL;
 }
 
+static uint32_t crc32c_of_iobuf(const IOBuf& buf) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < buf.backing_block_num(); ++i) {
+        const StringPiece blk = buf.backing_block(i);
+        crc = butil::crc32c::Extend(crc, blk.data(), blk.size());
+    }
+    return crc;
+}
+
+IOBufAsZeroCopyInputStreamWithChecksum::IOBufAsZeroCopyInputStreamWithChecksum(
+    const IOBuf& buf)
+    : IOBufAsZeroCopyInputStream(buf)
+    , _whole_buf(&buf)
+    , _pending_data(NULL)
+    , _pending_size(0)
+    , _crc_dirty(false)
+    , _crc(0) {
+}
+
+void IOBufAsZeroCopyInputStreamWithChecksum::_accumulate_pending() {
+    if (_pending_size > 0) {
+        _crc = butil::crc32c::Extend(
+            _crc, static_cast<const char*>(_pending_data), _pending_size);
+    }
+    _pending_data = NULL;
+    _pending_size = 0;
+}
+
+bool IOBufAsZeroCopyInputStreamWithChecksum::Next(
+    const void** data, int* size) {
+    _accumulate_pending();
+    if (!IOBufAsZeroCopyInputStream::Next(data, size)) {
+        return false;
+    }
+    _pending_data = *data;
+    _pending_size = *size;
+    return true;
+}
+
+void IOBufAsZeroCopyInputStreamWithChecksum::BackUp(int count) {
+    if (count <= _pending_size) {
+        // Backed-up bytes were not accumulated yet, just shrink the
+        // pending region; they are re-accumulated when handed out again.
+        _pending_size -= count;
+    } else {
+        _pending_data = NULL;
+        _pending_size = 0;
+        _crc_dirty = true;
+    }
+    IOBufAsZeroCopyInputStream::BackUp(count);
+}
+
+bool IOBufAsZeroCopyInputStreamWithChecksum::Skip(int count) {
+    // Skipped bytes never pass through Next() but still belong to the
+    // checksum, recompute from scratch at the end.
+    _accumulate_pending();
+    _crc_dirty = true;
+    return IOBufAsZeroCopyInputStream::Skip(count);
+}
+
+uint32_t IOBufAsZeroCopyInputStreamWithChecksum::checksum() {
+    if (_crc_dirty) {
+        _crc = crc32c_of_iobuf(*_whole_buf);
+        _crc_dirty = false;
+        _pending_data = NULL;
+        _pending_size = 0;
+        return _crc;
+    }
+    _accumulate_pending();
+    // Drain whatever the parser did not consume so that the result always
+    // covers the whole IOBuf.
+    const void* data = NULL;
+    int size = 0;
+    while (IOBufAsZeroCopyInputStream::Next(&data, &size)) {
+        _crc = butil::crc32c::Extend(
+            _crc, static_cast<const char*>(data), size);
+    }
+    return _crc;
+}
+
+IOBufAsZeroCopyOutputStreamWithChecksum::
+IOBufAsZeroCopyOutputStreamWithChecksum(IOBuf* buf)
+    : IOBufAsZeroCopyOutputStream(buf)
+    , _whole_buf(buf)
+    , _pending_data(NULL)
+    , _pending_size(0)
+    , _crc_dirty(false)
+    , _crc(0) {
+}
+
+IOBufAsZeroCopyOutputStreamWithChecksum::
+IOBufAsZeroCopyOutputStreamWithChecksum(IOBuf* buf, uint32_t block_size)
+    : IOBufAsZeroCopyOutputStream(buf, block_size)
+    , _whole_buf(buf)
+    , _pending_data(NULL)
+    , _pending_size(0)
+    , _crc_dirty(false)
+    , _crc(0) {
+}
+
+void IOBufAsZeroCopyOutputStreamWithChecksum::_accumulate_pending() {
+    if (_pending_size > 0) {
+        _crc = butil::crc32c::Extend(
+            _crc, static_cast<const char*>(_pending_data), _pending_size);
+    }
+    _pending_data = NULL;
+    _pending_size = 0;
+}
+
+bool IOBufAsZeroCopyOutputStreamWithChecksum::Next(void** data, int* size) {
+    // The previous block is complete once the serializer asks for the
+    // next one, accumulate it while it is still warm in cache.
+    _accumulate_pending();
+    if (!IOBufAsZeroCopyOutputStream::Next(data, size)) {
+        return false;
+    }
+    _pending_data = *data;
+    _pending_size = *size;
+    return true;
+}
+
+void IOBufAsZeroCopyOutputStreamWithChecksum::BackUp(int count) {
+    if (count <= _pending_size) {
+        _pending_size -= count;
+    } else {
+        // The extended multi-block BackUp removes bytes that were already
+        // accumulated; CRC cannot be subtracted, recompute at the end.
+        _pending_data = NULL;
+        _pending_size = 0;
+        _crc_dirty = true;
+    }
+    IOBufAsZeroCopyOutputStream::BackUp(count);
+}
+
+uint32_t IOBufAsZeroCopyOutputStreamWithChecksum::checksum() {
+    if (_crc_dirty) {
+        _crc = crc32c_of_iobuf(*_whole_buf);
+        _crc_dirty = false;
+        _pending_data = NULL;
+        _pending_size = 0;
+        return _crc;
+    }
+    _accumulate_pending();
+    return _crc;
+}
+
 IOBufAsSnappySink::IOBufAsSnappySink(butil::IOBuf& buf)
     : _cur_buf(NULL), _cur_len(0), _buf(&buf), _buf_stream(&buf) {
 }
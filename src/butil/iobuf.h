@@ -353,6 +353,33 @@ public:
     static size_t new_bigview_count();
     static size_t block_count_hit_tls_threshold();
 
+    // Attribution of block allocations. Blocks are stamped at creation
+    // with the site set in the calling thread(see ScopedBlockAllocSite
+    // below); blocks created outside any scope count as UNKNOWN, which in
+    // practice means direct appends from user code. Framework stamps
+    // SOCKET_INGRESS around reading sockets and SERIALIZATION inside
+    // IOBufAsZeroCopyOutputStream(the protobuf serializing path); apps
+    // may stamp USER around their own buffer-building regions.
+    enum BlockAllocSite {
+        BLOCK_SITE_UNKNOWN = 0,
+        BLOCK_SITE_SOCKET_INGRESS = 1,
+        BLOCK_SITE_SERIALIZATION = 2,
+        BLOCK_SITE_USER = 3,
+        BLOCK_SITE_NUM = 4
+    };
+    struct BlockSiteStat {
+        // Live blocks stamped with the site and their memory.
+        size_t nblock;
+        size_t memory;
+        // Died blocks bucketed by lifetime:
+        // <1ms, <10ms, <100ms, <1s, <10s, >=10s.
+        static const size_t NLIFETIME_BUCKET = 6;
+        size_t lifetime_buckets[NLIFETIME_BUCKET];
+    };
+    static const char* block_alloc_site_name(int site);
+    // Fill `stat' of `site', zeroed when site is out of range.
+    static void get_block_site_stat(int site, BlockSiteStat* stat);
+
     // Equal with a string/IOBuf or not.
     bool equals(const butil::StringPiece&) const;
     bool equals(const IOBuf& other) const;
@@ -430,6 +457,28 @@ private:
 
 std::ostream& operator<<(std::ostream&, const IOBuf& buf);
 
+namespace iobuf {
+// Site stamped into blocks created by the calling thread, see
+// IOBuf::BlockAllocSite.
+int get_tls_alloc_site();
+void set_tls_alloc_site(int site);
+}  // namespace iobuf
+
+// Stamp blocks created by this thread within the scope with `site'.
+class ScopedBlockAllocSite {
+public:
+    explicit ScopedBlockAllocSite(IOBuf::BlockAllocSite site)
+        : _saved(iobuf::get_tls_alloc_site()) {
+        iobuf::set_tls_alloc_site(site);
+    }
+    ~ScopedBlockAllocSite() {
+        iobuf::set_tls_alloc_site(_saved);
+    }
+private:
+    DISALLOW_COPY_AND_ASSIGN(ScopedBlockAllocSite);
+    int _saved;
+};
+
 inline bool operator==(const butil::IOBuf& b, const butil::StringPiece& s)
 { return b.equals(s); }
 inline bool operator==(const butil::StringPiece& s, const butil::IOBuf& b)
@@ -571,6 +620,37 @@ private:
     const IOBuf* _buf;
 };
 
+// Same as IOBufAsZeroCopyInputStream but accumulates the CRC32C of the
+// wrapped IOBuf while the parser walks it, so that checksum verification
+// does not need a second pass over the data. checksum() finishes the
+// accumulation (draining whatever the parser did not consume, so it always
+// covers every byte of the IOBuf) and must only be called after parsing --
+// the stream position is unusable afterwards.
+class IOBufAsZeroCopyInputStreamWithChecksum
+    : public IOBufAsZeroCopyInputStream {
+public:
+    explicit IOBufAsZeroCopyInputStreamWithChecksum(const IOBuf&);
+
+    bool Next(const void** data, int* size) override;
+    void BackUp(int count) override;
+    bool Skip(int count) override;
+
+    // CRC32C of the whole wrapped IOBuf.
+    uint32_t checksum();
+
+private:
+    void _accumulate_pending();
+
+    const IOBuf* _whole_buf;
+    const void* _pending_data;
+    int _pending_size;
+    // Set when bytes were skipped or backed up beyond the last block
+    // handed out; checksum() recomputes from scratch then, which is no
+    // worse than the separate verification pass this class replaces.
+    bool _crc_dirty;
+    uint32_t _crc;
+};
+
 // Serialize protobuf message into IOBuf. This wrapper does not clear source
 // IOBuf before appending. You can change the source IOBuf when stream is 
 // not used(append sth. to the IOBuf, serialize a protobuf message, append 
@@ -604,6 +684,35 @@ private:
     google::protobuf::int64 _byte_count;
 };
 
+// Same as IOBufAsZeroCopyOutputStream but accumulates the CRC32C of the
+// bytes written through it while the serializer fills blocks, saving the
+// separate checksum pass over the buffer afterwards. The wrapped IOBuf
+// must be appended through this stream only. Call checksum() after
+// serialization finished.
+class IOBufAsZeroCopyOutputStreamWithChecksum
+    : public IOBufAsZeroCopyOutputStream {
+public:
+    explicit IOBufAsZeroCopyOutputStreamWithChecksum(IOBuf*);
+    IOBufAsZeroCopyOutputStreamWithChecksum(IOBuf*, uint32_t block_size);
+
+    bool Next(void** data, int* size) override;
+    void BackUp(int count) override;
+
+    // CRC32C of everything written through this stream so far.
+    uint32_t checksum();
+
+private:
+    void _accumulate_pending();
+
+    IOBuf* _whole_buf;
+    void* _pending_data;
+    int _pending_size;
+    // Set by the extended multi-block BackUp which cannot be subtracted
+    // from a running CRC; checksum() recomputes from scratch then.
+    bool _crc_dirty;
+    uint32_t _crc;
+};
+
 // Wrap IOBuf into input of snappy compression.
 class IOBufAsSnappySource : public butil::snappy::Source {
 public:
@@ -24,9 +24,12 @@
 
 #include <iostream>                       // std::ostream
 #include <pthread.h>                      // pthread_mutex_t
+#include <sched.h>                        // sched_getcpu
+#include <unistd.h>                       // sysconf
 #include <algorithm>                      // std::max, std::min
 #include <vector>
 #include "butil/atomicops.h"              // butil::atomic
+#include "butil/build_config.h"           // OS_LINUX
 #include "butil/macros.h"                 // BAIDU_CACHELINE_ALIGNMENT
 #include "butil/scoped_lock.h"            // BAIDU_SCOPED_LOCK
 #include "butil/thread_local.h"           // BAIDU_THREAD_LOCAL
@@ -64,6 +67,8 @@ struct ObjectPoolInfo {
     size_t item_num;
     size_t block_item_num;
     size_t free_chunk_item_num;
+    size_t free_chunk_sharded_num;
+    size_t free_chunk_overflow_num;
     size_t total_size;
 #ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
     size_t free_item_num;
@@ -74,6 +79,11 @@ static const size_t OP_MAX_BLOCK_NGROUP = 65536;
 static const size_t OP_GROUP_NBLOCK_NBIT = 16;
 static const size_t OP_GROUP_NBLOCK = (1UL << OP_GROUP_NBLOCK_NBIT);
 static const size_t OP_INITIAL_FREE_LIST_SIZE = 1024;
+// Free chunks are sharded by the core that pushes them; one shard holds at
+// most OP_SHARD_MAX_NCHUNK chunks, the excess overflows into the mutex
+// guarded global vector.
+static const size_t OP_MAX_FREE_CHUNK_NSHARD = 64;
+static const size_t OP_SHARD_MAX_NCHUNK = 16;
 
 template <typename T>
 class ObjectPoolBlockItemNum {
@@ -114,9 +124,26 @@ public:
     static const size_t FREE_CHUNK_NITEM = BLOCK_NITEM;
 
     // Free objects are batched in a FreeChunk before they're added to
-    // global list(_free_chunks).
+    // the sharded tier or the global list(_free_chunks).
     typedef ObjectPoolFreeChunk<T, FREE_CHUNK_NITEM>    FreeChunk;
-    typedef ObjectPoolFreeChunk<T, 0> DynamicFreeChunk;
+    // Dynamically allocated counterpart of FreeChunk. `next' chains the
+    // chunk into the lock-free stack of a FreeChunkShard and is unused
+    // while the chunk sits in _free_chunks.
+    struct DynamicFreeChunk {
+        DynamicFreeChunk* next;
+        size_t nfree;
+        T* ptrs[0];
+    };
+
+    // A lock-free (Treiber) stack of free chunks. Chunks are pushed to
+    // the shard of the core they're freed on, so threads that only free
+    // objects and threads that only allocate them no longer serialize
+    // on _free_chunks_mutex.
+    struct BAIDU_CACHELINE_ALIGNMENT FreeChunkShard {
+        butil::atomic<DynamicFreeChunk*> head;
+        // Approximate, only used to bound the length of the stack.
+        butil::atomic<size_t> nchunk;
+    };
 #ifdef BUTIL_USE_ASAN
     // According to https://github.com/google/sanitizers/wiki/AddressSanitizerManualPoisoning ,
     // The allocated chunks should start with 8-aligned addresses,
@@ -315,6 +342,13 @@ public:
         info.item_num = 0;
         info.free_chunk_item_num = free_chunk_nitem();
         info.block_item_num = BLOCK_NITEM;
+        // Both are approximate, for monitoring only.
+        info.free_chunk_sharded_num = 0;
+        for (size_t i = 0; i < free_chunk_nshard(); ++i) {
+            info.free_chunk_sharded_num +=
+                _shards[i].nchunk.load(butil::memory_order_relaxed);
+        }
+        info.free_chunk_overflow_num = _free_chunks.size();
 #ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
         info.free_item_num = _global_nfree.load(butil::memory_order_relaxed);
 #endif
@@ -355,6 +389,10 @@ public:
 
 private:
     ObjectPool() {
+        for (size_t i = 0; i < OP_MAX_FREE_CHUNK_NSHARD; ++i) {
+            _shards[i].head.store(NULL, butil::memory_order_relaxed);
+            _shards[i].nchunk.store(0, butil::memory_order_relaxed);
+        }
         _free_chunks.reserve(OP_INITIAL_FREE_LIST_SIZE);
         pthread_mutex_init(&_free_chunks_mutex, NULL);
     }
@@ -487,20 +525,89 @@ private:
     }
 
 private:
-    bool pop_free_chunk(FreeChunk& c) {
-        // Critical for the case that most return_object are called in
-        // different threads of get_object.
-        if (_free_chunks.empty()) {
-            return false;
+    // Number of shards actually in use, the core count rounded up to a
+    // power of two so the index is a simple mask.
+    static size_t free_chunk_nshard() {
+        static const size_t nshard = compute_free_chunk_nshard();
+        return nshard;
+    }
+
+    static size_t compute_free_chunk_nshard() {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu <= 0) {
+            ncpu = 1;
         }
-        pthread_mutex_lock(&_free_chunks_mutex);
-        if (_free_chunks.empty()) {
+        size_t n = 1;
+        while (n < (size_t)ncpu && n < OP_MAX_FREE_CHUNK_NSHARD) {
+            n <<= 1;
+        }
+        return n;
+    }
+
+    static size_t current_shard_index() {
+#if defined(OS_LINUX)
+        const int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return (size_t)cpu & (free_chunk_nshard() - 1);
+        }
+#endif
+        return ((size_t)pthread_self() >> 5) & (free_chunk_nshard() - 1);
+    }
+
+    // Pop one chunk from `s'. The whole stack is taken in one exchange,
+    // which avoids the ABA problem of popping a single node, and the
+    // rest is prepended back with one CAS; the walk to its tail is
+    // bounded by OP_SHARD_MAX_NCHUNK.
+    DynamicFreeChunk* pop_from_shard(FreeChunkShard& s) {
+        if (NULL == s.head.load(butil::memory_order_relaxed)) {
+            return NULL;
+        }
+        DynamicFreeChunk* p = s.head.exchange(NULL, butil::memory_order_acquire);
+        if (NULL == p) {
+            return NULL;
+        }
+        DynamicFreeChunk* rest = p->next;
+        if (rest) {
+            DynamicFreeChunk* tail = rest;
+            while (tail->next) {
+                tail = tail->next;
+            }
+            DynamicFreeChunk* head = s.head.load(butil::memory_order_relaxed);
+            do {
+                tail->next = head;
+            } while (!s.head.compare_exchange_weak(
+                         head, rest, butil::memory_order_release,
+                         butil::memory_order_relaxed));
+        }
+        s.nchunk.fetch_sub(1, butil::memory_order_relaxed);
+        return p;
+    }
+
+    bool pop_free_chunk(FreeChunk& c) {
+        const size_t nshard = free_chunk_nshard();
+        const size_t index = current_shard_index();
+        DynamicFreeChunk* p = pop_from_shard(_shards[index]);
+        if (NULL == p && !_free_chunks.empty()) {
+            // The local shard is empty, check the global overflow.
+            // Critical for the case that most return_object are called in
+            // different threads of get_object.
+            pthread_mutex_lock(&_free_chunks_mutex);
+            if (!_free_chunks.empty()) {
+                p = _free_chunks.back();
+                _free_chunks.pop_back();
+            }
             pthread_mutex_unlock(&_free_chunks_mutex);
-            return false;
         }
-        DynamicFreeChunk* p = _free_chunks.back();
-        _free_chunks.pop_back();
-        pthread_mutex_unlock(&_free_chunks_mutex);
+        if (NULL == p) {
+            // Steal from other shards before falling back to allocating
+            // a new block.
+            for (size_t i = 1; i < nshard && NULL == p; ++i) {
+                p = pop_from_shard(_shards[(index + i) & (nshard - 1)]);
+            }
+            if (NULL == p) {
+                return false;
+            }
+        }
         c.nfree = p->nfree;
         memcpy(c.ptrs, p->ptrs, sizeof(*p->ptrs) * p->nfree);
         free(p);
@@ -515,12 +622,25 @@ private:
         }
         p->nfree = c.nfree;
         memcpy(p->ptrs, c.ptrs, sizeof(*c.ptrs) * c.nfree);
+        FreeChunkShard& s = _shards[current_shard_index()];
+        if (s.nchunk.load(butil::memory_order_relaxed) < OP_SHARD_MAX_NCHUNK) {
+            DynamicFreeChunk* head = s.head.load(butil::memory_order_relaxed);
+            do {
+                p->next = head;
+            } while (!s.head.compare_exchange_weak(
+                         head, p, butil::memory_order_release,
+                         butil::memory_order_relaxed));
+            s.nchunk.fetch_add(1, butil::memory_order_relaxed);
+            return true;
+        }
+        // The shard is full, overflow into the global vector.
+        p->next = NULL;
         pthread_mutex_lock(&_free_chunks_mutex);
         _free_chunks.push_back(p);
         pthread_mutex_unlock(&_free_chunks_mutex);
         return true;
     }
-    
+
     static butil::static_atomic<ObjectPool*> _singleton;
     static pthread_mutex_t _singleton_mutex;
     static BAIDU_THREAD_LOCAL LocalPool* _local_pool;
@@ -530,6 +650,7 @@ private:
     static pthread_mutex_t _change_thread_mutex;
     static butil::static_atomic<BlockGroup*> _block_groups[OP_MAX_BLOCK_NGROUP];
 
+    FreeChunkShard _shards[OP_MAX_FREE_CHUNK_NSHARD];
     std::vector<DynamicFreeChunk*> _free_chunks;
     pthread_mutex_t _free_chunks_mutex;
 
@@ -582,6 +703,8 @@ inline std::ostream& operator<<(std::ostream& os,
               << "\nitem_num: " << info.item_num
               << "\nblock_item_num: " << info.block_item_num
               << "\nfree_chunk_item_num: " << info.free_chunk_item_num
+              << "\nfree_chunk_sharded_num: " << info.free_chunk_sharded_num
+              << "\nfree_chunk_overflow_num: " << info.free_chunk_overflow_num
               << "\ntotal_size: " << info.total_size
 #ifdef BUTIL_OBJECT_POOL_NEED_FREE_ITEM_NUM
               << "\nfree_num: " << info.free_item_num
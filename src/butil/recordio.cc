@@ -15,6 +15,10 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <gflags/gflags.h>
 #include "butil/logging.h"
 #include "butil/recordio.h"
@@ -300,8 +304,214 @@ int RecordReader::CutRecord(Record* rec) {
     return 1;
 }
 
+const StringPiece* MemoryMappedRecordReader::RecordView::Meta(
+    const StringPiece& name) const {
+    for (size_t i = 0; i < metas.size(); ++i) {
+        if (metas[i].name == name) {
+            return &metas[i].data;
+        }
+    }
+    return NULL;
+}
+
+MemoryMappedRecordReader::MemoryMappedRecordReader()
+    : _data(NULL)
+    , _size(0)
+    , _offset(0)
+    , _last_error(0) {
+}
+
+MemoryMappedRecordReader::~MemoryMappedRecordReader() {
+    Close();
+}
+
+int MemoryMappedRecordReader::Open(const char* path) {
+    if (_data != NULL) {
+        LOG(ERROR) << "Already opened a file";
+        return -1;
+    }
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << path;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        PLOG(ERROR) << "Fail to fstat " << path;
+        close(fd);
+        return -1;
+    }
+    _size = st.st_size;
+    _offset = 0;
+    _last_error = 0;
+    if (_size == 0) {
+        // Nothing to map, ReadNext() will just report END_OF_READER.
+        close(fd);
+        return 0;
+    }
+    void* m = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == m) {
+        PLOG(ERROR) << "Fail to mmap " << path;
+        _size = 0;
+        return -1;
+    }
+    // Double the kernel read-ahead and free pages soon after access.
+    if (madvise(m, _size, MADV_SEQUENTIAL) != 0) {
+        PLOG(WARNING) << "Fail to madvise " << path;
+    }
+    _data = (const char*)m;
+    return 0;
+}
+
+void MemoryMappedRecordReader::Close() {
+    if (_data != NULL) {
+        munmap((void*)_data, _size);
+        _data = NULL;
+    }
+    _size = 0;
+    _offset = 0;
+    _last_error = 0;
+}
+
+bool MemoryMappedRecordReader::ReadNext(RecordView* out) {
+    do {
+        size_t consumed = 0;
+        const int rc = ParseRecord(out, &consumed);
+        if (rc > 0) {
+            _offset += consumed;
+            _last_error = 0;
+            return true;
+        } else if (rc == 0) {
+            // An incomplete record at the end is run-out data, same as
+            // RecordReader on a drained IReader.
+            _last_error = END_OF_READER;
+            return false;
+        } else if (!FindNextRecordCandidate()) {
+            _last_error = END_OF_READER;
+            return false;
+        }
+    } while (true);
+}
+
+static uint32_t LoadNet32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return NetToHost32(v);
+}
+
+bool MemoryMappedRecordReader::FindNextRecordCandidate() {
+    const size_t old_offset = _offset;
+    // Skip beginning magic
+    if (_size - _offset >= 4 &&
+        memcmp(_data + _offset, BRPC_RECORDIO_MAGIC, 4) == 0) {
+        _offset += 4;
+    }
+    while (_size - _offset >= 4) {
+        const char* found = (const char*)memchr(
+            _data + _offset, BRPC_RECORDIO_MAGIC[0], _size - _offset - 3);
+        if (NULL == found) {
+            _offset = _size - 3;
+            return false;
+        }
+        _offset = found - _data;
+        if (memcmp(found, BRPC_RECORDIO_MAGIC, 4) == 0) {
+            LOG(INFO) << "Found record candidate after "
+                      << _offset - old_offset << " bytes";
+            return true;
+        }
+        ++_offset;
+    }
+    return false;
+}
+
+int MemoryMappedRecordReader::ParseRecord(RecordView* rec, size_t* consumed) {
+    const size_t avail = _size - _offset;
+    if (avail < 9) {
+        return 0;
+    }
+    const char* p = _data + _offset;
+    if (memcmp(p, BRPC_RECORDIO_MAGIC, 4) != 0) {
+        LOG(ERROR) << "Invalid magic_num="
+                   << butil::PrintedAsBinary(std::string(p, 4))
+                   << ", offset=" << offset();
+        return -1;
+    }
+    uint32_t tmp = LoadNet32(p + 4);
+    const uint8_t checksum = SizeChecksum(tmp);
+    bool has_meta = (tmp & 0x80000000);
+    const size_t data_size = (tmp & 0x7FFFFFFF);
+    if (checksum != (uint8_t)p[8]) {
+        LOG(ERROR) << "Unmatched checksum of 0x"
+                   << std::hex << tmp << std::dec
+                   << "(metabit=" << has_meta
+                   << " size=" << data_size
+                   << " offset=" << offset()
+                   << "), expected=" << (unsigned)(uint8_t)p[8]
+                   << " actual=" << (unsigned)checksum;
+        return -1;
+    }
+    if (data_size > (size_t)FLAGS_recordio_max_record_size) {
+        LOG(ERROR) << "data_size=" << data_size
+                   << " is larger than -recordio_max_record_size="
+                   << FLAGS_recordio_max_record_size
+                   << ", offset=" << offset();
+        return -1;
+    }
+    if (avail < data_size + 9) {
+        return 0;
+    }
+    rec->payload = StringPiece();
+    rec->metas.clear();
+    const char* q = p + 9;
+    size_t consumed_bytes = 0;
+    while (has_meta) {
+        if (consumed_bytes + 5 > data_size) {
+            LOG(ERROR) << "Truncated meta head at data offset="
+                       << consumed_bytes << ", offset=" << offset();
+            return -1;
+        }
+        const size_t name_size = (uint8_t)q[0];
+        if (consumed_bytes + 5 + name_size > data_size) {
+            LOG(ERROR) << "Truncated meta name at data offset="
+                       << consumed_bytes << ", offset=" << offset();
+            return -1;
+        }
+        const StringPiece name(q + 1, name_size);
+        tmp = LoadNet32(q + 1 + name_size);
+        has_meta = (tmp & 0x80000000);
+        const size_t meta_size = (tmp & 0x7FFFFFFF);
+        if (consumed_bytes + 5 + name_size + meta_size > data_size) {
+            LOG(ERROR) << name << ".meta_size=" << meta_size
+                       << " is inconsistent with its data_size=" << data_size
+                       << ", offset=" << offset();
+            return -1;
+        }
+        if (rec->Meta(name) != NULL) {
+            LOG(ERROR) << "Fail to add meta=" << name
+                       << ", offset=" << offset();
+            return -1;
+        }
+        MetaView m;
+        m.name = name;
+        m.data = StringPiece(q + 5 + name_size, meta_size);
+        rec->metas.push_back(m);
+        q += 5 + name_size + meta_size;
+        consumed_bytes += 5 + name_size + meta_size;
+    }
+    rec->payload = StringPiece(q, data_size - consumed_bytes);
+    *consumed = 9 + data_size;
+    return 1;
+}
+
 RecordWriter::RecordWriter(IWriter* writer)
-    :_writer(writer) {
+    : _writer(writer)
+    , _flush_threshold(0) {
+}
+
+RecordWriter::RecordWriter(IWriter* writer, size_t flush_threshold)
+    : _writer(writer)
+    , _flush_threshold(flush_threshold) {
 }
 
 int RecordWriter::WriteWithoutFlush(const Record& rec) {
@@ -381,6 +591,9 @@ int RecordWriter::Write(const Record& record) {
     if (rc) {
         return rc;
     }
+    if (_buf.size() < _flush_threshold) {
+        return 0;
+    }
     return Flush();
 }
 
@@ -118,11 +118,87 @@ private:
     int _last_error;
 };
 
+// Parse records from a memory-mapped file without copying record bytes.
+// The mapping is advised as MADV_SEQUENTIAL so the kernel reads ahead
+// aggressively; replaying large dumps is I/O-bound rather than spending
+// CPU on per-record buffer management.
+// Returned views point into the mapping and stay valid until Close() or
+// destruction of the reader. Corrupted records are skipped, same as
+// RecordReader.
+// Example:
+//    MemoryMappedRecordReader rd;
+//    if (rd.Open(path) != 0) { ... }
+//    MemoryMappedRecordReader::RecordView rec;
+//    while (rd.ReadNext(&rec)) {
+//        // Handle the rec
+//    }
+//    if (rd.last_error() != RecordReader::END_OF_READER) {
+//        LOG(FATAL) << "Critical error occurred";
+//    }
+class MemoryMappedRecordReader {
+public:
+    // Same meaning as RecordReader::END_OF_READER.
+    static const int END_OF_READER = RecordReader::END_OF_READER;
+
+    struct MetaView {
+        StringPiece name;
+        StringPiece data;
+    };
+
+    // A parsed record whose payload and metas reference the mapped file.
+    struct RecordView {
+        size_t MetaCount() const { return metas.size(); }
+        const MetaView& MetaAt(size_t i) const { return metas[i]; }
+        // Get meta by |name|. NULL on not found.
+        const StringPiece* Meta(const StringPiece& name) const;
+
+        StringPiece payload;
+        std::vector<MetaView> metas;
+    };
+
+    MemoryMappedRecordReader();
+    ~MemoryMappedRecordReader();
+
+    // Map the whole file at |path| readonly.
+    // Returns 0 on success, -1 otherwise.
+    int Open(const char* path);
+
+    // Returns true on success and |out| references the next record.
+    // False otherwise and last_error() is the error.
+    bool ReadNext(RecordView* out);
+
+    // 0 means no error.
+    // END_OF_READER means all records are successfully consumed.
+    int last_error() const { return _last_error; }
+
+    // Offset of the first unconsumed byte in the file.
+    size_t offset() const { return _offset; }
+
+    // Unmap the file. Views obtained from ReadNext() become invalid.
+    void Close();
+
+private:
+    bool FindNextRecordCandidate();
+    int ParseRecord(RecordView* rec, size_t* consumed);
+
+private:
+    const char* _data;
+    size_t _size;
+    size_t _offset;
+    int _last_error;
+};
+
 // Write records into the IWriter.
 class RecordWriter {
 public:
     explicit RecordWriter(IWriter* writer);
 
+    // When |flush_threshold| is positive, Write() only flushes after at
+    // least that many serialized bytes have been buffered, so many small
+    // records are framed in memory and handed to the IWriter as a few
+    // large writes. Call Flush() after the last record.
+    RecordWriter(IWriter* writer, size_t flush_threshold);
+
     // Serialize |record| into internal buffer and NOT flush into the IWriter.
     int WriteWithoutFlush(const Record& record);
 
@@ -136,6 +212,7 @@ public:
 private:
     IOBuf _buf;
     IWriter* _writer;
+    size_t _flush_threshold;
 };
 
 } // namespace butil
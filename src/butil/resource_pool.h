@@ -76,6 +76,15 @@ template <typename T> struct ResourcePoolFreeChunkMaxItem {
     static size_t value() { return 256; }
 };
 
+// Set value to true to let each thread cache a spare free chunk besides
+// the one being filled/drained, doubling the amount of locally cached
+// objects and halving trips to the global free list. Useful for hot types
+// that are mostly allocated in some threads and freed in others(e.g.
+// bthread's TaskMeta under heavy fan-outs).
+template <typename T> struct ResourcePoolSpareFreeChunk {
+    static const bool value = false;
+};
+
 // ResourcePool calls this function on newly constructed objects. If this
 // function returns false, the object is destructed immediately and
 // get_resource() shall return NULL. This is useful when the constructor
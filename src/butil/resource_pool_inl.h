@@ -24,8 +24,11 @@
 
 #include <iostream>                      // std::ostream
 #include <pthread.h>                     // pthread_mutex_t
+#include <sched.h>                       // sched_getcpu
+#include <unistd.h>                      // sysconf
 #include <algorithm>                     // std::max, std::min
 #include "butil/atomicops.h"             // butil::atomic
+#include "butil/build_config.h"          // OS_LINUX
 #include "butil/macros.h"                // BAIDU_CACHELINE_ALIGNMENT
 #include "butil/scoped_lock.h"           // BAIDU_SCOPED_LOCK
 #include "butil/thread_local.h"          // thread_atexit
@@ -78,6 +81,8 @@ struct ResourcePoolInfo {
     size_t item_num;
     size_t block_item_num;
     size_t free_chunk_item_num;
+    size_t free_chunk_sharded_num;
+    size_t free_chunk_overflow_num;
     size_t total_size;
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
     size_t free_item_num;
@@ -88,6 +93,11 @@ static const size_t RP_MAX_BLOCK_NGROUP = 65536;
 static const size_t RP_GROUP_NBLOCK_NBIT = 16;
 static const size_t RP_GROUP_NBLOCK = (1UL << RP_GROUP_NBLOCK_NBIT);
 static const size_t RP_INITIAL_FREE_LIST_SIZE = 1024;
+// Free chunks are sharded by the core that pushes them; one shard holds at
+// most RP_SHARD_MAX_NCHUNK chunks, the excess overflows into the mutex
+// guarded global vector.
+static const size_t RP_MAX_FREE_CHUNK_NSHARD = 64;
+static const size_t RP_SHARD_MAX_NCHUNK = 16;
 
 template <typename T>
 class ResourcePoolBlockItemNum {
@@ -106,9 +116,26 @@ public:
     static const size_t FREE_CHUNK_NITEM = BLOCK_NITEM;
 
     // Free identifiers are batched in a FreeChunk before they're added to
-    // global list(_free_chunks).
+    // the sharded tier or the global list(_free_chunks).
     typedef ResourcePoolFreeChunk<T, FREE_CHUNK_NITEM>      FreeChunk;
-    typedef ResourcePoolFreeChunk<T, 0> DynamicFreeChunk;
+    // Dynamically allocated counterpart of FreeChunk. `next' chains the
+    // chunk into the lock-free stack of a FreeChunkShard and is unused
+    // while the chunk sits in _free_chunks.
+    struct DynamicFreeChunk {
+        DynamicFreeChunk* next;
+        size_t nfree;
+        ResourceId<T> ids[0];
+    };
+
+    // A lock-free (Treiber) stack of free chunks. Chunks are pushed to
+    // the shard of the core they're freed on, so threads that only free
+    // resources and threads that only allocate them no longer serialize
+    // on _free_chunks_mutex.
+    struct BAIDU_CACHELINE_ALIGNMENT FreeChunkShard {
+        butil::atomic<DynamicFreeChunk*> head;
+        // Approximate, only used to bound the length of the stack.
+        butil::atomic<size_t> nchunk;
+    };
 
     typedef AlignedMemory<sizeof(T), __alignof__(T)> BlockItem;
     // When a thread needs memory, it allocates a Block. To improve locality,
@@ -145,6 +172,7 @@ public:
             , _cur_block(NULL)
             , _cur_block_index(0) {
             _cur_free.nfree = 0;
+            _spare_free.nfree = 0;
         }
 
         ~LocalPool() {
@@ -152,6 +180,9 @@ public:
             if (_cur_free.nfree) {
                 _pool->push_free_chunk(_cur_free);
             }
+            if (ResourcePoolSpareFreeChunk<T>::value && _spare_free.nfree) {
+                _pool->push_free_chunk(_spare_free);
+            }
 
             _pool->clear_from_destructor_of_local_pool();
         }
@@ -172,10 +203,20 @@ public:
             BAIDU_RESOURCE_POOL_FREE_ITEM_NUM_SUB1;                         \
             return unsafe_address_resource(free_id);                        \
         }                                                                   \
-        /* Fetch a FreeChunk from global.                                   \
+        /* Fetch from the spare chunk(see ResourcePoolSpareFreeChunk) */    \
+        if (ResourcePoolSpareFreeChunk<T>::value && _spare_free.nfree) {    \
+            const ResourceId<T> free_id =                                   \
+                _spare_free.ids[--_spare_free.nfree];                       \
+            *id = free_id;                                                  \
+            BAIDU_RESOURCE_POOL_FREE_ITEM_NUM_SUB1;                         \
+            return unsafe_address_resource(free_id);                        \
+        }                                                                   \
+        /* Fetch FreeChunk(s) from global.                                  \
            TODO: Popping from _free needs to copy a FreeChunk which is      \
            costly, but hardly impacts amortized performance. */             \
-        if (_pool->pop_free_chunk(_cur_free)) {                             \
+        if (ResourcePoolSpareFreeChunk<T>::value                            \
+            ? _pool->pop_free_chunk(_cur_free, _spare_free)                 \
+            : _pool->pop_free_chunk(_cur_free)) {                           \
             --_cur_free.nfree;                                              \
             const ResourceId<T> free_id =  _cur_free.ids[_cur_free.nfree];  \
             *id = free_id;                                                  \
@@ -229,6 +270,14 @@ public:
                 BAIDU_RESOURCE_POOL_FREE_ITEM_NUM_ADD1;
                 return 0;
             }
+            // Overflow into the spare chunk, delaying the global push
+            // until both chunks are full.
+            if (ResourcePoolSpareFreeChunk<T>::value &&
+                _spare_free.nfree < ResourcePool::free_chunk_nitem()) {
+                _spare_free.ids[_spare_free.nfree++] = id;
+                BAIDU_RESOURCE_POOL_FREE_ITEM_NUM_ADD1;
+                return 0;
+            }
             // Local free list is full, return it to global.
             // For copying issue, check comment in upper get()
             if (_pool->push_free_chunk(_cur_free)) {
@@ -245,6 +294,8 @@ public:
         Block* _cur_block;
         size_t _cur_block_index;
         FreeChunk _cur_free;
+        // Unused unless ResourcePoolSpareFreeChunk<T>::value is true.
+        FreeChunk _spare_free;
     };
 
     static inline T* unsafe_address_resource(ResourceId<T> id) {
@@ -317,6 +368,13 @@ public:
         info.item_num = 0;
         info.free_chunk_item_num = free_chunk_nitem();
         info.block_item_num = BLOCK_NITEM;
+        // Both are approximate, for monitoring only.
+        info.free_chunk_sharded_num = 0;
+        for (size_t i = 0; i < free_chunk_nshard(); ++i) {
+            info.free_chunk_sharded_num +=
+                _shards[i].nchunk.load(butil::memory_order_relaxed);
+        }
+        info.free_chunk_overflow_num = _free_chunks.size();
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
         info.free_item_num = _global_nfree.load(butil::memory_order_relaxed);
 #endif
@@ -357,6 +415,10 @@ public:
 
 private:
     ResourcePool() {
+        for (size_t i = 0; i < RP_MAX_FREE_CHUNK_NSHARD; ++i) {
+            _shards[i].head.store(NULL, butil::memory_order_relaxed);
+            _shards[i].nchunk.store(0, butil::memory_order_relaxed);
+        }
         _free_chunks.reserve(RP_INITIAL_FREE_LIST_SIZE);
         pthread_mutex_init(&_free_chunks_mutex, NULL);
     }
@@ -488,26 +550,117 @@ private:
     }
 
 private:
-    bool pop_free_chunk(FreeChunk& c) {
-        // Critical for the case that most return_object are called in
-        // different threads of get_object.
-        if (_free_chunks.empty()) {
-            return false;
+    // Number of shards actually in use, the core count rounded up to a
+    // power of two so the index is a simple mask.
+    static size_t free_chunk_nshard() {
+        static const size_t nshard = compute_free_chunk_nshard();
+        return nshard;
+    }
+
+    static size_t compute_free_chunk_nshard() {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu <= 0) {
+            ncpu = 1;
         }
-        pthread_mutex_lock(&_free_chunks_mutex);
-        if (_free_chunks.empty()) {
+        size_t n = 1;
+        while (n < (size_t)ncpu && n < RP_MAX_FREE_CHUNK_NSHARD) {
+            n <<= 1;
+        }
+        return n;
+    }
+
+    static size_t current_shard_index() {
+#if defined(OS_LINUX)
+        const int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return (size_t)cpu & (free_chunk_nshard() - 1);
+        }
+#endif
+        return ((size_t)pthread_self() >> 5) & (free_chunk_nshard() - 1);
+    }
+
+    // Pop one chunk from `s'. The whole stack is taken in one exchange,
+    // which avoids the ABA problem of popping a single node, and the
+    // rest is prepended back with one CAS; the walk to its tail is
+    // bounded by RP_SHARD_MAX_NCHUNK.
+    DynamicFreeChunk* pop_from_shard(FreeChunkShard& s) {
+        if (NULL == s.head.load(butil::memory_order_relaxed)) {
+            return NULL;
+        }
+        DynamicFreeChunk* p = s.head.exchange(NULL, butil::memory_order_acquire);
+        if (NULL == p) {
+            return NULL;
+        }
+        DynamicFreeChunk* rest = p->next;
+        if (rest) {
+            DynamicFreeChunk* tail = rest;
+            while (tail->next) {
+                tail = tail->next;
+            }
+            DynamicFreeChunk* head = s.head.load(butil::memory_order_relaxed);
+            do {
+                tail->next = head;
+            } while (!s.head.compare_exchange_weak(
+                         head, rest, butil::memory_order_release,
+                         butil::memory_order_relaxed));
+        }
+        s.nchunk.fetch_sub(1, butil::memory_order_relaxed);
+        return p;
+    }
+
+    DynamicFreeChunk* pop_dynamic_free_chunk() {
+        const size_t nshard = free_chunk_nshard();
+        const size_t index = current_shard_index();
+        DynamicFreeChunk* p = pop_from_shard(_shards[index]);
+        if (NULL == p && !_free_chunks.empty()) {
+            // The local shard is empty, check the global overflow.
+            // Critical for the case that most return_resource are called
+            // in different threads of get_resource.
+            pthread_mutex_lock(&_free_chunks_mutex);
+            if (!_free_chunks.empty()) {
+                p = _free_chunks.back();
+                _free_chunks.pop_back();
+            }
             pthread_mutex_unlock(&_free_chunks_mutex);
+        }
+        if (NULL == p) {
+            // Steal from other shards before falling back to allocating
+            // a new block.
+            for (size_t i = 1; i < nshard && NULL == p; ++i) {
+                p = pop_from_shard(_shards[(index + i) & (nshard - 1)]);
+            }
+        }
+        return p;
+    }
+
+    bool pop_free_chunk(FreeChunk& c) {
+        DynamicFreeChunk* p = pop_dynamic_free_chunk();
+        if (NULL == p) {
             return false;
         }
-        DynamicFreeChunk* p = _free_chunks.back();
-        _free_chunks.pop_back();
-        pthread_mutex_unlock(&_free_chunks_mutex);
         c.nfree = p->nfree;
         memcpy(c.ids, p->ids, sizeof(*p->ids) * p->nfree);
         free(p);
         return true;
     }
 
+    // Pop up to two FreeChunks, filling `spare'(which must be empty) as
+    // well when the local shard has a second one.
+    bool pop_free_chunk(FreeChunk& c, FreeChunk& spare) {
+        if (!pop_free_chunk(c)) {
+            return false;
+        }
+        // Only look at the local shard for the optional second chunk;
+        // scanning farther is not worth it.
+        DynamicFreeChunk* p2 = pop_from_shard(_shards[current_shard_index()]);
+        if (p2) {
+            spare.nfree = p2->nfree;
+            memcpy(spare.ids, p2->ids, sizeof(*p2->ids) * p2->nfree);
+            free(p2);
+        }
+        return true;
+    }
+
     bool push_free_chunk(const FreeChunk& c) {
         DynamicFreeChunk* p = (DynamicFreeChunk*)malloc(
             offsetof(DynamicFreeChunk, ids) + sizeof(*c.ids) * c.nfree);
@@ -516,12 +669,25 @@ private:
         }
         p->nfree = c.nfree;
         memcpy(p->ids, c.ids, sizeof(*c.ids) * c.nfree);
+        FreeChunkShard& s = _shards[current_shard_index()];
+        if (s.nchunk.load(butil::memory_order_relaxed) < RP_SHARD_MAX_NCHUNK) {
+            DynamicFreeChunk* head = s.head.load(butil::memory_order_relaxed);
+            do {
+                p->next = head;
+            } while (!s.head.compare_exchange_weak(
+                         head, p, butil::memory_order_release,
+                         butil::memory_order_relaxed));
+            s.nchunk.fetch_add(1, butil::memory_order_relaxed);
+            return true;
+        }
+        // The shard is full, overflow into the global vector.
+        p->next = NULL;
         pthread_mutex_lock(&_free_chunks_mutex);
         _free_chunks.push_back(p);
         pthread_mutex_unlock(&_free_chunks_mutex);
         return true;
     }
-    
+
     static butil::static_atomic<ResourcePool*> _singleton;
     static pthread_mutex_t _singleton_mutex;
     static BAIDU_THREAD_LOCAL LocalPool* _local_pool;
@@ -531,6 +697,7 @@ private:
     static pthread_mutex_t _change_thread_mutex;
     static butil::static_atomic<BlockGroup*> _block_groups[RP_MAX_BLOCK_NGROUP];
 
+    FreeChunkShard _shards[RP_MAX_FREE_CHUNK_NSHARD];
     std::vector<DynamicFreeChunk*> _free_chunks;
     pthread_mutex_t _free_chunks_mutex;
 
@@ -602,6 +769,8 @@ inline std::ostream& operator<<(std::ostream& os,
               << "\nitem_num: " << info.item_num
               << "\nblock_item_num: " << info.block_item_num
               << "\nfree_chunk_item_num: " << info.free_chunk_item_num
+              << "\nfree_chunk_sharded_num: " << info.free_chunk_sharded_num
+              << "\nfree_chunk_overflow_num: " << info.free_chunk_overflow_num
               << "\ntotal_size: " << info.total_size;
 #ifdef BUTIL_RESOURCE_POOL_NEED_FREE_ITEM_NUM
               << "\nfree_num: " << info.free_item_num
@@ -0,0 +1,286 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <errno.h>
+#include <new>
+#include <string.h>
+#include "butil/build_config.h"
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "butil/shm_ring.h"
+
+#if defined(OS_LINUX)
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace butil {
+
+// One side of the ring. `pos' counts bytes ever pushed(tail, written by the
+// producer) or popped(head, written by the consumer) and never wraps in
+// practice. `seq' is bumped on every publication of `pos' and doubles as
+// the futex word the peer sleeps on; `sleeping' tells the publisher that a
+// wake-up syscall is needed, so doorbells cost nothing while the peer is
+// busy. Each side lives in its own cacheline to avoid false sharing with
+// the opposite direction.
+struct BAIDU_CACHELINE_ALIGNMENT ShmRingSide {
+    butil::atomic<uint64_t> pos;
+    butil::atomic<uint32_t> seq;
+    butil::atomic<uint32_t> sleeping;
+};
+
+struct ShmRingMeta {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t reserved;
+    ShmRingSide tail;
+    ShmRingSide head;
+};
+
+static const uint32_t SHM_RING_MAGIC = 0x52494e47;  // "RING"
+static const uint32_t SHM_RING_VERSION = 1;
+static const uint32_t MIN_SHM_RING_CAP = 4096;
+
+#if defined(OS_LINUX)
+
+static long shm_ring_futex(butil::atomic<uint32_t>* addr, int op, uint32_t val) {
+    // No FUTEX_PRIVATE_FLAG: the word is shared between processes.
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, NULL, NULL, 0);
+}
+
+ShmRing::ShmRing(int fd, ShmRingMeta* meta, char* data)
+    : _fd(fd), _meta(meta), _data(data) {
+}
+
+ShmRing::~ShmRing() {
+    if (_meta != NULL) {
+        munmap(_meta, sizeof(ShmRingMeta) + _meta->capacity);
+        _meta = NULL;
+        _data = NULL;
+    }
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+ShmRing* ShmRing::Create(uint32_t capacity) {
+    uint32_t cap = MIN_SHM_RING_CAP;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    const int fd = syscall(SYS_memfd_create, "brpc_shm_ring", 0);
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to memfd_create";
+        return NULL;
+    }
+    const size_t total = sizeof(ShmRingMeta) + cap;
+    if (ftruncate(fd, total) != 0) {
+        PLOG(ERROR) << "Fail to ftruncate fd=" << fd << " to " << total;
+        close(fd);
+        return NULL;
+    }
+    void* mem = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mem) {
+        PLOG(ERROR) << "Fail to mmap " << total << " bytes of fd=" << fd;
+        close(fd);
+        return NULL;
+    }
+    ShmRingMeta* meta = (ShmRingMeta*)mem;
+    memset(meta, 0, sizeof(*meta));
+    meta->magic = SHM_RING_MAGIC;
+    meta->version = SHM_RING_VERSION;
+    meta->capacity = cap;
+    ShmRing* ring = new (std::nothrow) ShmRing(
+        fd, meta, (char*)mem + sizeof(ShmRingMeta));
+    if (NULL == ring) {
+        munmap(mem, total);
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ring;
+}
+
+ShmRing* ShmRing::Attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        PLOG(ERROR) << "Fail to fstat fd=" << fd;
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(ShmRingMeta) + MIN_SHM_RING_CAP) {
+        LOG(ERROR) << "fd=" << fd << " is too small(" << st.st_size
+                   << " bytes) to be a ShmRing";
+        errno = EINVAL;
+        return NULL;
+    }
+    void* mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if (MAP_FAILED == mem) {
+        PLOG(ERROR) << "Fail to mmap " << st.st_size << " bytes of fd=" << fd;
+        return NULL;
+    }
+    ShmRingMeta* meta = (ShmRingMeta*)mem;
+    if (meta->magic != SHM_RING_MAGIC ||
+        meta->version != SHM_RING_VERSION ||
+        sizeof(ShmRingMeta) + meta->capacity != (size_t)st.st_size ||
+        (meta->capacity & (meta->capacity - 1)) != 0) {
+        LOG(ERROR) << "fd=" << fd << " does not contain a valid ShmRing";
+        munmap(mem, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    ShmRing* ring = new (std::nothrow) ShmRing(
+        fd, meta, (char*)mem + sizeof(ShmRingMeta));
+    if (NULL == ring) {
+        munmap(mem, st.st_size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ring;
+}
+
+size_t ShmRing::Push(const void* data, size_t n) {
+    ShmRingMeta* m = _meta;
+    const uint32_t cap = m->capacity;
+    const uint64_t head = m->head.pos.load(butil::memory_order_acquire);
+    const uint64_t tail = m->tail.pos.load(butil::memory_order_relaxed);
+    const size_t space = cap - (size_t)(tail - head);
+    if (0 == space) {
+        return 0;
+    }
+    n = std::min(n, space);
+    const uint32_t off = (uint32_t)(tail & (cap - 1));
+    const size_t first = std::min(n, (size_t)(cap - off));
+    memcpy(_data + off, data, first);
+    if (n > first) {
+        memcpy(_data, (const char*)data + first, n - first);
+    }
+    m->tail.pos.store(tail + n, butil::memory_order_release);
+    // The RMW makes the new `pos' visible to a consumer reading the new
+    // `seq', see WaitForData().
+    m->tail.seq.fetch_add(1, butil::memory_order_seq_cst);
+    if (m->tail.sleeping.exchange(0, butil::memory_order_seq_cst)) {
+        shm_ring_futex(&m->tail.seq, FUTEX_WAKE, 1);
+    }
+    return n;
+}
+
+size_t ShmRing::Pop(void* dest, size_t n) {
+    ShmRingMeta* m = _meta;
+    const uint32_t cap = m->capacity;
+    const uint64_t tail = m->tail.pos.load(butil::memory_order_acquire);
+    const uint64_t head = m->head.pos.load(butil::memory_order_relaxed);
+    const size_t readable = (size_t)(tail - head);
+    if (0 == readable) {
+        return 0;
+    }
+    n = std::min(n, readable);
+    const uint32_t off = (uint32_t)(head & (cap - 1));
+    const size_t first = std::min(n, (size_t)(cap - off));
+    memcpy(dest, _data + off, first);
+    if (n > first) {
+        memcpy((char*)dest + first, _data, n - first);
+    }
+    m->head.pos.store(head + n, butil::memory_order_release);
+    m->head.seq.fetch_add(1, butil::memory_order_seq_cst);
+    if (m->head.sleeping.exchange(0, butil::memory_order_seq_cst)) {
+        shm_ring_futex(&m->head.seq, FUTEX_WAKE, 1);
+    }
+    return n;
+}
+
+// Wait until `side'(published by the peer) moves, i.e. until the locally
+// owned `my_pos' no longer leads it by `limit' bytes(0 when waiting on
+// data with my_pos=head, the capacity when waiting on space with
+// my_pos=tail).
+static int wait_on_side(ShmRingSide* side, butil::atomic<uint64_t>* my_pos,
+                        uint64_t limit) {
+    while (true) {
+        const uint32_t seen = side->seq.load(butil::memory_order_seq_cst);
+        if (my_pos->load(butil::memory_order_relaxed) -
+            side->pos.load(butil::memory_order_acquire) != limit) {
+            return 0;
+        }
+        side->sleeping.store(1, butil::memory_order_seq_cst);
+        // A publication between loading `seen' and storing `sleeping' may
+        // have skipped the wake-up; the seq recheck catches it. If the
+        // publication happens after the store, the publisher sees
+        // sleeping==1 and wakes us even out of a not-yet-started
+        // futex_wait(which then returns EAGAIN).
+        if (side->seq.load(butil::memory_order_seq_cst) != seen) {
+            continue;
+        }
+        if (shm_ring_futex(&side->seq, FUTEX_WAIT, seen) != 0 &&
+            errno != EAGAIN && errno != EINTR && errno != EWOULDBLOCK) {
+            return -1;
+        }
+    }
+}
+
+int ShmRing::WaitForData() {
+    // head == tail means empty.
+    return wait_on_side(&_meta->tail, &_meta->head.pos, 0);
+}
+
+int ShmRing::WaitForSpace() {
+    // tail == head + capacity means full.
+    return wait_on_side(&_meta->head, &_meta->tail.pos, _meta->capacity);
+}
+
+size_t ShmRing::readable_bytes() const {
+    return (size_t)(_meta->tail.pos.load(butil::memory_order_acquire) -
+                    _meta->head.pos.load(butil::memory_order_acquire));
+}
+
+uint32_t ShmRing::capacity() const {
+    return _meta->capacity;
+}
+
+#else  // OS_LINUX
+
+ShmRing::ShmRing(int fd, ShmRingMeta* meta, char* data)
+    : _fd(fd), _meta(meta), _data(data) {
+}
+
+ShmRing::~ShmRing() {}
+
+ShmRing* ShmRing::Create(uint32_t /*capacity*/) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+ShmRing* ShmRing::Attach(int /*fd*/) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+size_t ShmRing::Push(const void*, size_t) { return 0; }
+size_t ShmRing::Pop(void*, size_t) { return 0; }
+int ShmRing::WaitForData() { errno = ENOSYS; return -1; }
+int ShmRing::WaitForSpace() { errno = ENOSYS; return -1; }
+size_t ShmRing::readable_bytes() const { return 0; }
+uint32_t ShmRing::capacity() const { return 0; }
+
+#endif  // OS_LINUX
+
+}  // namespace butil
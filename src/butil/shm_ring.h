@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// A single-producer single-consumer byte ring inside a shared memory
+// mapping, for passing RPC traffic between processes on one host without
+// going through the TCP stack. The backing memory is an anonymous
+// in-memory file whose descriptor can be handed to the peer process over
+// an unix domain socket (unix_socket_send_fd in butil/unix_socket.h),
+// which maps the same ring with Attach(). Pushing and popping are
+// wait-free memcpys; a blocked side sleeps on a futex inside the mapping
+// and is woken by the peer, so an idle ring costs nothing.
+
+#ifndef BUTIL_SHM_RING_H
+#define BUTIL_SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "butil/macros.h"
+
+namespace butil {
+
+struct ShmRingMeta;
+
+class ShmRing {
+public:
+    ~ShmRing();
+
+    // Create a ring whose data area holds `capacity' bytes, rounded up to a
+    // power of two not less than 4096. Returns NULL on error with errno set.
+    // Only supported on Linux(memfd + shared futex), other systems always
+    // fail with ENOSYS.
+    static ShmRing* Create(uint32_t capacity);
+
+    // Map the ring behind `fd' which was created by the peer process and
+    // received over an unix domain socket. Takes ownership of `fd' on
+    // success. Returns NULL on error with errno set.
+    static ShmRing* Attach(int fd);
+
+    // Copy at most `n' bytes from `data' into the ring, not blocking when
+    // the ring is full. Returns the number of bytes copied. Must be called
+    // by the producing side only.
+    size_t Push(const void* data, size_t n);
+
+    // Copy at most `n' bytes from the ring into `dest', not blocking when
+    // the ring is empty. Returns the number of bytes copied. Must be called
+    // by the consuming side only.
+    size_t Pop(void* dest, size_t n);
+
+    // Block until the ring has readable bytes. Returns 0 when data is (or
+    // may be) available, -1 on error. May wake up spuriously, simply call
+    // Pop() and wait again when it returns 0.
+    int WaitForData();
+
+    // Block until the ring has writable space. Same conventions as
+    // WaitForData().
+    int WaitForSpace();
+
+    // Bytes currently readable. May be stale immediately, but never
+    // overestimates for the consumer nor underestimates for the producer.
+    size_t readable_bytes() const;
+
+    // Capacity of the data area in bytes.
+    uint32_t capacity() const;
+
+    // Descriptor of the backing file, owned by this object. Pass it to the
+    // peer process to share the ring.
+    int fd() const { return _fd; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ShmRing);
+    ShmRing(int fd, ShmRingMeta* meta, char* data);
+
+    int _fd;
+    ShmRingMeta* _meta;
+    char* _data;
+};
+
+}  // namespace butil
+
+#endif  // BUTIL_SHM_RING_H
@@ -1,25 +1,35 @@
-// Licensed to the Apache Software Foundation (ASF) under one
-// or more contributor license agreements.  See the NOTICE file
-// distributed with this work for additional information
-// regarding copyright ownership.  The ASF licenses this file
-// to you under the Apache License, Version 2.0 (the
-// "License"); you may not use this file except in compliance
-// with the License.  You may obtain a copy of the License at
-//
-//   http://www.apache.org/licenses/LICENSE-2.0
-//
-// Unless required by applicable law or agreed to in writing,
-// software distributed under the License is distributed on an
-// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
-// KIND, either express or implied.  See the License for the
-// specific language governing permissions and limitations
-// under the License.
-
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
 #ifndef RAPIDJSON_OPTIMIZED_WRITER_H
 #define RAPIDJSON_OPTIMIZED_WRITER_H
 
 #include "writer.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward)
+#endif
+#ifdef RAPIDJSON_SSE42
+#include <nmmintrin.h>
+#elif defined(RAPIDJSON_SSE2)
+#include <emmintrin.h>
+#endif
+
 BUTIL_RAPIDJSON_NAMESPACE_BEGIN
 
 //! Optimized writer
@@ -79,6 +89,41 @@ protected:
             size_t index = 0;
             size_t pos = 0;
             while (pos < length) {
+#ifdef RAPIDJSON_SIMD
+                // Most payload bytes need no escaping; scan for the next
+                // one requiring it 16 bytes at a time so that the bulk
+                // Puts() below copies the clean span in one go.
+                if (sizeof(Ch) == 1) {
+                    const __m128i dquote = _mm_set1_epi8('\"');
+                    const __m128i bslash = _mm_set1_epi8('\\');
+                    const __m128i max_ctrl = _mm_set1_epi8(0x1F);
+                    while (pos + 16 <= length) {
+                        const __m128i s = _mm_loadu_si128(
+                            reinterpret_cast<const __m128i*>(str + pos));
+                        __m128i x = _mm_cmpeq_epi8(s, dquote);
+                        x = _mm_or_si128(x, _mm_cmpeq_epi8(s, bslash));
+                        // min(s, 0x1F) == s iff (unsigned)s <= 0x1F
+                        x = _mm_or_si128(
+                            x, _mm_cmpeq_epi8(_mm_min_epu8(s, max_ctrl), s));
+                        const unsigned r = (unsigned)_mm_movemask_epi8(x);
+                        if (r == 0) {
+                            pos += 16;
+                            continue;
+                        }
+#ifdef _MSC_VER // Find the index of the first byte needing an escape
+                        unsigned long offset;
+                        _BitScanForward(&offset, r);
+                        pos += offset;
+#else
+                        pos += __builtin_ffs(r) - 1;
+#endif
+                        break;
+                    }
+                    if (pos >= length) {
+                        break;
+                    }
+                }
+#endif // RAPIDJSON_SIMD
                 Ch c = str[pos];
                 if ((sizeof(Ch) == 1 || (unsigned)c < 256) && escape[(unsigned char)c]) {
                     Base::os_->Puts(str + index, pos - index);
@@ -293,6 +293,18 @@
     If any of these symbols is defined, RapidJSON defines the macro
     \c RAPIDJSON_SIMD to indicate the availability of the optimized code.
 */
+// Auto-enable the SIMD optimizations when the compiler already targets the
+// corresponding instruction set(__SSE2__ is implied by x86-64). Define
+// RAPIDJSON_NO_SIMD to opt out.
+#if !defined(RAPIDJSON_NO_SIMD) \
+    && !defined(RAPIDJSON_SSE2) && !defined(RAPIDJSON_SSE42)
+  #if defined(__SSE4_2__)
+    #define RAPIDJSON_SSE42
+  #elif defined(__SSE2__)
+    #define RAPIDJSON_SSE2
+  #endif
+#endif
+
 #if defined(RAPIDJSON_SSE2) || defined(RAPIDJSON_SSE42) \
     || defined(RAPIDJSON_DOXYGEN_RUNNING)
 #define RAPIDJSON_SIMD
@@ -623,6 +635,8 @@ struct GenericInsituStringStream {
     // Read
     Ch Peek() { return *src_; }
     Ch Take() { return *src_++; }
+    const Ch* TakeWithAddr() { return src_++; }
+    bool ReadBlockTail() { return false; }
     size_t Tell() { return static_cast<size_t>(src_ - head_); }
 
     // Write
@@ -0,0 +1,150 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// wyhash (final version 3) was written by Wang Yi <godzigege@gmail.com> and
+// released into the public domain (http://unlicense.org/). Condensed from
+// https://github.com/wangyi-fudan/wyhash without the seed/secret generators
+// which brpc does not use.
+//
+// It hashes with 64-bit multiplications instead of byte-wise arithmetic and
+// reaches xxh3-class throughput on the short keys typical for hash-map keys
+// and consistent-hashing ring points, without needing SIMD dispatch.
+
+#ifndef BUTIL_THIRD_PARTY_WYHASH_WYHASH_H
+#define BUTIL_THIRD_PARTY_WYHASH_WYHASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace butil {
+
+namespace wyhash_internal {
+
+// 64x64 -> 128 multiply folded to 64 bits by xor of both halves.
+inline void wymum(uint64_t* A, uint64_t* B) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *A;
+    r *= *B;
+    *A = (uint64_t)r;
+    *B = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *A = _umul128(*A, *B, B);
+#else
+    const uint64_t ha = *A >> 32, hb = *B >> 32;
+    const uint64_t la = (uint32_t)*A, lb = (uint32_t)*B;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    uint64_t c = (t < rl);
+    const uint64_t lo = t + (rm1 << 32);
+    c += (lo < t);
+    *A = lo;
+    *B = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline uint64_t wymix(uint64_t A, uint64_t B) {
+    wymum(&A, &B);
+    return A ^ B;
+}
+
+#if defined(ARCH_CPU_BIG_ENDIAN)
+inline uint64_t wybswap64(uint64_t v) {
+    return __builtin_bswap64(v);
+}
+inline uint32_t wybswap32(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+#endif
+
+inline uint64_t wyr8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(ARCH_CPU_BIG_ENDIAN)
+    v = wybswap64(v);
+#endif
+    return v;
+}
+
+inline uint64_t wyr4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if defined(ARCH_CPU_BIG_ENDIAN)
+    v = wybswap32(v);
+#endif
+    return v;
+}
+
+inline uint64_t wyr3(const uint8_t* p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+}  // namespace wyhash_internal
+
+// The default secret of the reference implementation.
+const uint64_t kWyhashSecret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+inline uint64_t wyhash(const void* key, size_t len, uint64_t seed,
+                       const uint64_t* secret = kWyhashSecret) {
+    using namespace wyhash_internal;
+    const uint8_t* p = (const uint8_t*)key;
+    seed ^= secret[0];
+    uint64_t a, b;
+    if (__builtin_expect(len <= 16, 1)) {
+        if (__builtin_expect(len >= 4, 1)) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32)
+                | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (__builtin_expect(len > 0, 1)) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (__builtin_expect(i > 48, 0)) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (__builtin_expect(i > 48, 0));
+            seed ^= see1 ^ see2;
+        }
+        while (__builtin_expect(i > 16, 0)) {
+            seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    return wymix(secret[1] ^ len, wymix(a ^ secret[1], b ^ seed));
+}
+
+}  // namespace butil
+
+#endif  // BUTIL_THIRD_PARTY_WYHASH_WYHASH_H
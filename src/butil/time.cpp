@@ -28,7 +28,10 @@
 #include <string.h>                          // memmem
 #undef _GNU_SOURCE
 
+#include <pthread.h>                         // pthread_create
+
 #include "butil/time.h"
+#include "butil/logging.h"                   // PLOG
 
 #if defined(NO_CLOCK_GETTIME_IN_MAC)
 #include <mach/clock.h>                      // mach_absolute_time
@@ -153,6 +156,49 @@ int64_t read_invariant_cpu_frequency() {
 }
 
 int64_t invariant_cpu_freq = -1;
+
+butil::atomic<int64_t> g_coarse_cpuwide_time_ns(0);
+butil::atomic<int64_t> g_coarse_time_us(0);
+
+static const useconds_t COARSE_CLOCK_STEP_US = 100;
+
+static void* CoarseTimeTicker(void*) {
+    while (true) {
+        g_coarse_cpuwide_time_ns.store(cpuwide_time_ns(),
+                                       butil::memory_order_relaxed);
+        g_coarse_time_us.store(gettimeofday_us(),
+                               butil::memory_order_relaxed);
+        usleep(COARSE_CLOCK_STEP_US);
+    }
+    return NULL;
+}
+
+static void StartCoarseTimeTicker() {
+    // Fill the caches before the thread runs so that readers racing with
+    // the start don't keep seeing zero.
+    g_coarse_cpuwide_time_ns.store(cpuwide_time_ns(),
+                                   butil::memory_order_relaxed);
+    g_coarse_time_us.store(gettimeofday_us(), butil::memory_order_relaxed);
+    pthread_t th;
+    if (pthread_create(&th, NULL, CoarseTimeTicker, NULL) != 0) {
+        PLOG(ERROR) << "Fail to create CoarseTimeTicker";
+        return;
+    }
+    pthread_detach(th);
+}
+
+static pthread_once_t g_coarse_ticker_once = PTHREAD_ONCE_INIT;
+
+int64_t init_coarse_cpuwide_time_ns() {
+    pthread_once(&g_coarse_ticker_once, StartCoarseTimeTicker);
+    return cpuwide_time_ns();
+}
+
+int64_t init_coarse_time_us() {
+    pthread_once(&g_coarse_ticker_once, StartCoarseTimeTicker);
+    return gettimeofday_us();
+}
+
 }  // namespace detail
 
 }  // namespace butil
@@ -26,6 +26,8 @@
 #include <sys/time.h>                        // timeval, gettimeofday
 #include <stdint.h>                          // int64_t, uint64_t
 
+#include "butil/atomicops.h"                 // butil::atomic
+
 #if defined(NO_CLOCK_GETTIME_IN_MAC)
 #include <mach/mach.h>
 # define CLOCK_REALTIME CALENDAR_CLOCK
@@ -342,6 +344,55 @@ inline int64_t gettimeofday_s() {
     return gettimeofday_us() / 1000000L;
 }
 
+// -------------------------------------------------------------------
+// Coarse timestamps with ~100us resolution, readable in ~1ns.
+// Reading is a single relaxed load of a cached value which is
+// refreshed by a lazily-started background ticker thread every 100us
+// and at bthread scheduling boundaries. Useful on hot paths that read
+// clocks many times per operation and tolerate the inaccuracy, e.g.
+// idle-connection bookkeeping. Do NOT use for deadlines or latency
+// measurement.
+// -------------------------------------------------------------------
+namespace detail {
+// The cached clocks, zero before the ticker thread started (time.cpp).
+extern butil::atomic<int64_t> g_coarse_cpuwide_time_ns;
+extern butil::atomic<int64_t> g_coarse_time_us;
+// Start the ticker thread (at most once) and return a fresh value.
+int64_t init_coarse_cpuwide_time_ns();
+int64_t init_coarse_time_us();
+// Refresh the cached cpuwide clock with an already-read value. Called
+// at bthread scheduling boundaries to piggyback on clock reads that
+// are made anyway. No-op before the ticker started, whose zero value
+// makes the first coarse_*() reader start the ticker.
+inline void set_coarse_cpuwide_time_ns(int64_t now_ns) {
+    if (g_coarse_cpuwide_time_ns.load(butil::memory_order_relaxed)) {
+        g_coarse_cpuwide_time_ns.store(now_ns, butil::memory_order_relaxed);
+    }
+}
+}  // namespace detail
+
+// Cached cpuwide_time_ns/us(), comparable with accurate cpuwide_time_*().
+inline int64_t coarse_cpuwide_time_ns() {
+    const int64_t v =
+        detail::g_coarse_cpuwide_time_ns.load(butil::memory_order_relaxed);
+    return v ? v : detail::init_coarse_cpuwide_time_ns();
+}
+
+inline int64_t coarse_cpuwide_time_us() {
+    return coarse_cpuwide_time_ns() / 1000L;
+}
+
+// Cached gettimeofday_us/ms(), comparable with accurate gettimeofday_*().
+inline int64_t coarse_time_us() {
+    const int64_t v =
+        detail::g_coarse_time_us.load(butil::memory_order_relaxed);
+    return v ? v : detail::init_coarse_time_us();
+}
+
+inline int64_t coarse_time_ms() {
+    return coarse_time_us() / 1000L;
+}
+
 // ----------------------------------------
 // Control frequency of operations.
 // ----------------------------------------
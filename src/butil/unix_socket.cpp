@@ -17,6 +17,7 @@
 
 // Date: Mon. Jan 27  23:08:35 CST 2014
 
+#include <string.h>                             // memset
 #include <sys/types.h>                          // socket
 #include <sys/socket.h>                         // ^
 #include <sys/un.h>                             // unix domain socket
@@ -72,4 +73,55 @@ int unix_socket_connect(const char* sockname) {
     return fd.release();
 }
 
+int unix_socket_send_fd(int sockfd, int fd) {
+    char payload = 0;
+    struct iovec iov = { &payload, 1 };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    if (sendmsg(sockfd, &msg, 0) < 0) {
+        PLOG(ERROR) << "Fail to send fd=" << fd << " over sockfd=" << sockfd;
+        return -1;
+    }
+    return 0;
+}
+
+int unix_socket_recv_fd(int sockfd) {
+    char payload = 0;
+    struct iovec iov = { &payload, 1 };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(sockfd, &msg, 0) < 0) {
+        PLOG(ERROR) << "Fail to recvmsg from sockfd=" << sockfd;
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (NULL == cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+        LOG(ERROR) << "No fd was attached to the message from sockfd="
+                   << sockfd;
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = -1;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
 }  // namespace butil
@@ -36,6 +36,16 @@ int unix_socket_listen(const char* sockname);
 // Returns the file descriptor on success, -1 otherwise and errno is set.
 int unix_socket_connect(const char* sockname);
 
+// Send the file descriptor `fd' over the connected unix domain socket
+// `sockfd' via SCM_RIGHTS, accompanied by one payload byte.
+// Returns 0 on success, -1 otherwise and errno is set.
+int unix_socket_send_fd(int sockfd, int fd);
+
+// Receive a file descriptor sent by unix_socket_send_fd() from `sockfd'.
+// Returns the (newly created) descriptor on success, -1 otherwise and
+// errno is set.
+int unix_socket_recv_fd(int sockfd);
+
 }  // namespace butil
 
 #endif  // BUTIL_UNIX_SOCKET_H
@@ -18,6 +18,7 @@
 // Date: Mon Dec 14 19:12:30 CST 2015
 
 #include <map>
+#include <memory>
 #include <gflags/gflags.h>
 #include "butil/memory/singleton_on_pthread_once.h"
 #include "butil/threading/platform_thread.h"
@@ -34,6 +35,11 @@ DEFINE_int32(bvar_collector_max_pending_samples, 1000,
 DEFINE_int32(bvar_collector_expected_per_second, 1000,
              "Expected number of samples to be collected per second");
 
+DEFINE_int32(bvar_collector_dump_threads, 1,
+             "Number of threads calling dump callbacks, each handling one "
+             "round of grabbed samples in rotation. All dumpers and "
+             "preprocessors must be thread-safe before raising this above 1");
+
 // CAUTION: Don't change this value unless you know exactly what it means.
 static const int64_t COLLECTOR_GRAB_INTERVAL_US = 100000L; // 100ms
 
@@ -64,12 +70,28 @@ public:
 
     void wakeup_grab_thread();
 
+public:
+    // Hard cap of -bvar_collector_dump_threads.
+    static const int MAX_DUMP_THREADS = 16;
+
 private:
+    // One dump thread and its private hand-off list. grab_thread rotates
+    // over the queues so that rounds spread across threads without any
+    // shared list head.
+    struct DumpQueue {
+        Collector* parent;
+        int index;
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        butil::LinkNode<Collected> root;
+    };
+
     // The thread for collecting TLS submissions.
     void grab_thread();
 
-    // The thread for calling user's callbacks.
-    void dump_thread();
+    // The threads for calling user's callbacks.
+    void dump_thread(int index);
 
     // Adjust speed_limit if grab_thread collected too many in one round.
     void update_speed_limit(CollectorSpeedLimit* speed_limit,
@@ -84,30 +106,36 @@ private:
 
     static void* run_dump_thread(void* arg) {
         butil::PlatformThread::SetName("bvar_collector_dumper");
-        static_cast<Collector*>(arg)->dump_thread();
+        DumpQueue* q = static_cast<DumpQueue*>(arg);
+        q->parent->dump_thread(q->index);
         return NULL;
     }
 
     static int64_t get_pending_count(void* arg) {
         Collector* d = static_cast<Collector*>(arg);
-        return d->_ngrab - d->_ndump - d->_ndrop;
+        return d->_ngrab - d->_ndump.load(butil::memory_order_relaxed)
+            - d->_ndrop;
+    }
+
+    static int64_t get_ndump(void* arg) {
+        return static_cast<Collector*>(arg)->_ndump.load(
+            butil::memory_order_relaxed);
     }
-    
+
 private:
     // periodically modified by grab_thread, accessed by every submit.
     // Make sure that this cacheline does not include frequently modified field.
     int64_t _last_active_cpuwide_us;
-    
+
     bool _created;      // Mark validness of _grab_thread.
     bool _stop;         // Set to true in dtor.
     pthread_t _grab_thread;     // For joining.
-    pthread_t _dump_thread;
     int64_t _ngrab BAIDU_CACHELINE_ALIGNMENT;
     int64_t _ndrop;
-    int64_t _ndump;
-    pthread_mutex_t _dump_thread_mutex;
-    pthread_cond_t _dump_thread_cond;
-    butil::LinkNode<Collected> _dump_root;
+    butil::atomic<int64_t> _ndump;  // modified by every dump thread.
+    int _ndump_threads;             // fixed after grab_thread started.
+    int _next_dump_queue;           // only used by grab_thread.
+    DumpQueue _dump_queues[MAX_DUMP_THREADS];
     pthread_mutex_t _sleep_mutex;
     pthread_cond_t _sleep_cond;
 };
@@ -117,12 +145,18 @@ Collector::Collector()
     , _created(false)
     , _stop(false)
     , _grab_thread(0)
-    , _dump_thread(0)
     , _ngrab(0)
     , _ndrop(0)
-    , _ndump(0) {
-    pthread_mutex_init(&_dump_thread_mutex, NULL);
-    pthread_cond_init(&_dump_thread_cond, NULL);
+    , _ndump(0)
+    , _ndump_threads(1)
+    , _next_dump_queue(0) {
+    for (int i = 0; i < MAX_DUMP_THREADS; ++i) {
+        _dump_queues[i].parent = this;
+        _dump_queues[i].index = i;
+        _dump_queues[i].thread = 0;
+        pthread_mutex_init(&_dump_queues[i].mutex, NULL);
+        pthread_cond_init(&_dump_queues[i].cond, NULL);
+    }
     pthread_mutex_init(&_sleep_mutex, NULL);
     pthread_cond_init(&_sleep_cond, NULL);
     int rc = pthread_create(&_grab_thread, NULL, run_grab_thread, this);
@@ -139,8 +173,10 @@ Collector::~Collector() {
         pthread_join(_grab_thread, NULL);
         _created = false;
     }
-    pthread_mutex_destroy(&_dump_thread_mutex);
-    pthread_cond_destroy(&_dump_thread_cond);
+    for (int i = 0; i < MAX_DUMP_THREADS; ++i) {
+        pthread_mutex_destroy(&_dump_queues[i].mutex);
+        pthread_cond_destroy(&_dump_queues[i].cond);
+    }
     pthread_mutex_destroy(&_sleep_mutex);
     pthread_cond_destroy(&_sleep_cond);
 }
@@ -158,10 +194,22 @@ void Collector::grab_thread() {
     int64_t last_before_update_sl = _last_active_cpuwide_us;
 
     // This is the thread for collecting TLS submissions. User's callbacks are
-    // called inside the separate _dump_thread to prevent a slow callback
+    // called inside separate dump threads to prevent a slow callback
     // (caused by busy disk generally) from blocking collecting code too long
     // that pending requests may explode memory.
-    CHECK_EQ(0, pthread_create(&_dump_thread, NULL, run_dump_thread, this));
+    _ndump_threads = FLAGS_bvar_collector_dump_threads;
+    if (_ndump_threads < 1) {
+        _ndump_threads = 1;
+    } else if (_ndump_threads > MAX_DUMP_THREADS) {
+        LOG(WARNING) << "bvar_collector_dump_threads="
+                     << FLAGS_bvar_collector_dump_threads
+                     << " is limited to " << MAX_DUMP_THREADS;
+        _ndump_threads = MAX_DUMP_THREADS;
+    }
+    for (int i = 0; i < _ndump_threads; ++i) {
+        CHECK_EQ(0, pthread_create(&_dump_queues[i].thread, NULL,
+                                   run_dump_thread, &_dump_queues[i]));
+    }
 
     // vars
     bvar::PassiveStatus<int64_t> pending_sampled_data(
@@ -242,13 +290,16 @@ void Collector::grab_thread() {
                     }
                 }
             }
-            // Give the samples to dump_thread
+            // Give the samples to the next dump thread in rotation so that
+            // rounds dump in parallel when -bvar_collector_dump_threads > 1.
             if (root.next() != &root) {  // non empty
                 butil::LinkNode<Collected>* head2 = root.next();
                 root.RemoveFromList();
-                BAIDU_SCOPED_LOCK(_dump_thread_mutex);
-                head2->InsertBeforeAsList(&_dump_root);
-                pthread_cond_signal(&_dump_thread_cond);
+                DumpQueue& q = _dump_queues[_next_dump_queue];
+                _next_dump_queue = (_next_dump_queue + 1) % _ndump_threads;
+                BAIDU_SCOPED_LOCK(q.mutex);
+                head2->InsertBeforeAsList(&q.root);
+                pthread_cond_signal(&q.cond);
             }
         }
         int64_t now = butil::cpuwide_time_us();
@@ -275,12 +326,14 @@ void Collector::grab_thread() {
         _last_active_cpuwide_us = butil::cpuwide_time_us();
     }
     // make sure _stop is true, we may have other reasons to quit above loop
-    {
-        BAIDU_SCOPED_LOCK(_dump_thread_mutex);
-        _stop = true; 
-        pthread_cond_signal(&_dump_thread_cond);
+    for (int i = 0; i < _ndump_threads; ++i) {
+        BAIDU_SCOPED_LOCK(_dump_queues[i].mutex);
+        _stop = true;
+        pthread_cond_signal(&_dump_queues[i].cond);
+    }
+    for (int i = 0; i < _ndump_threads; ++i) {
+        CHECK_EQ(0, pthread_join(_dump_queues[i].thread, NULL));
     }
-    CHECK_EQ(0, pthread_join(_dump_thread, NULL));
 }
 
 void Collector::wakeup_grab_thread() {
@@ -359,18 +412,30 @@ size_t is_collectable_before_first_time_grabbed(CollectorSpeedLimit* sl) {
 }
 
 // Call user's callbacks in this thread.
-void Collector::dump_thread() {
+void Collector::dump_thread(int index) {
+    DumpQueue& q = _dump_queues[index];
     int64_t last_ns = butil::cpuwide_time_ns();
 
-    // vars
+    // vars. Exposed by the first dump thread only: names are global and
+    // the usage of additional threads is not worth separate variables.
     double busy_seconds = 0;
-    bvar::PassiveStatus<double> busy_seconds_var(deref_value<double>, &busy_seconds);
-    bvar::PerSecond<bvar::PassiveStatus<double> > busy_seconds_second(
-        "bvar_collector_dump_thread_usage", &busy_seconds_var);
-
-    bvar::PassiveStatus<int64_t> ndumped_var(deref_value<int64_t>, &_ndump);
-    bvar::PerSecond<bvar::PassiveStatus<int64_t> > ndumped_second(
-        "bvar::collector_dump_second", &ndumped_var);
+    std::unique_ptr<bvar::PassiveStatus<double> > busy_seconds_var;
+    std::unique_ptr<bvar::PerSecond<bvar::PassiveStatus<double> > >
+        busy_seconds_second;
+    std::unique_ptr<bvar::PassiveStatus<int64_t> > ndumped_var;
+    std::unique_ptr<bvar::PerSecond<bvar::PassiveStatus<int64_t> > >
+        ndumped_second;
+    if (index == 0) {
+        busy_seconds_var.reset(new bvar::PassiveStatus<double>(
+            deref_value<double>, &busy_seconds));
+        busy_seconds_second.reset(
+            new bvar::PerSecond<bvar::PassiveStatus<double> >(
+                "bvar_collector_dump_thread_usage", busy_seconds_var.get()));
+        ndumped_var.reset(new bvar::PassiveStatus<int64_t>(get_ndump, this));
+        ndumped_second.reset(
+            new bvar::PerSecond<bvar::PassiveStatus<int64_t> >(
+                "bvar::collector_dump_second", ndumped_var.get()));
+    }
 
     butil::LinkNode<Collected> root;
     size_t round = 0;
@@ -381,20 +446,20 @@ void Collector::dump_thread() {
         // Get new samples set by grab_thread.
         butil::LinkNode<Collected>* newhead = NULL;
         {
-            BAIDU_SCOPED_LOCK(_dump_thread_mutex);
-            while (!_stop && _dump_root.next() == &_dump_root) {
+            BAIDU_SCOPED_LOCK(q.mutex);
+            while (!_stop && q.root.next() == &q.root) {
                 const int64_t now_ns = butil::cpuwide_time_ns();
                 busy_seconds += (now_ns - last_ns) / 1000000000.0;
-                pthread_cond_wait(&_dump_thread_cond, &_dump_thread_mutex);
+                pthread_cond_wait(&q.cond, &q.mutex);
                 last_ns = butil::cpuwide_time_ns();
             }
             if (_stop) {
                 break;
             }
-            newhead = _dump_root.next();
-            _dump_root.RemoveFromList();
+            newhead = q.root.next();
+            q.root.RemoveFromList();
         }
-        CHECK(newhead != &_dump_root);
+        CHECK(newhead != &q.root);
         newhead->InsertBeforeAsList(&root);
 
         // Call callbacks.
@@ -404,7 +469,7 @@ void Collector::dump_thread() {
             p->RemoveFromList();
             Collected* s = p->value();
             s->dump_and_destroy(round);
-            ++_ndump;
+            _ndump.fetch_add(1, butil::memory_order_relaxed);
             p = saved_next;
         }
     }
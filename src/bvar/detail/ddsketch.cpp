@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "bvar/detail/ddsketch.h"
+#include "butil/logging.h"
+
+namespace bvar {
+namespace detail {
+
+DDSketchPercentile::DDSketchPercentile()
+    : _combiner(std::make_shared<combiner_type>()), _sampler(NULL) {}
+
+DDSketchPercentile::~DDSketchPercentile() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+}
+
+DDSketchPercentile::value_type DDSketchPercentile::reset() {
+    return _combiner->reset_all_agents();
+}
+
+DDSketchPercentile::value_type DDSketchPercentile::get_value() const {
+    return _combiner->combine_agents();
+}
+
+DDSketchPercentile& DDSketchPercentile::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << "Input=" << latency << " to `" << _debug_name
+                       << "' is negative, drop";
+        } else {
+            LOG(WARNING) << "Input=" << latency << " to DDSketchPercentile("
+                       << (void*)this << ") is negative, drop";
+        }
+        return *this;
+    }
+    agent->element.modify(AddDDSketchSamples(), latency);
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
@@ -0,0 +1,213 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_DDSKETCH_H
+#define  BVAR_DETAIL_DDSKETCH_H
+
+#include <string.h>                     // memset
+#include <stdint.h>                     // uint32_t
+#include <limits>                       // std::numeric_limits
+#include <ostream>                      // std::ostream
+#include <math.h>                       // log2 exp2 ceil
+#include "butil/macros.h"
+#include "bvar/reducer.h"               // VoidOp
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Relative error guarantee of DDSketchSamples. Fixed at compile time so
+// that all sketches use the same bucket boundaries and stay mergeable.
+const double DDSKETCH_ALPHA = 0.01;
+const double DDSKETCH_GAMMA = (1 + DDSKETCH_ALPHA) / (1 - DDSKETCH_ALPHA);
+// Bucket 0 stores zeros, bucket i(>0) stores values in
+// (gamma^(i-2), gamma^(i-1)]. ceil(32 / log2(gamma)) = 1109 logarithmic
+// buckets cover [1, UINT32_MAX] for alpha = 1%, values above UINT32_MAX are
+// clamped into the last bucket just like PercentileInterval.
+const size_t NUM_DDSKETCH_BUCKETS = 1111;
+
+// A DDSketch of latencies: a fixed set of logarithmic buckets giving any
+// quantile with a bounded *relative* error of DDSKETCH_ALPHA, O(1) insert
+// and a trivial (bucket-wise sum) merge. Unlike PercentileSamples nothing
+// is ever down-sampled, so tail quantiles don't jitter at high add rates.
+class DDSketchSamples {
+public:
+    DDSketchSamples() { clear(); }
+
+    void clear() {
+        _num_added = 0;
+        memset(_counts, 0, sizeof(_counts));
+    }
+
+    // Add a latency. Negative values are dropped by callers (as in
+    // Percentile::operator<<).
+    void add(int64_t x) {
+        ++_num_added;
+        uint32_t* c = &_counts[bucket_of(x)];
+        if (BAIDU_LIKELY(*c != std::numeric_limits<uint32_t>::max())) {
+            ++*c;
+        }
+    }
+
+    // Add buckets of another sketch.
+    void merge(const DDSketchSamples& rhs) {
+        _num_added += rhs._num_added;
+        for (size_t i = 0; i < NUM_DDSKETCH_BUCKETS; ++i) {
+            const uint64_t s = (uint64_t)_counts[i] + rhs._counts[i];
+            _counts[i] = (s <= std::numeric_limits<uint32_t>::max() ?
+                          (uint32_t)s : std::numeric_limits<uint32_t>::max());
+        }
+    }
+
+    // Combine multiple sketches into this one.
+    template <typename Iterator>
+    void combine_of(const Iterator& begin, const Iterator& end) {
+        clear();
+        for (Iterator iter = begin; iter != end; ++iter) {
+            merge(*iter);
+        }
+    }
+
+    // Get the `ratio'-ile value. E.g. 0.99 means 99%-ile value.
+    int64_t get_number(double ratio) const {
+        size_t n = (size_t)ceil(ratio * _num_added);
+        if (n > _num_added) {
+            n = _num_added;
+        } else if (n == 0) {
+            return 0;
+        }
+        size_t acc = 0;
+        for (size_t i = 0; i < NUM_DDSKETCH_BUCKETS; ++i) {
+            acc += _counts[i];
+            if (acc >= n) {
+                return value_of(i);
+            }
+        }
+        // Saturated counts may make buckets sum up less than _num_added.
+        return value_of(NUM_DDSKETCH_BUCKETS - 1);
+    }
+
+    // #values ever added by calling add()
+    size_t added_count() const { return _num_added; }
+
+    // For debugging.
+    void describe(std::ostream& os) const {
+        os << this << "{num_added=" << _num_added
+           << " p50=" << get_number(0.5)
+           << " p99=" << get_number(0.99)
+           << " p999=" << get_number(0.999) << '}';
+    }
+
+private:
+    static size_t bucket_of(int64_t x) {
+        if (x <= 0) {
+            return 0;
+        }
+        if (x > (int64_t)std::numeric_limits<uint32_t>::max()) {
+            x = std::numeric_limits<uint32_t>::max();
+        }
+        static const double inv_log2_gamma = 1.0 / log2(DDSKETCH_GAMMA);
+        const size_t i = (size_t)ceil(log2((double)x) * inv_log2_gamma) + 1;
+        return (i < NUM_DDSKETCH_BUCKETS ? i : NUM_DDSKETCH_BUCKETS - 1);
+    }
+
+    // Middle of the range of bucket `index', within DDSKETCH_ALPHA of any
+    // value stored in the bucket.
+    static int64_t value_of(size_t index) {
+        if (index == 0) {
+            return 0;
+        }
+        static const double log2_gamma = log2(DDSKETCH_GAMMA);
+        return (int64_t)llround(exp2((double)(index - 1) * log2_gamma) *
+                                (2.0 / (DDSKETCH_GAMMA + 1)));
+    }
+
+    size_t _num_added;
+    uint32_t _counts[NUM_DDSKETCH_BUCKETS];
+};
+
+inline std::ostream& operator<<(std::ostream& os, const DDSketchSamples& s) {
+    s.describe(os);
+    return os;
+}
+
+// A specialized reducer accumulating latencies into per-thread DDSketches
+// which are combined through AgentCombiner, mirroring Percentile.
+// NOTE: DON'T use it directly, use LatencyRecorder instead.
+class DDSketchPercentile {
+public:
+    struct AddDDSketchSamples {
+        void operator()(DDSketchSamples& b1,
+                        const DDSketchSamples& b2) const {
+            b1.merge(b2);
+        }
+        void operator()(DDSketchSamples& b1, int64_t latency) const {
+            b1.add(latency);
+        }
+    };
+
+    typedef DDSketchSamples                                 value_type;
+    typedef ReducerSampler<DDSketchPercentile,
+                           DDSketchSamples,
+                           AddDDSketchSamples, VoidOp>      sampler_type;
+    typedef AgentCombiner<DDSketchSamples,
+                          DDSketchSamples,
+                          AddDDSketchSamples>               combiner_type;
+    typedef combiner_type::self_shared_type                 shared_combiner_type;
+    typedef combiner_type::Agent                            agent_type;
+
+    DDSketchPercentile();
+    ~DDSketchPercentile();
+
+    AddDDSketchSamples op() const { return AddDDSketchSamples(); }
+    VoidOp inv_op() const { return VoidOp(); }
+
+    // The sampler for windows over this reducer.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset();
+
+    value_type get_value() const;
+
+    DDSketchPercentile& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(DDSketchPercentile);
+
+    shared_combiner_type _combiner;
+    sampler_type* _sampler;
+    std::string _debug_name;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_DDSKETCH_H
@@ -41,7 +41,7 @@ inline unsigned long round_of_expectation(unsigned long a, unsigned long b) {
     if (BAIDU_UNLIKELY(b == 0)) {
         return 0;
     }
-    return a / b + (butil::fast_rand_less_than(b) < a % b);
+    return a / b + (butil::fast_rand_batched_less_than(b) < a % b);
 }
 
 // Storing latencies inside a interval.
@@ -121,7 +121,7 @@ public:
             CHECK_LE(num_remain, _num_samples);
             // Randomly drop samples of this
             for (size_t i = _num_samples; i > num_remain; --i) {
-                _samples[butil::fast_rand_less_than(i)] = _samples[i - 1];
+                _samples[butil::fast_rand_batched_less_than(i)] = _samples[i - 1];
             }
             const size_t num_remain_from_rhs = SAMPLE_SIZE - num_remain;
             CHECK_LE(num_remain_from_rhs, rhs._num_samples);
@@ -129,7 +129,7 @@ public:
             DEFINE_SMALL_ARRAY(uint32_t, tmp, rhs._num_samples, 64);
             memcpy(tmp, rhs._samples, sizeof(uint32_t) * rhs._num_samples);
             for (size_t i = 0; i < num_remain_from_rhs; ++i) {
-                const int index = butil::fast_rand_less_than(rhs._num_samples - i);
+                const int index = butil::fast_rand_batched_less_than(rhs._num_samples - i);
                 _samples[num_remain++] = tmp[index];
                 tmp[index] = tmp[rhs._num_samples - i - 1];
             }
@@ -150,11 +150,11 @@ public:
             return;
         }
         for (size_t i = 0; i < n; ++i) {
-            size_t index = butil::fast_rand_less_than(mutable_rhs._num_samples - i);
+            size_t index = butil::fast_rand_batched_less_than(mutable_rhs._num_samples - i);
             if (_num_samples < SAMPLE_SIZE) {
                 _samples[_num_samples++] = mutable_rhs._samples[index];
             } else {
-                _samples[butil::fast_rand_less_than(_num_samples)]
+                _samples[butil::fast_rand_batched_less_than(_num_samples)]
                         = mutable_rhs._samples[index];
             }
             std::swap(mutable_rhs._samples[index],
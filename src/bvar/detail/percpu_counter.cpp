@@ -0,0 +1,132 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <unistd.h>                      // sysconf
+#include <new>                           // std::nothrow
+#include "butil/build_config.h"          // OS_LINUX
+#if defined(OS_LINUX)
+#include <sched.h>                       // sched_getcpu
+#endif
+#include "butil/logging.h"
+#include "bvar/detail/percpu_counter.h"
+
+namespace bvar {
+namespace detail {
+
+#if defined(OS_LINUX) && defined(__GLIBC__)
+// The rseq area that glibc 2.35+ registers for every thread. Declared
+// weak so that binaries still link(and fall back to sched_getcpu) with
+// older glibc.
+extern "C" {
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+}
+
+// Head of the kernel rseq ABI(linux/rseq.h), stable by contract.
+struct RseqAreaHead {
+    uint32_t cpu_id_start;
+    uint32_t cpu_id;
+};
+
+static inline const char* thread_pointer() {
+#if defined(__x86_64__)
+    // glibc stores the thread pointer at %fs:0 on x86-64.
+    const char* tp;
+    asm ("movq %%fs:0, %0" : "=r"(tp));
+    return tp;
+#elif defined(__aarch64__)
+    const char* tp;
+    asm ("mrs %0, tpidr_el0" : "=r"(tp));
+    return tp;
+#else
+    return NULL;
+#endif
+}
+
+static inline int rseq_current_cpu() {
+    if (&__rseq_size == NULL || __rseq_size == 0) {
+        // glibc did not register rseq(old glibc or disabled by
+        // GLIBC_TUNABLES=glibc.pthread.rseq=0).
+        return -1;
+    }
+    const char* tp = thread_pointer();
+    if (NULL == tp) {
+        return -1;
+    }
+    const RseqAreaHead* area = (const RseqAreaHead*)(tp + __rseq_offset);
+    // cpu_id is negative until the kernel initializes the area.
+    return (int32_t)area->cpu_id;
+}
+#endif  // OS_LINUX && __GLIBC__
+
+int get_current_cpu() {
+    int cpu = -1;
+#if defined(OS_LINUX)
+#if defined(__GLIBC__)
+    cpu = rseq_current_cpu();
+#endif
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+#endif
+    return cpu >= 0 ? cpu : 0;
+}
+
+PerCpuCounter::PerCpuCounter() : _slots(NULL), _nslot(0), _mask(0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu <= 0) {
+        ncpu = 1;
+    }
+    size_t nslot = 1;
+    while (nslot < (size_t)ncpu) {
+        nslot <<= 1;
+    }
+    _slots = new (std::nothrow) Slot[nslot];
+    if (NULL == _slots) {
+        LOG(FATAL) << "Fail to new " << nslot << " per-cpu slots";
+        return;
+    }
+    for (size_t i = 0; i < nslot; ++i) {
+        _slots[i].value.store(0, butil::memory_order_relaxed);
+    }
+    _nslot = nslot;
+    _mask = nslot - 1;
+}
+
+PerCpuCounter::~PerCpuCounter() {
+    delete [] _slots;
+    _slots = NULL;
+}
+
+int64_t PerCpuCounter::sum() const {
+    int64_t s = 0;
+    for (size_t i = 0; i < _nslot; ++i) {
+        s += _slots[i].value.load(butil::memory_order_relaxed);
+    }
+    return s;
+}
+
+int64_t PerCpuCounter::reset() {
+    int64_t s = 0;
+    for (size_t i = 0; i < _nslot; ++i) {
+        s += _slots[i].value.exchange(0, butil::memory_order_relaxed);
+    }
+    return s;
+}
+
+}  // namespace detail
+}  // namespace bvar
@@ -0,0 +1,77 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_DETAIL_PERCPU_COUNTER_H
+#define  BVAR_DETAIL_PERCPU_COUNTER_H
+
+#include <stdint.h>
+#include "butil/atomicops.h"
+#include "butil/macros.h"                // BAIDU_CACHELINE_ALIGNMENT
+
+namespace bvar {
+namespace detail {
+
+// Index of the CPU running the caller, for addressing per-CPU slots. On
+// linux the cpu_id field of the rseq area registered by glibc(2.35+) is
+// read when present, which is a single load from TLS, otherwise the call
+// falls back to sched_getcpu(). Returns 0 on systems without either.
+int get_current_cpu();
+
+// A fixed array of cacheline-aligned per-CPU slots for integral counters.
+// Writes add onto the slot of the running CPU and rarely contend; reads
+// sum up the ncpu slots without touching thread-local state or any lock,
+// which makes frequent combination(e.g. the per-second sampler pass and
+// /vars dumping) much cheaper than walking the mutex-guarded agent list
+// of AgentCombiner whose size grows with the number of threads.
+class PerCpuCounter {
+public:
+    PerCpuCounter();
+    ~PerCpuCounter();
+
+    // Add `value' onto the slot of the CPU running the caller. A thread
+    // migrated between the read of the cpu id and the addition still
+    // commits onto a valid slot since slots are atomic.
+    void add(int64_t value) {
+        _slots[get_current_cpu() & _mask].value.fetch_add(
+            value, butil::memory_order_relaxed);
+    }
+
+    // Sum of all slots.
+    int64_t sum() const;
+
+    // Zero all slots and return the sum before zeroing.
+    int64_t reset();
+
+    // True if this counter is constructed successfully.
+    bool valid() const { return _slots != NULL; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(PerCpuCounter);
+
+    struct BAIDU_CACHELINE_ALIGNMENT Slot {
+        butil::atomic<int64_t> value;
+    };
+
+    Slot* _slots;
+    size_t _nslot;   // power of 2 covering all cpus
+    size_t _mask;    // _nslot - 1
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  // BVAR_DETAIL_PERCPU_COUNTER_H
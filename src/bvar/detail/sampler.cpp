@@ -18,6 +18,7 @@
 // Date: Tue Jul 28 18:14:40 CST 2015
 
 #include <gflags/gflags.h>
+#include "butil/atomicops.h"
 #include "butil/threading/platform_thread.h"
 #include "butil/time.h"
 #include "butil/memory/singleton_on_pthread_once.h"
@@ -49,6 +50,8 @@ struct CombineSampler {
 // of child as well, no need to register in the child again.
 static bool registered_atfork = false;
 
+class SamplerCollectorGroup;
+
 // Call take_sample() of all scheduled samplers.
 // This can be done with regular timer thread, but it's way too slow(global
 // contention + log(N) heap manipulations). We need it to be super fast so that
@@ -60,13 +63,19 @@ static bool registered_atfork = false;
 // list of Samplers. Waking through the list and call take_sample().
 // If a Sampler needs to be deleted, we just mark it as unused and the
 // deletion is taken place in the thread as well.
+// With many samplers(e.g. hundreds of thousands of bvars), one walk may take
+// tens of milliseconds and skew all windows. SamplerCollectorGroup partitions
+// samplers into multiple collectors, each owning its sublist and a dedicated
+// thread. A sampler is walked and deleted only by the thread of the collector
+// it was scheduled into.
 class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
     SamplerCollector()
-        : _created(false)
+        : _group(NULL)
+        , _index(0)
+        , _created(false)
         , _stop(false)
         , _cumulated_time_us(0) {
-        create_sampling_thread();
     }
     ~SamplerCollector() {
         if (_created) {
@@ -76,36 +85,31 @@ public:
         }
     }
 
-private:
-    // Support for fork:
-    // * The singleton can be null before forking, the child callback will not
-    //   be registered.
-    // * If the singleton is not null before forking, the child callback will
-    //   be registered and the sampling thread will be re-created.
-    // * A forked program can be forked again.
+    // Called once by SamplerCollectorGroup after this collector knows its
+    // position in the group.
+    void start(SamplerCollectorGroup* group, size_t index) {
+        _group = group;
+        _index = index;
+        create_sampling_thread();
+    }
 
-    static void child_callback_atfork() {
-        butil::get_leaky_singleton<SamplerCollector>()->after_forked_as_child();
+    void after_forked_as_child() {
+        _created = false;
+        create_sampling_thread();
     }
 
+    int64_t cumulated_time_us() const { return _cumulated_time_us; }
+
+private:
     void create_sampling_thread() {
         const int rc = pthread_create(&_tid, NULL, sampling_thread, this);
         if (rc != 0) {
             LOG(FATAL) << "Fail to create sampling_thread, " << berror(rc);
         } else {
             _created = true;
-            if (!registered_atfork) {
-                registered_atfork = true;
-                pthread_atfork(NULL, NULL, child_callback_atfork);
-            }
         }
     }
 
-    void after_forked_as_child() {
-        _created = false;
-        create_sampling_thread();
-    }
-
     void run();
 
     static void* sampling_thread(void* arg) {
@@ -114,17 +118,81 @@ private:
         return NULL;
     }
 
-    static double get_cumulated_time(void* arg) {
-        return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
-    }
-
 private:
+    SamplerCollectorGroup* _group;
+    size_t _index;
     bool _created;
     bool _stop;
     int64_t _cumulated_time_us;
     pthread_t _tid;
 };
 
+DEFINE_int32(bvar_sampler_thread_num, 1,
+             "Number of threads walking scheduled samplers. Read once when "
+             "the first sampler is scheduled, changes afterwards are ignored");
+
+// Owns all SamplerCollector partitions. schedule() spreads samplers over
+// partitions round-robinly so that the per-second walk is parallelized and
+// each walk stays short enough to keep window boundaries accurate.
+class SamplerCollectorGroup {
+public:
+    SamplerCollectorGroup() : _round(0) {
+        int nshard = FLAGS_bvar_sampler_thread_num;
+        if (nshard < 1) {
+            LOG(ERROR) << "Invalid bvar_sampler_thread_num=" << nshard
+                       << ", changed to 1";
+            nshard = 1;
+        }
+        _nshard = nshard;
+        _collectors = new SamplerCollector[_nshard];
+        for (size_t i = 0; i < _nshard; ++i) {
+            _collectors[i].start(this, i);
+        }
+        if (!registered_atfork) {
+            registered_atfork = true;
+            pthread_atfork(NULL, NULL, child_callback_atfork);
+        }
+    }
+    // This object is a leaky singleton and never destructed.
+
+    SamplerCollector* next_collector() {
+        return &_collectors[_round.fetch_add(1, butil::memory_order_relaxed)
+                            % _nshard];
+    }
+
+    static double get_cumulated_time(void* arg) {
+        SamplerCollectorGroup* g = static_cast<SamplerCollectorGroup*>(arg);
+        int64_t sum = 0;
+        for (size_t i = 0; i < g->_nshard; ++i) {
+            sum += g->_collectors[i].cumulated_time_us();
+        }
+        return sum / 1000.0 / 1000.0;
+    }
+
+private:
+    // Support for fork:
+    // * The singleton can be null before forking, the child callback will not
+    //   be registered.
+    // * If the singleton is not null before forking, the child callback will
+    //   be registered and the sampling threads will be re-created.
+    // * A forked program can be forked again.
+
+    static void child_callback_atfork() {
+        butil::get_leaky_singleton<SamplerCollectorGroup>()
+            ->after_forked_as_child();
+    }
+
+    void after_forked_as_child() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            _collectors[i].after_forked_as_child();
+        }
+    }
+
+    size_t _nshard;
+    butil::atomic<size_t> _round;
+    SamplerCollector* _collectors;
+};
+
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
@@ -132,23 +200,37 @@ static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bv
 
 DEFINE_int32(bvar_sampler_thread_start_delay_us, 10000, "bvar sampler thread start delay us");
 
+// The timestamp shared by all take_sample() in one collection pass, so that
+// samples of the same pass stamp the same window boundary instead of
+// drifting by the time of walking earlier samplers in the list.
+static __thread int64_t tls_sampling_time_us = 0;
+
+int64_t sampling_time_us() {
+    const int64_t ts = tls_sampling_time_us;
+    return ts != 0 ? ts : butil::gettimeofday_us();
+}
+
 void SamplerCollector::run() {
     ::usleep(FLAGS_bvar_sampler_thread_start_delay_us);
-    
+
 #ifndef UNIT_TEST
     // NOTE:
     // * Following vars can't be created on thread's stack since this thread
     //   may be abandoned at any time after forking.
-    // * They can't created inside the constructor of SamplerCollector as well,
-    //   which results in deadlock.
-    if (s_cumulated_time_bvar == NULL) {
-        s_cumulated_time_bvar =
-            new PassiveStatus<double>(get_cumulated_time, this);
-    }
-    if (s_sampling_thread_usage_bvar == NULL) {
-        s_sampling_thread_usage_bvar =
-            new bvar::PerSecond<bvar::PassiveStatus<double> >(
-                    "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
+    // * They can't created inside the constructor of SamplerCollectorGroup as
+    //   well, which results in deadlock.
+    // * Only created by the first collector to keep the bvar names unique;
+    //   they cover all collectors of the group.
+    if (_index == 0) {
+        if (s_cumulated_time_bvar == NULL) {
+            s_cumulated_time_bvar = new PassiveStatus<double>(
+                    SamplerCollectorGroup::get_cumulated_time, _group);
+        }
+        if (s_sampling_thread_usage_bvar == NULL) {
+            s_sampling_thread_usage_bvar =
+                new bvar::PerSecond<bvar::PassiveStatus<double> >(
+                        "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
+        }
     }
 #endif
 
@@ -156,6 +238,7 @@ void SamplerCollector::run() {
     int consecutive_nosleep = 0;
     while (!_stop) {
         int64_t abstime = butil::gettimeofday_us();
+        tls_sampling_time_us = abstime;
         Sampler* s = this->reset();
         if (s) {
             s->InsertBeforeAsList(&root);
@@ -203,10 +286,11 @@ Sampler::~Sampler() {}
 DEFINE_bool(bvar_enable_sampling, true, "is enable bvar sampling");
 
 void Sampler::schedule() {
-    // since the SamplerCollector is initialized before the program starts
-    // flags will not take effect if used in the SamplerCollector constructor
+    // since the SamplerCollectorGroup is initialized before the program starts
+    // flags will not take effect if used in the SamplerCollectorGroup constructor
     if (FLAGS_bvar_enable_sampling) {
-        *butil::get_leaky_singleton<SamplerCollector>() << this;
+        *butil::get_leaky_singleton<SamplerCollectorGroup>()->next_collector()
+            << this;
     }
 }
 
@@ -32,6 +32,11 @@
 namespace bvar {
 namespace detail {
 
+// Returns the timestamp shared by all take_sample() calls in the current
+// collection pass when called from a sampling thread, otherwise returns
+// butil::gettimeofday_us(). Defined in sampler.cpp.
+int64_t sampling_time_us();
+
 template <typename T>
 struct Sample {
     T data;
@@ -136,7 +141,7 @@ public:
             // get_value() of _reducer can still be called.
             latest.data = _reducer->get_value();
         }
-        latest.time_us = butil::gettimeofday_us();
+        latest.time_us = sampling_time_us();
         _q.elim_push(latest);
     }
 
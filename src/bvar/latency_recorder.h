@@ -20,10 +20,14 @@
 #ifndef  BVAR_LATENCY_RECORDER_H
 #define  BVAR_LATENCY_RECORDER_H
 
+#include <memory>
+#include "butil/atomicops.h"
+#include "butil/synchronization/lock.h"
 #include "bvar/recorder.h"
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/ddsketch.h"
 
 namespace bvar {
 namespace detail {
@@ -32,41 +36,83 @@ class Percentile;
 typedef Window<IntRecorder, SERIES_IN_SECOND> RecorderWindow;
 typedef Window<Maxer<int64_t>, SERIES_IN_SECOND> MaxWindow;
 typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
+typedef Window<DDSketchPercentile, SERIES_IN_SECOND> DDSketchPercentileWindow;
 
 // NOTE: Always use int64_t in the interfaces no matter what the impl. is.
 
 class CDF : public Variable {
 public:
     explicit CDF(PercentileWindow* w);
+    CDF(PercentileWindow* w, DDSketchPercentileWindow* dw);
     ~CDF();
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
-    PercentileWindow* _w; 
+    PercentileWindow* _w;
+    // Used instead of _w when the owning recorder uses ddsketch.
+    DDSketchPercentileWindow* _dw;
 };
 
 // For mimic constructor inheritance.
 class LatencyRecorderBase {
 public:
-    explicit LatencyRecorderBase(time_t window_size);
-    time_t window_size() const { return _latency_window.window_size(); }
+    explicit LatencyRecorderBase(time_t window_size, bool use_ddsketch = false);
+    ~LatencyRecorderBase();
+    time_t window_size() const { return _window_size; }
 protected:
+    // Sub-bvars derived from _latency: windows, percentiles, qps and max.
+    // Each recorder owns ~10 of them while a rarely-called method only
+    // ever writes _latency, so they're materialized on the first recorded
+    // latency instead of in the ctor, keeping recorders of idle methods
+    // out of the registry and the per-second sampler pass.
+    struct LazyVars {
+        LazyVars(IntRecorder* latency, time_t window_size,
+                 bool use_ddsketch, void* owner);
+        // Expose all sub-bvars with `prefix'. Returns 0 on success.
+        int expose(const butil::StringPiece& prefix);
+        void hide();
+
+        Maxer<int64_t> max_latency;
+        Percentile latency_percentile;
+        RecorderWindow latency_window;
+        MaxWindow max_latency_window;
+        PassiveStatus<int64_t> count;
+        PassiveStatus<int64_t> qps;
+        PercentileWindow latency_percentile_window;
+        // DDSketch backend for percentiles, only created when the recorder
+        // is constructed with use_ddsketch=true, in which case it replaces
+        // latency_percentile as the source of all *-ile bvars.
+        std::unique_ptr<DDSketchPercentile> latency_ddsketch;
+        std::unique_ptr<DDSketchPercentileWindow> latency_ddsketch_window;
+        PassiveStatus<int64_t> latency_p1;
+        PassiveStatus<int64_t> latency_p2;
+        PassiveStatus<int64_t> latency_p3;
+        PassiveStatus<int64_t> latency_999;  // 99.9%
+        PassiveStatus<int64_t> latency_9999; // 99.99%
+        CDF latency_cdf;
+        PassiveStatus<Vector<int64_t, 4> > latency_percentiles;
+    };
+
+    // Get the sub-bvars, materializing(and exposing) them at first call.
+    LazyVars* get_or_create_vars();
+    // May be NULL before the first latency is recorded.
+    LazyVars* vars() const
+    { return _lazy_vars.load(butil::memory_order_acquire); }
+
     IntRecorder _latency;
-    Maxer<int64_t> _max_latency;
-    Percentile _latency_percentile;
-
-    RecorderWindow _latency_window;
-    MaxWindow _max_latency_window;
-    PassiveStatus<int64_t> _count;
-    PassiveStatus<int64_t> _qps;
-    PercentileWindow _latency_percentile_window;
-    PassiveStatus<int64_t> _latency_p1;
-    PassiveStatus<int64_t> _latency_p2;
-    PassiveStatus<int64_t> _latency_p3;
-    PassiveStatus<int64_t> _latency_999;  // 99.9%
-    PassiveStatus<int64_t> _latency_9999; // 99.99%
-    CDF _latency_cdf;
-    PassiveStatus<Vector<int64_t, 4> > _latency_percentiles;
+    time_t _window_size;
+    bool _use_ddsketch;
+    butil::atomic<LazyVars*> _lazy_vars;
+    butil::Mutex _vars_mutex;  // serializes materialization with expose/hide.
+    std::string _exposed_prefix;  // non-empty when exposed.
+    // Names of sub-bvars, kept here so that they're readable even before
+    // the sub-bvars are materialized.
+    std::string _latency_name;
+    std::string _max_latency_name;
+    std::string _count_name;
+    std::string _qps_name;
+    std::string _latency_cdf_name;
+    std::string _latency_percentiles_name;
 };
 } // namespace detail
 
@@ -77,6 +123,17 @@ class LatencyRecorder : public detail::LatencyRecorderBase {
 public:
     LatencyRecorder() : Base(-1) {}
     explicit LatencyRecorder(time_t window_size) : Base(window_size) {}
+    // When |use_ddsketch| is true, percentiles (p1/p2/p3/999/9999, cdf and
+    // latency_percentiles) are computed from a DDSketch instead of interval
+    // sampling: O(1) insert, cheap bucket-wise merges and tail quantiles
+    // with a bounded relative error (detail::DDSKETCH_ALPHA).
+    LatencyRecorder(time_t window_size, bool use_ddsketch)
+        : Base(window_size, use_ddsketch) {}
+    LatencyRecorder(const butil::StringPiece& prefix,
+                    time_t window_size, bool use_ddsketch)
+        : Base(window_size, use_ddsketch) {
+        expose(prefix);
+    }
     explicit LatencyRecorder(const butil::StringPiece& prefix) : Base(-1) {
         expose(prefix);
     }
@@ -98,7 +155,7 @@ public:
 
     // Record the latency.
     LatencyRecorder& operator<<(int64_t latency);
-        
+
     // Expose all internal variables using `prefix' as prefix.
     // Returns 0 on success, -1 otherwise.
     // Example:
@@ -116,22 +173,29 @@ public:
     }
     int expose(const butil::StringPiece& prefix1,
                const butil::StringPiece& prefix2);
-    
+
     // Hide all internal variables, called in dtor as well.
     void hide();
 
     // Get the average latency in recent |window_size| seconds
     // If |window_size| is absent, use the window_size to ctor.
-    int64_t latency(time_t window_size) const
-    { return _latency_window.get_value(window_size).get_average_int(); }
-    int64_t latency() const
-    { return _latency_window.get_value().get_average_int(); }
+    int64_t latency(time_t window_size) const {
+        detail::LatencyRecorderBase::LazyVars* v = vars();
+        return v ? v->latency_window.get_value(window_size).get_average_int() : 0;
+    }
+    int64_t latency() const {
+        detail::LatencyRecorderBase::LazyVars* v = vars();
+        return v ? v->latency_window.get_value().get_average_int() : 0;
+    }
 
     // Get p1/p2/p3/99.9-ile latencies in recent window_size-to-ctor seconds.
     Vector<int64_t, 4> latency_percentiles() const;
 
     // Get the max latency in recent window_size-to-ctor seconds.
-    int64_t max_latency() const { return _max_latency_window.get_value(); }
+    int64_t max_latency() const {
+        detail::LatencyRecorderBase::LazyVars* v = vars();
+        return v ? v->max_latency_window.get_value() : 0;
+    }
 
     // Get the total number of recorded latencies.
     int64_t count() const { return _latency.get_value().num; }
@@ -140,21 +204,26 @@ public:
     // recorded by operator<<().
     // If |window_size| is absent, use the window_size to ctor.
     int64_t qps(time_t window_size) const;
-    int64_t qps() const { return _qps.get_value(); }
+    int64_t qps() const {
+        detail::LatencyRecorderBase::LazyVars* v = vars();
+        return v ? v->qps.get_value() : 0;
+    }
 
     // Get |ratio|-ile latency in recent |window_size| seconds
     // E.g. 0.99 means 99%-ile
     int64_t latency_percentile(double ratio) const;
 
+    // True if percentiles are backed by a DDSketch.
+    bool use_ddsketch() const { return _use_ddsketch; }
+
     // Get name of a sub-bvar.
-    const std::string& latency_name() const { return _latency_window.name(); }
+    const std::string& latency_name() const { return _latency_name; }
     const std::string& latency_percentiles_name() const
-    { return _latency_percentiles.name(); }
-    const std::string& latency_cdf_name() const { return _latency_cdf.name(); }
-    const std::string& max_latency_name() const
-    { return _max_latency_window.name(); }
-    const std::string& count_name() const { return _count.name(); }
-    const std::string& qps_name() const { return _qps.name(); }
+    { return _latency_percentiles_name; }
+    const std::string& latency_cdf_name() const { return _latency_cdf_name; }
+    const std::string& max_latency_name() const { return _max_latency_name; }
+    const std::string& count_name() const { return _count_name; }
+    const std::string& qps_name() const { return _qps_name; }
 };
 
 std::ostream& operator<<(std::ostream& os, const LatencyRecorder&);
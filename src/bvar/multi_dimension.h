@@ -20,6 +20,8 @@
 #ifndef BVAR_MULTI_DIMENSION_H
 #define BVAR_MULTI_DIMENSION_H
 
+#include <unordered_map>
+#include "butil/atomicops.h"                         // butil::atomic
 #include "butil/logging.h"                           // LOG
 #include "butil/macros.h"                            // BAIDU_CASSERT
 #include "butil/scoped_lock.h"                       // BAIDU_SCOPE_LOCK
@@ -183,18 +185,49 @@ private:
 
     template <typename K>
     bool is_valid_lables_value(const K& labels_value) const;
-    
+
     // Remove all stats so those not count and dump
     void delete_stats();
 
+    // Per-thread cache of recently used metrics, so that emitting to a
+    // hot label set costs a hash plus the metric operation instead of a
+    // doubly-buffered map read. Entries are keyed by the label hash and
+    // validated against the stored labels and _delete_seq.
+    struct CachedMetric {
+        key_type labels;
+        op_value_type metric;
+    };
+    struct LabelCache {
+        butil::FlatMap<size_t, CachedMetric> map;
+        uint64_t delete_seq;
+    };
+
+    // Get the calling thread's cache for this instance, creating it on
+    // first use. Return NULL if creation failed.
+    LabelCache* get_tls_label_cache();
+
+    template <typename K>
+    T* seek_tls_label_cache(LabelCache* cache, const K& labels_value,
+                            size_t labels_hash) const;
+
+    template <typename K>
+    void update_tls_label_cache(LabelCache* cache, const K& labels_value,
+                                size_t labels_hash, op_value_type metric);
+
     void set_max_stats_count(size_t max_stats_count) {
         _max_stats_count = max_stats_count;
     }
     
     static size_t init_flatmap(MetricMap& bg);
-    
+
     size_t _max_stats_count;
     MetricMapDBD _metric_map;
+    // Never-reused id identifying this instance in thread local caches,
+    // so that a new instance at the address of a destroyed one can not
+    // hit the stale cache entries.
+    const uint64_t _instance_id;
+    // Bumped on every deletion to invalidate thread local caches.
+    butil::atomic<uint64_t> _delete_seq;
 };
 
 } // namespace bvar
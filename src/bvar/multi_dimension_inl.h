@@ -34,10 +34,18 @@ static const std::string ALLOW_UNUSED METRIC_TYPE_SUMMARY = "summary";
 static const std::string ALLOW_UNUSED METRIC_TYPE_HISTOGRAM = "histogram";
 static const std::string ALLOW_UNUSED METRIC_TYPE_GAUGE = "gauge";
 
+// Generate never-reused ids keying thread local label caches
+inline uint64_t new_multi_dimension_instance_id() {
+    static butil::atomic<uint64_t> s_id(0);
+    return s_id.fetch_add(1, butil::memory_order_relaxed) + 1;
+}
+
 template <typename T, typename KeyType>
 MultiDimension<T, KeyType>::MultiDimension(const key_type& labels)
     : Base(labels)
-    , _max_stats_count(FLAGS_max_multi_dimension_stats_count) {
+    , _max_stats_count(FLAGS_max_multi_dimension_stats_count)
+    , _instance_id(new_multi_dimension_instance_id())
+    , _delete_seq(0) {
     _metric_map.Modify(init_flatmap);
 }
 
@@ -79,6 +87,61 @@ size_t MultiDimension<T, KeyType>::count_stats() {
     return metric_map_ptr->size();
 }
 
+template <typename T, typename KeyType>
+typename MultiDimension<T, KeyType>::LabelCache*
+MultiDimension<T, KeyType>::get_tls_label_cache() {
+    // Caches of destroyed instances can never be hit (ids are not
+    // reused), they are only dropped wholesale once the map grows big.
+    thread_local std::unordered_map<uint64_t, LabelCache> tls_caches;
+    if (tls_caches.size() >= 64 &&
+        tls_caches.find(_instance_id) == tls_caches.end()) {
+        tls_caches.clear();
+    }
+    LabelCache& cache = tls_caches[_instance_id];
+    if (!cache.map.initialized()) {
+        if (cache.map.init(256, 80) != 0) {
+            return NULL;
+        }
+        cache.delete_seq = _delete_seq.load(butil::memory_order_acquire);
+    }
+    return &cache;
+}
+
+template <typename T, typename KeyType>
+template <typename K>
+T* MultiDimension<T, KeyType>::seek_tls_label_cache(
+        LabelCache* cache, const K& labels_value, size_t labels_hash) const {
+    const uint64_t seq = _delete_seq.load(butil::memory_order_acquire);
+    if (cache->delete_seq != seq) {
+        // Some stats were deleted, the cached pointers may dangle
+        cache->map.clear();
+        cache->delete_seq = seq;
+        return nullptr;
+    }
+    CachedMetric* entry = cache->map.seek(labels_hash);
+    if (entry != NULL && KeyEqualTo()(entry->labels, labels_value)) {
+        return entry->metric;
+    }
+    return nullptr;
+}
+
+template <typename T, typename KeyType>
+template <typename K>
+void MultiDimension<T, KeyType>::update_tls_label_cache(
+        LabelCache* cache, const K& labels_value, size_t labels_hash,
+        op_value_type metric) {
+    if (cache->map.size() >= 1024) {
+        cache->map.clear();
+    }
+    CachedMetric entry;
+    for (auto& label : labels_value) {
+        // key_type::value_type must be able to convert to std::string.
+        entry.labels.push_back(std::string(label));
+    }
+    entry.metric = metric;
+    cache->map.insert(labels_hash, entry);
+}
+
 template <typename T, typename KeyType>
 template <typename K>
 void MultiDimension<T, KeyType>::delete_stats(const K& labels_value) {
@@ -93,6 +156,10 @@ void MultiDimension<T, KeyType>::delete_stats(const K& labels_value) {
         };
         _metric_map.Modify(erase_fn);
         if (tmp_metric) {
+            // Invalidate thread local caches before the object dies.
+            // As with the doubly-buffered map itself, pointers already
+            // returned to callers are not protected against deletion.
+            _delete_seq.fetch_add(1, butil::memory_order_release);
             delete tmp_metric;
         }
     }
@@ -115,6 +182,8 @@ void MultiDimension<T, KeyType>::delete_stats() {
     };
     int ret = _metric_map.Modify(clear_fn);
     CHECK_EQ(1, ret);
+    // Invalidate thread local caches before the objects die
+    _delete_seq.fetch_add(1, butil::memory_order_release);
     for (auto &kv : tmp_map) {
         delete kv.second;
     }
@@ -163,6 +232,14 @@ T* MultiDimension<T, KeyType>::get_stats_impl(
     if (!is_valid_lables_value(labels_value)) {
         return nullptr;
     }
+    const size_t labels_hash = KeyHash()(labels_value);
+    LabelCache* cache = get_tls_label_cache();
+    if (NULL != cache) {
+        T* cached = seek_tls_label_cache(cache, labels_value, labels_hash);
+        if (nullptr != cached) {
+            return cached;
+        }
+    }
     {
         MetricMapScopedPtr metric_map_ptr;
         if (0 != _metric_map.Read(&metric_map_ptr)) {
@@ -172,6 +249,9 @@ T* MultiDimension<T, KeyType>::get_stats_impl(
 
         auto it = metric_map_ptr->seek(labels_value);
         if (NULL != it) {
+            if (NULL != cache) {
+                update_tls_label_cache(cache, labels_value, labels_hash, *it);
+            }
             return (*it);
         } else if (READ_ONLY == stats_op) {
             return nullptr;
@@ -205,6 +285,9 @@ T* MultiDimension<T, KeyType>::get_stats_impl(
         return 1;
     };
     _metric_map.Modify(insert_fn);
+    if (NULL != cache && NULL != cache_metric) {
+        update_tls_label_cache(cache, labels_value, labels_hash, cache_metric);
+    }
     return cache_metric;
 }
 
@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef  BVAR_PERCPU_ADDER_H
+#define  BVAR_PERCPU_ADDER_H
+
+#include "bvar/reducer.h"                      // AddTo, MinusFrom
+#include "bvar/detail/percpu_counter.h"
+
+namespace bvar {
+
+// An integral adder backed by per-CPU slots instead of the per-thread
+// agents of Adder<T>. Writing is a single increment onto the slot of the
+// running CPU without thread-local agent lookup, and reading sums up a
+// fixed ncpu-sized array instead of walking a mutex-guarded agent list
+// whose size grows with threads, so both the hot path and the per-second
+// sampler pass stay cheap regardless of how many threads write.
+// Prefer this over Adder<int64_t> for extremely hot counters in processes
+// with many threads; semantics are identical otherwise.
+//
+// bvar::PerCpuAdder sum;
+// sum << 1 << 2 << 3;
+// LOG(INFO) << sum.get_value();  // 6
+class PerCpuAdder : public Variable {
+public:
+    typedef int64_t value_type;
+    typedef detail::ReducerSampler<PerCpuAdder, int64_t, detail::AddTo<int64_t>,
+                                   detail::MinusFrom<int64_t> > sampler_type;
+
+    PerCpuAdder() : _sampler(NULL) {}
+    explicit PerCpuAdder(const butil::StringPiece& name) : _sampler(NULL) {
+        expose(name);
+    }
+    PerCpuAdder(const butil::StringPiece& prefix,
+                const butil::StringPiece& name) : _sampler(NULL) {
+        expose_as(prefix, name);
+    }
+    ~PerCpuAdder() override {
+        // Calling hide() manually is a MUST required by Variable.
+        hide();
+        if (_sampler) {
+            _sampler->destroy();
+            _sampler = NULL;
+        }
+    }
+
+    // Add a value.
+    // Returns self reference for chaining.
+    PerCpuAdder& operator<<(int64_t value) {
+        _counter.add(value);
+        return *this;
+    }
+
+    // Get the sum. Unlike Reducer::get_value() this only reads a fixed
+    // number of slots and is cheap to call frequently.
+    int64_t get_value() const { return _counter.sum(); }
+
+    // Reset the value to 0.
+    // Returns the value before reset.
+    int64_t reset() { return _counter.reset(); }
+
+    void describe(std::ostream& os, bool /*quote_string*/) const override {
+        os << get_value();
+    }
+
+#ifdef BAIDU_INTERNAL
+    void get_value(boost::any* value) const override { *value = get_value(); }
+#endif
+
+    // True if this adder is constructed successfully.
+    bool valid() const { return _counter.valid(); }
+
+    detail::AddTo<int64_t> op() const { return detail::AddTo<int64_t>(); }
+    detail::MinusFrom<int64_t> inv_op() const {
+        return detail::MinusFrom<int64_t>();
+    }
+
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+private:
+    detail::PerCpuCounter _counter;
+    sampler_type* _sampler;
+};
+
+}  // namespace bvar
+
+#endif  // BVAR_PERCPU_ADDER_H
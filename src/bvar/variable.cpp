@@ -74,8 +74,11 @@ typedef butil::FlatMap<std::string, VarEntry> VarMap;
 
 struct VarMapWithLock : public VarMap {
     pthread_mutex_t mutex;
+    // Bumped on every insertion/erasure(under mutex), checked by the
+    // sorted-snapshot cache below to re-sort only churned sub maps.
+    size_t version;
 
-    VarMapWithLock() {
+    VarMapWithLock() : version(0) {
         if (init(1024) != 0) {
             LOG(WARNING) << "Fail to init VarMap";
         }
@@ -162,6 +165,7 @@ int Variable::expose_impl(const butil::StringPiece& prefix,
             entry = &m[_name];
             entry->var = this;
             entry->display_filter = display_filter;
+            ++m.version;
             return 0;
         }
     }
@@ -193,6 +197,7 @@ bool Variable::hide() {
     VarEntry* entry = m.seek(_name);
     if (entry) {
         CHECK_EQ(1UL, m.erase(_name));
+        ++m.version;
     } else {
         CHECK(false) << "`" << _name << "' must exist";
     }
@@ -245,6 +250,102 @@ size_t Variable::count_exposed() {
     return n;
 }
 
+// Cache of exposed names in sorted order, refreshed incrementally:
+// expose()/hide() just bump the version of their sub map and never touch
+// the cache, dumpers re-sort only the sub maps whose version changed
+// since the last dump and k-way merge the per-map sorted lists. With many
+// variables and moderate churn(e.g. per-connection bvars of sockets) this
+// replaces the full sort of all names on every dump.
+struct SortedNamesCache {
+    typedef std::pair<std::string, DisplayFilter> NamedFilter;
+    pthread_mutex_t mutex;
+    size_t versions[SUB_MAP_COUNT];
+    std::vector<NamedFilter> sub_names[SUB_MAP_COUNT];
+    std::vector<NamedFilter> merged;
+    bool merged_valid;
+
+    SortedNamesCache() : merged_valid(false) {
+        pthread_mutex_init(&mutex, NULL);
+        for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+            versions[i] = (size_t)-1;
+        }
+    }
+};
+
+static pthread_once_t s_sorted_names_once = PTHREAD_ONCE_INIT;
+static SortedNamesCache* s_sorted_names = NULL;
+
+static void init_sorted_names() {
+    s_sorted_names = new SortedNamesCache;
+}
+
+static bool name_filter_less(const SortedNamesCache::NamedFilter& lhs,
+                             const SortedNamesCache::NamedFilter& rhs) {
+    return lhs.first < rhs.first;
+}
+
+// List exposed variables in ascending order of name through the cache
+// above. Holds each sub map mutex only while copying out a changed map.
+static void list_exposed_sorted(std::vector<std::string>* names,
+                                DisplayFilter display_filter) {
+    pthread_once(&s_sorted_names_once, init_sorted_names);
+    SortedNamesCache& cache = *s_sorted_names;
+    VarMapWithLock* var_maps = get_var_maps();
+    BAIDU_SCOPED_LOCK(cache.mutex);
+    for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+        VarMapWithLock& m = var_maps[i];
+        std::vector<SortedNamesCache::NamedFilter>& sub = cache.sub_names[i];
+        {
+            BAIDU_SCOPED_LOCK(m.mutex);
+            if (m.version == cache.versions[i]) {
+                continue;
+            }
+            sub.clear();
+            sub.reserve(m.size());
+            for (VarMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+                sub.push_back(std::make_pair(it->first,
+                                             it->second.display_filter));
+            }
+            cache.versions[i] = m.version;
+        }
+        std::sort(sub.begin(), sub.end(), name_filter_less);
+        cache.merged_valid = false;
+    }
+    if (!cache.merged_valid) {
+        size_t total = 0;
+        size_t pos[SUB_MAP_COUNT];
+        for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+            total += cache.sub_names[i].size();
+            pos[i] = 0;
+        }
+        cache.merged.clear();
+        cache.merged.reserve(total);
+        for (;;) {
+            size_t best = SUB_MAP_COUNT;
+            for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+                if (pos[i] < cache.sub_names[i].size() &&
+                    (best == SUB_MAP_COUNT ||
+                     cache.sub_names[i][pos[i]].first <
+                     cache.sub_names[best][pos[best]].first)) {
+                    best = i;
+                }
+            }
+            if (best == SUB_MAP_COUNT) {
+                break;
+            }
+            cache.merged.push_back(cache.sub_names[best][pos[best]++]);
+        }
+        cache.merged_valid = true;
+    }
+    names->clear();
+    names->reserve(cache.merged.size());
+    for (size_t i = 0; i < cache.merged.size(); ++i) {
+        if (cache.merged[i].second & display_filter) {
+            names->push_back(cache.merged[i].first);
+        }
+    }
+}
+
 int Variable::describe_exposed(const std::string& name, std::ostream& os,
                                bool quote_string,
                                DisplayFilter display_filter) {
@@ -505,11 +606,11 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
             }
         }
     } else {
-        // Have to iterate all variables.
+        // Have to iterate all variables. The names are sorted(for
+        // readability) by the incrementally refreshed cache rather than
+        // being re-sorted from scratch on every dump.
         std::vector<std::string> varnames;
-        bvar::Variable::list_exposed(&varnames, opt.display_filter);
-        // Sort the names to make them more readable.
-        std::sort(varnames.begin(), varnames.end());
+        list_exposed_sorted(&varnames, opt.display_filter);
         for (std::vector<std::string>::const_iterator
                  it = varnames.begin(); it != varnames.end(); ++it) {
             const std::string& name = *it;
@@ -66,7 +66,8 @@ Json2PbOptions::Json2PbOptions()
     : base64_to_bytes(true)
 #endif
     , array_to_single_repeated(false)
-    , allow_remaining_bytes_after_parsing(false) {
+    , allow_remaining_bytes_after_parsing(false)
+    , insitu_parsing(false) {
 }
 
 enum MatchType { 
@@ -614,7 +615,39 @@ bool JsonValueToProtoMessage(const BUTIL_RAPIDJSON_NAMESPACE::Value& json_value,
     return true;
 }
 
-inline bool JsonToProtoMessageInline(const std::string& json_string, 
+// Parse `mutable_json'(NUL-terminated) destructively with kParseInsituFlag:
+// unescaped strings are written back into the buffer and the DOM references
+// them instead of copying, saving one allocation plus one copy per string.
+// `mutable_json' must remain valid until the conversion is done, which is
+// guaranteed here since the callers keep the buffer on their stacks.
+static bool InsituJsonToProtoMessage(char* mutable_json,
+                                     google::protobuf::Message* message,
+                                     const Json2PbOptions& options,
+                                     std::string* error,
+                                     size_t* parsed_offset) {
+    BUTIL_RAPIDJSON_NAMESPACE::Document d;
+    if (options.allow_remaining_bytes_after_parsing) {
+        d.ParseInsitu<BUTIL_RAPIDJSON_NAMESPACE::kParseStopWhenDoneFlag>(mutable_json);
+        if (parsed_offset != nullptr) {
+            *parsed_offset = d.GetErrorOffset();
+        }
+    } else {
+        d.ParseInsitu<0>(mutable_json);
+    }
+    if (d.HasParseError()) {
+        if (options.allow_remaining_bytes_after_parsing &&
+            d.GetParseError() == BUTIL_RAPIDJSON_NAMESPACE::kParseErrorDocumentEmpty) {
+            // This is usual when parsing multiple jsons, don't waste time
+            // on setting the `empty error'
+            return false;
+        }
+        J2PERROR_WITH_PB(message, error, "Invalid json: %s", BUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
+        return false;
+    }
+    return JsonValueToProtoMessage(d, message, options, error, true);
+}
+
+inline bool JsonToProtoMessageInline(const std::string& json_string,
                         google::protobuf::Message* message,
                         const Json2PbOptions& options,
                         std::string* error,
@@ -622,6 +655,12 @@ inline bool JsonToProtoMessageInline(const std::string& json_string,
     if (error) {
         error->clear();
     }
+    if (options.insitu_parsing) {
+        // The caller's string must not be modified, parse a copy in-situ.
+        std::string mutable_json(json_string);
+        return InsituJsonToProtoMessage(&mutable_json[0], message, options,
+                                        error, parsed_offset);
+    }
     BUTIL_RAPIDJSON_NAMESPACE::Document d;
     if (options.allow_remaining_bytes_after_parsing) {
         d.Parse<BUTIL_RAPIDJSON_NAMESPACE::kParseStopWhenDoneFlag>(json_string.c_str());
@@ -658,6 +697,23 @@ bool JsonToProtoMessage(google::protobuf::io::ZeroCopyInputStream* stream,
                         const Json2PbOptions& options,
                         std::string* error,
                         size_t* parsed_offset) {
+    if (options.insitu_parsing) {
+        if (error) {
+            error->clear();
+        }
+        // Gather the stream into one mutable buffer(bulk copies of whole
+        // blocks), then parse it in-situ which avoids the per-string
+        // copies of DOM parsing and enables the SIMD whitespace skipping
+        // of contiguous input.
+        std::string mutable_json;
+        const void* data = NULL;
+        int size = 0;
+        while (stream->Next(&data, &size)) {
+            mutable_json.append((const char*)data, size);
+        }
+        return InsituJsonToProtoMessage(&mutable_json[0], message, options,
+                                        error, parsed_offset);
+    }
     ZeroCopyStreamReader reader(stream);
     return JsonToProtoMessage(&reader, message, options, error, parsed_offset);
 }
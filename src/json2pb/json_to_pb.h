@@ -42,6 +42,14 @@ struct Json2PbOptions {
     // Allow more bytes remaining in the input after parsing the first json
     // object. Useful when the input contains more than one json object.
     bool allow_remaining_bytes_after_parsing;
+
+    // Parse the json in-situ: the input is copied into a contiguous mutable
+    // buffer once and string values point into that buffer directly instead
+    // of being duplicated inside the DOM, which is noticeably faster on
+    // string-heavy jsons. The ZeroCopyStreamReader overload ignores this
+    // option since the reader may be reused between calls.
+    // Default: false.
+    bool insitu_parsing;
 };
 
 // Convert `json' to protobuf `message' according to `options'.
@@ -297,6 +297,27 @@ bool PbToJsonConverter::_PbFieldToJson(
     return true;
 }
 
+// Feeds writer output straight into a std::string, saving the copy through
+// rapidjson::StringBuffer that the string overload of ProtoMessageToJson
+// used to make.
+class StringWriter {
+public:
+    typedef char Ch;
+    explicit StringWriter(std::string* out) : _out(out) {}
+    void Put(char c) { _out->push_back(c); }
+    void PutN(char c, size_t n) { _out->append(n, c); }
+    void Puts(const char* str, size_t length) { _out->append(str, length); }
+    void Flush() {}
+    // Never called, writers only output.
+    char Peek() { return 0; }
+    char Take() { return 0; }
+    size_t Tell() { return 0; }
+    char* PutBegin() { return NULL; }
+    size_t PutEnd(char*) { return 0; }
+private:
+    std::string* _out;
+};
+
 template <typename OutputStream>
 bool ProtoMessageToJsonStream(const google::protobuf::Message& message,
                               const Pb2JsonOptions& options,
@@ -321,13 +342,14 @@ bool ProtoMessageToJson(const google::protobuf::Message& message,
                         std::string* json,
                         const Pb2JsonOptions& options,
                         std::string* error) {
-    // TODO(gejun): We could further wrap a std::string as a buffer to reduce
-    // a copying.
-    BUTIL_RAPIDJSON_NAMESPACE::StringBuffer buffer;
-    if (json2pb::ProtoMessageToJsonStream(message, options, buffer, error)) {
-        json->append(buffer.GetString(), buffer.GetSize());
+    const size_t old_size = json->size();
+    StringWriter wrapper(json);
+    if (json2pb::ProtoMessageToJsonStream(message, options, wrapper, error)) {
         return true;
     }
+    // Keep the all-or-nothing semantics of the old StringBuffer-based
+    // implementation.
+    json->resize(old_size);
     return false;
 }
 
@@ -20,6 +20,7 @@
 // Date: Mon Oct 19 17:17:36 CST 2015
 
 #include <gflags/gflags.h>
+#include "butil/containers/doubly_buffered_data.h"
 #include "mcpack2pb/mcpack2pb.h"
 
 DEFINE_bool(mcpack2pb_absent_field_is_error, false, "Parsing fails if the "
@@ -56,4 +57,46 @@ MessageHandler find_message_handler(const std::string& full_name) {
     return null_handler;
 }
 
+// Cache of handlers keyed by Descriptor*, filled lazily from s_handler_map.
+// Descriptors can't key the registration map directly because generated
+// code registers by name before descriptor pools are initialized.
+// Conversion-heavy fronts(ubrpc/nshead+mcpack) fetch the handler on every
+// request, thus the read side is doubly-buffered to be wait-free instead of
+// sharing a rwlock whose cacheline bounces between cores.
+typedef butil::FlatMap<uintptr_t, MessageHandler> DescHandlerMap;
+static pthread_once_t s_init_desc_handler_map_once = PTHREAD_ONCE_INIT;
+static butil::DoublyBufferedData<DescHandlerMap>* s_desc_handler_map = NULL;
+static void init_desc_handler_map() {
+    s_desc_handler_map = new butil::DoublyBufferedData<DescHandlerMap>;
+}
+
+static size_t add_desc_handler(DescHandlerMap& m, uintptr_t key,
+                               const MessageHandler& handler) {
+    if (!m.initialized() && m.init(64, 50) != 0) {
+        LOG(WARNING) << "Fail to init desc handler map";
+        return 0;
+    }
+    m[key] = handler;
+    return 1;
+}
+
+MessageHandler find_message_handler(const ::google::protobuf::Descriptor* desc) {
+    pthread_once(&s_init_desc_handler_map_once, init_desc_handler_map);
+    const uintptr_t key = (uintptr_t)desc;
+    {
+        butil::DoublyBufferedData<DescHandlerMap>::ScopedPtr ptr;
+        if (s_desc_handler_map->Read(&ptr) == 0 && ptr->initialized()) {
+            const MessageHandler* handler = ptr->seek(key);
+            if (handler != NULL) {
+                return *handler;
+            }
+        }
+    }
+    // Not-found results are cached as well(as null handlers) to avoid
+    // repeated name hashing on messages without registered handlers.
+    const MessageHandler result = find_message_handler(desc->full_name());
+    s_desc_handler_map->Modify(add_desc_handler, key, result);
+    return result;
+}
+
 } // namespace mcpack2pb
@@ -108,6 +108,11 @@ void register_message_handler_or_die(const std::string& full_name,
 // If the handler was not registered, function pointers inside are NULL.
 MessageHandler find_message_handler(const std::string& full_name);
 
+// Same as above but keyed by the message descriptor. Results are cached in
+// a registry keyed by Descriptor* so that repeated lookups from protocol
+// code cost a pointer-keyed seek per call instead of hashing the full name.
+MessageHandler find_message_handler(const ::google::protobuf::Descriptor* desc);
+
 // inline impl.
 inline size_t MessageHandler::parse_from_iobuf_prefix(
     ::google::protobuf::Message* msg, const ::butil::IOBuf& buf) {
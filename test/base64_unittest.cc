@@ -24,4 +24,28 @@ TEST(Base64Test, Basic) {
   EXPECT_EQ(kText, decoded);
 }
 
+// Exercises the vectorized kernels with sizes around their block
+// boundaries and checks that invalid characters are still rejected.
+TEST(Base64Test, LongInput) {
+  const size_t kSizes[] = { 0, 1, 11, 12, 15, 16, 23, 24, 31, 32,
+                            47, 48, 63, 64, 100, 1000, 4096, 4097 };
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    std::string data(kSizes[i], 0);
+    for (size_t j = 0; j < data.size(); ++j) {
+      data[j] = (char)(j * 131 + i);
+    }
+    std::string encoded;
+    Base64Encode(data, &encoded);
+    std::string decoded;
+    EXPECT_TRUE(Base64Decode(encoded, &decoded));
+    EXPECT_EQ(data, decoded);
+
+    if (!encoded.empty()) {
+      std::string bad = encoded;
+      bad[bad.size() / 2] = '\n';
+      EXPECT_FALSE(Base64Decode(bad, &decoded));
+    }
+  }
+}
+
 }  // namespace butil
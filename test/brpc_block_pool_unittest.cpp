@@ -163,9 +163,13 @@ TEST_F(BlockPoolTest, memory_not_enough) {
         EXPECT_TRUE(buf[i] != NULL);
     }
     EXPECT_EQ(2, GetRegionNum());
+    // No region can be added, but the idle 8KB tier donates a chunk
+    // instead of failing with ENOMEM.
     void* tmp = AllocBlock(65536);
-    EXPECT_EQ(ENOMEM, errno);
-    EXPECT_EQ(0, GetRegionId(tmp));
+    EXPECT_TRUE(tmp != NULL);
+    EXPECT_EQ(1, GetBlockType(tmp));
+    EXPECT_EQ(2, GetRegionNum());
+    DeallocBlock(tmp);
     for (size_t i = 0; i < num; ++i) {
         DeallocBlock(buf[i]);
     }
@@ -174,6 +178,31 @@ TEST_F(BlockPoolTest, memory_not_enough) {
     DestroyBlockPool();
 }
 
+TEST_F(BlockPoolTest, tier_rebalance) {
+    FLAGS_rdma_memory_pool_initial_size_mb = 64;
+    FLAGS_rdma_memory_pool_increase_size_mb = 64;
+    FLAGS_rdma_memory_pool_max_regions = 1;
+    FLAGS_rdma_memory_pool_buckets = 1;
+    EXPECT_TRUE(InitBlockPool(DummyCallback));
+    EXPECT_EQ(1, GetRegionNum());
+
+    // All the capacity sits idle in the 8KB tier and no region can be
+    // added; large blocks are served by migrating idle chunks.
+    void* buf = AllocBlock(GetBlockSize(2));
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_EQ(2, GetBlockType(buf));
+    EXPECT_EQ(1, GetRegionNum());
+    DeallocBlock(buf);
+
+    // The migrated chunk stays in its new tier once freed.
+    buf = AllocBlock(GetBlockSize(2));
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_EQ(2, GetBlockType(buf));
+    DeallocBlock(buf);
+
+    DestroyBlockPool();
+}
+
 TEST_F(BlockPoolTest, invalid_use) {
     FLAGS_rdma_memory_pool_initial_size_mb = 64;
     FLAGS_rdma_memory_pool_increase_size_mb = 64;
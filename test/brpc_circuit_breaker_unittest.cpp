@@ -56,6 +56,7 @@ DECLARE_int32(circuit_breaker_long_window_error_percent);
 DECLARE_int32(circuit_breaker_min_isolation_duration_ms);
 DECLARE_int32(circuit_breaker_max_isolation_duration_ms);
 DECLARE_int32(circuit_breaker_half_open_window_size);
+DECLARE_int32(circuit_breaker_success_sample_rate);
 } // namespace brpc
 
 int main(int argc, char* argv[]) {
@@ -270,6 +271,36 @@ TEST_F(CircuitBreakerTest, isolation_duration_grow_and_reset) {
 
 }
 
+TEST_F(CircuitBreakerTest, sampled_accounting_still_isolates) {
+    brpc::FLAGS_circuit_breaker_success_sample_rate = 10;
+    std::vector<pthread_t> thread_list;
+    std::vector<std::unique_ptr<FeedbackControl>> fc_list;
+
+    // Failed calls are recorded regardless of the sample rate, a broken
+    // node must be isolated just like with rate=1.
+    StartFeedbackThread(&thread_list, &fc_list, 50);
+    for (int  i = 0; i < kThreadNum; ++i) {
+        void* ret_data = nullptr;
+        ASSERT_EQ(pthread_join(thread_list[i], &ret_data), 0);
+        FeedbackControl* fc = static_cast<FeedbackControl*>(ret_data);
+        EXPECT_GT(fc->_unhealthy_cnt, 0);
+        EXPECT_FALSE(fc->_healthy);
+    }
+
+    // A healthy node stays healthy under sampling.
+    _circuit_breaker.Reset();
+    StartFeedbackThread(&thread_list, &fc_list, 0);
+    for (int  i = 0; i < kThreadNum; ++i) {
+        void* ret_data = nullptr;
+        ASSERT_EQ(pthread_join(thread_list[i], &ret_data), 0);
+        FeedbackControl* fc = static_cast<FeedbackControl*>(ret_data);
+        EXPECT_EQ(fc->_unhealthy_cnt, 0);
+        EXPECT_TRUE(fc->_healthy);
+    }
+    brpc::FLAGS_circuit_breaker_success_sample_rate = 1;
+    _circuit_breaker.Reset();
+}
+
 TEST_F(CircuitBreakerTest, maximum_isolation_duration) {
     brpc::FLAGS_circuit_breaker_max_isolation_duration_ms =
         brpc::FLAGS_circuit_breaker_min_isolation_duration_ms + 1;
@@ -136,3 +136,21 @@ TEST_F(ControllerTest, SessionKV) {
     logging::SetLogSink(oldSink);
 }
 #endif
+
+TEST_F(ControllerTest, object_pool_reuse) {
+    brpc::Controller* cntl = brpc::Controller::TakeFromObjectPool();
+    ASSERT_TRUE(cntl != NULL);
+    cntl->set_timeout_ms(123);
+    cntl->SetFailed(EINVAL, "artificial error");
+    ASSERT_TRUE(cntl->Failed());
+    brpc::Controller::ReturnToObjectPool(cntl);
+
+    // Same thread gets the recycled object back, fully reset.
+    brpc::Controller* cntl2 = brpc::Controller::TakeFromObjectPool();
+    ASSERT_EQ(cntl, cntl2);
+    ASSERT_FALSE(cntl2->Failed());
+    ASSERT_EQ(0, cntl2->ErrorCode());
+    brpc::Controller::ReturnToObjectPool(cntl2);
+
+    brpc::Controller::ReturnToObjectPool(NULL);  // no-op
+}
@@ -0,0 +1,100 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/policy/gradient_concurrency_limiter.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include <gtest/gtest.h>
+
+namespace brpc {
+namespace policy {
+DECLARE_int32(gradient_cl_sample_window_size_ms);
+DECLARE_int32(gradient_cl_min_sample_count);
+DECLARE_int32(gradient_cl_max_sample_count);
+DECLARE_int32(gradient_cl_min_concurrency);
+}  // namespace policy
+}  // namespace brpc
+
+TEST(GradientConcurrencyLimiterTest, AddSample) {
+    brpc::policy::FLAGS_gradient_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_gradient_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_gradient_cl_max_sample_count = 10;
+
+    {
+        // Insufficient samples at the end of the window are discarded.
+        brpc::policy::GradientConcurrencyLimiter limiter;
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+        bthread_usleep(10 * 1000);
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+        ASSERT_EQ(limiter._sw.succ_count, 0);
+        ASSERT_EQ(limiter._sw.failed_count, 0);
+        ASSERT_DOUBLE_EQ(limiter._smoothed_rtt_us, 0);
+    }
+
+    {
+        // A full window updates the smoothed RTT and, at steady latency,
+        // grows the limit by the additive headroom.
+        brpc::policy::GradientConcurrencyLimiter limiter;
+        const int initial_mc = limiter.MaxConcurrency();
+        for (int i = 0; i < 10; ++i) {
+            limiter.AddSample(0, 100, butil::gettimeofday_us());
+        }
+        ASSERT_EQ(limiter._sw.succ_count, 0);
+        ASSERT_DOUBLE_EQ(limiter._smoothed_rtt_us, 100);
+        ASSERT_GT(limiter.MaxConcurrency(), initial_mc);
+    }
+}
+
+TEST(GradientConcurrencyLimiterTest, ShrinkOnLatencySpike) {
+    brpc::policy::FLAGS_gradient_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_gradient_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_gradient_cl_max_sample_count = 10;
+
+    brpc::policy::GradientConcurrencyLimiter limiter;
+    for (int i = 0; i < 10; ++i) {
+        limiter.AddSample(0, 100, butil::gettimeofday_us());
+    }
+    const int mc_at_noload = limiter.MaxConcurrency();
+
+    // Windows far above the long-term RTT must shrink the limit.
+    for (int w = 0; w < 20; ++w) {
+        for (int i = 0; i < 10; ++i) {
+            limiter.AddSample(0, 10000, butil::gettimeofday_us());
+        }
+    }
+    ASSERT_LT(limiter.MaxConcurrency(), mc_at_noload);
+    ASSERT_GE(limiter.MaxConcurrency(),
+              brpc::policy::FLAGS_gradient_cl_min_concurrency);
+}
+
+TEST(GradientConcurrencyLimiterTest, AllFailedWindowHalvesLimit) {
+    brpc::policy::FLAGS_gradient_cl_sample_window_size_ms = 10;
+    brpc::policy::FLAGS_gradient_cl_min_sample_count = 5;
+    brpc::policy::FLAGS_gradient_cl_max_sample_count = 10;
+
+    brpc::policy::GradientConcurrencyLimiter limiter;
+    const int initial_mc = limiter.MaxConcurrency();
+    for (int i = 0; i < 10; ++i) {
+        limiter.AddSample(1, 100, butil::gettimeofday_us());
+    }
+    ASSERT_LE(limiter.MaxConcurrency(), initial_mc / 2 + 1);
+    ASSERT_GE(limiter.MaxConcurrency(),
+              brpc::policy::FLAGS_gradient_cl_min_concurrency);
+}
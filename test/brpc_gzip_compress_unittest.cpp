@@ -0,0 +1,98 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/iobuf.h"
+#include "brpc/compress.h"
+#include "brpc/policy/gzip_compress.h"
+
+namespace {
+
+std::string MakeData(size_t len) {
+    std::string data;
+    data.resize(len);
+    for (size_t i = 0; i < len; ++i) {
+        data[i] = (char)('a' + (i * 7 + i / 100) % 26);
+    }
+    return data;
+}
+
+class GzipCompressTest : public ::testing::Test {};
+
+TEST_F(GzipCompressTest, iobuf_round_trip) {
+    const std::string data = MakeData(300000);
+    // Repeat to exercise reuse of the thread-local z_streams.
+    for (int i = 0; i < 3; ++i) {
+        butil::IOBuf in, compressed, out;
+        in.append(data);
+        ASSERT_TRUE(brpc::policy::GzipCompress(in, &compressed, NULL));
+        ASSERT_LT(compressed.size(), data.size());
+        ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &out));
+        ASSERT_EQ(data, out.to_string());
+    }
+    // ZLIB format through the same entry.
+    brpc::policy::GzipCompressOptions options;
+    options.format = google::protobuf::io::GzipOutputStream::ZLIB;
+    butil::IOBuf in, compressed, out;
+    in.append(data);
+    ASSERT_TRUE(brpc::policy::GzipCompress(in, &compressed, &options));
+    ASSERT_TRUE(brpc::policy::ZlibDecompress(compressed, &out));
+    ASSERT_EQ(data, out.to_string());
+}
+
+TEST_F(GzipCompressTest, decompress_concatenated_members) {
+    const std::string d1 = MakeData(100000);
+    const std::string d2 = MakeData(50000);
+    butil::IOBuf in1, in2, compressed, out;
+    in1.append(d1);
+    in2.append(d2);
+    ASSERT_TRUE(brpc::policy::GzipCompress(in1, &compressed, NULL));
+    ASSERT_TRUE(brpc::policy::GzipCompress(in2, &compressed, NULL));
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &out));
+    ASSERT_EQ(d1 + d2, out.to_string());
+}
+
+TEST_F(GzipCompressTest, decompress_rejects_broken_input) {
+    const std::string data = MakeData(100000);
+    butil::IOBuf in, compressed;
+    in.append(data);
+    ASSERT_TRUE(brpc::policy::GzipCompress(in, &compressed, NULL));
+    butil::IOBuf truncated, out1;
+    compressed.append_to(&truncated, compressed.size() / 2, 0);
+    ASSERT_FALSE(brpc::policy::GzipDecompress(truncated, &out1));
+    butil::IOBuf garbage, out2;
+    garbage.append("this is not gzip at all");
+    ASSERT_FALSE(brpc::policy::GzipDecompress(garbage, &out2));
+}
+
+TEST_F(GzipCompressTest, parallel_compress) {
+    const std::string data = MakeData(3 * 1024 * 1024);
+    butil::IOBuf in, compressed, out;
+    in.append(data);
+    GFLAGS_NAMESPACE::SetCommandLineOption(
+        "gzip_parallel_compress_threshold", "1048576");
+    ASSERT_TRUE(brpc::policy::GzipCompress(in, &compressed, NULL));
+    GFLAGS_NAMESPACE::SetCommandLineOption(
+        "gzip_parallel_compress_threshold", "0");
+    ASSERT_LT(compressed.size(), data.size());
+    ASSERT_TRUE(brpc::policy::GzipDecompress(compressed, &out));
+    ASSERT_EQ(data, out.to_string());
+}
+
+} // namespace
@@ -142,6 +142,47 @@ TEST_F(HPackTest, indexed_header) {
     ASSERT_EQ(h.value, h2.value);
 }
 
+TEST_F(HPackTest, remote_table_size_limit) {
+    brpc::HPacker p1;
+    ASSERT_EQ(0, p1.Init(4096));
+    brpc::HPacker p2;
+    ASSERT_EQ(0, p2.Init(4096));
+    brpc::HPacker::Header h;
+    h.name = "custom-key";
+    h.value = "custom-header";
+    brpc::HPackOptions options;
+    options.index_policy = brpc::HPACK_INDEX_HEADER;
+    butil::IOBufAppender buf;
+    p1.Encode(&buf, h, options);
+    brpc::HPacker::Header tmp;
+    ASSERT_GT(p2.Decode(&buf.buf(), &tmp), 0);
+
+    // The peer shrinks its table to nothing: the next block must start
+    // with a Dynamic Table Size Update(0x20) evicting the entry above,
+    // and the header is sent as a literal again instead of an index.
+    p1.SetRemoteTableSizeLimit(0);
+    p1.Encode(&buf, h, options);
+    const ssize_t nwrite = buf.buf().size();
+    char first_byte;
+    ASSERT_EQ(1u, buf.buf().copy_to(&first_byte, 1));
+    ASSERT_EQ(0x20, first_byte);
+    brpc::HPacker::Header h2;
+    ssize_t nread = p2.Decode(&buf.buf(), &h2);
+    ASSERT_EQ(nread, nwrite);
+    ASSERT_TRUE(buf.buf().empty());
+    ASSERT_EQ(h.name, h2.name);
+    ASSERT_EQ(h.value, h2.value);
+
+    // Both tables are empty now, re-encoding still yields a literal and
+    // no further size update is emitted.
+    p1.Encode(&buf, h, options);
+    ASSERT_EQ(1u, buf.buf().copy_to(&first_byte, 1));
+    ASSERT_EQ(0x40, first_byte & 0xC0);
+    brpc::HPacker::Header h3;
+    ASSERT_GT(p2.Decode(&buf.buf(), &h3), 0);
+    ASSERT_EQ(h.value, h3.value);
+}
+
 struct ConstHeader {
     const char* name;
     const char* value;
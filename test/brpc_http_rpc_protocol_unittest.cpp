@@ -20,6 +20,7 @@
 // Date: Sun Jul 13 15:04:18 CST 2014
 
 #include <cstddef>
+#include <fcntl.h>
 #include <google/protobuf/stubs/logging.h>
 #include <string>
 #include <sys/ioctl.h>
@@ -52,6 +53,7 @@
 #include "json2pb/pb_to_json.h"
 #include "json2pb/json_to_pb.h"
 #include "brpc/details/method_status.h"
+#include "brpc/progressive_writer.h"
 #include "brpc/rpc_dump.h"
 #include "bthread/unstable.h"
 
@@ -658,6 +660,158 @@ private:
     int _last_errno;
 };
     
+class PullWriter : public brpc::ProgressiveWriter {
+public:
+    explicit PullWriter(size_t nrep)
+        : _nrep(nrep), _ncount(0), _done(false) {}
+
+    butil::Status OnWriteOnePart(butil::IOBuf* data) override {
+        if (_ncount < _nrep) {
+            char buf[PA_DATA_LEN];
+            CopyPAPrefixedWithSeqNo(buf, _ncount++);
+            data->append(buf, sizeof(buf));
+        } // otherwise leave `data' empty to end the body.
+        return butil::Status::OK();
+    }
+
+    void OnEndOfWriting(const butil::Status& st) override {
+        _st = st;
+        _done = true;
+    }
+
+    bool done() const { return _done; }
+    const butil::Status& status() const { return _st; }
+
+private:
+    size_t _nrep;
+    size_t _ncount;
+    bool _done;
+    butil::Status _st;
+};
+
+// Streams the body of /DownloadService/Download from a ProgressiveWriter
+// instead of pushing it through a ProgressiveAttachment.
+class PullDownloadServiceImpl : public ::test::DownloadService {
+public:
+    explicit PullDownloadServiceImpl(brpc::ProgressiveWriter* writer)
+        : _writer(writer) {}
+
+    void Download(::google::protobuf::RpcController* cntl_base,
+                  const ::test::HttpRequest*,
+                  ::test::HttpResponse*,
+                  ::google::protobuf::Closure* done) override {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        cntl->http_response().set_content_type("text/plain");
+        ASSERT_EQ(0, cntl->WriteProgressiveAttachmentBy(_writer));
+    }
+
+private:
+    brpc::ProgressiveWriter* _writer;
+};
+
+TEST_F(HttpTest, write_chunked_response_from_pull_writer) {
+    const int port = 8923;
+    const size_t nrep = 10000;
+    PullWriter writer(nrep);
+    PullDownloadServiceImpl svc(&writer);
+    brpc::Server server;
+    EXPECT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    EXPECT_EQ(0, server.Start(port, NULL));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_HTTP;
+    ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+    brpc::Controller cntl;
+    cntl.http_request().uri() = "/DownloadService/Download";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(nrep * PA_DATA_LEN, cntl.response_attachment().size());
+    std::string expected(PA_DATA_LEN, 0);
+    for (size_t i = 0; i < nrep; ++i) {
+        CopyPAPrefixedWithSeqNo(&expected[0], i);
+        std::string part;
+        cntl.response_attachment().cutn(&part, PA_DATA_LEN);
+        ASSERT_EQ(expected, part) << "i=" << i;
+    }
+    for (int i = 0; i < 300 && !writer.done(); ++i) {
+        usleep(10000);
+    }
+    ASSERT_TRUE(writer.done());
+    ASSERT_TRUE(writer.status().ok()) << writer.status();
+}
+
+TEST_F(HttpTest, write_chunked_response_from_file_region) {
+    const int port = 8923;
+    std::string content;
+    content.reserve(20000 * PA_DATA_LEN);
+    for (size_t i = 0; i < 20000; ++i) {
+        content.append(PA_DATA, PA_DATA_LEN);
+    }
+    const butil::FilePath path("file_region_writer.tmp");
+    ASSERT_EQ((int)content.size(), butil::WriteFile(
+                  path, content.data(), content.size()));
+    const off_t offset = 100;
+    const size_t length = content.size() - 300;
+    const int fd = open(path.value().c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    // The writer owns `fd' and destroys itself when the writing ends.
+    PullDownloadServiceImpl svc(
+        brpc::NewFileRegionWriter(fd, offset, length));
+    brpc::Server server;
+    EXPECT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    EXPECT_EQ(0, server.Start(port, NULL));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_HTTP;
+    ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+    brpc::Controller cntl;
+    cntl.http_request().uri() = "/DownloadService/Download";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(length, cntl.response_attachment().size());
+    ASSERT_EQ(content.substr(offset, length),
+              cntl.response_attachment().to_string());
+    butil::DeleteFile(path, false);
+}
+
+TEST_F(HttpTest, write_rate_limited_response_from_file_region) {
+    const int port = 8923;
+    std::string content;
+    content.reserve(1000 * PA_DATA_LEN);
+    for (size_t i = 0; i < 1000; ++i) {
+        content.append(PA_DATA, PA_DATA_LEN);
+    }
+    const butil::FilePath path("file_region_writer2.tmp");
+    ASSERT_EQ((int)content.size(), butil::WriteFile(
+                  path, content.data(), content.size()));
+    const int fd = open(path.value().c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    // Limit the rate to half of the content per second: the download must
+    // be complete and intact, and take at least a second.
+    PullDownloadServiceImpl svc(brpc::NewFileRegionWriter(
+        fd, 0, content.size(), content.size() / 2));
+    brpc::Server server;
+    EXPECT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    EXPECT_EQ(0, server.Start(port, NULL));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_HTTP;
+    ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+    brpc::Controller cntl;
+    cntl.http_request().uri() = "/DownloadService/Download";
+    cntl.set_timeout_ms(-1);
+    const int64_t start_us = butil::gettimeofday_us();
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(content, cntl.response_attachment().to_string());
+    ASSERT_GE(butil::gettimeofday_us() - start_us, 1000000L);
+    butil::DeleteFile(path, false);
+}
+
 TEST_F(HttpTest, read_chunked_response_normally) {
     const int port = 8923;
     brpc::Server server;
@@ -1411,6 +1565,59 @@ TEST_F(HttpTest, http2_settings) {
     ASSERT_TRUE(ctx->_remote_settings.stream_window_size == (1u << 29) - 1);
 }
 
+TEST_F(HttpTest, http2_window_auto_tune) {
+    ASSERT_FALSE(GFLAGS_NAMESPACE::SetCommandLineOption(
+                     "h2_window_auto_tune", "true").empty());
+
+    brpc::policy::H2Context* ctx = new brpc::policy::H2Context(_socket.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    _socket->initialize_parsing_context(&ctx);
+    ctx->_conn_state = brpc::policy::H2_CONNECTION_READY;
+    const int64_t old_size = ctx->_unack_local_settings.stream_window_size;
+
+    // Receiving data should start a probing PING.
+    ctx->MaybeStartBdpProbe(old_size);
+    ASSERT_NE(0, ctx->_bdp_ping_sent_us);
+    butil::IOPortal ping_buf;
+    CHECK_EQ(ping_buf.append_from_file_descriptor(_pipe_fds[0], 1024),
+             (ssize_t)(brpc::policy::FRAME_HEAD_SIZE + 8));
+    brpc::policy::H2FrameHead ping_head;
+    butil::IOBufBytesIterator it(ping_buf);
+    ctx->ConsumeFrameHead(it, &ping_head);
+    CHECK_EQ(ping_head.type, brpc::policy::H2_FRAME_PING);
+    CHECK_EQ(ping_head.stream_id, 0);
+
+    // Ack the probe echoing its opaque data. The sample filled the whole
+    // window, both windows should be enlarged.
+    char ackbuf[brpc::policy::FRAME_HEAD_SIZE + 8];
+    brpc::policy::SerializeFrameHead(ackbuf, 8, brpc::policy::H2_FRAME_PING,
+                                     0x1/*H2_FLAGS_ACK*/, 0);
+    it.copy_and_forward(ackbuf + brpc::policy::FRAME_HEAD_SIZE, 8);
+    butil::IOBuf ack;
+    ack.append(ackbuf, sizeof(ackbuf));
+    brpc::policy::ParseH2Message(&ack, _socket.get(), false, NULL);
+    ASSERT_EQ(0, ctx->_bdp_ping_sent_us);
+    ASSERT_EQ(old_size * 2,
+              (int64_t)ctx->_unack_local_settings.stream_window_size);
+
+    // A SETTINGS announcing the larger stream-level window followed by a
+    // WINDOW_UPDATE enlarging the connection-level one.
+    butil::IOPortal grow_buf;
+    ASSERT_GT(grow_buf.append_from_file_descriptor(_pipe_fds[0], 1024), 0);
+    butil::IOBufBytesIterator it2(grow_buf);
+    brpc::policy::H2FrameHead settings_head;
+    ctx->ConsumeFrameHead(it2, &settings_head);
+    CHECK_EQ(settings_head.type, brpc::policy::H2_FRAME_SETTINGS);
+    it2.forward(settings_head.payload_size);
+    brpc::policy::H2FrameHead wu_head;
+    ctx->ConsumeFrameHead(it2, &wu_head);
+    CHECK_EQ(wu_head.type, brpc::policy::H2_FRAME_WINDOW_UPDATE);
+    CHECK_EQ(wu_head.stream_id, 0);
+
+    ASSERT_FALSE(GFLAGS_NAMESPACE::SetCommandLineOption(
+                     "h2_window_auto_tune", "false").empty());
+}
+
 TEST_F(HttpTest, http2_invalid_settings) {
     {
         brpc::Server server;
@@ -134,6 +134,47 @@ private:
     EchoServiceImpl _echo_svc;
 };
 
+// Composed statically by InterceptorChain, no virtual Accept needed.
+struct CountingHook {
+    explicit CountingHook(int* c) : count(c) {}
+    bool Accept(const brpc::Controller*, int&, std::string&) const {
+        ++*count;
+        return true;
+    }
+    int* count;
+};
+
+struct RejectingHook {
+    bool Accept(const brpc::Controller*, int& error_code,
+                std::string& error_txt) const {
+        error_code = EREJECT;
+        error_txt = "rejected by RejectingHook";
+        return false;
+    }
+};
+
+TEST(InterceptorChainTest, short_circuits_in_order) {
+    int ncalled = 0;
+    std::string error_txt;
+    int error_code = 0;
+
+    CountingHook counting(&ncalled);
+    brpc::InterceptorChain<CountingHook, CountingHook> accept_all(
+            counting, counting);
+    ASSERT_TRUE(accept_all.Accept(NULL, error_code, error_txt));
+    ASSERT_EQ(2, ncalled);
+
+    ncalled = 0;
+    brpc::InterceptorChain<CountingHook, RejectingHook, CountingHook> chain(
+            counting, RejectingHook(), counting);
+    ASSERT_FALSE(chain.Accept(NULL, error_code, error_txt));
+    // The hook behind the rejection must not run.
+    ASSERT_EQ(1, ncalled);
+    ASSERT_EQ(EREJECT, error_code);
+    ASSERT_EQ("rejected by RejectingHook", error_txt);
+    ASSERT_EQ(&ncalled, chain.interceptor_at<0>().count);
+}
+
 TEST_F(InterceptorTest, sanity) {
     ::test::EchoRequest req;
     ::test::EchoResponse res;
@@ -142,6 +142,41 @@ TEST_F(LoadBalancerTest, doubly_buffered_data) {
     test_doubly_buffered_data<butil::DoublyBufferedData<Foo, butil::Void, true>>();
 }
 
+struct ModifyWaitArgs {
+    butil::DoublyBufferedData<Foo>* dbd;
+    butil::atomic<bool>* modified;
+};
+
+void* modify_from_another_thread(void* void_arg) {
+    ModifyWaitArgs* args = static_cast<ModifyWaitArgs*>(void_arg);
+    args->dbd->Modify(AddN, 1);
+    args->modified->store(true, butil::memory_order_release);
+    return NULL;
+}
+
+TEST_F(LoadBalancerTest, doubly_buffered_data_modify_waits_for_read) {
+    butil::DoublyBufferedData<Foo> d;
+    butil::atomic<bool> modified(false);
+    ModifyWaitArgs args = { &d, &modified };
+    pthread_t tid;
+    {
+        butil::DoublyBufferedData<Foo>::ScopedPtr ptr;
+        ASSERT_EQ(0, d.Read(&ptr));
+        ASSERT_EQ(0, pthread_create(
+            &tid, NULL, modify_from_another_thread, &args));
+        usleep(100 * 1000);
+        // Modify() must not finish while the foreground instance is still
+        // being read by this thread.
+        ASSERT_FALSE(modified.load(butil::memory_order_acquire));
+        ASSERT_EQ(0, ptr->x);
+    }
+    ASSERT_EQ(0, pthread_join(tid, NULL));
+    ASSERT_TRUE(modified.load(butil::memory_order_acquire));
+    butil::DoublyBufferedData<Foo>::ScopedPtr ptr;
+    ASSERT_EQ(0, d.Read(&ptr));
+    ASSERT_EQ(1, ptr->x);
+}
+
 bool exitFlag = false;
 
 template <typename DBD>
@@ -743,16 +778,18 @@ TEST_F(LoadBalancerTest, fairness) {
 
 TEST_F(LoadBalancerTest, consistent_hashing) {
     ::brpc::policy::HashFunc hashs[::brpc::policy::CONS_HASH_LB_LAST] = {
-            ::brpc::policy::MurmurHash32, 
+            ::brpc::policy::MurmurHash32,
+            ::brpc::policy::MD5Hash32,
             ::brpc::policy::MD5Hash32,
-            ::brpc::policy::MD5Hash32
             // ::brpc::policy::CRCHash32 crc is a bad hash function in test
+            ::brpc::policy::WyHash32
     };
 
     ::brpc::policy::ConsistentHashingLoadBalancerType hash_type[::brpc::policy::CONS_HASH_LB_LAST] = {
         ::brpc::policy::CONS_HASH_LB_MURMUR3,
         ::brpc::policy::CONS_HASH_LB_MD5,
-        ::brpc::policy::CONS_HASH_LB_KETAMA
+        ::brpc::policy::CONS_HASH_LB_KETAMA,
+        ::brpc::policy::CONS_HASH_LB_WYHASH
     };
 
     const char* servers[] = { 
@@ -825,6 +862,84 @@ TEST_F(LoadBalancerTest, consistent_hashing) {
     }
 }
 
+TEST_F(LoadBalancerTest, consistent_hashing_bounded_loads) {
+    const char* servers[] = {
+            "10.92.115.19:8833",
+            "10.42.108.25:8833",
+            "10.36.150.32:8833",
+    };
+    brpc::policy::ConsistentHashingLoadBalancer proto(
+            brpc::policy::CONS_HASH_LB_MURMUR3);
+    brpc::LoadBalancer* lb = proto.New("load_factor=1.5");
+    ASSERT_TRUE(lb != NULL);
+    std::vector<brpc::ServerId> ids;
+    for (size_t i = 0; i < ARRAY_SIZE(servers); ++i) {
+        butil::EndPoint dummy;
+        ASSERT_EQ(0, str2endpoint(servers[i], &dummy));
+        brpc::ServerId id(8888);
+        brpc::SocketOptions options;
+        options.remote_side = dummy;
+        options.user = new SaveRecycle;
+        ASSERT_EQ(0, brpc::Socket::Create(options, &id.id));
+        ids.push_back(id);
+        ASSERT_TRUE(lb->AddServer(id));
+    }
+
+    brpc::SocketUniquePtr ptr;
+    brpc::LoadBalancer::SelectIn in = { 0, false, true, 12345u, NULL };
+    // Without feedback every pick stays "in flight", so the favorite
+    // server of the code saturates quickly and subsequent picks must
+    // spill to other servers on the ring.
+    const size_t N = 30;
+    std::map<butil::EndPoint, size_t> times;
+    std::vector<brpc::SocketId> picked;
+    butil::EndPoint favorite;
+    for (size_t i = 0; i < N; ++i) {
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_TRUE(out.need_feedback);
+        if (i == 0) {
+            favorite = ptr->remote_side();
+        }
+        ++times[ptr->remote_side()];
+        picked.push_back(ptr->id());
+    }
+    ASSERT_GT(times.size(), 1ul);
+    for (const auto& t : times) {
+        std::cout << "bounded loads: " << t.first << " picked "
+                  << t.second << " times" << std::endl;
+        // No server takes more than its bounded share.
+        ASSERT_LE(t.second, (size_t)(1.5 * N / ARRAY_SIZE(servers)) + 1);
+    }
+
+    // Finish all the calls. With counters back to zero the key sticks to
+    // its favorite server again.
+    for (size_t i = 0; i < picked.size(); ++i) {
+        brpc::LoadBalancer::CallInfo info;
+        info.begin_time_us = 0;
+        info.server_id = picked[i];
+        info.error_code = 0;
+        info.controller = NULL;
+        lb->Feedback(info);
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        brpc::LoadBalancer::SelectOut out(&ptr);
+        ASSERT_EQ(0, lb->SelectServer(in, &out));
+        ASSERT_EQ(favorite, ptr->remote_side());
+        brpc::LoadBalancer::CallInfo info;
+        info.begin_time_us = 0;
+        info.server_id = ptr->id();
+        info.error_code = 0;
+        info.controller = NULL;
+        lb->Feedback(info);
+    }
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, brpc::Socket::SetFailed(ids[i].id));
+    }
+    lb->Destroy();
+}
+
 TEST_F(LoadBalancerTest, weighted_round_robin) {
     const char* servers[] = { 
             "10.92.115.19:8831", 
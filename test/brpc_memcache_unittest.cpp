@@ -18,6 +18,7 @@
 #include <iostream>
 #include "butil/time.h"
 #include "butil/logging.h"
+#include "butil/string_printf.h"
 #include <brpc/memcache.h>
 #include <brpc/channel.h>
 #include <gtest/gtest.h>
@@ -168,6 +169,62 @@ TEST_F(MemcacheTest, sanity) {
     ASSERT_EQ(~0ul, cas_value3);
 }
 
+TEST_F(MemcacheTest, multi_get) {
+    if (g_mc_pid < 0) {
+        puts("Skipped due to absence of memcached");
+        return;
+    }
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0:" MEMCACHED_PORT, &options));
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+
+    const size_t NKEY = 40;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < NKEY; ++i) {
+        keys.push_back(butil::string_printf("multi_get_key_%lu",
+                                            (unsigned long)i));
+        // Only set even keys, odd ones shall be misses.
+        if (i % 2 == 0) {
+            ASSERT_TRUE(request.Set(keys.back(),
+                                    butil::string_printf("value_%lu",
+                                                         (unsigned long)i),
+                                    (uint32_t)i, 100, 0));
+        }
+    }
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    for (size_t i = 0; i < NKEY; i += 2) {
+        uint64_t cas_value = 0;
+        ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    }
+
+    cntl.Reset();
+    request.Clear();
+    ASSERT_TRUE(request.MultiGet(keys));
+    ASSERT_EQ(1, request.pipelined_count());
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    std::map<std::string, brpc::MemcacheResponse::MultiGetValue> values;
+    ASSERT_TRUE(response.PopMultiGet(&values)) << response.LastError();
+    ASSERT_EQ(NKEY / 2, values.size());
+    for (size_t i = 0; i < NKEY; ++i) {
+        std::map<std::string, brpc::MemcacheResponse::MultiGetValue>
+            ::const_iterator it = values.find(keys[i]);
+        if (i % 2 == 0) {
+            ASSERT_TRUE(it != values.end()) << keys[i];
+            ASSERT_EQ(butil::string_printf("value_%lu", (unsigned long)i),
+                      it->second.value.to_string());
+            ASSERT_EQ((uint32_t)i, it->second.flags);
+        } else {
+            ASSERT_TRUE(it == values.end()) << keys[i];
+        }
+    }
+}
+
 TEST_F(MemcacheTest, incr_and_decr) {
     if (g_mc_pid < 0) {
         puts("Skipped due to absence of memcached");
@@ -34,6 +34,7 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/controller.h"
 #include "brpc/mongo_head.h"
+#include "brpc/mongo_msg.h"
 #include "brpc/mongo_service_adaptor.h"
 #include "brpc/policy/mongo.pb.h"
 
@@ -232,4 +233,114 @@ TEST_F(MongoTest, complete_flow) {
     ASSERT_FALSE(cntl.Failed());
     ASSERT_STREQ(EXP_RESPONSE.c_str(), msg_buf);
 }
+
+// A minimal BSON document { name: value } with an int32 element.
+static std::string MakeBsonDoc(const std::string& name, int32_t value) {
+    std::string doc;
+    const int32_t len = 4 + 1 + name.size() + 1 + 4 + 1;
+    doc.append((const char*)&len, 4);
+    doc.push_back('\x10');  // int32 element
+    doc.append(name);
+    doc.push_back('\0');
+    doc.append((const char*)&value, 4);
+    doc.push_back('\0');
+    return doc;
+}
+
+TEST_F(MongoTest, op_msg_view) {
+    const std::string doc0 = MakeBsonDoc("find", 1);
+    const std::string doc1 = MakeBsonDoc("a", 2);
+    const std::string doc2 = MakeBsonDoc("b", 3);
+
+    butil::IOBuf body;
+    const uint32_t flag_bits = 0;
+    body.append(&flag_bits, 4);
+    // Section kind 0: a single body document.
+    body.append("\0", 1);
+    body.append(doc0);
+    // Section kind 1: a document sequence named "documents".
+    body.append("\1", 1);
+    const uint32_t sec_size = 4 + sizeof("documents") + doc1.size() + doc2.size();
+    body.append(&sec_size, 4);
+    body.append("documents", sizeof("documents"));
+    body.append(doc1);
+    body.append(doc2);
+
+    brpc::MongoMsgView view;
+    ASSERT_EQ(0, brpc::ParseMongoMsgView(body, &view));
+    ASSERT_EQ(0u, view.flag_bits);
+    ASSERT_EQ(2u, view.sections.size());
+    ASSERT_EQ(0, view.sections[0].kind);
+    ASSERT_EQ(1u, view.sections[0].documents.size());
+    ASSERT_EQ(doc0, view.sections[0].documents[0].to_string());
+    ASSERT_EQ(1, view.sections[1].kind);
+    ASSERT_EQ("documents", view.sections[1].identifier);
+    ASSERT_EQ(2u, view.sections[1].documents.size());
+    ASSERT_EQ(doc1, view.sections[1].documents[0].to_string());
+    ASSERT_EQ(doc2, view.sections[1].documents[1].to_string());
+    ASSERT_TRUE(brpc::ValidateBsonDocument(view.sections[0].documents[0]));
+
+    // A checksum announced by flag bit 0 is skipped.
+    butil::IOBuf checksummed;
+    const uint32_t crc_flag = 1;
+    checksummed.append(&crc_flag, 4);
+    checksummed.append("\0", 1);
+    checksummed.append(doc0);
+    checksummed.append("\x12\x34\x56\x78", 4);
+    ASSERT_EQ(0, brpc::ParseMongoMsgView(checksummed, &view));
+    ASSERT_EQ(1u, view.flag_bits);
+    ASSERT_EQ(1u, view.sections.size());
+    ASSERT_EQ(doc0, view.sections[0].documents[0].to_string());
+
+    // Truncated documents are rejected.
+    butil::IOBuf truncated;
+    truncated.append(&flag_bits, 4);
+    truncated.append("\0", 1);
+    truncated.append(doc0.data(), doc0.size() - 2);
+    ASSERT_EQ(-1, brpc::ParseMongoMsgView(truncated, &view));
+}
+
+TEST_F(MongoTest, reply_builder) {
+    const std::string doc0 = MakeBsonDoc("a", 1);
+    const std::string doc1 = MakeBsonDoc("b", 2);
+
+    brpc::MongoReplyBuilder builder(5, 7);
+    builder.set_cursor_id(42);
+    butil::IOBuf doc_buf;
+    doc_buf.append(doc0);
+    ASSERT_EQ(0, builder.AddDocument(doc_buf));
+    doc_buf.clear();
+    doc_buf.append(doc1);
+    ASSERT_EQ(0, builder.AddDocument(doc_buf));
+    ASSERT_EQ(2, builder.number_returned());
+
+    // Broken documents are rejected.
+    doc_buf.clear();
+    doc_buf.append("xyz");
+    ASSERT_EQ(-1, builder.AddDocument(doc_buf));
+    ASSERT_EQ(2, builder.number_returned());
+
+    butil::IOBuf out;
+    ASSERT_EQ(0, builder.SerializeTo(&out));
+    brpc::mongo_head_t head;
+    ASSERT_EQ(sizeof(head), out.cutn(&head, sizeof(head)));
+    head.make_host_endian();
+    ASSERT_EQ((int32_t)(36 + doc0.size() + doc1.size()), head.message_length);
+    ASSERT_EQ(5, head.request_id);
+    ASSERT_EQ(7, head.response_to);
+    ASSERT_EQ(brpc::MONGO_OPCODE_REPLY, head.op_code);
+    int32_t response_flags = -1;
+    int64_t cursor_id = 0;
+    int32_t starting_from = -1;
+    int32_t number_returned = 0;
+    out.cutn(&response_flags, 4);
+    out.cutn(&cursor_id, 8);
+    out.cutn(&starting_from, 4);
+    out.cutn(&number_returned, 4);
+    ASSERT_EQ(0, response_flags);
+    ASSERT_EQ(42, cursor_id);
+    ASSERT_EQ(0, starting_from);
+    ASSERT_EQ(2, number_returned);
+    ASSERT_EQ(doc0 + doc1, out.to_string());
+}
 } //namespace
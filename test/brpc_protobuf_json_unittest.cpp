@@ -1640,6 +1640,48 @@ TEST_F(ProtobufJsonTest, parse_multiple_json_error) {
     ASSERT_EQ(47ul, offset);
 }
 
+TEST_F(ProtobufJsonTest, json_to_pb_insitu) {
+    const std::string info3 = "{\"content\":[{\"distance\":1,\"unknown_member\":2,\"ext\":"
+                        "{\"age\":1666666666, \"databyte\":\"d2VsY29tZQ==\", \"enumtype\":1},"
+                        "\"uid\":\"someone\"},{\"distance\":10,\"unknown_member\":20,"
+                        "\"ext\":{\"age\":1666666660, \"databyte\":\"d2VsY29tZQ==\","
+                        "\"enumtype\":2},\"uid\":\"someone0\"}], \"judge\":false,"
+                        "\"spur\":2, \"data\":[1,2,3,4,5,6,7,8,9,10]}";
+    std::string error;
+
+    JsonContextBody expected;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(info3, &expected, &error)) << error;
+
+    json2pb::Json2PbOptions options;
+    options.insitu_parsing = true;
+
+    // In-situ parsing yields the same message from a string...
+    JsonContextBody data;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(info3, &data, options, &error)) << error;
+    ASSERT_EQ(expected.ShortDebugString(), data.ShortDebugString());
+    // ...and the input is left untouched.
+    ASSERT_EQ('{', info3[0]);
+
+    // Same from a ZeroCopyInputStream.
+    butil::IOBuf buf;
+    buf.append(info3);
+    butil::IOBufAsZeroCopyInputStream stream(buf);
+    data.Clear();
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(&stream, &data, options, &error)) << error;
+    ASSERT_EQ(expected.ShortDebugString(), data.ShortDebugString());
+
+    // allow_remaining_bytes_after_parsing still reports the parsed offset.
+    std::string two_jsons = R"( { "name":"tom", "id":323, "datadouble":3.2 } { "name":)";
+    options.allow_remaining_bytes_after_parsing = true;
+    Person req;
+    size_t offset = 0;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(two_jsons, &req, options, &error, &offset));
+    ASSERT_STREQ("tom", req.name().c_str());
+    ASSERT_EQ(323, req.id());
+    ASSERT_EQ(3.2, req.datadouble());
+    ASSERT_NE(std::string::npos, two_jsons.substr(offset).find("{ \"name\":"));
+}
+
 TEST_F(ProtobufJsonTest, proto_json_to_pb) {
     std::string error;
     json2pb::ProtoJson2PbOptions options;
@@ -1132,6 +1132,61 @@ TEST_F(RedisTest, server_sanity) {
     ASSERT_EQ("", response.reply(3).data());
 }
 
+TEST_F(RedisTest, client_command_batcher) {
+    std::string password = GeneratePassword();
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    RedisServiceImpl* rsimpl = new RedisServiceImpl(password);
+    rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl));
+    rsimpl->AddCommandHandler("set", new SetCommandHandler(rsimpl));
+    rsimpl->AddCommandHandler("auth", new AuthCommandHandler(rsimpl));
+    server_options.redis_service = rsimpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    options.auth = new brpc::policy::RedisAuthenticator(password);
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisCommandBatcher batcher(&channel);
+    brpc::RedisCommandBatcher::Reply set1 = batcher.AddCommand("set b_key1 value1");
+    brpc::RedisCommandBatcher::Reply get1 = batcher.AddCommand("get %s", "b_key1");
+    brpc::RedisCommandBatcher::Reply get2 = batcher.AddCommand("get b_key_no_exist");
+    ASSERT_EQ(3, batcher.pending_command_size());
+    batcher.Flush();
+    ASSERT_EQ(0, batcher.pending_command_size());
+    ASSERT_FALSE(set1.Failed()) << set1.ErrorText();
+    ASSERT_EQ(brpc::REDIS_REPLY_STATUS, set1.get().type());
+    ASSERT_STREQ("OK", set1.get().c_str());
+    ASSERT_EQ(brpc::REDIS_REPLY_STRING, get1.get().type());
+    ASSERT_STREQ("value1", get1.get().c_str());
+    ASSERT_EQ(brpc::REDIS_REPLY_NIL, get2.get().type());
+
+    // Waiting on a handle flushes the pending batch implicitly.
+    brpc::RedisCommandBatcher::Reply set2 = batcher.AddCommand("set b_key2 value2");
+    brpc::RedisCommandBatcher::Reply get3 = batcher.AddCommand("get b_key2");
+    ASSERT_EQ(brpc::REDIS_REPLY_STRING, get3.get().type());
+    ASSERT_STREQ("value2", get3.get().c_str());
+    ASSERT_STREQ("OK", set2.get().c_str());
+    ASSERT_EQ(0, batcher.pending_command_size());
+
+    // Auto-flush when max_batch_size is reached.
+    brpc::RedisCommandBatcher batcher2(&channel, 2);
+    brpc::RedisCommandBatcher::Reply g1 = batcher2.AddCommand("get b_key1");
+    ASSERT_EQ(1, batcher2.pending_command_size());
+    brpc::RedisCommandBatcher::Reply g2 = batcher2.AddCommand("get b_key2");
+    ASSERT_EQ(0, batcher2.pending_command_size());
+    ASSERT_STREQ("value1", g1.get().c_str());
+    ASSERT_STREQ("value2", g2.get().c_str());
+
+    // Default-constructed handles are failed nil replies.
+    brpc::RedisCommandBatcher::Reply invalid;
+    ASSERT_TRUE(invalid.Failed());
+    ASSERT_EQ(brpc::REDIS_REPLY_NIL, invalid.get().type());
+}
+
 void* incr_thread(void* arg) {
     brpc::Channel* c = static_cast<brpc::Channel*>(arg);
     for (int i = 0; i < 5000; ++i) {
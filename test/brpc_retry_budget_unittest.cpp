@@ -0,0 +1,57 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "brpc/retry_budget.h"
+#include <gtest/gtest.h>
+
+TEST(RetryBudgetTest, take_and_replenish) {
+    brpc::RetryBudget::Options options;
+    options.token_ratio = 0.5;
+    options.max_tokens = 3;
+    brpc::RetryBudget budget(options);
+
+    // The initial reserve equals max_tokens.
+    ASSERT_DOUBLE_EQ(budget.remaining_tokens(), 3);
+    ASSERT_TRUE(budget.TakeToken());
+    ASSERT_TRUE(budget.TakeToken());
+    ASSERT_TRUE(budget.TakeToken());
+    ASSERT_FALSE(budget.TakeToken());
+    ASSERT_EQ(budget.exhausted_count(), 1);
+
+    // Two successes buy back one retry at ratio 0.5.
+    budget.OnCallSucceeded();
+    ASSERT_FALSE(budget.TakeToken());
+    budget.OnCallSucceeded();
+    ASSERT_TRUE(budget.TakeToken());
+    ASSERT_EQ(budget.exhausted_count(), 2);
+
+    // Deposits are capped at max_tokens.
+    for (int i = 0; i < 100; ++i) {
+        budget.OnCallSucceeded();
+    }
+    ASSERT_DOUBLE_EQ(budget.remaining_tokens(), 3);
+}
+
+TEST(RetryBudgetTest, invalid_options_corrected) {
+    brpc::RetryBudget::Options options;
+    options.token_ratio = -1;
+    options.max_tokens = 0;
+    brpc::RetryBudget budget(options);
+    ASSERT_DOUBLE_EQ(budget.remaining_tokens(), 1);
+    ASSERT_TRUE(budget.TakeToken());
+    ASSERT_FALSE(budget.TakeToken());
+}
@@ -48,6 +48,9 @@
 #include "brpc/builtin/sockets_service.h"      // SocketsService
 #include "brpc/builtin/bad_method_service.h"
 #include "brpc/server.h"
+#include "brpc/details/method_status.h"
+#include "brpc/details/usercode_backup_pool.h"
+#include "brpc/attachment_buffer_pool.h"
 #include "brpc/restful.h"
 #include "brpc/channel.h"
 #include "brpc/socket_map.h"
@@ -114,6 +117,7 @@ public:
 };
 
 bool g_delete = false;
+bool g_check_aligned_attachment = false;
 const std::string EXP_REQUEST = "hello";
 const std::string EXP_RESPONSE = "world";
 const std::string EXP_REQUEST_BASE64 = "aGVsbG8=";
@@ -147,6 +151,13 @@ public:
             ASSERT_EQ(*val, EXP_USER_FIELD_VALUE);
             cntl->response_user_fields()->insert(EXP_USER_FIELD_KEY, EXP_USER_FIELD_VALUE);
         }
+        if (g_check_aligned_attachment && !cntl->request_attachment().empty()) {
+            // The attachment landed in one buffer of the registered pool.
+            ASSERT_EQ(1u, cntl->request_attachment().backing_block_num());
+            const butil::StringPiece blk = cntl->request_attachment().backing_block(0);
+            ASSERT_EQ(0u, (uintptr_t)blk.data() % 4096);
+            cntl->response_attachment() = cntl->request_attachment();
+        }
     }
 
     virtual void ComboEcho(google::protobuf::RpcController*,
@@ -1247,6 +1258,93 @@ TEST_F(ServerTest, add_remove_service) {
     ASSERT_EQ(0ul, server.service_count());
 }
 
+TEST_F(ServerTest, dedicated_usercode_pool) {
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    brpc::ServiceOptions svc_opt;
+    svc_opt.dedicated_usercode_backup_threads = 2;
+    ASSERT_EQ(0, server.AddService(&echo_svc, svc_opt));
+    const brpc::Server::MethodProperty* mp = server._method_map.seek(
+        test::EchoService::descriptor()->method(0)->full_name());
+    ASSERT_TRUE(mp != NULL && mp->status != NULL);
+    // The service got a dedicated pool, shared by its methods.
+    brpc::UserCodeBackupPool* pool = mp->status->usercode_pool();
+    ASSERT_TRUE(pool != NULL);
+    ASSERT_FALSE(brpc::TooManyUserCode(pool));
+
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:9200", &ep));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+    const bool saved_flag = brpc::FLAGS_usercode_in_pthread;
+    brpc::FLAGS_usercode_in_pthread = true;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, NULL));
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    test::EchoService_Stub stub(&chan);
+    stub.Echo(&cntl, &req, &res, NULL);
+    EXPECT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    EXPECT_EQ(EXP_RESPONSE, res.message());
+    brpc::FLAGS_usercode_in_pthread = saved_flag;
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    // RemoveService destroys the pool.
+    ASSERT_EQ(0, server.RemoveService(&echo_svc));
+
+    // Services without the option stay on the global pool.
+    brpc::Server server2;
+    EchoServiceImpl echo_svc2;
+    ASSERT_EQ(0, server2.AddService(
+        &echo_svc2, brpc::SERVER_DOESNT_OWN_SERVICE));
+    mp = server2._method_map.seek(
+        test::EchoService::descriptor()->method(0)->full_name());
+    ASSERT_TRUE(mp != NULL && mp->status != NULL);
+    ASSERT_TRUE(mp->status->usercode_pool() == NULL);
+}
+
+TEST_F(ServerTest, registered_attachment_pool) {
+    brpc::Server server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(&echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::AttachmentBufferPool pool(1 << 20, 4096, 4);
+    ASSERT_EQ((1ul << 20), pool.buffer_size());
+    ASSERT_EQ(-1, server.RegisterAttachmentPool("unknown.Service.Method", &pool));
+    ASSERT_EQ(0, server.RegisterAttachmentPool(
+        test::EchoService::descriptor()->method(0)->full_name(), &pool));
+    const brpc::Server::MethodProperty* mp = server._method_map.seek(
+        test::EchoService::descriptor()->method(0)->full_name());
+    ASSERT_TRUE(mp != NULL && mp->attachment_pool == &pool);
+
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:9201", &ep));
+    ASSERT_EQ(0, server.Start(ep, NULL));
+    // Registration is rejected on a running server.
+    ASSERT_EQ(-1, server.RegisterAttachmentPool(
+        test::EchoService::descriptor()->method(0)->full_name(), &pool));
+
+    g_check_aligned_attachment = true;
+    brpc::Channel chan;
+    ASSERT_EQ(0, chan.Init(ep, NULL));
+    brpc::Controller cntl;
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    const std::string att(256 * 1024, 'a');
+    cntl.request_attachment().append(att);
+    test::EchoService_Stub stub(&chan);
+    stub.Echo(&cntl, &req, &res, NULL);
+    EXPECT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    EXPECT_EQ(EXP_RESPONSE, res.message());
+    // The service echoed the attachment back from the pooled buffer.
+    EXPECT_EQ(att, cntl.response_attachment().to_string());
+    g_check_aligned_attachment = false;
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 void SendSleepRPC(butil::EndPoint ep, int sleep_ms, bool succ) {
     brpc::Channel channel;
     ASSERT_EQ(0, channel.Init(ep, NULL));
@@ -1399,6 +1497,26 @@ void SendMultipleRPC(butil::EndPoint ep, int count) {
     }
 }
               
+void SendMultipleRPCWithShortConnection(butil::EndPoint ep, int count) {
+    // Short connections so that RPCs below connect() repeatedly and
+    // are spread over SO_REUSEPORT listen sockets by the kernel.
+    brpc::ChannelOptions copt;
+    copt.connection_type = brpc::CONNECTION_TYPE_SHORT;
+    brpc::Channel channel;
+    EXPECT_EQ(0, channel.Init(ep, &copt));
+
+    for (int i = 0; i < count; ++i) {
+        brpc::Controller cntl;
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        test::EchoService_Stub stub(&channel);
+        stub.Echo(&cntl, &req, &res, NULL);
+
+        EXPECT_EQ(EXP_RESPONSE, res.message()) << cntl.ErrorText();
+    }
+}
+
 TEST_F(ServerTest, serving_requests) {
     EchoServiceImpl echo_svc;
     brpc::Server server;
@@ -1424,6 +1542,33 @@ TEST_F(ServerTest, serving_requests) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, num_acceptors) {
+    EchoServiceImpl echo_svc;
+    brpc::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   brpc::SERVER_DOESNT_OWN_SERVICE));
+    butil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8614", &ep));
+    brpc::ServerOptions options;
+    options.num_acceptors = 4;
+    ASSERT_EQ(0, server.Start(ep, &options));
+
+    const int NUM = 8;
+    const int COUNT = 10;
+    pthread_t tids[NUM];
+    for (int i = 0; i < NUM; ++i) {
+        google::protobuf::Closure* thrd_func =
+                brpc::NewCallback(SendMultipleRPCWithShortConnection, ep, COUNT);
+        EXPECT_EQ(0, pthread_create(&tids[i], NULL, RunClosure, thrd_func));
+    }
+    for (int i = 0; i < NUM; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    ASSERT_EQ(NUM * COUNT, echo_svc.count.load());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(ServerTest, create_pid_file) {
     {
         brpc::Server server;
@@ -137,6 +137,92 @@ TEST_F(SocketMapTest, idle_timeout) {
     brpc::SocketMapRemove(g_key);
 }
 
+class LocalSocketCreator : public brpc::SocketCreator {
+public:
+    int CreateSocket(const brpc::SocketOptions& opt,
+                     brpc::SocketId* id) override {
+        return brpc::get_or_new_client_side_messenger()->Create(opt, id);
+    }
+};
+
+TEST_F(SocketMapTest, sharded_map) {
+    brpc::SocketMap map;
+    brpc::SocketMapOptions options;
+    options.socket_creator = new LocalSocketCreator;
+    options.num_shards = 4;
+    ASSERT_EQ(0, map.Init(options));
+    const int N = 32;
+    brpc::SocketId ids[N];
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &ep));
+        brpc::SocketMapKey key(ep);
+        ASSERT_EQ(0, map.Insert(key, &ids[i]));
+        brpc::SocketId id2;
+        ASSERT_EQ(0, map.Find(key, &id2));
+        ASSERT_EQ(ids[i], id2);
+    }
+    std::vector<brpc::SocketId> all;
+    map.List(&all);
+    ASSERT_EQ((size_t)N, all.size());
+    for (int i = 0; i < N; ++i) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 20000 + i, &ep));
+        brpc::SocketMapKey key(ep);
+        map.Remove(key, ids[i]);
+        brpc::SocketId id2;
+        ASSERT_EQ(-1, map.Find(key, &id2));
+    }
+    map.List(&all);
+    ASSERT_TRUE(all.empty());
+}
+
+struct InsertOnceArgs {
+    brpc::SocketMap* map;
+    butil::EndPoint ep;
+    brpc::SocketId id;
+};
+
+void* insert_once(void* void_arg) {
+    InsertOnceArgs* args = static_cast<InsertOnceArgs*>(void_arg);
+    brpc::SocketMapKey key(args->ep);
+    EXPECT_EQ(0, args->map->Insert(key, &args->id));
+    return NULL;
+}
+
+TEST_F(SocketMapTest, concurrent_insert_shares_one_socket) {
+    brpc::SocketMap map;
+    brpc::SocketMapOptions options;
+    options.socket_creator = new LocalSocketCreator;
+    options.num_shards = 4;
+    ASSERT_EQ(0, map.Init(options));
+    const int NTHREAD = 8;
+    for (int round = 0; round < 10; ++round) {
+        butil::EndPoint ep;
+        ASSERT_EQ(0, butil::str2endpoint("127.0.0.1", 21000 + round, &ep));
+        InsertOnceArgs args[NTHREAD];
+        pthread_t tids[NTHREAD];
+        for (int i = 0; i < NTHREAD; ++i) {
+            args[i].map = &map;
+            args[i].ep = ep;
+            ASSERT_EQ(0, pthread_create(&tids[i], NULL, insert_once, &args[i]));
+        }
+        for (int i = 0; i < NTHREAD; ++i) {
+            ASSERT_EQ(0, pthread_join(tids[i], NULL));
+        }
+        // Racing inserts of one key must end up sharing one socket.
+        for (int i = 1; i < NTHREAD; ++i) {
+            ASSERT_EQ(args[0].id, args[i].id);
+        }
+        brpc::SocketMapKey key(ep);
+        for (int i = 0; i < NTHREAD; ++i) {
+            map.Remove(key, args[i].id);
+        }
+        brpc::SocketId id2;
+        ASSERT_EQ(-1, map.Find(key, &id2));
+    }
+}
+
 TEST_F(SocketMapTest, max_pool_size) {
     const int MAXSIZE = 5;
     const int TOTALSIZE = MAXSIZE + 5;
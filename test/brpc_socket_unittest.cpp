@@ -32,6 +32,7 @@
 #include "bthread/unstable.h"
 #include "bthread/task_control.h"
 #include "brpc/socket.h"
+#include "brpc/egress_rate_limiter.h"
 #include "brpc/errno.pb.h"
 #include "brpc/acceptor.h"
 #include "brpc/policy/hulu_pbrpc_protocol.h"
@@ -294,6 +295,190 @@ TEST_F(SocketTest, single_threaded_write) {
     close(fds[0]);
 }
 
+static void* DrainFdUntil(void* void_arg) {
+    // args: [fd, expected_total(out: read_total)]
+    intptr_t* args = (intptr_t*)void_arg;
+    const int fd = args[0];
+    intptr_t nread = 0;
+    char buf[16384];
+    while (nread < args[1]) {
+        const ssize_t nr = read(fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            break;
+        }
+        nread += nr;
+    }
+    args[1] = nread;
+    return NULL;
+}
+
+TEST_F(SocketTest, egress_rate_limited_write) {
+    // The limiter starts with one second of burst, so with 128K/s the
+    // last 128K of the 256K written below must wait ~1 second.
+    const int64_t RATE = 128 * 1024;
+    const size_t TOTAL = 256 * 1024;
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    butil::EndPoint dummy;
+    ASSERT_EQ(0, str2endpoint("192.168.1.26:8080", &dummy));
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.remote_side = dummy;
+    options.user = new CheckRecycle;
+    options.egress_limiter = std::make_shared<brpc::EgressRateLimiter>(RATE);
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+
+    intptr_t reader_args[2] = { fds[0], (intptr_t)TOTAL };
+    pthread_t reader;
+    ASSERT_EQ(0, pthread_create(&reader, NULL, DrainFdUntil, reader_args));
+
+    butil::Timer tm;
+    tm.start();
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        butil::IOBuf chunk;
+        chunk.resize(16 * 1024, 'x');
+        for (size_t sent = 0; sent < TOTAL; sent += 16 * 1024) {
+            butil::IOBuf src = chunk;
+            ASSERT_EQ(0, s->Write(&src));
+        }
+        // Wait until everything arrived at the other end.
+        ASSERT_EQ(0, pthread_join(reader, NULL));
+        tm.stop();
+        ASSERT_EQ((intptr_t)TOTAL, reader_args[1]);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+    // 256K at 128K/s with 128K burst takes about 1 second.
+    ASSERT_GE(tm.m_elapsed(), 700);
+    LOG(INFO) << "Transferred " << TOTAL << " bytes in " << tm.m_elapsed()
+              << "ms under limit=" << RATE << " bytes/s";
+}
+
+struct MicroBatchWriteArgs {
+    brpc::Socket* sock;
+    size_t msg_size;
+};
+
+static void* MicroBatchWriteOnce(void* void_arg) {
+    MicroBatchWriteArgs* args = (MicroBatchWriteArgs*)void_arg;
+    butil::IOBuf msg;
+    msg.resize(args->msg_size, 'm');
+    brpc::Socket::WriteOptions wopt;
+    wopt.micro_batch_window_us = 2000;
+    wopt.micro_batch_max_count = 4;
+    EXPECT_EQ(0, args->sock->Write(&msg, &wopt));
+    return NULL;
+}
+
+TEST_F(SocketTest, micro_batch_write) {
+    const size_t MSG_SIZE = 1024;
+    const size_t NMSG = 16;
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    butil::EndPoint dummy;
+    ASSERT_EQ(0, str2endpoint("192.168.1.26:8080", &dummy));
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.remote_side = dummy;
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+
+    intptr_t reader_args[2] = { fds[0], (intptr_t)(NMSG * MSG_SIZE) };
+    pthread_t reader;
+    ASSERT_EQ(0, pthread_create(&reader, NULL, DrainFdUntil, reader_args));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        // Concurrent writers racing for the write head: the winner holds
+        // the flush for the window(or until 4 writes queue up) and the
+        // rest share its flush. Only delivery is asserted since the
+        // batching factor depends on scheduling.
+        MicroBatchWriteArgs warg = { s.get(), MSG_SIZE };
+        bthread_t th[NMSG];
+        for (size_t i = 0; i < NMSG; ++i) {
+            ASSERT_EQ(0, bthread_start_background(
+                          &th[i], NULL, MicroBatchWriteOnce, &warg));
+        }
+        for (size_t i = 0; i < NMSG; ++i) {
+            ASSERT_EQ(0, bthread_join(th[i], NULL));
+        }
+        ASSERT_EQ(0, pthread_join(reader, NULL));
+        ASSERT_EQ((intptr_t)(NMSG * MSG_SIZE), reader_args[1]);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
+TEST_F(SocketTest, batch_write) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    brpc::SocketId id = 8888;
+    butil::EndPoint dummy;
+    ASSERT_EQ(0, str2endpoint("192.168.1.26:8080", &dummy));
+    brpc::SocketOptions options;
+    options.fd = fds[1];
+    options.remote_side = dummy;
+    options.user = new CheckRecycle;
+    ASSERT_EQ(0, brpc::Socket::Create(options, &id));
+    {
+        brpc::SocketUniquePtr s;
+        ASSERT_EQ(0, brpc::Socket::Address(id, &s));
+        global_sock = s.get();
+        const int BATCH = 7;
+        for (size_t i = 0; i < 20; ++i) {
+            char buf[32 * BATCH];
+            size_t len = 0;
+            butil::IOBuf msgs[BATCH];
+            for (int j = 0; j < BATCH; ++j) {
+                if (j % 3 == 0) {
+                    // Empty message, should be skipped.
+                    continue;
+                }
+                const size_t sub_len = snprintf(
+                    buf + len, sizeof(buf) - len, "hello world! %lu.%d", i, j);
+                msgs[j].append(buf + len, sub_len);
+                len += sub_len;
+            }
+            ASSERT_EQ(0, s->WriteBatch(msgs, BATCH));
+            for (int j = 0; j < BATCH; ++j) {
+                ASSERT_TRUE(msgs[j].empty()) << "j=" << j;
+            }
+            // Messages should arrive concatenated in submission order.
+            char dest[sizeof(buf)];
+            size_t nread = 0;
+            while (nread < len) {
+                const ssize_t nr = read(fds[0], dest + nread, sizeof(dest) - nread);
+                ASSERT_GT(nr, 0);
+                nread += nr;
+            }
+            ASSERT_EQ(len, nread);
+            ASSERT_EQ(0, memcmp(buf, dest, len));
+        }
+        // A batch of all-empty messages is invalid.
+        butil::IOBuf empty_msgs[2];
+        ASSERT_EQ(-1, s->WriteBatch(empty_msgs, 2));
+        ASSERT_EQ(EINVAL, errno);
+        // pipelined_count is not supported.
+        butil::IOBuf src;
+        src.append("x");
+        brpc::Socket::WriteOptions wopt;
+        wopt.pipelined_count = 1;
+        ASSERT_EQ(-1, s->WriteBatch(&src, 1, &wopt));
+        ASSERT_EQ(EINVAL, errno);
+        ASSERT_EQ(0, s->SetFailed());
+    }
+    ASSERT_EQ((brpc::Socket*)NULL, global_sock);
+    close(fds[0]);
+}
+
 void EchoProcessHuluRequest(brpc::InputMessageBase* msg_base) {
     brpc::DestroyingPtr<brpc::policy::MostCommonMessage> msg(
         static_cast<brpc::policy::MostCommonMessage*>(msg_base));
@@ -0,0 +1,133 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "brpc/websocket.h"
+#include "butil/logging.h"
+
+class WebSocketTest : public testing::Test {
+};
+
+TEST_F(WebSocketTest, accept_key) {
+    // The example of RFC 6455 section 1.3.
+    ASSERT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+              brpc::ComputeWebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+TEST_F(WebSocketTest, unmasked_roundtrip) {
+    brpc::WebSocketFrame in;
+    in.opcode = brpc::WS_OPCODE_TEXT;
+    in.payload.append("Hello");
+    butil::IOBuf buf;
+    brpc::SerializeWebSocketFrame(&buf, in);
+    // Known serialization from RFC 6455 section 5.7.
+    ASSERT_EQ("\x81\x05Hello", buf.to_string());
+
+    brpc::WebSocketFrame out;
+    ASSERT_EQ(1, brpc::ParseWebSocketFrame(&buf, &out));
+    ASSERT_TRUE(buf.empty());
+    ASSERT_EQ(brpc::WS_OPCODE_TEXT, out.opcode);
+    ASSERT_TRUE(out.final);
+    ASSERT_EQ("Hello", out.payload.to_string());
+}
+
+TEST_F(WebSocketTest, masked_roundtrip) {
+    brpc::WebSocketFrame in;
+    in.opcode = brpc::WS_OPCODE_TEXT;
+    in.payload.append("Hello");
+    const uint32_t mask_key = 0x37FA213D;
+    butil::IOBuf buf;
+    brpc::SerializeWebSocketFrame(&buf, in, &mask_key);
+    // Known serialization from RFC 6455 section 5.7.
+    ASSERT_EQ(std::string("\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58", 11),
+              buf.to_string());
+
+    brpc::WebSocketFrame out;
+    ASSERT_EQ(1, brpc::ParseWebSocketFrame(&buf, &out));
+    ASSERT_TRUE(buf.empty());
+    ASSERT_EQ("Hello", out.payload.to_string());
+}
+
+TEST_F(WebSocketTest, extended_lengths) {
+    for (size_t size : { 5, 200, 70000 }) {
+        std::string payload;
+        for (size_t i = 0; i < size; ++i) {
+            payload.push_back('a' + i % 26);
+        }
+        brpc::WebSocketFrame in;
+        in.opcode = brpc::WS_OPCODE_BINARY;
+        in.payload.append(payload);
+        butil::IOBuf buf;
+        brpc::SerializeWebSocketFrame(&buf, in);
+        brpc::WebSocketFrame out;
+        ASSERT_EQ(1, brpc::ParseWebSocketFrame(&buf, &out)) << size;
+        ASSERT_TRUE(buf.empty());
+        ASSERT_EQ(payload, out.payload.to_string());
+
+        // Masking must not change what the parser sees either.
+        buf.clear();
+        const uint32_t mask_key = 0xDEADBEEF;
+        brpc::SerializeWebSocketFrame(&buf, in, &mask_key);
+        ASSERT_EQ(1, brpc::ParseWebSocketFrame(&buf, &out)) << size;
+        ASSERT_EQ(payload, out.payload.to_string());
+    }
+}
+
+TEST_F(WebSocketTest, incomplete_input_is_left_untouched) {
+    brpc::WebSocketFrame in;
+    in.opcode = brpc::WS_OPCODE_BINARY;
+    in.payload.append("0123456789");
+    butil::IOBuf whole;
+    brpc::SerializeWebSocketFrame(&whole, in);
+    for (size_t n = 0; n < whole.size(); ++n) {
+        butil::IOBuf part;
+        whole.append_to(&part, n);
+        brpc::WebSocketFrame out;
+        ASSERT_EQ(0, brpc::ParseWebSocketFrame(&part, &out)) << n;
+        ASSERT_EQ(n, part.size());
+    }
+    brpc::WebSocketFrame out;
+    ASSERT_EQ(1, brpc::ParseWebSocketFrame(&whole, &out));
+}
+
+TEST_F(WebSocketTest, malformed_frames) {
+    brpc::WebSocketFrame out;
+    {
+        // RSV1 set without a negotiated extension.
+        butil::IOBuf buf;
+        buf.append("\xC1\x00", 2);
+        ASSERT_EQ(-1, brpc::ParseWebSocketFrame(&buf, &out));
+    }
+    {
+        // Reserved opcode 0x3.
+        butil::IOBuf buf;
+        buf.append("\x83\x00", 2);
+        ASSERT_EQ(-1, brpc::ParseWebSocketFrame(&buf, &out));
+    }
+    {
+        // Fragmented control frame.
+        butil::IOBuf buf;
+        buf.append("\x09\x00", 2);
+        ASSERT_EQ(-1, brpc::ParseWebSocketFrame(&buf, &out));
+    }
+    {
+        // Control frame with a payload longer than 125.
+        butil::IOBuf buf;
+        buf.append("\x88\x7E\x01\x00", 4);
+        ASSERT_EQ(-1, brpc::ParseWebSocketFrame(&buf, &out));
+    }
+}
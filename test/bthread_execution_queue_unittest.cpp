@@ -87,6 +87,51 @@ TEST_F(ExecutionQueueTest, single_thread) {
     }
 }
 
+struct BatchMeta {
+    int64_t sum;
+    long last;
+};
+
+int batch_add(void* meta, bthread::TaskIterator<LongIntTask>& iter) {
+    stopped = iter.is_queue_stopped();
+    BatchMeta* m = (BatchMeta*)meta;
+    if (iter) {
+        EXPECT_GE(iter.num_ready(), 1ul);
+    }
+    for (; iter; ++iter) {
+        // Tasks of a batch keep their submission order
+        EXPECT_LT(m->last, iter->value);
+        m->last = iter->value;
+        m->sum += iter->value;
+    }
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, execute_batch) {
+    BatchMeta meta = { 0, -1 };
+    int64_t expected_result = 0;
+    long next_value = 0;
+    bthread::ExecutionQueueId<LongIntTask> queue_id;
+    ASSERT_EQ(0, bthread::execution_queue_start(&queue_id, NULL,
+                                                batch_add, &meta));
+    LongIntTask tasks[32];
+    for (int i = 0; i < 1000; ++i) {
+        const size_t n = butil::fast_rand_in(1, 32);
+        for (size_t j = 0; j < n; ++j) {
+            tasks[j] = LongIntTask(next_value);
+            expected_result += next_value++;
+        }
+        ASSERT_EQ(0, bthread::execution_queue_execute_batch(queue_id, tasks, n));
+    }
+    // Empty batches are no-op
+    ASSERT_EQ(0, bthread::execution_queue_execute_batch(queue_id, tasks, 0));
+    ASSERT_EQ(0, bthread::execution_queue_stop(queue_id));
+    ASSERT_NE(0, bthread::execution_queue_execute_batch(queue_id, tasks, 1));
+    ASSERT_EQ(0, bthread::execution_queue_join(queue_id));
+    ASSERT_EQ(expected_result, meta.sum);
+    ASSERT_TRUE(stopped);
+}
+
 class RValue {
 public:
     RValue() : _value(0) {}
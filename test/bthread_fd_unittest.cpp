@@ -549,6 +549,55 @@ TEST(FDTest, bthread_close_fd_which_did_not_call_bthread_functions) {
     ASSERT_EQ(0, bthread_close(fds[1]));
 }
 
+struct FileIOArgs {
+    int fd;
+    char content[64];
+};
+
+void* do_bthread_pwrite(void* arg) {
+    auto a = (FileIOArgs*)arg;
+    EXPECT_EQ((ssize_t)strlen(a->content),
+              bthread_pwrite(a->fd, a->content, strlen(a->content), 8));
+    return NULL;
+}
+
+void* do_bthread_pread(void* arg) {
+    auto a = (FileIOArgs*)arg;
+    char buf[64] = {};
+    EXPECT_EQ((ssize_t)strlen(a->content),
+              bthread_pread(a->fd, buf, sizeof(buf), 8));
+    EXPECT_STREQ(a->content, buf);
+    return NULL;
+}
+
+TEST(FDTest, bthread_pread_pwrite) {
+    char path[] = "/tmp/bthread_file_io_unittest.XXXXXX";
+    butil::fd_guard fd(mkstemp(path));
+    ASSERT_GE(fd, 0);
+    unlink(path);
+
+    FileIOArgs args;
+    args.fd = fd;
+    snprintf(args.content, sizeof(args.content), "the quick brown fox");
+
+    // From a bthread: only the calling bthread suspends.
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, do_bthread_pwrite, &args));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    ASSERT_EQ(0, bthread_start_urgent(&th, NULL, do_bthread_pread, &args));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+
+    // From a plain pthread: falls through to the syscall.
+    char buf[64] = {};
+    ASSERT_EQ((ssize_t)strlen(args.content),
+              bthread_pread(fd, buf, sizeof(buf), 8));
+    ASSERT_STREQ(args.content, buf);
+
+    // Errors keep pread semantics.
+    ASSERT_EQ(-1, bthread_pread(-1, buf, sizeof(buf), 0));
+    ASSERT_EQ(EBADF, errno);
+}
+
 TEST(FDTest, double_close) {
     int fds[2];
     ASSERT_EQ(0, pipe(fds));
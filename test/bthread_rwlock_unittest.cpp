@@ -169,6 +169,78 @@ TEST(RWLockTest, trylock) {
     ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
 }
 
+struct BigReaderArgs {
+    bthread_rwlock_t* rw;
+    volatile int value;
+};
+
+void* big_reader_locker(void* arg) {
+    auto a = (BigReaderArgs*)arg;
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(0, bthread_rwlock_rdlock(a->rw));
+        // Writers keep the protected value even, readers never observe
+        // an odd value.
+        EXPECT_EQ(0, a->value % 2);
+        EXPECT_EQ(0, bthread_rwlock_unlock(a->rw));
+    }
+    return NULL;
+}
+
+void* big_reader_writer(void* arg) {
+    auto a = (BigReaderArgs*)arg;
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(0, bthread_rwlock_wrlock(a->rw));
+        ++a->value;
+        bthread_usleep(10);
+        ++a->value;
+        EXPECT_EQ(0, bthread_rwlock_unlock(a->rw));
+    }
+    return NULL;
+}
+
+TEST(RWLockTest, big_reader_kind) {
+    bthread_rwlockattr_t attr;
+    ASSERT_EQ(0, bthread_rwlockattr_init(&attr));
+    ASSERT_EQ(EINVAL, bthread_rwlockattr_setkind_np(&attr, 10086));
+    ASSERT_EQ(0, bthread_rwlockattr_setkind_np(
+        &attr, BTHREAD_RWLOCK_KIND_BIGREADER_NP));
+    int kind = BTHREAD_RWLOCK_KIND_DEFAULT_NP;
+    ASSERT_EQ(0, bthread_rwlockattr_getkind_np(&attr, &kind));
+    ASSERT_EQ(BTHREAD_RWLOCK_KIND_BIGREADER_NP, kind);
+
+    bthread_rwlock_t rw;
+    ASSERT_EQ(0, bthread_rwlock_init(&rw, &attr));
+    ASSERT_EQ(0, bthread_rwlockattr_destroy(&attr));
+
+    // Same semantics as the default kind.
+    ASSERT_EQ(0, bthread_rwlock_rdlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, bthread_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_trywrlock(&rw));
+    ASSERT_EQ(EBUSY, bthread_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(0, bthread_rwlock_unlock(&rw));
+
+    BigReaderArgs args{&rw, 0};
+    pthread_t rdth[8];
+    pthread_t wrth[2];
+    for (size_t i = 0; i < ARRAY_SIZE(rdth); ++i) {
+        ASSERT_EQ(0, pthread_create(&rdth[i], NULL, big_reader_locker, &args));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(wrth); ++i) {
+        ASSERT_EQ(0, pthread_create(&wrth[i], NULL, big_reader_writer, &args));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(rdth); ++i) {
+        pthread_join(rdth[i], NULL);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(wrth); ++i) {
+        pthread_join(wrth[i], NULL);
+    }
+    ASSERT_EQ(200, args.value);
+    ASSERT_EQ(0, bthread_rwlock_destroy(&rw));
+}
+
 TEST(RWLockTest, cpp_wrapper) {
     bthread::RWLock rw;
     ASSERT_TRUE(rw.try_rdlock());
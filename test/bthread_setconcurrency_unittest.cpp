@@ -222,4 +222,45 @@ TEST(BthreadTest, concurrency_by_tag) {
     ASSERT_EQ(concurrency_by_tag(con + 1), true);
 }
 
+void* elastic_proc(void* arg) {
+    ((butil::atomic<int>*)arg)->fetch_add(1, butil::memory_order_relaxed);
+    return NULL;
+}
+
+TEST(BthreadTest, elastic_workers) {
+    ASSERT_FALSE(GFLAGS_NAMESPACE::SetCommandLineOption(
+        "bthread_elastic_workers", "true").empty());
+    // Park aggressively so that the test exercises deep parking and the
+    // wakeup path within a few idle cycles.
+    ASSERT_FALSE(GFLAGS_NAMESPACE::SetCommandLineOption(
+        "bthread_elastic_park_after_idle", "1").empty());
+
+    // Repeated bursts with idle gaps: every burst must complete even if
+    // workers parked deeply in the preceding gap.
+    butil::atomic<int> nran(0);
+    const int ROUND = 20;
+    const int N = 100;
+    for (int r = 0; r < ROUND; ++r) {
+        bthread_t tids[N];
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, bthread_start_background(
+                &tids[i], &BTHREAD_ATTR_SMALL, elastic_proc, &nran));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, bthread_join(tids[i], NULL));
+        }
+        usleep(10 * 1000);
+    }
+    ASSERT_EQ(ROUND * N, nran.load(butil::memory_order_relaxed));
+
+    bthread::TaskControl* c = bthread::g_task_control;
+    ASSERT_TRUE(c != NULL);
+    const int64_t parked = c->get_deep_parked_worker_count();
+    ASSERT_GE(parked, 0);
+    ASSERT_EQ(c->concurrency() - parked, c->get_active_worker_count());
+
+    ASSERT_FALSE(GFLAGS_NAMESPACE::SetCommandLineOption(
+        "bthread_elastic_workers", "false").empty());
+}
+
 } // namespace
@@ -135,4 +135,105 @@ TEST(WSQTest, sanity) {
               << " popped=" << npopped
               << " left=" << (N - nstolen - npopped)  << std::endl;
 }
+
+TEST(WSQTest, steal_batch_takes_at_most_half) {
+    bthread::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(32));
+    for (size_t i = 0; i < 16; ++i) {
+        ASSERT_TRUE(q.push(i));
+    }
+    value_type vals[16];
+    // Never takes more than asked.
+    ASSERT_EQ(4u, q.steal_batch(vals, 4));
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_EQ(i, vals[i]);
+    }
+    // 12 items left, at most half of them in one batch.
+    ASSERT_EQ(6u, q.steal_batch(vals, 16));
+    for (size_t i = 0; i < 6; ++i) {
+        ASSERT_EQ(i + 4, vals[i]);
+    }
+    ASSERT_EQ(6u, q.volatile_size());
+    // Drains completely when called repeatedly.
+    size_t n;
+    size_t expected = 10;
+    while ((n = q.steal_batch(vals, 16)) != 0) {
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_EQ(expected++, vals[i]);
+        }
+    }
+    ASSERT_EQ(16u, expected);
+    ASSERT_EQ(0u, q.volatile_size());
+}
+
+void* steal_batch_thread(void* arg) {
+    std::vector<value_type> *stolen = new std::vector<value_type>;
+    stolen->reserve(N);
+    bthread::WorkStealingQueue<value_type> *q =
+        (bthread::WorkStealingQueue<value_type>*)arg;
+    value_type vals[4];
+    while (!g_stop) {
+        const size_t n = q->steal_batch(vals, ARRAY_SIZE(vals));
+        if (n != 0) {
+            stolen->insert(stolen->end(), vals, vals + n);
+        } else {
+#if defined(ARCH_CPU_ARM_FAMILY)
+            asm volatile("yield\n": : :"memory");
+#elif defined(ARCH_CPU_LOONGARCH64_FAMILY)
+            asm volatile("nop\n": : :"memory");
+#else
+            asm volatile("pause\n": : :"memory");
+#endif
+        }
+    }
+    return stolen;
+}
+
+TEST(WSQTest, batched_sanity) {
+    g_stop = false;
+    bthread::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(CAP));
+    pthread_t rth[8];
+    pthread_t wth, pop_th;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        ASSERT_EQ(0, pthread_create(&rth[i], NULL, steal_batch_thread, &q));
+    }
+    ASSERT_EQ(0, pthread_create(&wth, NULL, push_thread, &q));
+    ASSERT_EQ(0, pthread_create(&pop_th, NULL, pop_thread, &q));
+
+    std::vector<value_type> values;
+    values.reserve(N);
+    size_t nstolen = 0, npopped = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(rth); ++i) {
+        std::vector<value_type>* res = NULL;
+        pthread_join(rth[i], (void**)&res);
+        for (size_t j = 0; j < res->size(); ++j, ++nstolen) {
+            values.push_back((*res)[j]);
+        }
+        delete res;
+    }
+    pthread_join(wth, NULL);
+    std::vector<value_type>* res = NULL;
+    pthread_join(pop_th, (void**)&res);
+    for (size_t j = 0; j < res->size(); ++j, ++npopped) {
+        values.push_back((*res)[j]);
+    }
+    delete res;
+
+    value_type val;
+    while (q.pop(&val)) {
+        values.push_back(val);
+    }
+
+    std::sort(values.begin(), values.end());
+    values.resize(std::unique(values.begin(), values.end()) - values.begin());
+
+    ASSERT_EQ(N, values.size());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(i, values[i]);
+    }
+    std::cout << "stolen=" << nstolen
+              << " popped=" << npopped
+              << " left=" << (N - nstolen - npopped)  << std::endl;
+}
 } // namespace
@@ -194,6 +194,37 @@ TEST_F(MultiDimensionTest, madder) {
     ASSERT_STREQ("hello world", my_str1->get_value().c_str());
 }
 
+TEST_F(MultiDimensionTest, madder_label_cache) {
+    std::list<std::string> labels_value = {"bj", "get", "200"};
+    bvar::MultiDimension<bvar::Adder<uint64_t> > my_madder("request_count_madder_cached", labels);
+    bvar::Adder<uint64_t>* my_adder = my_madder.get_stats(labels_value);
+    ASSERT_TRUE(my_adder);
+    // Repeated lookups hit the thread local cache and must return the
+    // same object
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(my_adder, my_madder.get_stats(labels_value));
+        *my_madder.get_stats(labels_value) << 1;
+    }
+    ASSERT_EQ(100u, my_adder->get_value());
+
+    // Deleting the stat invalidates the cache, the next lookup creates
+    // a fresh metric
+    my_madder.delete_stats(labels_value);
+    ASSERT_FALSE(my_madder.has_stats(labels_value));
+    bvar::Adder<uint64_t>* recreated = my_madder.get_stats(labels_value);
+    ASSERT_TRUE(recreated);
+    ASSERT_EQ(0u, recreated->get_value());
+
+    // Different label values with the same cache never mix up
+    std::list<std::string> other_value = {"sh", "put", "500"};
+    bvar::Adder<uint64_t>* other = my_madder.get_stats(other_value);
+    ASSERT_TRUE(other);
+    ASSERT_NE(recreated, other);
+    *other << 7;
+    ASSERT_EQ(7u, other->get_value());
+    ASSERT_EQ(0u, recreated->get_value());
+}
+
 TEST_F(MultiDimensionTest, mmadder_perf) {
     std::list<std::string> labels_value = {"bj", "get", "200"};
     bvar::MultiDimension<bvar::Adder<uint64_t> > my_madder1("request_count_madder_uint64_t", labels);
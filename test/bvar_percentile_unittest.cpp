@@ -18,6 +18,7 @@
 // Date: 2015/09/15 15:42:55
 
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/ddsketch.h"
 #include "butil/logging.h"
 #include <gtest/gtest.h>
 #include <fstream>
@@ -186,3 +187,43 @@ TEST_F(PercentileTest, combine_of) {
                   
     }
 }
+
+TEST_F(PercentileTest, ddsketch_add) {
+    bvar::detail::DDSketchPercentile p;
+    for (int j = 0; j < 10; ++j) {
+        for (int i = 0; i < 10000; ++i) {
+            p << (i + 1);
+        }
+        bvar::detail::DDSketchSamples b = p.reset();
+        ASSERT_EQ(10000u, b.added_count());
+        int64_t last_value = 0;
+        for (uint32_t k = 1; k <= 10u; ++k) {
+            const int64_t value = b.get_number(k / 10.0);
+            EXPECT_GE(value, last_value);
+            last_value = value;
+            // relative error is bounded by DDSKETCH_ALPHA
+            EXPECT_GT(value, k * 1000 * (1 - 2 * bvar::detail::DDSKETCH_ALPHA))
+                << "k=" << k;
+            EXPECT_LT(value, k * 1000 * (1 + 2 * bvar::detail::DDSKETCH_ALPHA))
+                << "k=" << k;
+        }
+    }
+}
+
+TEST_F(PercentileTest, ddsketch_merge) {
+    bvar::detail::DDSketchSamples b1;
+    bvar::detail::DDSketchSamples b2;
+    for (int i = 0; i < 50000; ++i) {
+        b1.add(i + 1);
+        b2.add(i + 50001);
+    }
+    b1.merge(b2);
+    ASSERT_EQ(100000u, b1.added_count());
+    for (uint32_t k = 1; k <= 10u; ++k) {
+        const int64_t value = b1.get_number(k / 10.0);
+        EXPECT_GT(value, k * 10000 * (1 - 2 * bvar::detail::DDSKETCH_ALPHA))
+            << "k=" << k;
+        EXPECT_LT(value, k * 10000 * (1 + 2 * bvar::detail::DDSKETCH_ALPHA))
+            << "k=" << k;
+    }
+}
@@ -18,6 +18,7 @@
 #include <limits>                           //std::numeric_limits
 
 #include "bvar/reducer.h"
+#include "bvar/percpu_adder.h"
 
 #include "butil/time.h"
 #include "butil/macros.h"
@@ -62,6 +63,46 @@ TEST_F(ReducerTest, adder) {
     ASSERT_EQ(-5, reducer3.get_value());
 }
 
+TEST_F(ReducerTest, percpu_adder) {
+    bvar::PerCpuAdder adder;
+    ASSERT_TRUE(adder.valid());
+    adder << 2 << 4;
+    ASSERT_EQ(6, adder.get_value());
+    adder << -9 << 1 << 0 << 3;
+    ASSERT_EQ(1, adder.get_value());
+    ASSERT_EQ(1, adder.reset());
+    ASSERT_EQ(0, adder.get_value());
+}
+
+static void* percpu_adder_counter(void* arg) {
+    bvar::PerCpuAdder* adder = (bvar::PerCpuAdder*)arg;
+    for (size_t i = 0; i < 500000; ++i) {
+        (*adder) << 2;
+    }
+    return NULL;
+}
+
+TEST_F(ReducerTest, percpu_adder_multi_threaded) {
+    bvar::PerCpuAdder adder;
+    pthread_t threads[8];
+    for (size_t i = 0; i < ARRAY_SIZE(threads); ++i) {
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                                    percpu_adder_counter, &adder));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(threads); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ASSERT_EQ((int64_t)(2 * 500000 * ARRAY_SIZE(threads)), adder.get_value());
+}
+
+TEST_F(ReducerTest, percpu_adder_window) {
+    bvar::PerCpuAdder adder;
+    bvar::Window<bvar::PerCpuAdder> w1(&adder, 1);
+    ASSERT_EQ(0, w1.get_value());
+    adder << 10;
+    ASSERT_EQ(10, adder.get_value());
+}
+
 const size_t OPS_PER_THREAD = 500000;
 
 static void *thread_counter(void *arg) {
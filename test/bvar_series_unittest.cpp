@@ -0,0 +1,158 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <sstream>
+#include "bvar/detail/series.h"
+
+namespace {
+
+struct AddToInt64 {
+    void operator()(int64_t& lhs, int64_t rhs) const { lhs += rhs; }
+};
+
+struct AddToDouble {
+    void operator()(double& lhs, double rhs) const { lhs += rhs; }
+};
+
+struct AddToVector {
+    void operator()(bvar::Vector<int64_t, 4>& lhs,
+                    const bvar::Vector<int64_t, 4>& rhs) const {
+        lhs += rhs;
+    }
+};
+
+class SeriesTest : public testing::Test {
+protected:
+    void SetUp() {}
+    void TearDown() {}
+};
+
+TEST_F(SeriesTest, xor_block_round_trip) {
+    // Flat, slowly-varying and random patterns must all round-trip.
+    const int N = 60;
+    uint64_t values[N];
+    srand(0);
+    for (int pattern = 0; pattern < 3; ++pattern) {
+        bvar::detail::XorSeriesBlock block;
+        for (int i = 0; i < N; ++i) {
+            switch (pattern) {
+            case 0: values[i] = 42; break;
+            case 1: values[i] = 100000 + i * 3; break;
+            default: values[i] = ((uint64_t)rand() << 32) | rand(); break;
+            }
+            block.append(values[i]);
+        }
+        ASSERT_EQ(N, block.count());
+        uint64_t out[N];
+        ASSERT_EQ(N, block.decompress(out, N));
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(values[i], out[i]) << "pattern=" << pattern << " i=" << i;
+        }
+        if (pattern == 0) {
+            // A flat series costs 1 bit per sample after the first one.
+            ASSERT_LT(block.byte_size(), sizeof(uint64_t) * N / 4 + sizeof(block));
+        }
+    }
+}
+
+TEST_F(SeriesTest, tier_window_across_rotation) {
+    bvar::detail::CompressedSeriesTier<int64_t> tier(5);
+    int64_t window[5];
+
+    // Not filled yet: zero-padded at the front.
+    tier.append(1);
+    tier.append(2);
+    tier.latest_window(window);
+    const int64_t expected1[5] = { 0, 0, 0, 1, 2 };
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(expected1[i], window[i]) << "i=" << i;
+    }
+
+    for (int64_t v = 3; v <= 5; ++v) {
+        tier.append(v);
+    }
+    ASSERT_EQ(5, tier.appended_count());
+    tier.rotate();
+    tier.append(6);
+    tier.append(7);
+
+    // The window spans the rotated and the current block.
+    tier.latest_window(window);
+    const int64_t expected2[5] = { 3, 4, 5, 6, 7 };
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(expected2[i], window[i]) << "i=" << i;
+    }
+}
+
+TEST_F(SeriesTest, describe_scalar) {
+    bvar::detail::Series<int64_t, AddToInt64> series((AddToInt64()));
+    for (int64_t i = 1; i <= 10; ++i) {
+        series.append(i);
+    }
+    std::ostringstream os;
+    series.describe(os, NULL);
+    const std::string out = os.str();
+    // Seconds are plotted at index 114..173, the last 10 hold the data.
+    ASSERT_NE(std::string::npos, out.find("[163,0]")) << out;
+    ASSERT_NE(std::string::npos, out.find("[164,1]")) << out;
+    ASSERT_NE(std::string::npos, out.find("[173,10]")) << out;
+}
+
+TEST_F(SeriesTest, describe_scalar_aggregation) {
+    bvar::detail::Series<int64_t, AddToInt64> series((AddToInt64()));
+    // Filling a minute aggregates 60 seconds into one minute sample.
+    // AddTo looks like addition, so the sum is divided back by 60.
+    for (int i = 0; i < 60; ++i) {
+        series.append(6);
+    }
+    std::ostringstream os;
+    series.describe(os, NULL);
+    const std::string out = os.str();
+    // The minute window ends at index 113.
+    ASSERT_NE(std::string::npos, out.find("[113,6]")) << out;
+}
+
+TEST_F(SeriesTest, describe_double) {
+    bvar::detail::Series<double, AddToDouble> series((AddToDouble()));
+    series.append(0.5);
+    series.append(2.25);
+    std::ostringstream os;
+    series.describe(os, NULL);
+    const std::string out = os.str();
+    ASSERT_NE(std::string::npos, out.find("[172,0.5]")) << out;
+    ASSERT_NE(std::string::npos, out.find("[173,2.25]")) << out;
+}
+
+TEST_F(SeriesTest, describe_vector) {
+    // Vectors stay on the plain ring storage.
+    bvar::detail::Series<bvar::Vector<int64_t, 4>, AddToVector>
+        series((AddToVector()));
+    bvar::Vector<int64_t, 4> v;
+    for (size_t i = 0; i < 4; ++i) {
+        v[i] = i + 1;
+    }
+    series.append(v);
+    std::ostringstream os;
+    series.describe(os, NULL);
+    const std::string out = os.str();
+    ASSERT_NE(std::string::npos, out.find("\"label\":\"Vector[0]\"")) << out;
+    ASSERT_NE(std::string::npos, out.find("[173,4]")) << out;
+}
+
+} // namespace
@@ -0,0 +1,150 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "butil/string_printf.h"
+#include "butil/containers/concurrent_lru_cache.h"
+
+namespace {
+class ConcurrentLRUCacheTest : public ::testing::Test{
+protected:
+    ConcurrentLRUCacheTest(){};
+    virtual ~ConcurrentLRUCacheTest(){};
+    virtual void SetUp() {
+    };
+    virtual void TearDown() {
+    };
+};
+
+TEST_F(ConcurrentLRUCacheTest, sanity) {
+    butil::ConcurrentLRUCache<std::string, int> cache;
+    // Not initialized yet.
+    ASSERT_EQ(-1, cache.init(0));
+    ASSERT_EQ(0, cache.init(1000, 4));
+    ASSERT_EQ(-1, cache.init(1000, 4));
+
+    int value = 0;
+    ASSERT_FALSE(cache.Get("foo", &value));
+    ASSERT_EQ(1u, cache.miss_count());
+
+    cache.Put("foo", 1, 10);
+    cache.Put("bar", 2, 20);
+    ASSERT_EQ(2u, cache.size());
+    ASSERT_EQ(30u, cache.bytes());
+
+    ASSERT_TRUE(cache.Get("foo", &value));
+    ASSERT_EQ(1, value);
+    ASSERT_TRUE(cache.Get("bar", NULL));
+    ASSERT_EQ(2u, cache.hit_count());
+
+    // Overwriting updates both value and accounted bytes.
+    cache.Put("foo", 3, 15);
+    ASSERT_TRUE(cache.Get("foo", &value));
+    ASSERT_EQ(3, value);
+    ASSERT_EQ(35u, cache.bytes());
+
+    ASSERT_TRUE(cache.Remove("foo"));
+    ASSERT_FALSE(cache.Remove("foo"));
+    ASSERT_FALSE(cache.Get("foo", &value));
+    ASSERT_EQ(1u, cache.size());
+
+    cache.Clear();
+    ASSERT_EQ(0u, cache.size());
+    ASSERT_EQ(0u, cache.bytes());
+}
+
+TEST_F(ConcurrentLRUCacheTest, evict_least_recently_used) {
+    // One shard so that all keys share one recency list.
+    butil::ConcurrentLRUCache<int, int> cache;
+    ASSERT_EQ(0, cache.init(10, 1));
+    for (int i = 0; i < 10; ++i) {
+        cache.Put(i, i, 1);
+    }
+    ASSERT_EQ(10u, cache.size());
+    ASSERT_EQ(0u, cache.eviction_count());
+
+    // Touch 0..4 to make 5 the least-recently-used entry.
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(cache.Get(i, NULL));
+    }
+    cache.Put(100, 100, 1);
+    ASSERT_EQ(10u, cache.size());
+    ASSERT_EQ(1u, cache.eviction_count());
+    ASSERT_FALSE(cache.Get(5, NULL));
+    ASSERT_TRUE(cache.Get(0, NULL));
+    ASSERT_TRUE(cache.Get(100, NULL));
+
+    // An oversized entry evicts everything else but stays itself.
+    cache.Put(200, 200, 100);
+    ASSERT_EQ(1u, cache.size());
+    ASSERT_TRUE(cache.Get(200, NULL));
+}
+
+struct ReaderArg {
+    butil::ConcurrentLRUCache<int, int>* cache;
+    int nkey;
+    size_t nfound;
+};
+
+static void* read_cache(void* void_arg) {
+    ReaderArg* arg = static_cast<ReaderArg*>(void_arg);
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < arg->nkey; ++i) {
+            int value = 0;
+            if (arg->cache->Get(i, &value)) {
+                EXPECT_EQ(i * 2, value);
+                ++arg->nfound;
+            }
+        }
+    }
+    return NULL;
+}
+
+TEST_F(ConcurrentLRUCacheTest, concurrent_access) {
+    const int NKEY = 1000;
+    butil::ConcurrentLRUCache<int, int> cache;
+    ASSERT_EQ(0, cache.init(NKEY * 2));
+    for (int i = 0; i < NKEY; ++i) {
+        cache.Put(i, i * 2, 1);
+    }
+    pthread_t tids[8];
+    ReaderArg args[8];
+    for (size_t i = 0; i < arraysize(tids); ++i) {
+        args[i].cache = &cache;
+        args[i].nkey = NKEY;
+        args[i].nfound = 0;
+        ASSERT_EQ(0, pthread_create(&tids[i], NULL, read_cache, &args[i]));
+    }
+    // Writers run along with the readers.
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < NKEY; i += 7) {
+            cache.Put(i, i * 2, 1);
+        }
+    }
+    size_t nfound = 0;
+    for (size_t i = 0; i < arraysize(tids); ++i) {
+        ASSERT_EQ(0, pthread_join(tids[i], NULL));
+        nfound += args[i].nfound;
+    }
+    ASSERT_GT(nfound, 0u);
+    ASSERT_EQ(cache.hit_count(), nfound);
+    ASSERT_EQ(NKEY, (int)cache.size());
+}
+} // namespace
@@ -7,8 +7,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <string>
 #include <gtest/gtest.h>
 #include "butil/crc32c.h"
+#include "butil/macros.h"
 
 namespace butil {
 namespace crc32c {
@@ -73,5 +75,25 @@ TEST_F(CRC, fast_is_on) {
   std::cout << "IsFastCrc32Supported=" << IsFastCrc32Supported() << std::endl;
 }
 
+TEST_F(CRC, LargeBuffers) {
+  // Sizes around the segment boundaries of the 3-way hardware kernel
+  // (3*256 and 3*8192) and odd alignments, checked against the
+  // incremental property which a mismatched stream merge would break.
+  std::string data(100000, 0);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 131 + 17);
+  }
+  const size_t sizes[] = { 767, 768, 769, 24575, 24576, 24577, 100000 };
+  for (size_t s = 0; s < ARRAY_SIZE(sizes); ++s) {
+    for (size_t offset = 0; offset < 9; ++offset) {
+      const char* p = data.data() + offset;
+      const size_t n = sizes[s] - offset;
+      const size_t half = n / 2;
+      ASSERT_EQ(Value(p, n), Extend(Value(p, half), p + half, n - half))
+          << "size=" << n << " offset=" << offset;
+    }
+  }
+}
+
 }  // namespace crc32c
 }  // namespace butil
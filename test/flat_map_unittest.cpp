@@ -384,6 +384,35 @@ TEST_F(FlatMapTest, make_sure_all_methods_compile) {
     std::cout << std::endl;
 }
 
+TEST_F(FlatMapTest, fast_string_hasher) {
+    // Test vectors of the reference wyhash (final version 3).
+    ASSERT_EQ(0x42bc986dc5eec4d3ull, butil::wyhash("", 0, 0));
+    ASSERT_EQ(0x84508dc903c31551ull, butil::wyhash("a", 1, 1));
+    ASSERT_EQ(0x0bc54887cfc9ecb1ull, butil::wyhash("abc", 3, 2));
+    ASSERT_EQ(0x6e2ff3298208a67cull, butil::wyhash("message digest", 14, 3));
+    ASSERT_EQ(0x9a64e42e897195b9ull,
+              butil::wyhash("abcdefghijklmnopqrstuvwxyz", 26, 4));
+
+    // All key types hash equally.
+    butil::FastStringHasher h;
+    const std::string key = "up_latency_as_key";
+    ASSERT_EQ(h(key), h(key.c_str()));
+    ASSERT_EQ(h(key), h(butil::StringPiece(key)));
+
+    butil::FlatMap<std::string, size_t, butil::FastStringHasher> m1;
+    const size_t N = 10000;
+    ASSERT_EQ(0, m1.init(N));
+    for (size_t i = 0; i < N; ++i) {
+        m1[butil::string_printf("up_latency_as_key_%lu", i)] = i;
+    }
+    ASSERT_EQ(N, m1.size());
+    for (size_t i = 0; i < N; ++i) {
+        size_t* v = m1.seek(butil::string_printf("up_latency_as_key_%lu", i));
+        ASSERT_NE(nullptr, v);
+        ASSERT_EQ(i, *v);
+    }
+}
+
 TEST_F(FlatMapTest, flat_map_of_string) {
     std::vector<std::string> keys;
     butil::FlatMap<std::string, size_t> m1;
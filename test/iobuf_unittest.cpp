@@ -33,6 +33,7 @@
 #include <butil/fd_guard.h>
 #include <butil/errno.h>
 #include <butil/fast_rand.h>
+#include <gflags/gflags.h>
 #include "iobuf.pb.h"
 
 namespace butil {
@@ -1890,4 +1891,33 @@ TEST_F(IOBufTest, reserve_aligned) {
     }
 }
 
+TEST_F(IOBufTest, size_classed_append) {
+    GFLAGS_NAMESPACE::SetCommandLineOption("iobuf_size_classed_blocks", "true");
+
+    std::string s;
+    s.reserve(1024 * 1024);
+    for (size_t i = 0; i < 1024 * 1024; ++i) {
+        s.push_back((char)butil::fast_rand_in('a', 'z'));
+    }
+    butil::IOBuf b;
+    ASSERT_EQ(0, b.append(s.data(), s.size()));
+    ASSERT_EQ(s.size(), b.length());
+    // 1MB lands in 256K-class blocks instead of 128 default blocks.
+    ASSERT_LE(b.backing_block_num(), 5u);
+    ASSERT_EQ(s, to_str(b));
+
+    // Small appends still go through the shared TLS block.
+    butil::IOBuf small;
+    ASSERT_EQ(0, small.append("hello", 5));
+    ASSERT_EQ(1u, small.backing_block_num());
+
+    // Recycled block memory is reused without corruption.
+    b.clear();
+    butil::IOBuf c;
+    ASSERT_EQ(0, c.append(s.data(), s.size()));
+    ASSERT_EQ(s, to_str(c));
+
+    GFLAGS_NAMESPACE::SetCommandLineOption("iobuf_size_classed_blocks", "false");
+}
+
 } // namespace
@@ -4,6 +4,7 @@
 
 #include "butil/basictypes.h"
 #include "butil/logging.h"
+#include "butil/async_log_sink.h"
 #include "gperftools_helper.h"
 #include "butil/files/temp_file.h"
 #include "butil/popen.h"
@@ -200,6 +201,36 @@ TEST_F(LoggingTest, streaming_log_sanity) {
               PLOG_STREAM(FATAL).content_str());
 }
 
+TEST_F(LoggingTest, async_log_sink) {
+    ::logging::StringSink log_str;
+    ::logging::AsyncLogSink async_sink(&log_str);
+    ::logging::LogSink* old_sink = ::logging::SetLogSink(&async_sink);
+    LOG(WARNING) << "written out asynchronously";
+    // Wait for the background flush.
+    for (int i = 0; i < 100 && log_str.empty(); ++i) {
+        usleep(10 * 1000);
+    }
+    ::logging::SetLogSink(old_sink);
+    ASSERT_NE(std::string::npos, log_str.find("written out asynchronously"));
+    ASSERT_EQ(0, async_sink.discarded());
+
+    // A tiny ring drops instead of blocking.
+    ::logging::StringSink log_str2;
+    ::logging::AsyncLogSinkOptions options;
+    options.records_per_thread = 1;
+    options.flush_interval_ms = 1000;
+    {
+        ::logging::AsyncLogSink small_sink(&log_str2, options);
+        old_sink = ::logging::SetLogSink(&small_sink);
+        for (int i = 0; i < 1000; ++i) {
+            LOG(WARNING) << "burst " << i;
+        }
+        ::logging::SetLogSink(old_sink);
+        ASSERT_GT(small_sink.discarded(), 0);
+    }  // dtor drains the staged records.
+    ASSERT_NE(std::string::npos, log_str2.find("burst 0"));
+}
+
 TEST_F(LoggingTest, log_at) {
     ::logging::StringSink log_str;
     ::logging::LogSink* old_sink = ::logging::SetLogSink(&log_str);
@@ -198,6 +198,51 @@ TEST(RandUtilTest, DISABLED_RandBytesPerf) {
               << (end - now).InMicroseconds() << "ms";
 }
 
+TEST(RandUtilTest, fast_rand_batched_less_than) {
+    // range 0 and 1 are edge cases.
+    ASSERT_EQ(0u, butil::fast_rand_batched_less_than(0));
+    ASSERT_EQ(0u, butil::fast_rand_batched_less_than(1));
+
+    // All results stay inside [0, range) and every bucket is hit roughly
+    // uniformly.
+    const uint64_t kRange = 17;
+    const int kTestIterations = 170000;
+    int buckets[kRange] = {};
+    for (int i = 0; i < kTestIterations; ++i) {
+        const uint64_t r = butil::fast_rand_batched_less_than(kRange);
+        ASSERT_LT(r, kRange);
+        ++buckets[r];
+    }
+    const int expected = kTestIterations / kRange;
+    for (uint64_t i = 0; i < kRange; ++i) {
+        ASSERT_GT(buckets[i], expected / 2) << "i=" << i;
+        ASSERT_LT(buckets[i], expected * 2) << "i=" << i;
+    }
+
+    // Consecutive full-width numbers shall not repeat.
+    ASSERT_NE(butil::fast_rand_batched(), butil::fast_rand_batched());
+}
+
+TEST(RandUtilTest, fast_rand_batched_perf) {
+    const int kTestIterations = 1000000;
+    const int kRange = 17;
+    uint64_t s = 0;
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < kTestIterations; ++i) {
+        s += butil::fast_rand_batched_less_than(kRange);
+    }
+    tm.stop();
+    LOG(INFO) << "Each fast_rand_batched_less_than took "
+              << tm.n_elapsed() / kTestIterations
+              << " ns, s=" << s
+#if !defined(NDEBUG)
+              << " (debugging version)";
+#else
+             ;
+#endif
+}
+
 TEST(RandUtilTest, fast_rand_perf) {
     const int kTestIterations = 1000000;
     const int kRange = 17;
@@ -321,4 +321,118 @@ TEST(RecordIOTest, write_read_random) {
     ASSERT_LE(str.size() - rr.offset(), 3u);
 }
 
+TEST(RecordIOTest, batched_writer) {
+    StringWriter sw;
+    butil::RecordWriter rw(&sw, 64 * 1024/*flush_threshold*/);
+    const int N = 100;
+    size_t nbytes = 0;
+    for (int i = 0; i < N; ++i) {
+        butil::Record src;
+        src.MutablePayload()->append(
+            butil::string_printf("payload_%d", i));
+        ASSERT_EQ(0, rw.Write(src));
+        nbytes += src.ByteSize();
+        // Small records stay buffered instead of being written one by one.
+        ASSERT_EQ(0u, sw.str().size());
+    }
+    ASSERT_EQ(0, rw.Flush());
+    ASSERT_EQ(nbytes, sw.str().size());
+
+    StringReader sr(sw.str());
+    butil::RecordReader rr(&sr);
+    butil::Record r;
+    int j = 0;
+    for (; rr.ReadNext(&r); ++j) {
+        ASSERT_EQ(butil::string_printf("payload_%d", j), r.Payload());
+    }
+    ASSERT_EQ(N, j);
+    ASSERT_EQ((int)butil::RecordReader::END_OF_READER, rr.last_error());
+}
+
+// ASSERT_* of gtest cannot be used in functions returning non-void.
+#define ASSERT_TRUE_RET(expr, ret)               \
+    do {                                         \
+        EXPECT_TRUE(expr);                       \
+        if (!(expr)) { return ret; }             \
+    } while (0)
+
+static std::string write_records_to_file(butil::FilePath* path) {
+    StringWriter sw;
+    butil::RecordWriter rw(&sw);
+    butil::Record src;
+    ASSERT_TRUE_RET(0 == rw.Write(src), "");
+    src.MutableMeta("foo")->append("foo_data");
+    ASSERT_TRUE_RET(0 == rw.Write(src), "");
+    src.MutableMeta("bar")->append("bar_data");
+    src.MutablePayload()->append("payload_data");
+    ASSERT_TRUE_RET(0 == rw.Write(src), "");
+    ASSERT_TRUE_RET(0 == rw.Flush(), "");
+    ASSERT_TRUE_RET(butil::CreateTemporaryFile(path), "");
+    ASSERT_TRUE_RET(butil::WriteFile(*path, sw.str().data(), sw.str().size())
+                    == (int)sw.str().size(), "");
+    return sw.str();
+}
+
+TEST(RecordIOTest, mmap_reader_basic) {
+    butil::FilePath path;
+    const std::string str = write_records_to_file(&path);
+    ASSERT_FALSE(str.empty());
+
+    butil::MemoryMappedRecordReader rd;
+    ASSERT_EQ(0, rd.Open(path.value().c_str()));
+    // Opening twice is an error.
+    ASSERT_EQ(-1, rd.Open(path.value().c_str()));
+
+    butil::MemoryMappedRecordReader::RecordView r;
+    ASSERT_TRUE(rd.ReadNext(&r));
+    ASSERT_EQ(0u, r.MetaCount());
+    ASSERT_TRUE(r.payload.empty());
+
+    ASSERT_TRUE(rd.ReadNext(&r));
+    ASSERT_EQ(1u, r.MetaCount());
+    ASSERT_EQ("foo", r.MetaAt(0).name);
+    ASSERT_EQ("foo_data", r.MetaAt(0).data);
+    ASSERT_TRUE(r.payload.empty());
+
+    ASSERT_TRUE(rd.ReadNext(&r));
+    ASSERT_EQ(2u, r.MetaCount());
+    ASSERT_EQ("foo_data", *r.Meta("foo"));
+    ASSERT_EQ("bar_data", *r.Meta("bar"));
+    ASSERT_TRUE(r.Meta("baz") == NULL);
+    ASSERT_EQ("payload_data", r.payload);
+
+    ASSERT_FALSE(rd.ReadNext(&r));
+    ASSERT_EQ((int)butil::MemoryMappedRecordReader::END_OF_READER,
+              rd.last_error());
+    ASSERT_EQ(str.size(), rd.offset());
+    rd.Close();
+
+    butil::DeleteFile(path, false);
+}
+
+TEST(RecordIOTest, mmap_reader_skips_corruption) {
+    butil::FilePath path;
+    std::string str = write_records_to_file(&path);
+    ASSERT_FALSE(str.empty());
+    // Break the checksum of the first record; the reader must resync on
+    // the second one.
+    ++str[8];
+    ASSERT_EQ((int)str.size(),
+              butil::WriteFile(path, str.data(), str.size()));
+
+    butil::MemoryMappedRecordReader rd;
+    ASSERT_EQ(0, rd.Open(path.value().c_str()));
+    butil::MemoryMappedRecordReader::RecordView r;
+    ASSERT_TRUE(rd.ReadNext(&r));
+    ASSERT_EQ(1u, r.MetaCount());
+    ASSERT_EQ("foo", r.MetaAt(0).name);
+    ASSERT_TRUE(rd.ReadNext(&r));
+    ASSERT_EQ(2u, r.MetaCount());
+    ASSERT_FALSE(rd.ReadNext(&r));
+    ASSERT_EQ((int)butil::MemoryMappedRecordReader::END_OF_READER,
+              rd.last_error());
+
+    butil::DeleteFile(path, false);
+}
+
 } // namespace
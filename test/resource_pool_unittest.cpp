@@ -26,6 +26,8 @@
 namespace {
 struct MyObject {};
 
+struct SpareObj { char dummy[8]; };
+
 int nfoo_dtor = 0;
 struct Foo {
     Foo() {
@@ -51,6 +53,18 @@ template <> struct ResourcePoolFreeChunkMaxItem<MyObject> {
     static size_t value() { return 5; }
 };
 
+template <> struct ResourcePoolBlockMaxItem<SpareObj> {
+    static const size_t value = 4;
+};
+
+template <> struct ResourcePoolFreeChunkMaxItem<SpareObj> {
+    static size_t value() { return 4; }
+};
+
+template <> struct ResourcePoolSpareFreeChunk<SpareObj> {
+    static const bool value = true;
+};
+
 template <> struct ResourcePoolValidator<Foo> {
     static bool validate(const Foo* foo) {
         return foo->x != 0;
@@ -122,6 +136,27 @@ TEST_F(ResourcePoolTest, change_config) {
     std::cout << describe_resources<MyObject>() << std::endl;
 }
 
+TEST_F(ResourcePoolTest, spare_free_chunk) {
+    // With the spare chunk on, a thread caches 2 * free_chunk_nitem()
+    // freed objects locally(8 for SpareObj) and reuses all of them.
+    std::vector<ResourceId<SpareObj> > ids(8);
+    std::set<SpareObj*> ptrs;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        SpareObj* p = get_resource(&ids[i]);
+        ASSERT_TRUE(p);
+        ptrs.insert(p);
+    }
+    ASSERT_EQ(8u, ptrs.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(0, return_resource(ids[i]));
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        SpareObj* p = get_resource(&ids[i]);
+        ASSERT_EQ(1u, ptrs.count(p)) << "i=" << i;
+    }
+    ASSERT_EQ(8u, describe_resources<SpareObj>().item_num);
+}
+
 struct NonDefaultCtorObject {
     explicit NonDefaultCtorObject(int value) : _value(value) {}
     NonDefaultCtorObject(int value, int dummy) : _value(value + dummy) {}
@@ -0,0 +1,141 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <gtest/gtest.h>
+#include "butil/build_config.h"
+#include "butil/shm_ring.h"
+#include "butil/unix_socket.h"
+
+#if defined(OS_LINUX)
+
+namespace {
+
+class ShmRingTest : public ::testing::Test {};
+
+TEST_F(ShmRingTest, push_pop_with_wrap_around) {
+    butil::ShmRing* ring = butil::ShmRing::Create(1);
+    ASSERT_TRUE(ring != NULL);
+    ASSERT_EQ(4096u, ring->capacity());  // rounded up to the minimum
+
+    char out[8192];
+    // Fill the ring completely.
+    std::string data(5000, 'x');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (char)(i * 13 + 5);
+    }
+    ASSERT_EQ(4096u, ring->Push(data.data(), data.size()));
+    ASSERT_EQ(4096u, ring->readable_bytes());
+    ASSERT_EQ(0u, ring->Push(data.data(), 1));  // full
+
+    // Drain a part and push over the wrap-around point.
+    ASSERT_EQ(4000u, ring->Pop(out, 4000));
+    ASSERT_EQ(0, memcmp(out, data.data(), 4000));
+    ASSERT_EQ(904u, ring->Push(data.data() + 4096, 904));
+    ASSERT_EQ(1000u, ring->Pop(out, sizeof(out)));
+    ASSERT_EQ(0, memcmp(out, data.data() + 4000, 1000));
+    ASSERT_EQ(0u, ring->Pop(out, sizeof(out)));  // empty
+    delete ring;
+}
+
+TEST_F(ShmRingTest, attach_sees_the_same_ring) {
+    butil::ShmRing* ring = butil::ShmRing::Create(16384);
+    ASSERT_TRUE(ring != NULL);
+    ASSERT_EQ(16384u, ring->capacity());
+
+    // Hand the fd to the "peer" over a socketpair, as the negotiation over
+    // an unix domain socket would.
+    int socks[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, socks));
+    ASSERT_EQ(0, butil::unix_socket_send_fd(socks[0], ring->fd()));
+    const int peer_fd = butil::unix_socket_recv_fd(socks[1]);
+    ASSERT_GE(peer_fd, 0);
+    ASSERT_NE(peer_fd, ring->fd());
+    butil::ShmRing* peer = butil::ShmRing::Attach(peer_fd);
+    ASSERT_TRUE(peer != NULL);
+    ASSERT_EQ(16384u, peer->capacity());
+
+    const char msg[] = "hello over shared memory";
+    ASSERT_EQ(sizeof(msg), ring->Push(msg, sizeof(msg)));
+    char out[64];
+    ASSERT_EQ(sizeof(msg), peer->Pop(out, sizeof(out)));
+    ASSERT_STREQ(msg, out);
+
+    delete peer;
+    delete ring;
+    close(socks[0]);
+    close(socks[1]);
+}
+
+const size_t NBYTES = 32 * 1024 * 1024;
+
+void* produce_bytes(void* arg) {
+    butil::ShmRing* ring = (butil::ShmRing*)arg;
+    char buf[1000];
+    size_t npushed = 0;
+    while (npushed < NBYTES) {
+        size_t n = std::min(sizeof(buf), NBYTES - npushed);
+        for (size_t i = 0; i < n; ++i) {
+            buf[i] = (char)((npushed + i) * 131 + 17);
+        }
+        size_t off = 0;
+        while (off < n) {
+            const size_t pushed = ring->Push(buf + off, n - off);
+            if (0 == pushed) {
+                EXPECT_EQ(0, ring->WaitForSpace());
+                continue;
+            }
+            off += pushed;
+        }
+        npushed += n;
+    }
+    return NULL;
+}
+
+TEST_F(ShmRingTest, threaded_transfer_with_doorbells) {
+    butil::ShmRing* ring = butil::ShmRing::Create(8192);
+    ASSERT_TRUE(ring != NULL);
+    pthread_t th;
+    ASSERT_EQ(0, pthread_create(&th, NULL, produce_bytes, ring));
+    char buf[4096];
+    size_t npopped = 0;
+    bool mismatched = false;
+    while (npopped < NBYTES) {
+        const size_t popped = ring->Pop(buf, sizeof(buf));
+        if (0 == popped) {
+            ASSERT_EQ(0, ring->WaitForData());
+            continue;
+        }
+        for (size_t i = 0; i < popped && !mismatched; ++i) {
+            mismatched = (buf[i] != (char)((npopped + i) * 131 + 17));
+        }
+        ASSERT_FALSE(mismatched) << "offset=" << npopped;
+        npopped += popped;
+    }
+    ASSERT_EQ(NBYTES, npopped);
+    ASSERT_EQ(0u, ring->readable_bytes());
+    pthread_join(th, NULL);
+    delete ring;
+}
+
+} // namespace
+
+#endif  // OS_LINUX
@@ -0,0 +1,153 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include "butil/string_printf.h"
+#include "butil/containers/swiss_flat_map.h"
+
+namespace {
+
+class SwissFlatMapTest : public ::testing::Test {};
+
+TEST_F(SwissFlatMapTest, basic_ops) {
+    butil::SwissFlatMap<uint64_t, uint64_t> m;
+    ASSERT_FALSE(m.initialized());
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(NULL, m.seek(1));
+
+    uint64_t* p = m.insert(1, 10);
+    ASSERT_TRUE(p != NULL);
+    ASSERT_EQ(10u, *p);
+    ASSERT_TRUE(m.initialized());
+    ASSERT_EQ(1u, m.size());
+    ASSERT_EQ(p, m.seek(1));
+
+    // insert overwrites.
+    ASSERT_TRUE(m.insert(1, 11) != NULL);
+    ASSERT_EQ(11u, *m.seek(1));
+    ASSERT_EQ(1u, m.size());
+
+    // operator[] inserts zeroized values.
+    ASSERT_EQ(0u, m[2]);
+    m[2] = 20;
+    ASSERT_EQ(20u, *m.seek(2));
+    ASSERT_EQ(2u, m.size());
+
+    uint64_t old = 0;
+    ASSERT_EQ(1u, m.erase(1, &old));
+    ASSERT_EQ(11u, old);
+    ASSERT_EQ(NULL, m.seek(1));
+    ASSERT_EQ(0u, m.erase(1));
+    ASSERT_EQ(1u, m.size());
+
+    m.clear();
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(NULL, m.seek(2));
+}
+
+TEST_F(SwissFlatMapTest, random_ops_against_unordered_map) {
+    butil::SwissFlatMap<uint64_t, uint64_t> m;
+    ASSERT_EQ(0, m.init(32));
+    std::unordered_map<uint64_t, uint64_t> ref;
+    srand(0);
+    for (int i = 0; i < 200000; ++i) {
+        const uint64_t key = rand() % 3000;
+        switch (rand() % 4) {
+        case 0:
+        case 1: {
+            const uint64_t val = rand();
+            ASSERT_TRUE(m.insert(key, val) != NULL);
+            ref[key] = val;
+            break;
+        }
+        case 2:
+            ASSERT_EQ(ref.erase(key), m.erase(key));
+            break;
+        default: {
+            uint64_t* p = m.seek(key);
+            auto it = ref.find(key);
+            if (it != ref.end()) {
+                ASSERT_TRUE(p != NULL);
+                ASSERT_EQ(it->second, *p);
+            } else {
+                ASSERT_EQ(NULL, p);
+            }
+        }
+        }
+        ASSERT_EQ(ref.size(), m.size());
+    }
+    size_t n = 0;
+    for (auto it = m.begin(); it != m.end(); ++it, ++n) {
+        auto rit = ref.find(it->first);
+        ASSERT_TRUE(rit != ref.end());
+        ASSERT_EQ(rit->second, it->second);
+    }
+    ASSERT_EQ(ref.size(), n);
+}
+
+TEST_F(SwissFlatMapTest, string_keys_and_heterogeneous_seek) {
+    butil::SwissFlatMap<std::string, int> m;
+    ASSERT_EQ(0, m.init(64));
+    for (int i = 0; i < 1000; ++i) {
+        m[butil::string_printf("/pkg.Service/Method%d", i)] = i;
+    }
+    ASSERT_EQ(1000u, m.size());
+    ASSERT_EQ(567, *m.seek("/pkg.Service/Method567"));
+    ASSERT_EQ(567, *m.seek(butil::StringPiece("/pkg.Service/Method567")));
+    ASSERT_EQ(567, *m.seek(std::string("/pkg.Service/Method567")));
+    ASSERT_EQ(NULL, m.seek("/pkg.Service/NoSuchMethod"));
+    ASSERT_EQ(1u, m.erase(butil::StringPiece("/pkg.Service/Method567")));
+    ASSERT_EQ(NULL, m.seek("/pkg.Service/Method567"));
+}
+
+TEST_F(SwissFlatMapTest, copy_and_swap) {
+    butil::SwissFlatMap<int, int> m1;
+    for (int i = 0; i < 100; ++i) {
+        m1[i] = i * 3;
+    }
+    butil::SwissFlatMap<int, int> m2 = m1;
+    ASSERT_EQ(m1.size(), m2.size());
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(i * 3, *m2.seek(i));
+    }
+    butil::SwissFlatMap<int, int> m3;
+    m3[1000] = 1;
+    m3.swap(m2);
+    ASSERT_EQ(100u, m3.size());
+    ASSERT_EQ(1u, m2.size());
+    ASSERT_EQ(1, *m2.seek(1000));
+    m3 = m2;
+    ASSERT_EQ(1u, m3.size());
+}
+
+TEST_F(SwissFlatMapTest, erase_heavy_churn_does_not_grow) {
+    butil::SwissFlatMap<uint64_t, uint64_t> m;
+    ASSERT_EQ(0, m.init(32));
+    for (uint64_t i = 0; i < 1000000; ++i) {
+        ASSERT_TRUE(m.insert(i, i) != NULL);
+        ASSERT_EQ(1u, m.erase(i));
+    }
+    ASSERT_TRUE(m.empty());
+    // Tombstones are reclaimed by same-sized rehashes instead of doublings.
+    ASSERT_LE(m.bucket_count(), 64u);
+}
+
+} // namespace
@@ -64,6 +64,20 @@ void InfoThread::run() {
                (int)(cur_error_count - last_error_count),
                (long long)cur_error_count,
                (long long)cur_sent_count);
+        if (_options.latency_csv) {
+            fprintf(_options.latency_csv,
+                    "%lld,%d,%d,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                    (long long)tm_s,
+                    (int)(cur_succ_count - last_succ_count),
+                    (int)(cur_error_count - last_error_count),
+                    (long long)_options.latency_recorder->latency(),
+                    (long long)_options.latency_recorder->latency_percentile(0.5),
+                    (long long)_options.latency_recorder->latency_percentile(0.9),
+                    (long long)_options.latency_recorder->latency_percentile(0.99),
+                    (long long)_options.latency_recorder->latency_percentile(0.999),
+                    (long long)_options.latency_recorder->max_latency());
+            fflush(_options.latency_csv);
+        }
         last_sent_count = cur_sent_count;
         last_succ_count = cur_succ_count;
         last_error_count = cur_error_count;
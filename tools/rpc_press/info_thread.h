@@ -19,6 +19,7 @@
 #define BRPC_RPC_REPLAY_INFO_THREAD_H
 
 #include <pthread.h>
+#include <stdio.h>
 #include <bvar/bvar.h>
 
 namespace brpc {
@@ -27,11 +28,15 @@ struct InfoThreadOptions {
     bvar::LatencyRecorder* latency_recorder;
     bvar::Adder<int64_t>* sent_count;
     bvar::Adder<int64_t>* error_count;
+    // When non-NULL, a CSV line of per-second qps and latency percentiles
+    // is appended each second (latency-over-time). Not owned.
+    FILE* latency_csv;
 
     InfoThreadOptions()
         : latency_recorder(NULL)
         , sent_count(NULL)
-        , error_count(NULL) {}
+        , error_count(NULL)
+        , latency_csv(NULL) {}
 };
 
 class InfoThread {
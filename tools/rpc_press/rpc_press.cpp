@@ -44,6 +44,11 @@ DEFINE_int32(attachment_size, 0, "Carry so many byte attachment along with reque
 DEFINE_int32(duration, 0, "how many seconds the press keep");
 DEFINE_int32(qps, 100 , "how many calls  per seconds");
 DEFINE_bool(pretty, true, "output pretty jsons");
+DEFINE_bool(open_loop, false, "Send requests at -qps on a fixed schedule"
+            " regardless of completions and measure latency from the"
+            " intended send time, avoiding coordinated omission");
+DEFINE_string(latency_over_time, "", "Append a CSV line of per-second qps"
+              " and latency percentiles to this file");
 
 bool set_press_options(pbrpcframework::PressOptions* options){
     size_t dot_pos = FLAGS_method.find_last_of('.');
@@ -92,6 +97,12 @@ bool set_press_options(pbrpcframework::PressOptions* options){
     options->host = FLAGS_server;
     options->proto_file = FLAGS_proto;
     options->proto_includes = FLAGS_inc;
+    options->open_loop = FLAGS_open_loop;
+    options->latency_over_time = FLAGS_latency_over_time;
+    if (options->open_loop && FLAGS_qps <= 0) {
+        LOG(ERROR) << "-open_loop requires a positive -qps";
+        return false;
+    }
     return true;
 }
 
@@ -95,7 +95,8 @@ RpcPress::RpcPress()
     : _pbrpc_client(NULL)
     , _started(false)
     , _stop(false)
-    , _output_json(NULL) {
+    , _output_json(NULL)
+    , _latency_csv(NULL) {
 }
 
 RpcPress::~RpcPress() {
@@ -103,6 +104,10 @@ RpcPress::~RpcPress() {
         fclose(_output_json);
         _output_json = NULL;
     }
+    if (_latency_csv) {
+        fclose(_latency_csv);
+        _latency_csv = NULL;
+    }
     delete _importer;
 }
 
@@ -153,6 +158,20 @@ int RpcPress::init(const PressOptions* options) {
         LOG_IF(ERROR, !_output_json) << "Fail to open " << _options.output;
     }
 
+    if (_options.open_loop && _options.test_req_rate <= 0) {
+        LOG(ERROR) << "-open_loop requires a positive -qps";
+        return -1;
+    }
+    if (!_options.latency_over_time.empty()) {
+        _latency_csv = fopen(_options.latency_over_time.c_str(), "w");
+        if (NULL == _latency_csv) {
+            LOG(ERROR) << "Fail to open " << _options.latency_over_time;
+            return -1;
+        }
+        fprintf(_latency_csv, "time,success,error,avg_us,p50_us,p90_us,"
+                "p99_us,p999_us,max_us\n");
+    }
+
     int ret = _pbrpc_client->init();
     if (0 != ret) {
         LOG(ERROR) << "Fail to initialize rpc client";
@@ -190,6 +209,11 @@ void* RpcPress::sync_call_thread(void* arg) {
     return NULL;
 }
 
+void* RpcPress::open_loop_call_thread(void* arg) {
+    ((RpcPress*)arg)->open_loop_client();
+    return NULL;
+}
+
 void RpcPress::handle_response(brpc::Controller* cntl, 
                                Message* request,
                                Message* response, 
@@ -263,11 +287,57 @@ void RpcPress::sync_client() {
     }
 }
 
+void RpcPress::open_loop_client() {
+    const double req_rate = _options.test_req_rate / _options.test_thread_num;
+    if (_msgs.empty()) {
+        LOG(ERROR) << "nothing to send!";
+        return;
+    }
+    const int thread_index = g_thread_count.fetch_add(1, butil::memory_order_relaxed);
+    int msg_index = thread_index;
+    const int64_t interval = (int64_t)(1000000000L / req_rate);
+    // The schedule is fixed at start: the k-th request is due at
+    // first_deadline + k * interval no matter how the previous ones went.
+    // When the sender falls behind (e.g. a stalled target backs up the
+    // connection) the overdue requests are issued immediately and their
+    // latencies, measured from the intended send time, include the wait.
+    const int64_t first_deadline = butil::monotonic_time_ns() + interval;
+    for (int64_t k = 0; !_stop; ++k) {
+        const int64_t deadline_ns = first_deadline + k * interval;
+        const int64_t early_ns = deadline_ns - butil::monotonic_time_ns();
+        if (early_ns > 0) {
+            usleep(early_ns / 1000);
+        }
+        msg_index = (msg_index + _options.test_thread_num) % _msgs.size();
+        Message* request = _msgs[msg_index];
+        Message* response = _pbrpc_client->get_output_message();
+        brpc::Controller* cntl = new brpc::Controller;
+        // The intended send time in wall-clock us, as handle_response
+        // subtracts it from gettimeofday_us().
+        const int64_t intended_time = butil::gettimeofday_us() -
+            std::max(butil::monotonic_time_ns() - deadline_ns, (int64_t)0) / 1000;
+        google::protobuf::Closure* done = brpc::NewCallback<
+            RpcPress,
+            RpcPress*,
+            brpc::Controller*,
+            Message*,
+            Message*, int64_t>
+            (this, &RpcPress::handle_response, cntl, request, response,
+             intended_time);
+        _pbrpc_client->call_method(cntl, request, response, done);
+        _sent_count << 1;
+        // Never join the call: completions must not throttle the offered
+        // load.
+    }
+}
+
 int RpcPress::start() {
     _ttid.resize(_options.test_thread_num);
     int ret = 0;
+    void* (*call_thread)(void*) =
+        _options.open_loop ? open_loop_call_thread : sync_call_thread;
     for (int i = 0; i < _options.test_thread_num; i++) {
-        if ((ret = pthread_create(&_ttid[i], NULL, sync_call_thread, this)) != 0) {
+        if ((ret = pthread_create(&_ttid[i], NULL, call_thread, this)) != 0) {
             LOG(ERROR) << "Fail to create sending threads";
             return -1;
         }
@@ -276,6 +346,7 @@ int RpcPress::start() {
     info_thr_opt.latency_recorder = &_latency_recorder;
     info_thr_opt.error_count = &_error_count;
     info_thr_opt.sent_count = &_sent_count;
+    info_thr_opt.latency_csv = _latency_csv;
     if (!_info_thr.start(info_thr_opt)) {
         LOG(ERROR) << "Fail to create stats thread";
         return -1;
@@ -56,7 +56,14 @@ struct PressOptions {
     std::string lb_policy; // "rr", "Policy of load balance rr ||random"
     std::string proto_file;
     std::string proto_includes;
-    
+    // Send at test_req_rate on an absolute schedule regardless of
+    // completions and measure latency from the intended send time, which
+    // avoids coordinated omission: a stalled server keeps receiving the
+    // offered load and the stall shows up in the tail latencies.
+    bool open_loop;
+    // Write a per-second CSV of qps and latency percentiles to this file.
+    std::string latency_over_time;
+
     PressOptions() :
         server_type(0),
         test_req_rate(0),
@@ -67,7 +74,8 @@ struct PressOptions {
         request_compress_type(0),
         response_compress_type(0),
         attachment_size(0),
-        auth(false)
+        auth(false),
+        open_loop(false)
     {}
 };
 
@@ -117,11 +125,13 @@ private:
     
     bool new_pbrpc_press_client_by_client_type(int client_type);
     void sync_client();
+    void open_loop_client();
     void handle_response(brpc::Controller* cntl,
                          google::protobuf::Message* request,
                          google::protobuf::Message* response,
                          int64_t start_time_ns);
     static void* sync_call_thread(void* arg);
+    static void* open_loop_call_thread(void* arg);
 
     bvar::LatencyRecorder _latency_recorder;
     bvar::Adder<int64_t> _error_count;
@@ -132,6 +142,7 @@ private:
     bool _started;
     bool _stop;
     FILE* _output_json;
+    FILE* _latency_csv;
     google::protobuf::compiler::Importer* _importer;
     google::protobuf::DynamicMessageFactory _factory;
     std::vector<pthread_t> _ttid;